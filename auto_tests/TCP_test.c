@@ -29,10 +29,11 @@ uint16_t ports[NUM_PORTS] = {1234, 33445, 25643};
 
 START_TEST(test_basic)
 {
+    Mono_Time *mono_time = new_mono_time(NULL);
     uint8_t self_public_key[crypto_box_PUBLICKEYBYTES];
     uint8_t self_secret_key[crypto_box_SECRETKEYBYTES];
     crypto_box_keypair(self_public_key, self_secret_key);
-    TCP_Server *tcp_s = new_TCP_server(1, NUM_PORTS, ports, self_secret_key, NULL);
+    TCP_Server *tcp_s = new_TCP_server(mono_time, 1, NUM_PORTS, ports, self_secret_key, NULL);
     ck_assert_msg(tcp_s != NULL, "Failed to create TCP relay server");
     ck_assert_msg(tcp_s->num_listening_socks == NUM_PORTS, "Failed to bind to all ports");
 
@@ -119,6 +120,7 @@ START_TEST(test_basic)
     ck_assert_msg(packet_resp_plain[1] == 0, "connection not refused %u", packet_resp_plain[1]);
     ck_assert_msg(memcmp(packet_resp_plain + 2, f_public_key, crypto_box_PUBLICKEYBYTES) == 0, "key in packet wrong");
     kill_TCP_server(tcp_s);
+    kill_mono_time(mono_time);
 }
 END_TEST
 
@@ -211,10 +213,11 @@ int read_packet_sec_TCP(struct sec_TCP_con *con, uint8_t *data, uint16_t length)
 
 START_TEST(test_some)
 {
+    Mono_Time *mono_time = new_mono_time(NULL);
     uint8_t self_public_key[crypto_box_PUBLICKEYBYTES];
     uint8_t self_secret_key[crypto_box_SECRETKEYBYTES];
     crypto_box_keypair(self_public_key, self_secret_key);
-    TCP_Server *tcp_s = new_TCP_server(1, NUM_PORTS, ports, self_secret_key, NULL);
+    TCP_Server *tcp_s = new_TCP_server(mono_time, 1, NUM_PORTS, ports, self_secret_key, NULL);
     ck_assert_msg(tcp_s != NULL, "Failed to create TCP relay server");
     ck_assert_msg(tcp_s->num_listening_socks == NUM_PORTS, "Failed to bind to all ports");
 
@@ -301,6 +304,7 @@ START_TEST(test_some)
     kill_TCP_con(con1);
     kill_TCP_con(con2);
     kill_TCP_con(con3);
+    kill_mono_time(mono_time);
 }
 END_TEST
 
@@ -376,11 +380,11 @@ static int oob_data_callback(void *object, const uint8_t *public_key, const uint
 
 START_TEST(test_client)
 {
-    unix_time_update();
+    Mono_Time *mono_time = new_mono_time(NULL);
     uint8_t self_public_key[crypto_box_PUBLICKEYBYTES];
     uint8_t self_secret_key[crypto_box_SECRETKEYBYTES];
     crypto_box_keypair(self_public_key, self_secret_key);
-    TCP_Server *tcp_s = new_TCP_server(1, NUM_PORTS, ports, self_secret_key, NULL);
+    TCP_Server *tcp_s = new_TCP_server(mono_time, 1, NUM_PORTS, ports, self_secret_key, NULL);
     ck_assert_msg(tcp_s != NULL, "Failed to create TCP relay server");
     ck_assert_msg(tcp_s->num_listening_socks == NUM_PORTS, "Failed to bind to all ports");
 
@@ -392,7 +396,8 @@ START_TEST(test_client)
     ip_port_tcp_s.port = htons(ports[rand() % NUM_PORTS]);
     ip_port_tcp_s.ip.family = AF_INET6;
     ip_port_tcp_s.ip.ip6.in6_addr = in6addr_loopback;
-    TCP_Client_Connection *conn = new_TCP_connection(ip_port_tcp_s, self_public_key, f_public_key, f_secret_key, 0);
+    TCP_Client_Connection *conn = new_TCP_connection(mono_time, ip_port_tcp_s, self_public_key, f_public_key,
+                                                     f_secret_key, 0);
     c_sleep(50);
     do_TCP_connection(conn);
     ck_assert_msg(conn->status == TCP_CLIENT_UNCONFIRMED, "Wrong status. Expected: %u, is: %u", TCP_CLIENT_UNCONFIRMED,
@@ -420,7 +425,8 @@ START_TEST(test_client)
     uint8_t f2_secret_key[crypto_box_SECRETKEYBYTES];
     crypto_box_keypair(f2_public_key, f2_secret_key);
     ip_port_tcp_s.port = htons(ports[rand() % NUM_PORTS]);
-    TCP_Client_Connection *conn2 = new_TCP_connection(ip_port_tcp_s, self_public_key, f2_public_key, f2_secret_key, 0);
+    TCP_Client_Connection *conn2 = new_TCP_connection(mono_time, ip_port_tcp_s, self_public_key, f2_public_key,
+                                                      f2_secret_key, 0);
     routing_response_handler(conn, response_callback, ((void *)conn) + 2);
     routing_status_handler(conn, status_callback, (void *)2);
     routing_data_handler(conn, data_callback, (void *)3);
@@ -472,12 +478,13 @@ START_TEST(test_client)
     kill_TCP_server(tcp_s);
     kill_TCP_connection(conn);
     kill_TCP_connection(conn2);
+    kill_mono_time(mono_time);
 }
 END_TEST
 
 START_TEST(test_client_invalid)
 {
-    unix_time_update();
+    Mono_Time *mono_time = new_mono_time(NULL);
     uint8_t self_public_key[crypto_box_PUBLICKEYBYTES];
     uint8_t self_secret_key[crypto_box_SECRETKEYBYTES];
     crypto_box_keypair(self_public_key, self_secret_key);
@@ -490,7 +497,8 @@ START_TEST(test_client_invalid)
     ip_port_tcp_s.port = htons(ports[rand() % NUM_PORTS]);
     ip_port_tcp_s.ip.family = AF_INET6;
     ip_port_tcp_s.ip.ip6.in6_addr = in6addr_loopback;
-    TCP_Client_Connection *conn = new_TCP_connection(ip_port_tcp_s, self_public_key, f_public_key, f_secret_key, 0);
+    TCP_Client_Connection *conn = new_TCP_connection(mono_time, ip_port_tcp_s, self_public_key, f_public_key,
+                                                     f_secret_key, 0);
     c_sleep(50);
     do_TCP_connection(conn);
     ck_assert_msg(conn->status == TCP_CLIENT_CONNECTING, "Wrong status. Expected: %u, is: %u", TCP_CLIENT_CONNECTING,
@@ -505,6 +513,7 @@ START_TEST(test_client_invalid)
                   conn->status);
 
     kill_TCP_connection(conn);
+    kill_mono_time(mono_time);
 }
 END_TEST
 
@@ -533,21 +542,21 @@ static int tcp_data_callback(void *object, int id, const uint8_t *data, uint16_t
 START_TEST(test_tcp_connection)
 {
     tcp_data_callback_called = 0;
-    unix_time_update();
+    Mono_Time *mono_time = new_mono_time(NULL);
     uint8_t self_public_key[crypto_box_PUBLICKEYBYTES];
     uint8_t self_secret_key[crypto_box_SECRETKEYBYTES];
     crypto_box_keypair(self_public_key, self_secret_key);
-    TCP_Server *tcp_s = new_TCP_server(1, NUM_PORTS, ports, self_secret_key, NULL);
+    TCP_Server *tcp_s = new_TCP_server(mono_time, 1, NUM_PORTS, ports, self_secret_key, NULL);
     ck_assert_msg(memcmp(tcp_s->public_key, self_public_key, crypto_box_PUBLICKEYBYTES) == 0, "Wrong public key");
 
     TCP_Proxy_Info proxy_info;
     proxy_info.proxy_type = TCP_PROXY_NONE;
     crypto_box_keypair(self_public_key, self_secret_key);
-    TCP_Connections *tc_1 = new_tcp_connections(self_secret_key, &proxy_info);
+    TCP_Connections *tc_1 = new_tcp_connections(mono_time, self_secret_key, &proxy_info);
     ck_assert_msg(memcmp(tc_1->self_public_key, self_public_key, crypto_box_PUBLICKEYBYTES) == 0, "Wrong public key");
 
     crypto_box_keypair(self_public_key, self_secret_key);
-    TCP_Connections *tc_2 = new_tcp_connections(self_secret_key, &proxy_info);
+    TCP_Connections *tc_2 = new_tcp_connections(mono_time, self_secret_key, &proxy_info);
     ck_assert_msg(memcmp(tc_2->self_public_key, self_public_key, crypto_box_PUBLICKEYBYTES) == 0, "Wrong public key");
 
     IP_Port ip_port_tcp_s;
@@ -612,6 +621,7 @@ START_TEST(test_tcp_connection)
     kill_TCP_server(tcp_s);
     kill_tcp_connections(tc_1);
     kill_tcp_connections(tc_2);
+    kill_mono_time(mono_time);
 }
 END_TEST
 
@@ -636,21 +646,21 @@ START_TEST(test_tcp_connection2)
     tcp_oobdata_callback_called = 0;
     tcp_data_callback_called = 0;
 
-    unix_time_update();
+    Mono_Time *mono_time = new_mono_time(NULL);
     uint8_t self_public_key[crypto_box_PUBLICKEYBYTES];
     uint8_t self_secret_key[crypto_box_SECRETKEYBYTES];
     crypto_box_keypair(self_public_key, self_secret_key);
-    TCP_Server *tcp_s = new_TCP_server(1, NUM_PORTS, ports, self_secret_key, NULL);
+    TCP_Server *tcp_s = new_TCP_server(mono_time, 1, NUM_PORTS, ports, self_secret_key, NULL);
     ck_assert_msg(memcmp(tcp_s->public_key, self_public_key, crypto_box_PUBLICKEYBYTES) == 0, "Wrong public key");
 
     TCP_Proxy_Info proxy_info;
     proxy_info.proxy_type = TCP_PROXY_NONE;
     crypto_box_keypair(self_public_key, self_secret_key);
-    TCP_Connections *tc_1 = new_tcp_connections(self_secret_key, &proxy_info);
+    TCP_Connections *tc_1 = new_tcp_connections(mono_time, self_secret_key, &proxy_info);
     ck_assert_msg(memcmp(tc_1->self_public_key, self_public_key, crypto_box_PUBLICKEYBYTES) == 0, "Wrong public key");
 
     crypto_box_keypair(self_public_key, self_secret_key);
-    TCP_Connections *tc_2 = new_tcp_connections(self_secret_key, &proxy_info);
+    TCP_Connections *tc_2 = new_tcp_connections(mono_time, self_secret_key, &proxy_info);
     ck_assert_msg(memcmp(tc_2->self_public_key, self_public_key, crypto_box_PUBLICKEYBYTES) == 0, "Wrong public key");
 
     IP_Port ip_port_tcp_s;
@@ -709,6 +719,45 @@ START_TEST(test_tcp_connection2)
     kill_TCP_server(tcp_s);
     kill_tcp_connections(tc_1);
     kill_tcp_connections(tc_2);
+    kill_mono_time(mono_time);
+}
+END_TEST
+
+START_TEST(test_tcp_connection_share)
+{
+    Mono_Time *mono_time = new_mono_time(NULL);
+    TCP_Proxy_Info proxy_info;
+    proxy_info.proxy_type = TCP_PROXY_NONE;
+    uint8_t self_public_key[crypto_box_PUBLICKEYBYTES];
+    uint8_t self_secret_key[crypto_box_SECRETKEYBYTES];
+    crypto_box_keypair(self_public_key, self_secret_key);
+    TCP_Connections *tc = new_tcp_connections(mono_time, self_secret_key, &proxy_info);
+
+    uint8_t peer_public_key[crypto_box_PUBLICKEYBYTES];
+    crypto_box_keypair(peer_public_key, self_secret_key);
+
+    int connection = share_tcp_connection_to(tc, peer_public_key, 123);
+    ck_assert_msg(connection != -1, "Failed to share connection");
+    ck_assert_msg(share_tcp_connection_to(tc, peer_public_key, 123) == connection, "Second user got another connection");
+    ck_assert_msg(new_tcp_connection_to(tc, peer_public_key, 123) == -1, "Managed to readd shared connection");
+
+    /* The connection sleeps only once none of its users use it */
+    ck_assert_msg(use_tcp_connection_to(tc, connection, 0) == 0, "Failed to stop using connection");
+    ck_assert_msg(tc->connections[connection].status == TCP_CONN_VALID, "Connection slept while in use");
+    ck_assert_msg(use_tcp_connection_to(tc, connection, 0) == 0, "Failed to stop using connection");
+    ck_assert_msg(tc->connections[connection].status == TCP_CONN_SLEEPING, "Unused connection didn't sleep");
+    ck_assert_msg(use_tcp_connection_to(tc, connection, 0) == -1, "Stopped using connection no one used");
+    ck_assert_msg(use_tcp_connection_to(tc, connection, 1) == 0, "Failed to use connection");
+    ck_assert_msg(tc->connections[connection].status == TCP_CONN_VALID, "Used connection still sleeping");
+
+    /* It goes away with its last user */
+    ck_assert_msg(release_tcp_connection_to(tc, connection, 1) == 0, "Failed to release connection");
+    ck_assert_msg(tc->connections[connection].status == TCP_CONN_SLEEPING, "Connection used after its user left");
+    ck_assert_msg(release_tcp_connection_to(tc, connection, 0) == 0, "Failed to release connection");
+    ck_assert_msg(tc->connections_length == 0, "Connection left after its last user");
+
+    kill_tcp_connections(tc);
+    kill_mono_time(mono_time);
 }
 END_TEST
 
@@ -722,6 +771,7 @@ Suite *TCP_suite(void)
     DEFTESTCASE_SLOW(client_invalid, 15);
     DEFTESTCASE_SLOW(tcp_connection, 20);
     DEFTESTCASE_SLOW(tcp_connection2, 20);
+    DEFTESTCASE(tcp_connection_share);
     return s;
 }
 
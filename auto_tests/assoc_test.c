@@ -18,12 +18,13 @@
 START_TEST(test_basics)
 {
     /* TODO: real test */
+    Mono_Time *mono_time = new_mono_time(NULL);
     uint8_t id[CLIENT_ID_SIZE];
-    Assoc *assoc = new_Assoc_default(id);
+    Assoc *assoc = new_Assoc_default(mono_time, id);
     ck_assert_msg(assoc != NULL, "failed to create default assoc");
 
     kill_Assoc(assoc);
-    assoc = new_Assoc(17, 4, id); /* results in an assoc of 16/3 */
+    assoc = new_Assoc(mono_time, 17, 4, id); /* results in an assoc of 16/3 */
     ck_assert_msg(assoc != NULL, "failed to create customized assoc");
 
     IP_Port ipp;
@@ -33,7 +34,7 @@ START_TEST(test_basics)
 
     IPPTs ippts_send;
     ippts_send.ip_port = ipp;
-    ippts_send.timestamp = unix_time();
+    ippts_send.timestamp = unix_time(mono_time);
     IP_Port ipp_recv = ipp;
 
     uint8_t res = Assoc_add_entry(assoc, id, &ippts_send, &ipp_recv, 0);
@@ -56,12 +57,14 @@ START_TEST(test_basics)
     uint8_t found = Assoc_get_close_entries(assoc, &close_entries);
     ck_assert_msg(found == 1, "get_close_entries(): expected %u, got %u", 1, found);
     kill_Assoc(assoc);
+    kill_mono_time(mono_time);
 }
 END_TEST
 
 START_TEST(test_fillup)
 {
     /* TODO: real test */
+    Mono_Time *mono_time = new_mono_time(NULL);
     int i, j;
     uint8_t id[CLIENT_ID_SIZE];
     //uint32_t a = current_time();
@@ -72,7 +75,7 @@ START_TEST(test_fillup)
         id[i] = rand();
     }
 
-    Assoc *assoc = new_Assoc(6, 15, id);
+    Assoc *assoc = new_Assoc(mono_time, 6, 15, id);
     ck_assert_msg(assoc != NULL, "failed to create default assoc");
     struct entry {
         uint8_t id[CLIENT_ID_SIZE];
@@ -94,7 +97,7 @@ START_TEST(test_fillup)
         ipp.ip.ip4.uint32 = rand();
         ipp.port = rand();
         entries[j].ippts_send.ip_port = ipp;
-        entries[j].ippts_send.timestamp = unix_time();
+        entries[j].ippts_send.timestamp = unix_time(mono_time);
         ipp.ip.ip4.uint32 = rand();
         ipp.port = rand();
         entries[j].ipp_recv = ipp;
@@ -132,6 +135,7 @@ START_TEST(test_fillup)
     ck_assert_msg(good == 8, "Entries found were not the closest ones. Only %u/8 were.", good);
     //printf("good: %u %u %u\n", good, a, ((uint32_t)current_time() - a));
     kill_Assoc(assoc);
+    kill_mono_time(mono_time);
 }
 END_TEST
 
@@ -146,7 +150,6 @@ Suite *Assoc_suite(void)
 
 int main(int argc, char *argv[])
 {
-    unix_time_update();
     Suite *Assoc = Assoc_suite();
     SRunner *test_runner = srunner_create(Assoc);
 
@@ -0,0 +1,465 @@
+/* Tests for the net_crypto congestion control algorithms.
+ *
+ * The algorithms are run against a deterministic emulated network path with a
+ * bottleneck link of configurable bandwidth, queue size, one way delay and random
+ * loss. Time is simulated so every run with the same parameters gives the same
+ * results.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/congestion_control.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+
+#include "helpers.h"
+
+/* Same as MAX_REQUEST_PACKET_INTERVAL in net_crypto.c */
+#define SIM_ACK_INTERVAL (CONGESTION_CONTROL_INTERVAL / 2)
+
+/* Interval between request packets when nothing is being received. */
+#define SIM_IDLE_ACK_INTERVAL 1000
+
+/* Same as MIN_RUN_INTERVAL in Messenger.c */
+#define SIM_MAX_RUN_INTERVAL 50
+
+/* Same as PACKET_RESEND_MULTIPLIER in net_crypto.c */
+#define SIM_RESEND_MULTIPLIER 3
+
+/* Same as CRYPTO_PACKET_BUFFER_SIZE */
+#define SIM_MAX_SEND_QUEUE 16384
+
+#define SIM_RING_SIZE 65536
+#define SIM_NOT_RECEIVED UINT64_MAX
+
+typedef struct {
+    uint32_t bandwidth; /* Bottleneck bandwidth in packets per second. */
+    uint32_t queue_size; /* Max number of packets queued at the bottleneck. */
+    uint32_t delay; /* One way propagation delay in ms. */
+    double loss; /* Probability of a packet being lost after the bottleneck. */
+    uint32_t duration; /* Length of the simulation in ms. */
+    uint32_t seed;
+} Sim_Path;
+
+typedef struct {
+    double goodput; /* Unique packets received per second. */
+    double utilization; /* goodput / bandwidth */
+    double avg_queue_delay; /* Average time in ms packets spent in the bottleneck queue. */
+    uint64_t sent;
+    uint64_t resent;
+    uint64_t received;
+    uint64_t dropped; /* Dropped because the bottleneck queue was full. */
+    uint64_t lost; /* Randomly lost. */
+} Sim_Result;
+
+typedef struct {
+    uint64_t sent_time;
+    uint64_t recv_time;
+    _Bool acked;
+    _Bool requested;
+    _Bool in_resend_queue;
+} Sim_Packet;
+
+typedef struct {
+    uint32_t seq;
+    uint64_t arrival_time;
+} Sim_Flight;
+
+typedef struct {
+    uint64_t generated;
+    uint64_t arrival_time;
+    uint32_t highest; /* One past the highest packet number received. */
+} Sim_Ack;
+
+static uint32_t sim_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void sim_send(const Sim_Path *path, Sim_Packet *packets, uint32_t seq, uint64_t now, double *link_free,
+                     Sim_Flight *flights, uint32_t *flights_end, uint32_t *rng, Sim_Result *result, double *queue_delay_sum)
+{
+    packets[seq].sent_time = now;
+
+    double service = 1000.0 / path->bandwidth;
+    double backlog = *link_free > now ? *link_free - now : 0;
+
+    if (backlog / service >= path->queue_size) {
+        ++result->dropped;
+        return;
+    }
+
+    double start = *link_free > now ? *link_free : now;
+    *link_free = start + service;
+    *queue_delay_sum += start - now;
+
+    if ((sim_random(rng) / 4294967296.0) < path->loss) {
+        ++result->lost;
+        return;
+    }
+
+    Sim_Flight *flight = &flights[*flights_end % SIM_RING_SIZE];
+    flight->seq = seq;
+    flight->arrival_time = (uint64_t)(*link_free + 0.5) + path->delay;
+    ++*flights_end;
+}
+
+/* Run one bulk transfer over path using the congestion control algorithm type.
+ */
+static void run_sim(CONGESTION_CONTROL_TYPE type, const Sim_Path *path, Sim_Result *result)
+{
+    uint32_t capacity = ((uint64_t)path->bandwidth * path->duration) / 1000 * 4 + SIM_MAX_SEND_QUEUE;
+    Sim_Packet *packets = calloc(capacity, sizeof(Sim_Packet));
+    Sim_Flight *flights = calloc(SIM_RING_SIZE, sizeof(Sim_Flight));
+    Sim_Ack *acks = calloc(SIM_RING_SIZE, sizeof(Sim_Ack));
+    uint32_t *resend_queue = calloc(SIM_RING_SIZE, sizeof(uint32_t));
+    ck_assert(packets && flights && acks && resend_queue);
+
+    memset(result, 0, sizeof(Sim_Result));
+
+    uint32_t i;
+
+    for (i = 0; i < capacity; ++i) {
+        packets[i].recv_time = SIM_NOT_RECEIVED;
+    }
+
+    Congestion_Control cc;
+    uint64_t now = 1000;
+    ck_assert(congestion_control_init(&cc, type, now) == 0);
+
+    uint32_t rng = path->seed ? path->seed : 1;
+    uint32_t packets_left = CONGESTION_MIN_QUEUE_LENGTH;
+    uint32_t next_seq = 0, send_start = 0, recv_highest = 0;
+    uint32_t flights_start = 0, flights_end = 0, acks_start = 0, acks_end = 0, resend_start = 0, resend_end = 0;
+    uint64_t last_update = now, last_ack_sent = now, last_recv = 0, next_iteration = now;
+    uint64_t rtt_time = CONGESTION_INITIAL_RTT;
+    double link_free = 0, queue_delay_sum = 0;
+    uint64_t end = now + path->duration;
+
+    for (; now < end; ++now) {
+        /* Packets arriving at the receiver. */
+        while (flights_start != flights_end && flights[flights_start % SIM_RING_SIZE].arrival_time <= now) {
+            uint32_t seq = flights[flights_start % SIM_RING_SIZE].seq;
+            ++flights_start;
+
+            if (packets[seq].recv_time == SIM_NOT_RECEIVED) {
+                packets[seq].recv_time = now;
+                ++result->received;
+            }
+
+            if (seq + 1 > recv_highest)
+                recv_highest = seq + 1;
+
+            last_recv = now;
+        }
+
+        /* Receiver sends request packets. */
+        uint64_t ack_interval = last_recv + SIM_ACK_INTERVAL > now ? SIM_ACK_INTERVAL : SIM_IDLE_ACK_INTERVAL;
+
+        if (last_ack_sent + ack_interval <= now) {
+            Sim_Ack *ack = &acks[acks_end % SIM_RING_SIZE];
+            ack->generated = now;
+            ack->arrival_time = now + path->delay;
+            ack->highest = recv_highest;
+            ++acks_end;
+            last_ack_sent = now;
+        }
+
+        /* The sender only runs when tox_iterate() would be called. */
+        if (now < next_iteration)
+            continue;
+
+        /* Request packets arriving at the sender. */
+        while (acks_start != acks_end && acks[acks_start % SIM_RING_SIZE].arrival_time <= now) {
+            const Sim_Ack *ack = &acks[acks_start % SIM_RING_SIZE];
+            ++acks_start;
+
+            uint32_t num_acked = 0, num_lost = 0;
+            uint64_t latest_acked_time = 0;
+            uint32_t seq;
+
+            for (seq = send_start; seq < ack->highest; ++seq) {
+                Sim_Packet *packet = &packets[seq];
+
+                if (packet->acked)
+                    continue;
+
+                if (packet->recv_time <= ack->generated) {
+                    packet->acked = 1;
+                    ++num_acked;
+
+                    if (!packet->requested && packet->sent_time > latest_acked_time)
+                        latest_acked_time = packet->sent_time;
+                } else if (packet->sent_time != 0 && packet->sent_time + rtt_time < now) {
+                    packet->sent_time = 0;
+                    packet->requested = 1;
+                    ++num_lost;
+
+                    if (!packet->in_resend_queue) {
+                        packet->in_resend_queue = 1;
+                        resend_queue[resend_end % SIM_RING_SIZE] = seq;
+                        ++resend_end;
+                    }
+                }
+            }
+
+            while (send_start < next_seq && packets[send_start].acked) {
+                ++send_start;
+            }
+
+            if (latest_acked_time != 0) {
+                uint64_t rtt = now - latest_acked_time;
+
+                if (rtt < rtt_time)
+                    rtt_time = rtt;
+
+                congestion_control_on_rtt_sample(&cc, now, rtt);
+            }
+
+            congestion_control_on_ack(&cc, now, num_acked);
+            congestion_control_on_loss(&cc, now, num_lost);
+        }
+
+        if (last_update + CONGESTION_CONTROL_INTERVAL < now) {
+            congestion_control_update(&cc, now, next_seq - send_start);
+            last_update = now;
+        }
+
+        congestion_control_pace(&cc, now, &packets_left);
+
+        /* Resend requested packets like send_requested_packets() in net_crypto.c, running out of
+         * packets to send while doing that is a congestion event.
+         */
+        uint32_t resend_budget = packets_left * SIM_RESEND_MULTIPLIER, resent = 0;
+
+        while (resent < resend_budget && resend_start != resend_end) {
+            uint32_t seq = resend_queue[resend_start % SIM_RING_SIZE];
+            ++resend_start;
+            packets[seq].in_resend_queue = 0;
+
+            if (packets[seq].acked)
+                continue;
+
+            sim_send(path, packets, seq, now, &link_free, flights, &flights_end, &rng, result, &queue_delay_sum);
+            ++result->resent;
+            ++resent;
+        }
+
+        if (resent < packets_left) {
+            packets_left -= resent;
+        } else {
+            congestion_control_on_congestion_event(&cc, now);
+            packets_left = 0;
+        }
+
+        /* The application fills the send queue with new packets like write_cryptpacket() does. */
+        while (packets_left && next_seq < capacity && next_seq - send_start < SIM_MAX_SEND_QUEUE) {
+            sim_send(path, packets, next_seq, now, &link_free, flights, &flights_end, &rng, result, &queue_delay_sum);
+            ++next_seq;
+            ++result->sent;
+            congestion_control_on_sent(&cc, 1);
+            --packets_left;
+        }
+
+        /* Same as the interval from send_crypto_packets() and messenger_run_interval(). */
+        uint32_t interval = SIM_MAX_RUN_INTERVAL;
+
+        if (cc.send_rate > CONGESTION_MIN_SEND_RATE * 1.5 && (uint32_t)(1000.0 / cc.send_rate) + 1 < interval)
+            interval = (uint32_t)(1000.0 / cc.send_rate) + 1;
+
+        next_iteration = now + interval;
+    }
+
+    result->goodput = (result->received * 1000.0) / path->duration;
+    result->utilization = result->goodput / path->bandwidth;
+
+    uint64_t transmissions = result->sent + result->resent - result->dropped;
+
+    if (transmissions)
+        result->avg_queue_delay = queue_delay_sum / transmissions;
+
+    free(packets);
+    free(flights);
+    free(acks);
+    free(resend_queue);
+}
+
+static void print_result(const char *name, CONGESTION_CONTROL_TYPE type, const Sim_Result *result)
+{
+    printf("%-12s %-8s goodput %7.1f/s utilization %5.3f queue delay %7.1fms sent %llu resent %llu dropped %llu\n",
+           name, congestion_control_name(type), result->goodput, result->utilization, result->avg_queue_delay,
+           (unsigned long long)result->sent, (unsigned long long)result->resent, (unsigned long long)result->dropped);
+}
+
+static const Sim_Path clean_path = {1000, 200, 25, 0.0, 20000, 1};
+static const Sim_Path lossy_long_path = {1000, 400, 150, 0.02, 30000, 2};
+static const Sim_Path deep_buffer_path = {500, 2000, 20, 0.0, 30000, 3};
+
+START_TEST(test_init)
+{
+    Congestion_Control cc;
+
+    ck_assert_msg(congestion_control_init(&cc, CONGESTION_CONTROL_INVALID, 1) == -1, "invalid algorithm accepted");
+    ck_assert_msg(congestion_control_name(CONGESTION_CONTROL_INVALID) == NULL, "invalid algorithm has a name");
+
+    unsigned int i;
+
+    for (i = 0; i < CONGESTION_CONTROL_INVALID; ++i) {
+        ck_assert_msg(congestion_control_init(&cc, i, 1) == 0, "failed to init algorithm %u", i);
+        ck_assert_msg(congestion_control_name(i) != NULL, "algorithm %u has no name", i);
+        ck_assert_msg(cc.send_rate >= CONGESTION_MIN_SEND_RATE, "initial send rate too low");
+
+        uint32_t packets_left = 0;
+        congestion_control_pace(&cc, 1, &packets_left);
+        ck_assert_msg(packets_left != 0, "%s allows no initial packets", congestion_control_name(i));
+    }
+}
+END_TEST
+
+START_TEST(test_rtt_estimation)
+{
+    Congestion_Control cc;
+    congestion_control_init(&cc, CONGESTION_CONTROL_BBR, 1000);
+
+    congestion_control_on_rtt_sample(&cc, 1000, 100);
+    ck_assert_msg(cc.min_rtt == 100 && cc.smoothed_rtt == 100, "first sample not used");
+
+    congestion_control_on_rtt_sample(&cc, 1100, 180);
+    ck_assert_msg(cc.min_rtt == 100, "min_rtt increased");
+    ck_assert_msg(cc.smoothed_rtt == 110, "smoothed rtt %llu != 110", (unsigned long long)cc.smoothed_rtt);
+    ck_assert_msg(cc.latest_rtt == 180, "latest rtt not set");
+
+    congestion_control_on_rtt_sample(&cc, 1200, 80);
+    ck_assert_msg(cc.min_rtt == 80, "min_rtt not lowered");
+
+    /* Once the window expired the next sample replaces min_rtt. */
+    congestion_control_on_rtt_sample(&cc, 1200 + cc.min_rtt_window + 1, 120);
+    ck_assert_msg(cc.min_rtt == 120 && cc.min_rtt_expired, "min_rtt did not expire");
+}
+END_TEST
+
+START_TEST(test_bandwidth_estimation)
+{
+    Congestion_Control cc;
+    uint64_t now = 1000;
+    congestion_control_init(&cc, CONGESTION_CONTROL_LEDBAT, now);
+    congestion_control_on_rtt_sample(&cc, now, 100);
+
+    /* 20 packets acked every 50ms: 400 packets per second. */
+    uint32_t i;
+
+    for (i = 0; i < 40; ++i) {
+        now += CONGESTION_CONTROL_INTERVAL;
+        congestion_control_on_sent(&cc, 20);
+        congestion_control_on_ack(&cc, now, 20);
+        congestion_control_update(&cc, now, 20);
+    }
+
+    ck_assert_msg(cc.delivery_rate > 399.0 && cc.delivery_rate < 401.0, "wrong delivery rate %f", cc.delivery_rate);
+    ck_assert_msg(cc.max_bandwidth > 399.0 && cc.max_bandwidth < 401.0, "wrong bandwidth %f", cc.max_bandwidth);
+    ck_assert_msg(cc.total_acked == 800, "wrong number of acked packets");
+}
+END_TEST
+
+START_TEST(test_deterministic)
+{
+    unsigned int i;
+
+    for (i = 0; i < CONGESTION_CONTROL_INVALID; ++i) {
+        Sim_Result a, b;
+        run_sim(i, &lossy_long_path, &a);
+        run_sim(i, &lossy_long_path, &b);
+        ck_assert_msg(memcmp(&a, &b, sizeof(Sim_Result)) == 0, "%s simulation is not deterministic",
+                      congestion_control_name(i));
+    }
+}
+END_TEST
+
+START_TEST(test_clean_path)
+{
+    unsigned int i;
+
+    for (i = 0; i < CONGESTION_CONTROL_INVALID; ++i) {
+        Sim_Result result;
+        run_sim(i, &clean_path, &result);
+        print_result("clean", i, &result);
+        ck_assert_msg(result.utilization > (i == CONGESTION_CONTROL_DEFAULT ? 0.1 : 0.7), "%s only used %f of the bandwidth", congestion_control_name(i),
+                      result.utilization);
+    }
+}
+END_TEST
+
+START_TEST(test_lossy_long_path)
+{
+    Sim_Result results[CONGESTION_CONTROL_INVALID];
+    unsigned int i;
+
+    for (i = 0; i < CONGESTION_CONTROL_INVALID; ++i) {
+        run_sim(i, &lossy_long_path, &results[i]);
+        print_result("lossy long", i, &results[i]);
+    }
+
+    ck_assert_msg(results[CONGESTION_CONTROL_BBR].utilization > 0.7, "bbr only used %f of the bandwidth",
+                  results[CONGESTION_CONTROL_BBR].utilization);
+    ck_assert_msg(results[CONGESTION_CONTROL_BBR].utilization > results[CONGESTION_CONTROL_DEFAULT].utilization,
+                  "bbr did not do better than the default algorithm on a lossy path");
+}
+END_TEST
+
+START_TEST(test_deep_buffer)
+{
+    Sim_Result results[CONGESTION_CONTROL_INVALID];
+    unsigned int i;
+
+    for (i = 0; i < CONGESTION_CONTROL_INVALID; ++i) {
+        run_sim(i, &deep_buffer_path, &results[i]);
+        print_result("deep buffer", i, &results[i]);
+    }
+
+    ck_assert_msg(results[CONGESTION_CONTROL_LEDBAT].utilization > 0.7, "ledbat only used %f of the bandwidth",
+                  results[CONGESTION_CONTROL_LEDBAT].utilization);
+    ck_assert_msg(results[CONGESTION_CONTROL_LEDBAT].avg_queue_delay < 200.0, "ledbat queue delay %fms too high",
+                  results[CONGESTION_CONTROL_LEDBAT].avg_queue_delay);
+    ck_assert_msg(results[CONGESTION_CONTROL_BBR].avg_queue_delay < 200.0, "bbr queue delay %fms too high",
+                  results[CONGESTION_CONTROL_BBR].avg_queue_delay);
+}
+END_TEST
+
+static Suite *congestion_control_suite(void)
+{
+    Suite *s = suite_create("Congestion control");
+
+    DEFTESTCASE(init);
+    DEFTESTCASE(rtt_estimation);
+    DEFTESTCASE(bandwidth_estimation);
+    DEFTESTCASE_SLOW(deterministic, 60);
+    DEFTESTCASE_SLOW(clean_path, 60);
+    DEFTESTCASE_SLOW(lossy_long_path, 60);
+    DEFTESTCASE_SLOW(deep_buffer, 60);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *congestion_control = congestion_control_suite();
+    SRunner *test_runner = srunner_create(congestion_control);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -272,6 +272,67 @@ START_TEST(test_large_data_symmetric)
 }
 END_TEST
 
+START_TEST(test_pipeline)
+{
+    unsigned char k[crypto_box_KEYBYTES];
+    unsigned char n[crypto_box_NONCEBYTES];
+
+    Crypto_Job jobs[64];
+    unsigned char m[64][1024];
+    unsigned char c[64][1024 + crypto_box_MACBYTES];
+    unsigned char c_expected[1024 + crypto_box_MACBYTES];
+    unsigned char m_out[64][1024];
+
+    uint32_t i;
+
+    new_symmetric_key(k);
+    rand_bytes(n, crypto_box_NONCEBYTES);
+
+    Crypto_Pipeline *pipeline = new_crypto_pipeline(3);
+    ck_assert_msg(pipeline != NULL, "could not create pipeline");
+
+    for (i = 0; i < 64; ++i) {
+        rand_bytes(m[i], sizeof(m[i]));
+        memcpy(jobs[i].shared_key, k, sizeof(k));
+        memcpy(jobs[i].nonce, n, sizeof(n));
+        increment_nonce(n);
+        jobs[i].input = m[i];
+        jobs[i].input_length = 1 + (i * 16);
+        jobs[i].output = c[i];
+        jobs[i].type = CRYPTO_JOB_ENCRYPT;
+    }
+
+    crypto_pipeline_run(pipeline, jobs, 64);
+
+    for (i = 0; i < 64; ++i) {
+        int clen = encrypt_data_symmetric(k, jobs[i].nonce, m[i], jobs[i].input_length, c_expected);
+        ck_assert_msg(jobs[i].result == clen, "wrong ciphertext length for job %u", i);
+        ck_assert_msg(memcmp(c[i], c_expected, clen) == 0, "ciphertext of job %u doesn't match", i);
+
+        jobs[i].input = c[i];
+        jobs[i].input_length = clen;
+        jobs[i].output = m_out[i];
+        jobs[i].type = CRYPTO_JOB_DECRYPT;
+    }
+
+    /* Corrupt one of the packets, only that one should fail. */
+    c[7][3] ^= 1;
+    crypto_pipeline_run(pipeline, jobs, 64);
+
+    for (i = 0; i < 64; ++i) {
+        if (i == 7) {
+            ck_assert_msg(jobs[i].result == -1, "corrupted packet decrypted");
+            continue;
+        }
+
+        ck_assert_msg(jobs[i].result == jobs[i].input_length - crypto_box_MACBYTES, "could not decrypt job %u", i);
+        ck_assert_msg(memcmp(m_out[i], m[i], jobs[i].result) == 0, "decrypted text of job %u differs", i);
+    }
+
+    kill_crypto_pipeline(pipeline);
+}
+END_TEST
+
 Suite *crypto_suite(void)
 {
     Suite *s = suite_create("Crypto");
@@ -281,6 +342,7 @@ Suite *crypto_suite(void)
     DEFTESTCASE_SLOW(endtoend, 15); /* waiting up to 15 seconds */
     DEFTESTCASE(large_data);
     DEFTESTCASE(large_data_symmetric);
+    DEFTESTCASE(pipeline);
 
     return s;
 }
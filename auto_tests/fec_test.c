@@ -0,0 +1,381 @@
+/* Tests for the forward error correction of lossy packets.
+ *
+ * Groups are encoded, symbols are dropped at random and whatever is left must give
+ * back the original data whenever no more symbols than parity symbols were lost.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/fec.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+
+#include "helpers.h"
+
+#define TEST_HEADER_ID 9
+#define TEST_PACKET_ID 200
+#define TEST_MAX_PACKET_LENGTH 1373
+#define TEST_SYMBOL_LENGTH 300
+
+static uint8_t data_symbols[FEC_MAX_DATA_PACKETS][TEST_SYMBOL_LENGTH];
+static uint8_t parity_symbols[FEC_MAX_PARITY_PACKETS][TEST_SYMBOL_LENGTH];
+static uint8_t recovered_symbols[FEC_MAX_DATA_PACKETS][TEST_SYMBOL_LENGTH];
+
+/* Drop num_lost of the num symbols at random. */
+static void pick_lost(uint8_t *lost, uint32_t num, uint32_t num_lost)
+{
+    memset(lost, 0, num);
+
+    while (num_lost) {
+        uint32_t i = rand() % num;
+
+        if (!lost[i]) {
+            lost[i] = 1;
+            --num_lost;
+        }
+    }
+}
+
+/* Encode a random group, drop num_lost symbols and decode it.
+ *
+ * return what fec_decode returned.
+ */
+static int encode_drop_decode(uint8_t num_data, uint8_t num_parity, uint32_t num_lost)
+{
+    const uint8_t *data[FEC_MAX_DATA_PACKETS];
+    uint8_t *parity[FEC_MAX_PARITY_PACKETS];
+    const uint8_t *received_parity[FEC_MAX_PARITY_PACKETS];
+    uint8_t *recovered[FEC_MAX_DATA_PACKETS];
+    uint8_t lost[FEC_MAX_DATA_PACKETS + FEC_MAX_PARITY_PACKETS];
+    uint32_t i, j;
+
+    for (i = 0; i < num_data; ++i) {
+        for (j = 0; j < TEST_SYMBOL_LENGTH; ++j)
+            data_symbols[i][j] = rand();
+
+        data[i] = data_symbols[i];
+    }
+
+    for (i = 0; i < num_parity; ++i)
+        parity[i] = parity_symbols[i];
+
+    ck_assert_msg(fec_encode(data, num_data, parity, num_parity, TEST_SYMBOL_LENGTH) == 0, "encode failed");
+
+    pick_lost(lost, num_data + num_parity, num_lost);
+    uint32_t data_lost = 0;
+
+    for (i = 0; i < num_data; ++i) {
+        if (lost[i]) {
+            data[i] = NULL;
+            recovered[i] = recovered_symbols[i];
+            ++data_lost;
+        } else {
+            recovered[i] = NULL;
+        }
+    }
+
+    for (i = 0; i < num_parity; ++i)
+        received_parity[i] = lost[num_data + i] ? NULL : parity_symbols[i];
+
+    int ret = fec_decode(data, num_data, received_parity, num_parity, recovered, TEST_SYMBOL_LENGTH);
+
+    if (ret == -1)
+        return ret;
+
+    ck_assert_msg(ret == data_lost, "recovered %i symbols instead of %u", ret, data_lost);
+
+    for (i = 0; i < num_data; ++i) {
+        if (recovered[i])
+            ck_assert_msg(memcmp(recovered[i], data_symbols[i], TEST_SYMBOL_LENGTH) == 0, "symbol %u recovered wrong", i);
+    }
+
+    return ret;
+}
+
+START_TEST(test_xor_parity)
+{
+    uint32_t i;
+
+    for (i = 0; i < 200; ++i) {
+        uint8_t num_data = 1 + rand() % FEC_MAX_DATA_PACKETS;
+        ck_assert_msg(encode_drop_decode(num_data, 1, rand() % 2) != -1, "single loss not recovered");
+    }
+}
+END_TEST
+
+START_TEST(test_reed_solomon)
+{
+    uint32_t i;
+
+    for (i = 0; i < 500; ++i) {
+        uint8_t num_data = 1 + rand() % FEC_MAX_DATA_PACKETS;
+        uint8_t num_parity = 2 + rand() % (FEC_MAX_PARITY_PACKETS - 1);
+        uint32_t num_lost = rand() % (num_parity + 1);
+
+        ck_assert_msg(encode_drop_decode(num_data, num_parity, num_lost) != -1,
+                      "%u of %u + %u symbols lost not recovered", num_lost, num_data, num_parity);
+    }
+
+    /* Every symbol a full group of parity packets can make up for. */
+    for (i = 0; i < 50; ++i)
+        ck_assert_msg(encode_drop_decode(FEC_MAX_DATA_PACKETS, FEC_MAX_PARITY_PACKETS, FEC_MAX_PARITY_PACKETS) != -1,
+                      "burst loss not recovered");
+}
+END_TEST
+
+START_TEST(test_too_many_lost)
+{
+    const uint8_t *data[FEC_MAX_DATA_PACKETS];
+    const uint8_t *parity[FEC_MAX_PARITY_PACKETS];
+    uint8_t *recovered[FEC_MAX_DATA_PACKETS];
+    uint32_t i;
+
+    for (i = 0; i < 10; ++i) {
+        data[i] = i < 4 ? NULL : data_symbols[i];
+        recovered[i] = i < 4 ? recovered_symbols[i] : NULL;
+    }
+
+    for (i = 0; i < 3; ++i)
+        parity[i] = parity_symbols[i];
+
+    ck_assert_msg(fec_decode(data, 10, parity, 3, recovered, TEST_SYMBOL_LENGTH) == -1,
+                  "decoded with more symbols lost than parity symbols");
+
+    data[0] = data_symbols[0];
+    parity[1] = NULL;
+    ck_assert_msg(fec_decode(data, 10, parity, 3, recovered, TEST_SYMBOL_LENGTH) == -1,
+                  "decoded with fewer parity symbols than lost ones");
+
+    ck_assert_msg(fec_encode(data, 0, (uint8_t *const *)parity, 3, TEST_SYMBOL_LENGTH) == -1, "encoded empty group");
+    ck_assert_msg(fec_encode(data, FEC_MAX_DATA_PACKETS + 1, (uint8_t *const *)parity, 3, TEST_SYMBOL_LENGTH) == -1,
+                  "encoded too large group");
+}
+END_TEST
+
+typedef struct {
+    uint8_t data[FEC_MAX_PACKET_SIZE];
+    uint16_t length;
+} Test_Packet;
+
+#define TEST_SESSION_PACKETS 2000
+
+/* Send TEST_SESSION_PACKETS lossy packets through two sessions, dropping up to num_lost
+ * packets of every group of num_data + num_parity, every packet must be received exactly once.
+ */
+static void session_roundtrip(uint8_t num_data, uint8_t num_parity, uint32_t num_lost)
+{
+    FEC_Session *send_fec = new_fec_session(TEST_HEADER_ID, TEST_MAX_PACKET_LENGTH);
+    FEC_Session *recv_fec = new_fec_session(TEST_HEADER_ID, TEST_MAX_PACKET_LENGTH);
+    ck_assert_msg(send_fec && recv_fec, "failed to create sessions");
+    ck_assert_msg(fec_set_stream(send_fec, TEST_PACKET_ID, num_data, num_parity) == 0, "failed to set stream");
+
+    static Test_Packet sent[TEST_SESSION_PACKETS];
+    static uint8_t received[TEST_SESSION_PACKETS];
+    static Test_Packet group[FEC_MAX_DATA_PACKETS + FEC_MAX_PARITY_PACKETS];
+    static uint8_t out[FEC_MAX_PARITY_PACKETS + 1][FEC_MAX_PACKET_SIZE];
+    uint16_t out_lengths[FEC_MAX_PARITY_PACKETS + 1];
+    static uint8_t parity[FEC_MAX_PARITY_PACKETS][FEC_MAX_PACKET_SIZE];
+    uint16_t parity_lengths[FEC_MAX_PARITY_PACKETS];
+    uint8_t lost[FEC_MAX_DATA_PACKETS + FEC_MAX_PARITY_PACKETS];
+    uint32_t i, j, k, num_group = 0;
+    memset(received, 0, sizeof(received));
+
+    for (i = 0; i < TEST_SESSION_PACKETS; ++i) {
+        /* [packet id][uint16_t packet number][random bytes] */
+        sent[i].length = 3 + rand() % (TEST_MAX_PACKET_LENGTH - FEC_OVERHEAD - 3 + 1);
+        sent[i].data[0] = TEST_PACKET_ID;
+        sent[i].data[1] = i >> 8;
+        sent[i].data[2] = i & 0xff;
+
+        for (j = 3; j < sent[i].length; ++j)
+            sent[i].data[j] = rand();
+
+        ck_assert_msg(fec_packet_protected(send_fec, sent[i].data, sent[i].length), "packet not protected");
+        int length = fec_wrap_packet(send_fec, sent[i].data, sent[i].length, group[num_group].data, 0);
+        ck_assert_msg(length == sent[i].length + FEC_OVERHEAD, "wrong wrapped length %i", length);
+        group[num_group].length = length;
+        ++num_group;
+
+        uint32_t num_parity_packets = fec_parity_packets(send_fec, TEST_PACKET_ID, i == TEST_SESSION_PACKETS - 1, parity,
+                                      parity_lengths);
+
+        if (num_parity_packets == 0)
+            continue;
+
+        ck_assert_msg(num_parity_packets == num_parity, "wrong number of parity packets");
+
+        for (j = 0; j < num_parity_packets; ++j) {
+            ck_assert_msg(parity_lengths[j] <= TEST_MAX_PACKET_LENGTH, "parity packet too long");
+            memcpy(group[num_group].data, parity[j], parity_lengths[j]);
+            group[num_group].length = parity_lengths[j];
+            ++num_group;
+        }
+
+        pick_lost(lost, num_group, num_lost < num_group ? num_lost : num_group);
+
+        for (j = 0; j < num_group; ++j) {
+            if (lost[j])
+                continue;
+
+            int num = fec_handle_packet(recv_fec, group[j].data, group[j].length, out, out_lengths);
+            ck_assert_msg(num >= 0, "failed to handle packet");
+
+            for (k = 0; k < (uint32_t)num; ++k) {
+                uint32_t number = ((uint32_t)out[k][1] << 8) | out[k][2];
+                ck_assert_msg(number < TEST_SESSION_PACKETS, "bad packet number");
+                ck_assert_msg(!received[number], "packet %u received twice", number);
+                ck_assert_msg(out_lengths[k] == sent[number].length
+                              && memcmp(out[k], sent[number].data, out_lengths[k]) == 0, "packet %u corrupted", number);
+                received[number] = 1;
+            }
+        }
+
+        num_group = 0;
+    }
+
+    for (i = 0; i < TEST_SESSION_PACKETS; ++i)
+        ck_assert_msg(received[i], "packet %u (%u + %u, %u lost) never received", i, num_data, num_parity, num_lost);
+
+    kill_fec_session(send_fec);
+    kill_fec_session(recv_fec);
+}
+
+START_TEST(test_session_recovery)
+{
+    session_roundtrip(10, 1, 1);
+    session_roundtrip(10, 3, 3);
+    session_roundtrip(FEC_MAX_DATA_PACKETS, FEC_MAX_PARITY_PACKETS, FEC_MAX_PARITY_PACKETS);
+    /* Groups are flushed after every packet. */
+    session_roundtrip(1, 2, 2);
+}
+END_TEST
+
+START_TEST(test_session_flush)
+{
+    FEC_Session *send_fec = new_fec_session(TEST_HEADER_ID, TEST_MAX_PACKET_LENGTH);
+    FEC_Session *recv_fec = new_fec_session(TEST_HEADER_ID, TEST_MAX_PACKET_LENGTH);
+    static uint8_t packets[3][FEC_MAX_PACKET_SIZE];
+    static uint8_t parity[FEC_MAX_PARITY_PACKETS][FEC_MAX_PACKET_SIZE];
+    uint16_t parity_lengths[FEC_MAX_PARITY_PACKETS];
+    static uint8_t out[FEC_MAX_PARITY_PACKETS + 1][FEC_MAX_PACKET_SIZE];
+    uint16_t out_lengths[FEC_MAX_PARITY_PACKETS + 1];
+    uint8_t data[100];
+    int lengths[3];
+    uint32_t i;
+
+    ck_assert_msg(fec_set_stream(send_fec, TEST_PACKET_ID, 10, 2) == 0, "failed to set stream");
+    memset(data, TEST_PACKET_ID, sizeof(data));
+    ck_assert_msg(!fec_packet_protected(send_fec, data, TEST_MAX_PACKET_LENGTH), "too long packet protected");
+
+    for (i = 0; i < 3; ++i) {
+        data[1] = i;
+        lengths[i] = fec_wrap_packet(send_fec, data, 50 + i * 20, packets[i], 1000 + i * 10);
+        ck_assert_msg(lengths[i] > 0, "wrap failed");
+    }
+
+    ck_assert_msg(fec_parity_packets(send_fec, TEST_PACKET_ID, 0, parity, parity_lengths) == 0, "incomplete group flushed");
+    ck_assert_msg(fec_timed_out_parity_packets(send_fec, 1039, 40, parity, parity_lengths) == 0, "flushed before timeout");
+    ck_assert_msg(fec_timed_out_parity_packets(send_fec, 1040, 40, parity, parity_lengths) == 2, "not flushed on timeout");
+    ck_assert_msg(fec_timed_out_parity_packets(send_fec, 1040, 40, parity, parity_lengths) == 0, "flushed twice");
+
+    /* Lose the first two packets. */
+    ck_assert_msg(fec_handle_packet(recv_fec, packets[2], lengths[2], out, out_lengths) == 1, "packet not passed on");
+    ck_assert_msg(fec_handle_packet(recv_fec, parity[0], parity_lengths[0], out, out_lengths) == 0, "recovered too early");
+    ck_assert_msg(fec_handle_packet(recv_fec, parity[1], parity_lengths[1], out, out_lengths) == 2, "packets not recovered");
+
+    for (i = 0; i < 2; ++i) {
+        ck_assert_msg(out_lengths[i] == 50 + i * 20 && out[i][1] == i, "wrong packet recovered");
+    }
+
+    /* Late packets that were already recovered are not passed on twice. */
+    ck_assert_msg(fec_handle_packet(recv_fec, packets[0], lengths[0], out, out_lengths) == 0, "packet passed on twice");
+
+    /* Changing the stream while a group is open drops the group. */
+    fec_wrap_packet(send_fec, data, 50, packets[0], 2000);
+    ck_assert_msg(fec_set_stream(send_fec, TEST_PACKET_ID, 0, 0) == 0, "failed to disable stream");
+    ck_assert_msg(!fec_packet_protected(send_fec, data, 50), "packet protected after disabling");
+    ck_assert_msg(fec_parity_packets(send_fec, TEST_PACKET_ID, 1, parity, parity_lengths) == 0, "disabled stream flushed");
+
+    kill_fec_session(send_fec);
+    kill_fec_session(recv_fec);
+}
+END_TEST
+
+START_TEST(test_invalid_packets)
+{
+    FEC_Session *send_fec = new_fec_session(TEST_HEADER_ID, TEST_MAX_PACKET_LENGTH);
+    FEC_Session *recv_fec = new_fec_session(TEST_HEADER_ID, TEST_MAX_PACKET_LENGTH);
+    static uint8_t packet[FEC_MAX_PACKET_SIZE];
+    static uint8_t out[FEC_MAX_PARITY_PACKETS + 1][FEC_MAX_PACKET_SIZE];
+    uint16_t out_lengths[FEC_MAX_PARITY_PACKETS + 1];
+    uint8_t data[64];
+
+    ck_assert_msg(new_fec_session(TEST_HEADER_ID, FEC_MAX_PACKET_SIZE + 1) == NULL, "session with too large packets");
+    ck_assert_msg(fec_set_stream(send_fec, TEST_PACKET_ID, FEC_MAX_DATA_PACKETS + 1, 1) == -1, "too many data packets");
+    ck_assert_msg(fec_set_stream(send_fec, TEST_PACKET_ID, 10, FEC_MAX_PARITY_PACKETS + 1) == -1, "too many parity packets");
+    ck_assert_msg(fec_set_stream(send_fec, TEST_PACKET_ID, 10, 0) == -1, "no parity packets");
+    ck_assert_msg(fec_set_stream(send_fec, TEST_PACKET_ID, 4, 1) == 0, "failed to set stream");
+
+    memset(data, TEST_PACKET_ID, sizeof(data));
+    int length = fec_wrap_packet(send_fec, data, sizeof(data), packet, 0);
+
+    ck_assert_msg(fec_handle_packet(recv_fec, packet, FEC_OVERHEAD, out, out_lengths) == -1, "empty packet handled");
+    ck_assert_msg(fec_handle_packet(recv_fec, packet, length - 1, out, out_lengths) == -1, "truncated packet handled");
+
+    packet[0] = TEST_HEADER_ID + 1;
+    ck_assert_msg(fec_handle_packet(recv_fec, packet, length, out, out_lengths) == -1, "wrong header handled");
+    packet[0] = TEST_HEADER_ID;
+
+    packet[4] = 4;
+    ck_assert_msg(fec_handle_packet(recv_fec, packet, length, out, out_lengths) == -1, "index out of group handled");
+    packet[4] = FEC_MAX_DATA_PACKETS + 1;
+    ck_assert_msg(fec_handle_packet(recv_fec, packet, length, out, out_lengths) == -1, "parity index out of group handled");
+    packet[4] = 0;
+
+    packet[5] = 0;
+    ck_assert_msg(fec_handle_packet(recv_fec, packet, length, out, out_lengths) == -1, "empty group handled");
+    packet[5] = 4;
+
+    ck_assert_msg(fec_handle_packet(recv_fec, packet, length, out, out_lengths) == 1, "valid packet not handled");
+    ck_assert_msg(out_lengths[0] == sizeof(data) && memcmp(out[0], data, sizeof(data)) == 0, "wrong packet");
+    ck_assert_msg(fec_handle_packet(recv_fec, packet, length, out, out_lengths) == 0, "duplicate passed on");
+
+    kill_fec_session(send_fec);
+    kill_fec_session(recv_fec);
+}
+END_TEST
+
+static Suite *fec_suite(void)
+{
+    Suite *s = suite_create("FEC");
+
+    DEFTESTCASE(xor_parity);
+    DEFTESTCASE(reed_solomon);
+    DEFTESTCASE(too_many_lost);
+    DEFTESTCASE_SLOW(session_recovery, 60);
+    DEFTESTCASE(session_flush);
+    DEFTESTCASE(invalid_packets);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    srand(0);
+
+    Suite *fec = fec_suite();
+    SRunner *test_runner = srunner_create(fec);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -0,0 +1,237 @@
+/* Tests for the store of group announcements held by DHT nodes.
+ *
+ * Groups must keep at most their own number of nodes, the store must evict the
+ * announcements heard from the longest ago and hand out nodes by their deadline.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/group_announce_store.h"
+#include "../toxcore/util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+
+#include "helpers.h"
+
+#define TEST_GROUPS 50
+#define TEST_GROUP_NODES 8
+
+static void random_node(GC_Announce_Node *node)
+{
+    memset(node, 0, sizeof(GC_Announce_Node));
+    randombytes(node->public_key, ENC_PUBLIC_KEY);
+    ip_init(&node->ip_port.ip, 0);
+    node->ip_port.ip.ip4.uint32 = random_int();
+    node->ip_port.port = random_int() % 65535 + 1;
+}
+
+static bool has_node(const GCA_Store *store, const uint8_t *chat_id, const GC_Announce_Node *node)
+{
+    GC_Announce_Node nodes[TEST_GROUP_NODES];
+    uint32_t i, num = gca_store_get_nodes(store, chat_id, nodes, TEST_GROUP_NODES);
+
+    for (i = 0; i < num; ++i) {
+        if (id_equal(nodes[i].public_key, node->public_key) && ipport_equal(&nodes[i].ip_port, &node->ip_port))
+            return true;
+    }
+
+    return false;
+}
+
+START_TEST(test_groups)
+{
+    Mono_Time *mono_time = new_mono_time(NULL);
+    GCA_Store store;
+    gca_store_init(&store, mono_time, TEST_GROUPS * TEST_GROUP_NODES, TEST_GROUP_NODES);
+
+    uint8_t chat_ids[TEST_GROUPS][CHAT_ID_SIZE];
+    GC_Announce_Node nodes[TEST_GROUPS][TEST_GROUP_NODES + 2];
+    uint32_t i, j;
+
+
+    for (i = 0; i < TEST_GROUPS; ++i) {
+        randombytes(chat_ids[i], CHAT_ID_SIZE);
+
+        for (j = 0; j < TEST_GROUP_NODES + 2; ++j) {
+            random_node(&nodes[i][j]);
+            ck_assert_msg(gca_store_add(&store, chat_ids[i], &nodes[i][j], false, unix_time(mono_time) + j) != -1,
+                          "failed to add node %u of group %u", j, i);
+        }
+    }
+
+    ck_assert_msg(store.count == TEST_GROUPS * TEST_GROUP_NODES, "wrong count %u", store.count);
+    ck_assert_msg(store.num_groups == TEST_GROUPS, "wrong number of groups %u", store.num_groups);
+
+    /* The two oldest nodes of each group were replaced */
+    for (i = 0; i < TEST_GROUPS; ++i) {
+        GC_Announce_Node got[TEST_GROUP_NODES + 2];
+        ck_assert_msg(gca_store_get_nodes(&store, chat_ids[i], got, TEST_GROUP_NODES + 2) == TEST_GROUP_NODES,
+                      "wrong number of nodes in group %u", i);
+        ck_assert_msg(id_equal(got[0].public_key, nodes[i][TEST_GROUP_NODES + 1].public_key),
+                      "newest node of group %u not first", i);
+
+        for (j = 0; j < TEST_GROUP_NODES + 2; ++j)
+            ck_assert_msg(has_node(&store, chat_ids[i], &nodes[i][j]) == (j >= 2), "node %u of group %u stored: %d",
+                          j, i, j < 2);
+    }
+
+    /* Refreshing keeps the count and updates the address */
+    nodes[0][5].ip_port.port = 1234;
+    int nodenumber = gca_store_add(&store, chat_ids[0], &nodes[0][5], false, unix_time(mono_time) + 100);
+    ck_assert_msg(nodenumber != -1 && store.count == TEST_GROUPS * TEST_GROUP_NODES, "refresh added a node");
+    ck_assert_msg(has_node(&store, chat_ids[0], &nodes[0][5]), "refresh didn't update the address");
+
+    /* Unknown group */
+    uint8_t other_chat_id[CHAT_ID_SIZE];
+    randombytes(other_chat_id, CHAT_ID_SIZE);
+    ck_assert_msg(gca_store_get_nodes(&store, other_chat_id, nodes[0], TEST_GROUP_NODES) == 0, "unknown group has nodes");
+
+    /* Removing every node of a group removes the group */
+    GC_Announce_Node got[TEST_GROUP_NODES];
+
+    for (i = 0; i < store.nodes_size; ++i) {
+        struct GC_AnnouncedNode *node = gca_store_get(&store, i);
+
+        if (node != NULL && chat_id_equal(node->chat_id, chat_ids[3]))
+            gca_store_remove(&store, i);
+    }
+
+    ck_assert_msg(store.num_groups == TEST_GROUPS - 1, "group not removed");
+    ck_assert_msg(gca_store_get_nodes(&store, chat_ids[3], got, TEST_GROUP_NODES) == 0, "removed group has nodes");
+
+    /* The group moved into the removed one's place is still found */
+    for (i = 0; i < TEST_GROUPS; ++i) {
+        if (i != 3)
+            ck_assert_msg(gca_store_get_nodes(&store, chat_ids[i], got, TEST_GROUP_NODES) == TEST_GROUP_NODES,
+                          "group %u lost", i);
+    }
+
+    gca_store_free(&store);
+    ck_assert_msg(store.count == 0 && gca_store_get_nodes(&store, chat_ids[0], got, TEST_GROUP_NODES) == 0,
+                  "store not empty after free");
+    kill_mono_time(mono_time);
+}
+END_TEST
+
+START_TEST(test_eviction)
+{
+    Mono_Time *mono_time = new_mono_time(NULL);
+    GCA_Store store;
+    gca_store_init(&store, mono_time, 10, 10);
+
+    uint8_t chat_ids[2][CHAT_ID_SIZE];
+    GC_Announce_Node nodes[20];
+    uint32_t i;
+
+    randombytes(chat_ids[0], CHAT_ID_SIZE);
+    randombytes(chat_ids[1], CHAT_ID_SIZE);
+
+    /* Our own announcement is never evicted */
+    random_node(&nodes[0]);
+    ck_assert_msg(gca_store_add(&store, chat_ids[0], &nodes[0], true, 0) != -1, "failed to add self");
+
+    for (i = 1; i < 20; ++i) {
+        random_node(&nodes[i]);
+        ck_assert_msg(gca_store_add(&store, chat_ids[i % 2], &nodes[i], false, unix_time(mono_time) + i) != -1,
+                      "failed to add node %u", i);
+    }
+
+    ck_assert_msg(store.count == 10, "wrong count %u", store.count);
+    ck_assert_msg(has_node(&store, chat_ids[0], &nodes[0]), "self announcement evicted");
+
+    /* The earliest deadlines are the ones evicted first */
+    for (i = 1; i < 20; ++i)
+        ck_assert_msg(has_node(&store, chat_ids[i % 2], &nodes[i]) == (i >= 11), "node %u stored: %d", i, i < 11);
+
+    ck_assert_msg(gca_store_set_limits(&store, 0, 1) == -1, "set a zero limit");
+    ck_assert_msg(gca_store_set_limits(&store, 5, 2) == 0, "failed to set limits");
+    ck_assert_msg(store.count == 4, "wrong count %u after lowering the limits", store.count);
+    ck_assert_msg(has_node(&store, chat_ids[0], &nodes[0]), "self announcement evicted by the limits");
+
+    gca_store_remove_self(&store, chat_ids[0]);
+    ck_assert_msg(!has_node(&store, chat_ids[0], &nodes[0]) && store.count == 3, "self announcement not removed");
+
+    gca_store_free(&store);
+    kill_mono_time(mono_time);
+}
+END_TEST
+
+START_TEST(test_deadlines)
+{
+    Mono_Time *mono_time = new_mono_time(NULL);
+    GCA_Store store;
+    gca_store_init(&store, mono_time, 1000, 1000);
+
+    uint8_t chat_id[CHAT_ID_SIZE];
+    GC_Announce_Node node;
+    uint32_t i;
+
+    randombytes(chat_id, CHAT_ID_SIZE);
+
+    for (i = 0; i < 1000; ++i) {
+        random_node(&node);
+        int nodenumber = gca_store_add(&store, chat_id, &node, false, random_int() % 10000 + 1);
+        ck_assert_msg(nodenumber != -1, "failed to add node %u", i);
+        ck_assert_msg(gca_store_set_ping(&store, nodenumber, i + 1) == 0, "failed to set ping");
+    }
+
+    ck_assert_msg(gca_store_find_ping(&store, 0) == GCA_STORE_NONE, "found ping id 0");
+    ck_assert_msg(gca_store_find_ping(&store, 1001) == GCA_STORE_NONE, "found unknown ping id");
+
+    /* Nodes come out in deadline order, rescheduling puts them back in place */
+    uint64_t last = 0;
+    uint32_t n, num = 0;
+
+    ck_assert_msg(gca_store_due(&store, 0) == GCA_STORE_NONE, "node due before its deadline");
+
+    while ((n = gca_store_due(&store, 10000)) != GCA_STORE_NONE) {
+        struct GC_AnnouncedNode *entry = gca_store_get(&store, n);
+        ck_assert_msg(entry->deadline >= last, "deadline %llu after %llu", (unsigned long long)entry->deadline,
+                      (unsigned long long)last);
+        ck_assert_msg(gca_store_find_ping(&store, entry->ping_id) == n, "ping id not found");
+        last = entry->deadline;
+
+        if (num++ % 2)
+            gca_store_set_deadline(&store, n, 20000 + num);
+        else
+            gca_store_remove(&store, n);
+    }
+
+    ck_assert_msg(num == 1000 && store.count == 500, "wrong number of due nodes %u", num);
+
+    gca_store_free(&store);
+    kill_mono_time(mono_time);
+}
+END_TEST
+
+static Suite *group_announce_store_suite(void)
+{
+    Suite *s = suite_create("Group announce store");
+
+    DEFTESTCASE(groups);
+    DEFTESTCASE(eviction);
+    DEFTESTCASE(deadlines);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    srand(0);
+
+    Suite *group_announce_store = group_announce_store_suite();
+    SRunner *test_runner = srunner_create(group_announce_store);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
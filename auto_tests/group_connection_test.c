@@ -0,0 +1,245 @@
+/* Tests for the receive buffer and the acks of group connections.
+ *
+ * Out of order messages must stay within the receive budget shared by all groups and within
+ * the share of it each peer may take, the ones that don't fit are dropped and counted, and
+ * all of their memory is given back once they are gone. Acks with ranges of messages that
+ * weren't sent are rejected.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/group_chats.h"
+#include "../toxcore/group_connection.h"
+#include "../toxcore/util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+
+#include "helpers.h"
+
+static Networking_Core *test_net;   /* gives the chats their clock */
+
+/* Makes chat a group with num_peers peers whose buffers are allocated, returns the first one. */
+static GC_Connection *setup_chat(GC_Chat *chat, GC_Recv_Budget *budget, uint64_t limit, uint32_t num_peers)
+{
+    memset(chat, 0, sizeof(GC_Chat));
+    memset(budget, 0, sizeof(GC_Recv_Budget));
+    budget->limit = limit;
+    chat->recv_arena.budget = budget;
+    chat->net = test_net;
+
+    chat->gcc = malloc(sizeof(GC_Connection *) * num_peers);
+    ck_assert_msg(chat->gcc != NULL, "malloc failed");
+
+    uint32_t i;
+
+    for (i = 0; i < num_peers; ++i) {
+        GC_Connection *gconn = gcc_new_connection(chat, i);
+        ck_assert_msg(gconn != NULL, "failed to create connection");
+        ck_assert_msg(gcc_init_buffers(gconn) == 0, "failed to allocate buffers");
+
+        chat->gcc[i] = gconn;
+        chat->numpeers = i + 1;
+    }
+
+    return chat->gcc[0];
+}
+
+START_TEST(test_recv_budget)
+{
+    GC_Chat chat;
+    GC_Recv_Budget budget;
+    GC_Connection *gconn = setup_chat(&chat, &budget, GC_RECV_PEER_SHARE * 10 * GCC_RECV_SLOT_SIZE, 1);
+
+    uint8_t data[GCC_RECV_SLOT_SIZE * 3];
+    memset(data, 0xAB, sizeof(data));
+
+    uint32_t num_messages, bytes, dropped;
+    uint64_t i;
+
+    /* Message 1 is missing, the others are kept until the peer's share of the budget is used up */
+    for (i = 2; i < 22; ++i) {
+        int ret = gcc_handle_recv_message(&chat, 0, data, 100, 0, i);
+        ck_assert_msg(ret == (i < 12 ? 1 : 0), "message %u: got %d", (uint32_t)i, ret);
+    }
+
+    ck_assert_msg(gc_get_peer_recv_buffer(&chat, 0, &num_messages, &bytes, &dropped) == 0, "failed to get usage");
+    ck_assert_msg(num_messages == 10 && bytes == 10 * GCC_RECV_SLOT_SIZE && dropped == 10,
+                  "wrong usage: %u messages, %u bytes, %u dropped", num_messages, bytes, dropped);
+    ck_assert_msg(budget.used == 10 * GCC_RECV_SLOT_SIZE && budget.dropped == 10, "wrong budget usage");
+    ck_assert_msg(gconn->recv_ary[get_ary_index(11)].data != NULL && gconn->recv_ary[get_ary_index(12)].data == NULL,
+                  "wrong messages kept");
+    ck_assert_msg(memcmp(gconn->recv_ary[get_ary_index(5)].data, data, 100) == 0, "kept message changed");
+
+    /* A duplicate of a kept message isn't kept twice */
+    ck_assert_msg(gcc_handle_recv_message(&chat, 0, data, 100, 0, 5) == 0, "duplicate kept");
+    ck_assert_msg(budget.used == 10 * GCC_RECV_SLOT_SIZE, "duplicate charged");
+
+    gcc_free_buffers(&chat, gconn);
+    ck_assert_msg(budget.used == 0 && gconn->recv_ary_count == 0, "freed messages still charged");
+
+    /* Messages larger than a slot are charged their size */
+    ck_assert_msg(gcc_init_buffers(gconn) == 0, "failed to allocate buffers");
+    ck_assert_msg(gcc_handle_recv_message(&chat, 0, data, sizeof(data), 0, 30) == 1, "large message dropped");
+    ck_assert_msg(budget.used == sizeof(data), "wrong charge for large message");
+    ck_assert_msg(memcmp(gconn->recv_ary[get_ary_index(30)].data, data, sizeof(data)) == 0, "large message changed");
+
+    gcc_cleanup(&chat);
+    ck_assert_msg(budget.used == 0 && chat.recv_arena.num_blocks == 0, "cleanup left memory behind");
+}
+END_TEST
+
+START_TEST(test_recv_arena)
+{
+    GC_Chat chat;
+    GC_Recv_Budget budget;
+    GC_Connection *gconn = setup_chat(&chat, &budget, 0, 1);
+
+    uint8_t data[64];
+    uint64_t i;
+
+    for (i = 2; i < 2 + GCC_RECV_BLOCK_SLOTS * 4; ++i) {
+        memcpy(data, &i, sizeof(i));
+        ck_assert_msg(gcc_handle_recv_message(&chat, 0, data, sizeof(data), 0, i) == 1, "message %u dropped",
+                      (uint32_t)i);
+    }
+
+    ck_assert_msg(chat.recv_arena.num_blocks == 4, "%u blocks for 4 blocks of messages", chat.recv_arena.num_blocks);
+    ck_assert_msg(budget.dropped == 0, "messages dropped without a limit");
+
+    for (i = 2; i < 2 + GCC_RECV_BLOCK_SLOTS * 4; ++i) {
+        uint64_t id;
+        memcpy(&id, gconn->recv_ary[get_ary_index(i)].data, sizeof(id));
+        ck_assert_msg(id == i, "slot of message %u overwritten", (uint32_t)i);
+    }
+
+    /* Once empty the arena keeps a single block */
+    gcc_free_buffers(&chat, gconn);
+    ck_assert_msg(chat.recv_arena.num_blocks == 1 && chat.recv_arena.used_slots == 0, "arena didn't shrink");
+
+    gcc_cleanup(&chat);
+}
+END_TEST
+
+START_TEST(test_recv_peer_share)
+{
+    GC_Chat chat;
+    GC_Recv_Budget budget;
+    setup_chat(&chat, &budget, GC_RECV_PEER_SHARE * 4 * GCC_RECV_SLOT_SIZE, GC_RECV_PEER_SHARE + 1);
+
+    uint8_t data[100];
+    memset(data, 0xAB, sizeof(data));
+
+    uint32_t num_messages, bytes, dropped;
+    uint32_t peer;
+    uint64_t i;
+
+    /* A flooding peer gets its share only */
+    for (i = 2; i < 12; ++i)
+        gcc_handle_recv_message(&chat, 0, data, sizeof(data), 0, i);
+
+    ck_assert_msg(gc_get_peer_recv_buffer(&chat, 0, &num_messages, &bytes, &dropped) == 0, "failed to get usage");
+    ck_assert_msg(num_messages == 4 && dropped == 6, "flooding peer kept %u messages, %u dropped", num_messages,
+                  dropped);
+
+    /* The others still have room, until the budget as a whole is used up */
+    for (peer = 1; peer <= GC_RECV_PEER_SHARE; ++peer) {
+        for (i = 2; i < 6; ++i) {
+            int ret = gcc_handle_recv_message(&chat, peer, data, sizeof(data), 0, i);
+            ck_assert_msg(ret == (peer < GC_RECV_PEER_SHARE ? 1 : 0), "peer %u message %u: got %d", peer,
+                          (uint32_t)i, ret);
+        }
+    }
+
+    ck_assert_msg(budget.used == budget.limit, "budget not used up");
+    ck_assert_msg(budget.dropped == 6 + 4, "wrong number of dropped messages");
+
+    gcc_cleanup(&chat);
+    ck_assert_msg(budget.used == 0, "cleanup left memory behind");
+}
+END_TEST
+
+/* Packs an ack of ack_id with one range of num messages from first into data. */
+static uint32_t pack_ack_range(uint8_t *data, uint64_t ack_id, uint64_t first, uint16_t num)
+{
+    U64_to_bytes(data, ack_id);
+    data[sizeof(uint64_t)] = 1;
+    U64_to_bytes(data + sizeof(uint64_t) + sizeof(uint8_t), first);
+    U16_to_bytes(data + sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint64_t), num);
+    return sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint16_t);
+}
+
+START_TEST(test_ack_ranges)
+{
+    GC_Chat chat;
+    GC_Recv_Budget budget;
+    GC_Connection *gconn = setup_chat(&chat, &budget, 0, 1);
+
+    uint8_t data[GCC_MAX_ACK_SIZE];
+    uint32_t length;
+
+    gconn->send_message_id = 5;
+
+    /* A range that wraps around past zero */
+    length = pack_ack_range(data, 0, UINT64_MAX, 1);
+    ck_assert_msg(gcc_handle_ack_packet(&chat, gconn, data, length) == -1, "wrapping range accepted");
+
+    /* A range past what was sent */
+    length = pack_ack_range(data, 0, 2, UINT16_MAX);
+    ck_assert_msg(gcc_handle_ack_packet(&chat, gconn, data, length) == -1, "range past sent messages accepted");
+
+    /* A range far past the send buffer */
+    gconn->send_message_id = GCC_BUFFER_SIZE * 4;
+    length = pack_ack_range(data, 0, GCC_BUFFER_SIZE * 2, 1);
+    ck_assert_msg(gcc_handle_ack_packet(&chat, gconn, data, length) == -1, "range past the send buffer accepted");
+
+    length = pack_ack_range(data, 0, GCC_BUFFER_SIZE - 1, 2);
+    ck_assert_msg(gcc_handle_ack_packet(&chat, gconn, data, length) == -1, "range ending past the buffer accepted");
+    ck_assert_msg(gconn->send_acked_id == 0, "rejected ack was applied");
+
+    /* A range within what was sent */
+    gconn->send_message_id = 5;
+    length = pack_ack_range(data, 1, 3, 2);
+    ck_assert_msg(gcc_handle_ack_packet(&chat, gconn, data, length) == 0, "valid range rejected");
+    ck_assert_msg(gconn->send_acked_id == 1, "valid ack wasn't applied");
+
+    gcc_cleanup(&chat);
+}
+END_TEST
+
+static Suite *group_connection_suite(void)
+{
+    Suite *s = suite_create("Group connection");
+
+    DEFTESTCASE(recv_budget);
+    DEFTESTCASE(recv_arena);
+    DEFTESTCASE(recv_peer_share);
+    DEFTESTCASE(ack_ranges);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    srand(0);
+    test_net = new_networking_no_udp(NULL);
+
+    if (test_net == NULL)
+        return 1;
+
+    Suite *group_connection = group_connection_suite();
+    SRunner *test_runner = srunner_create(group_connection);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+    kill_networking(test_net);
+
+    return number_failed;
+}
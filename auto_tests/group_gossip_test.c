@@ -0,0 +1,153 @@
+/* Tests for the signed gossip that relays broadcasts in overlay groups.
+ *
+ * Packets must verify only for the chat they were made for and without changes
+ * past the hop count, and the cache must remember the newest broadcasts.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/group_gossip.h"
+#include "../toxcore/util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+
+#include "helpers.h"
+
+#define TEST_PAYLOAD_SIZE 100
+
+START_TEST(test_pack_verify)
+{
+    uint8_t public_key[EXT_PUBLIC_KEY], secret_key[EXT_SECRET_KEY];
+    uint8_t chat_id[CHAT_ID_SIZE], other_chat_id[CHAT_ID_SIZE];
+    uint8_t payload[TEST_PAYLOAD_SIZE];
+    uint8_t packet[TEST_PAYLOAD_SIZE + GC_GOSSIP_OVERHEAD];
+
+    create_extended_keypair(public_key, secret_key);
+    randombytes(chat_id, sizeof(chat_id));
+    randombytes(other_chat_id, sizeof(other_chat_id));
+    randombytes(payload, sizeof(payload));
+
+    ck_assert_msg(gc_gossip_pack(packet, sizeof(packet) - 1, chat_id, public_key, secret_key, 1, payload,
+                                 sizeof(payload)) == -1, "packed into a buffer that is too small");
+    ck_assert_msg(gc_gossip_pack(packet, sizeof(packet), chat_id, public_key, secret_key, 1, payload, 0) == -1,
+                  "packed empty payload");
+
+    int length = gc_gossip_pack(packet, sizeof(packet), chat_id, public_key, secret_key, 1234, payload,
+                                sizeof(payload));
+    ck_assert_msg(length == sizeof(packet), "wrong packet length %d", length);
+
+    GC_Gossip gossip;
+    ck_assert_msg(gc_gossip_unpack(&gossip, packet, GC_GOSSIP_OVERHEAD) == -1, "unpacked packet without payload");
+    ck_assert_msg(gc_gossip_unpack(&gossip, packet, length) == 0, "failed to unpack");
+    ck_assert_msg(gossip.hops == 0 && gossip.seq == 1234, "wrong hops %u or seq %llu", gossip.hops,
+                  (unsigned long long)gossip.seq);
+    ck_assert_msg(memcmp(gossip.origin_pk, public_key, EXT_PUBLIC_KEY) == 0, "wrong origin");
+    ck_assert_msg(gossip.length == sizeof(payload) && memcmp(gossip.payload, payload, sizeof(payload)) == 0,
+                  "wrong payload");
+
+    ck_assert_msg(gc_gossip_verify(chat_id, packet, length), "failed to verify");
+    ck_assert_msg(!gc_gossip_verify(other_chat_id, packet, length), "verified for another chat");
+
+    /* Relaying peers only change the hop count */
+    packet[0] = 5;
+    ck_assert_msg(gc_gossip_verify(chat_id, packet, length), "failed to verify after hop count change");
+
+    uint32_t i;
+
+    for (i = 1; i < (uint32_t)length; i += 7) {
+        packet[i] ^= 1;
+        ck_assert_msg(!gc_gossip_verify(chat_id, packet, length), "verified with byte %u changed", i);
+        packet[i] ^= 1;
+    }
+
+    ck_assert_msg(!gc_gossip_verify(chat_id, packet, length - 1), "verified truncated packet");
+}
+END_TEST
+
+START_TEST(test_cache)
+{
+    GC_Gossip_Cache cache;
+    memset(&cache, 0, sizeof(cache));
+
+    uint8_t sig_pks[2][SIG_PUBLIC_KEY];
+    randombytes(sig_pks[0], SIG_PUBLIC_KEY);
+    randombytes(sig_pks[1], SIG_PUBLIC_KEY);
+
+    ck_assert_msg(!gc_gossip_cache_has(&cache, sig_pks[0], 1), "empty cache has a broadcast");
+    ck_assert_msg(gc_gossip_cache_add(&cache, sig_pks[0], 1) == 0, "failed to add");
+    ck_assert_msg(gc_gossip_cache_has(&cache, sig_pks[0], 1), "added broadcast not found");
+    ck_assert_msg(!gc_gossip_cache_has(&cache, sig_pks[0], 2), "found broadcast with another seq");
+    ck_assert_msg(!gc_gossip_cache_has(&cache, sig_pks[1], 1), "found broadcast from another origin");
+
+    /* Broadcasts arriving out of order within the window are still taken */
+    ck_assert_msg(gc_gossip_cache_add(&cache, sig_pks[0], 10) == 0, "failed to add");
+    ck_assert_msg(!gc_gossip_cache_has(&cache, sig_pks[0], 5), "found broadcast that wasn't added");
+    ck_assert_msg(gc_gossip_cache_add(&cache, sig_pks[0], 5) == 0, "failed to add");
+    ck_assert_msg(gc_gossip_cache_has(&cache, sig_pks[0], 5), "out of order broadcast not found");
+    ck_assert_msg(gc_gossip_cache_has(&cache, sig_pks[0], 1), "first broadcast forgotten");
+
+    /* Past the window everything older is dropped */
+    ck_assert_msg(gc_gossip_cache_add(&cache, sig_pks[0], 10 + GC_GOSSIP_WINDOW) == 0, "failed to add");
+    ck_assert_msg(gc_gossip_cache_has(&cache, sig_pks[0], 9), "broadcast older than the window not dropped");
+    ck_assert_msg(!gc_gossip_cache_has(&cache, sig_pks[0], 11), "found broadcast that wasn't added");
+
+    /* However much another origin sends, the first one isn't forgotten */
+    uint64_t seq;
+
+    for (seq = 1; seq <= GC_GOSSIP_CACHE_SIZE * 2; ++seq)
+        ck_assert_msg(gc_gossip_cache_add(&cache, sig_pks[1], seq) == 0, "failed to add %llu",
+                      (unsigned long long)seq);
+
+    ck_assert_msg(cache.count == 2, "wrong count %u", cache.count);
+    ck_assert_msg(gc_gossip_cache_has(&cache, sig_pks[0], 9), "replay accepted after other broadcasts");
+    ck_assert_msg(gc_gossip_cache_has(&cache, sig_pks[1], 1), "replay accepted after other broadcasts");
+
+    /* Only many other origins push one out */
+    uint32_t i;
+
+    for (i = 0; i < GC_GOSSIP_CACHE_SIZE - 1; ++i) {
+        uint8_t sig_pk[SIG_PUBLIC_KEY];
+        randombytes(sig_pk, SIG_PUBLIC_KEY);
+        ck_assert_msg(gc_gossip_cache_add(&cache, sig_pk, 1) == 0, "failed to add origin %u", i);
+    }
+
+    ck_assert_msg(cache.count == GC_GOSSIP_CACHE_SIZE, "wrong count %u", cache.count);
+    ck_assert_msg(cache.index.count == GC_GOSSIP_CACHE_SIZE, "wrong index count %u", cache.index.count);
+    ck_assert_msg(!gc_gossip_cache_has(&cache, sig_pks[0], 9), "oldest origin not forgotten");
+    ck_assert_msg(gc_gossip_cache_has(&cache, sig_pks[1], 1), "newer origin forgotten");
+
+    gc_gossip_cache_free(&cache);
+    ck_assert_msg(cache.count == 0 && !gc_gossip_cache_has(&cache, sig_pks[1], 1), "cache not empty after free");
+}
+END_TEST
+
+static Suite *group_gossip_suite(void)
+{
+    Suite *s = suite_create("Group gossip");
+
+    DEFTESTCASE(pack_verify);
+    DEFTESTCASE(cache);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    srand(0);
+
+    Suite *group_gossip = group_gossip_suite();
+    SRunner *test_runner = srunner_create(group_gossip);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
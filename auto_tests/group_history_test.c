@@ -0,0 +1,299 @@
+/* Tests for the bounded message log of group chats and the batches peers catch up with.
+ *
+ * The log must stay within its size, keep its entries when reopened and hand out the same
+ * entries it was given, both directly and through a packed batch. Signatures of entries must
+ * only check out for the message and group they were made for.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/group_history.h"
+#include "../toxcore/util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "helpers.h"
+
+#define TEST_SENDERS 5
+
+static uint8_t test_keys[TEST_SENDERS][EXT_PUBLIC_KEY];
+
+static void make_test_path(char *path, size_t size)
+{
+    snprintf(path, size, "group_history_test_%d.log", (int)getpid());
+    unlink(path);
+}
+
+/* Fills entry with message number num, sent by one of TEST_SENDERS senders at time. */
+static void make_entry(GC_History_Entry *entry, uint32_t num, uint64_t time)
+{
+    memset(entry, 0, sizeof(GC_History_Entry));
+
+    uint32_t sender = num % TEST_SENDERS;
+    memcpy(entry->public_key, test_keys[sender], EXT_PUBLIC_KEY);
+    entry->nick_len = snprintf((char *)entry->nick, MAX_GC_NICK_SIZE, "peer %u", sender);
+    entry->type = num % 7 == 0 ? GC_MESSAGE_TYPE_ACTION : GC_MESSAGE_TYPE_NORMAL;
+    entry->time = time;
+    entry->length = 1 + num % 200;
+    memset(entry->message, num & 0xff, entry->length);
+    memcpy(entry->message, &num, entry->length < sizeof(num) ? entry->length : sizeof(num));
+    memset(entry->signature, num & 0xff, SIGNATURE_SIZE);
+    memcpy(entry->signature, &num, sizeof(num));
+}
+
+static int entries_equal(const GC_History_Entry *a, const GC_History_Entry *b)
+{
+    return a->time == b->time && a->type == b->type && a->nick_len == b->nick_len && a->length == b->length
+           && memcmp(a->public_key, b->public_key, EXT_PUBLIC_KEY) == 0 && memcmp(a->nick, b->nick, a->nick_len) == 0
+           && memcmp(a->message, b->message, a->length) == 0 && memcmp(a->signature, b->signature, SIGNATURE_SIZE) == 0;
+}
+
+static void init_keys(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < TEST_SENDERS; ++i) {
+        randombytes(test_keys[i], EXT_PUBLIC_KEY);
+    }
+}
+
+START_TEST(test_append_get)
+{
+    char path[64];
+    make_test_path(path, sizeof(path));
+    init_keys();
+
+    GC_History *history = gc_history_open(path, GC_HISTORY_MIN_SIZE);
+    ck_assert_msg(history != NULL, "failed to open log");
+    ck_assert_msg(gc_history_first_seq(history) == gc_history_next_seq(history), "new log not empty");
+    ck_assert_msg(gc_history_last_time(history) == 0, "new log has a last time");
+
+    GC_History_Entry entry, got;
+    uint32_t i;
+
+    for (i = 0; i < 100; ++i) {
+        make_entry(&entry, i, 1000 + i / 10);
+        ck_assert_msg(gc_history_append(history, &entry) == i + 1, "wrong sequence number for entry %u", i);
+    }
+
+    for (i = 0; i < 100; ++i) {
+        make_entry(&entry, i, 1000 + i / 10);
+        ck_assert_msg(gc_history_get(history, i + 1, &got) == 0, "failed to get entry %u", i);
+        ck_assert_msg(entries_equal(&entry, &got), "entry %u changed", i);
+    }
+
+    ck_assert_msg(gc_history_get(history, 101, &got) == -1, "got an entry that wasn't logged");
+    ck_assert_msg(gc_history_last_time(history) == 1009, "wrong last time");
+    ck_assert_msg(gc_history_find_time(history, 1005) == 51, "wrong first entry at time");
+    ck_assert_msg(gc_history_find_time(history, 0) == 1, "wrong first entry at time 0");
+    ck_assert_msg(gc_history_find_time(history, 2000) == 101, "found entry after last time");
+
+    make_entry(&entry, 95, 1009);
+    ck_assert_msg(gc_history_contains(history, &entry, 101), "logged entry not found");
+    ck_assert_msg(!gc_history_contains(history, &entry, 96), "entry found before it was logged");
+    entry.signature[0] ^= 1;
+    ck_assert_msg(!gc_history_contains(history, &entry, 101), "entry with another signature found");
+    entry.signature[0] ^= 1;
+    entry.time += GC_HISTORY_MAX_CLOCK_SKEW;
+    ck_assert_msg(gc_history_contains(history, &entry, 101), "entry with a skewed time not found");
+    entry.time += 1000;
+    ck_assert_msg(!gc_history_contains(history, &entry, 101), "entry looked for past the clock skew");
+
+    gc_history_close(history);
+
+    /* Reopened with the same size the log keeps its entries */
+    history = gc_history_open(path, GC_HISTORY_MIN_SIZE);
+    ck_assert_msg(history != NULL, "failed to reopen log");
+    ck_assert_msg(gc_history_first_seq(history) == 1 && gc_history_next_seq(history) == 101,
+                  "reopened log lost entries");
+    make_entry(&entry, 42, 1004);
+    ck_assert_msg(gc_history_get(history, 43, &got) == 0 && entries_equal(&entry, &got),
+                  "reopened log changed entry");
+    gc_history_close(history);
+
+    /* With another size it's started over */
+    history = gc_history_open(path, GC_HISTORY_MIN_SIZE * 2);
+    ck_assert_msg(history != NULL, "failed to reopen log with new size");
+    ck_assert_msg(gc_history_first_seq(history) == gc_history_next_seq(history), "resized log not empty");
+    gc_history_close(history);
+
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_bound)
+{
+    char path[64];
+    make_test_path(path, sizeof(path));
+    init_keys();
+
+    GC_History *history = gc_history_open(path, GC_HISTORY_MIN_SIZE);
+    ck_assert_msg(history != NULL, "failed to open log");
+
+    GC_History_Entry entry, got;
+    uint32_t i;
+
+    for (i = 0; i < 5000; ++i) {
+        make_entry(&entry, i, 1000 + i);
+        ck_assert_msg(gc_history_append(history, &entry) == i + 1, "failed to append entry %u", i);
+    }
+
+    uint64_t first_seq = gc_history_first_seq(history);
+    ck_assert_msg(first_seq > 1, "full log didn't drop old entries");
+    ck_assert_msg(gc_history_next_seq(history) == 5001, "wrong next sequence number");
+    ck_assert_msg(gc_history_get(history, first_seq - 1, &got) == -1, "got dropped entry");
+
+    for (i = first_seq - 1; i < 5000; ++i) {
+        make_entry(&entry, i, 1000 + i);
+        ck_assert_msg(gc_history_get(history, i + 1, &got) == 0 && entries_equal(&entry, &got),
+                      "entry %u changed after wrapping", i);
+    }
+
+    ck_assert_msg(gc_history_find_time(history, 0) == first_seq, "find_time returned dropped entry");
+
+    gc_history_close(history);
+
+    history = gc_history_open(path, GC_HISTORY_MIN_SIZE);
+    ck_assert_msg(history != NULL, "failed to reopen log");
+    ck_assert_msg(gc_history_first_seq(history) == first_seq && gc_history_next_seq(history) == 5001,
+                  "reopened wrapped log lost entries");
+    gc_history_close(history);
+
+    unlink(path);
+}
+END_TEST
+
+typedef struct {
+    uint32_t num;
+    uint32_t bad;
+} Unpack_State;
+
+static void check_unpacked(void *object, const GC_History_Entry *entry)
+{
+    Unpack_State *state = object;
+    GC_History_Entry expected;
+    make_entry(&expected, state->num, 1000 + state->num * 3);
+
+    if (!entries_equal(&expected, entry))
+        ++state->bad;
+
+    ++state->num;
+}
+
+START_TEST(test_batch)
+{
+    char path[64];
+    make_test_path(path, sizeof(path));
+    init_keys();
+
+    GC_History *history = gc_history_open(path, GC_HISTORY_MIN_SIZE);
+    ck_assert_msg(history != NULL, "failed to open log");
+
+    GC_History_Entry entry;
+    uint32_t i;
+
+    for (i = 0; i < 200; ++i) {
+        make_entry(&entry, i, 1000 + i * 3);
+        gc_history_append(history, &entry);
+    }
+
+    uint8_t data[1700];
+    Unpack_State state = {0, 0};
+    uint64_t seq = 1;
+    uint32_t batches = 0;
+
+    while (seq < gc_history_next_seq(history)) {
+        uint64_t next_seq;
+        int length = gc_history_pack_batch(history, seq, data, sizeof(data), &next_seq);
+        ck_assert_msg(length > 0 && next_seq > seq, "failed to pack batch at %u", (uint32_t)seq);
+
+        int unpacked = gc_history_unpack_batch(data, length, &check_unpacked, &state);
+        ck_assert_msg(unpacked == next_seq - seq, "unpacked %d entries, expected %u", unpacked,
+                      (uint32_t)(next_seq - seq));
+
+        /* A cut short batch is rejected as a whole */
+        uint32_t before = state.num;
+        ck_assert_msg(gc_history_unpack_batch(data, length - 1, &check_unpacked, &state) == -1,
+                      "cut short batch accepted");
+        ck_assert_msg(state.num == before, "callback called for rejected batch");
+
+        seq = next_seq;
+        ++batches;
+    }
+
+    ck_assert_msg(state.num == 200 && state.bad == 0, "batches changed entries");
+    ck_assert_msg(batches > 1, "200 entries fit in a single batch");
+
+    /* Nothing left to pack */
+    uint64_t next_seq;
+    ck_assert_msg(gc_history_pack_batch(history, seq, data, sizeof(data), &next_seq) >= 0 && next_seq == seq,
+                  "packed entries past the end");
+
+    gc_history_close(history);
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_sign)
+{
+    uint8_t secret_key[EXT_SECRET_KEY];
+    uint8_t chat_id[CHAT_ID_SIZE], other_chat_id[CHAT_ID_SIZE];
+    randombytes(chat_id, sizeof(chat_id));
+    memcpy(other_chat_id, chat_id, sizeof(chat_id));
+    other_chat_id[0] ^= 1;
+
+    GC_History_Entry entry;
+    make_entry(&entry, 3, 1000);
+    create_extended_keypair(entry.public_key, secret_key);
+
+    ck_assert_msg(gc_history_sign(&entry, chat_id, secret_key) == 0, "failed to sign entry");
+    ck_assert_msg(gc_history_verify(&entry, chat_id), "signature of entry didn't check out");
+    ck_assert_msg(!gc_history_verify(&entry, other_chat_id), "signature checked out for another group");
+
+    /* The nick isn't signed, anything else is */
+    entry.nick[0] ^= 1;
+    ck_assert_msg(gc_history_verify(&entry, chat_id), "signature covers the nick");
+    entry.message[0] ^= 1;
+    ck_assert_msg(!gc_history_verify(&entry, chat_id), "signature checked out for a changed message");
+    entry.message[0] ^= 1;
+    ++entry.time;
+    ck_assert_msg(!gc_history_verify(&entry, chat_id), "signature checked out for a changed time");
+    --entry.time;
+    entry.type = GC_MESSAGE_TYPE_ACTION;
+    ck_assert_msg(!gc_history_verify(&entry, chat_id), "signature checked out for a changed type");
+}
+END_TEST
+
+static Suite *group_history_suite(void)
+{
+    Suite *s = suite_create("Group history");
+
+    DEFTESTCASE(append_get);
+    DEFTESTCASE(bound);
+    DEFTESTCASE(batch);
+    DEFTESTCASE(sign);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    srand(0);
+
+    Suite *group_history = group_history_suite();
+    SRunner *test_runner = srunner_create(group_history);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
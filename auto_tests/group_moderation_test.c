@@ -0,0 +1,320 @@
+/* Tests for the sanctions list deltas group peers sync with and for moderation list validation.
+ *
+ * A delta must rebuild the sender's list in the same order, so that its hash matches the
+ * credentials, and a delta that doesn't must leave the receiver's list as it was.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/group_chats.h"
+#include "../toxcore/group_connection.h"
+#include "../toxcore/group_moderation.h"
+#include "../toxcore/util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+
+#include "helpers.h"
+
+#define TEST_PEERS 20
+#define TEST_SANCTIONS 10
+
+static GC_Connection test_gconns[TEST_PEERS];
+static GC_Connection *test_gcc[TEST_PEERS];
+static GC_GroupPeer test_group[TEST_PEERS];
+static Networking_Core *test_net;   /* gives the chats their clock */
+
+/* Makes founder the founder of a group with TEST_PEERS peers and peer a member of the same group. */
+static void setup_chats(GC_Chat *founder, GC_Chat *peer)
+{
+    uint32_t i;
+
+    memset(founder, 0, sizeof(GC_Chat));
+    memset(peer, 0, sizeof(GC_Chat));
+
+    create_extended_keypair(founder->self_public_key, founder->self_secret_key);
+    memcpy(founder->shared_state.founder_public_key, founder->self_public_key, EXT_PUBLIC_KEY);
+    memcpy(peer->shared_state.founder_public_key, founder->self_public_key, EXT_PUBLIC_KEY);
+
+    for (i = 0; i < TEST_PEERS; ++i) {
+        randombytes(test_gconns[i].addr.public_key, ENC_PUBLIC_KEY);
+        test_gcc[i] = &test_gconns[i];
+    }
+
+    founder->gcc = test_gcc;
+    founder->group = test_group;
+    founder->numpeers = TEST_PEERS;
+    founder->net = test_net;
+    peer->net = test_net;
+}
+
+static void copy_sanctions(const GC_Chat *from, GC_Chat *to)
+{
+    sanctions_list_cleanup(to);
+    to->moderation.sanctions = malloc(sizeof(struct GC_Sanction) * (from->moderation.num_sanctions + 1));
+    ck_assert_msg(to->moderation.sanctions != NULL, "malloc failed");
+    memcpy(to->moderation.sanctions, from->moderation.sanctions,
+           sizeof(struct GC_Sanction) * from->moderation.num_sanctions);
+    to->moderation.num_sanctions = from->moderation.num_sanctions;
+    memcpy(&to->moderation.sanctions_creds, &from->moderation.sanctions_creds, sizeof(struct GC_Sanction_Creds));
+}
+
+/* Entries are compared packed, unpacked ones have unset bytes in their union */
+static bool same_sanctions(GC_Chat *a, GC_Chat *b)
+{
+    uint8_t packed_a[MAX_GC_SANCTIONS * sizeof(struct GC_Sanction)];
+    uint8_t packed_b[MAX_GC_SANCTIONS * sizeof(struct GC_Sanction)];
+
+    int len_a = sanctions_list_pack(packed_a, sizeof(packed_a), a->moderation.sanctions,
+                                    &a->moderation.sanctions_creds, a->moderation.num_sanctions);
+    int len_b = sanctions_list_pack(packed_b, sizeof(packed_b), b->moderation.sanctions,
+                                    &b->moderation.sanctions_creds, b->moderation.num_sanctions);
+
+    return len_a > 0 && len_a == len_b && memcmp(packed_a, packed_b, len_a) == 0;
+}
+
+/* Packs the delta founder sends to peer into data.
+ *
+ * Returns the length of the delta.
+ */
+static int make_delta(GC_Chat *founder, const GC_Chat *peer, uint8_t *data, uint16_t length, uint16_t *num_new)
+{
+    uint8_t packed_ids[sizeof(uint16_t) + MAX_GC_SANCTIONS * sizeof(uint32_t)];
+    int ids_len = sanctions_list_pack_ids(peer, packed_ids, sizeof(packed_ids));
+    ck_assert_msg(ids_len == sizeof(uint16_t) + peer->moderation.num_sanctions * sizeof(uint32_t),
+                  "wrong length of packed ids %d", ids_len);
+
+    uint32_t ids[MAX_GC_SANCTIONS];
+    uint16_t num_ids;
+    ck_assert_msg(sanctions_list_unpack_ids(ids, MAX_GC_SANCTIONS, &num_ids, packed_ids, ids_len - 1) == -1,
+                  "unpacked truncated ids");
+    ck_assert_msg(sanctions_list_unpack_ids(ids, MAX_GC_SANCTIONS, &num_ids, packed_ids, ids_len) == ids_len,
+                  "failed to unpack ids");
+    ck_assert_msg(num_ids == peer->moderation.num_sanctions, "wrong number of ids %u", num_ids);
+
+    int delta_len = sanctions_list_pack_delta(founder, ids, num_ids, data, length, num_new);
+    ck_assert_msg(delta_len > 0, "failed to pack delta");
+    return delta_len;
+}
+
+START_TEST(test_delta)
+{
+    GC_Chat founder, peer;
+    struct GC_Sanction sanction;
+    uint8_t data[MAX_GC_SANCTIONS * sizeof(struct GC_Sanction)];
+    uint16_t num_new;
+    uint32_t i;
+
+    setup_chats(&founder, &peer);
+
+    for (i = 0; i < TEST_SANCTIONS; ++i)
+        ck_assert_msg(sanctions_list_make_entry(&founder, i, &sanction, SA_OBSERVER) == 0,
+                      "failed to make entry %u", i);
+
+    /* All our entries are new to a peer that has none */
+    int delta_len = make_delta(&founder, &peer, data, sizeof(data), &num_new);
+    ck_assert_msg(num_new == TEST_SANCTIONS, "%u new entries out of %u", num_new, TEST_SANCTIONS);
+    ck_assert_msg(sanctions_list_apply_delta(&peer, data, delta_len, NULL) == delta_len, "failed to apply full delta");
+    ck_assert_msg(same_sanctions(&founder, &peer), "lists differ after full delta");
+
+    /* A removal moves the last entry into the removed one's place, the delta keeps the order */
+    ck_assert_msg(sanctions_list_remove_observer(&founder, test_gconns[3].addr.public_key, NULL) == 0,
+                  "failed to remove entry");
+
+    for (i = TEST_SANCTIONS; i < TEST_SANCTIONS + 2; ++i)
+        ck_assert_msg(sanctions_list_make_entry(&founder, i, &sanction, SA_OBSERVER) == 0,
+                      "failed to make entry %u", i);
+
+    delta_len = make_delta(&founder, &peer, data, sizeof(data), &num_new);
+    ck_assert_msg(num_new == 2, "%u new entries instead of 2", num_new);
+    ck_assert_msg(sanctions_list_apply_delta(&peer, data, delta_len, NULL) == delta_len, "failed to apply delta");
+    ck_assert_msg(same_sanctions(&founder, &peer), "lists differ after delta");
+    ck_assert_msg(!sanctions_list_is_observer(&peer, test_gconns[3].addr.public_key), "removed entry kept");
+
+    /* Removals alone carry no entries */
+    ck_assert_msg(sanctions_list_remove_observer(&founder, test_gconns[0].addr.public_key, NULL) == 0,
+                  "failed to remove entry");
+    delta_len = make_delta(&founder, &peer, data, sizeof(data), &num_new);
+    ck_assert_msg(num_new == 0, "%u new entries instead of 0", num_new);
+    ck_assert_msg(sanctions_list_apply_delta(&peer, data, delta_len, NULL) == delta_len, "failed to apply removal");
+    ck_assert_msg(same_sanctions(&founder, &peer), "lists differ after removal");
+
+    sanctions_list_cleanup(&founder);
+    sanctions_list_cleanup(&peer);
+    sanctions_cache_cleanup(&founder);
+    sanctions_cache_cleanup(&peer);
+}
+END_TEST
+
+START_TEST(test_bad_delta)
+{
+    GC_Chat founder, peer;
+    struct GC_Sanction sanction;
+    uint8_t data[MAX_GC_SANCTIONS * sizeof(struct GC_Sanction)];
+    uint16_t num_new;
+    uint32_t i;
+
+    setup_chats(&founder, &peer);
+
+    for (i = 0; i < TEST_SANCTIONS; ++i)
+        ck_assert_msg(sanctions_list_make_entry(&founder, i, &sanction, SA_OBSERVER) == 0,
+                      "failed to make entry %u", i);
+
+    copy_sanctions(&founder, &peer);
+    ck_assert_msg(sanctions_list_make_entry(&founder, TEST_SANCTIONS, &sanction, SA_OBSERVER) == 0,
+                  "failed to make entry");
+
+    struct GC_Sanction old_sanctions[TEST_SANCTIONS];
+    struct GC_Sanction_Creds old_creds;
+    memcpy(old_sanctions, peer.moderation.sanctions, sizeof(old_sanctions));
+    memcpy(&old_creds, &peer.moderation.sanctions_creds, sizeof(old_creds));
+
+    int delta_len = make_delta(&founder, &peer, data, sizeof(data), &num_new);
+    ck_assert_msg(num_new == 1, "%u new entries instead of 1", num_new);
+
+    ck_assert_msg(sanctions_list_apply_delta(&peer, data, delta_len - 1, NULL) == -1, "applied truncated delta");
+
+    /* An id that points at the wrong entry, as colliding ids would, puts the list out of order */
+    uint8_t bad_data[sizeof(data)];
+    memcpy(bad_data, data, delta_len);
+    memcpy(bad_data + sizeof(uint16_t), data + sizeof(uint16_t) + sizeof(uint32_t), sizeof(uint32_t));
+    memcpy(bad_data + sizeof(uint16_t) + sizeof(uint32_t), data + sizeof(uint16_t), sizeof(uint32_t));
+    ck_assert_msg(sanctions_list_apply_delta(&peer, bad_data, delta_len, NULL) == -1, "applied delta out of order");
+
+    /* A new entry that doesn't come from a moderator */
+    memcpy(bad_data, data, delta_len);
+    bad_data[delta_len - GC_SANCTIONS_CREDENTIALS_SIZE - 1] ^= 1;
+    ck_assert_msg(sanctions_list_apply_delta(&peer, bad_data, delta_len, NULL) == -1,
+                  "applied delta with bad signature");
+
+    ck_assert_msg(peer.moderation.num_sanctions == TEST_SANCTIONS
+                  && memcmp(peer.moderation.sanctions, old_sanctions, sizeof(old_sanctions)) == 0
+                  && memcmp(&peer.moderation.sanctions_creds, &old_creds, sizeof(old_creds)) == 0,
+                  "bad deltas changed the list");
+
+    ck_assert_msg(sanctions_list_apply_delta(&peer, data, delta_len, NULL) == delta_len, "failed to apply delta");
+    ck_assert_msg(same_sanctions(&founder, &peer), "lists differ after delta");
+
+    sanctions_list_cleanup(&founder);
+    sanctions_list_cleanup(&peer);
+    sanctions_cache_cleanup(&founder);
+    sanctions_cache_cleanup(&peer);
+}
+END_TEST
+
+/* Entries verified once are skipped, but a changed entry is never taken from the cache */
+START_TEST(test_verify_cache)
+{
+    GC_Chat founder, peer;
+    struct GC_Sanction sanction;
+    uint32_t i;
+
+    setup_chats(&founder, &peer);
+
+    for (i = 0; i < TEST_SANCTIONS; ++i)
+        ck_assert_msg(sanctions_list_make_entry(&founder, i, &sanction, SA_OBSERVER) == 0,
+                      "failed to make entry %u", i);
+
+    Crypto_Pipeline *pipeline = new_crypto_pipeline(2);
+    ck_assert_msg(pipeline != NULL, "failed to create pipeline");
+
+    struct GC_Sanction sanctions[TEST_SANCTIONS];
+    memcpy(sanctions, founder.moderation.sanctions, sizeof(sanctions));
+
+    ck_assert_msg(sanctions_list_check_integrity(&peer, &founder.moderation.sanctions_creds, sanctions,
+                  TEST_SANCTIONS, pipeline) == 0, "valid list rejected");
+    ck_assert_msg(peer.moderation.num_verified == TEST_SANCTIONS, "%u entries cached instead of %u",
+                  peer.moderation.num_verified, TEST_SANCTIONS);
+
+    ck_assert_msg(sanctions_list_check_integrity(&peer, &founder.moderation.sanctions_creds, sanctions,
+                  TEST_SANCTIONS, NULL) == 0, "cached list rejected");
+    ck_assert_msg(peer.moderation.num_verified == TEST_SANCTIONS, "cached entries added again");
+
+    sanctions[TEST_SANCTIONS - 1].target_pk[0] ^= 1;
+    ck_assert_msg(sanctions_list_check_integrity(&peer, &founder.moderation.sanctions_creds, sanctions,
+                  TEST_SANCTIONS, pipeline) == -1, "changed entry accepted");
+
+    memcpy(sanctions, founder.moderation.sanctions, sizeof(sanctions));
+    sanctions[0].signature[0] ^= 1;
+    ck_assert_msg(sanctions_list_check_integrity(&peer, &founder.moderation.sanctions_creds, sanctions,
+                  TEST_SANCTIONS, NULL) == -1, "entry with bad signature accepted");
+
+    kill_crypto_pipeline(pipeline);
+    sanctions_list_cleanup(&founder);
+    sanctions_cache_cleanup(&founder);
+    sanctions_cache_cleanup(&peer);
+}
+END_TEST
+
+/* The running moderator list hash must match a hash of the whole list */
+START_TEST(test_mod_list_hash)
+{
+    GC_Chat chat;
+    uint8_t mods[MAX_GC_MODERATORS][GC_MOD_LIST_ENTRY_SIZE];
+    uint8_t hash[GC_MODERATION_HASH_SIZE];
+    uint8_t expected[GC_MODERATION_HASH_SIZE];
+    uint8_t packed[MAX_GC_MODERATORS * GC_MOD_LIST_ENTRY_SIZE];
+    uint32_t i;
+
+    memset(&chat, 0, sizeof(GC_Chat));
+    randombytes((uint8_t *)mods, sizeof(mods));
+
+    for (i = 0; i < 50; ++i) {
+        if (i % 7 == 3) {
+            ck_assert_msg(mod_list_remove_entry(&chat, mods[i / 2]) == 0, "failed to remove mod %u", i / 2);
+        }
+
+        ck_assert_msg(mod_list_add_entry(&chat, mods[i]) == 0, "failed to add mod %u", i);
+
+        mod_list_make_hash(&chat, hash);
+        mod_list_pack(&chat, packed);
+        crypto_hash_sha256(expected, packed, chat.moderation.num_mods * GC_MOD_LIST_ENTRY_SIZE);
+        ck_assert_msg(memcmp(hash, expected, GC_MODERATION_HASH_SIZE) == 0, "wrong hash after %u changes", i);
+    }
+
+    ck_assert_msg(mod_list_unpack(&chat, packed, 2 * GC_MOD_LIST_ENTRY_SIZE, 2) == 2 * GC_MOD_LIST_ENTRY_SIZE,
+                  "failed to unpack mod list");
+    mod_list_make_hash(&chat, hash);
+    crypto_hash_sha256(expected, packed, 2 * GC_MOD_LIST_ENTRY_SIZE);
+    ck_assert_msg(memcmp(hash, expected, GC_MODERATION_HASH_SIZE) == 0, "wrong hash after unpack");
+
+    mod_list_cleanup(&chat);
+}
+END_TEST
+
+static Suite *group_moderation_suite(void)
+{
+    Suite *s = suite_create("Group moderation");
+
+    DEFTESTCASE(delta);
+    DEFTESTCASE(bad_delta);
+    DEFTESTCASE(verify_cache);
+    DEFTESTCASE(mod_list_hash);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    srand(0);
+    test_net = new_networking_no_udp(NULL);
+
+    if (test_net == NULL)
+        return 1;
+
+    Suite *group_moderation = group_moderation_suite();
+    SRunner *test_runner = srunner_create(group_moderation);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+    kill_networking(test_net);
+
+    return number_failed;
+}
@@ -0,0 +1,146 @@
+/* Tests for the hash index used to find group chats and their peers.
+ *
+ * Values are added and removed at random, many of them with the same hash, and
+ * every value still in the index must be found while removed ones must not.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/hash_index.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+
+#include "helpers.h"
+
+#define TEST_NUM_VALUES 2000
+
+/* Hash of each value, 0 if the value isn't in the index. */
+static uint32_t value_hashes[TEST_NUM_VALUES];
+
+static bool match_value(const void *object, uint32_t value, const void *key)
+{
+    return value == *(const uint32_t *)key;
+}
+
+static bool in_index(const Hash_Index *index, uint32_t value, uint32_t hash)
+{
+    return hash_index_find(index, hash, &match_value, NULL, &value) == value;
+}
+
+START_TEST(test_basic)
+{
+    Hash_Index index;
+    memset(&index, 0, sizeof(index));
+
+    uint32_t value = 5;
+    ck_assert_msg(hash_index_find(&index, 1234, NULL, NULL, NULL) == HASH_INDEX_NONE, "found value in empty index");
+    ck_assert_msg(hash_index_remove(&index, 1234, 5) == -1, "removed value from empty index");
+    ck_assert_msg(hash_index_add(&index, 1234, HASH_INDEX_NONE) == -1, "added invalid value");
+
+    ck_assert_msg(hash_index_add(&index, 1234, 5) == 0, "failed to add value");
+    ck_assert_msg(hash_index_add(&index, 1234, 6) == 0, "failed to add value with the same hash");
+    ck_assert_msg(in_index(&index, 5, 1234), "value not found");
+    ck_assert_msg(!in_index(&index, 5, 1235), "value found with the wrong hash");
+
+    value = 6;
+    ck_assert_msg(hash_index_find(&index, 1234, &match_value, NULL, &value) == 6, "wrong value with the same hash");
+
+    ck_assert_msg(hash_index_remove(&index, 1234, 7) == -1, "removed value that isn't in the index");
+    ck_assert_msg(hash_index_remove(&index, 1234, 5) == 0, "failed to remove value");
+    ck_assert_msg(!in_index(&index, 5, 1234), "removed value found");
+    ck_assert_msg(in_index(&index, 6, 1234), "value lost after removing another one");
+    ck_assert_msg(index.count == 1, "wrong count %u", index.count);
+
+    hash_index_free(&index);
+    ck_assert_msg(index.count == 0 && hash_index_find(&index, 1234, NULL, NULL, NULL) == HASH_INDEX_NONE,
+                  "index not empty after free");
+}
+END_TEST
+
+static void check_all_values(const Hash_Index *index, uint32_t count)
+{
+    uint32_t i, hash;
+
+    ck_assert_msg(index->count == count, "wrong count %u, expected %u", index->count, count);
+
+    for (i = 0; i < TEST_NUM_VALUES; ++i) {
+        hash = value_hashes[i] ? value_hashes[i] : (i % 64) + 1;
+        ck_assert_msg(in_index(index, i, hash) == (value_hashes[i] != 0), "value %u in index: %u, expected %u", i,
+                      in_index(index, i, hash), value_hashes[i] != 0);
+    }
+}
+
+START_TEST(test_churn)
+{
+    Hash_Index index;
+    memset(&index, 0, sizeof(index));
+    memset(value_hashes, 0, sizeof(value_hashes));
+
+    uint32_t i, count = 0;
+
+    /* Few different hashes so that removals have long runs of colliding entries to fix. */
+    for (i = 0; i < 200000; ++i) {
+        uint32_t value = rand() % TEST_NUM_VALUES;
+
+        if (value_hashes[value]) {
+            ck_assert_msg(hash_index_remove(&index, value_hashes[value], value) == 0, "failed to remove %u", value);
+            value_hashes[value] = 0;
+            --count;
+        } else {
+            value_hashes[value] = (value % 64) + 1;
+            ck_assert_msg(hash_index_add(&index, value_hashes[value], value) == 0, "failed to add %u", value);
+            ++count;
+        }
+
+        if (i % 10000 == 0)
+            check_all_values(&index, count);
+    }
+
+    check_all_values(&index, count);
+    ck_assert_msg(index.count * 2 <= index.size, "index more than half full");
+
+    /* Emptying the index shrinks it back. */
+    for (i = 0; i < TEST_NUM_VALUES; ++i) {
+        if (value_hashes[i]) {
+            ck_assert_msg(hash_index_remove(&index, value_hashes[i], i) == 0, "failed to remove %u", i);
+            value_hashes[i] = 0;
+        }
+    }
+
+    check_all_values(&index, 0);
+    ck_assert_msg(index.size <= 32, "index not shrunk, size %u", index.size);
+
+    hash_index_free(&index);
+}
+END_TEST
+
+static Suite *hash_index_suite(void)
+{
+    Suite *s = suite_create("Hash index");
+
+    DEFTESTCASE(basic);
+    DEFTESTCASE_SLOW(churn, 60);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    srand(0);
+
+    Suite *hash_index = hash_index_suite();
+    SRunner *test_runner = srunner_create(hash_index);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -0,0 +1,162 @@
+/* Tests for LAN discovery following interfaces as they come up.
+ *
+ * Runs in a network namespace of its own with a veth pair, so it needs root (or CAP_NET_ADMIN
+ * and user namespaces) and the ip tool, and is skipped without them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../toxcore/DHT.h"
+#include "../toxcore/LAN_discovery.h"
+#include "../toxcore/util.h"
+
+#include "helpers.h"
+
+#define TEST_PORT 33446
+
+/* Exit code that makes automake report the test as skipped. */
+#define EXIT_SKIP 77
+
+static DHT *new_test_dht(uint16_t port)
+{
+    IP ip;
+    ip_init(&ip, 0);
+    Networking_Core *net = new_networking(ip, port);
+    ck_assert_msg(net != NULL, "failed to bind port %u", port);
+
+    DHT *dht = new_DHT(net);
+    ck_assert_msg(dht != NULL, "failed to create DHT");
+    LANdiscovery_init(dht);
+    return dht;
+}
+
+static void kill_test_dht(DHT *dht)
+{
+    Networking_Core *net = dht->net;
+    LANdiscovery_kill(dht);
+    kill_DHT(dht);
+    kill_networking(net);
+}
+
+static _Bool knows(const DHT *dht, const uint8_t *public_key)
+{
+    uint32_t i;
+
+    for (i = 0; i < LCLIENT_LIST; ++i)
+        if (id_equal(dht->close_clientlist[i].client_id, public_key))
+            return 1;
+
+    return 0;
+}
+
+/* Runs both for about seconds, sending LAN discovery from a whenever it polls a change. */
+static void run(DHT *a, DHT *b, uint32_t seconds, _Bool *changed)
+{
+    uint32_t i;
+
+    for (i = 0; i < seconds * 20; ++i) {
+        if (LANdiscovery_poll(a)) {
+            *changed = 1;
+            send_LANdiscovery(htons(TOX_PORT_DEFAULT), a);
+        }
+
+        networking_poll(a->net);
+        networking_poll(b->net);
+        do_DHT(a);
+        do_DHT(b);
+        usleep(50000);
+    }
+}
+
+START_TEST(test_link_up)
+{
+    ck_assert_msg(unshare(CLONE_NEWNET) == 0 && system("ip link set lo up") == 0,
+                  "failed to set up the network namespace");
+
+    /* b listens where LAN discovery is sent to */
+    DHT *a = new_test_dht(TEST_PORT);
+    DHT *b = new_test_dht(TOX_PORT_DEFAULT);
+    _Bool changed = 0;
+
+    /* With only the loopback up there is nowhere to broadcast to */
+    send_LANdiscovery(htons(TOX_PORT_DEFAULT), a);
+    run(a, b, 2, &changed);
+    ck_assert_msg(!changed, "change reported while the interfaces stayed the same");
+    ck_assert_msg(!knows(b, a->self_public_key), "discovered without an interface");
+
+    ck_assert_msg(system("ip link add tox0 type veth peer name tox1"
+                         " && ip addr add 10.7.0.1/24 broadcast 10.7.0.255 dev tox0"
+                         " && ip link set tox0 up && ip link set tox1 up") == 0, "failed to set up the veth pair");
+
+    /* Well before LAN_DISCOVERY_INTERVAL */
+    run(a, b, 3, &changed);
+    ck_assert_msg(changed, "the interface coming up wasn't reported");
+    ck_assert_msg(knows(b, a->self_public_key), "not discovered after the interface came up");
+
+    /* Taking it down and up again is reported again */
+    changed = 0;
+    ck_assert_msg(system("ip link set tox1 down && ip link set tox1 up") == 0, "failed to flap the link");
+    run(a, b, 2, &changed);
+    ck_assert_msg(changed, "the link coming back wasn't reported");
+
+    kill_test_dht(a);
+    kill_test_dht(b);
+}
+END_TEST
+
+/* Tries what the test needs in a child, so that the namespace doesn't stick to this process. */
+static _Bool have_network_namespace(void)
+{
+    pid_t pid = fork();
+
+    if (pid == 0)
+        _exit(unshare(CLONE_NEWNET) == 0 && system("ip link set lo up > /dev/null 2>&1") == 0 ? 0 : 1);
+
+    int status;
+
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return 0;
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static Suite *lan_discovery_suite(void)
+{
+    Suite *s = suite_create("LAN discovery");
+
+    DEFTESTCASE_SLOW(link_up, 30);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!have_network_namespace()) {
+        printf("No network namespace (needs root and the ip tool), skipping\n");
+        return EXIT_SKIP;
+    }
+
+    Suite *lan_discovery = lan_discovery_suite();
+    SRunner *test_runner = srunner_create(lan_discovery);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -16,6 +16,7 @@
 
 #include "../testing/misc_tools.c" // hex_string_to_bin
 #include "../toxcore/Messenger.h"
+#include "../toxcore/util.h"
 #include <sys/types.h>
 #include <stdint.h>
 #include <string.h>
@@ -300,12 +301,128 @@ START_TEST(test_messenger_state_saveloadsave)
 }
 END_TEST
 
+/* Returns the offset of the contents of the savedata section of type in data, sets its length. */
+static uint32_t find_state_section(const uint8_t *data, uint32_t length, uint16_t type, uint32_t *section_length)
+{
+    uint32_t offset = sizeof(uint32_t) * 2;
+
+    while (offset + sizeof(uint32_t) * 2 <= length) {
+        uint32_t len, cookie_type;
+        lendian_to_host32(&len, data + offset);
+        lendian_to_host32(&cookie_type, data + offset + sizeof(uint32_t));
+        offset += sizeof(uint32_t) * 2;
+
+        if ((cookie_type & 0xFFFF) == type) {
+            *section_length = len;
+            return offset;
+        }
+
+        offset += len;
+    }
+
+    ck_abort_msg("Savedata section %u not found", type);
+    return 0;
+}
+
+/* Loads the savedata in a new messenger and gets the cache of the friend with good_id_a. */
+static void load_friend_cache(const uint8_t *data, uint32_t length, Friend_Conn_Cache *cache)
+{
+    Messenger_Options options = {0};
+    options.ipv6enabled = TOX_ENABLE_IPV6_DEFAULT;
+    Messenger *loaded = new_messenger(&options, 0);
+    ck_assert_msg(loaded != NULL, "Failed to create messenger");
+
+    messenger_load(loaded, data, length);
+
+    int32_t friendnum = getfriend_id(loaded, good_id_a);
+    ck_assert_msg(friendnum >= 0, "Friend not loaded");
+    ck_assert_msg(get_friendcon_cache(loaded->fr_c, getfriendcon_id(loaded, friendnum), cache) == 0,
+                  "Failed to get the friend connection cache");
+
+    kill_messenger(loaded);
+}
+
+#define FRIEND_CONNECTIONS_SECTION 12   /* MESSENGER_STATE_TYPE_FRIEND_CONNECTIONS */
+
+START_TEST(test_friend_connections_saveload)
+{
+    Messenger_Options options = {0};
+    options.ipv6enabled = TOX_ENABLE_IPV6_DEFAULT;
+    Messenger *saved = new_messenger(&options, 0);
+    ck_assert_msg(saved != NULL, "Failed to create messenger");
+
+    int32_t friendnum = m_addfriend_norequest(saved, good_id_a);
+    ck_assert_msg(friendnum >= 0, "Failed to add friend");
+
+    Friend_Conn_Cache cache;
+    memset(&cache, 0, sizeof(cache));
+    memcpy(cache.dht_temp_pk, good_id_b, crypto_box_PUBLICKEYBYTES);
+    cache.dht_pk_time = unix_time(saved->net->mono_time);
+    cache.ip_port.ip.family = AF_INET;
+    cache.ip_port.ip.ip4.uint32 = htonl(0x7F000001);
+    cache.ip_port.port = htons(33445);
+    cache.ip_port_time = unix_time(saved->net->mono_time);
+    cache.tcp_relays[0].ip_port.ip.family = AF_INET;
+    cache.tcp_relays[0].ip_port.ip.ip4.uint32 = htonl(0x01020304);
+    cache.tcp_relays[0].ip_port.port = htons(443);
+    memcpy(cache.tcp_relays[0].public_key, friend_id, crypto_box_PUBLICKEYBYTES);
+    ck_assert_msg(set_friendcon_cache(saved->fr_c, getfriendcon_id(saved, friendnum), &cache) == 0,
+                  "Failed to set the friend connection cache");
+
+    Friend_Conn_Cache expected;
+    get_friendcon_cache(saved->fr_c, getfriendcon_id(saved, friendnum), &expected);
+    ck_assert_msg(memcmp(expected.dht_temp_pk, good_id_b, crypto_box_PUBLICKEYBYTES) == 0, "DHT key not set");
+    ck_assert_msg(expected.tcp_relays[0].ip_port.ip.family == AF_INET, "Relay not set");
+    ck_assert_msg(expected.ip_port.ip.family == AF_INET, "Address not set");
+
+    uint32_t size = messenger_size(saved);
+    uint8_t *data = malloc(size);
+    ck_assert_msg(data != NULL, "malloc failed");
+    messenger_save(saved, data);
+    kill_messenger(saved);
+
+    /* Round trip */
+    Friend_Conn_Cache loaded;
+    load_friend_cache(data, size, &loaded);
+    ck_assert_msg(memcmp(loaded.dht_temp_pk, expected.dht_temp_pk, crypto_box_PUBLICKEYBYTES) == 0,
+                  "DHT key changed by save/load");
+    ck_assert_msg(ipport_equal(&loaded.ip_port, &expected.ip_port), "Address changed by save/load");
+    ck_assert_msg(ipport_equal(&loaded.tcp_relays[0].ip_port, &expected.tcp_relays[0].ip_port)
+                  && memcmp(loaded.tcp_relays[0].public_key, expected.tcp_relays[0].public_key,
+                            crypto_box_PUBLICKEYBYTES) == 0, "Relay changed by save/load");
+
+    uint32_t section_length;
+    uint32_t section = find_state_section(data, size, FRIEND_CONNECTIONS_SECTION, &section_length);
+    ck_assert_msg(section_length != 0, "Friend connection not saved");
+
+    /* A garbage address family in the relay slot, after [real_pk][dht_temp_pk][2 times][ip_port] */
+    uint8_t *garbage = malloc(size);
+    ck_assert_msg(garbage != NULL, "malloc failed");
+    memcpy(garbage, data, size);
+    garbage[section + crypto_box_PUBLICKEYBYTES * 2 + sizeof(uint64_t) * 2 + 1 + SIZE_IP6 + sizeof(uint16_t)] = 0x7F;
+    load_friend_cache(garbage, size, &loaded);
+    ck_assert_msg(loaded.dht_pk_time == 0 && loaded.tcp_relays[0].ip_port.ip.family == 0,
+                  "Invalid saved friend connection was loaded");
+    free(garbage);
+
+    /* A truncated section at the end of the savedata */
+    uint32_t truncated_size = section + section_length - 5;
+    host_to_lendian32(data + section - sizeof(uint32_t) * 2, section_length - 5);
+    load_friend_cache(data, truncated_size, &loaded);
+    ck_assert_msg(loaded.dht_pk_time == 0 && loaded.tcp_relays[0].ip_port.ip.family == 0,
+                  "Truncated saved friend connection was loaded");
+
+    free(data);
+}
+END_TEST
+
 Suite *messenger_suite(void)
 {
     Suite *s = suite_create("Messenger");
 
     DEFTESTCASE(dht_state_saveloadsave);
     DEFTESTCASE(messenger_state_saveloadsave);
+    DEFTESTCASE(friend_connections_saveload);
 
     DEFTESTCASE(getself_name);
     DEFTESTCASE(m_get_userstatus_size);
@@ -0,0 +1,144 @@
+/* Tests for the queue the threads that send to friends push to.
+ *
+ * Several threads push numbered nodes while this one pops them, and every node must come out
+ * exactly once and after the nodes its thread pushed before it.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/mpsc_queue.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+
+#include "helpers.h"
+
+#define TEST_NUM_PRODUCERS 8
+#define TEST_NODES_PER_PRODUCER 100000
+
+typedef struct {
+    MPSC_Node node;
+    uint32_t producer;
+    uint32_t number;
+} Test_Node;
+
+typedef struct {
+    MPSC_Queue *queue;
+    Test_Node *nodes;
+    pthread_t thread;
+} Test_Producer;
+
+START_TEST(test_basic)
+{
+    MPSC_Queue queue;
+    mpsc_queue_init(&queue);
+    ck_assert_msg(mpsc_queue_pop(&queue) == NULL, "popped from empty queue");
+
+    Test_Node nodes[3];
+    uint32_t i;
+
+    for (i = 0; i < 3; ++i)
+        mpsc_queue_push(&queue, &nodes[i].node);
+
+    ck_assert_msg(mpsc_queue_pop(&queue) == &nodes[0].node, "wrong first node");
+    ck_assert_msg(mpsc_queue_pop(&queue) == &nodes[1].node, "wrong second node");
+
+    /* Pushing while the queue holds a node and after it was emptied keeps the order */
+    mpsc_queue_push(&queue, &nodes[0].node);
+    ck_assert_msg(mpsc_queue_pop(&queue) == &nodes[2].node, "wrong third node");
+    ck_assert_msg(mpsc_queue_pop(&queue) == &nodes[0].node, "wrong node pushed again");
+    ck_assert_msg(mpsc_queue_pop(&queue) == NULL, "queue not empty");
+
+    mpsc_queue_push(&queue, &nodes[1].node);
+    ck_assert_msg(mpsc_queue_pop(&queue) == &nodes[1].node, "wrong node pushed to emptied queue");
+    ck_assert_msg(mpsc_queue_pop(&queue) == NULL, "queue not empty at the end");
+}
+END_TEST
+
+static void *produce(void *arg)
+{
+    Test_Producer *producer = arg;
+    uint32_t i;
+
+    for (i = 0; i < TEST_NODES_PER_PRODUCER; ++i)
+        mpsc_queue_push(producer->queue, &producer->nodes[i].node);
+
+    return NULL;
+}
+
+START_TEST(test_producers)
+{
+    MPSC_Queue queue;
+    mpsc_queue_init(&queue);
+
+    Test_Producer producers[TEST_NUM_PRODUCERS];
+    uint32_t next[TEST_NUM_PRODUCERS] = {0};
+    uint32_t i, j;
+
+    for (i = 0; i < TEST_NUM_PRODUCERS; ++i) {
+        producers[i].queue = &queue;
+        producers[i].nodes = calloc(TEST_NODES_PER_PRODUCER, sizeof(Test_Node));
+        ck_assert_msg(producers[i].nodes != NULL, "out of memory");
+
+        for (j = 0; j < TEST_NODES_PER_PRODUCER; ++j) {
+            producers[i].nodes[j].producer = i;
+            producers[i].nodes[j].number = j;
+        }
+    }
+
+    for (i = 0; i < TEST_NUM_PRODUCERS; ++i)
+        ck_assert_msg(pthread_create(&producers[i].thread, NULL, &produce, &producers[i]) == 0, "failed to start thread");
+
+    uint64_t popped = 0;
+
+    while (popped < (uint64_t)TEST_NUM_PRODUCERS * TEST_NODES_PER_PRODUCER) {
+        Test_Node *node = (Test_Node *)mpsc_queue_pop(&queue);
+
+        if (node == NULL)
+            continue;
+
+        ck_assert_msg(node->producer < TEST_NUM_PRODUCERS, "popped a node nobody pushed");
+        ck_assert_msg(node->number == next[node->producer], "node %u of thread %u popped, expected %u", node->number,
+                      node->producer, next[node->producer]);
+        ++next[node->producer];
+        ++popped;
+    }
+
+    for (i = 0; i < TEST_NUM_PRODUCERS; ++i)
+        pthread_join(producers[i].thread, NULL);
+
+    ck_assert_msg(mpsc_queue_pop(&queue) == NULL, "queue not empty after popping every node");
+
+    for (i = 0; i < TEST_NUM_PRODUCERS; ++i)
+        free(producers[i].nodes);
+}
+END_TEST
+
+static Suite *mpsc_queue_suite(void)
+{
+    Suite *s = suite_create("MPSC queue");
+
+    DEFTESTCASE(basic);
+    DEFTESTCASE_SLOW(producers, 60);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *mpsc_queue = mpsc_queue_suite();
+    SRunner *test_runner = srunner_create(mpsc_queue);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
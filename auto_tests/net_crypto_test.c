@@ -0,0 +1,598 @@
+/* Tests for the net_crypto request and coalesced packets.
+ *
+ * The request packets are generated from a receive window with holes and handled
+ * by a send window holding every packet, the packets the send side marks to be
+ * sent again must be exactly the missing ones.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../toxcore/net_crypto.c"
+
+#include "helpers.h"
+
+/* Lossless packet id used in the coalescing tests. */
+#define TEST_PACKET_ID 160
+
+/* RTT in ms used to turn recovery rounds into a recovery time. */
+#define TEST_RTT 100
+
+/* Clock of the tests that handle packets on bare arrays. */
+static Mono_Time *test_mono_time;
+
+/* Fill send_array with window packets and recv_array with the ones lost[] is not set for.
+ */
+static void fill_arrays(Packets_Array *send_array, Packets_Array *recv_array, const uint8_t *lost, uint32_t window)
+{
+    Packet_Data dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.sent_time = 1;
+    dt.length = 1;
+
+    uint32_t i;
+
+    for (i = 0; i < window; ++i) {
+        ck_assert_msg(add_data_end_of_buffer(send_array, &dt) == i, "failed to add packet to send array");
+
+        if (!lost[i])
+            ck_assert_msg(add_data_to_buffer(recv_array, i, &dt) == 0, "failed to add packet to recv array");
+    }
+
+    ck_assert_msg(set_buffer_end(recv_array, window) == 0, "failed to set recv buffer end");
+}
+
+/* Check that the first covered packets of send_array were removed or marked lost according
+ * to lost[], the packets after them must be untouched.
+ */
+static void check_send_array(const Packets_Array *send_array, const uint8_t *lost, uint32_t window, uint32_t covered)
+{
+    uint32_t i;
+
+    for (i = 0; i < window; ++i) {
+        const Packet_Data *dt = send_array->buffer[i % CRYPTO_PACKET_BUFFER_SIZE];
+
+        if (i >= covered) {
+            ck_assert_msg(dt != NULL && dt->sent_time == 1, "packet %u after the covered part was touched", i);
+        } else if (lost[i]) {
+            ck_assert_msg(dt != NULL && dt->sent_time == 0 && dt->requested, "lost packet %u not requested", i);
+        } else {
+            ck_assert_msg(dt == NULL, "received packet %u not removed", i);
+        }
+    }
+}
+
+/* Generate a sack packet from the lost[] packets and handle it.
+ *
+ * return number of packets the sack covers.
+ */
+static uint32_t sack_roundtrip(const uint8_t *lost, uint32_t window)
+{
+    Packets_Array *send_array = calloc(1, sizeof(Packets_Array));
+    Packets_Array *recv_array = calloc(1, sizeof(Packets_Array));
+    ck_assert_msg(send_array != NULL && recv_array != NULL, "malloc failed");
+
+    fill_arrays(send_array, recv_array, lost, window);
+
+    uint8_t data[MAX_CRYPTO_DATA_SIZE];
+    int len = generate_sack_packet(data, sizeof(data), recv_array);
+    ck_assert_msg(len >= (int)SACK_HEADER_LENGTH && len <= (int)sizeof(data), "generating the sack failed: %i", len);
+
+    uint16_t covered;
+    memcpy(&covered, data + 1, sizeof(uint16_t));
+    covered = ntohs(covered);
+
+    uint64_t latest_send_time = 0;
+    uint32_t num_acked, num_lost;
+    int requested = handle_sack_packet(test_mono_time, send_array, data, len, &latest_send_time, 0, &num_acked,
+                                       &num_lost);
+
+    uint32_t i, num_missing = 0;
+
+    for (i = 0; i < covered; ++i) {
+        num_missing += lost[i];
+    }
+
+    ck_assert_msg(requested == (int)num_missing, "%u packets were missing but %i were requested", num_missing, requested);
+    ck_assert_msg(num_lost == num_missing, "%u packets were missing but %u were marked lost", num_missing, num_lost);
+    ck_assert_msg(num_acked == covered - num_missing, "%u packets were received but %u were acked",
+                  covered - num_missing, num_acked);
+    ck_assert_msg(latest_send_time == (num_acked ? 1 : 0), "wrong latest send time");
+    check_send_array(send_array, lost, window, covered);
+
+    clear_buffer(send_array);
+    clear_buffer(recv_array);
+    free(send_array);
+    free(recv_array);
+    return covered;
+}
+
+START_TEST(test_sack_roundtrip)
+{
+    static uint8_t lost[CRYPTO_PACKET_BUFFER_SIZE];
+    const double loss_rates[] = {0.0, 0.001, 0.02, 0.2, 0.5, 0.9, 1.0};
+    unsigned int i, j;
+
+    srand(1);
+
+    for (i = 0; i < sizeof(loss_rates) / sizeof(loss_rates[0]); ++i) {
+        for (j = 0; j < CRYPTO_PACKET_BUFFER_SIZE; ++j) {
+            lost[j] = rand() < loss_rates[i] * RAND_MAX;
+        }
+
+        ck_assert_msg(sack_roundtrip(lost, 1000) == 1000, "sack did not cover a 1000 packet window");
+        sack_roundtrip(lost, CRYPTO_PACKET_BUFFER_SIZE);
+    }
+
+    /* Holes of every length around the range/bitmap threshold. */
+    memset(lost, 0, sizeof(lost));
+
+    for (i = 1, j = 3; j + i < CRYPTO_PACKET_BUFFER_SIZE; j += i * 2 + 5, ++i) {
+        memset(lost + j, 1, i);
+    }
+
+    ck_assert_msg(sack_roundtrip(lost, CRYPTO_PACKET_BUFFER_SIZE) == CRYPTO_PACKET_BUFFER_SIZE,
+                  "sack did not cover the whole window");
+}
+END_TEST
+
+START_TEST(test_sack_truncated)
+{
+    static uint8_t lost[CRYPTO_PACKET_BUFFER_SIZE];
+    unsigned int i;
+
+    /* Every other packet lost needs more bitmap than fits in a packet. */
+    for (i = 0; i < CRYPTO_PACKET_BUFFER_SIZE; ++i) {
+        lost[i] = i % 2;
+    }
+
+    uint32_t covered = sack_roundtrip(lost, CRYPTO_PACKET_BUFFER_SIZE);
+    ck_assert_msg(covered < CRYPTO_PACKET_BUFFER_SIZE && covered > CRYPTO_PACKET_BUFFER_SIZE / 2,
+                  "bad number of packets covered: %u", covered);
+}
+END_TEST
+
+START_TEST(test_sack_invalid)
+{
+    Packets_Array *send_array = calloc(1, sizeof(Packets_Array));
+    ck_assert_msg(send_array != NULL, "malloc failed");
+
+    Packet_Data dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.sent_time = 1;
+
+    unsigned int i;
+
+    for (i = 0; i < 100; ++i) {
+        add_data_end_of_buffer(send_array, &dt);
+    }
+
+    uint64_t latest_send_time = 0;
+    uint32_t num_acked, num_lost;
+
+    /* Covers more packets than were sent. */
+    uint8_t too_many[] = {PACKET_ID_SACK, 0, 101};
+    ck_assert_msg(handle_sack_packet(test_mono_time, send_array, too_many, sizeof(too_many), &latest_send_time, 0,
+                                     &num_acked, &num_lost) == -1, "handled sack covering unsent packets");
+
+    /* Range going past the covered packets. */
+    uint8_t long_range[] = {PACKET_ID_SACK, 0, 50, 0, 10, 0, 41};
+    ck_assert_msg(handle_sack_packet(test_mono_time, send_array, long_range, sizeof(long_range), &latest_send_time, 0,
+                                     &num_acked, &num_lost) == -1, "handled sack with a range past the end");
+
+    /* Bitmap longer than the packet. */
+    uint8_t short_bitmap[] = {PACKET_ID_SACK, 0, 50, 0x80, 0, 4, 0xFF};
+    ck_assert_msg(handle_sack_packet(test_mono_time, send_array, short_bitmap, sizeof(short_bitmap),
+                                     &latest_send_time, 0, &num_acked, &num_lost) == -1,
+                  "handled sack with a truncated bitmap");
+
+    clear_buffer(send_array);
+    free(send_array);
+}
+END_TEST
+
+/* Lose burst_length packets from burst_start in a window of packets and count the number
+ * of request packet round trips until the receiving side has every packet.
+ */
+static uint32_t burst_recovery_rounds(_Bool sack, uint32_t window, uint32_t burst_start, uint32_t burst_length)
+{
+    static uint8_t lost[CRYPTO_PACKET_BUFFER_SIZE];
+    Packets_Array *send_array = calloc(1, sizeof(Packets_Array));
+    Packets_Array *recv_array = calloc(1, sizeof(Packets_Array));
+    ck_assert_msg(send_array != NULL && recv_array != NULL, "malloc failed");
+
+    memset(lost, 0, sizeof(lost));
+    memset(lost + burst_start, 1, burst_length);
+    fill_arrays(send_array, recv_array, lost, window);
+
+    uint32_t rounds = 0;
+    Packet_Data dt;
+
+    while (1) {
+        while (read_data_beg_buffer(recv_array, &dt) != -1);
+
+        if (recv_array->buffer_start == window)
+            break;
+
+        ck_assert_msg(rounds < 1000, "burst loss was never recovered");
+        ++rounds;
+
+        uint8_t data[MAX_CRYPTO_DATA_SIZE];
+        int len;
+
+        if (sack) {
+            len = generate_sack_packet(data, sizeof(data), recv_array);
+        } else {
+            len = generate_request_packet(data, sizeof(data), recv_array);
+        }
+
+        ck_assert_msg(len > 0, "generating the request failed");
+        ck_assert_msg(clear_buffer_until(send_array, recv_array->buffer_start) != -1, "clear_buffer_until failed");
+
+        uint64_t latest_send_time = 0;
+        uint32_t num_acked, num_lost;
+
+        if (sack) {
+            handle_sack_packet(test_mono_time, send_array, data, len, &latest_send_time, 0, &num_acked, &num_lost);
+        } else {
+            handle_request_packet(test_mono_time, send_array, data, len, &latest_send_time, 0, &num_acked, &num_lost);
+        }
+
+        /* Send the requested packets again, none of them get lost this time. */
+        uint32_t i;
+
+        for (i = send_array->buffer_start; i != send_array->buffer_end; ++i) {
+            Packet_Data *packet = send_array->buffer[i % CRYPTO_PACKET_BUFFER_SIZE];
+
+            if (packet && packet->sent_time == 0) {
+                packet->sent_time = 1;
+                add_data_to_buffer(recv_array, i, packet);
+            }
+        }
+    }
+
+    clear_buffer(send_array);
+    clear_buffer(recv_array);
+    free(send_array);
+    free(recv_array);
+    return rounds;
+}
+
+START_TEST(test_burst_loss_recovery)
+{
+    const uint32_t bursts[] = {100, 1000, 4000, 8000, CRYPTO_PACKET_BUFFER_SIZE - 200};
+    unsigned int i;
+
+    for (i = 0; i < sizeof(bursts) / sizeof(bursts[0]); ++i) {
+        uint32_t request_rounds = burst_recovery_rounds(0, CRYPTO_PACKET_BUFFER_SIZE, 100, bursts[i]);
+        uint32_t sack_rounds = burst_recovery_rounds(1, CRYPTO_PACKET_BUFFER_SIZE, 100, bursts[i]);
+
+        printf("burst of %u lost packets: request recovers in %u rounds (%ums), sack in %u rounds (%ums)\n", bursts[i],
+               request_rounds, request_rounds * TEST_RTT, sack_rounds, sack_rounds * TEST_RTT);
+
+        ck_assert_msg(sack_rounds == 1, "sack took %u rounds to recover a burst of %u", sack_rounds, bursts[i]);
+        ck_assert_msg(sack_rounds <= request_rounds, "sack was slower than request packets");
+    }
+
+    ck_assert_msg(burst_recovery_rounds(0, CRYPTO_PACKET_BUFFER_SIZE, 100, 8000) > 1,
+                  "request packets should not fit a burst of 8000");
+}
+END_TEST
+
+#define NUM_COALESCE_PACKETS 100
+
+static uint8_t coalesce_received[NUM_COALESCE_PACKETS][MAX_CRYPTO_DATA_SIZE];
+static uint16_t coalesce_received_length[NUM_COALESCE_PACKETS];
+static unsigned int num_coalesce_received;
+
+static int coalesce_data_callback(void *object, int id, uint8_t *data, uint16_t length)
+{
+    ck_assert_msg(num_coalesce_received < NUM_COALESCE_PACKETS, "received too many packets");
+    ck_assert_msg(length <= MAX_CRYPTO_DATA_SIZE, "received packet is too long");
+    memcpy(coalesce_received[num_coalesce_received], data, length);
+    coalesce_received_length[num_coalesce_received] = length;
+    ++num_coalesce_received;
+    return 0;
+}
+
+/* Create a Net_Crypto with one established connection that sends its packets to itself
+ * over UDP.
+ */
+static Net_Crypto *new_test_net_crypto(void)
+{
+    Net_Crypto *c = calloc(1, sizeof(Net_Crypto));
+    ck_assert_msg(c != NULL, "malloc failed");
+
+    IP ip;
+    ip_init(&ip, 0);
+    ip.ip4.uint32 = htonl(0x7F000001);
+
+    c->dht = calloc(1, sizeof(DHT));
+    ck_assert_msg(c->dht != NULL, "malloc failed");
+    c->dht->net = new_networking(ip, 33445);
+    ck_assert_msg(c->dht->net != NULL, "failed to create networking");
+    c->dht->mono_time = c->dht->net->mono_time;
+    c->mono_time = c->dht->mono_time;
+
+    c->crypto_connections = calloc(1, sizeof(Crypto_Connection));
+    ck_assert_msg(c->crypto_connections != NULL, "malloc failed");
+    c->crypto_connections_length = 1;
+
+    Crypto_Connection *conn = &c->crypto_connections[0];
+    conn->status = CRYPTO_CONN_ESTABLISHED;
+    conn->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
+    conn->peer_capabilities = CRYPTO_CAPABILITIES;
+    conn->capabilities_received = 1;
+    conn->connection_data_callback = coalesce_data_callback;
+    conn->ip_port.ip = ip;
+    conn->ip_port.port = c->dht->net->port;
+    conn->direct_lastrecv_time = unix_time(c->mono_time);
+    pthread_mutex_init(&conn->mutex, NULL);
+    return c;
+}
+
+static void kill_test_net_crypto(Net_Crypto *c)
+{
+    clear_buffer(&c->crypto_connections[0].send_array);
+    pthread_mutex_destroy(&c->crypto_connections[0].mutex);
+    free(c->crypto_connections);
+    kill_networking(c->dht->net);
+    free(c->dht);
+    free(c);
+}
+
+START_TEST(test_coalesce_packets)
+{
+    Net_Crypto *c = new_test_net_crypto();
+    Crypto_Connection *conn = &c->crypto_connections[0];
+    set_packet_coalescing(c, 1);
+
+    uint8_t packets[NUM_COALESCE_PACKETS][CRYPTO_COALESCE_MAX_LENGTH];
+    uint16_t lengths[NUM_COALESCE_PACKETS];
+    int64_t numbers[NUM_COALESCE_PACKETS];
+    unsigned int i;
+
+    srand(2);
+
+    for (i = 0; i < NUM_COALESCE_PACKETS; ++i) {
+        lengths[i] = 1 + rand() % 64;
+
+        /* Packets too long to be coalesced are sent on their own. */
+        if (i % 25 == 24)
+            lengths[i] = CRYPTO_COALESCE_MAX_LENGTH + 1;
+
+        if (lengths[i] > CRYPTO_COALESCE_MAX_LENGTH) {
+            uint8_t long_packet[CRYPTO_COALESCE_MAX_LENGTH + 1];
+            memset(long_packet, TEST_PACKET_ID, sizeof(long_packet));
+            numbers[i] = write_cryptpacket(c, 0, long_packet, sizeof(long_packet), 0);
+        } else {
+            packets[i][0] = CRYPTO_RESERVED_PACKETS + i % 100;
+            randombytes(packets[i] + 1, lengths[i] - 1);
+            numbers[i] = write_cryptpacket(c, 0, packets[i], lengths[i], 1);
+        }
+
+        ck_assert_msg(numbers[i] != -1, "write_cryptpacket failed");
+        ck_assert_msg(i == 0 || numbers[i] >= numbers[i - 1], "packet numbers went backwards");
+    }
+
+    uint64_t packets_saved, bytes_saved;
+    packet_coalescing_stats(c, &packets_saved, &bytes_saved);
+    uint32_t num_packets = num_packets_array(&conn->send_array);
+
+    ck_assert_msg(num_packets < NUM_COALESCE_PACKETS / 4, "%u packets used for %u lossless packets", num_packets,
+                  NUM_COALESCE_PACKETS);
+    ck_assert_msg(packets_saved == NUM_COALESCE_PACKETS - num_packets, "wrong number of packets saved: %llu",
+                  (unsigned long long)packets_saved);
+    ck_assert_msg(bytes_saved > packets_saved * (CRYPTO_DATA_PACKET_MIN_SIZE - 5), "wrong number of bytes saved: %llu",
+                  (unsigned long long)bytes_saved);
+
+    /* Deliver every packet in the send queue to the callback like the receiving side does. */
+    num_coalesce_received = 0;
+
+    for (i = conn->send_array.buffer_start; i != conn->send_array.buffer_end; ++i) {
+        Packet_Data *dt;
+        ck_assert_msg(get_data_pointer(&conn->send_array, &dt, i) == 1, "packet missing from send queue");
+        ck_assert_msg(dt->length <= MAX_CRYPTO_DATA_SIZE, "packet is too long");
+        ck_assert_msg(dt->data[0] != PACKET_ID_COALESCED || coalesced_packet_valid(dt->data, dt->length),
+                      "invalid coalesced packet");
+        ck_assert_msg(deliver_lossless_packet(c, 0, dt->data, dt->length) == 0, "deliver_lossless_packet failed");
+    }
+
+    ck_assert_msg(num_coalesce_received == NUM_COALESCE_PACKETS, "received %u packets instead of %u",
+                  num_coalesce_received, NUM_COALESCE_PACKETS);
+
+    for (i = 0; i < NUM_COALESCE_PACKETS; ++i) {
+        ck_assert_msg(coalesce_received_length[i] == lengths[i], "packet %u has the wrong length", i);
+
+        if (lengths[i] <= CRYPTO_COALESCE_MAX_LENGTH)
+            ck_assert_msg(memcmp(coalesce_received[i], packets[i], lengths[i]) == 0, "packet %u has the wrong contents", i);
+    }
+
+    kill_test_net_crypto(c);
+}
+END_TEST
+
+START_TEST(test_coalesce_negotiation)
+{
+    Net_Crypto *c = new_test_net_crypto();
+    Crypto_Connection *conn = &c->crypto_connections[0];
+    uint8_t packet[] = {TEST_PACKET_ID, 1, 2, 3};
+    unsigned int i;
+
+    /* Disabled by default. */
+    for (i = 0; i < 4; ++i) {
+        ck_assert_msg(write_cryptpacket(c, 0, packet, sizeof(packet), 0) == i, "write_cryptpacket failed");
+    }
+
+    /* Not used with peers that don't handle it. */
+    set_packet_coalescing(c, 1);
+    conn->peer_capabilities = CRYPTO_CAPABILITY_SACK;
+
+    for (i = 4; i < 8; ++i) {
+        ck_assert_msg(write_cryptpacket(c, 0, packet, sizeof(packet), 0) == i, "write_cryptpacket failed");
+    }
+
+    uint8_t capabilities[CAPABILITIES_PACKET_LENGTH] = {PACKET_ID_CAPABILITIES, 0, 0, 0, CRYPTO_CAPABILITY_COALESCED, 1};
+    ck_assert_msg(handle_capabilities_packet(c, 0, capabilities, sizeof(capabilities)) == 0,
+                  "handle_capabilities_packet failed");
+    ck_assert_msg(conn->peer_capabilities == CRYPTO_CAPABILITY_COALESCED, "wrong peer capabilities");
+
+    for (i = 0; i < 4; ++i) {
+        ck_assert_msg(write_cryptpacket(c, 0, packet, sizeof(packet), 0) == 8, "packet was not coalesced");
+    }
+
+    kill_test_net_crypto(c);
+}
+END_TEST
+
+START_TEST(test_coalesced_packet_invalid)
+{
+    uint8_t empty[] = {PACKET_ID_COALESCED};
+    uint8_t zero_length[] = {PACKET_ID_COALESCED, 0, 0};
+    uint8_t too_long[] = {PACKET_ID_COALESCED, 0, 3, TEST_PACKET_ID, 0};
+    uint8_t reserved[] = {PACKET_ID_COALESCED, 0, 1, PACKET_ID_KILL};
+    uint8_t lossy[] = {PACKET_ID_COALESCED, 0, 1, PACKET_ID_LOSSY_RANGE_START};
+    uint8_t valid[] = {PACKET_ID_COALESCED, 0, 1, TEST_PACKET_ID, 0, 2, CRYPTO_RESERVED_PACKETS, 0};
+
+    ck_assert_msg(!coalesced_packet_valid(empty, sizeof(empty)), "empty packet is valid");
+    ck_assert_msg(!coalesced_packet_valid(zero_length, sizeof(zero_length)), "zero length packet is valid");
+    ck_assert_msg(!coalesced_packet_valid(too_long, sizeof(too_long)), "truncated packet is valid");
+    ck_assert_msg(!coalesced_packet_valid(reserved, sizeof(reserved)), "reserved packet is valid");
+    ck_assert_msg(!coalesced_packet_valid(lossy, sizeof(lossy)), "lossy packet is valid");
+    ck_assert_msg(coalesced_packet_valid(valid, sizeof(valid)), "valid packet is invalid");
+}
+END_TEST
+
+START_TEST(test_histogram)
+{
+    uint64_t histogram[CRYPTO_HISTOGRAM_BUCKETS] = {0};
+    uint64_t values[] = {0, 1, 2, 3, 4, 7, 8, 1000, 1 << 14, 1 << 15, UINT64_MAX};
+    unsigned int buckets[] = {0, 1, 2, 2, 3, 3, 4, 10, 15, 15, 15};
+    unsigned int i;
+
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        uint64_t before = histogram[buckets[i]];
+        crypto_histogram_add(histogram, values[i]);
+        ck_assert_msg(histogram[buckets[i]] == before + 1, "%llu not counted in bucket %u",
+                      (unsigned long long)values[i], buckets[i]);
+    }
+}
+END_TEST
+
+static uint8_t last_packet[MAX_CRYPTO_PACKET_SIZE];
+static uint16_t last_packet_length;
+
+static int stats_handle_packet(void *object, IP_Port source, const uint8_t *packet, uint16_t length)
+{
+    memcpy(last_packet, packet, length);
+    last_packet_length = length;
+    count_packet_received(object, 0, length, 0);
+    handle_packet_connection(object, 0, packet, length);
+    return 0;
+}
+
+START_TEST(test_connection_stats)
+{
+    Net_Crypto *c = new_test_net_crypto();
+    Crypto_Connection *conn = &c->crypto_connections[0];
+    networking_registerhandler(c->dht->net, NET_PACKET_CRYPTO_DATA, &stats_handle_packet, c);
+    uint8_t secret_key[crypto_box_SECRETKEYBYTES];
+    TCP_Proxy_Info proxy_info = {{{0}}};
+    randombytes(secret_key, sizeof(secret_key));
+    c->tcp_c = new_tcp_connections(c->mono_time, secret_key, &proxy_info);
+    ck_assert_msg(c->tcp_c != NULL, "failed to create TCP connections");
+    uint8_t packet[] = {TEST_PACKET_ID, 1, 2, 3};
+    unsigned int i;
+
+    num_coalesce_received = 0;
+
+    for (i = 0; i < 10; ++i) {
+        ck_assert_msg(write_cryptpacket(c, 0, packet, sizeof(packet), 0) == i, "write_cryptpacket failed");
+    }
+
+    usleep(50000);
+    networking_poll(c->dht->net);
+    ck_assert_msg(num_coalesce_received == 10, "received %u packets instead of 10", num_coalesce_received);
+
+    Crypto_Connection_Stats stats;
+    ck_assert_msg(crypto_connection_stats(c, 0, &stats) == 0, "crypto_connection_stats failed");
+    ck_assert_msg(stats.counters.packets_sent == 10 && stats.counters.packets_received == 10,
+                  "%llu packets sent and %llu received instead of 10", (unsigned long long)stats.counters.packets_sent,
+                  (unsigned long long)stats.counters.packets_received);
+    ck_assert_msg(stats.counters.bytes_sent == stats.counters.bytes_received && stats.counters.bytes_sent > 10 * 4,
+                  "wrong number of bytes counted");
+    ck_assert_msg(stats.counters.packets_sent_tcp == 0, "packets counted as sent through TCP");
+    ck_assert_msg(stats.status == CRYPTO_CONN_ESTABLISHED && stats.direct_connected, "wrong status");
+
+    /* A packet received again is outside of the window, a corrupted one can't be decrypted. */
+    ck_assert_msg(handle_packet_connection(c, 0, last_packet, last_packet_length) == -1, "packet received twice");
+    last_packet[last_packet_length - 1] ^= 1;
+    ck_assert_msg(handle_packet_connection(c, 0, last_packet, last_packet_length) == -1, "corrupted packet received");
+    conn->status = CRYPTO_CONN_COOKIE_REQUESTING;
+    ck_assert_msg(handle_packet_connection(c, 0, last_packet, last_packet_length) == -1,
+                  "packet received in wrong state");
+    conn->status = CRYPTO_CONN_ESTABLISHED;
+
+    ck_assert_msg(crypto_connection_stats(c, 0, &stats) == 0, "crypto_connection_stats failed");
+    ck_assert_msg(stats.counters.drops[CRYPTO_DROP_WINDOW] == 1, "window drop not counted");
+    ck_assert_msg(stats.counters.drops[CRYPTO_DROP_DECRYPT] == 1, "decrypt drop not counted");
+    ck_assert_msg(stats.counters.drops[CRYPTO_DROP_STATE] == 1, "state drop not counted");
+    ck_assert_msg(stats.counters.drops[CRYPTO_DROP_INVALID] == 0, "invalid drop counted");
+
+    Net_Crypto_Stats totals;
+    c->killed_counters.packets_sent = 5;
+    net_crypto_stats(c, &totals);
+    ck_assert_msg(totals.connections == 1 && totals.connections_established == 1 && totals.connections_direct == 1,
+                  "wrong number of connections");
+    ck_assert_msg(totals.totals.packets_sent == 15, "killed connections not counted in totals");
+    ck_assert_msg(totals.totals.drops[CRYPTO_DROP_WINDOW] == 1, "drops not counted in totals");
+
+    kill_tcp_connections(c->tcp_c);
+    kill_test_net_crypto(c);
+}
+END_TEST
+
+static Suite *net_crypto_suite(void)
+{
+    Suite *s = suite_create("Net_crypto");
+
+    DEFTESTCASE_SLOW(sack_roundtrip, 60);
+    DEFTESTCASE(sack_truncated);
+    DEFTESTCASE(sack_invalid);
+    DEFTESTCASE_SLOW(burst_loss_recovery, 60);
+    DEFTESTCASE(coalesce_packets);
+    DEFTESTCASE(coalesce_negotiation);
+    DEFTESTCASE(coalesced_packet_invalid);
+    DEFTESTCASE(histogram);
+    DEFTESTCASE(connection_stats);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    test_mono_time = new_mono_time(NULL);
+
+    if (test_mono_time == NULL)
+        return 1;
+
+    Suite *net_crypto = net_crypto_suite();
+    SRunner *test_runner = srunner_create(net_crypto);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+    kill_mono_time(test_mono_time);
+
+    return number_failed;
+}
@@ -10,6 +10,7 @@
 #include <time.h>
 
 #include "../toxcore/network.h"
+#include "../toxcore/util.h"
 
 #include "helpers.h"
 
@@ -134,12 +135,115 @@ START_TEST(test_ip_equal)
 }
 END_TEST
 
+static Networking_Core *transport_peer;
+static uint32_t transport_sent;
+
+/* Delivers the packets right away to transport_peer */
+static int transport_send(void *object, IP_Port ip_port, const uint8_t *data, uint16_t length)
+{
+    Networking_Core *net = object;
+    ++transport_sent;
+
+    if (!ipport_equal(&ip_port, &transport_peer->transport.ip_port))
+        return -1;
+
+    networking_handle_packet(transport_peer, net->transport.ip_port, data, length);
+    return length;
+}
+
+static IP_Port transport_received_from;
+static uint32_t transport_received;
+
+static int handle_transport_packet(void *object, IP_Port ip_port, const uint8_t *data, uint16_t len)
+{
+    transport_received_from = ip_port;
+    transport_received += len;
+    return 0;
+}
+
+START_TEST(test_transport)
+{
+    Net_Transport transport_a = {&transport_send, NULL}, transport_b = {&transport_send, NULL};
+    ip_init(&transport_a.ip_port.ip, 0);
+    transport_a.ip_port.ip.ip4.uint32 = htonl(0x14000001);
+    transport_a.ip_port.port = htons(33445);
+    transport_b.ip_port = transport_a.ip_port;
+    transport_b.ip_port.ip.ip4.uint32 = htonl(0x14000002);
+
+    Networking_Core *a = new_networking_transport(&transport_a, NULL);
+    Networking_Core *b = new_networking_transport(&transport_b, NULL);
+    ck_assert_msg(a != NULL && b != NULL, "failed to create networking on a transport");
+    ck_assert_msg(a->port == htons(33445) && a->family == AF_INET, "wrong address");
+
+    a->transport.object = a;
+    transport_peer = b;
+    networking_registerhandler(b, 200, &handle_transport_packet, NULL);
+
+    uint8_t data[100] = {200};
+    ck_assert_msg(sendpacket(a, transport_b.ip_port, data, sizeof(data)) == sizeof(data), "send failed");
+    ck_assert_msg(transport_sent == 1 && transport_received == sizeof(data), "packet not delivered");
+    ck_assert_msg(ipport_equal(&transport_received_from, &transport_a.ip_port), "wrong source");
+
+    /* The family of the transport is checked like the one of a socket */
+    IP_Port ip_port6;
+    ip_init(&ip_port6.ip, 1);
+    ip_port6.ip.ip6.uint32[3] = htonl(1);
+    ip_port6.port = htons(33445);
+    ck_assert_msg(sendpacket(a, ip_port6, data, sizeof(data)) == -1, "sent to IPv6 from IPv4");
+    ck_assert_msg(transport_sent == 1, "transport called for IPv6");
+
+    /* Polling doesn't touch a socket */
+    networking_poll(a);
+
+    kill_networking(a);
+    kill_networking(b);
+}
+END_TEST
+
+static uint64_t test_clock;
+
+static uint64_t get_test_clock(void *object)
+{
+    return *(uint64_t *)object;
+}
+
+START_TEST(test_time_callback)
+{
+    Net_Clock clock = {&get_test_clock, &test_clock};
+    Mono_Time *system_time = new_mono_time(NULL);
+    uint64_t unix_start = unix_time(system_time);
+
+    test_clock = unix_start * 1000;
+    Mono_Time *mono_time = new_mono_time(&clock);
+    ck_assert_msg(system_time != NULL && mono_time != NULL, "failed to create clocks");
+    ck_assert_msg(current_time_monotonic(mono_time) == test_clock, "callback not used");
+    ck_assert_msg(unix_time(mono_time) == unix_start, "unix time isn't the one of the clock");
+
+    test_clock += 3600 * 1000;
+    ck_assert_msg(current_time_monotonic(mono_time) == test_clock, "callback not used");
+    ck_assert_msg(unix_time(mono_time) == unix_start, "unix time changed before its update");
+
+    unix_time_update(mono_time);
+    ck_assert_msg(unix_time(mono_time) == unix_start + 3600, "unix time didn't follow the clock");
+
+    /* Other instances keep the system clock */
+    unix_time_update(system_time);
+    ck_assert_msg(unix_time(system_time) < unix_start + 3600, "clock shared between instances");
+    ck_assert_msg(current_time_monotonic(system_time) < test_clock, "clock shared between instances");
+
+    kill_mono_time(mono_time);
+    kill_mono_time(system_time);
+}
+END_TEST
+
 Suite *network_suite(void)
 {
     Suite *s = suite_create("Network");
 
     DEFTESTCASE(addr_resolv_localhost);
     DEFTESTCASE(ip_equal);
+    DEFTESTCASE(transport);
+    DEFTESTCASE(time_callback);
 
     return s;
 }
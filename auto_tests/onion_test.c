@@ -12,6 +12,7 @@
 #include "../toxcore/onion.h"
 #include "../toxcore/onion_announce.h"
 #include "../toxcore/onion_client.h"
+#include "../toxcore/onion_workers.h"
 #include "../toxcore/util.h"
 
 #include "helpers.h"
@@ -196,7 +197,7 @@ START_TEST(test_basic)
     randombytes(sb_data, sizeof(sb_data));
     memcpy(&s, sb_data, sizeof(uint64_t));
     memcpy(onion2_a->entries[1].public_key, onion2->dht->self_public_key, crypto_box_PUBLICKEYBYTES);
-    onion2_a->entries[1].time = unix_time();
+    onion2_a->entries[1].time = unix_time(onion2->dht->mono_time);
     networking_registerhandler(onion1->net, NET_PACKET_ONION_DATA_RESPONSE, &handle_test_4, onion1);
     send_announce_request(onion1->net, &path, nodes[3], onion1->dht->self_public_key, onion1->dht->self_secret_key,
                           test_3_ping_id, onion1->dht->self_public_key, onion1->dht->self_public_key, s);
@@ -447,11 +448,65 @@ START_TEST(test_announce)
 }
 END_TEST
 
+START_TEST(test_workers)
+{
+    IP ip;
+    ip_init(&ip, 0);
+    ip.ip4.uint32 = htonl(0x7F000001);
+    Onion *onion1 = new_onion(new_DHT(new_networking(ip, 34580)));
+    Onion *onion2 = new_onion(new_DHT(new_networking(ip, 34581)));
+    ck_assert_msg((onion1 != NULL) && (onion2 != NULL), "Onion failed initializing.");
+
+    /* onion1 forwards the packets of the path on its workers, onion2 by itself */
+    Onion_Workers *workers = new_onion_workers(onion1, 2);
+    ck_assert_msg(workers != NULL, "Onion workers failed initializing.");
+
+    networking_registerhandler(onion2->net, 'I', &handle_test_1, onion2);
+    networking_registerhandler(onion1->net, 'i', &handle_test_2, onion1);
+
+    Node_format nodes[4];
+    memcpy(nodes[0].public_key, onion1->dht->self_public_key, crypto_box_PUBLICKEYBYTES);
+    nodes[0].ip_port.ip = ip;
+    nodes[0].ip_port.port = onion1->net->port;
+    memcpy(nodes[1].public_key, onion2->dht->self_public_key, crypto_box_PUBLICKEYBYTES);
+    nodes[1].ip_port.ip = ip;
+    nodes[1].ip_port.port = onion2->net->port;
+    nodes[2] = nodes[0];
+    nodes[3] = nodes[1];
+
+    Onion_Path path;
+    create_onion_path(onion1->dht, &path, nodes);
+    int ret = send_onion_packet(onion1->net, &path, nodes[3].ip_port, (uint8_t *)"Install Gentoo",
+                                sizeof("Install Gentoo"));
+    ck_assert_msg(ret == 0, "Failed to create/send onion packet.");
+
+    handled_test_1 = 0;
+    handled_test_2 = 0;
+
+    while (handled_test_1 == 0 || handled_test_2 == 0) {
+        do_onion(onion1);
+        do_onion_workers(workers);
+        do_onion(onion2);
+        c_sleep(1);
+    }
+
+    uint64_t handled, dropped;
+    onion_workers_stats(workers, &handled, &dropped);
+    ck_assert_msg(handled == 4 && dropped == 0, "Workers forwarded %u packets and dropped %u, expected 4 and 0",
+                  (unsigned int)handled, (unsigned int)dropped);
+
+    kill_onion_workers(workers);
+    ck_assert_msg(onion1->net->packethandlers[NET_PACKET_ONION_SEND_INITIAL].object == onion1,
+                  "Onion handlers not given back.");
+}
+END_TEST
+
 Suite *onion_suite(void)
 {
     Suite *s = suite_create("Onion");
 
     DEFTESTCASE_SLOW(basic, 5);
+    DEFTESTCASE_SLOW(workers, 5);
     DEFTESTCASE_SLOW(announce, 70);
     return s;
 }
@@ -0,0 +1,218 @@
+/* Statistical tests of the random numbers crypto_core hands out.
+ *
+ * They can't prove the stream is random, they catch the mistakes that make it obviously not:
+ * biased bits or bytes, repeated output, threads or forked processes sharing a stream and a
+ * skewed random_int_range(). The bounds are about 6 standard deviations wide.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/crypto_core.h"
+#include "../toxcore/util.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "helpers.h"
+
+/* More than RANDOM_RESEED_BYTES, so that the stream gets reseeded along the way */
+#define TEST_NUM_BYTES (4 * 1024 * 1024)
+#define TEST_NUM_IDS 100000
+#define TEST_NUM_THREADS 4
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+START_TEST(test_bits_and_bytes)
+{
+    uint8_t *bytes = malloc(TEST_NUM_BYTES);
+    ck_assert_msg(bytes != NULL, "out of memory");
+
+    /* Odd sizes so that requests straddle the refills */
+    uint32_t i, done = 0;
+
+    while (done < TEST_NUM_BYTES) {
+        uint32_t length = MIN(1 + done % 61, TEST_NUM_BYTES - done);
+        random_bytes(bytes + done, length);
+        done += length;
+    }
+
+    uint64_t ones = 0;
+    uint64_t counts[256] = {0};
+
+    for (i = 0; i < TEST_NUM_BYTES; ++i) {
+        ones += __builtin_popcount(bytes[i]);
+        ++counts[bytes[i]];
+    }
+
+    /* The standard deviation of the number of ones is sqrt(bits) / 2 */
+    double bits = TEST_NUM_BYTES * 8.0, deviation = ones - bits / 2;
+    ck_assert_msg(deviation * deviation < 36 * bits / 4, "%llu of %.0f bits set", (unsigned long long)ones, bits);
+
+    /* Chi-squared with 255 degrees of freedom: mean 255, standard deviation about 22.6 */
+    double expected = TEST_NUM_BYTES / 256.0, chi2 = 0;
+
+    for (i = 0; i < 256; ++i)
+        chi2 += (counts[i] - expected) * (counts[i] - expected) / expected;
+
+    ck_assert_msg(chi2 > 120 && chi2 < 390, "byte values not uniform, chi2 %.1f", chi2);
+
+    /* Consecutive bytes shouldn't depend on each other either */
+    uint64_t pairs[16][16] = {{0}};
+
+    for (i = 1; i < TEST_NUM_BYTES; ++i)
+        ++pairs[bytes[i - 1] >> 4][bytes[i] >> 4];
+
+    expected = (TEST_NUM_BYTES - 1) / 256.0;
+    chi2 = 0;
+
+    for (i = 0; i < 256; ++i)
+        chi2 += (pairs[i / 16][i % 16] - expected) * (pairs[i / 16][i % 16] - expected) / expected;
+
+    ck_assert_msg(chi2 > 120 && chi2 < 390, "consecutive bytes not independent, chi2 %.1f", chi2);
+
+    free(bytes);
+}
+END_TEST
+
+START_TEST(test_no_repeats)
+{
+    uint64_t *ids = malloc(TEST_NUM_IDS * sizeof(uint64_t));
+    ck_assert_msg(ids != NULL, "out of memory");
+    uint32_t i;
+
+    for (i = 0; i < TEST_NUM_IDS; ++i)
+        ids[i] = random_64b();
+
+    qsort(ids, TEST_NUM_IDS, sizeof(uint64_t), cmp_u64);
+
+    for (i = 1; i < TEST_NUM_IDS; ++i)
+        ck_assert_msg(ids[i] != ids[i - 1], "random_64b() repeated a value");
+
+    uint8_t nonce1[crypto_box_NONCEBYTES], nonce2[crypto_box_NONCEBYTES];
+    new_nonce(nonce1);
+    new_nonce(nonce2);
+    ck_assert_msg(memcmp(nonce1, nonce2, sizeof(nonce1)) != 0, "new_nonce() repeated a nonce");
+
+    free(ids);
+}
+END_TEST
+
+START_TEST(test_range)
+{
+    /* 2^32 isn't a multiple of 3 * 2^30, a modulo without rejecting would favour the first third */
+    uint32_t bounds[] = {2, 3, 10, 3U << 30};
+    uint32_t b, i;
+
+    ck_assert_msg(random_int_range(0) == 0 && random_int_range(1) == 0, "values out of a range of one");
+
+    for (b = 0; b < sizeof(bounds) / sizeof(bounds[0]); ++b) {
+        uint64_t counts[10] = {0};
+        uint32_t buckets = MIN(bounds[b], 10), samples = 300000;
+
+        for (i = 0; i < samples; ++i) {
+            uint32_t value = random_int_range(bounds[b]);
+            ck_assert_msg(value < bounds[b], "%u out of range %u", value, bounds[b]);
+            ++counts[(uint64_t)value * buckets / bounds[b]];
+        }
+
+        double expected = (double)samples / buckets, chi2 = 0;
+
+        for (i = 0; i < buckets; ++i)
+            chi2 += (counts[i] - expected) * (counts[i] - expected) / expected;
+
+        /* At most 9 degrees of freedom, 6 standard deviations above is about 35 */
+        ck_assert_msg(chi2 < 35, "random_int_range(%u) not uniform, chi2 %.1f", bounds[b], chi2);
+    }
+}
+END_TEST
+
+static void *take_bytes(void *arg)
+{
+    random_bytes(arg, 32);
+    return NULL;
+}
+
+START_TEST(test_threads)
+{
+    uint8_t bytes[TEST_NUM_THREADS + 1][32];
+    pthread_t threads[TEST_NUM_THREADS];
+    uint32_t i, j;
+
+    for (i = 0; i < TEST_NUM_THREADS; ++i)
+        ck_assert_msg(pthread_create(&threads[i], NULL, &take_bytes, bytes[i]) == 0, "failed to start thread");
+
+    for (i = 0; i < TEST_NUM_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+
+    random_bytes(bytes[TEST_NUM_THREADS], 32);
+
+    for (i = 0; i <= TEST_NUM_THREADS; ++i)
+        for (j = i + 1; j <= TEST_NUM_THREADS; ++j)
+            ck_assert_msg(memcmp(bytes[i], bytes[j], 32) != 0, "threads %u and %u got the same bytes", i, j);
+}
+END_TEST
+
+START_TEST(test_fork)
+{
+    uint8_t parent[32], child[32];
+    int fds[2];
+
+    /* Leave bytes in the buffer that the child would otherwise hand out too */
+    random_bytes(parent, 1);
+    ck_assert_msg(pipe(fds) == 0, "pipe() failed");
+
+    pid_t pid = fork();
+    ck_assert_msg(pid != -1, "fork() failed");
+
+    if (pid == 0) {
+        random_bytes(child, sizeof(child));
+        _exit(write(fds[1], child, sizeof(child)) != sizeof(child));
+    }
+
+    random_bytes(parent, sizeof(parent));
+    ck_assert_msg(read(fds[0], child, sizeof(child)) == sizeof(child), "no bytes from the child");
+    waitpid(pid, NULL, 0);
+    close(fds[0]);
+    close(fds[1]);
+
+    ck_assert_msg(memcmp(parent, child, sizeof(parent)) != 0, "the child repeated the bytes of its parent");
+}
+END_TEST
+
+static Suite *random_suite(void)
+{
+    Suite *s = suite_create("Random");
+
+    DEFTESTCASE_SLOW(bits_and_bytes, 30);
+    DEFTESTCASE(no_repeats);
+    DEFTESTCASE_SLOW(range, 30);
+    DEFTESTCASE(threads);
+    DEFTESTCASE(fork);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *rng = random_suite();
+    SRunner *test_runner = srunner_create(rng);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -0,0 +1,191 @@
+/* Tests of Tox instances sharing one socket on a host.
+ *
+ * Two instances run on a host and each is befriended by an instance of its own, one with a
+ * friend request and one without, so that handshakes, onion data and friend requests all have
+ * to find the right instance of the host.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../toxcore/tox.h"
+
+#include "helpers.h"
+
+#define NUM_ACCOUNTS 2
+
+#define TEST_TIMEOUT 120   /* seconds */
+
+typedef struct {
+    Tox *tox;
+    uint32_t friend_number;
+    uint32_t messages_received;
+} Test_Tox;
+
+static Test_Tox accounts[NUM_ACCOUNTS];
+static Test_Tox peers[NUM_ACCOUNTS];
+
+static void handle_friend_request(Tox *tox, const uint8_t *public_key, const uint8_t *message, size_t length,
+                                  void *userdata)
+{
+    Test_Tox *test_tox = userdata;
+
+    if (length == sizeof("Gentoo") && memcmp(message, "Gentoo", length) == 0)
+        test_tox->friend_number = tox_friend_add_norequest(tox, public_key, NULL);
+}
+
+static void handle_message(Tox *tox, uint32_t friend_number, TOX_MESSAGE_TYPE type, const uint8_t *message,
+                           size_t length, void *userdata)
+{
+    Test_Tox *test_tox = userdata;
+
+    if (length == sizeof("Install Gentoo") && memcmp(message, "Install Gentoo", length) == 0)
+        ++test_tox->messages_received;
+}
+
+static _Bool friend_connected(const Test_Tox *test_tox)
+{
+    return test_tox->friend_number != UINT32_MAX
+           && tox_friend_get_connection_status(test_tox->tox, test_tox->friend_number, NULL) != TOX_CONNECTION_NONE;
+}
+
+START_TEST(test_host_accounts)
+{
+    long long unsigned int cur_time = time(NULL);
+    struct Tox_Options options;
+    tox_options_default(&options);
+    options.ipv6_enabled = 0;
+
+    TOX_ERR_NEW error;
+    Tox_Host *host = tox_host_new(&options, &error);
+    ck_assert_msg(host != NULL && error == TOX_ERR_NEW_OK, "failed to create host: %u", error);
+
+    uint32_t i;
+
+    for (i = 0; i < NUM_ACCOUNTS; ++i) {
+        accounts[i].tox = tox_new_hosted(host, NULL, &error);
+        ck_assert_msg(accounts[i].tox != NULL && error == TOX_ERR_NEW_OK, "failed to create account %u: %u", i, error);
+        accounts[i].friend_number = UINT32_MAX;
+        tox_callback_friend_request(accounts[i].tox, &handle_friend_request, &accounts[i]);
+        tox_callback_friend_message(accounts[i].tox, &handle_message, &accounts[i]);
+
+        peers[i].tox = tox_new(&options, &error);
+        ck_assert_msg(peers[i].tox != NULL, "failed to create peer %u: %u", i, error);
+        peers[i].friend_number = UINT32_MAX;
+        tox_callback_friend_message(peers[i].tox, &handle_message, &peers[i]);
+    }
+
+    /* The accounts share the DHT key and port of the host but not their keys */
+    uint8_t dht_key[TOX_PUBLIC_KEY_SIZE], other_dht_key[TOX_PUBLIC_KEY_SIZE];
+    uint8_t public_key[TOX_PUBLIC_KEY_SIZE], other_public_key[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(accounts[0].tox, dht_key);
+    tox_self_get_dht_id(accounts[1].tox, other_dht_key);
+    tox_self_get_public_key(accounts[0].tox, public_key);
+    tox_self_get_public_key(accounts[1].tox, other_public_key);
+    ck_assert_msg(memcmp(dht_key, other_dht_key, sizeof(dht_key)) == 0, "accounts have different DHT keys");
+    ck_assert_msg(memcmp(public_key, other_public_key, sizeof(public_key)) != 0, "accounts have the same key");
+
+    uint16_t port = tox_self_get_udp_port(accounts[0].tox, NULL);
+    ck_assert_msg(port == tox_self_get_udp_port(accounts[1].tox, NULL), "accounts have different ports");
+
+    for (i = 0; i < NUM_ACCOUNTS; ++i)
+        ck_assert_msg(tox_bootstrap(peers[i].tox, "127.0.0.1", port, dht_key, NULL), "bootstrap failed");
+
+    tox_self_get_dht_id(peers[0].tox, other_dht_key);
+    ck_assert_msg(tox_host_bootstrap(host, "127.0.0.1", tox_self_get_udp_port(peers[0].tox, NULL), other_dht_key,
+                                     NULL), "host bootstrap failed");
+
+    /* The first account is befriended with a friend request, the second one without */
+    uint8_t address[TOX_ADDRESS_SIZE];
+    tox_self_get_address(accounts[0].tox, address);
+    peers[0].friend_number = tox_friend_add(peers[0].tox, address, (const uint8_t *)"Gentoo", sizeof("Gentoo"), NULL);
+    ck_assert_msg(peers[0].friend_number != UINT32_MAX, "failed to send friend request");
+
+    tox_self_get_public_key(accounts[1].tox, public_key);
+    peers[1].friend_number = tox_friend_add_norequest(peers[1].tox, public_key, NULL);
+    tox_self_get_public_key(peers[1].tox, public_key);
+    accounts[1].friend_number = tox_friend_add_norequest(accounts[1].tox, public_key, NULL);
+    ck_assert_msg(peers[1].friend_number != UINT32_MAX && accounts[1].friend_number != UINT32_MAX,
+                  "failed to add friends");
+
+    _Bool done = 0;
+
+    while (!done && time(NULL) - cur_time < TEST_TIMEOUT) {
+        tox_host_iterate(host);
+
+        for (i = 0; i < NUM_ACCOUNTS; ++i)
+            tox_iterate(peers[i].tox);
+
+        done = 1;
+
+        for (i = 0; i < NUM_ACCOUNTS; ++i) {
+            Test_Tox *pair[2] = {&accounts[i], &peers[i]};
+            uint32_t j;
+
+            for (j = 0; j < 2; ++j) {
+                if (!friend_connected(pair[j])) {
+                    done = 0;
+                    continue;
+                }
+
+                if (pair[1 - j]->messages_received == 0) {
+                    tox_friend_send_message(pair[j]->tox, pair[j]->friend_number, TOX_MESSAGE_TYPE_NORMAL,
+                                            (const uint8_t *)"Install Gentoo", sizeof("Install Gentoo"), NULL);
+                    done = 0;
+                }
+            }
+        }
+
+        usleep(tox_host_iteration_interval(host) * 1000);
+    }
+
+    for (i = 0; i < NUM_ACCOUNTS; ++i) {
+        ck_assert_msg(friend_connected(&accounts[i]) && friend_connected(&peers[i]), "account %u never connected", i);
+        ck_assert_msg(accounts[i].messages_received > 0 && peers[i].messages_received > 0,
+                      "account %u and its friend didn't exchange messages", i);
+    }
+
+    printf("test_host_accounts succeeded, took %llu seconds\n", time(NULL) - cur_time);
+
+    for (i = 0; i < NUM_ACCOUNTS; ++i) {
+        tox_kill(accounts[i].tox);
+        tox_kill(peers[i].tox);
+    }
+
+    tox_host_kill(host);
+}
+END_TEST
+
+static Suite *tox_host_suite(void)
+{
+    Suite *s = suite_create("Tox host");
+
+    DEFTESTCASE_SLOW(host_accounts, TEST_TIMEOUT + 20);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    srand(time(NULL));
+
+    Suite *tox_host = tox_host_suite();
+    SRunner *test_runner = srunner_create(tox_host);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -0,0 +1,294 @@
+/* Stress test of many Tox instances on a pool of threads.
+ *
+ * 256 instances are created, iterated and killed on 16 threads, every instance only ever touched
+ * by the thread it belongs to. Friends are picked on different threads so that they exchange
+ * messages across them. Meant to be run in a build with -fsanitize=thread, which reports any state
+ * the instances still share.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../toxcore/tox.h"
+
+#include "helpers.h"
+
+#define NUM_THREADS 16
+#define TOXES_PER_THREAD 16
+#define NUM_TOXES (NUM_THREADS * TOXES_PER_THREAD)
+#define NUM_PAIRS 32
+#define NUM_BOOTSTRAP_TOXES 4
+
+#define TEST_TIMEOUT 300   /* seconds */
+
+typedef enum {
+    PHASE_CREATE,
+    PHASE_ITERATE,
+    PHASE_KILL,
+} Test_Phase;
+
+typedef struct {
+    Tox *tox;
+    uint32_t friend_number;   /* UINT32_MAX if the instance has no friend */
+    _Bool message_sent;
+    uint32_t messages_received;
+} Test_Tox;
+
+typedef struct {
+    uint32_t index;
+    pthread_t thread;
+
+    /* Only touched with lock held */
+    uint32_t connected;
+    uint32_t friends_received;
+    _Bool failed;
+} Test_Thread;
+
+static Test_Tox toxes[NUM_TOXES];
+static Test_Thread threads[NUM_THREADS];
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static Test_Phase phase;
+static uint32_t threads_done;
+
+static void handle_message(Tox *tox, uint32_t friend_number, TOX_MESSAGE_TYPE type, const uint8_t *message,
+                           size_t length, void *userdata)
+{
+    Test_Tox *test_tox = userdata;
+
+    if (length == sizeof("Install Gentoo") && memcmp(message, "Install Gentoo", length) == 0)
+        ++test_tox->messages_received;
+}
+
+/* Tells the main thread this thread is done with the phase and waits for the next one. */
+static void wait_phase(Test_Phase next)
+{
+    pthread_mutex_lock(&lock);
+    ++threads_done;
+    pthread_cond_broadcast(&cond);
+
+    while (phase != next)
+        pthread_cond_wait(&cond, &lock);
+
+    pthread_mutex_unlock(&lock);
+}
+
+static void *test_thread(void *arg)
+{
+    Test_Thread *thread = arg;
+    uint32_t first = thread->index * TOXES_PER_THREAD;
+    uint32_t i;
+
+    for (i = first; i < first + TOXES_PER_THREAD; ++i) {
+        struct Tox_Options options;
+        tox_options_default(&options);
+        options.ipv6_enabled = 0;
+        options.start_port = 33445;
+        options.end_port = 33445 + NUM_TOXES * 2;
+
+        toxes[i].tox = tox_new(&options, NULL);
+
+        if (toxes[i].tox == NULL) {
+            pthread_mutex_lock(&lock);
+            thread->failed = 1;
+            pthread_mutex_unlock(&lock);
+            continue;
+        }
+
+        tox_callback_friend_message(toxes[i].tox, &handle_message, &toxes[i]);
+    }
+
+    wait_phase(PHASE_ITERATE);
+
+    while (1) {
+        pthread_mutex_lock(&lock);
+        Test_Phase current = phase;
+        pthread_mutex_unlock(&lock);
+
+        if (current != PHASE_ITERATE)
+            break;
+
+        uint32_t connected = 0, friends_received = 0;
+
+        for (i = first; i < first + TOXES_PER_THREAD; ++i) {
+            Test_Tox *test_tox = &toxes[i];
+
+            if (test_tox->tox == NULL)
+                continue;
+
+            tox_iterate(test_tox->tox);
+
+            if (tox_self_get_connection_status(test_tox->tox) != TOX_CONNECTION_NONE)
+                ++connected;
+
+            if (test_tox->friend_number == UINT32_MAX)
+                continue;
+
+            if (!test_tox->message_sent
+                    && tox_friend_get_connection_status(test_tox->tox, test_tox->friend_number, NULL) == TOX_CONNECTION_UDP) {
+                tox_friend_send_message(test_tox->tox, test_tox->friend_number, TOX_MESSAGE_TYPE_NORMAL,
+                                        (const uint8_t *)"Install Gentoo", sizeof("Install Gentoo"), NULL);
+                test_tox->message_sent = 1;
+            }
+
+            if (test_tox->messages_received > 0)
+                ++friends_received;
+        }
+
+        pthread_mutex_lock(&lock);
+        thread->connected = connected;
+        thread->friends_received = friends_received;
+        pthread_mutex_unlock(&lock);
+
+        usleep(50000);
+    }
+
+    for (i = first; i < first + TOXES_PER_THREAD; ++i) {
+        if (toxes[i].tox)
+            tox_kill(toxes[i].tox);
+
+        toxes[i].tox = NULL;
+    }
+
+    wait_phase(PHASE_KILL);
+    return NULL;
+}
+
+static void wait_threads(void)
+{
+    pthread_mutex_lock(&lock);
+
+    while (threads_done < NUM_THREADS)
+        pthread_cond_wait(&cond, &lock);
+
+    threads_done = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+static void set_phase(Test_Phase next)
+{
+    pthread_mutex_lock(&lock);
+    phase = next;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+START_TEST(test_many_threads)
+{
+    long long unsigned int cur_time = time(NULL);
+    uint32_t i;
+
+    phase = PHASE_CREATE;
+
+    for (i = 0; i < NUM_THREADS; ++i) {
+        threads[i].index = i;
+        ck_assert_msg(pthread_create(&threads[i].thread, NULL, &test_thread, &threads[i]) == 0,
+                      "failed to start thread %u", i);
+    }
+
+    wait_threads();
+
+    for (i = 0; i < NUM_THREADS; ++i)
+        ck_assert_msg(!threads[i].failed, "failed to create the instances of thread %u", i);
+
+    /* The threads wait for the next phase, so the instances can be set up from here */
+    uint8_t dht_keys[NUM_BOOTSTRAP_TOXES][TOX_PUBLIC_KEY_SIZE];
+    uint16_t ports[NUM_BOOTSTRAP_TOXES];
+
+    for (i = 0; i < NUM_BOOTSTRAP_TOXES; ++i) {
+        tox_self_get_dht_id(toxes[i].tox, dht_keys[i]);
+        ports[i] = tox_self_get_udp_port(toxes[i].tox, NULL);
+    }
+
+    for (i = 0; i < NUM_TOXES; ++i) {
+        uint32_t j = (i + 1) % NUM_BOOTSTRAP_TOXES;
+        ck_assert_msg(tox_bootstrap(toxes[i].tox, "127.0.0.1", ports[j], dht_keys[j], NULL), "bootstrap failed");
+        toxes[i].friend_number = UINT32_MAX;
+    }
+
+    /* The two friends of a pair are on threads half the pool apart */
+    for (i = 0; i < NUM_PAIRS; ++i) {
+        uint32_t a = NUM_BOOTSTRAP_TOXES + i;
+        uint32_t b = a + NUM_TOXES / 2;
+        uint8_t public_key[TOX_PUBLIC_KEY_SIZE];
+
+        tox_self_get_public_key(toxes[b].tox, public_key);
+        toxes[a].friend_number = tox_friend_add_norequest(toxes[a].tox, public_key, NULL);
+        tox_self_get_public_key(toxes[a].tox, public_key);
+        toxes[b].friend_number = tox_friend_add_norequest(toxes[b].tox, public_key, NULL);
+        ck_assert_msg(toxes[a].friend_number != UINT32_MAX && toxes[b].friend_number != UINT32_MAX,
+                      "failed to add friends");
+    }
+
+    set_phase(PHASE_ITERATE);
+
+    uint32_t connected = 0, friends_received = 0;
+
+    while (time(NULL) - cur_time < TEST_TIMEOUT) {
+        sleep(1);
+
+        connected = 0;
+        friends_received = 0;
+
+        pthread_mutex_lock(&lock);
+
+        for (i = 0; i < NUM_THREADS; ++i) {
+            connected += threads[i].connected;
+            friends_received += threads[i].friends_received;
+        }
+
+        pthread_mutex_unlock(&lock);
+
+        if (connected == NUM_TOXES && friends_received == NUM_PAIRS * 2)
+            break;
+    }
+
+    set_phase(PHASE_KILL);
+    wait_threads();
+
+    for (i = 0; i < NUM_THREADS; ++i)
+        pthread_join(threads[i].thread, NULL);
+
+    ck_assert_msg(connected == NUM_TOXES, "only %u of %u instances connected", connected, NUM_TOXES);
+    ck_assert_msg(friends_received == NUM_PAIRS * 2, "only %u of %u friends got their message", friends_received,
+                  NUM_PAIRS * 2);
+
+    printf("test_many_threads succeeded, took %llu seconds\n", time(NULL) - cur_time);
+}
+END_TEST
+
+static Suite *tox_threads_suite(void)
+{
+    Suite *s = suite_create("Tox threads");
+
+    DEFTESTCASE_SLOW(many_threads, TEST_TIMEOUT + 60);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    srand(time(NULL));
+
+    Suite *tox_threads = tox_threads_suite();
+    SRunner *test_runner = srunner_create(tox_threads);
+    int number_failed = 0;
+
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -141,7 +141,7 @@ int main(int argc, char *argv[])
 #ifdef TCP_RELAY_ENABLED
 #define NUM_PORTS 3
     uint16_t ports[NUM_PORTS] = {443, 3389, PORT};
-    TCP_Server *tcp_s = new_TCP_server(ipv6enabled, NUM_PORTS, ports, dht->self_secret_key, onion);
+    TCP_Server *tcp_s = new_TCP_server(dht->mono_time, ipv6enabled, NUM_PORTS, ports, dht->self_secret_key, onion);
 
     if (tcp_s == NULL) {
         printf("TCP server failed to initialize.\n");
@@ -190,9 +190,10 @@ int main(int argc, char *argv[])
 
         do_DHT(dht);
 
-        if (is_timeout(last_LANdiscovery, is_waiting_for_dht_connection ? 5 : LAN_DISCOVERY_INTERVAL)) {
+        if (LANdiscovery_poll(dht)
+                || is_timeout(dht->mono_time, last_LANdiscovery, is_waiting_for_dht_connection ? 5 : LAN_DISCOVERY_INTERVAL)) {
             send_LANdiscovery(htons(PORT), dht);
-            last_LANdiscovery = unix_time();
+            last_LANdiscovery = unix_time(dht->mono_time);
         }
 
 #ifdef TCP_RELAY_ENABLED
@@ -44,6 +44,7 @@
 // toxcore
 #include "../../toxcore/LAN_discovery.h"
 #include "../../toxcore/onion_announce.h"
+#include "../../toxcore/onion_workers.h"
 #include "../../toxcore/TCP_server.h"
 #include "../../toxcore/util.h"
 #include "../../toxcore/group_announce.h"
@@ -70,6 +71,9 @@
 #define DEFAULT_TCP_RELAY_PORTS_COUNT 3
 #define DEFAULT_ENABLE_MOTD           1 // 1 - true, 0 - false
 #define DEFAULT_MOTD                  DAEMON_NAME
+#define DEFAULT_GROUP_ANNOUNCE_MAX_NODES       GCA_STORE_DEFAULT_MAX_NODES
+#define DEFAULT_GROUP_ANNOUNCE_MAX_GROUP_NODES GCA_STORE_DEFAULT_MAX_GROUP_NODES
+#define DEFAULT_ONION_WORKERS         0 // 0 - onion packets are forwarded by the main thread
 
 #define MIN_ALLOWED_PORT 1
 #define MAX_ALLOWED_PORT 65535
@@ -240,7 +244,8 @@ void parse_tcp_relay_ports_config(config_t *cfg, uint16_t **tcp_relay_ports, int
 int get_general_config(const char *cfg_file_path, char **pid_file_path, char **keys_file_path, int *port,
                        int *enable_ipv6,
                        int *enable_ipv4_fallback, int *enable_lan_discovery, int *enable_tcp_relay, uint16_t **tcp_relay_ports,
-                       int *tcp_relay_port_count, int *enable_motd, char **motd)
+                       int *tcp_relay_port_count, int *enable_motd, char **motd, int *group_announce_max_nodes,
+                       int *group_announce_max_group_nodes, int *onion_workers)
 {
     config_t cfg;
 
@@ -253,6 +258,9 @@ int get_general_config(const char *cfg_file_path, char **pid_file_path, char **k
     const char *NAME_ENABLE_TCP_RELAY     = "enable_tcp_relay";
     const char *NAME_ENABLE_MOTD          = "enable_motd";
     const char *NAME_MOTD                 = "motd";
+    const char *NAME_GROUP_ANNOUNCE_MAX_NODES       = "group_announce_max_nodes";
+    const char *NAME_GROUP_ANNOUNCE_MAX_GROUP_NODES = "group_announce_max_group_nodes";
+    const char *NAME_ONION_WORKERS        = "onion_workers";
 
     config_init(&cfg);
 
@@ -356,6 +364,28 @@ int get_general_config(const char *cfg_file_path, char **pid_file_path, char **k
         (*motd)[motd_length - 1] = '\0';
     }
 
+    // Get group announcement limits
+    if (config_lookup_int(&cfg, NAME_GROUP_ANNOUNCE_MAX_NODES, group_announce_max_nodes) == CONFIG_FALSE) {
+        syslog(LOG_WARNING, "No '%s' setting in configuration file.\n", NAME_GROUP_ANNOUNCE_MAX_NODES);
+        syslog(LOG_WARNING, "Using default '%s': %d\n", NAME_GROUP_ANNOUNCE_MAX_NODES,
+               DEFAULT_GROUP_ANNOUNCE_MAX_NODES);
+        *group_announce_max_nodes = DEFAULT_GROUP_ANNOUNCE_MAX_NODES;
+    }
+
+    if (config_lookup_int(&cfg, NAME_GROUP_ANNOUNCE_MAX_GROUP_NODES, group_announce_max_group_nodes) == CONFIG_FALSE) {
+        syslog(LOG_WARNING, "No '%s' setting in configuration file.\n", NAME_GROUP_ANNOUNCE_MAX_GROUP_NODES);
+        syslog(LOG_WARNING, "Using default '%s': %d\n", NAME_GROUP_ANNOUNCE_MAX_GROUP_NODES,
+               DEFAULT_GROUP_ANNOUNCE_MAX_GROUP_NODES);
+        *group_announce_max_group_nodes = DEFAULT_GROUP_ANNOUNCE_MAX_GROUP_NODES;
+    }
+
+    // Get number of onion forwarding threads
+    if (config_lookup_int(&cfg, NAME_ONION_WORKERS, onion_workers) == CONFIG_FALSE) {
+        syslog(LOG_WARNING, "No '%s' setting in configuration file.\n", NAME_ONION_WORKERS);
+        syslog(LOG_WARNING, "Using default '%s': %d\n", NAME_ONION_WORKERS, DEFAULT_ONION_WORKERS);
+        *onion_workers = DEFAULT_ONION_WORKERS;
+    }
+
     config_destroy(&cfg);
 
     syslog(LOG_DEBUG, "Successfully read:\n");
@@ -388,6 +418,10 @@ int get_general_config(const char *cfg_file_path, char **pid_file_path, char **k
         syslog(LOG_DEBUG, "'%s': %s\n", NAME_MOTD, *motd);
     }
 
+    syslog(LOG_DEBUG, "'%s': %d\n", NAME_GROUP_ANNOUNCE_MAX_NODES,       *group_announce_max_nodes);
+    syslog(LOG_DEBUG, "'%s': %d\n", NAME_GROUP_ANNOUNCE_MAX_GROUP_NODES, *group_announce_max_group_nodes);
+    syslog(LOG_DEBUG, "'%s': %d\n", NAME_ONION_WORKERS,        *onion_workers);
+
     return 1;
 }
 
@@ -539,9 +573,13 @@ int main(int argc, char *argv[])
     int tcp_relay_port_count;
     int enable_motd;
     char *motd;
+    int group_announce_max_nodes;
+    int group_announce_max_group_nodes;
+    int onion_workers;
 
     if (get_general_config(cfg_file_path, &pid_file_path, &keys_file_path, &port, &enable_ipv6, &enable_ipv4_fallback,
-                           &enable_lan_discovery, &enable_tcp_relay, &tcp_relay_ports, &tcp_relay_port_count, &enable_motd, &motd)) {
+                           &enable_lan_discovery, &enable_tcp_relay, &tcp_relay_ports, &tcp_relay_port_count, &enable_motd, &motd,
+                           &group_announce_max_nodes, &group_announce_max_group_nodes, &onion_workers)) {
         syslog(LOG_DEBUG, "General config read successfully\n");
     } else {
         syslog(LOG_ERR, "Couldn't read config file: %s. Exiting.\n", cfg_file_path);
@@ -553,6 +591,12 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (onion_workers < 0 || onion_workers > MAX_ONION_WORKERS) {
+        syslog(LOG_ERR, "Invalid number of onion workers: %d, should be in [0, %d]. Exiting.\n", onion_workers,
+               MAX_ONION_WORKERS);
+        return 1;
+    }
+
     // Check if the PID file exists
     FILE *pid_file;
 
@@ -606,6 +650,13 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (group_announce_max_nodes <= 0 || group_announce_max_group_nodes <= 0
+            || gca_set_limits(group_announce, group_announce_max_nodes, group_announce_max_group_nodes) == -1) {
+        syslog(LOG_ERR, "Invalid group announcement limits: %d, %d, should be positive. Exiting.\n",
+               group_announce_max_nodes, group_announce_max_group_nodes);
+        return 1;
+    }
+
     if (enable_motd) {
         if (bootstrap_set_callbacks(dht->net, DAEMON_VERSION_NUMBER, (uint8_t *)motd, strlen(motd) + 1) == 0) {
             syslog(LOG_DEBUG, "Set MOTD successfully.\n");
@@ -632,7 +683,8 @@ int main(int argc, char *argv[])
             return 1;
         }
 
-        tcp_server = new_TCP_server(enable_ipv6, tcp_relay_port_count, tcp_relay_ports, dht->self_secret_key, onion);
+        tcp_server = new_TCP_server(dht->mono_time, enable_ipv6, tcp_relay_port_count, tcp_relay_ports,
+                                    dht->self_secret_key, onion);
 
         // tcp_relay_port_count != 0 at this point
         free(tcp_relay_ports);
@@ -712,13 +764,28 @@ int main(int argc, char *argv[])
         syslog(LOG_DEBUG, "Initialized LAN discovery.\n");
     }
 
+    // Threads don't survive the fork, so the workers are started by the child
+    Onion_Workers *workers = NULL;
+
+    if (onion_workers > 0) {
+        workers = new_onion_workers(onion, onion_workers);
+
+        if (workers == NULL) {
+            syslog(LOG_ERR, "Couldn't start %d onion workers. Exiting.\n", onion_workers);
+            return 1;
+        }
+
+        syslog(LOG_DEBUG, "Started %d onion workers.\n", onion_workers);
+    }
+
     while (1) {
         do_DHT(dht);
         do_gca(group_announce);
 
-        if (enable_lan_discovery && is_timeout(last_LANdiscovery, LAN_DISCOVERY_INTERVAL)) {
+        if (enable_lan_discovery
+                && (LANdiscovery_poll(dht) || is_timeout(dht->mono_time, last_LANdiscovery, LAN_DISCOVERY_INTERVAL))) {
             send_LANdiscovery(htons_port, dht);
-            last_LANdiscovery = unix_time();
+            last_LANdiscovery = unix_time(dht->mono_time);
         }
 
         if (enable_tcp_relay) {
@@ -727,6 +794,10 @@ int main(int argc, char *argv[])
 
         networking_poll(dht->net);
 
+        if (workers) {
+            do_onion_workers(workers);
+        }
+
         if (waiting_for_dht_connection && DHT_isconnected(dht)) {
             syslog(LOG_DEBUG, "Connected to other bootstrap node successfully.\n");
             waiting_for_dht_connection = 0;
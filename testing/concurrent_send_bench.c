@@ -0,0 +1,305 @@
+/* concurrent_send_bench.c
+ *
+ * Throughput of sending messages to many friends from many threads, with the sends serialised
+ * with the iterate loop by a mutex like applications had to and with concurrent_send.
+ *
+ * One sender and its friends run on a simulated network, see network_sim.h, connected to each
+ * other directly. Once all the friends are online the producer threads each send their messages
+ * to the friends in turn, retrying a send whenever the queue of the friend is full, while the main
+ * thread iterates the sender and the friends until every message got through.
+ *
+ * It prints one line of comma separated values for each mode, after a header line:
+ *   mode             locked or queued
+ *   producers        number of producer threads
+ *   friends          number of friends of the sender
+ *   messages         messages sent by all the producers together
+ *   produce_s        wall time the producers took to have all their messages accepted
+ *   sends_per_s      messages accepted per second of produce_s
+ *   deliver_s        wall time until the friends received all the messages
+ *   delivered_per_s  messages received per second of deliver_s
+ *   full             sends that were retried because a queue was full
+ *
+ * Usage: ./concurrent_send_bench [friends] [producers] [messages per producer]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "network_sim.h"
+#include "../toxcore/Messenger.h"
+#include "../toxcore/group_chats.h"
+#include "../toxcore/util.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MAX_PRODUCERS 64
+#define BENCH_LATENCY 20   /* ms, one way */
+#define BENCH_SEED 42
+
+/* How far the simulated clock moves for each round of iterating everything */
+#define BENCH_ITERATE_INTERVAL 20   /* ms */
+
+/* Simulated time the friends get to connect and wall time the messages get to arrive */
+#define BENCH_CONNECT_TIMEOUT 300000   /* ms */
+#define BENCH_DELIVER_TIMEOUT 600   /* s */
+
+#define BENCH_MESSAGE "Install Gentoo"
+
+typedef struct {
+    Messenger *sender;
+    uint32_t num_friends;
+    uint32_t num_messages;   /* per producer */
+    _Bool locked;
+
+    /* In locked mode held by the main thread while it iterates and by the producers while they send */
+    pthread_mutex_t lock;
+
+    uint32_t producers_done;   /* atomic */
+    uint64_t full;   /* atomic */
+    uint64_t received;   /* only touched by the main thread */
+} Bench;
+
+typedef struct {
+    Bench *bench;
+    uint32_t index;
+    uint32_t num_producers;
+    pthread_t thread;
+} Producer;
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void handle_message(Messenger *m, uint32_t friend_number, unsigned int type, const uint8_t *message,
+                           size_t length, void *userdata)
+{
+    Bench *bench = userdata;
+    ++bench->received;
+}
+
+static void *produce(void *arg)
+{
+    Producer *producer = arg;
+    Bench *bench = producer->bench;
+    uint32_t friend_number = producer->index % bench->num_friends;
+    uint32_t i;
+
+    for (i = 0; i < bench->num_messages; ++i) {
+        while (1) {
+            if (bench->locked)
+                pthread_mutex_lock(&bench->lock);
+
+            int ret = m_send_message_generic(bench->sender, friend_number, MESSAGE_NORMAL, (const uint8_t *)BENCH_MESSAGE,
+                                             sizeof(BENCH_MESSAGE), NULL);
+
+            if (bench->locked)
+                pthread_mutex_unlock(&bench->lock);
+
+            if (ret == 0)
+                break;
+
+            if (ret != -4) {
+                printf("Send to friend %u failed: %i\n", friend_number, ret);
+                exit(1);
+            }
+
+            __atomic_add_fetch(&bench->full, 1, __ATOMIC_RELAXED);
+            sched_yield();
+        }
+
+        friend_number = (friend_number + producer->num_producers) % bench->num_friends;
+    }
+
+    __atomic_add_fetch(&bench->producers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int run(uint32_t num_friends, uint32_t num_producers, uint32_t num_messages, _Bool queued)
+{
+    Net_Sim_Options sim_options = {BENCH_LATENCY, BENCH_LATENCY, 0, BENCH_SEED};
+    Net_Sim *sim = new_net_sim(&sim_options, num_friends + 1);
+    Messenger **friends = calloc(num_friends, sizeof(Messenger *));
+    Producer *producers = calloc(num_producers, sizeof(Producer));
+    Bench bench = {0};
+
+    if (sim == NULL || friends == NULL || producers == NULL || pthread_mutex_init(&bench.lock, NULL) != 0)
+        return -1;
+
+    Messenger_Options options = {0};
+    options.concurrent_send = queued;
+    int node = net_sim_add_node(sim, &options.transport, &options.clock);
+    bench.sender = new_messenger(&options, 0);
+
+    if (node == -1 || bench.sender == NULL)
+        return -1;
+
+    net_sim_set_networking(sim, node, bench.sender->net);
+    Messenger *sender = bench.sender;
+    uint32_t i;
+
+    /* The friends learn each other's DHT key and address right away instead of through the onion */
+    for (i = 0; i < num_friends; ++i) {
+        Messenger_Options friend_options = {0};
+        node = net_sim_add_node(sim, &friend_options.transport, &friend_options.clock);
+        friends[i] = new_messenger(&friend_options, 0);
+
+        if (node == -1 || friends[i] == NULL)
+            return -1;
+
+        net_sim_set_networking(sim, node, friends[i]->net);
+        m_callback_friendmessage(friends[i], &handle_message, &bench);
+
+        int32_t friend_number = m_addfriend_norequest(sender, friends[i]->net_crypto->self_public_key);
+        int32_t sender_number = m_addfriend_norequest(friends[i], sender->net_crypto->self_public_key);
+
+        if (friend_number != (int32_t)i || sender_number != 0)
+            return -1;
+
+        set_dht_temp_pk(sender->fr_c, sender->friendlist[i].friendcon_id, friends[i]->dht->self_public_key);
+        set_dht_temp_pk(friends[i]->fr_c, friends[i]->friendlist[0].friendcon_id, sender->dht->self_public_key);
+        DHT_bootstrap(sender->dht, friends[i]->options.transport.ip_port, friends[i]->dht->self_public_key);
+        DHT_bootstrap(friends[i]->dht, sender->options.transport.ip_port, sender->dht->self_public_key);
+    }
+
+    uint64_t connect_end = net_sim_time(sim) + BENCH_CONNECT_TIMEOUT;
+    uint32_t online = 0;
+
+    while (online < num_friends && net_sim_time(sim) < connect_end) {
+        net_sim_run(sim, net_sim_time(sim) + BENCH_ITERATE_INTERVAL);
+        do_messenger(sender);
+
+        for (i = 0; i < num_friends; ++i)
+            do_messenger(friends[i]);
+
+        online = 0;
+
+        for (i = 0; i < num_friends; ++i)
+            online += m_get_friend_connectionstatus(sender, i) != CONNECTION_NONE;
+    }
+
+    if (online < num_friends) {
+        printf("Only %u of %u friends connected\n", online, num_friends);
+        return -1;
+    }
+
+    bench.num_friends = num_friends;
+    bench.num_messages = num_messages;
+    bench.locked = !queued;
+
+    uint64_t total = (uint64_t)num_messages * num_producers;
+    double start = get_time(), produced = 0, delivered = 0;
+
+    for (i = 0; i < num_producers; ++i) {
+        producers[i].bench = &bench;
+        producers[i].index = i;
+        producers[i].num_producers = num_producers;
+
+        if (pthread_create(&producers[i].thread, NULL, &produce, &producers[i]) != 0)
+            return -1;
+    }
+
+    while (bench.received < total && get_time() - start < BENCH_DELIVER_TIMEOUT) {
+        if (bench.locked)
+            pthread_mutex_lock(&bench.lock);
+
+        net_sim_run(sim, net_sim_time(sim) + BENCH_ITERATE_INTERVAL);
+        do_messenger(sender);
+
+        for (i = 0; i < num_friends; ++i)
+            do_messenger(friends[i]);
+
+        if (bench.locked)
+            pthread_mutex_unlock(&bench.lock);
+
+        /* Mutexes aren't fair, without this the producers may never get the lock on one core */
+        sched_yield();
+
+        if (produced == 0 && __atomic_load_n(&bench.producers_done, __ATOMIC_ACQUIRE) == num_producers)
+            produced = get_time() - start;
+    }
+
+    delivered = get_time() - start;
+
+    for (i = 0; i < num_producers; ++i)
+        pthread_join(producers[i].thread, NULL);
+
+    if (produced == 0)
+        produced = get_time() - start;
+
+    printf("%s,%u,%u,%llu,%.2f,%.0f,%.2f,%.0f,%llu\n", queued ? "queued" : "locked", num_producers, num_friends,
+           (unsigned long long)total, produced, total / produced, delivered, bench.received / delivered,
+           (unsigned long long)bench.full);
+
+    if (bench.received < total)
+        printf("Only %llu of %llu messages arrived\n", (unsigned long long)bench.received, (unsigned long long)total);
+
+    for (i = 0; i < num_friends; ++i) {
+        kill_groupchats(friends[i]->group_handler);
+        kill_messenger(friends[i]);
+    }
+
+    kill_groupchats(sender->group_handler);
+    kill_messenger(sender);
+    kill_net_sim(sim);
+    pthread_mutex_destroy(&bench.lock);
+    free(producers);
+    free(friends);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_friends = 1000;
+    uint32_t num_producers = 8;
+    uint32_t num_messages = 10000;
+
+    if (argc > 1)
+        num_friends = atoi(argv[1]);
+
+    if (argc > 2)
+        num_producers = atoi(argv[2]);
+
+    if (argc > 3)
+        num_messages = atoi(argv[3]);
+
+    if (num_friends == 0 || num_producers == 0 || num_producers > BENCH_MAX_PRODUCERS || num_messages == 0) {
+        printf("Usage: %s [friends] [producers] [messages per producer]\n", argv[0]);
+        return 1;
+    }
+
+    printf("mode,producers,friends,messages,produce_s,sends_per_s,deliver_s,delivered_per_s,full\n");
+
+    if (run(num_friends, num_producers, num_messages, 0) == -1 || run(num_friends, num_producers, num_messages, 1) == -1) {
+        printf("Benchmark failed\n");
+        return 1;
+    }
+
+    return 0;
+}
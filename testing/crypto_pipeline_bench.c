@@ -0,0 +1,185 @@
+/* crypto_pipeline_bench.c
+ *
+ * Benchmark for the net_crypto crypto pipeline.
+ *
+ * Encrypts and decrypts full sized data packets in batches of CRYPTO_PIPELINE_BATCH_SIZE
+ * with a varying number of worker threads and prints the throughput for each.
+ *
+ * Usage: ./crypto_pipeline_bench [number of packets] [max number of workers]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/net_crypto.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_PACKET_SIZE MAX_CRYPTO_DATA_SIZE
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static uint8_t plain[CRYPTO_PIPELINE_BATCH_SIZE][BENCH_PACKET_SIZE];
+static uint8_t encrypted[CRYPTO_PIPELINE_BATCH_SIZE][BENCH_PACKET_SIZE + crypto_box_MACBYTES];
+static uint8_t decrypted[CRYPTO_PIPELINE_BATCH_SIZE][BENCH_PACKET_SIZE];
+static Crypto_Job jobs[CRYPTO_PIPELINE_BATCH_SIZE];
+
+/* Encrypt then decrypt num_packets packets with num_workers threads (0 means no pipeline).
+ *
+ * return number of seconds it took.
+ */
+static double run_bench(uint32_t num_workers, uint32_t num_packets, const uint8_t *key)
+{
+    Crypto_Pipeline *pipeline = NULL;
+
+    if (num_workers) {
+        pipeline = new_crypto_pipeline(num_workers);
+
+        if (pipeline == NULL) {
+            printf("Failed to create pipeline with %u workers\n", num_workers);
+            exit(1);
+        }
+    }
+
+    uint8_t nonce[crypto_box_NONCEBYTES];
+    random_nonce(nonce);
+
+    double start = get_time();
+    uint32_t done = 0;
+
+    while (done < num_packets) {
+        uint32_t i, batch = num_packets - done;
+
+        if (batch > CRYPTO_PIPELINE_BATCH_SIZE)
+            batch = CRYPTO_PIPELINE_BATCH_SIZE;
+
+        for (i = 0; i < batch; ++i) {
+            memcpy(jobs[i].shared_key, key, crypto_box_BEFORENMBYTES);
+            memcpy(jobs[i].nonce, nonce, crypto_box_NONCEBYTES);
+            increment_nonce(nonce);
+            jobs[i].input = plain[i];
+            jobs[i].input_length = BENCH_PACKET_SIZE;
+            jobs[i].output = encrypted[i];
+            jobs[i].type = CRYPTO_JOB_ENCRYPT;
+
+            if (!pipeline)
+                jobs[i].result = encrypt_data_symmetric(key, jobs[i].nonce, plain[i], BENCH_PACKET_SIZE, encrypted[i]);
+        }
+
+        if (pipeline)
+            crypto_pipeline_run(pipeline, jobs, batch);
+
+        for (i = 0; i < batch; ++i) {
+            if (jobs[i].result != BENCH_PACKET_SIZE + crypto_box_MACBYTES) {
+                printf("Encryption failed\n");
+                exit(1);
+            }
+
+            jobs[i].input = encrypted[i];
+            jobs[i].input_length = BENCH_PACKET_SIZE + crypto_box_MACBYTES;
+            jobs[i].output = decrypted[i];
+            jobs[i].type = CRYPTO_JOB_DECRYPT;
+
+            if (!pipeline)
+                jobs[i].result = decrypt_data_symmetric(key, jobs[i].nonce, encrypted[i], BENCH_PACKET_SIZE + crypto_box_MACBYTES,
+                                                        decrypted[i]);
+        }
+
+        if (pipeline)
+            crypto_pipeline_run(pipeline, jobs, batch);
+
+        for (i = 0; i < batch; ++i) {
+            if (jobs[i].result != BENCH_PACKET_SIZE) {
+                printf("Decryption failed\n");
+                exit(1);
+            }
+        }
+
+        done += batch;
+    }
+
+    double elapsed = get_time() - start;
+    kill_crypto_pipeline(pipeline);
+    return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_packets = 200000;
+    uint32_t max_workers = 8;
+
+    if (argc > 1)
+        num_packets = atoi(argv[1]);
+
+    if (argc > 2)
+        max_workers = atoi(argv[2]);
+
+    if (num_packets == 0 || max_workers > CRYPTO_PIPELINE_MAX_WORKERS) {
+        printf("Usage: %s [number of packets] [max number of workers (<= %u)]\n", argv[0], CRYPTO_PIPELINE_MAX_WORKERS);
+        return 1;
+    }
+
+    uint8_t key[crypto_box_BEFORENMBYTES];
+    new_symmetric_key(key);
+
+    uint32_t i;
+
+    for (i = 0; i < CRYPTO_PIPELINE_BATCH_SIZE; ++i) {
+        randombytes(plain[i], BENCH_PACKET_SIZE);
+    }
+
+    printf("packets: %u, packet size: %u, batch size: %u\n", num_packets, (unsigned int)BENCH_PACKET_SIZE,
+           CRYPTO_PIPELINE_BATCH_SIZE);
+    printf("%-8s %-12s %-14s %-10s\n", "workers", "seconds", "packets/s", "MB/s");
+
+    double base_time = 0;
+    uint32_t workers = 0;
+
+    while (1) {
+        double seconds = run_bench(workers, num_packets, key);
+        double packets_per_sec = (2.0 * num_packets) / seconds;
+
+        if (workers == 0)
+            base_time = seconds;
+
+        printf("%-8u %-12.3f %-14.0f %-10.1f (x%.2f)\n", workers, seconds, packets_per_sec,
+               (packets_per_sec * BENCH_PACKET_SIZE) / (1024.0 * 1024.0), base_time / seconds);
+
+        if (workers >= max_workers)
+            break;
+
+        workers = workers ? workers * 2 : 1;
+
+        if (workers > max_workers)
+            workers = max_workers;
+    }
+
+    return 0;
+}
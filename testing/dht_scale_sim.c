@@ -0,0 +1,341 @@
+/* dht_scale_sim.c
+ *
+ * Simulation of a network of many Messenger nodes on a simulated network and clock.
+ *
+ * Every node is a full Messenger with its own DHT, onion and net_crypto, sending through
+ * network_sim instead of a socket, so thousands of them fit in one process and run faster than
+ * real time. A few of them are bootstrap nodes, the others join at random times over the first
+ * seconds and bootstrap from them, again every few seconds until they are in the DHT like clients
+ * do. Some pairs of nodes add each other as friends at the start and have to find each other
+ * through the onion.
+ *
+ * For each number of nodes it prints one line of comma separated values, after a header line:
+ *   nodes            nodes in the network
+ *   loss             share of the packets lost
+ *   connected        nodes that got connected to the network, as tox_self_get_connection_status()
+ *                    reports it
+ *   connect_p50_ms   time from joining until nodes were connected, median and 95th percentile
+ *   connect_p95_ms
+ *   friends_found    pairs of friends that got a direct connection to each other
+ *   find_p50_ms      time from when both friends were connected until they found each other
+ *   find_p95_ms
+ *   up_bps           bytes per second an average node sent and received over the last half of
+ *   down_bps         the run, when the network has settled
+ *   max_up_bps       the most a single node sent per second over the last half of the run
+ *   speedup          simulated time over the time it took to run
+ *
+ * Latencies, losses and keys all come from a fixed seed, so the same arguments give the same
+ * numbers every run, the speedup aside.
+ *
+ * Usage: ./dht_scale_sim [node counts, comma separated] [simulated seconds] [loss percent]
+ *                        [friend pairs]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "network_sim.h"
+#include "../toxcore/Messenger.h"
+#include "../toxcore/group_chats.h"
+#include "../toxcore/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_MAX_COUNTS 16
+#define SIM_BOOTSTRAP_NODES 4
+#define SIM_MIN_LATENCY 10   /* ms, one way */
+#define SIM_MAX_LATENCY 150
+#define SIM_SEED 42
+
+/* How often every node runs do_messenger(), like a client calling tox_iterate() */
+#define SIM_ITERATE_INTERVAL 50   /* ms */
+
+/* Nodes join over this long, the bootstrap nodes right away */
+#define SIM_JOIN_PERIOD 10000   /* ms */
+
+/* How often a node that isn't in the DHT bootstraps again */
+#define SIM_BOOTSTRAP_INTERVAL 5000   /* ms */
+
+#define SIM_NEVER UINT64_MAX
+
+typedef struct {
+    Messenger *m;
+    uint64_t joined;   /* ms since the start */
+    uint64_t last_bootstrap;   /* ms since the start or SIM_NEVER */
+    uint64_t connected;   /* ms since joining or SIM_NEVER */
+} Sim_Tox;
+
+typedef struct {
+    uint32_t a;
+    uint32_t b;
+    int32_t friend_a;   /* friend number of b for a */
+    uint64_t found;
+} Sim_Friends;
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Sorts values and returns the given percentile of the first num of them, or 0 if num is 0. */
+static uint64_t percentile(uint64_t *values, uint32_t num, uint32_t percent)
+{
+    if (num == 0)
+        return 0;
+
+    qsort(values, num, sizeof(uint64_t), &cmp_u64);
+    return values[(uint64_t)(num - 1) * percent / 100];
+}
+
+static int run(uint32_t num_nodes, uint32_t seconds, double loss, uint32_t num_pairs)
+{
+    Net_Sim_Options sim_options = {SIM_MIN_LATENCY, SIM_MAX_LATENCY, loss, SIM_SEED};
+    Net_Sim *sim = new_net_sim(&sim_options, num_nodes);
+    Sim_Tox *nodes = calloc(num_nodes, sizeof(Sim_Tox));
+    Sim_Friends *pairs = calloc(num_pairs, sizeof(Sim_Friends));
+    uint64_t *values = calloc(num_nodes > num_pairs ? num_nodes : num_pairs, sizeof(uint64_t));
+    Net_Sim_Stats *half = calloc(num_nodes, sizeof(Net_Sim_Stats));
+
+    if (sim == NULL || nodes == NULL || pairs == NULL || values == NULL || half == NULL)
+        return -1;
+
+    double wall_start = get_time();
+    uint32_t i;
+
+    for (i = 0; i < num_nodes; ++i) {
+        Messenger_Options options = {0};
+
+        if (net_sim_add_node(sim, &options.transport, &options.clock) == -1)
+            return -1;
+
+        nodes[i].m = new_messenger(&options, 0);
+
+        if (nodes[i].m == NULL)
+            return -1;
+
+        net_sim_set_networking(sim, i, nodes[i].m->net);
+        nodes[i].last_bootstrap = SIM_NEVER;
+        nodes[i].connected = SIM_NEVER;
+    }
+
+    /* Join times and friends are picked the same way every run */
+    uint64_t seed = SIM_SEED;
+
+    for (i = SIM_BOOTSTRAP_NODES; i < num_nodes; ++i) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        nodes[i].joined = (seed >> 33) % SIM_JOIN_PERIOD;
+    }
+
+    for (i = 0; i < num_pairs && num_nodes > SIM_BOOTSTRAP_NODES + 1; ++i) {
+        Sim_Friends *pair = &pairs[i];
+        uint32_t others = num_nodes - SIM_BOOTSTRAP_NODES;
+
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        pair->a = SIM_BOOTSTRAP_NODES + (seed >> 33) % others;
+
+        do {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            pair->b = SIM_BOOTSTRAP_NODES + (seed >> 33) % others;
+        } while (pair->b == pair->a);
+
+        Messenger *a = nodes[pair->a].m, *b = nodes[pair->b].m;
+        pair->friend_a = m_addfriend_norequest(a, b->net_crypto->self_public_key);
+        m_addfriend_norequest(b, a->net_crypto->self_public_key);
+        pair->found = SIM_NEVER;
+    }
+
+    uint64_t start = net_sim_time(sim), end = start + seconds * 1000ULL;
+    uint64_t half_time = start + seconds * 500ULL;
+    _Bool half_taken = 0;
+
+    while (net_sim_time(sim) < end) {
+        uint64_t now = net_sim_time(sim) + SIM_ITERATE_INTERVAL;
+        net_sim_run(sim, now);
+
+        for (i = 0; i < num_nodes; ++i) {
+            Sim_Tox *node = &nodes[i];
+
+            if (now - start < node->joined)
+                continue;
+
+            /* Bootstrap nodes bootstrap from each other */
+            if (!DHT_isconnected(node->m->dht) && (node->last_bootstrap == SIM_NEVER
+                    || now - start >= node->last_bootstrap + SIM_BOOTSTRAP_INTERVAL)) {
+                uint32_t j = i < SIM_BOOTSTRAP_NODES ? (i + 1) % SIM_BOOTSTRAP_NODES : i % SIM_BOOTSTRAP_NODES;
+
+                if (j != i && j < num_nodes)
+                    DHT_bootstrap(node->m->dht, nodes[j].m->options.transport.ip_port, nodes[j].m->dht->self_public_key);
+
+                node->last_bootstrap = now - start;
+            }
+
+            do_messenger(node->m);
+
+            if (node->connected == SIM_NEVER && onion_connection_status(node->m->onion_c) != 0)
+                node->connected = now - start - node->joined;
+        }
+
+        for (i = 0; i < num_pairs; ++i) {
+            Sim_Friends *pair = &pairs[i];
+
+            if (pair->found == SIM_NEVER && pair->friend_a != -1
+                    && m_get_friend_connectionstatus(nodes[pair->a].m, pair->friend_a) == CONNECTION_UDP)
+                pair->found = now - start;
+        }
+
+        if (!half_taken && now >= half_time) {
+            for (i = 0; i < num_nodes; ++i)
+                net_sim_get_stats(sim, i, &half[i]);
+
+            half_taken = 1;
+        }
+    }
+
+    double wall = get_time() - wall_start;
+
+    uint32_t connected = 0;
+
+    for (i = 0; i < num_nodes; ++i) {
+        if (nodes[i].connected != SIM_NEVER)
+            values[connected++] = nodes[i].connected;
+    }
+
+    uint64_t connect_p50 = percentile(values, connected, 50);
+    uint64_t connect_p95 = percentile(values, connected, 95);
+
+    uint32_t found = 0;
+
+    for (i = 0; i < num_pairs; ++i) {
+        const Sim_Friends *pair = &pairs[i];
+
+        if (pair->found == SIM_NEVER)
+            continue;
+
+        const Sim_Tox *a = &nodes[pair->a], *b = &nodes[pair->b];
+        uint64_t both = a->joined + a->connected > b->joined + b->connected ? a->joined + a->connected :
+                        b->joined + b->connected;
+        values[found++] = pair->found > both ? pair->found - both : 0;
+    }
+
+    uint64_t find_p50 = percentile(values, found, 50);
+    uint64_t find_p95 = percentile(values, found, 95);
+
+    uint64_t up = 0, down = 0, max_up = 0;
+    double half_seconds = (end - half_time) / 1000.0;
+
+    for (i = 0; i < num_nodes; ++i) {
+        Net_Sim_Stats stats;
+        net_sim_get_stats(sim, i, &stats);
+
+        uint64_t sent = stats.bytes_sent - half[i].bytes_sent;
+        up += sent;
+        down += stats.bytes_received - half[i].bytes_received;
+
+        if (sent > max_up)
+            max_up = sent;
+    }
+
+    printf("%u,%.3f,%u,%llu,%llu,%u,%llu,%llu,%.0f,%.0f,%.0f,%.1f\n", num_nodes, loss, connected,
+           (unsigned long long)connect_p50, (unsigned long long)connect_p95, found, (unsigned long long)find_p50,
+           (unsigned long long)find_p95, up / half_seconds / num_nodes, down / half_seconds / num_nodes,
+           max_up / half_seconds, seconds / wall);
+
+    for (i = 0; i < num_nodes; ++i) {
+        kill_groupchats(nodes[i].m->group_handler);
+        kill_messenger(nodes[i].m);
+    }
+
+    kill_net_sim(sim);
+    free(half);
+    free(values);
+    free(pairs);
+    free(nodes);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t counts[SIM_MAX_COUNTS] = {100, 500, 1000};
+    uint32_t num_counts = 3;
+    uint32_t seconds = 120;
+    double loss = 0.01;
+    uint32_t num_pairs = 50;
+
+    if (argc > 1) {
+        char *list = argv[1];
+        num_counts = 0;
+
+        while (*list && num_counts < SIM_MAX_COUNTS) {
+            counts[num_counts++] = strtoul(list, &list, 10);
+
+            if (*list == ',')
+                ++list;
+            else
+                break;
+        }
+    }
+
+    if (argc > 2)
+        seconds = atoi(argv[2]);
+
+    if (argc > 3)
+        loss = atof(argv[3]) / 100.0;
+
+    if (argc > 4)
+        num_pairs = atoi(argv[4]);
+
+    if (num_counts == 0 || seconds == 0 || loss < 0 || loss >= 1) {
+        printf("Usage: %s [node counts, comma separated] [simulated seconds] [loss percent] [friend pairs]\n", argv[0]);
+        return 1;
+    }
+
+    /* Keys too come from the seed, so that the same arguments give the same run */
+    if (net_sim_seed_random(SIM_SEED) == -1) {
+        printf("Failed to seed the random number generator\n");
+        return 1;
+    }
+
+    printf("nodes,loss,connected,connect_p50_ms,connect_p95_ms,friends_found,find_p50_ms,find_p95_ms,"
+           "up_bps,down_bps,max_up_bps,speedup\n");
+
+    uint32_t i;
+
+    for (i = 0; i < num_counts; ++i) {
+        if (counts[i] == 0 || run(counts[i], seconds, loss, num_pairs) == -1) {
+            printf("Simulation of %u nodes failed\n", counts[i]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,244 @@
+/* fec_bench.c
+ *
+ * Benchmark for the forward error correction of lossy packets.
+ *
+ * Sends video frames split in pieces as lossy packets through a simulated lossy
+ * link, with and without FEC, and prints the fraction of frames received with all
+ * their pieces, the bandwidth overhead and the encoding and decoding speed.
+ *
+ * The link loses packets following a two state (Gilbert-Elliott) model so that
+ * both random and burst losses can be simulated.
+ *
+ * Usage: ./fec_bench [number of frames] [pieces per frame] [average burst length]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/net_crypto.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Same as the video RTP packets of toxav. */
+#define BENCH_PACKET_ID 193
+#define BENCH_PIECE_SIZE 1280
+
+#define BENCH_MAX_PIECES 64
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+typedef struct {
+    double loss; /* Average fraction of packets lost. */
+    double burst; /* Average length of a loss burst. */
+    _Bool bad; /* In the lossy state. */
+} Lossy_Link;
+
+/* return 1 if the next packet is lost.
+ *
+ * In the bad state every packet is lost, the probability of leaving it gives the
+ * burst length and the probability of entering it the average loss.
+ */
+static _Bool link_lose_packet(Lossy_Link *link)
+{
+    double leave_bad = 1.0 / link->burst;
+    double enter_bad = link->loss * leave_bad / (1.0 - link->loss);
+    double r = (double)rand() / RAND_MAX;
+
+    if (link->bad) {
+        if (r < leave_bad)
+            link->bad = 0;
+    } else if (r < enter_bad) {
+        link->bad = 1;
+    }
+
+    return link->bad;
+}
+
+typedef struct {
+    const char *name;
+    uint8_t num_data;
+    uint8_t num_parity;
+} Bench_Config;
+
+typedef struct {
+    double frames_complete;
+    double overhead;
+    double encode_mbps;
+    double decode_mbps;
+} Bench_Result;
+
+static uint8_t wire[FEC_MAX_PACKET_SIZE];
+static uint8_t parity[FEC_MAX_PARITY_PACKETS][FEC_MAX_PACKET_SIZE];
+static uint8_t received[FEC_MAX_PARITY_PACKETS + 1][FEC_MAX_PACKET_SIZE];
+
+/* Pass packet through the link and the receiving session, marking the pieces that made it. */
+static void deliver(Lossy_Link *link, FEC_Session *recv_fec, const uint8_t *packet, uint16_t length,
+                    uint32_t frame, uint8_t *pieces, double *decode_time)
+{
+    if (link_lose_packet(link))
+        return;
+
+    if (recv_fec == NULL) {
+        pieces[packet[5]] = 1;
+        return;
+    }
+
+    uint16_t lengths[FEC_MAX_PARITY_PACKETS + 1];
+    double start = get_time();
+    int num = fec_handle_packet(recv_fec, packet, length, received, lengths);
+    *decode_time += get_time() - start;
+    int i;
+
+    for (i = 0; i < num; ++i) {
+        uint32_t piece_frame;
+        memcpy(&piece_frame, received[i] + 1, sizeof(piece_frame));
+
+        /* Pieces of older frames come too late to be used. */
+        if (piece_frame == frame)
+            pieces[received[i][5]] = 1;
+    }
+}
+
+static Bench_Result run_bench(const Bench_Config *config, double loss, double burst, uint32_t num_frames,
+                              uint32_t num_pieces)
+{
+    Lossy_Link link = {loss, burst, 0};
+    FEC_Session *send_fec = NULL, *recv_fec = NULL;
+
+    if (config->num_data) {
+        send_fec = new_fec_session(PACKET_ID_FEC, MAX_CRYPTO_DATA_SIZE);
+        recv_fec = new_fec_session(PACKET_ID_FEC, MAX_CRYPTO_DATA_SIZE);
+        fec_set_stream(send_fec, BENCH_PACKET_ID, config->num_data, config->num_parity);
+    }
+
+    uint8_t piece[BENCH_PIECE_SIZE];
+    uint8_t pieces[BENCH_MAX_PIECES];
+    uint64_t payload_bytes = 0, sent_bytes = 0;
+    uint32_t complete = 0, frame, i, j;
+    double encode_time = 0, decode_time = 0;
+
+    for (i = 0; i < sizeof(piece); ++i)
+        piece[i] = rand();
+
+    for (frame = 0; frame < num_frames; ++frame) {
+        memset(pieces, 0, sizeof(pieces));
+
+        for (i = 0; i < num_pieces; ++i) {
+            /* [packet id][uint32_t frame][uint8_t piece][data] */
+            piece[0] = BENCH_PACKET_ID;
+            memcpy(piece + 1, &frame, sizeof(frame));
+            piece[5] = i;
+            payload_bytes += sizeof(piece);
+
+            if (send_fec == NULL) {
+                sent_bytes += sizeof(piece);
+                deliver(&link, NULL, piece, sizeof(piece), frame, pieces, &decode_time);
+                continue;
+            }
+
+            uint16_t lengths[FEC_MAX_PARITY_PACKETS];
+            double start = get_time();
+            int length = fec_wrap_packet(send_fec, piece, sizeof(piece), wire, frame);
+            uint32_t num_parity = fec_parity_packets(send_fec, BENCH_PACKET_ID, i == num_pieces - 1, parity, lengths);
+            encode_time += get_time() - start;
+
+            sent_bytes += length;
+            deliver(&link, recv_fec, wire, length, frame, pieces, &decode_time);
+
+            for (j = 0; j < num_parity; ++j) {
+                sent_bytes += lengths[j];
+                deliver(&link, recv_fec, parity[j], lengths[j], frame, pieces, &decode_time);
+            }
+        }
+
+        for (i = 0; i < num_pieces && pieces[i]; ++i);
+
+        if (i == num_pieces)
+            ++complete;
+    }
+
+    kill_fec_session(send_fec);
+    kill_fec_session(recv_fec);
+
+    Bench_Result result;
+    result.frames_complete = (double)complete / num_frames;
+    result.overhead = (double)sent_bytes / payload_bytes - 1.0;
+    result.encode_mbps = encode_time > 0 ? payload_bytes / encode_time / 1000000.0 : 0;
+    result.decode_mbps = decode_time > 0 ? payload_bytes / decode_time / 1000000.0 : 0;
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_frames = 20000;
+    uint32_t num_pieces = 8;
+    double burst = 1.0;
+
+    if (argc > 1)
+        num_frames = atoi(argv[1]);
+
+    if (argc > 2)
+        num_pieces = atoi(argv[2]);
+
+    if (argc > 3)
+        burst = atof(argv[3]);
+
+    if (num_frames == 0 || num_pieces == 0 || num_pieces > BENCH_MAX_PIECES || burst < 1.0) {
+        printf("Usage: %s [number of frames] [pieces per frame (<= %u)] [average burst length (>= 1)]\n", argv[0],
+               BENCH_MAX_PIECES);
+        return 1;
+    }
+
+    const Bench_Config configs[] = {
+        {"none", 0, 0},
+        {"xor 10+1", 10, 1},
+        {"rs 10+2", 10, 2},
+        {"rs 10+4", 10, 4},
+        {"rs 32+8", 32, 8},
+    };
+    const double losses[] = {0.01, 0.02, 0.05, 0.10, 0.20};
+    uint32_t i, j;
+
+    printf("frames: %u, pieces per frame: %u, piece size: %u, average burst length: %.1f\n", num_frames, num_pieces,
+           BENCH_PIECE_SIZE, burst);
+    printf("%-10s %-6s %-16s %-10s %-14s %-14s\n", "fec", "loss", "frames complete", "overhead", "encode MB/s",
+           "decode MB/s");
+
+    for (i = 0; i < sizeof(losses) / sizeof(losses[0]); ++i) {
+        for (j = 0; j < sizeof(configs) / sizeof(configs[0]); ++j) {
+            srand(i);
+            Bench_Result result = run_bench(&configs[j], losses[i], burst, num_frames, num_pieces);
+            printf("%-10s %-6.2f %-16.4f %-10.3f %-14.1f %-14.1f\n", configs[j].name, losses[i], result.frames_complete,
+                   result.overhead, result.encode_mbps, result.decode_mbps);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,317 @@
+/* group_ack_bench.c
+ *
+ * Benchmark for the acknowledgements and retransmissions of group lossless messages.
+ *
+ * Connects two group peers over localhost UDP, drops packets in both directions at
+ * several loss rates and sends a stream of messages from one peer to the other.
+ * Prints the number of ack packets sent per message, the number of retransmissions
+ * and the delivery latency of all messages and of those whose first copy was lost.
+ *
+ * Usage: ./group_ack_bench [number of messages] [messages per ms]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* The peer list and packet functions are static. */
+#include "../toxcore/group_chats.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MESSAGE_SIZE 64
+#define BENCH_TIMEOUT 60000
+
+typedef struct {
+    Messenger *m;   /* receiving end */
+    double loss;
+    uint32_t lossless_packets;
+    uint32_t lossy_packets;
+} Bench_Link;
+
+typedef struct {
+    uint32_t num_messages;
+    uint64_t *sent_time;
+    uint64_t *recv_time;
+    uint8_t *first_lost;    /* true if the first copy of the message was lost */
+    uint64_t first_message_id;
+    uint32_t received;
+} Bench_State;
+
+static Bench_State state;
+
+static uint8_t lose_packet(const Bench_Link *link)
+{
+    return (double)rand() / RAND_MAX < link->loss;
+}
+
+/* Marks the broadcast messages lost on their first send so that their recovery can be timed. */
+static void mark_lost(Bench_Link *link, const uint8_t *packet, uint16_t length)
+{
+    GC_Chat *chat = &link->m->group_handler->chats[0];
+    uint8_t data[MAX_GC_PACKET_SIZE];
+    uint64_t message_id, ack_id;
+    uint8_t packet_type;
+
+    if (unwrap_group_packet(chat->gcc[1]->shared_key, data, &message_id, &ack_id, &packet_type, packet, length) <= 0)
+        return;
+
+    if (packet_type != GP_BROADCAST || message_id < state.first_message_id)
+        return;
+
+    uint64_t index = message_id - state.first_message_id;
+
+    if (index < state.num_messages && state.recv_time[index] == 0 && state.first_lost[index] == 0)
+        state.first_lost[index] = 1;
+}
+
+static int bench_handle_packet(void *object, IP_Port ipp, const uint8_t *packet, uint16_t length)
+{
+    Bench_Link *link = object;
+
+    if (packet[0] == NET_PACKET_GC_LOSSLESS)
+        ++link->lossless_packets;
+    else
+        ++link->lossy_packets;
+
+    if (lose_packet(link)) {
+        if (packet[0] == NET_PACKET_GC_LOSSLESS && length >= MIN_GC_LOSSLESS_PACKET_SIZE)
+            mark_lost(link, packet, length);
+
+        return 0;
+    }
+
+    return handle_gc_udp_packet(link->m, ipp, packet, length);
+}
+
+static void bench_message(Messenger *m, uint32_t groupnumber, uint32_t peernumber, unsigned int type,
+                          const uint8_t *message, size_t length, void *userdata)
+{
+    uint32_t seq;
+
+    if (length != BENCH_MESSAGE_SIZE)
+        return;
+
+    memcpy(&seq, message, sizeof(seq));
+
+    if (seq < state.num_messages && state.recv_time[seq] == 0) {
+        state.recv_time[seq] = current_time_monotonic(m->net->mono_time);
+        ++state.received;
+    }
+}
+
+/* Adds other as a confirmed peer of m with the handshake already done. */
+static GC_Connection *bench_add_peer(Messenger *m, Messenger *other)
+{
+    GC_Chat *chat = &m->group_handler->chats[0];
+    GC_Chat *other_chat = &other->group_handler->chats[0];
+
+    IP_Port ipp;
+    ip_init(&ipp.ip, 0);
+    ipp.ip.ip4.uint32 = htonl(0x7F000001);
+    ipp.port = other->net->port;
+
+    int peernumber = peer_add(m, 0, &ipp, other_chat->self_public_key);
+
+    if (peernumber != 1)
+        return NULL;
+
+    GC_Connection *gconn = chat->gcc[peernumber];
+
+    if (set_peer_sig_key(chat, gconn, SIG_PK(other_chat->self_public_key)) == -1)
+        return NULL;
+
+    gconn->handshaked = true;
+    gconn->confirmed = true;
+    gconn->last_recv_direct_time = unix_time(m->net->mono_time);
+    chat->group[peernumber].role = GR_USER;
+    return gconn;
+}
+
+static Messenger *bench_new_peer(Bench_Link *link)
+{
+    Messenger_Options options = {0};
+    Messenger *m = new_messenger(&options, 0);
+
+    if (m == NULL || create_new_group(m->group_handler, false) != 0)
+        return NULL;
+
+    link->m = m;
+    networking_registerhandler(m->net, NET_PACKET_GC_LOSSLESS, &bench_handle_packet, link);
+    networking_registerhandler(m->net, NET_PACKET_GC_LOSSY, &bench_handle_packet, link);
+    gc_callback_message(m, &bench_message, NULL);
+    return m;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int run_bench(double loss, uint32_t num_messages, uint32_t per_ms)
+{
+    Bench_Link link_a = {0}, link_b = {0};
+    link_a.loss = link_b.loss = loss;
+
+    Messenger *a = bench_new_peer(&link_a);
+    Messenger *b = bench_new_peer(&link_b);
+
+    if (a == NULL || b == NULL)
+        return -1;
+
+    GC_Chat *chat_a = &a->group_handler->chats[0];
+    GC_Chat *chat_b = &b->group_handler->chats[0];
+
+    /* Both peers are in the same group, A's */
+    memcpy(chat_b->chat_public_key, chat_a->chat_public_key, EXT_PUBLIC_KEY);
+
+    if (set_chat_id_hash(a->group_handler, chat_a) == -1 || set_chat_id_hash(b->group_handler, chat_b) == -1)
+        return -1;
+
+    chat_a->connection_state = CS_CONNECTED;
+    chat_b->connection_state = CS_CONNECTED;
+
+    GC_Connection *a_to_b = bench_add_peer(a, b);
+    GC_Connection *b_to_a = bench_add_peer(b, a);
+
+    if (a_to_b == NULL || b_to_a == NULL)
+        return -1;
+
+    encrypt_precompute(b_to_a->session_public_key, a_to_b->session_secret_key, a_to_b->shared_key);
+    encrypt_precompute(a_to_b->session_public_key, b_to_a->session_secret_key, b_to_a->shared_key);
+
+    memset(state.recv_time, 0, num_messages * sizeof(uint64_t));
+    memset(state.first_lost, 0, num_messages);
+    state.num_messages = num_messages;
+    state.received = 0;
+    state.first_message_id = a_to_b->send_message_id;
+
+    uint8_t message[BENCH_MESSAGE_SIZE];
+    uint32_t sent = 0, i;
+    uint64_t start = current_time_monotonic(a->net->mono_time);
+
+    memset(message, 'x', sizeof(message));
+
+    while (state.received < num_messages && current_time_monotonic(a->net->mono_time) - start < BENCH_TIMEOUT) {
+        unix_time_update(a->net->mono_time);
+        unix_time_update(b->net->mono_time);
+
+        for (i = 0; i < per_ms && sent < num_messages; ++i, ++sent) {
+            memcpy(message, &sent, sizeof(sent));
+            state.sent_time[sent] = current_time_monotonic(a->net->mono_time);
+
+            if (gc_send_message(chat_a, message, sizeof(message), GC_MESSAGE_TYPE_NORMAL) != 0)
+                return -1;
+        }
+
+        networking_poll(a->net);
+        networking_poll(b->net);
+        do_gc(a->group_handler);
+        do_gc(b->group_handler);
+        usleep(1000);
+    }
+
+    uint64_t *latencies = calloc(num_messages, sizeof(uint64_t));
+    uint64_t total = 0, recovered_total = 0;
+    uint32_t recovered = 0, num = 0;
+
+    if (latencies == NULL)
+        return -1;
+
+    for (i = 0; i < num_messages; ++i) {
+        if (state.recv_time[i] == 0)
+            continue;
+
+        latencies[num] = state.recv_time[i] - state.sent_time[i];
+        total += latencies[num];
+
+        if (state.first_lost[i]) {
+            recovered_total += latencies[num];
+            ++recovered;
+        }
+
+        ++num;
+    }
+
+    qsort(latencies, num, sizeof(uint64_t), &compare_u64);
+
+    /* Acks from B are all of its lossy packets but the rare pings, lossless packets past the messages are resends */
+    printf("%-6.2f %-10u %-14.3f %-10u %-12.1f %-10llu %-10llu %-10u %-14.1f\n", loss, num,
+           (double)link_a.lossy_packets / num_messages,
+           link_b.lossless_packets > num_messages ? link_b.lossless_packets - num_messages : 0,
+           num ? (double)total / num : 0.0, num ? (unsigned long long)latencies[num / 2] : 0ULL,
+           num ? (unsigned long long)latencies[num * 99 / 100] : 0ULL, recovered,
+           recovered ? (double)recovered_total / recovered : 0.0);
+
+    free(latencies);
+    kill_messenger(a);
+    kill_messenger(b);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_messages = 2000;
+    uint32_t per_ms = 1;
+
+    if (argc > 1)
+        num_messages = atoi(argv[1]);
+
+    if (argc > 2)
+        per_ms = atoi(argv[2]);
+
+    if (num_messages == 0 || per_ms == 0) {
+        printf("Usage: %s [number of messages] [messages per ms]\n", argv[0]);
+        return 1;
+    }
+
+    state.sent_time = calloc(num_messages, sizeof(uint64_t));
+    state.recv_time = calloc(num_messages, sizeof(uint64_t));
+    state.first_lost = calloc(num_messages, 1);
+
+    if (state.sent_time == NULL || state.recv_time == NULL || state.first_lost == NULL)
+        return 1;
+
+    const double losses[] = {0.0, 0.01, 0.05, 0.10, 0.20};
+    uint32_t i;
+
+    printf("messages: %u, messages per ms: %u, message size: %u\n", num_messages, per_ms, BENCH_MESSAGE_SIZE);
+    printf("%-6s %-10s %-14s %-10s %-12s %-10s %-10s %-10s %-14s\n", "loss", "delivered", "acks/message",
+           "resends", "mean ms", "p50 ms", "p99 ms", "lost once", "recovery ms");
+
+    for (i = 0; i < sizeof(losses) / sizeof(losses[0]); ++i) {
+        srand(i);
+
+        if (run_bench(losses[i], num_messages, per_ms) == -1) {
+            printf("Failed to run benchmark at loss %.2f\n", losses[i]);
+            return 1;
+        }
+    }
+
+    free(state.sent_time);
+    free(state.recv_time);
+    free(state.first_lost);
+    return 0;
+}
@@ -0,0 +1,221 @@
+/* group_announce_bench.c
+ *
+ * Benchmark for the store of group announcements held by DHT nodes.
+ *
+ * Fills a store with announcements spread over many groups, then times announcing,
+ * looking up the nodes of a group and going through the nodes whose ping is due.
+ * The same announces and lookups are timed on a flat array scanned for every operation,
+ * the way announcements used to be stored, for comparison.
+ *
+ * Usage: ./group_announce_bench [number of announcements] [nodes per group]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/group_announce.h"
+#include "../toxcore/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Operations timed on the flat array, each one scans all of it */
+#define BENCH_FLAT_OPERATIONS 2000
+
+static Mono_Time *mono_time;
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void random_node(GC_Announce_Node *node)
+{
+    memset(node, 0, sizeof(GC_Announce_Node));
+    randombytes(node->public_key, ENC_PUBLIC_KEY);
+    ip_init(&node->ip_port.ip, 0);
+    node->ip_port.ip.ip4.uint32 = random_int();
+    node->ip_port.port = random_int() % 65535 + 1;
+}
+
+/* Adds node to the flat array the way it used to be done, refreshing it or replacing the oldest entry. */
+static void flat_add(struct GC_AnnouncedNode *nodes, uint32_t size, const uint8_t *chat_id,
+                     const GC_Announce_Node *node)
+{
+    uint32_t i, oldest_idx = 0;
+    uint64_t oldest_announce = UINT64_MAX;
+
+    for (i = 0; i < size; ++i) {
+        if (nodes[i].time_added < oldest_announce) {
+            oldest_announce = nodes[i].time_added;
+            oldest_idx = i;
+        }
+
+        if ((id_equal(nodes[i].node.public_key, node->public_key) && chat_id_equal(nodes[i].chat_id, chat_id))
+                || !ipport_isset(&nodes[i].node.ip_port)) {
+            oldest_idx = i;
+            break;
+        }
+    }
+
+    memcpy(nodes[oldest_idx].chat_id, chat_id, CHAT_ID_SIZE);
+    nodes[oldest_idx].node = *node;
+    nodes[oldest_idx].time_added = unix_time(mono_time);
+}
+
+static uint32_t flat_get(const struct GC_AnnouncedNode *nodes, uint32_t size, const uint8_t *chat_id,
+                         GC_Announce_Node *found)
+{
+    uint32_t i, num = 0;
+
+    for (i = 0; i < size; ++i) {
+        if (ipport_isset(&nodes[i].node.ip_port) && chat_id_equal(nodes[i].chat_id, chat_id)) {
+            found[num] = nodes[i].node;
+
+            if (++num == MAX_GCA_SENT_NODES)
+                break;
+        }
+    }
+
+    return num;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_nodes = 100000;
+    uint32_t group_nodes = 5;
+
+    if (argc > 1)
+        num_nodes = atoi(argv[1]);
+
+    if (argc > 2)
+        group_nodes = atoi(argv[2]);
+
+    if (num_nodes == 0 || group_nodes == 0) {
+        printf("Usage: %s [number of announcements] [nodes per group]\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t num_groups = (num_nodes + group_nodes - 1) / group_nodes;
+    uint8_t (*chat_ids)[CHAT_ID_SIZE] = malloc(num_groups * CHAT_ID_SIZE);
+    GC_Announce_Node *nodes = malloc(num_nodes * sizeof(GC_Announce_Node));
+    struct GC_AnnouncedNode *flat = calloc(num_nodes, sizeof(struct GC_AnnouncedNode));
+
+    if (chat_ids == NULL || nodes == NULL || flat == NULL)
+        return 1;
+
+    uint32_t i;
+
+    srand(time(NULL));
+    mono_time = new_mono_time(NULL);
+
+    if (mono_time == NULL)
+        return 1;
+
+    for (i = 0; i < num_groups; ++i)
+        randombytes(chat_ids[i], CHAT_ID_SIZE);
+
+    for (i = 0; i < num_nodes; ++i)
+        random_node(&nodes[i]);
+
+    GCA_Store store;
+    gca_store_init(&store, mono_time, num_nodes, group_nodes);
+
+    printf("announcements: %u, groups: %u, nodes per group: %u\n", num_nodes, num_groups, group_nodes);
+    printf("%-10s %-14s %-14s\n", "store", "operation", "ops/s");
+
+    /* Deadlines are spread over the ping interval like announcements arriving over time */
+    double start = get_time();
+
+    for (i = 0; i < num_nodes; ++i) {
+        if (gca_store_add(&store, chat_ids[i % num_groups], &nodes[i], false, unix_time(mono_time) + i % 60) == -1) {
+            printf("Failed to add announcement %u\n", i);
+            return 1;
+        }
+    }
+
+    printf("%-10s %-14s %-14.0f\n", "indexed", "announce", num_nodes / (get_time() - start));
+
+    start = get_time();
+
+    for (i = 0; i < num_nodes; ++i)
+        gca_store_add(&store, chat_ids[i % num_groups], &nodes[i], false, unix_time(mono_time) + 60 + i % 60);
+
+    printf("%-10s %-14s %-14.0f\n", "indexed", "refresh", num_nodes / (get_time() - start));
+
+    GC_Announce_Node found[MAX_GCA_SENT_NODES];
+    uint32_t total = 0;
+    start = get_time();
+
+    for (i = 0; i < num_nodes; ++i)
+        total += gca_store_get_nodes(&store, chat_ids[random_int() % num_groups], found, MAX_GCA_SENT_NODES);
+
+    printf("%-10s %-14s %-14.0f\n", "indexed", "lookup", num_nodes / (get_time() - start));
+
+    if (total != num_nodes * MIN(group_nodes, MAX_GCA_SENT_NODES)) {
+        printf("Lookups found %u nodes\n", total);
+        return 1;
+    }
+
+    /* A second's worth of due nodes is rescheduled the way do_gca pings them */
+    uint32_t nodenumber, due = 0;
+    start = get_time();
+
+    while ((nodenumber = gca_store_due(&store, unix_time(mono_time) + 61)) != GCA_STORE_NONE) {
+        gca_store_set_ping(&store, nodenumber, random_64b());
+        gca_store_set_deadline(&store, nodenumber, unix_time(mono_time) + 120);
+        ++due;
+    }
+
+    printf("%-10s %-14s %-14.0f (%u due)\n", "indexed", "due", due / (get_time() - start), due);
+
+    /* The flat array is full, as the store is */
+    for (i = 0; i < num_nodes; ++i) {
+        memcpy(flat[i].chat_id, chat_ids[i % num_groups], CHAT_ID_SIZE);
+        flat[i].node = nodes[i];
+        flat[i].time_added = unix_time(mono_time);
+    }
+
+    start = get_time();
+
+    for (i = 0; i < BENCH_FLAT_OPERATIONS; ++i)
+        flat_add(flat, num_nodes, chat_ids[i % num_groups], &nodes[random_int() % num_nodes]);
+
+    printf("%-10s %-14s %-14.0f\n", "flat", "announce", BENCH_FLAT_OPERATIONS / (get_time() - start));
+
+    start = get_time();
+
+    for (i = 0; i < BENCH_FLAT_OPERATIONS; ++i)
+        flat_get(flat, num_nodes, chat_ids[random_int() % num_groups], found);
+
+    printf("%-10s %-14s %-14.0f\n", "flat", "lookup", BENCH_FLAT_OPERATIONS / (get_time() - start));
+
+    gca_store_free(&store);
+    free(chat_ids);
+    free(nodes);
+    free(flat);
+    kill_mono_time(mono_time);
+    return 0;
+}
@@ -0,0 +1,175 @@
+/* group_churn_bench.c
+ *
+ * Benchmark for the peer list of group chats.
+ *
+ * Fills a group with peers and then makes random peers leave and new ones join,
+ * looking peers up by their encryption and signature keys in between like incoming
+ * packets do. Prints the join, leave and lookup rates and checks that the handles
+ * of the peers still in the group keep pointing to them.
+ *
+ * Usage: ./group_churn_bench [number of peers] [number of leaves and joins]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* The peer list functions are static. */
+#include "../toxcore/group_chats.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LOOKUPS_PER_ROUND 16
+
+typedef struct {
+    uint8_t public_key[EXT_PUBLIC_KEY];
+    uint32_t handle;
+} Bench_Peer;
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* Add a peer with new random keys to the group.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int bench_join(Messenger *m, GC_Chat *chat, Bench_Peer *peer)
+{
+    randombytes(peer->public_key, EXT_PUBLIC_KEY);
+
+    int peernumber = peer_add(m, chat->groupnumber, NULL, peer->public_key);
+
+    if (peernumber < 0)
+        return -1;
+
+    if (set_peer_sig_key(chat, chat->gcc[peernumber], SIG_PK(peer->public_key)) == -1)
+        return -1;
+
+    peer->handle = chat->gcc[peernumber]->handle;
+    return 0;
+}
+
+/* return number of lookups that didn't find the right peer. */
+static uint32_t bench_lookups(const GC_Chat *chat, const Bench_Peer *peers, uint32_t num_peers)
+{
+    uint32_t i, errors = 0;
+
+    for (i = 0; i < LOOKUPS_PER_ROUND; ++i) {
+        const Bench_Peer *peer = &peers[rand() % num_peers];
+        int enc_peernumber = get_peernum_of_enc_pk(chat, peer->public_key);
+        int sig_peernumber = get_peernum_of_sig_pk(chat, SIG_PK(peer->public_key));
+
+        if (enc_peernumber == -1 || enc_peernumber != sig_peernumber
+                || chat->gcc[enc_peernumber]->handle != peer->handle)
+            ++errors;
+    }
+
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_peers = 500;
+    uint32_t num_rounds = 100000;
+
+    if (argc > 1)
+        num_peers = atoi(argv[1]);
+
+    if (argc > 2)
+        num_rounds = atoi(argv[2]);
+
+    if (num_peers == 0 || num_peers >= MAX_GC_NUM_PEERS || num_rounds == 0) {
+        printf("Usage: %s [number of peers (< %u)] [number of leaves and joins]\n", argv[0],
+               (unsigned int)MAX_GC_NUM_PEERS);
+        return 1;
+    }
+
+    Messenger_Options options = {0};
+    Messenger *m = new_messenger(&options, 0);
+
+    if (m == NULL) {
+        printf("Failed to create messenger\n");
+        return 1;
+    }
+
+    int groupnumber = create_new_group(m->group_handler, true);
+
+    if (groupnumber == -1) {
+        printf("Failed to create group\n");
+        return 1;
+    }
+
+    GC_Chat *chat = gc_get_group(m->group_handler, groupnumber);
+    Bench_Peer *peers = calloc(num_peers, sizeof(Bench_Peer));
+    uint32_t i, errors = 0;
+
+    if (peers == NULL)
+        return 1;
+
+    double start = get_time();
+
+    for (i = 0; i < num_peers; ++i) {
+        if (bench_join(m, chat, &peers[i]) == -1) {
+            printf("Failed to add peer %u\n", i);
+            return 1;
+        }
+    }
+
+    double fill_time = get_time() - start;
+    double churn_time = 0, lookup_time = 0;
+
+    for (i = 0; i < num_rounds; ++i) {
+        Bench_Peer *peer = &peers[rand() % num_peers];
+
+        start = get_time();
+        GC_Connection *gconn = gcc_get_connection(chat, peer->handle);
+
+        if (gconn == NULL || gc_peer_delete(m, groupnumber, gconn->peernumber, NULL, 0) == -1
+                || bench_join(m, chat, peer) == -1) {
+            printf("Failed to replace peer in round %u\n", i);
+            return 1;
+        }
+
+        churn_time += get_time() - start;
+
+        start = get_time();
+        errors += bench_lookups(chat, peers, num_peers);
+        lookup_time += get_time() - start;
+    }
+
+    printf("peers: %u, rounds: %u\n", num_peers, num_rounds);
+    printf("fill:    %10.0f joins/s\n", num_peers / fill_time);
+    printf("churn:   %10.0f leaves+joins/s\n", num_rounds / churn_time);
+    printf("lookups: %10.0f enc+sig lookups/s\n", (double)num_rounds * LOOKUPS_PER_ROUND / lookup_time);
+    printf("peer list capacity: %u, peer slots: %u, lookup errors: %u\n", chat->peers_capacity, chat->num_peer_slots,
+           errors);
+
+    free(peers);
+    kill_messenger(m);
+    return errors != 0;
+}
@@ -0,0 +1,637 @@
+/* group_gossip_sim.c
+ *
+ * Simulation of broadcasts in large group chats, full mesh against the gossip overlay.
+ *
+ * The first part simulates groups of 100, 500 and 1000 peers on a simulated clock. Every peer
+ * has its own keys and gossip cache, overlay packets are signed, verified and deduplicated with
+ * the functions group chats use, every link has its own latency and every peer a limited uplink.
+ * Neighbours are picked the way joining peers pick them. It prints the delivery latency, the
+ * share of peers reached and the packets and bytes sent per message.
+ *
+ * The second part runs an overlay group of real Messenger instances over localhost, fewer than the
+ * first part as each one needs its own port, and checks that announcements and messages reach
+ * every peer through their neighbours.
+ *
+ * Usage: ./group_gossip_sim [messages per group] [peers of the messenger group]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* The packet sizes and peer list functions are static. */
+#include "../toxcore/group_chats.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIM_MESSAGE_SIZE 64
+#define SIM_MIN_LATENCY 10000   /* us, one way */
+#define SIM_MAX_LATENCY 80000
+#define SIM_UPLINK 125   /* bytes per ms, 1 Mbit/s */
+
+#define SIM_MESSENGER_TIMEOUT 30000   /* ms */
+
+/* Full lossless packets carrying a broadcast, as sent on the wire */
+#define SIM_MESH_PACKET_SIZE (MIN_GC_LOSSLESS_PACKET_SIZE + GC_BROADCAST_ENC_HEADER_SIZE + SIM_MESSAGE_SIZE)
+#define SIM_BROADCAST_SIZE (GC_BROADCAST_ENC_HEADER_SIZE - HASH_ID_BYTES + SIM_MESSAGE_SIZE)
+#define SIM_GOSSIP_SIZE (GC_GOSSIP_OVERHEAD + SIM_BROADCAST_SIZE)
+#define SIM_OVERLAY_PACKET_SIZE (MIN_GC_LOSSLESS_PACKET_SIZE + HASH_ID_BYTES + SIM_GOSSIP_SIZE)
+
+typedef struct {
+    uint64_t time;   /* us */
+    uint32_t to;
+    uint32_t from;
+    uint8_t  hops;
+} Sim_Event;
+
+typedef struct {
+    Sim_Event *events;   /* binary heap ordered by time */
+    uint32_t count;
+    uint32_t size;
+} Sim_Queue;
+
+typedef struct {
+    uint8_t public_key[EXT_PUBLIC_KEY];
+    uint8_t secret_key[EXT_SECRET_KEY];
+    uint32_t neighbours[GC_OVERLAY_MAX_NEIGHBOURS];
+    uint32_t num_neighbours;
+    GC_Gossip_Cache cache;
+
+    /* State of the message being simulated */
+    uint64_t uplink_free;   /* us, when the packets the peer queued have left */
+    uint64_t bytes_sent;
+    uint32_t packets_sent;
+    uint64_t delivered;   /* us, 0 if the message didn't reach the peer yet */
+} Sim_Peer;
+
+typedef struct {
+    uint64_t *latencies;   /* us */
+    uint32_t num_latencies;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t max_upload;   /* sum over messages of the bytes sent by the busiest peer */
+    uint64_t duplicates;
+    uint64_t verifies;
+    double verify_time;   /* s */
+} Sim_Stats;
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static int queue_push(Sim_Queue *queue, const Sim_Event *event)
+{
+    if (queue->count == queue->size) {
+        uint32_t size = queue->size ? queue->size * 2 : 1024;
+        Sim_Event *events = realloc(queue->events, size * sizeof(Sim_Event));
+
+        if (events == NULL)
+            return -1;
+
+        queue->events = events;
+        queue->size = size;
+    }
+
+    uint32_t i = queue->count++;
+
+    while (i > 0 && queue->events[(i - 1) / 2].time > event->time) {
+        queue->events[i] = queue->events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+
+    queue->events[i] = *event;
+    return 0;
+}
+
+static void queue_pop(Sim_Queue *queue, Sim_Event *event)
+{
+    *event = queue->events[0];
+    Sim_Event last = queue->events[--queue->count];
+    uint32_t i = 0;
+
+    while (2 * i + 1 < queue->count) {
+        uint32_t child = 2 * i + 1;
+
+        if (child + 1 < queue->count && queue->events[child + 1].time < queue->events[child].time)
+            ++child;
+
+        if (last.time <= queue->events[child].time)
+            break;
+
+        queue->events[i] = queue->events[child];
+        i = child;
+    }
+
+    queue->events[i] = last;
+}
+
+/* One way latency of the link between a and b, the same in both directions. */
+static uint64_t link_latency(uint32_t a, uint32_t b)
+{
+    uint32_t lo = a < b ? a : b, hi = a < b ? b : a;
+    uint32_t hash = (lo * 2654435761u) ^ (hi * 2246822519u);
+    hash ^= hash >> 15;
+    return SIM_MIN_LATENCY + hash % (SIM_MAX_LATENCY - SIM_MIN_LATENCY);
+}
+
+/* Queues a packet of size from peer from to peer to behind the packets from already queued. */
+static int sim_send(Sim_Queue *queue, Sim_Peer *peers, uint32_t from, uint32_t to, uint64_t now, uint32_t size,
+                    uint8_t hops)
+{
+    Sim_Peer *peer = &peers[from];
+    uint64_t start = peer->uplink_free > now ? peer->uplink_free : now;
+
+    peer->uplink_free = start + (uint64_t)size * 1000 / SIM_UPLINK;
+    peer->bytes_sent += size;
+    ++peer->packets_sent;
+
+    Sim_Event event = {peer->uplink_free + link_latency(from, to), to, from, hops};
+    return queue_push(queue, &event);
+}
+
+static bool are_neighbours(const Sim_Peer *peer, uint32_t other)
+{
+    uint32_t i;
+
+    for (i = 0; i < peer->num_neighbours; ++i) {
+        if (peer->neighbours[i] == other)
+            return true;
+    }
+
+    return false;
+}
+
+/* Peers join one after the other and connect to random peers of the group that still take neighbours. */
+static void sim_build_overlay(Sim_Peer *peers, uint32_t num_peers)
+{
+    uint32_t i, tries;
+
+    for (i = 1; i < num_peers; ++i) {
+        for (tries = 0; peers[i].num_neighbours < GC_OVERLAY_NEIGHBOURS && tries < i * 4; ++tries) {
+            uint32_t other = rand() % i;
+
+            if (peers[other].num_neighbours >= GC_OVERLAY_MAX_NEIGHBOURS || are_neighbours(&peers[i], other))
+                continue;
+
+            peers[i].neighbours[peers[i].num_neighbours++] = other;
+            peers[other].neighbours[peers[other].num_neighbours++] = i;
+        }
+    }
+}
+
+/* Simulates one broadcast of origin and adds its results to stats.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int sim_message(Sim_Peer *peers, uint32_t num_peers, bool overlay, uint32_t origin, uint64_t seq,
+                       const uint8_t *chat_id, Sim_Queue *queue, Sim_Stats *stats)
+{
+    uint8_t broadcast[SIM_BROADCAST_SIZE];
+    uint8_t packet[SIM_GOSSIP_SIZE];
+    uint32_t i;
+
+    randombytes(broadcast, sizeof(broadcast));
+    broadcast[0] = GM_PLAIN_MESSAGE;
+
+    for (i = 0; i < num_peers; ++i) {
+        peers[i].uplink_free = 0;
+        peers[i].bytes_sent = 0;
+        peers[i].packets_sent = 0;
+        peers[i].delivered = 0;
+    }
+
+    if (overlay) {
+        if (gc_gossip_pack(packet, sizeof(packet), chat_id, peers[origin].public_key, peers[origin].secret_key, seq,
+                           broadcast, sizeof(broadcast)) != sizeof(packet))
+            return -1;
+
+        for (i = 0; i < peers[origin].num_neighbours; ++i) {
+            if (sim_send(queue, peers, origin, peers[origin].neighbours[i], 0, SIM_OVERLAY_PACKET_SIZE, 0) == -1)
+                return -1;
+        }
+    } else {
+        for (i = 0; i < num_peers; ++i) {
+            if (i != origin && sim_send(queue, peers, origin, i, 0, SIM_MESH_PACKET_SIZE, 0) == -1)
+                return -1;
+        }
+    }
+
+    const uint8_t *origin_sig_pk = SIG_PK(peers[origin].public_key);
+
+    while (queue->count > 0) {
+        Sim_Event event;
+        queue_pop(queue, &event);
+        Sim_Peer *peer = &peers[event.to];
+
+        if (!overlay) {
+            peer->delivered = event.time;
+            continue;
+        }
+
+        if (event.to == origin || gc_gossip_cache_has(&peer->cache, origin_sig_pk, seq)) {
+            ++stats->duplicates;
+            continue;
+        }
+
+        packet[0] = event.hops;
+
+        double start = get_time();
+        bool verified = gc_gossip_verify(chat_id, packet, sizeof(packet));
+        stats->verify_time += get_time() - start;
+        ++stats->verifies;
+
+        if (!verified || gc_gossip_cache_add(&peer->cache, origin_sig_pk, seq) == -1)
+            return -1;
+
+        peer->delivered = event.time;
+
+        if (event.hops >= GC_GOSSIP_MAX_HOPS)
+            continue;
+
+        for (i = 0; i < peer->num_neighbours; ++i) {
+            uint32_t neighbour = peer->neighbours[i];
+
+            if (neighbour == event.from || neighbour == origin)
+                continue;
+
+            if (sim_send(queue, peers, event.to, neighbour, event.time, SIM_OVERLAY_PACKET_SIZE, event.hops + 1) == -1)
+                return -1;
+        }
+    }
+
+    uint64_t max_upload = 0;
+
+    for (i = 0; i < num_peers; ++i) {
+        if (i != origin && peers[i].delivered)
+            stats->latencies[stats->num_latencies++] = peers[i].delivered;
+
+        stats->packets += peers[i].packets_sent;
+        stats->bytes += peers[i].bytes_sent;
+
+        if (peers[i].bytes_sent > max_upload)
+            max_upload = peers[i].bytes_sent;
+    }
+
+    stats->max_upload += max_upload;
+    return 0;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int sim_group(uint32_t num_peers, uint32_t num_messages, bool overlay)
+{
+    Sim_Peer *peers = calloc(num_peers, sizeof(Sim_Peer));
+    Sim_Queue queue = {0};
+    Sim_Stats stats = {0};
+    uint8_t chat_id[CHAT_ID_SIZE];
+    uint32_t i;
+
+    stats.latencies = calloc((uint64_t)num_messages * num_peers, sizeof(uint64_t));
+
+    if (peers == NULL || stats.latencies == NULL)
+        return -1;
+
+    randombytes(chat_id, sizeof(chat_id));
+
+    for (i = 0; i < num_peers; ++i)
+        create_extended_keypair(peers[i].public_key, peers[i].secret_key);
+
+    if (overlay)
+        sim_build_overlay(peers, num_peers);
+
+    for (i = 0; i < num_messages; ++i) {
+        if (sim_message(peers, num_peers, overlay, rand() % num_peers, i + 1, chat_id, &queue, &stats) == -1)
+            return -1;
+    }
+
+    qsort(stats.latencies, stats.num_latencies, sizeof(uint64_t), &compare_u64);
+
+    uint64_t total = 0;
+
+    for (i = 0; i < stats.num_latencies; ++i)
+        total += stats.latencies[i];
+
+    double per_peer = (double)num_messages * num_peers;
+    uint32_t num = stats.num_latencies;
+
+    printf("%-10s %-6u %-10.2f %-9.1f %-9.1f %-9.1f %-13.2f %-12.3f %-14.2f %-11.2f %-10.1f\n",
+           overlay ? "overlay" : "full mesh", num_peers,
+           100.0 * num / ((double)num_messages * (num_peers - 1)),
+           num ? total / 1000.0 / num : 0.0, num ? stats.latencies[num / 2] / 1000.0 : 0.0,
+           num ? stats.latencies[num * 99 / 100] / 1000.0 : 0.0,
+           stats.packets / per_peer, stats.bytes / per_peer / 1024.0,
+           stats.max_upload / (double)num_messages / 1024.0, stats.duplicates / per_peer,
+           stats.verifies ? stats.verify_time * 1000000.0 / stats.verifies : 0.0);
+
+    for (i = 0; i < num_peers; ++i)
+        gc_gossip_cache_free(&peers[i].cache);
+
+    free(queue.events);
+    free(stats.latencies);
+    free(peers);
+    return 0;
+}
+
+/* Overlay group of real Messenger instances */
+
+typedef struct {
+    Messenger *m;
+    uint32_t index;
+    uint32_t lossless_packets;
+    uint32_t num_neighbours;
+} Sim_Instance;
+
+typedef struct {
+    uint32_t num_messages;
+    uint32_t num_peers;
+    uint64_t *sent_time;
+    uint64_t *latencies;   /* ms, per message and receiving peer, 0 if not received */
+    uint32_t received;
+} Sim_Messenger_State;
+
+static Sim_Messenger_State mstate;
+
+static int sim_handle_packet(void *object, IP_Port ipp, const uint8_t *packet, uint16_t length)
+{
+    Sim_Instance *instance = object;
+
+    if (packet[0] == NET_PACKET_GC_LOSSLESS)
+        ++instance->lossless_packets;
+
+    return handle_gc_udp_packet(instance->m, ipp, packet, length);
+}
+
+static void sim_message_cb(Messenger *m, uint32_t groupnumber, uint32_t peernumber, unsigned int type,
+                           const uint8_t *message, size_t length, void *userdata)
+{
+    const Sim_Instance *instance = userdata;
+    uint32_t seq;
+
+    if (length != SIM_MESSAGE_SIZE)
+        return;
+
+    memcpy(&seq, message, sizeof(seq));
+
+    if (seq >= mstate.num_messages)
+        return;
+
+    uint64_t *latency = &mstate.latencies[(uint64_t)seq * mstate.num_peers + instance->index];
+
+    if (*latency == 0) {
+        *latency = current_time_monotonic(instance->m->net->mono_time) - mstate.sent_time[seq] + 1;
+        ++mstate.received;
+    }
+}
+
+/* Makes a and b neighbours with the handshake and the peer info exchange already done. */
+static int sim_connect(Sim_Instance *a, Sim_Instance *b)
+{
+    GC_Chat *chat_a = &a->m->group_handler->chats[0];
+    GC_Chat *chat_b = &b->m->group_handler->chats[0];
+    GC_Connection *gconns[2];
+    Sim_Instance *ends[2] = {a, b};
+    uint32_t i;
+
+    for (i = 0; i < 2; ++i) {
+        GC_Chat *chat = i == 0 ? chat_a : chat_b;
+        GC_Chat *other_chat = i == 0 ? chat_b : chat_a;
+
+        IP_Port ipp;
+        ip_init(&ipp.ip, 0);
+        ipp.ip.ip4.uint32 = htonl(0x7F000001);
+        ipp.port = ends[1 - i]->m->net->port;
+
+        int peernumber = peer_add(ends[i]->m, 0, &ipp, other_chat->self_public_key);
+
+        if (peernumber < 0)
+            return -1;
+
+        gconns[i] = chat->gcc[peernumber];
+
+        if (set_peer_sig_key(chat, gconns[i], SIG_PK(other_chat->self_public_key)) == -1)
+            return -1;
+
+        gconns[i]->handshaked = true;
+        gconns[i]->confirmed = true;
+        gconns[i]->last_recv_direct_time = unix_time(ends[i]->m->net->mono_time);
+        memcpy(&chat->group[peernumber], &other_chat->group[0], sizeof(GC_GroupPeer));
+        ++ends[i]->num_neighbours;
+    }
+
+    encrypt_precompute(gconns[1]->session_public_key, gconns[0]->session_secret_key, gconns[0]->shared_key);
+    encrypt_precompute(gconns[0]->session_public_key, gconns[1]->session_secret_key, gconns[1]->shared_key);
+    return 0;
+}
+
+static void sim_do_messengers(Sim_Instance *instances, uint32_t num)
+{
+    uint32_t i;
+
+    for (i = 0; i < num; ++i) {
+        networking_poll(instances[i].m->net);
+        do_gc(instances[i].m->group_handler);
+    }
+
+    usleep(1000);
+}
+
+static int sim_messengers(uint32_t num_peers, uint32_t num_messages)
+{
+    Sim_Instance *instances = calloc(num_peers, sizeof(Sim_Instance));
+    uint32_t i, j;
+
+    mstate.num_messages = num_messages;
+    mstate.num_peers = num_peers;
+    mstate.received = 0;
+    mstate.sent_time = calloc(num_messages, sizeof(uint64_t));
+    mstate.latencies = calloc((uint64_t)num_messages * num_peers, sizeof(uint64_t));
+
+    if (instances == NULL || mstate.sent_time == NULL || mstate.latencies == NULL)
+        return -1;
+
+    for (i = 0; i < num_peers; ++i) {
+        Messenger_Options options = {0};
+        Messenger *m = new_messenger(&options, 0);
+
+        if (m == NULL || create_new_group(m->group_handler, false) != 0) {
+            printf("Failed to create messenger %u\n", i);
+            return -1;
+        }
+
+        instances[i].m = m;
+        instances[i].index = i;
+        networking_registerhandler(m->net, NET_PACKET_GC_LOSSLESS, &sim_handle_packet, &instances[i]);
+        networking_registerhandler(m->net, NET_PACKET_GC_LOSSY, &sim_handle_packet, &instances[i]);
+        gc_callback_message(m, &sim_message_cb, &instances[i]);
+
+        GC_Chat *chat = &m->group_handler->chats[0];
+        GC_Chat *first = &instances[0].m->group_handler->chats[0];
+
+        /* Everyone is in the first peer's group */
+        memcpy(chat->chat_public_key, first->chat_public_key, EXT_PUBLIC_KEY);
+
+        if (set_chat_id_hash(m->group_handler, chat) == -1)
+            return -1;
+
+        chat->group[0].nick_len = snprintf((char *)chat->group[0].nick, MAX_GC_NICK_SIZE, "peer%u", i);
+        chat->shared_state.topology = GT_OVERLAY;
+        chat->shared_state.maxpeers = MAX_GC_NUM_PEERS;
+        chat->connection_state = CS_CONNECTED;
+    }
+
+    /* Neighbours are picked the way joining peers pick them */
+    for (i = 1; i < num_peers; ++i) {
+        uint32_t tries;
+
+        for (tries = 0; instances[i].num_neighbours < GC_OVERLAY_NEIGHBOURS && tries < i * 4; ++tries) {
+            uint32_t other = rand() % i;
+
+            if (instances[other].num_neighbours >= GC_OVERLAY_MAX_NEIGHBOURS
+                    || get_peernum_of_enc_pk(&instances[i].m->group_handler->chats[0],
+                                             instances[other].m->group_handler->chats[0].self_public_key) != -1)
+                continue;
+
+            if (sim_connect(&instances[i], &instances[other]) == -1) {
+                printf("Failed to connect peers %u and %u\n", i, other);
+                return -1;
+            }
+        }
+    }
+
+    /* Peers learn about the ones they aren't connected to from their announcements */
+    Mono_Time *mono_time = instances[0].m->net->mono_time;
+    uint64_t start = current_time_monotonic(mono_time);
+    uint32_t known = 0;
+
+    while (current_time_monotonic(mono_time) - start < SIM_MESSENGER_TIMEOUT) {
+        sim_do_messengers(instances, num_peers);
+
+        for (i = 0, known = 0; i < num_peers; ++i)
+            known += get_gc_confirmed_numpeers(&instances[i].m->group_handler->chats[0]) - 1;
+
+        if (known == num_peers * (num_peers - 1))
+            break;
+    }
+
+    uint64_t membership_time = current_time_monotonic(mono_time) - start;
+
+    for (i = 0; i < num_peers; ++i)
+        instances[i].lossless_packets = 0;
+
+    uint8_t message[SIM_MESSAGE_SIZE];
+    memset(message, 'x', sizeof(message));
+
+    for (i = 0; i < num_messages; ++i) {
+        GC_Chat *chat = &instances[rand() % num_peers].m->group_handler->chats[0];
+
+        memcpy(message, &i, sizeof(i));
+        mstate.sent_time[i] = current_time_monotonic(mono_time);
+
+        if (gc_send_message(chat, message, sizeof(message), GC_MESSAGE_TYPE_NORMAL) != 0)
+            return -1;
+
+        for (j = 0; j < 5; ++j)
+            sim_do_messengers(instances, num_peers);
+    }
+
+    start = current_time_monotonic(mono_time);
+
+    while (mstate.received < num_messages * (num_peers - 1)
+            && current_time_monotonic(mono_time) - start < SIM_MESSENGER_TIMEOUT)
+        sim_do_messengers(instances, num_peers);
+
+    uint64_t total = 0;
+    uint32_t lossless_packets = 0;
+
+    for (i = 0; i < (uint64_t)num_messages * num_peers; ++i)
+        total += mstate.latencies[i];
+
+    for (i = 0; i < num_peers; ++i)
+        lossless_packets += instances[i].lossless_packets;
+
+    printf("messenger overlay, peers: %u, messages: %u\n", num_peers, num_messages);
+    printf("  peers known after announcements: %.2f%% in %llu ms\n",
+           100.0 * known / ((double)num_peers * (num_peers - 1)), (unsigned long long)membership_time);
+    printf("  messages delivered: %.2f%%, mean latency: %.1f ms, lossless packets per peer per message: %.2f\n",
+           100.0 * mstate.received / ((double)num_messages * (num_peers - 1)),
+           mstate.received ? (double)total / mstate.received : 0.0,
+           lossless_packets / ((double)num_messages * num_peers));
+
+    for (i = 0; i < num_peers; ++i)
+        kill_messenger(instances[i].m);
+
+    free(instances);
+    free(mstate.sent_time);
+    free(mstate.latencies);
+    return mstate.received == num_messages * (num_peers - 1) && known == num_peers * (num_peers - 1) ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_messages = 20;
+    uint32_t num_messenger_peers = 32;
+
+    if (argc > 1)
+        num_messages = atoi(argv[1]);
+
+    if (argc > 2)
+        num_messenger_peers = atoi(argv[2]);
+
+    if (num_messages == 0 || num_messenger_peers < 2) {
+        printf("Usage: %s [messages per group] [peers of the messenger group]\n", argv[0]);
+        return 1;
+    }
+
+    const uint32_t sizes[] = {100, 500, 1000};
+    uint32_t i;
+
+    srand(time(NULL));
+
+    printf("messages per group: %u, message size: %u, link latency: %u-%u ms, uplink: %u kB/s\n", num_messages,
+           SIM_MESSAGE_SIZE, SIM_MIN_LATENCY / 1000, SIM_MAX_LATENCY / 1000, SIM_UPLINK);
+    printf("%-10s %-6s %-10s %-9s %-9s %-9s %-13s %-12s %-14s %-11s %-10s\n", "topology", "peers", "reached %",
+           "mean ms", "p50 ms", "p99 ms", "packets/peer", "kB/peer", "max kB/sender", "dups/peer", "verify us");
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        if (sim_group(sizes[i], num_messages, false) == -1 || sim_group(sizes[i], num_messages, true) == -1) {
+            printf("Failed to simulate group of %u peers\n", sizes[i]);
+            return 1;
+        }
+    }
+
+    if (sim_messengers(num_messenger_peers, num_messages) == -1) {
+        printf("Not every peer of the messenger group got every announcement and message\n");
+        return 1;
+    }
+
+    return 0;
+}
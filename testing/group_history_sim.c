@@ -0,0 +1,235 @@
+/* group_history_sim.c
+ *
+ * Simulation of a group peer catching up on the messages it missed while it was offline.
+ *
+ * The founder of a group of real Messenger instances has a message log with a number of
+ * messages from the peers of the group, a peer who joins with an empty log asks the founder
+ * for them. Packets between the two are handed over directly to the receiving handlers and
+ * the lossless packets sent each way are counted as they would go on the wire. The time it
+ * would take over a real link is estimated from the number of round trips, the bytes sent and
+ * the times the founder's limits on history responses made the peer wait and ask again.
+ *
+ * Usage: ./group_history_sim [number of missed messages] [number of senders]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* The history packet handlers are static. */
+#include "../toxcore/group_chats.c"
+#include "group_link_sim.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIM_RTT_MS 100
+#define SIM_BANDWIDTH (1024 * 1024 / 8)   /* bytes per second of a 1 Mbit/s link */
+
+static uint32_t sim_received;
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void sim_history_message(Messenger *m, uint32_t groupnumber, const uint8_t *public_key, const uint8_t *nick,
+                                size_t nick_len, unsigned int type, uint64_t time, const uint8_t *message,
+                                size_t length, void *userdata)
+{
+    ++sim_received;
+}
+
+/* Logs num_messages signed messages of num_senders senders in the log of chat, a few seconds apart.
+ *
+ * Returns the number of bytes the messages take with their sender, time and signature sent along in full.
+ */
+static uint64_t sim_fill_history(GC_Chat *chat, uint32_t num_messages, uint32_t num_senders)
+{
+    uint8_t (*public_keys)[EXT_PUBLIC_KEY] = malloc(num_senders * EXT_PUBLIC_KEY);
+    uint8_t (*secret_keys)[EXT_SECRET_KEY] = malloc(num_senders * EXT_SECRET_KEY);
+    GC_History_Entry entry;
+    uint64_t time = unix_time(chat->net->mono_time) - num_messages * 3;
+    uint64_t raw_bytes = 0;
+    uint32_t i;
+
+    if (public_keys == NULL || secret_keys == NULL)
+        exit(1);
+
+    for (i = 0; i < num_senders; ++i)
+        create_extended_keypair(public_keys[i], secret_keys[i]);
+
+    for (i = 0; i < num_messages; ++i) {
+        uint32_t sender = rand() % num_senders;
+        memset(&entry, 0, sizeof(GC_History_Entry));
+        memcpy(entry.public_key, public_keys[sender], EXT_PUBLIC_KEY);
+        entry.nick_len = snprintf((char *)entry.nick, MAX_GC_NICK_SIZE, "peer%u", sender);
+        entry.type = rand() % 20 ? GC_MESSAGE_TYPE_NORMAL : GC_MESSAGE_TYPE_ACTION;
+        time += rand() % 6;
+        entry.time = time;
+        entry.length = 10 + rand() % 140;
+
+        uint16_t j;
+
+        for (j = 0; j < entry.length; ++j)
+            entry.message[j] = 'a' + rand() % 26;
+
+        if (gc_history_sign(&entry, CHAT_ID(chat->chat_public_key), secret_keys[sender]) == -1
+                || gc_history_append(chat->history, &entry) == -1) {
+            raw_bytes = 0;
+            break;
+        }
+
+        raw_bytes += EXT_PUBLIC_KEY + 1 + entry.nick_len + TIME_STAMP_SIZE + SIGNATURE_SIZE + 1 + sizeof(uint16_t)
+                     + entry.length;
+    }
+
+    free(public_keys);
+    free(secret_keys);
+    return raw_bytes;
+}
+
+static int sim_catch_up(uint32_t num_messages, uint32_t num_senders)
+{
+    char founder_dir[] = "/tmp/group_history_sim_XXXXXX";
+    char peer_dir[] = "/tmp/group_history_sim_XXXXXX";
+
+    if (mkdtemp(founder_dir) == NULL || mkdtemp(peer_dir) == NULL)
+        return -1;
+
+    Messenger_Options options = {0};
+    options.group_history_size = 16 * 1024 * 1024;
+    options.group_history_dir = founder_dir;
+    Messenger *founder_m = new_messenger(&options, 0);
+    options.group_history_dir = peer_dir;
+    Messenger *peer_m = new_messenger(&options, 0);
+
+    if (founder_m == NULL || peer_m == NULL)
+        return -1;
+
+    if (gc_group_add(founder_m->group_handler, GI_PRIVATE, (const uint8_t *)"sim", 3) != 0
+            || create_new_group(peer_m->group_handler, false) != 0)
+        return -1;
+
+    GC_Chat *founder = &founder_m->group_handler->chats[0];
+    GC_Chat *peer = &peer_m->group_handler->chats[0];
+
+    memcpy(peer->chat_public_key, founder->chat_public_key, EXT_PUBLIC_KEY);
+
+    if (set_chat_id_hash(peer_m->group_handler, peer) == -1)
+        return -1;
+
+    if (founder->history == NULL || peer->history == NULL)
+        return -1;
+
+    peer->connection_state = CS_CONNECTED;
+    gc_callback_history_message(peer_m, sim_history_message, NULL);
+
+    GC_Sim_Link up, down;
+
+    if (gc_sim_connect(founder_m, peer_m, &down, &up) == -1)
+        return -1;
+
+    uint64_t raw_bytes = sim_fill_history(founder, num_messages, num_senders);
+
+    if (raw_bytes == 0)
+        return -1;
+
+    double start = get_time();
+
+    if (start_gc_history_sync(peer, up.peernumber) == -1)
+        return -1;
+
+    uint32_t waits = 0;
+
+    while (1) {
+        while (gc_sim_deliver(&up) + gc_sim_deliver(&down) > 0);
+
+        if (peer->history_peer_hash == 0)
+            break;
+
+        /* The founder's limits cut the responses short, let their interval pass and ask again */
+        ++waits;
+        founder->history_batches_time = 0;
+        founder->gcc[down.peernumber]->history_requests_time = 0;
+        peer->last_history_response = 0;
+        do_gc_history_sync(peer);
+    }
+
+    double cpu = get_time() - start;
+    uint32_t logged = gc_history_next_seq(peer->history) - gc_history_first_seq(peer->history);
+    double estimate = up.packets * SIM_RTT_MS / 1000.0 + (double)(up.bytes + down.bytes) / SIM_BANDWIDTH
+                      + waits * GC_HISTORY_SYNC_TIMEOUT;
+
+    printf("%u missed messages from %u senders\n", num_messages, num_senders);
+    printf("requests:       %u (%llu bytes)\n", up.packets, (unsigned long long)up.bytes);
+    printf("responses:      %u (%llu bytes)\n", down.packets, (unsigned long long)down.bytes);
+    printf("raw messages:   %llu bytes (x%.2f)\n", (unsigned long long)raw_bytes, (double)raw_bytes / down.bytes);
+    printf("received:       %u, logged %u\n", sim_received, logged);
+    printf("waits:          %u of %u s\n", waits, GC_HISTORY_SYNC_TIMEOUT);
+    printf("cpu time:       %.2f ms\n", cpu * 1000.0);
+    printf("estimated time: %.2f s at %u ms RTT and 1 Mbit/s\n", estimate, SIM_RTT_MS);
+
+    char founder_path[sizeof(founder_dir) + CHAT_ID_SIZE * 2 + 8];
+    char peer_path[sizeof(peer_dir) + CHAT_ID_SIZE * 2 + 8];
+    snprintf(founder_path, sizeof(founder_path), "%s/%s.log", founder_dir, id_toa(CHAT_ID(founder->chat_public_key)));
+    snprintf(peer_path, sizeof(peer_path), "%s/%s.log", peer_dir, id_toa(CHAT_ID(founder->chat_public_key)));
+
+    kill_messenger(founder_m);
+    kill_messenger(peer_m);
+
+    unlink(founder_path);
+    unlink(peer_path);
+    rmdir(founder_dir);
+    rmdir(peer_dir);
+
+    return sim_received == num_messages ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_messages = 10000;
+    uint32_t num_senders = 20;
+
+    if (argc > 1)
+        num_messages = atoi(argv[1]);
+
+    if (argc > 2)
+        num_senders = atoi(argv[2]);
+
+    if (num_messages == 0 || num_senders == 0) {
+        printf("Usage: %s [number of missed messages] [number of senders]\n", argv[0]);
+        return 1;
+    }
+
+    srand(time(NULL));
+
+    if (sim_catch_up(num_messages, num_senders) == -1) {
+        printf("Catching up failed\n");
+        return 1;
+    }
+
+    return 0;
+}
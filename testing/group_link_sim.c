@@ -0,0 +1,99 @@
+/* group_link_sim.c
+ *
+ * In-process links between the groups of two Messenger instances.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "group_link_sim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int gc_sim_connect(Messenger *a, Messenger *b, GC_Sim_Link *a_to_b, GC_Sim_Link *b_to_a)
+{
+    GC_Chat *chats[2] = {&a->group_handler->chats[0], &b->group_handler->chats[0]};
+    Messenger *ends[2] = {a, b};
+    GC_Sim_Link *links[2] = {a_to_b, b_to_a};
+    GC_Connection *gconns[2];
+    int peernumbers[2];
+    uint32_t i;
+
+    for (i = 0; i < 2; ++i) {
+        IP_Port ipp;
+        ip_init(&ipp.ip, 0);
+        ipp.ip.ip4.uint32 = htonl(0x7F000001);
+        ipp.port = ends[1 - i]->net->port;
+
+        peernumbers[i] = peer_add(ends[i], 0, &ipp, chats[1 - i]->self_public_key);
+
+        if (peernumbers[i] < 0)
+            return -1;
+
+        gconns[i] = chats[i]->gcc[peernumbers[i]];
+
+        if (set_peer_sig_key(chats[i], gconns[i], SIG_PK(chats[1 - i]->self_public_key)) == -1)
+            return -1;
+
+        gconns[i]->handshaked = true;
+        gconns[i]->confirmed = true;
+        gconns[i]->last_recv_direct_time = unix_time(ends[i]->net->mono_time);
+        memcpy(&chats[i]->group[peernumbers[i]], &chats[1 - i]->group[0], sizeof(GC_GroupPeer));
+    }
+
+    encrypt_precompute(gconns[1]->session_public_key, gconns[0]->session_secret_key, gconns[0]->shared_key);
+    encrypt_precompute(gconns[0]->session_public_key, gconns[1]->session_secret_key, gconns[1]->shared_key);
+
+    for (i = 0; i < 2; ++i) {
+        memset(links[i], 0, sizeof(GC_Sim_Link));
+        links[i]->from = ends[i];
+        links[i]->to = ends[1 - i];
+        links[i]->peernumber = peernumbers[i];
+        links[i]->next_message_id = gconns[i]->send_message_id;
+    }
+
+    return 0;
+}
+
+uint32_t gc_sim_deliver(GC_Sim_Link *link)
+{
+    GC_Chat *from = &link->from->group_handler->chats[0];
+    GC_Chat *to = &link->to->group_handler->chats[0];
+    GC_Connection *gconn = from->gcc[link->peernumber];
+    uint32_t num = 0;
+
+    while (link->next_message_id < gconn->send_message_id) {
+        uint64_t message_id = link->next_message_id++;
+        const struct GC_Message_Ary *entry = &gconn->send_ary[get_ary_index(message_id)];
+
+        if (entry->data == NULL)
+            continue;
+
+        ++link->packets;
+        link->bytes += entry->data_length;
+        ++num;
+
+        if (handle_gc_lossless_message(link->to, to, entry->data, entry->data_length, true) == -1)
+            printf("Packet of type %u wasn't handled\n", entry->packet_type);
+
+        gcc_handle_ack(link->from->net->mono_time, gconn, message_id);
+    }
+
+    return num;
+}
@@ -0,0 +1,62 @@
+/* group_link_sim.h
+ *
+ * In-process links between the groups of two Messenger instances, for simulations of group
+ * protocols that count what goes over the wire.
+ *
+ * The lossless packets one end sends are taken from its send buffer and handed over directly
+ * to the lossless packet handler of the other end, without going through the network. Each
+ * link counts the packets and bytes it carried.
+ *
+ * The handler is static, so group_link_sim.c is built in the same file as group_chats.c:
+ * include it right after "../toxcore/group_chats.c".
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GROUP_LINK_SIM_H
+#define GROUP_LINK_SIM_H
+
+#include "../toxcore/Messenger.h"
+
+typedef struct {
+    Messenger *from;
+    Messenger *to;
+    uint32_t peernumber;   /* of the receiving end in from's peer list */
+    uint64_t next_message_id;
+    uint32_t packets;
+    uint64_t bytes;
+} GC_Sim_Link;
+
+/* Makes the first groups of messengers a and b peers of each other, with the handshake done and
+ * a direct connection, and sets up a_to_b and b_to_a, the links they send to each other over.
+ * Only what is sent after this goes over the links.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int gc_sim_connect(Messenger *a, Messenger *b, GC_Sim_Link *a_to_b, GC_Sim_Link *b_to_a);
+
+/* Hands the lossless packets sent over link since the last call to the receiving end and acks
+ * them.
+ *
+ * return the number of packets handed over.
+ */
+uint32_t gc_sim_deliver(GC_Sim_Link *link);
+
+#endif
@@ -0,0 +1,378 @@
+/* group_load_bench.c
+ *
+ * Load generator and benchmark for the packet processing of group chats.
+ *
+ * Builds full mesh groups of real Messenger instances connected over localhost, with the
+ * handshakes already done, and has random peers send messages at a fixed rate for a while.
+ * Every message goes through the whole receive path of each peer: the lossless packet handler,
+ * the receive array, the broadcast handler and the message callback.
+ *
+ * For each group size it prints one line of comma separated values, after a header line, so
+ * that runs can be compared by scripts:
+ *   peers            size of the group
+ *   rate             messages per second sent to the group
+ *   sent             messages sent
+ *   delivered        messages received, counted once per receiving peer
+ *   delivered_pct    share of the messages every other peer should have received
+ *   throughput       delivered messages per second
+ *   p50_us, p99_us   delivery latency from gc_send_message() to the message callback
+ *   cpu_us_per_msg   CPU time of the whole process per sent message
+ *   cpu_us_per_recv  CPU time of the whole process per delivered message
+ *   kb_per_peer      resident memory added per peer of a peer's peer list, 0 if unknown
+ *   packets_per_msg  lossless packets received per sent message, resends included
+ *
+ * Every instance needs its own port, so groups can't have more peers than there are ports in
+ * the default port range.
+ *
+ * Usage: ./group_load_bench [group sizes, comma separated] [messages per second] [seconds]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* The peer list functions are static. */
+#include "../toxcore/group_chats.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MESSAGE_SIZE 64
+#define BENCH_MAX_SIZES 16
+#define BENCH_MAX_PEERS (TOX_PORTRANGE_TO - TOX_PORTRANGE_FROM + 1)
+
+/* How long to wait for the last messages once sending stopped, in ms */
+#define BENCH_DRAIN_TIME 5000
+
+typedef struct {
+    Messenger *m;
+    uint32_t index;
+    uint32_t lossless_packets;
+} Bench_Instance;
+
+typedef struct {
+    uint32_t num_peers;
+    uint32_t max_messages;
+    uint64_t *sent_time;   /* us */
+    uint32_t *latencies;   /* us, per message and receiving peer, 0 if not received */
+    uint32_t delivered;
+} Bench_State;
+
+static Bench_State state;
+
+static uint64_t get_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static double get_cpu_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* return resident memory of the process in kB, 0 if it can't be read. */
+static uint64_t get_rss_kb(void)
+{
+    FILE *file = fopen("/proc/self/statm", "r");
+
+    if (file == NULL)
+        return 0;
+
+    unsigned long size, resident;
+    int ret = fscanf(file, "%lu %lu", &size, &resident);
+    fclose(file);
+
+    if (ret != 2)
+        return 0;
+
+    return (uint64_t)resident * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static int bench_handle_packet(void *object, IP_Port ipp, const uint8_t *packet, uint16_t length)
+{
+    Bench_Instance *instance = object;
+
+    if (packet[0] == NET_PACKET_GC_LOSSLESS)
+        ++instance->lossless_packets;
+
+    return handle_gc_udp_packet(instance->m, ipp, packet, length);
+}
+
+static void bench_message(Messenger *m, uint32_t groupnumber, uint32_t peernumber, unsigned int type,
+                          const uint8_t *message, size_t length, void *userdata)
+{
+    const Bench_Instance *instance = userdata;
+    uint32_t seq;
+
+    if (length != BENCH_MESSAGE_SIZE)
+        return;
+
+    memcpy(&seq, message, sizeof(seq));
+
+    if (seq >= state.max_messages)
+        return;
+
+    uint32_t *latency = &state.latencies[(uint64_t)seq * state.num_peers + instance->index];
+
+    if (*latency == 0) {
+        *latency = get_time_us() - state.sent_time[seq] + 1;
+        ++state.delivered;
+    }
+}
+
+/* Makes a and b peers of each other with the handshake and the peer info exchange already done. */
+static int bench_connect(Bench_Instance *a, Bench_Instance *b)
+{
+    Bench_Instance *ends[2] = {a, b};
+    GC_Connection *gconns[2];
+    uint32_t i;
+
+    for (i = 0; i < 2; ++i) {
+        GC_Chat *chat = &ends[i]->m->group_handler->chats[0];
+        GC_Chat *other_chat = &ends[1 - i]->m->group_handler->chats[0];
+
+        IP_Port ipp;
+        ip_init(&ipp.ip, 0);
+        ipp.ip.ip4.uint32 = htonl(0x7F000001);
+        ipp.port = ends[1 - i]->m->net->port;
+
+        int peernumber = peer_add(ends[i]->m, 0, &ipp, other_chat->self_public_key);
+
+        if (peernumber < 0)
+            return -1;
+
+        gconns[i] = chat->gcc[peernumber];
+
+        if (set_peer_sig_key(chat, gconns[i], SIG_PK(other_chat->self_public_key)) == -1)
+            return -1;
+
+        gconns[i]->handshaked = true;
+        gconns[i]->confirmed = true;
+        gconns[i]->last_recv_direct_time = unix_time(ends[i]->m->net->mono_time);
+        memcpy(&chat->group[peernumber], &other_chat->group[0], sizeof(GC_GroupPeer));
+    }
+
+    encrypt_precompute(gconns[1]->session_public_key, gconns[0]->session_secret_key, gconns[0]->shared_key);
+    encrypt_precompute(gconns[0]->session_public_key, gconns[1]->session_secret_key, gconns[1]->shared_key);
+    return 0;
+}
+
+static void bench_do_instances(Bench_Instance *instances, uint32_t num)
+{
+    uint32_t i;
+
+    for (i = 0; i < num; ++i) {
+        networking_poll(instances[i].m->net);
+        do_gc(instances[i].m->group_handler);
+    }
+
+    usleep(500);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int run_bench(uint32_t num_peers, uint32_t rate, uint32_t seconds)
+{
+    Bench_Instance *instances = calloc(num_peers, sizeof(Bench_Instance));
+    uint32_t i, j;
+
+    state.num_peers = num_peers;
+    state.max_messages = rate * seconds;
+    state.delivered = 0;
+    state.sent_time = calloc(state.max_messages, sizeof(uint64_t));
+    state.latencies = calloc((uint64_t)state.max_messages * num_peers, sizeof(uint32_t));
+
+    if (instances == NULL || state.sent_time == NULL || state.latencies == NULL)
+        return -1;
+
+    for (i = 0; i < num_peers; ++i) {
+        Messenger_Options options = {0};
+        Messenger *m = new_messenger(&options, 0);
+
+        if (m == NULL || create_new_group(m->group_handler, false) != 0) {
+            fprintf(stderr, "Failed to create messenger %u\n", i);
+            return -1;
+        }
+
+        instances[i].m = m;
+        instances[i].index = i;
+        networking_registerhandler(m->net, NET_PACKET_GC_LOSSLESS, &bench_handle_packet, &instances[i]);
+        networking_registerhandler(m->net, NET_PACKET_GC_LOSSY, &bench_handle_packet, &instances[i]);
+        gc_callback_message(m, &bench_message, &instances[i]);
+
+        GC_Chat *chat = &m->group_handler->chats[0];
+        GC_Chat *first = &instances[0].m->group_handler->chats[0];
+
+        /* Everyone is in the first peer's group */
+        memcpy(chat->chat_public_key, first->chat_public_key, EXT_PUBLIC_KEY);
+
+        if (set_chat_id_hash(m->group_handler, chat) == -1)
+            return -1;
+
+        chat->group[0].nick_len = snprintf((char *)chat->group[0].nick, MAX_GC_NICK_SIZE, "peer%u", i);
+        chat->shared_state.maxpeers = MAX_GC_NUM_PEERS;
+        chat->connection_state = CS_CONNECTED;
+    }
+
+    uint64_t rss_before = get_rss_kb();
+
+    for (i = 0; i < num_peers; ++i) {
+        for (j = i + 1; j < num_peers; ++j) {
+            if (bench_connect(&instances[i], &instances[j]) == -1) {
+                fprintf(stderr, "Failed to connect peers %u and %u\n", i, j);
+                return -1;
+            }
+        }
+    }
+
+    uint8_t message[BENCH_MESSAGE_SIZE];
+    memset(message, 'x', sizeof(message));
+
+    double cpu_start = get_cpu_time();
+    uint64_t start = get_time_us();
+    uint64_t end = start + (uint64_t)seconds * 1000000;
+    uint32_t sent = 0;
+
+    while (sent < state.max_messages) {
+        uint64_t now = get_time_us();
+        uint64_t due = now < end ? (now - start) * rate / 1000000 : state.max_messages;
+
+        for (; sent < due && sent < state.max_messages; ++sent) {
+            GC_Chat *chat = &instances[rand() % num_peers].m->group_handler->chats[0];
+
+            memcpy(message, &sent, sizeof(sent));
+            state.sent_time[sent] = get_time_us();
+
+            if (gc_send_message(chat, message, sizeof(message), GC_MESSAGE_TYPE_NORMAL) != 0) {
+                fprintf(stderr, "Failed to send message %u\n", sent);
+                return -1;
+            }
+        }
+
+        bench_do_instances(instances, num_peers);
+    }
+
+    uint64_t expected = (uint64_t)sent * (num_peers - 1);
+    uint64_t drain_start = get_time_us();
+
+    while (state.delivered < expected && get_time_us() - drain_start < BENCH_DRAIN_TIME * 1000)
+        bench_do_instances(instances, num_peers);
+
+    double elapsed = (get_time_us() - start) / 1000000.0;
+    double cpu = get_cpu_time() - cpu_start;
+    uint64_t rss_after = get_rss_kb();
+
+    uint32_t *latencies = malloc(sizeof(uint32_t) * (state.delivered + 1));
+    uint32_t num = 0;
+    uint64_t lossless_packets = 0;
+
+    if (latencies == NULL)
+        return -1;
+
+    for (i = 0; i < (uint64_t)sent * num_peers; ++i) {
+        if (state.latencies[i] != 0)
+            latencies[num++] = state.latencies[i] - 1;
+    }
+
+    qsort(latencies, num, sizeof(uint32_t), &compare_u32);
+
+    for (i = 0; i < num_peers; ++i)
+        lossless_packets += instances[i].lossless_packets;
+
+    uint64_t num_links = (uint64_t)num_peers * (num_peers - 1);
+
+    printf("%u,%u,%u,%u,%.2f,%.1f,%u,%u,%.2f,%.2f,%.2f,%.2f\n", num_peers, rate, sent, num,
+           expected ? 100.0 * num / expected : 100.0, num / elapsed, num ? latencies[num / 2] : 0,
+           num ? latencies[(uint64_t)num * 99 / 100] : 0, sent ? cpu * 1000000.0 / sent : 0.0,
+           num ? cpu * 1000000.0 / num : 0.0,
+           rss_before && rss_after > rss_before && num_links ? (double)(rss_after - rss_before) / num_links : 0.0,
+           sent ? (double)lossless_packets / sent : 0.0);
+    fflush(stdout);
+
+    for (i = 0; i < num_peers; ++i)
+        kill_messenger(instances[i].m);
+
+    free(latencies);
+    free(instances);
+    free(state.sent_time);
+    free(state.latencies);
+    return num == expected ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t sizes[BENCH_MAX_SIZES] = {2, 8, 32};
+    uint32_t num_sizes = 3;
+    uint32_t rate = 200;
+    uint32_t seconds = 2;
+
+    if (argc > 1) {
+        char *token = strtok(argv[1], ",");
+
+        for (num_sizes = 0; token != NULL && num_sizes < BENCH_MAX_SIZES; token = strtok(NULL, ","))
+            sizes[num_sizes++] = atoi(token);
+    }
+
+    if (argc > 2)
+        rate = atoi(argv[2]);
+
+    if (argc > 3)
+        seconds = atoi(argv[3]);
+
+    uint32_t i;
+
+    for (i = 0; i < num_sizes; ++i) {
+        if (sizes[i] < 2 || sizes[i] > BENCH_MAX_PEERS)
+            break;
+    }
+
+    if (num_sizes == 0 || i != num_sizes || rate == 0 || seconds == 0) {
+        printf("Usage: %s [group sizes (2-%u), comma separated] [messages per second] [seconds]\n", argv[0],
+               BENCH_MAX_PEERS);
+        return 1;
+    }
+
+    srand(time(NULL));
+
+    printf("peers,rate,sent,delivered,delivered_pct,throughput,p50_us,p99_us,cpu_us_per_msg,cpu_us_per_recv,"
+           "kb_per_peer,packets_per_msg\n");
+
+    int ret = 0;
+
+    for (i = 0; i < num_sizes; ++i) {
+        if (run_bench(sizes[i], rate, seconds) == -1) {
+            fprintf(stderr, "Not every message reached every peer of the group of %u\n", sizes[i]);
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
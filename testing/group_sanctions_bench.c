@@ -0,0 +1,235 @@
+/* group_sanctions_bench.c
+ *
+ * Benchmark for group sanctions list validation.
+ *
+ * Validates a list of signed sanctions with a varying number of worker threads, first with
+ * none of its entries verified before and then with all of them cached, and prints the time
+ * each took. A received list can't hold more than MAX_GC_SANCTIONS entries, so that many are
+ * also unpacked from a packet before they are validated.
+ *
+ * Usage: ./group_sanctions_bench [number of sanctions] [max number of workers]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/group_chats.h"
+#include "../toxcore/group_moderation.h"
+#include "../toxcore/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* Fills sanctions with num_sanctions entries signed by the founder of chat, every fourth one a ban,
+ * and signs the list credentials.
+ */
+static void make_sanctions(const Mono_Time *mono_time, const GC_Chat *chat, struct GC_Sanction *sanctions,
+                           uint32_t num_sanctions, struct GC_Sanction_Creds *creds)
+{
+    uint32_t i;
+
+    for (i = 0; i < num_sanctions; ++i) {
+        struct GC_Sanction *sanction = &sanctions[i];
+        memset(sanction, 0, sizeof(struct GC_Sanction));
+
+        if (i % 4 == 0) {
+            sanction->type = SA_BAN;
+            sanction->ban_info.ip_port.ip.family = AF_INET;
+            sanction->ban_info.ip_port.ip.ip4.uint32 = htonl(0x0a000000 + i);
+            sanction->ban_info.ip_port.port = htons(33445);
+            sanction->ban_info.nick_len = snprintf((char *)sanction->ban_info.nick, MAX_GC_NICK_SIZE, "peer %u", i);
+            sanction->ban_info.id = i;
+        } else {
+            sanction->type = SA_OBSERVER;
+            randombytes(sanction->target_pk, ENC_PUBLIC_KEY);
+        }
+
+        memcpy(sanction->public_sig_key, SIG_PK(chat->self_public_key), SIG_PUBLIC_KEY);
+        sanction->time_set = unix_time(mono_time);
+
+        uint8_t packed[sizeof(struct GC_Sanction)];
+        int packed_len = sanctions_list_pack(packed, sizeof(packed), sanction, NULL, 1);
+
+        if (packed_len <= SIGNATURE_SIZE || crypto_sign_detached(sanction->signature, NULL, packed,
+                packed_len - SIGNATURE_SIZE, SIG_SK(chat->self_secret_key)) == -1) {
+            printf("Failed to sign sanction %u\n", i);
+            exit(1);
+        }
+    }
+
+    memset(creds, 0, sizeof(struct GC_Sanction_Creds));
+    creds->version = 1;
+    memcpy(creds->sig_pk, SIG_PK(chat->self_public_key), SIG_PUBLIC_KEY);
+    sanctions_list_make_hash(sanctions, creds->version, num_sanctions, creds->hash);
+    crypto_sign_detached(creds->sig, NULL, creds->hash, GC_MODERATION_HASH_SIZE, SIG_SK(chat->self_secret_key));
+}
+
+/* Validates the list twice with num_workers threads (0 means no pipeline), the second time with
+ * all entries cached, and puts the seconds each took in cold and cached.
+ */
+static void run_bench(GC_Chat *chat, uint32_t num_workers, struct GC_Sanction *sanctions, uint32_t num_sanctions,
+                      struct GC_Sanction_Creds *creds, double *cold, double *cached)
+{
+    Crypto_Pipeline *pipeline = NULL;
+
+    if (num_workers) {
+        pipeline = new_crypto_pipeline(num_workers);
+
+        if (pipeline == NULL) {
+            printf("Failed to create pipeline with %u workers\n", num_workers);
+            exit(1);
+        }
+    }
+
+    sanctions_cache_cleanup(chat);
+
+    double start = get_time();
+
+    if (sanctions_list_check_integrity(chat, creds, sanctions, num_sanctions, pipeline) == -1) {
+        printf("Valid list rejected\n");
+        exit(1);
+    }
+
+    *cold = get_time() - start;
+    start = get_time();
+
+    if (sanctions_list_check_integrity(chat, creds, sanctions, num_sanctions, pipeline) == -1) {
+        printf("Cached list rejected\n");
+        exit(1);
+    }
+
+    *cached = get_time() - start;
+    kill_crypto_pipeline(pipeline);
+}
+
+/* Unpacks and validates a packed list of num_sanctions entries.
+ *
+ * return number of seconds it took.
+ */
+static double run_unpack(GC_Chat *chat, const uint8_t *data, uint16_t length, uint32_t num_sanctions)
+{
+    struct GC_Sanction sanctions[MAX_GC_SANCTIONS];
+    struct GC_Sanction_Creds creds;
+
+    double start = get_time();
+
+    if (sanctions_list_unpack(sanctions, &creds, num_sanctions, data, length, NULL) != num_sanctions
+            || sanctions_list_check_integrity(chat, &creds, sanctions, num_sanctions, NULL) == -1) {
+        printf("Failed to unpack list\n");
+        exit(1);
+    }
+
+    return get_time() - start;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_sanctions = 5000;
+    uint32_t max_workers = 8;
+
+    if (argc > 1)
+        num_sanctions = atoi(argv[1]);
+
+    if (argc > 2)
+        max_workers = atoi(argv[2]);
+
+    if (num_sanctions == 0 || max_workers > CRYPTO_PIPELINE_MAX_WORKERS) {
+        printf("Usage: %s [number of sanctions] [max number of workers (<= %u)]\n", argv[0],
+               CRYPTO_PIPELINE_MAX_WORKERS);
+        return 1;
+    }
+
+    Mono_Time *mono_time = new_mono_time(NULL);
+    GC_Chat *chat = calloc(1, sizeof(GC_Chat));
+    struct GC_Sanction *sanctions = malloc(sizeof(struct GC_Sanction) * num_sanctions);
+
+    if (mono_time == NULL || chat == NULL || sanctions == NULL) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    create_extended_keypair(chat->self_public_key, chat->self_secret_key);
+    memcpy(chat->shared_state.founder_public_key, chat->self_public_key, EXT_PUBLIC_KEY);
+
+    struct GC_Sanction_Creds creds;
+    make_sanctions(mono_time, chat, sanctions, num_sanctions, &creds);
+
+    printf("sanctions: %u\n", num_sanctions);
+    printf("%-8s %-12s %-14s %-12s\n", "workers", "cold ms", "entries/s", "cached ms");
+
+    double base_time = 0;
+    uint32_t workers = 0;
+
+    while (1) {
+        double cold, cached;
+        run_bench(chat, workers, sanctions, num_sanctions, &creds, &cold, &cached);
+
+        if (workers == 0)
+            base_time = cold;
+
+        printf("%-8u %-12.2f %-14.0f %-12.2f (x%.2f)\n", workers, cold * 1000.0, num_sanctions / cold,
+               cached * 1000.0, base_time / cold);
+
+        if (workers >= max_workers)
+            break;
+
+        workers = workers ? workers * 2 : 1;
+
+        if (workers > max_workers)
+            workers = max_workers;
+    }
+
+    /* A received list, as a peer who joins gets it */
+    uint32_t num_packed = num_sanctions < MAX_GC_SANCTIONS ? num_sanctions : MAX_GC_SANCTIONS;
+    struct GC_Sanction_Creds packed_creds;
+    make_sanctions(mono_time, chat, sanctions, num_packed, &packed_creds);
+
+    uint8_t data[UINT16_MAX];
+    int length = sanctions_list_pack(data, sizeof(data), sanctions, &packed_creds, num_packed);
+
+    if (length == -1) {
+        printf("Failed to pack list\n");
+        return 1;
+    }
+
+    sanctions_cache_cleanup(chat);
+    double cold = run_unpack(chat, data, length, num_packed);
+    double cached = run_unpack(chat, data, length, num_packed);
+
+    printf("\nunpack %u sanctions (%d bytes): cold %.2f ms, cached %.2f ms\n", num_packed, length, cold * 1000.0,
+           cached * 1000.0);
+
+    sanctions_cache_cleanup(chat);
+    free(sanctions);
+    free(chat);
+    kill_mono_time(mono_time);
+    return 0;
+}
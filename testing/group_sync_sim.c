@@ -0,0 +1,261 @@
+/* group_sync_sim.c
+ *
+ * Simulation of the state sync a group peer does after it missed a single moderation event.
+ *
+ * The founder of a group of real Messenger instances sets up a mod list and a sanctions list,
+ * a peer gets a copy of that state, then the founder makes one more sanction the peer doesn't
+ * hear about. The peer syncs its state with the founder once with a full sync request and once
+ * with a delta sync request. Packets between the two are handed over directly to the receiving
+ * handlers and the lossless packets sent each way are counted as they would go on the wire.
+ *
+ * The other peers of the group are only in the peer lists of the founder and the syncing peer.
+ *
+ * Usage: ./group_sync_sim [number of peers] [number of sanctions before the event]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* The sync packet handlers are static. */
+#include "../toxcore/group_chats.c"
+#include "group_link_sim.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SIM_NUM_MODS 5
+
+/* Adds a peer that never sends anything to the groups of a and b.
+ *
+ * Returns its peernumber in a's group.
+ * Returns -1 on failure.
+ */
+static int sim_add_peer(Messenger *a, Messenger *b, uint32_t index)
+{
+    uint8_t public_key[EXT_PUBLIC_KEY], secret_key[EXT_SECRET_KEY];
+    create_extended_keypair(public_key, secret_key);
+
+    IP_Port ipp;
+    ip_init(&ipp.ip, 0);
+    ipp.ip.ip4.uint32 = htonl(0x0A000000 + index + 1);
+    ipp.port = htons(33445);
+
+    Messenger *ends[2] = {a, b};
+    int peernumbers[2];
+    uint32_t i;
+
+    for (i = 0; i < 2; ++i) {
+        GC_Chat *chat = &ends[i]->group_handler->chats[0];
+        peernumbers[i] = peer_add(ends[i], 0, &ipp, public_key);
+
+        if (peernumbers[i] < 0 || set_peer_sig_key(chat, chat->gcc[peernumbers[i]], SIG_PK(public_key)) == -1)
+            return -1;
+
+        chat->gcc[peernumbers[i]]->confirmed = true;
+        chat->group[peernumbers[i]].nick_len = snprintf((char *)chat->group[peernumbers[i]].nick, MAX_GC_NICK_SIZE,
+                                                        "peer%u", index);
+        chat->group[peernumbers[i]].role = GR_USER;
+    }
+
+    return peernumbers[0];
+}
+
+/* Gives the group of to the shared state, mod list and sanctions list of from's group. */
+static int sim_copy_state(const GC_Chat *from, GC_Chat *to)
+{
+    memcpy(&to->shared_state, &from->shared_state, sizeof(GC_SharedState));
+    memcpy(to->shared_state_sig, from->shared_state_sig, SIGNATURE_SIZE);
+
+    uint8_t mod_list[MAX_GC_MODERATORS * GC_MOD_LIST_ENTRY_SIZE];
+    mod_list_pack(from, mod_list);
+
+    if (mod_list_unpack(to, mod_list, from->moderation.num_mods * GC_MOD_LIST_ENTRY_SIZE,
+                        from->moderation.num_mods) == -1)
+        return -1;
+
+    sanctions_list_cleanup(to);
+    to->moderation.sanctions = malloc(sizeof(struct GC_Sanction) * (from->moderation.num_sanctions + 1));
+
+    if (to->moderation.sanctions == NULL)
+        return -1;
+
+    memcpy(to->moderation.sanctions, from->moderation.sanctions,
+           sizeof(struct GC_Sanction) * from->moderation.num_sanctions);
+    to->moderation.num_sanctions = from->moderation.num_sanctions;
+    memcpy(&to->moderation.sanctions_creds, &from->moderation.sanctions_creds, sizeof(struct GC_Sanction_Creds));
+    return 0;
+}
+
+static bool sim_synced(const GC_Chat *a, const GC_Chat *b)
+{
+    return a->moderation.num_sanctions == b->moderation.num_sanctions
+           && a->moderation.sanctions_creds.version == b->moderation.sanctions_creds.version
+           && memcmp(a->moderation.sanctions_creds.hash, b->moderation.sanctions_creds.hash,
+                     GC_MODERATION_HASH_SIZE) == 0;
+}
+
+/* Runs a sync of the peer at the other end of up's link with the founder. The sync request
+ * must already be sent. Packets are handed over until neither side sends any more.
+ */
+static void sim_run_sync(GC_Sim_Link *up, GC_Sim_Link *down, const char *name, const GC_Chat *founder,
+                         const GC_Chat *peer)
+{
+    up->packets = down->packets = 0;
+    up->bytes = down->bytes = 0;
+
+    while (gc_sim_deliver(up) + gc_sim_deliver(down) > 0);
+
+    printf("%-8s %-10u %-12llu %-10u %-12llu %s\n", name, up->packets, (unsigned long long)up->bytes,
+           down->packets, (unsigned long long)down->bytes, sim_synced(founder, peer) ? "yes" : "no");
+}
+
+/* Creates the group and runs the full and delta syncs after a sanction of the given type. */
+static int sim_moderation_event(uint32_t num_peers, uint32_t num_sanctions, uint8_t type)
+{
+    Messenger_Options options = {0};
+    Messenger *founder_m = new_messenger(&options, 0);
+    Messenger *peer_m = new_messenger(&options, 0);
+
+    if (founder_m == NULL || peer_m == NULL)
+        return -1;
+
+    if (gc_group_add(founder_m->group_handler, GI_PRIVATE, (const uint8_t *)"sim", 3) != 0
+            || create_new_group(peer_m->group_handler, false) != 0)
+        return -1;
+
+    GC_Chat *founder = &founder_m->group_handler->chats[0];
+    GC_Chat *peer = &peer_m->group_handler->chats[0];
+
+    memcpy(peer->chat_public_key, founder->chat_public_key, EXT_PUBLIC_KEY);
+
+    if (set_chat_id_hash(peer_m->group_handler, peer) == -1)
+        return -1;
+
+    peer->connection_state = CS_CONNECTED;
+
+    /* Our address as DHT nodes see it, which the full sync response holds */
+    ip_init(&founder_m->dht->close_clientlist[0].assoc4.ret_ip_port.ip, 0);
+    founder_m->dht->close_clientlist[0].assoc4.ret_ip_port.ip.ip4.uint32 = htonl(0xC0000201);
+    founder_m->dht->close_clientlist[0].assoc4.ret_ip_port.port = htons(33445);
+
+    GC_Sim_Link up, down;
+
+    if (gc_sim_connect(founder_m, peer_m, &down, &up) == -1)
+        return -1;
+
+    uint32_t i;
+
+    for (i = 0; i < num_peers - 2; ++i) {
+        int peernumber = sim_add_peer(founder_m, peer_m, i);
+
+        if (peernumber == -1)
+            return -1;
+
+        if (i < SIM_NUM_MODS) {
+            if (mod_list_add_entry(founder, SIG_PK(founder->gcc[peernumber]->addr.public_key)) == -1)
+                return -1;
+
+            founder->group[peernumber].role = GR_MODERATOR;
+        }
+    }
+
+    mod_list_make_hash(founder, founder->shared_state.mod_list_hash);
+
+    if (sign_gc_shared_state(founder) == -1)
+        return -1;
+
+    /* Moderators are left alone, the last peer is sanctioned by the event */
+    struct GC_Sanction sanction;
+
+    for (i = 0; i < num_sanctions; ++i) {
+        uint32_t peernumber = down.peernumber + 1 + SIM_NUM_MODS + i;
+
+        if (sanctions_list_make_entry(founder, peernumber, &sanction, i % 2 ? SA_BAN : SA_OBSERVER) == -1)
+            return -1;
+    }
+
+    if (sim_copy_state(founder, peer) == -1)
+        return -1;
+
+    struct GC_Sanction *old_sanctions = malloc(sizeof(struct GC_Sanction) * (num_sanctions + 1));
+    struct GC_Sanction_Creds old_creds;
+
+    if (old_sanctions == NULL)
+        return -1;
+
+    memcpy(old_sanctions, peer->moderation.sanctions, sizeof(struct GC_Sanction) * num_sanctions);
+    memcpy(&old_creds, &peer->moderation.sanctions_creds, sizeof(struct GC_Sanction_Creds));
+
+    if (sanctions_list_make_entry(founder, founder->numpeers - 1, &sanction, type) == -1)
+        return -1;
+
+    printf("\n%u peers, %u mods, %u sanctions, event: %s\n", num_peers, SIM_NUM_MODS, num_sanctions,
+           type == SA_BAN ? "ban" : "observer");
+    printf("%-8s %-10s %-12s %-10s %-12s %s\n", "sync", "packets up", "bytes up", "packets", "bytes down",
+           "synced");
+
+    if (send_gc_sync_request(peer, up.peernumber, 0) == -1)
+        return -1;
+
+    sim_run_sync(&up, &down, "full", founder, peer);
+
+    /* The peer goes back to the state it had before the event */
+    sanctions_list_cleanup(peer);
+    peer->moderation.sanctions = old_sanctions;
+    peer->moderation.num_sanctions = num_sanctions;
+    memcpy(&peer->moderation.sanctions_creds, &old_creds, sizeof(struct GC_Sanction_Creds));
+
+    /* The pings of the founder tell of no peers we don't know about */
+    if (send_gc_sync_delta_request(peer, up.peernumber, false) == -1)
+        return -1;
+
+    sim_run_sync(&up, &down, "delta", founder, peer);
+
+    kill_messenger(founder_m);
+    kill_messenger(peer_m);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_peers = 300;
+    uint32_t num_sanctions = 20;
+
+    if (argc > 1)
+        num_peers = atoi(argv[1]);
+
+    if (argc > 2)
+        num_sanctions = atoi(argv[2]);
+
+    if (num_peers < SIM_NUM_MODS + num_sanctions + 3 || num_sanctions >= MAX_GC_SANCTIONS) {
+        printf("Usage: %s [number of peers] [number of sanctions before the event]\n", argv[0]);
+        return 1;
+    }
+
+    if (sim_moderation_event(num_peers, num_sanctions, SA_OBSERVER) == -1
+            || sim_moderation_event(num_peers, num_sanctions, SA_BAN) == -1) {
+        printf("Failed to set up the group\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,358 @@
+/* group_tcp_bench.c
+ *
+ * Benchmark of the relay connections of a client in many groups.
+ *
+ * A Messenger instance creates a number of groups whose peers can only be reached through a
+ * few local TCP relays, once with every group on relay connections of its own, as groups with
+ * keys of their own are by default, and once with shared_group_key set, all of them on the
+ * connections the session shares between the groups that use our group key. Each group has a few peers out of a small set,
+ * so that some peers are in several groups like they would be for a real client.
+ *
+ * For each run it prints one line of comma separated values, after a header line:
+ *   mode             own: one set of relay connections per group, shared: one for all of them
+ *   groups           number of groups
+ *   sockets          sockets opened for the groups, both ends of each relay connection as the
+ *                    relays run in the same process
+ *   relay_clients    connections the relays accepted
+ *   routes           connections to peers through the relays, one per peer and group set
+ *   setup_ms         time until every relay connection was up
+ *   client_us_per_s  CPU time of do_gc() per second once the connections are up
+ *   relay_us_per_s   CPU time of the relays per second once the connections are up
+ *
+ * Usage: ./group_tcp_bench [number of groups] [seconds]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* The relay connection functions of groups are static. */
+#include "../toxcore/group_chats.c"
+#include "../toxcore/TCP_server.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_RELAYS 3
+#define BENCH_RELAY_PORT 33700
+#define BENCH_REMOTE_PEERS 20
+#define BENCH_PEERS_PER_GROUP 4
+
+/* How long to wait for the relay connections to come up, in seconds */
+#define BENCH_SETUP_TIMEOUT 30
+
+typedef struct {
+    TCP_Server *server;
+    uint8_t public_key[crypto_box_PUBLICKEYBYTES];
+    IP_Port ip_port;
+} Bench_Relay;
+
+static Bench_Relay relays[BENCH_RELAYS];
+static Mono_Time *relay_time;   /* the clock the relays share */
+static uint8_t remote_keys[BENCH_REMOTE_PEERS][EXT_PUBLIC_KEY];
+
+static double get_thread_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static double get_wall_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* Returns the number of sockets the process has open. */
+static uint32_t count_sockets(void)
+{
+    DIR *dir = opendir("/proc/self/fd");
+
+    if (dir == NULL)
+        return 0;
+
+    struct dirent *entry;
+    uint32_t num = 0;
+
+    while ((entry = readdir(dir)) != NULL) {
+        char path[300], target[64];
+        snprintf(path, sizeof(path), "/proc/self/fd/%s", entry->d_name);
+        ssize_t len = readlink(path, target, sizeof(target) - 1);
+
+        if (len > 0) {
+            target[len] = 0;
+
+            if (strncmp(target, "socket:", 7) == 0)
+                ++num;
+        }
+    }
+
+    closedir(dir);
+    return num;
+}
+
+static int start_relays(void)
+{
+    uint32_t i;
+
+    relay_time = new_mono_time(NULL);
+
+    if (relay_time == NULL)
+        return -1;
+
+    for (i = 0; i < BENCH_RELAYS; ++i) {
+        uint8_t secret_key[crypto_box_SECRETKEYBYTES];
+        uint16_t port = BENCH_RELAY_PORT + i;
+        crypto_box_keypair(relays[i].public_key, secret_key);
+        relays[i].server = new_TCP_server(relay_time, 0, 1, &port, secret_key, NULL);
+
+        if (relays[i].server == NULL)
+            return -1;
+
+        ip_init(&relays[i].ip_port.ip, 0);
+        relays[i].ip_port.ip.ip4.uint32 = htonl(0x7F000001);
+        relays[i].ip_port.port = htons(port);
+    }
+
+    return 0;
+}
+
+static uint32_t count_relay_clients(void)
+{
+    uint32_t i, num = 0;
+
+    for (i = 0; i < BENCH_RELAYS; ++i)
+        num += relays[i].server->num_accepted_connections;
+
+    return num;
+}
+
+static void do_relays(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < BENCH_RELAYS; ++i)
+        do_TCP_server(relays[i].server);
+}
+
+/* Returns the number of relays tcp_c has a working connection to. */
+static uint32_t count_connected_relays(const TCP_Connections *tcp_c)
+{
+    uint32_t i, num = 0;
+
+    for (i = 0; i < tcp_c->tcp_connections_length; ++i) {
+        if (tcp_c->tcp_connections[i].status == TCP_CONN_CONNECTED)
+            ++num;
+    }
+
+    return num;
+}
+
+static uint32_t count_routes(const TCP_Connections *tcp_c)
+{
+    uint32_t i, num = 0;
+
+    for (i = 0; i < tcp_c->connections_length; ++i) {
+        if (tcp_c->connections[i].status != TCP_CONN_NONE)
+            ++num;
+    }
+
+    return num;
+}
+
+/* Creates a group with a few of the remote peers, who are only reachable through the relays.
+ * If own is set the group must have a key and relay connections of its own.
+ */
+static int add_group(Messenger *m, uint32_t index, bool own)
+{
+    GC_Session *c = m->group_handler;
+    int groupnumber = create_new_group(c, false);
+
+    if (groupnumber == -1)
+        return -1;
+
+    GC_Chat *chat = &c->chats[groupnumber];
+
+    if (chat->shared_tcp == own)
+        return -1;
+
+    uint32_t i, j;
+
+    for (i = 0; i < BENCH_PEERS_PER_GROUP; ++i) {
+        int peernumber = peer_add(m, groupnumber, NULL, remote_keys[(index * 3 + i) % BENCH_REMOTE_PEERS]);
+
+        if (peernumber == -1)
+            return -1;
+
+        for (j = 0; j < BENCH_RELAYS; ++j)
+            add_tcp_relay_connection(chat->tcp_conn, chat->gcc[peernumber]->tcp_connection_num, relays[j].ip_port,
+                                     relays[j].public_key);
+    }
+
+    return 0;
+}
+
+/* Returns the number of distinct relay connection sets the groups of c use. */
+static uint32_t get_pools(GC_Session *c, TCP_Connections **pools)
+{
+    uint32_t i, j, num = 0;
+
+    for (i = 0; i < c->num_chats; ++i) {
+        for (j = 0; j < num; ++j) {
+            if (pools[j] == c->chats[i].tcp_conn)
+                break;
+        }
+
+        if (j == num)
+            pools[num++] = c->chats[i].tcp_conn;
+    }
+
+    return num;
+}
+
+static int run(uint32_t num_groups, uint32_t seconds, bool own)
+{
+    uint32_t base_relay_clients = count_relay_clients();
+
+    Messenger_Options options = {0};
+    options.shared_group_key = !own;
+    Messenger *m = new_messenger(&options, 0);
+
+    if (m == NULL)
+        return -1;
+
+    uint32_t sockets_before = count_sockets();
+    uint32_t i;
+
+    for (i = 0; i < num_groups; ++i) {
+        if (add_group(m, i, own) == -1)
+            return -1;
+    }
+
+    TCP_Connections *pools[num_groups];
+    uint32_t num_pools = get_pools(m->group_handler, pools);
+
+    double start = get_wall_time();
+    uint32_t connected;
+
+    do {
+        unix_time_update(m->net->mono_time);
+        do_gc(m->group_handler);
+        do_relays();
+        usleep(1000);
+
+        for (connected = 0, i = 0; i < num_pools; ++i)
+            connected += count_connected_relays(pools[i]);
+    } while (connected < num_pools * BENCH_RELAYS && get_wall_time() - start < BENCH_SETUP_TIMEOUT);
+
+    double setup = get_wall_time() - start;
+
+    if (connected < num_pools * BENCH_RELAYS)
+        printf("Only %u of %u relay connections came up\n", connected, num_pools * BENCH_RELAYS);
+
+    double client_cpu = 0, relay_cpu = 0;
+    start = get_wall_time();
+
+    while (get_wall_time() - start < seconds) {
+        unix_time_update(m->net->mono_time);
+
+        double t = get_thread_time();
+        do_gc(m->group_handler);
+        client_cpu += get_thread_time() - t;
+
+        t = get_thread_time();
+        do_relays();
+        relay_cpu += get_thread_time() - t;
+
+        usleep(20000);   /* roughly how often clients call tox_iterate() when idle */
+    }
+
+    uint32_t routes = 0;
+
+    for (i = 0; i < num_pools; ++i)
+        routes += count_routes(pools[i]);
+
+    printf("%s,%u,%u,%u,%u,%.0f,%.0f,%.0f\n", own ? "own" : "shared", num_groups,
+           count_sockets() - sockets_before, count_relay_clients() - base_relay_clients, routes, setup * 1000.0,
+           client_cpu * 1000000.0 / seconds, relay_cpu * 1000000.0 / seconds);
+
+    kill_groupchats(m->group_handler);
+    kill_messenger(m);
+
+    /* Let the relays see the connections go before the next run */
+    start = get_wall_time();
+
+    while (count_relay_clients() > base_relay_clients && get_wall_time() - start < BENCH_SETUP_TIMEOUT) {
+        do_relays();
+        usleep(1000);
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_groups = 50;
+    uint32_t seconds = 10;
+
+    if (argc > 1)
+        num_groups = atoi(argv[1]);
+
+    if (argc > 2)
+        seconds = atoi(argv[2]);
+
+    if (num_groups == 0 || seconds == 0) {
+        printf("Usage: %s [number of groups] [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    srand(time(NULL));
+
+    uint32_t i;
+
+    for (i = 0; i < BENCH_REMOTE_PEERS; ++i) {
+        uint8_t secret_key[EXT_SECRET_KEY];
+        create_extended_keypair(remote_keys[i], secret_key);
+    }
+
+    if (start_relays() == -1) {
+        printf("Failed to start the relays\n");
+        return 1;
+    }
+
+    printf("mode,groups,sockets,relay_clients,routes,setup_ms,client_us_per_s,relay_us_per_s\n");
+
+    if (run(num_groups, seconds, true) == -1 || run(num_groups, seconds, false) == -1) {
+        printf("Benchmark failed\n");
+        return 1;
+    }
+
+    for (i = 0; i < BENCH_RELAYS; ++i)
+        kill_TCP_server(relays[i].server);
+
+    kill_mono_time(relay_time);
+    return 0;
+}
@@ -0,0 +1,364 @@
+/* host_bench.c
+ *
+ * Benchmark of what running many accounts costs as separate Messengers and as the accounts of one
+ * Messenger_Host.
+ *
+ * For each number of accounts it creates them both ways on real sockets and counts the file
+ * descriptors and heap they take. It then runs them both ways on a simulated network of other
+ * nodes, see network_sim.h, and measures the background traffic of keeping them online: none of
+ * the accounts have friends, so everything they send and receive is the DHT, the onion announces
+ * and the pings that keep them up.
+ *
+ * It prints one line of comma separated values for each number of accounts and way of running
+ * them, after a header line:
+ *   mode             separate or host
+ *   accounts         number of accounts
+ *   sockets          file descriptors opened by creating the accounts
+ *   heap_kb          heap allocated by creating the accounts, 0 if it can't be measured
+ *   connected        accounts that got connected to the simulated network
+ *   up_bps           bytes per second all the accounts sent and received together over the last
+ *   down_bps         half of the simulation, when the network has settled
+ *
+ * Usage: ./host_bench [account counts, comma separated] [simulated seconds]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "network_sim.h"
+#include "../toxcore/Messenger.h"
+#include "../toxcore/group_chats.h"
+#include "../toxcore/util.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#define BENCH_MAX_COUNTS 16
+#define BENCH_BOOTSTRAP_NODES 4
+#define BENCH_OTHER_NODES 32   /* nodes of the simulated network besides the accounts */
+#define BENCH_MIN_LATENCY 10   /* ms, one way */
+#define BENCH_MAX_LATENCY 150
+#define BENCH_SEED 42
+
+/* How often everything runs, like a client calling tox_iterate() */
+#define BENCH_ITERATE_INTERVAL 50   /* ms */
+
+/* How often a node that isn't in the DHT bootstraps again */
+#define BENCH_BOOTSTRAP_INTERVAL 5000   /* ms */
+
+typedef struct {
+    uint32_t sockets;
+    uint64_t heap;
+    uint32_t connected;
+    double up_bps;
+    double down_bps;
+} Bench_Result;
+
+/* return the number of open file descriptors, 0 if they can't be counted. */
+static uint32_t count_fds(void)
+{
+    DIR *dir = opendir("/proc/self/fd");
+
+    if (dir == NULL)
+        return 0;
+
+    uint32_t count = 0;
+
+    while (readdir(dir))
+        ++count;
+
+    closedir(dir);
+    return count;
+}
+
+static uint64_t heap_used(void)
+{
+#ifdef __GLIBC__
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+static void kill_account(Messenger *m)
+{
+    kill_groupchats(m->group_handler);
+    kill_messenger(m);
+}
+
+/* Creates num_accounts accounts on real sockets, as separate Messengers or on a host. */
+static int measure_footprint(uint32_t num_accounts, _Bool hosted, Bench_Result *result)
+{
+    Messenger **accounts = calloc(num_accounts, sizeof(Messenger *));
+
+    if (accounts == NULL)
+        return -1;
+
+    Messenger_Options options = {0};
+    options.port_range[0] = TOX_PORTRANGE_FROM;
+    options.port_range[1] = TOX_PORTRANGE_FROM + num_accounts * 2;
+
+    uint32_t fds = count_fds();
+    uint64_t heap = heap_used();
+    Messenger_Host *host = NULL;
+
+    if (hosted) {
+        host = new_messenger_host(&options, 0);
+
+        if (host == NULL)
+            return -1;
+
+        options.host = host;
+    }
+
+    uint32_t i;
+
+    for (i = 0; i < num_accounts; ++i) {
+        accounts[i] = new_messenger(&options, 0);
+
+        if (accounts[i] == NULL)
+            return -1;
+    }
+
+    result->sockets = count_fds() - fds;
+    result->heap = heap_used() - heap;
+
+    for (i = 0; i < num_accounts; ++i)
+        kill_account(accounts[i]);
+
+    kill_messenger_host(host);
+    free(accounts);
+    return 0;
+}
+
+/* Bootstraps dht from one of the bootstrap nodes if it isn't connected, at most every
+ * BENCH_BOOTSTRAP_INTERVAL.
+ */
+static void keep_bootstrapped(DHT *dht, uint64_t *last_bootstrap, uint64_t now, Messenger **nodes, uint32_t index)
+{
+    if (DHT_isconnected(dht) || (*last_bootstrap != 0 && now < *last_bootstrap + BENCH_BOOTSTRAP_INTERVAL))
+        return;
+
+    uint32_t j = (index + 1) % BENCH_BOOTSTRAP_NODES;
+    DHT_bootstrap(dht, nodes[j]->options.transport.ip_port, nodes[j]->dht->self_public_key);
+    *last_bootstrap = now;
+}
+
+/* Runs num_accounts accounts on a simulated network for seconds, as separate Messengers or on a host. */
+static int measure_traffic(uint32_t num_accounts, _Bool hosted, uint32_t seconds, Bench_Result *result)
+{
+    uint32_t num_nodes = BENCH_OTHER_NODES + (hosted ? 1 : num_accounts);
+    Net_Sim_Options sim_options = {BENCH_MIN_LATENCY, BENCH_MAX_LATENCY, 0, BENCH_SEED};
+    Net_Sim *sim = new_net_sim(&sim_options, num_nodes);
+    Messenger **nodes = calloc(BENCH_OTHER_NODES, sizeof(Messenger *));
+    Messenger **accounts = calloc(num_accounts, sizeof(Messenger *));
+    uint64_t *last_bootstrap = calloc(num_nodes, sizeof(uint64_t));
+    Net_Sim_Stats *half = calloc(num_nodes, sizeof(Net_Sim_Stats));
+
+    if (sim == NULL || nodes == NULL || accounts == NULL || last_bootstrap == NULL || half == NULL)
+        return -1;
+
+    uint32_t i;
+
+    for (i = 0; i < BENCH_OTHER_NODES; ++i) {
+        Messenger_Options options = {0};
+        int node = net_sim_add_node(sim, &options.transport, &options.clock);
+
+        if (node == -1)
+            return -1;
+
+        nodes[i] = new_messenger(&options, 0);
+
+        if (nodes[i] == NULL)
+            return -1;
+
+        net_sim_set_networking(sim, node, nodes[i]->net);
+    }
+
+    Messenger_Host *host = NULL;
+
+    if (hosted) {
+        Messenger_Options options = {0};
+        int node = net_sim_add_node(sim, &options.transport, &options.clock);
+
+        if (node == -1)
+            return -1;
+
+        host = new_messenger_host(&options, 0);
+
+        if (host == NULL)
+            return -1;
+
+        net_sim_set_networking(sim, node, host->net);
+    }
+
+    for (i = 0; i < num_accounts; ++i) {
+        Messenger_Options options = {0};
+        options.host = host;
+
+        if (!hosted) {
+            int node = net_sim_add_node(sim, &options.transport, &options.clock);
+
+            if (node == -1)
+                return -1;
+
+            accounts[i] = new_messenger(&options, 0);
+
+            if (accounts[i] == NULL)
+                return -1;
+
+            net_sim_set_networking(sim, node, accounts[i]->net);
+        } else {
+            accounts[i] = new_messenger(&options, 0);
+
+            if (accounts[i] == NULL)
+                return -1;
+        }
+    }
+
+    uint64_t start = net_sim_time(sim), end = start + seconds * 1000ULL;
+    uint64_t half_time = start + seconds * 500ULL;
+    _Bool half_taken = 0;
+
+    while (net_sim_time(sim) < end) {
+        uint64_t now = net_sim_time(sim) + BENCH_ITERATE_INTERVAL;
+        net_sim_run(sim, now);
+
+        for (i = 0; i < BENCH_OTHER_NODES; ++i) {
+            keep_bootstrapped(nodes[i]->dht, &last_bootstrap[i], now, nodes, i);
+            do_messenger(nodes[i]);
+        }
+
+        if (hosted) {
+            keep_bootstrapped(host->dht, &last_bootstrap[BENCH_OTHER_NODES], now, nodes, BENCH_OTHER_NODES);
+            do_messenger_host(host);
+        } else {
+            for (i = 0; i < num_accounts; ++i) {
+                keep_bootstrapped(accounts[i]->dht, &last_bootstrap[BENCH_OTHER_NODES + i], now, nodes, i);
+                do_messenger(accounts[i]);
+            }
+        }
+
+        if (!half_taken && now >= half_time) {
+            for (i = BENCH_OTHER_NODES; i < num_nodes; ++i)
+                net_sim_get_stats(sim, i, &half[i]);
+
+            half_taken = 1;
+        }
+    }
+
+    uint64_t up = 0, down = 0;
+
+    for (i = BENCH_OTHER_NODES; i < num_nodes; ++i) {
+        Net_Sim_Stats stats;
+        net_sim_get_stats(sim, i, &stats);
+        up += stats.bytes_sent - half[i].bytes_sent;
+        down += stats.bytes_received - half[i].bytes_received;
+    }
+
+    double half_seconds = (end - half_time) / 1000.0;
+    result->up_bps = up / half_seconds;
+    result->down_bps = down / half_seconds;
+    result->connected = 0;
+
+    for (i = 0; i < num_accounts; ++i) {
+        if (onion_connection_status(accounts[i]->onion_c) != 0)
+            ++result->connected;
+
+        kill_account(accounts[i]);
+    }
+
+    kill_messenger_host(host);
+
+    for (i = 0; i < BENCH_OTHER_NODES; ++i)
+        kill_account(nodes[i]);
+
+    kill_net_sim(sim);
+    free(half);
+    free(last_bootstrap);
+    free(accounts);
+    free(nodes);
+    return 0;
+}
+
+static int run(uint32_t num_accounts, _Bool hosted, uint32_t seconds)
+{
+    Bench_Result result = {0};
+
+    if (measure_footprint(num_accounts, hosted, &result) == -1)
+        return -1;
+
+    if (measure_traffic(num_accounts, hosted, seconds, &result) == -1)
+        return -1;
+
+    printf("%s,%u,%u,%llu,%u,%.0f,%.0f\n", hosted ? "host" : "separate", num_accounts, result.sockets,
+           (unsigned long long)(result.heap / 1024), result.connected, result.up_bps, result.down_bps);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t counts[BENCH_MAX_COUNTS] = {1, 10, 50};
+    uint32_t num_counts = 3;
+    uint32_t seconds = 120;
+
+    if (argc > 1) {
+        char *list = argv[1];
+        num_counts = 0;
+
+        while (*list && num_counts < BENCH_MAX_COUNTS) {
+            counts[num_counts++] = strtoul(list, &list, 10);
+
+            if (*list == ',')
+                ++list;
+            else
+                break;
+        }
+    }
+
+    if (argc > 2)
+        seconds = atoi(argv[2]);
+
+    if (num_counts == 0 || seconds == 0) {
+        printf("Usage: %s [account counts, comma separated] [simulated seconds]\n", argv[0]);
+        return 1;
+    }
+
+    printf("mode,accounts,sockets,heap_kb,connected,up_bps,down_bps\n");
+
+    uint32_t i;
+
+    for (i = 0; i < num_counts; ++i) {
+        if (counts[i] == 0 || run(counts[i], 0, seconds) == -1 || run(counts[i], 1, seconds) == -1) {
+            printf("Benchmark with %u accounts failed\n", counts[i]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
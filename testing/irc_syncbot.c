@@ -37,12 +37,16 @@ int sock;
 #define SERVER_CONNECT "NICK "IRC_NAME"\nUSER "IRC_NAME" 8 * :"IRC_NAME"\n"
 #define CHANNEL_JOIN "JOIN "IRC_CHANNEL"\n"
 
-/* In toxcore/network.c */
-uint64_t current_time_monotonic(void);
+#include "../toxcore/network.h"
+
+static Mono_Time *mono_time;
 
 uint64_t get_monotime_sec(void)
 {
-    return current_time_monotonic() / 1000;
+    if (mono_time == NULL)
+        mono_time = new_mono_time(NULL);
+
+    return current_time_monotonic(mono_time) / 1000;
 }
 
 int reconnect(void)
@@ -0,0 +1,407 @@
+/* network_sim.c
+ *
+ * Discrete event simulation of a network for running many nodes in one process.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "network_sim.h"
+#include "../toxcore/crypto_core.h"
+#include "../toxcore/util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Nodes get the addresses after 20.0.0.0, which isn't a LAN range so nodes share them in the DHT */
+#define SIM_ADDRESS_BASE 0x14000000
+#define SIM_PORT 33445
+
+typedef struct {
+    uint64_t time;
+    uint64_t seq;   /* keeps packets due at the same time in the order they were sent */
+    uint32_t from;
+    uint32_t to;
+    uint16_t length;
+    uint8_t *data;
+} Sim_Packet;
+
+typedef struct {
+    Net_Sim *sim;
+    uint32_t number;
+    Networking_Core *net;
+    Net_Sim_Stats stats;
+} Sim_Node;
+
+struct Net_Sim {
+    Net_Sim_Options options;
+    uint64_t time;   /* ms */
+    uint64_t seq;
+    uint64_t rng;
+
+    Sim_Node *nodes;
+    uint32_t num_nodes;
+    uint32_t max_nodes;
+
+    Sim_Packet *packets;   /* binary heap ordered by time and seq */
+    uint32_t num_packets;
+    uint32_t packets_size;
+};
+
+/* After net_sim_seed_random() the clocks of simulations start at SIM_SEEDED_UNIX_TIME instead of
+ * the time of the system, so that timeouts expire at the same simulated times every run.
+ */
+#define SIM_SEEDED_UNIX_TIME 1500000000
+
+static _Bool seeded;
+
+/* splitmix64 */
+static uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t sim_random(Net_Sim *sim)
+{
+    return splitmix64(&sim->rng);
+}
+
+#ifndef VANILLA_NACL
+
+/* State of the generator libsodium draws from after net_sim_seed_random() */
+static uint64_t seeded_rng;
+
+static const char *seeded_random_name(void)
+{
+    return "network_sim";
+}
+
+static uint32_t seeded_random(void)
+{
+    return splitmix64(&seeded_rng);
+}
+
+static void seeded_random_buf(void *const buf, const size_t size)
+{
+    uint8_t *bytes = buf;
+    size_t i;
+
+    for (i = 0; i < size; i += sizeof(uint64_t)) {
+        uint64_t value = splitmix64(&seeded_rng);
+        memcpy(bytes + i, &value, size - i < sizeof(uint64_t) ? size - i : sizeof(uint64_t));
+    }
+}
+
+static randombytes_implementation seeded_implementation = {
+    &seeded_random_name, &seeded_random, NULL, NULL, &seeded_random_buf, NULL
+};
+
+int net_sim_seed_random(uint64_t seed)
+{
+    seeded_rng = seed;
+
+    if (randombytes_set_implementation(&seeded_implementation) != 0)
+        return -1;
+
+    /* Initializes libsodium and seeds rand() from the clock, only the first time it runs */
+    if (networking_at_startup() != 0)
+        return -1;
+
+    srand(seed);
+    seeded = 1;
+    return 0;
+}
+
+#else
+
+int net_sim_seed_random(uint64_t seed)
+{
+    return -1;
+}
+
+#endif
+
+/* Every link has a fixed latency, the same both ways, so that its packets stay in order. */
+static uint32_t link_latency(const Net_Sim *sim, uint32_t a, uint32_t b)
+{
+    const Net_Sim_Options *options = &sim->options;
+
+    if (options->max_latency <= options->min_latency)
+        return options->min_latency;
+
+    uint64_t z = options->seed ^ ((uint64_t)(a < b ? a : b) << 32 | (a < b ? b : a));
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+
+    return options->min_latency + z % (options->max_latency - options->min_latency + 1);
+}
+
+/* The time of the simulation is in ms since the epoch, as a Net_Clock gives it. */
+static uint64_t sim_clock(void *object)
+{
+    const Net_Sim *sim = object;
+    return sim->time;
+}
+
+static _Bool packet_before(const Sim_Packet *a, const Sim_Packet *b)
+{
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static int heap_push(Net_Sim *sim, const Sim_Packet *packet)
+{
+    if (sim->num_packets == sim->packets_size) {
+        uint32_t size = sim->packets_size ? sim->packets_size * 2 : 1024;
+        Sim_Packet *temp = realloc(sim->packets, size * sizeof(Sim_Packet));
+
+        if (temp == NULL)
+            return -1;
+
+        sim->packets = temp;
+        sim->packets_size = size;
+    }
+
+    uint32_t i = sim->num_packets++;
+
+    while (i > 0 && packet_before(packet, &sim->packets[(i - 1) / 2])) {
+        sim->packets[i] = sim->packets[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+
+    sim->packets[i] = *packet;
+    return 0;
+}
+
+static void heap_pop(Net_Sim *sim, Sim_Packet *dest)
+{
+    *dest = sim->packets[0];
+    Sim_Packet last = sim->packets[--sim->num_packets];
+    uint32_t i = 0;
+
+    while (1) {
+        uint32_t child = i * 2 + 1;
+
+        if (child >= sim->num_packets)
+            break;
+
+        if (child + 1 < sim->num_packets && packet_before(&sim->packets[child + 1], &sim->packets[child]))
+            ++child;
+
+        if (!packet_before(&sim->packets[child], &last))
+            break;
+
+        sim->packets[i] = sim->packets[child];
+        i = child;
+    }
+
+    if (sim->num_packets > 0)
+        sim->packets[i] = last;
+}
+
+static IP_Port node_ip_port(uint32_t number)
+{
+    /* Zeroed with its padding, some of toxcore compares addresses with memcmp() */
+    IP_Port ip_port;
+    memset(&ip_port, 0, sizeof(ip_port));
+    ip_init(&ip_port.ip, 0);
+    ip_port.ip.ip4.uint32 = htonl(SIM_ADDRESS_BASE + number + 1);
+    ip_port.port = htons(SIM_PORT);
+    return ip_port;
+}
+
+/* return the number of the node at ip_port or -1 if there is none. */
+static int64_t find_node(const Net_Sim *sim, const IP_Port *ip_port)
+{
+    if (ip_port->ip.family != AF_INET || ip_port->port != htons(SIM_PORT))
+        return -1;
+
+    uint32_t number = ntohl(ip_port->ip.ip4.uint32) - SIM_ADDRESS_BASE - 1;
+
+    if (number >= sim->num_nodes)
+        return -1;
+
+    return number;
+}
+
+static int sim_send(void *object, IP_Port ip_port, const uint8_t *data, uint16_t length)
+{
+    Sim_Node *node = object;
+    Net_Sim *sim = node->sim;
+
+    ++node->stats.packets_sent;
+    node->stats.bytes_sent += length;
+
+    int64_t to = find_node(sim, &ip_port);
+
+    /* Like UDP, packets to addresses nobody has or lost on the way look sent to the sender */
+    if (to == -1)
+        return length;
+
+    if (sim->options.loss > 0 && (sim_random(sim) >> 11) * (1.0 / 9007199254740992.0) < sim->options.loss) {
+        ++node->stats.packets_lost;
+        return length;
+    }
+
+    Sim_Packet packet;
+    packet.time = sim->time + link_latency(sim, node->number, to);
+    packet.seq = sim->seq++;
+    packet.from = node->number;
+    packet.to = to;
+    packet.length = length;
+    packet.data = malloc(length);
+
+    if (packet.data == NULL)
+        return -1;
+
+    memcpy(packet.data, data, length);
+
+    if (heap_push(sim, &packet) == -1) {
+        free(packet.data);
+        return -1;
+    }
+
+    return length;
+}
+
+Net_Sim *new_net_sim(const Net_Sim_Options *options, uint32_t max_nodes)
+{
+    if (max_nodes == 0 || options->min_latency > options->max_latency)
+        return NULL;
+
+    Net_Sim *sim = calloc(1, sizeof(Net_Sim));
+
+    if (sim == NULL)
+        return NULL;
+
+    sim->nodes = calloc(max_nodes, sizeof(Sim_Node));
+
+    if (sim->nodes == NULL) {
+        free(sim);
+        return NULL;
+    }
+
+    sim->options = *options;
+    sim->max_nodes = max_nodes;
+    sim->rng = options->seed;
+    sim->time = (seeded ? SIM_SEEDED_UNIX_TIME : (uint64_t)time(NULL)) * 1000ULL;
+    return sim;
+}
+
+int net_sim_add_node(Net_Sim *sim, Net_Transport *transport, Net_Clock *clock)
+{
+    if (sim->num_nodes == sim->max_nodes)
+        return -1;
+
+    Sim_Node *node = &sim->nodes[sim->num_nodes];
+    node->sim = sim;
+    node->number = sim->num_nodes;
+
+    transport->send = &sim_send;
+    transport->object = node;
+    transport->ip_port = node_ip_port(node->number);
+
+    clock->function = &sim_clock;
+    clock->object = sim;
+
+    return sim->num_nodes++;
+}
+
+void net_sim_set_networking(Net_Sim *sim, uint32_t node, Networking_Core *net)
+{
+    if (node < sim->num_nodes)
+        sim->nodes[node].net = net;
+}
+
+uint64_t net_sim_time(const Net_Sim *sim)
+{
+    return sim->time;
+}
+
+uint64_t net_sim_run(Net_Sim *sim, uint64_t time)
+{
+    uint64_t delivered = 0;
+
+    while (sim->num_packets > 0 && sim->packets[0].time <= time) {
+        Sim_Packet packet;
+        heap_pop(sim, &packet);
+
+        if (packet.time > sim->time)
+            sim->time = packet.time;
+
+        Sim_Node *node = &sim->nodes[packet.to];
+
+        if (node->net) {
+            unix_time_update(node->net->mono_time);
+            ++node->stats.packets_received;
+            node->stats.bytes_received += packet.length;
+            networking_handle_packet(node->net, node_ip_port(packet.from), packet.data, packet.length);
+            ++delivered;
+        }
+
+        free(packet.data);
+    }
+
+    if (time > sim->time)
+        sim->time = time;
+
+    uint32_t i;
+
+    for (i = 0; i < sim->num_nodes; ++i) {
+        if (sim->nodes[i].net)
+            unix_time_update(sim->nodes[i].net->mono_time);
+    }
+
+    return delivered;
+}
+
+uint32_t net_sim_pending(const Net_Sim *sim)
+{
+    return sim->num_packets;
+}
+
+void net_sim_get_stats(const Net_Sim *sim, uint32_t node, Net_Sim_Stats *stats)
+{
+    if (node < sim->num_nodes)
+        *stats = sim->nodes[node].stats;
+    else
+        memset(stats, 0, sizeof(Net_Sim_Stats));
+}
+
+void kill_net_sim(Net_Sim *sim)
+{
+    if (sim == NULL)
+        return;
+
+    uint32_t i;
+
+    for (i = 0; i < sim->num_packets; ++i)
+        free(sim->packets[i].data);
+
+    free(sim->packets);
+    free(sim->nodes);
+    free(sim);
+}
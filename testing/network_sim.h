@@ -0,0 +1,109 @@
+/* network_sim.h
+ *
+ * Discrete event simulation of a network for running many nodes in one process.
+ *
+ * Nodes send through a Net_Transport given by the simulation, which queues every packet with the
+ * latency of its link and delivers it once the simulated clock reaches it. Nodes read the time
+ * from the clock of the simulation too, so they run as fast as the machine can iterate them
+ * instead of in real time.
+ *
+ * Link latencies and packet loss come from a generator seeded by the caller, so a simulation with
+ * the same seed delivers the same packets at the same times as long as the nodes send the same
+ * packets. With net_sim_seed_random() keys and nonces come from a seeded generator as well, and
+ * a single threaded simulation runs the same way every time.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef NETWORK_SIM_H
+#define NETWORK_SIM_H
+
+#include "../toxcore/network.h"
+
+typedef struct Net_Sim Net_Sim;
+
+typedef struct {
+    uint32_t min_latency;   /* ms, one way */
+    uint32_t max_latency;
+    double   loss;   /* share of the packets that are dropped, 0 to 1 */
+    uint64_t seed;
+} Net_Sim_Options;
+
+typedef struct {
+    uint64_t packets_sent;
+    uint64_t bytes_sent;   /* UDP payload */
+    uint64_t packets_received;
+    uint64_t bytes_received;
+    uint64_t packets_lost;   /* sent by the node and dropped by the simulation */
+} Net_Sim_Stats;
+
+/* Makes libsodium draw every key, nonce and random number of the process from a generator seeded
+ * with seed, the per-thread streams of random_bytes() included, as they are keyed from libsodium,
+ * and seeds rand() with it. Simulations created after it start their clock at a fixed time. The
+ * generator isn't secure, it's for simulations only.
+ *
+ * Must be called before the first instance of the process is created, as libsodium takes its
+ * generator before sodium_init() and networking_at_startup() seeds rand() from the clock, and
+ * before any thread draws random numbers.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int net_sim_seed_random(uint64_t seed);
+
+/* Creates a simulated network for up to max_nodes nodes. Its clock starts at the current time, or
+ * a fixed one after net_sim_seed_random().
+ *
+ * return NULL on failure.
+ */
+Net_Sim *new_net_sim(const Net_Sim_Options *options, uint32_t max_nodes);
+
+/* Adds a node with an address of its own and sets transport to the one it must send through and
+ * clock to the one of the simulation, to be passed to new_networking_transport() or as the
+ * transport and clock of Messenger_Options.
+ *
+ * return the node number on success.
+ * return -1 on failure.
+ */
+int net_sim_add_node(Net_Sim *sim, Net_Transport *transport, Net_Clock *clock);
+
+/* Sets the Networking_Core the packets for node are handed to.
+ * Packets for a node without one are dropped.
+ */
+void net_sim_set_networking(Net_Sim *sim, uint32_t node, Networking_Core *net);
+
+/* return the current time of the simulation in ms since the epoch. */
+uint64_t net_sim_time(const Net_Sim *sim);
+
+/* Delivers the packets due until time, in ms, in the order they are due and moves the clock to
+ * time. Packets sent by the handlers are delivered too if they are due by then.
+ *
+ * return the number of packets delivered.
+ */
+uint64_t net_sim_run(Net_Sim *sim, uint64_t time);
+
+/* return the number of packets on their way. */
+uint32_t net_sim_pending(const Net_Sim *sim);
+
+void net_sim_get_stats(const Net_Sim *sim, uint32_t node, Net_Sim_Stats *stats);
+
+/* Frees the simulation and the packets still on their way. Its nodes must be killed first. */
+void kill_net_sim(Net_Sim *sim);
+
+#endif
@@ -0,0 +1,263 @@
+/* onion_forward_bench.c
+ *
+ * Benchmark of the onion packets a node forwards per second, with the packets forwarded by the
+ * thread that polls the network and with a number of onion workers.
+ *
+ * A sender blasts onion packets of a number of clients, each with a key of its own, at a relay
+ * node over localhost. The relay forwards them to the second node of their paths, which counts
+ * them. For each number of workers it prints one line of comma separated values, after a
+ * header line:
+ *   workers          onion worker threads, 0 when the polling thread forwards the packets
+ *   sent             packets sent to the relay
+ *   forwarded        packets that reached the second node
+ *   per_second       forwarded packets per second
+ *   queue_dropped    packets dropped because a worker's queue was full
+ *
+ * The sender, the relay's polling thread and the second node share one thread, so the numbers
+ * only mean something on a machine with cores to spare for the workers.
+ *
+ * Usage: ./onion_forward_bench [worker counts, comma separated] [seconds] [clients]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/onion_workers.h"
+#include "../toxcore/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_COUNTS 16
+#define BENCH_BATCH 32
+#define BENCH_DATA_SIZE 200
+
+typedef struct {
+    uint16_t length;
+    uint8_t data[ONION_MAX_PACKET_SIZE];
+} Bench_Packet;
+
+static uint64_t forwarded;
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static int handle_forwarded(void *object, IP_Port source, const uint8_t *packet, uint16_t length)
+{
+    ++forwarded;
+    return 0;
+}
+
+static IP_Port get_ip_port(const Networking_Core *net)
+{
+    IP_Port ip_port;
+    ip_init(&ip_port.ip, 0);
+    ip_port.ip.ip4.uint32 = htonl(0x7F000001);
+    ip_port.port = net->port;
+    return ip_port;
+}
+
+/* Makes the onion packets of num_clients clients whose paths start at relay and go on to next. */
+static Bench_Packet *make_packets(uint32_t num_clients, const DHT *relay, const Networking_Core *next)
+{
+    Bench_Packet *packets = calloc(num_clients, sizeof(Bench_Packet));
+
+    if (packets == NULL)
+        return NULL;
+
+    Node_format nodes[ONION_PATH_LENGTH];
+    memcpy(nodes[0].public_key, relay->self_public_key, crypto_box_PUBLICKEYBYTES);
+    nodes[0].ip_port = get_ip_port(relay->net);
+    nodes[1].ip_port = get_ip_port(next);
+    nodes[2].ip_port = get_ip_port(next);
+
+    uint8_t secret_key[crypto_box_SECRETKEYBYTES], data[BENCH_DATA_SIZE];
+    randombytes(data, sizeof(data));
+
+    /* create_onion_path() takes the key of the first hop from a DHT */
+    DHT *client = calloc(1, sizeof(DHT));
+
+    if (client == NULL)
+        return NULL;
+
+    uint32_t i;
+
+    for (i = 0; i < num_clients; ++i) {
+        crypto_box_keypair(client->self_public_key, client->self_secret_key);
+        crypto_box_keypair(nodes[1].public_key, secret_key);
+        crypto_box_keypair(nodes[2].public_key, secret_key);
+
+        Onion_Path path;
+
+        if (create_onion_path(client, &path, nodes) == -1)
+            return NULL;
+
+        int length = create_onion_packet(packets[i].data, sizeof(packets[i].data), &path, nodes[2].ip_port, data,
+                                         sizeof(data));
+
+        if (length == -1)
+            return NULL;
+
+        packets[i].length = length;
+    }
+
+    free(client);
+    return packets;
+}
+
+static int run(uint32_t num_workers, uint32_t seconds, uint32_t num_clients)
+{
+    IP ip;
+    ip_init(&ip, 0);
+    ip.ip4.uint32 = htonl(0x7F000001);
+
+    Networking_Core *sender = new_networking(ip, TOX_PORTRANGE_FROM);
+    Networking_Core *next = new_networking(ip, TOX_PORTRANGE_FROM);
+    DHT *relay_dht = new_DHT(new_networking(ip, TOX_PORTRANGE_FROM));
+
+    if (sender == NULL || next == NULL || relay_dht == NULL)
+        return -1;
+
+    Onion *relay = new_onion(relay_dht);
+
+    if (relay == NULL)
+        return -1;
+
+    Onion_Workers *workers = NULL;
+
+    if (num_workers > 0) {
+        workers = new_onion_workers(relay, num_workers);
+
+        if (workers == NULL)
+            return -1;
+    }
+
+    networking_registerhandler(next, NET_PACKET_ONION_SEND_1, &handle_forwarded, NULL);
+
+    Bench_Packet *packets = make_packets(num_clients, relay_dht, next);
+
+    if (packets == NULL)
+        return -1;
+
+    IP_Port relay_ip_port = get_ip_port(relay_dht->net);
+    uint64_t sent = 0;
+    forwarded = 0;
+
+    double start = get_time();
+
+    while (get_time() - start < seconds) {
+        uint32_t i;
+
+        for (i = 0; i < BENCH_BATCH; ++i, ++sent) {
+            const Bench_Packet *packet = &packets[sent % num_clients];
+            sendpacket(sender, relay_ip_port, packet->data, packet->length);
+        }
+
+        networking_poll(relay_dht->net);
+
+        if (workers)
+            do_onion_workers(workers);
+
+        networking_poll(next);
+    }
+
+    double elapsed = get_time() - start;
+
+    /* Give the workers a moment to catch up with what they were given */
+    uint32_t i;
+
+    for (i = 0; i < 100; ++i) {
+        networking_poll(next);
+        usleep(1000);
+    }
+
+    uint64_t handled = 0, dropped = 0;
+
+    if (workers)
+        onion_workers_stats(workers, &handled, &dropped);
+
+    printf("%u,%llu,%llu,%.0f,%llu\n", num_workers, (unsigned long long)sent, (unsigned long long)forwarded,
+           forwarded / elapsed, (unsigned long long)dropped);
+
+    kill_onion_workers(workers);
+    kill_onion(relay);
+    Networking_Core *relay_net = relay_dht->net;
+    kill_DHT(relay_dht);
+    kill_networking(relay_net);
+    kill_networking(next);
+    kill_networking(sender);
+    free(packets);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t counts[BENCH_MAX_COUNTS] = {0, 1, 2, 4};
+    uint32_t num_counts = 4;
+    uint32_t seconds = 5;
+    uint32_t num_clients = 256;
+
+    if (argc > 1) {
+        char *list = argv[1];
+        num_counts = 0;
+
+        while (*list && num_counts < BENCH_MAX_COUNTS) {
+            counts[num_counts++] = strtoul(list, &list, 10);
+
+            if (*list == ',')
+                ++list;
+            else
+                break;
+        }
+    }
+
+    if (argc > 2)
+        seconds = atoi(argv[2]);
+
+    if (argc > 3)
+        num_clients = atoi(argv[3]);
+
+    if (num_counts == 0 || seconds == 0 || num_clients == 0) {
+        printf("Usage: %s [worker counts, comma separated] [seconds] [clients]\n", argv[0]);
+        return 1;
+    }
+
+    printf("workers,sent,forwarded,per_second,queue_dropped\n");
+
+    uint32_t i;
+
+    for (i = 0; i < num_counts; ++i) {
+        if (counts[i] > MAX_ONION_WORKERS || run(counts[i], seconds, num_clients) == -1) {
+            printf("Benchmark with %u workers failed\n", counts[i]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,156 @@
+/* ping_array_bench.c
+ *
+ * Benchmark of the Ping_Array the DHT, the pings and the onion announces keep their outstanding
+ * requests in.
+ *
+ * Each cycle adds a ping and checks the response to the ping added a window of pings earlier, like
+ * a bootstrap node with that many requests in flight. Every tenth response is lost, its entry is
+ * overwritten when the array wraps around.
+ *
+ * It prints one line of comma separated values for each payload, after a header line:
+ *   payload    who adds pings of that size
+ *   bytes      payload size
+ *   cycles     add and check cycles
+ *   window     pings in flight
+ *   ns_cycle   nanoseconds per add and check
+ *   answered   checks that returned the payload that was added
+ *
+ * Usage: ./ping_array_bench [cycles] [window]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/DHT.h"
+#include "../toxcore/ping_array.h"
+#include "../toxcore/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Same as the arrays of the DHT */
+#define BENCH_ARRAY_SIZE DHT_PING_ARRAY_SIZE
+#define BENCH_TIMEOUT 5
+
+#define BENCH_LOSS_INTERVAL 10
+
+typedef struct {
+    const char *name;
+    uint32_t bytes;
+} Bench_Payload;
+
+static const Bench_Payload payloads[] = {
+    {"ping", crypto_box_PUBLICKEYBYTES + sizeof(IP_Port)},
+    {"getnodes", sizeof(Node_format)},
+    {"announce", sizeof(uint32_t) + crypto_box_PUBLICKEYBYTES + sizeof(IP_Port) + sizeof(uint32_t)},
+    {"hardening", sizeof(Node_format) * 2},
+};
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* return the number of answered pings, -1 on failure. */
+static int64_t run(const Mono_Time *mono_time, uint32_t bytes, uint32_t cycles, uint32_t window, double *seconds)
+{
+    Ping_Array array;
+    uint64_t *ping_ids = calloc(window, sizeof(uint64_t));
+    uint8_t data[sizeof(Node_format) * 2], out[sizeof(Node_format) * 2];
+
+    if (ping_ids == NULL || ping_array_init(&array, mono_time, BENCH_ARRAY_SIZE, BENCH_TIMEOUT, bytes) != 0)
+        return -1;
+
+    int64_t answered = 0;
+    uint32_t i;
+    double start = get_time();
+
+    for (i = 0; i < cycles; ++i) {
+        uint32_t slot = i % window;
+
+        if (i >= window && slot % BENCH_LOSS_INTERVAL != 0) {
+            uint32_t sent = i - window;
+
+            if (ping_array_check(out, sizeof(out), &array, ping_ids[slot]) == (int)bytes
+                    && memcmp(out, &sent, sizeof(sent)) == 0)
+                ++answered;
+        }
+
+        memset(data, i, bytes);
+        memcpy(data, &i, sizeof(i));
+        ping_ids[slot] = ping_array_add(&array, data, bytes);
+
+        if (ping_ids[slot] == 0)
+            return -1;
+    }
+
+    *seconds = get_time() - start;
+    ping_array_free_all(&array);
+    free(ping_ids);
+    return answered;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t cycles = 1000000;
+    uint32_t window = 256;
+
+    if (argc > 1)
+        cycles = atoi(argv[1]);
+
+    if (argc > 2)
+        window = atoi(argv[2]);
+
+    if (cycles == 0 || window == 0 || window > BENCH_ARRAY_SIZE) {
+        printf("Usage: %s [cycles] [window, at most %u]\n", argv[0], BENCH_ARRAY_SIZE);
+        return 1;
+    }
+
+    Mono_Time *mono_time = new_mono_time(NULL);
+
+    if (mono_time == NULL)
+        return 1;
+
+    printf("payload,bytes,cycles,window,ns_cycle,answered\n");
+
+    uint32_t i;
+
+    for (i = 0; i < sizeof(payloads) / sizeof(payloads[0]); ++i) {
+        double seconds = 0;
+        int64_t answered = run(mono_time, payloads[i].bytes, cycles, window, &seconds);
+
+        if (answered == -1) {
+            printf("Benchmark failed\n");
+            return 1;
+        }
+
+        printf("%s,%u,%u,%u,%.1f,%lld\n", payloads[i].name, payloads[i].bytes, cycles, window,
+               seconds * 1000000000.0 / cycles, (long long)answered);
+    }
+
+    kill_mono_time(mono_time);
+    return 0;
+}
@@ -0,0 +1,153 @@
+/* random_bench.c
+ *
+ * Benchmark of the random numbers toxcore uses for nonces and ping ids, taken from the OS for each
+ * call (libsodium randombytes()) and from the buffered stream of crypto_core.
+ *
+ * For each kind of request it prints one line of comma separated values, after a header line:
+ *   request      what is asked for: a random_int(), a ping id, a nonce or a 64 byte block
+ *   bytes        size of one request
+ *   threads      threads asking at the same time
+ *   os_ns        nanoseconds per request from randombytes()
+ *   buffered_ns  nanoseconds per request from the buffered stream
+ *   speedup      os_ns / buffered_ns
+ *
+ * Usage: ./random_bench [requests per thread] [threads]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "../toxcore/crypto_core.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_BYTES 64
+
+typedef struct {
+    const char *name;
+    uint32_t bytes;
+} Bench_Request;
+
+static const Bench_Request requests[] = {
+    {"int", sizeof(uint32_t)},
+    {"ping_id", sizeof(uint64_t)},
+    {"nonce", crypto_box_NONCEBYTES},
+    {"block", BENCH_MAX_BYTES},
+};
+
+typedef struct {
+    uint32_t bytes;
+    uint32_t count;
+    _Bool buffered;
+    uint8_t sink;   /* keeps the compiler from dropping the output */
+    pthread_t thread;
+} Bench_Thread;
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void *take(void *arg)
+{
+    Bench_Thread *thread = arg;
+    uint8_t out[BENCH_MAX_BYTES];
+    uint32_t i;
+
+    for (i = 0; i < thread->count; ++i) {
+        if (thread->buffered)
+            random_bytes(out, thread->bytes);
+        else
+            randombytes(out, thread->bytes);
+
+        thread->sink ^= out[0];
+    }
+
+    return NULL;
+}
+
+/* return the nanoseconds one request took on average, -1 on failure. */
+static double measure(uint32_t bytes, uint32_t count, uint32_t num_threads, _Bool buffered)
+{
+    Bench_Thread threads[BENCH_MAX_THREADS];
+    uint32_t i;
+
+    memset(threads, 0, sizeof(threads));
+    double start = get_time();
+
+    for (i = 0; i < num_threads; ++i) {
+        threads[i].bytes = bytes;
+        threads[i].count = count;
+        threads[i].buffered = buffered;
+
+        if (pthread_create(&threads[i].thread, NULL, &take, &threads[i]) != 0)
+            return -1;
+    }
+
+    for (i = 0; i < num_threads; ++i)
+        pthread_join(threads[i].thread, NULL);
+
+    return (get_time() - start) * 1000000000.0 / ((double)count * num_threads);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t count = 1000000;
+    uint32_t num_threads = 1;
+
+    if (argc > 1)
+        count = atoi(argv[1]);
+
+    if (argc > 2)
+        num_threads = atoi(argv[2]);
+
+    if (count == 0 || num_threads == 0 || num_threads > BENCH_MAX_THREADS) {
+        printf("Usage: %s [requests per thread] [threads]\n", argv[0]);
+        return 1;
+    }
+
+    printf("request,bytes,threads,os_ns,buffered_ns,speedup\n");
+
+    uint32_t i;
+
+    for (i = 0; i < sizeof(requests) / sizeof(requests[0]); ++i) {
+        double os_ns = measure(requests[i].bytes, count, num_threads, 0);
+        double buffered_ns = measure(requests[i].bytes, count, num_threads, 1);
+
+        if (os_ns < 0 || buffered_ns < 0) {
+            printf("Benchmark failed\n");
+            return 1;
+        }
+
+        printf("%s,%u,%u,%.1f,%.1f,%.1f\n", requests[i].name, requests[i].bytes, num_threads, os_ns, buffered_ns,
+               os_ns / buffered_ns);
+    }
+
+    return 0;
+}
@@ -0,0 +1,352 @@
+/* reconnect_bench.c
+ *
+ * Benchmark of how long the friends of a restarted client take to come back online, with and
+ * without the friend connection cache in its savedata.
+ *
+ * A client and its friends run on a simulated network of other nodes, see network_sim.h. Once the
+ * friends are online the client is saved, killed and, after a while, started again from the save on
+ * the same address. In cold mode the cache is removed from the save first, so that the client has to
+ * find each friend through the onion like before the cache existed. The friends stay up throughout.
+ *
+ * It prints one line of comma separated values for each mode, after a header line:
+ *   mode      cold or warm
+ *   friends   number of friends of the client
+ *   online    friends that came back online before the timeout
+ *   median_s  simulated seconds from the restart until a friend was online again, over the friends
+ *   p95_s     that came back
+ *   max_s
+ *
+ * Usage: ./reconnect_bench [friends] [simulated seconds of downtime]
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "network_sim.h"
+#include "../toxcore/Messenger.h"
+#include "../toxcore/group_chats.h"
+#include "../toxcore/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_BOOTSTRAP_NODES 4
+#define BENCH_OTHER_NODES 32   /* nodes of the simulated network besides the client and its friends */
+#define BENCH_MIN_LATENCY 10   /* ms, one way */
+#define BENCH_MAX_LATENCY 150
+#define BENCH_SEED 42
+
+/* How often everything runs, like a client calling tox_iterate() */
+#define BENCH_ITERATE_INTERVAL 50   /* ms */
+
+/* How often a node that isn't in the DHT bootstraps again */
+#define BENCH_BOOTSTRAP_INTERVAL 5000   /* ms */
+
+/* Simulated time the friends get to connect the first time, the network gets to settle after that
+ * and the friends get to come back after the restart */
+#define BENCH_CONNECT_TIMEOUT 600000   /* ms */
+#define BENCH_SETTLE_TIME 60000   /* ms */
+#define BENCH_RECONNECT_TIMEOUT 600000   /* ms */
+
+/* Savedata section of the friend connection cache, see Messenger.c */
+#define BENCH_CACHE_SECTION 12
+
+typedef struct {
+    uint32_t online;
+    double median;
+    double p95;
+    double max;
+} Bench_Result;
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void kill_node(Messenger *m)
+{
+    kill_groupchats(m->group_handler);
+    kill_messenger(m);
+}
+
+/* Bootstraps dht from one of the bootstrap nodes if it isn't connected, at most every
+ * BENCH_BOOTSTRAP_INTERVAL.
+ */
+static void keep_bootstrapped(DHT *dht, uint64_t *last_bootstrap, uint64_t now, Messenger **nodes, uint32_t index)
+{
+    if (DHT_isconnected(dht) || (*last_bootstrap != 0 && now < *last_bootstrap + BENCH_BOOTSTRAP_INTERVAL))
+        return;
+
+    uint32_t j = (index + 1) % BENCH_BOOTSTRAP_NODES;
+    DHT_bootstrap(dht, nodes[j]->options.transport.ip_port, nodes[j]->dht->self_public_key);
+    *last_bootstrap = now;
+}
+
+static uint32_t read_lendian32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/* Removes the sections of type from the savedata, see load_state().
+ *
+ * return the new length.
+ */
+static uint32_t remove_section(uint8_t *data, uint32_t length, uint16_t type)
+{
+    uint32_t pos = sizeof(uint32_t) * 2, end = length;
+
+    while (end - pos >= sizeof(uint32_t) * 2) {
+        uint32_t section_length = read_lendian32(data + pos);
+        uint32_t section_type = read_lendian32(data + pos + sizeof(uint32_t));
+        uint32_t total = sizeof(uint32_t) * 2 + section_length;
+
+        if (total > end - pos)
+            break;
+
+        if ((section_type & 0xFFFF) == type) {
+            memmove(data + pos, data + pos + total, end - pos - total);
+            end -= total;
+        } else {
+            pos += total;
+        }
+    }
+
+    return end;
+}
+
+/* Runs everything for one interval.
+ *
+ * return the new time of the simulation.
+ */
+static uint64_t iterate(Net_Sim *sim, Messenger **nodes, Messenger *client, Messenger **friends, uint32_t num_friends,
+                        uint64_t *last_bootstrap)
+{
+    uint64_t now = net_sim_time(sim) + BENCH_ITERATE_INTERVAL;
+    net_sim_run(sim, now);
+    uint32_t i;
+
+    for (i = 0; i < BENCH_OTHER_NODES; ++i) {
+        keep_bootstrapped(nodes[i]->dht, &last_bootstrap[i], now, nodes, i);
+        do_messenger(nodes[i]);
+    }
+
+    for (i = 0; i < num_friends; ++i) {
+        keep_bootstrapped(friends[i]->dht, &last_bootstrap[BENCH_OTHER_NODES + i], now, nodes, i);
+        do_messenger(friends[i]);
+    }
+
+    if (client) {
+        keep_bootstrapped(client->dht, &last_bootstrap[BENCH_OTHER_NODES + num_friends], now, nodes, num_friends);
+        do_messenger(client);
+    }
+
+    return now;
+}
+
+static uint32_t count_online(const Messenger *client, uint32_t num_friends)
+{
+    uint32_t i, online = 0;
+
+    for (i = 0; i < num_friends; ++i)
+        online += m_get_friend_connectionstatus(client, i) != CONNECTION_NONE;
+
+    return online;
+}
+
+static int run(uint32_t num_friends, uint32_t downtime, _Bool warm, Bench_Result *result)
+{
+    uint32_t num_nodes = BENCH_OTHER_NODES + num_friends + 1;
+    Net_Sim_Options sim_options = {BENCH_MIN_LATENCY, BENCH_MAX_LATENCY, 0, BENCH_SEED};
+    Net_Sim *sim = new_net_sim(&sim_options, num_nodes);
+    Messenger **nodes = calloc(BENCH_OTHER_NODES, sizeof(Messenger *));
+    Messenger **friends = calloc(num_friends, sizeof(Messenger *));
+    uint64_t *last_bootstrap = calloc(num_nodes, sizeof(uint64_t));
+    uint64_t *online_time = calloc(num_friends, sizeof(uint64_t));
+
+    if (sim == NULL || nodes == NULL || friends == NULL || last_bootstrap == NULL || online_time == NULL)
+        return -1;
+
+    uint32_t i;
+
+    for (i = 0; i < BENCH_OTHER_NODES + num_friends; ++i) {
+        Messenger_Options options = {0};
+        int node = net_sim_add_node(sim, &options.transport, &options.clock);
+        Messenger *m = new_messenger(&options, 0);
+
+        if (node == -1 || m == NULL)
+            return -1;
+
+        net_sim_set_networking(sim, node, m->net);
+
+        if (i < BENCH_OTHER_NODES) {
+            nodes[i] = m;
+        } else {
+            friends[i - BENCH_OTHER_NODES] = m;
+        }
+    }
+
+    Messenger_Options client_options = {0};
+    int client_node = net_sim_add_node(sim, &client_options.transport, &client_options.clock);
+    Messenger *client = new_messenger(&client_options, 0);
+
+    if (client_node == -1 || client == NULL)
+        return -1;
+
+    net_sim_set_networking(sim, client_node, client->net);
+
+    /* The first time round the friends learn each other's DHT key and address right away */
+    for (i = 0; i < num_friends; ++i) {
+        if (m_addfriend_norequest(client, friends[i]->net_crypto->self_public_key) != (int32_t)i
+                || m_addfriend_norequest(friends[i], client->net_crypto->self_public_key) != 0)
+            return -1;
+
+        set_dht_temp_pk(client->fr_c, client->friendlist[i].friendcon_id, friends[i]->dht->self_public_key);
+        set_dht_temp_pk(friends[i]->fr_c, friends[i]->friendlist[0].friendcon_id, client->dht->self_public_key);
+        DHT_bootstrap(client->dht, friends[i]->options.transport.ip_port, friends[i]->dht->self_public_key);
+    }
+
+    uint64_t end = net_sim_time(sim) + BENCH_CONNECT_TIMEOUT;
+
+    while (count_online(client, num_friends) < num_friends && net_sim_time(sim) < end)
+        iterate(sim, nodes, client, friends, num_friends, last_bootstrap);
+
+    if (count_online(client, num_friends) < num_friends) {
+        printf("Only %u of %u friends connected\n", count_online(client, num_friends), num_friends);
+        return -1;
+    }
+
+    /* Long enough for the onion announces and the relays to be shared */
+    end = net_sim_time(sim) + BENCH_SETTLE_TIME;
+
+    while (net_sim_time(sim) < end)
+        iterate(sim, nodes, client, friends, num_friends, last_bootstrap);
+
+    uint32_t length = messenger_size(client);
+    uint8_t *save = malloc(length);
+
+    if (save == NULL)
+        return -1;
+
+    messenger_save(client, save);
+
+    if (!warm)
+        length = remove_section(save, length, BENCH_CACHE_SECTION);
+
+    kill_node(client);
+    net_sim_set_networking(sim, client_node, NULL);
+    end = net_sim_time(sim) + downtime * 1000ULL;
+
+    while (net_sim_time(sim) < end)
+        iterate(sim, nodes, NULL, friends, num_friends, last_bootstrap);
+
+    /* Same address as before, like a client restarted on the same machine */
+    client = new_messenger(&client_options, 0);
+
+    if (client == NULL || messenger_load(client, save, length) != 0)
+        return -1;
+
+    net_sim_set_networking(sim, client_node, client->net);
+    last_bootstrap[BENCH_OTHER_NODES + num_friends] = 0;
+
+    uint64_t start = net_sim_time(sim);
+    end = start + BENCH_RECONNECT_TIMEOUT;
+    result->online = 0;
+
+    while (result->online < num_friends && net_sim_time(sim) < end) {
+        uint64_t now = iterate(sim, nodes, client, friends, num_friends, last_bootstrap);
+
+        for (i = 0; i < num_friends; ++i) {
+            if (online_time[i] == 0 && m_get_friend_connectionstatus(client, i) != CONNECTION_NONE) {
+                online_time[i] = now - start;
+                ++result->online;
+            }
+        }
+    }
+
+    uint32_t online = 0;
+
+    for (i = 0; i < num_friends; ++i) {
+        if (online_time[i] != 0)
+            online_time[online++] = online_time[i];
+    }
+
+    qsort(online_time, online, sizeof(uint64_t), cmp_u64);
+
+    if (online != 0) {
+        result->median = online_time[online / 2] / 1000.0;
+        result->p95 = online_time[(online * 95 - 1) / 100] / 1000.0;
+        result->max = online_time[online - 1] / 1000.0;
+    }
+
+    kill_node(client);
+
+    for (i = 0; i < num_friends; ++i)
+        kill_node(friends[i]);
+
+    for (i = 0; i < BENCH_OTHER_NODES; ++i)
+        kill_node(nodes[i]);
+
+    kill_net_sim(sim);
+    free(save);
+    free(online_time);
+    free(last_bootstrap);
+    free(friends);
+    free(nodes);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_friends = 100;
+    uint32_t downtime = 30;
+
+    if (argc > 1)
+        num_friends = atoi(argv[1]);
+
+    if (argc > 2)
+        downtime = atoi(argv[2]);
+
+    if (num_friends == 0) {
+        printf("Usage: %s [friends] [simulated seconds of downtime]\n", argv[0]);
+        return 1;
+    }
+
+    printf("mode,friends,online,median_s,p95_s,max_s\n");
+
+    uint32_t warm;
+
+    for (warm = 0; warm < 2; ++warm) {
+        Bench_Result result = {0};
+
+        if (run(num_friends, downtime, warm, &result) == -1) {
+            printf("Benchmark failed\n");
+            return 1;
+        }
+
+        printf("%s,%u,%u,%.2f,%.2f,%.2f\n", warm ? "warm" : "cold", num_friends, result.online, result.median, result.p95,
+               result.max);
+    }
+
+    return 0;
+}
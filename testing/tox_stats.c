@@ -0,0 +1,325 @@
+/* tox_stats.c
+ *
+ * Runs a Tox instance and prints its connection statistics as JSON, one object per line (JSON
+ * Lines) every interval, for feeding into a monitoring system or just piping through jq.
+ *
+ * Each line has:
+ *   time     unix time of the snapshot
+ *   self     the counters of the instance as a whole, see struct Tox_Stats
+ *   friends  one object per friend, see struct Tox_Friend_Stats
+ *   relays   one object per TCP relay connection, see struct Tox_Relay_Stats
+ *
+ * Histograms are arrays of TOX_STATS_HISTOGRAM_BUCKETS counts, drops an object keyed by reason.
+ *
+ * Usage: ./tox_stats [-f savedata] [-i seconds between lines] [-n number of lines]
+ *                    [ip port public_key (of a DHT bootstrap node)]...
+ *
+ * With -f, the instance is loaded from and saved back to the savedata file, so that it can be run
+ * as the account whose connections are to be watched.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../toxcore/tox.h"
+#include "misc_tools.c"
+
+static const char *drop_names[TOX_STATS_DROP_REASONS] = {"decrypt", "window", "state", "invalid"};
+
+static void print_hex(const uint8_t *data, size_t length)
+{
+    size_t i;
+
+    putchar('"');
+
+    for (i = 0; i < length; ++i)
+        printf("%02X", data[i]);
+
+    putchar('"');
+}
+
+static void print_histogram(const char *name, const uint64_t *histogram)
+{
+    unsigned int i;
+
+    printf("\"%s\":[", name);
+
+    for (i = 0; i < TOX_STATS_HISTOGRAM_BUCKETS; ++i)
+        printf("%s%" PRIu64, i ? "," : "", histogram[i]);
+
+    putchar(']');
+}
+
+/* JSON has no NaN or infinity. */
+static double json_number(double value)
+{
+    return isfinite(value) ? value : 0;
+}
+
+static void print_counters(const struct Tox_Connection_Counters *counters)
+{
+    unsigned int i;
+
+    printf("\"packets_sent\":%" PRIu64 ",\"bytes_sent\":%" PRIu64 ",\"packets_sent_tcp\":%" PRIu64
+           ",\"packets_received\":%" PRIu64 ",\"bytes_received\":%" PRIu64 ",\"packets_received_tcp\":%" PRIu64
+           ",\"retransmits\":%" PRIu64 ",\"congestion_events\":%" PRIu64 ",\"drops\":{",
+           counters->packets_sent, counters->bytes_sent, counters->packets_sent_tcp, counters->packets_received,
+           counters->bytes_received, counters->packets_received_tcp, counters->retransmits,
+           counters->congestion_events);
+
+    for (i = 0; i < TOX_STATS_DROP_REASONS; ++i)
+        printf("%s\"%s\":%" PRIu64, i ? "," : "", drop_names[i], counters->drops[i]);
+
+    printf("},");
+    print_histogram("rtt_histogram", counters->rtt_histogram);
+}
+
+static void print_self(const Tox *tox)
+{
+    struct Tox_Stats stats;
+    tox_self_get_stats(tox, &stats);
+
+    printf("\"self\":{\"udp_packets_sent\":%" PRIu64 ",\"udp_bytes_sent\":%" PRIu64 ",\"udp_send_failures\":%" PRIu64
+           ",\"udp_packets_received\":%" PRIu64 ",\"udp_bytes_received\":%" PRIu64 ",\"udp_packets_unhandled\":%" PRIu64
+           ",\"connections\":%u,\"connections_established\":%u,\"connections_direct\":%u"
+           ",\"packets_no_connection\":%" PRIu64 ",\"tcp_relays\":%u,",
+           stats.udp_packets_sent, stats.udp_bytes_sent, stats.udp_send_failures, stats.udp_packets_received,
+           stats.udp_bytes_received, stats.udp_packets_unhandled, stats.connections, stats.connections_established,
+           stats.connections_direct, stats.packets_no_connection, stats.tcp_relays);
+    print_histogram("handshake_histogram", stats.handshake_histogram);
+    printf(",\"friends\":{");
+    print_counters(&stats.friends);
+    printf("}}");
+}
+
+static void print_friends(const Tox *tox)
+{
+    size_t num = tox_self_get_friend_list_size(tox);
+    uint32_t *friends = calloc(num + 1, sizeof(uint32_t));
+    size_t i, printed = 0;
+
+    if (!friends)
+        exit(1);
+
+    tox_self_get_friend_list(tox, friends);
+    printf("\"friends\":[");
+
+    for (i = 0; i < num; ++i) {
+        struct Tox_Friend_Stats stats;
+        uint8_t public_key[TOX_PUBLIC_KEY_SIZE];
+
+        if (!tox_friend_get_stats(tox, friends[i], &stats, NULL)
+                || !tox_friend_get_public_key(tox, friends[i], public_key, NULL))
+            continue;
+
+        printf("%s{\"friend\":%u,\"public_key\":", printed++ ? "," : "", friends[i]);
+        print_hex(public_key, sizeof(public_key));
+        printf(",\"connected\":%s,\"established\":%s,\"direct\":%s,\"online_tcp_relays\":%u"
+               ",\"send_rate\":%.2f,\"recv_rate\":%.2f,\"rtt\":%" PRIu64 ",\"smoothed_rtt\":%" PRIu64
+               ",\"send_queue\":%u,\"recv_queue\":%u,\"handshake_time\":%" PRIu64 ",\"since_congestion_event\":",
+               stats.connected ? "true" : "false", stats.established ? "true" : "false",
+               stats.direct ? "true" : "false",
+               stats.online_tcp_relays, json_number(stats.send_rate), json_number(stats.recv_rate), stats.rtt,
+               stats.smoothed_rtt, stats.send_queue, stats.recv_queue, stats.handshake_time);
+
+        if (stats.since_congestion_event == UINT64_MAX) {
+            printf("null,");
+        } else {
+            printf("%" PRIu64 ",", stats.since_congestion_event);
+        }
+
+        print_counters(&stats.counters);
+        putchar('}');
+    }
+
+    putchar(']');
+    free(friends);
+}
+
+static void print_relays(const Tox *tox)
+{
+    size_t num = tox_self_get_relay_stats(tox, NULL, 0);
+    struct Tox_Relay_Stats *relays = calloc(num + 1, sizeof(struct Tox_Relay_Stats));
+    size_t i;
+
+    if (!relays)
+        exit(1);
+
+    num = tox_self_get_relay_stats(tox, relays, num);
+    printf("\"relays\":[");
+
+    for (i = 0; i < num; ++i) {
+        const struct Tox_Relay_Stats *relay = &relays[i];
+
+        printf("%s{\"public_key\":", i ? "," : "");
+        print_hex(relay->public_key, sizeof(relay->public_key));
+        printf(",\"address\":\"%s\",\"port\":%u,\"connected\":%s,\"sleeping\":%s,\"onion\":%s,\"users\":%u"
+               ",\"reconnects\":%u,\"connected_for\":%" PRIu64 ",\"packets_sent\":%" PRIu64 ",\"bytes_sent\":%" PRIu64
+               ",\"packets_received\":%" PRIu64 ",\"bytes_received\":%" PRIu64 "}",
+               relay->address, relay->port, relay->connected ? "true" : "false", relay->sleeping ? "true" : "false",
+               relay->onion ? "true" : "false", relay->users, relay->reconnects, relay->connected_for,
+               relay->packets_sent, relay->bytes_sent, relay->packets_received, relay->bytes_received);
+    }
+
+    putchar(']');
+    free(relays);
+}
+
+static Tox *load_tox(const char *path)
+{
+    struct Tox_Options options;
+    tox_options_default(&options);
+
+    uint8_t *data = NULL;
+    FILE *file = path ? fopen(path, "rb") : NULL;
+
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        data = malloc(size > 0 ? size : 1);
+
+        if (!data || fread(data, 1, size, file) != (size_t)size) {
+            fprintf(stderr, "Failed to read %s\n", path);
+            exit(1);
+        }
+
+        options.savedata_type = TOX_SAVEDATA_TYPE_TOX_SAVE;
+        options.savedata_data = data;
+        options.savedata_length = size;
+        fclose(file);
+    }
+
+    Tox *tox = tox_new(&options, NULL);
+    free(data);
+    return tox;
+}
+
+static void save_tox(const Tox *tox, const char *path)
+{
+    size_t size = tox_get_savedata_size(tox);
+    uint8_t *data = malloc(size);
+    FILE *file = fopen(path, "wb");
+
+    if (!data || !file) {
+        fprintf(stderr, "Failed to save to %s\n", path);
+        exit(1);
+    }
+
+    tox_get_savedata(tox, data);
+
+    if (fwrite(data, 1, size, file) != size)
+        fprintf(stderr, "Failed to save to %s\n", path);
+
+    fclose(file);
+    free(data);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = NULL;
+    unsigned int interval = 10;
+    unsigned int lines = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:i:n:")) != -1) {
+        switch (opt) {
+            case 'f':
+                path = optarg;
+                break;
+
+            case 'i':
+                interval = atoi(optarg);
+                break;
+
+            case 'n':
+                lines = atoi(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-f savedata] [-i seconds] [-n lines] [ip port public_key]...\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if ((argc - optind) % 3 != 0) {
+        fprintf(stderr, "Bootstrap nodes are given as ip port public_key\n");
+        return 1;
+    }
+
+    Tox *tox = load_tox(path);
+
+    if (!tox) {
+        fprintf(stderr, "Failed to create the Tox instance\n");
+        return 1;
+    }
+
+    int i;
+
+    for (i = optind; i < argc; i += 3) {
+        uint8_t *public_key = hex_string_to_bin(argv[i + 2]);
+
+        if (!tox_bootstrap(tox, argv[i], atoi(argv[i + 1]), public_key, NULL)
+                || !tox_add_tcp_relay(tox, argv[i], atoi(argv[i + 1]), public_key, NULL))
+            fprintf(stderr, "Failed to bootstrap from %s\n", argv[i]);
+
+        free(public_key);
+    }
+
+    unsigned int printed = 0;
+    uint64_t next_print = time(NULL) + interval;
+
+    while (lines == 0 || printed < lines) {
+        tox_iterate(tox);
+
+        if ((uint64_t)time(NULL) >= next_print) {
+            printf("{\"time\":%" PRIu64 ",", (uint64_t)time(NULL));
+            print_self(tox);
+            putchar(',');
+            print_friends(tox);
+            putchar(',');
+            print_relays(tox);
+            printf("}\n");
+            fflush(stdout);
+
+            next_print += interval;
+            ++printed;
+        }
+
+        usleep(tox_iteration_interval(tox) * 1000);
+    }
+
+    if (path)
+        save_tox(tox, path);
+
+    tox_kill(tox);
+    return 0;
+}
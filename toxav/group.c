@@ -87,13 +87,13 @@ static void terminate_queue(Group_JitterBuffer *q)
 
 /* Return 0 if packet was queued, -1 if it wasn't.
  */
-static int queue(Group_JitterBuffer *q, Group_Audio_Packet *pk)
+static int queue(const Mono_Time *mono_time, Group_JitterBuffer *q, Group_Audio_Packet *pk)
 {
     uint16_t sequnum = pk->sequnum;
 
     unsigned int num = sequnum % q->size;
 
-    if (!is_timeout(q->last_queued_time, GROUP_JBUF_DEAD_SECONDS)) {
+    if (!is_timeout(mono_time, q->last_queued_time, GROUP_JBUF_DEAD_SECONDS)) {
         if ((uint32_t)(sequnum - q->bottom) > (1 << 15)) {
             /* Drop old packet. */
             return -1;
@@ -105,7 +105,7 @@ static int queue(Group_JitterBuffer *q, Group_Audio_Packet *pk)
         q->bottom = sequnum - q->capacity;
         q->queue[num] = pk;
         q->top = sequnum + 1;
-        q->last_queued_time = unix_time();
+        q->last_queued_time = unix_time(mono_time);
         return 0;
     }
 
@@ -117,7 +117,7 @@ static int queue(Group_JitterBuffer *q, Group_Audio_Packet *pk)
     if ((sequnum - q->bottom) >= (q->top - q->bottom))
         q->top = sequnum + 1;
 
-    q->last_queued_time = unix_time();
+    q->last_queued_time = unix_time(mono_time);
     return 0;
 }
 
@@ -372,6 +372,7 @@ static int handle_group_audio_packet(void *object, int groupnumber, int friendgr
         return -1;
     }
 
+    const Group_AV *group_av = object;
     Group_Peer_AV *peer_av = peer_object;
 
     Group_Audio_Packet *pk = calloc(1, sizeof(Group_Audio_Packet) + (length - sizeof(uint16_t)));
@@ -386,7 +387,7 @@ static int handle_group_audio_packet(void *object, int groupnumber, int friendgr
     pk->length = length - sizeof(uint16_t);
     memcpy(pk->data, packet + sizeof(uint16_t), length - sizeof(uint16_t));
 
-    if (queue(peer_av->buffer, pk) == -1) {
+    if (queue(group_av->g_c->m->net->mono_time, peer_av->buffer, pk) == -1) {
         free(pk);
         return -1;
     }
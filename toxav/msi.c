@@ -468,7 +468,7 @@ static int timer_alloc (MSISession *session , void (*func)(Timer *), int call_id
     timer->func = func;
     timer->session = session;
     timer->call_idx = call_idx;
-    timer->timeout = timeout + current_time_monotonic(); /* In ms */
+    timer->timeout = timeout + current_time_monotonic(session->messenger_handle->net->mono_time); /* In ms */
     ++timer_id;
     timer->id = timer_id;
 
@@ -1597,7 +1597,7 @@ void msi_do(MSISession *session)
 
     TimerHandler *timer = session->timer_handler;
 
-    uint64_t time = current_time_monotonic();
+    uint64_t time = current_time_monotonic(session->messenger_handle->net->mono_time);
 
     while ( timer->timers[0] && timer->timers[0]->timeout < time ) {
         LOGGER_DEBUG("Executing timer assigned at: %d", timer->timers[0]->timeout);
@@ -258,7 +258,7 @@ uint8_t *add_ext_header ( RTPExtHeader *header, uint8_t *payload )
 /**
  * Builds header from control session values.
  */
-RTPHeader *build_header ( RTPSession *session )
+RTPHeader *build_header ( RTPSession *session, Mono_Time *mono_time )
 {
     RTPHeader *retu = calloc ( 1, sizeof (RTPHeader) );
 
@@ -275,7 +275,7 @@ RTPHeader *build_header ( RTPSession *session )
     ADD_SETTING_PAYLOAD ( retu, session->payload_type );
 
     retu->sequnum = session->sequnum;
-    retu->timestamp = current_time_monotonic(); /* milliseconds */
+    retu->timestamp = current_time_monotonic(mono_time); /* milliseconds */
     retu->ssrc = session->ssrc;
 
     int i;
@@ -372,7 +372,7 @@ int rtp_handle_packet ( Messenger *m, uint32_t friendnumber, const uint8_t *data
 /**
  * Allocate message and store data there
  */
-RTPMessage *rtp_new_message ( RTPSession *session, const uint8_t *data, uint32_t length )
+RTPMessage *rtp_new_message ( RTPSession *session, Mono_Time *mono_time, const uint8_t *data, uint32_t length )
 {
     if ( !session ) {
         LOGGER_WARNING("No session!");
@@ -388,7 +388,7 @@ RTPMessage *rtp_new_message ( RTPSession *session, const uint8_t *data, uint32_t
     }
 
     /* Sets header values and copies the extension header in retu */
-    retu->header = build_header ( session ); /* It allocates memory and all */
+    retu->header = build_header ( session, mono_time ); /* It allocates memory and all */
     retu->ext_header = session->ext_header;
 
 
@@ -424,7 +424,7 @@ RTPMessage *rtp_new_message ( RTPSession *session, const uint8_t *data, uint32_t
 
 int rtp_send_msg ( RTPSession *session, Messenger *messenger, const uint8_t *data, uint16_t length )
 {
-    RTPMessage *msg = rtp_new_message (session, data, length);
+    RTPMessage *msg = rtp_new_message (session, messenger->net->mono_time, data, length);
 
     if ( !msg ) return -1;
 
@@ -443,6 +443,30 @@ int rtp_send_msg ( RTPSession *session, Messenger *messenger, const uint8_t *dat
     return 0;
 }
 
+int rtp_set_fec ( RTPSession *session, Messenger *messenger, uint8_t num_data, uint8_t num_parity )
+{
+    int ret = m_set_lossy_fec(messenger, session->dest, session->prefix, num_data, num_parity);
+
+    if ( 0 != ret ) {
+        LOGGER_WARNING("Failed to set fec (data: %d parity: %d)! error: %i", num_data, num_parity, ret);
+        return rtp_ErrorSending;
+    }
+
+    return 0;
+}
+
+int rtp_flush_fec ( RTPSession *session, Messenger *messenger )
+{
+    int ret = m_flush_lossy_fec(messenger, session->dest, session->prefix);
+
+    if ( 0 != ret ) {
+        LOGGER_WARNING("Failed to flush fec! error: %i", ret);
+        return rtp_ErrorSending;
+    }
+
+    return 0;
+}
+
 void rtp_free_msg ( RTPSession *session, RTPMessage *msg )
 {
     if ( !session ) {
@@ -117,6 +117,18 @@ void rtp_kill ( RTPSession *session, Messenger *messenger );
  */
 int rtp_send_msg ( RTPSession *session, Messenger *messenger, const uint8_t *data, uint16_t length );
 
+/**
+ * Protect the messages sent by the session with forward error correction,
+ * num_parity parity packets are sent for every num_data messages.
+ * num_data 0 disables it.
+ */
+int rtp_set_fec ( RTPSession *session, Messenger *messenger, uint8_t num_data, uint8_t num_parity );
+
+/**
+ * Send the parity packets for the messages sent so far, at the end of a frame.
+ */
+int rtp_flush_fec ( RTPSession *session, Messenger *messenger );
+
 /**
  * Dealloc msg.
  */
@@ -58,6 +58,11 @@ const ToxAvCSettings av_DefaultSettings = {
     1
 };
 
+/* Video frames are split in up to VIDEO_FEC_DATA_PACKETS pieces protected by
+ * VIDEO_FEC_PARITY_PACKETS parity packets, flushed at the end of every frame. */
+#define VIDEO_FEC_DATA_PACKETS 10
+#define VIDEO_FEC_PARITY_PACKETS 2
+
 static const uint32_t jbuf_capacity = 6;
 static const uint8_t audio_index = 0, video_index = 1;
 
@@ -177,7 +182,7 @@ void toxav_do(ToxAv *av)
 {
     msi_do(av->msi_session);
 
-    uint64_t start = current_time_monotonic();
+    uint64_t start = current_time_monotonic(av->messenger->net->mono_time);
 
     uint32_t i = 0;
 
@@ -194,7 +199,7 @@ void toxav_do(ToxAv *av)
         }
     }
 
-    uint64_t end = current_time_monotonic();
+    uint64_t end = current_time_monotonic(av->messenger->net->mono_time);
 
     /* TODO maybe use variable for sizes */
     av->dectmsstotal += end - start;
@@ -346,6 +351,9 @@ int toxav_prepare_transmission ( ToxAv *av, int32_t call_index, int support_vide
         }
 
         call->crtps[video_index]->cs = call->cs;
+
+        /* Not fatal, the peer might not support it. */
+        rtp_set_fec(call->crtps[video_index], av->messenger, VIDEO_FEC_DATA_PACKETS, VIDEO_FEC_PARITY_PACKETS);
     }
 
     call->active = 1;
@@ -438,6 +446,9 @@ static int toxav_send_rtp_payload(ToxAv *av,
                 return av_ErrorSendingPayload;
         }
 
+        /* So that lost pieces can be recovered before the next frame starts. */
+        rtp_flush_fec(call->crtps[video_index], av->messenger);
+
         return av_ErrorNone;
 
     } else return av_ErrorNoRtpSession;
@@ -584,6 +595,32 @@ int toxav_send_audio ( ToxAv *av, int32_t call_index, const uint8_t *data, unsig
     return rc;
 }
 
+int toxav_set_fec ( ToxAv *av, int32_t call_index, ToxAvCallType type, uint8_t num_data, uint8_t num_parity )
+{
+    if (CALL_INVALID_INDEX(call_index, av->msi_session->max_calls)) {
+        LOGGER_WARNING("Invalid call index: %d", call_index);
+        return av_ErrorNoCall;
+    }
+
+    ToxAvCall *call = &av->calls[call_index];
+    pthread_mutex_lock(call->mutex);
+
+    if (!call->active) {
+        pthread_mutex_unlock(call->mutex);
+        LOGGER_WARNING("Action on inactive call: %d", call_index);
+        return av_ErrorInvalidState;
+    }
+
+    RTPSession *session = call->crtps[type == av_TypeAudio ? audio_index : video_index];
+    int rc = av_ErrorNoRtpSession;
+
+    if (session)
+        rc = rtp_set_fec(session, av->messenger, num_data, num_parity) == 0 ? av_ErrorNone : av_ErrorUnknown;
+
+    pthread_mutex_unlock(call->mutex);
+    return rc;
+}
+
 int toxav_get_peer_csettings ( ToxAv *av, int32_t call_index, int peer, ToxAvCSettings *dest )
 {
     if ( peer < 0 || CALL_INVALID_INDEX(call_index, av->msi_session->max_calls) ||
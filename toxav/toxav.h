@@ -249,6 +249,14 @@ int toxav_prepare_audio_frame ( ToxAv *av,
  */
 int toxav_send_audio ( ToxAv *av, int32_t call_index, const uint8_t *frame, unsigned int size);
 
+/**
+ * Protect the audio or video packets of the call with forward error correction:
+ * num_parity parity packets (at most 8) are sent for every num_data packets (at most 32)
+ * so that the peer can recover lost ones. num_data 0 disables it. Video is protected
+ * by default if the peer supports it.
+ */
+int toxav_set_fec ( ToxAv *av, int32_t call_index, ToxAvCallType type, uint8_t num_data, uint8_t num_parity );
+
 /**
  * Get codec settings from the peer. These were exchanged during call initialization
  * or when peer send us new csettings.
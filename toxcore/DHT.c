@@ -98,7 +98,8 @@ int id_closest(const uint8_t *id, const uint8_t *id1, const uint8_t *id2)
  * If shared key is already in shared_keys, copy it to shared_key.
  * else generate it into shared_key and copy it to shared_keys
  */
-void get_shared_key(Shared_Keys *shared_keys, uint8_t *shared_key, const uint8_t *secret_key, const uint8_t *client_id)
+void get_shared_key(const Mono_Time *mono_time, Shared_Keys *shared_keys, uint8_t *shared_key,
+                    const uint8_t *secret_key, const uint8_t *client_id)
 {
     uint32_t i, num = ~0, curr = 0;
 
@@ -109,12 +110,12 @@ void get_shared_key(Shared_Keys *shared_keys, uint8_t *shared_key, const uint8_t
             if (memcmp(client_id, shared_keys->keys[index].client_id, CLIENT_ID_SIZE) == 0) {
                 memcpy(shared_key, shared_keys->keys[index].shared_key, crypto_box_BEFORENMBYTES);
                 ++shared_keys->keys[index].times_requested;
-                shared_keys->keys[index].time_last_requested = unix_time();
+                shared_keys->keys[index].time_last_requested = unix_time(mono_time);
                 return;
             }
 
             if (num != 0) {
-                if (is_timeout(shared_keys->keys[index].time_last_requested, KEYS_TIMEOUT)) {
+                if (is_timeout(mono_time, shared_keys->keys[index].time_last_requested, KEYS_TIMEOUT)) {
                     num = 0;
                     curr = index;
                 } else if (num > shared_keys->keys[index].times_requested) {
@@ -137,7 +138,7 @@ void get_shared_key(Shared_Keys *shared_keys, uint8_t *shared_key, const uint8_t
         shared_keys->keys[curr].times_requested = 1;
         memcpy(shared_keys->keys[curr].client_id, client_id, CLIENT_ID_SIZE);
         memcpy(shared_keys->keys[curr].shared_key, shared_key, crypto_box_BEFORENMBYTES);
-        shared_keys->keys[curr].time_last_requested = unix_time();
+        shared_keys->keys[curr].time_last_requested = unix_time(mono_time);
     }
 }
 
@@ -146,7 +147,7 @@ void get_shared_key(Shared_Keys *shared_keys, uint8_t *shared_key, const uint8_t
  */
 void DHT_get_shared_key_recv(DHT *dht, uint8_t *shared_key, const uint8_t *client_id)
 {
-    get_shared_key(&dht->shared_keys_recv, shared_key, dht->self_secret_key, client_id);
+    get_shared_key(dht->mono_time, &dht->shared_keys_recv, shared_key, dht->self_secret_key, client_id);
 }
 
 /* Copy shared_key to encrypt/decrypt DHT packet from client_id into shared_key
@@ -154,7 +155,7 @@ void DHT_get_shared_key_recv(DHT *dht, uint8_t *shared_key, const uint8_t *clien
  */
 void DHT_get_shared_key_sent(DHT *dht, uint8_t *shared_key, const uint8_t *client_id)
 {
-    get_shared_key(&dht->shared_keys_sent, shared_key, dht->self_secret_key, client_id);
+    get_shared_key(dht->mono_time, &dht->shared_keys_sent, shared_key, dht->self_secret_key, client_id);
 }
 
 void to_net_family(IP *ip)
@@ -357,10 +358,11 @@ int unpack_nodes(Node_format *nodes, uint16_t max_num_nodes, uint16_t *processed
  *
  *  return True(1) or False(0)
  */
-static int client_or_ip_port_in_list(Client_data *list, uint16_t length, const uint8_t *client_id, IP_Port ip_port)
+static int client_or_ip_port_in_list(const Mono_Time *mono_time, Client_data *list, uint16_t length,
+                                     const uint8_t *client_id, IP_Port ip_port)
 {
     uint32_t i;
-    uint64_t temp_time = unix_time();
+    uint64_t temp_time = unix_time(mono_time);
 
     /* if client_id is in list, find it and maybe overwrite ip_port */
     for (i = 0; i < length; ++i)
@@ -478,7 +480,7 @@ static uint8_t hardening_correct(const Hardening *h)
 /*
  * helper for get_close_nodes(). argument list is a monster :D
  */
-static void get_close_nodes_inner(const uint8_t *client_id, Node_format *nodes_list,
+static void get_close_nodes_inner(const Mono_Time *mono_time, const uint8_t *client_id, Node_format *nodes_list,
                                   sa_family_t sa_family, const Client_data *client_list, uint32_t client_list_length,
                                   uint32_t *num_nodes_ptr, uint8_t is_LAN, uint8_t want_good)
 {
@@ -511,7 +513,7 @@ static void get_close_nodes_inner(const uint8_t *client_id, Node_format *nodes_l
         }
 
         /* node not in a good condition? */
-        if (is_timeout(ipptp->timestamp, BAD_NODE_TIMEOUT))
+        if (is_timeout(mono_time, ipptp->timestamp, BAD_NODE_TIMEOUT))
             continue;
 
         /* don't send LAN ips to non LAN peers */
@@ -567,7 +569,7 @@ static int get_somewhat_close_nodes(const DHT *dht, const uint8_t *client_id, No
                                     sa_family_t sa_family, uint8_t is_LAN, uint8_t want_good)
 {
     uint32_t num_nodes = 0, i;
-    get_close_nodes_inner(client_id, nodes_list, sa_family,
+    get_close_nodes_inner(dht->mono_time, client_id, nodes_list, sa_family,
                           dht->close_clientlist, LCLIENT_LIST, &num_nodes, is_LAN, want_good);
 
     /*TODO uncomment this when hardening is added to close friend clients
@@ -577,7 +579,7 @@ static int get_somewhat_close_nodes(const DHT *dht, const uint8_t *client_id, No
                                   &num_nodes, is_LAN, want_good);
     */
     for (i = 0; i < dht->num_friends; ++i)
-        get_close_nodes_inner(client_id, nodes_list, sa_family,
+        get_close_nodes_inner(dht->mono_time, client_id, nodes_list, sa_family,
                               dht->friends_list[i].client_list, MAX_FRIEND_CLIENTS,
                               &num_nodes, is_LAN, 0);
 
@@ -644,14 +646,24 @@ int get_close_nodes(const DHT *dht, const uint8_t *client_id, Node_format *nodes
 #endif
 }
 
-static uint8_t cmp_public_key[crypto_box_PUBLICKEYBYTES];
+/* Entries are sorted along with the key they are compared to, so that instances on different
+ * threads can sort their lists at the same time.
+ */
+typedef struct {
+    const Mono_Time *mono_time;
+    const uint8_t *base_public_key;
+    Client_data entry;
+} Cmp_data;
+
 static int cmp_dht_entry(const void *a, const void *b)
 {
-    Client_data entry1, entry2;
-    memcpy(&entry1, a, sizeof(Client_data));
-    memcpy(&entry2, b, sizeof(Client_data));
-    int t1 = is_timeout(entry1.assoc4.timestamp, BAD_NODE_TIMEOUT) && is_timeout(entry1.assoc6.timestamp, BAD_NODE_TIMEOUT);
-    int t2 = is_timeout(entry2.assoc4.timestamp, BAD_NODE_TIMEOUT) && is_timeout(entry2.assoc6.timestamp, BAD_NODE_TIMEOUT);
+    const Cmp_data *cmp1 = a, *cmp2 = b;
+    const Client_data *entry1 = &cmp1->entry, *entry2 = &cmp2->entry;
+    const Mono_Time *mono_time = cmp1->mono_time;
+    int t1 = is_timeout(mono_time, entry1->assoc4.timestamp, BAD_NODE_TIMEOUT)
+             && is_timeout(mono_time, entry1->assoc6.timestamp, BAD_NODE_TIMEOUT);
+    int t2 = is_timeout(mono_time, entry2->assoc4.timestamp, BAD_NODE_TIMEOUT)
+             && is_timeout(mono_time, entry2->assoc6.timestamp, BAD_NODE_TIMEOUT);
 
     if (t1 && t2)
         return 0;
@@ -662,10 +674,10 @@ static int cmp_dht_entry(const void *a, const void *b)
     if (t2)
         return 1;
 
-    t1 = hardening_correct(&entry1.assoc4.hardening) != HARDENING_ALL_OK
-         && hardening_correct(&entry1.assoc6.hardening) != HARDENING_ALL_OK;
-    t2 = hardening_correct(&entry2.assoc4.hardening) != HARDENING_ALL_OK
-         && hardening_correct(&entry2.assoc6.hardening) != HARDENING_ALL_OK;
+    t1 = hardening_correct(&entry1->assoc4.hardening) != HARDENING_ALL_OK
+         && hardening_correct(&entry1->assoc6.hardening) != HARDENING_ALL_OK;
+    t2 = hardening_correct(&entry2->assoc4.hardening) != HARDENING_ALL_OK
+         && hardening_correct(&entry2->assoc6.hardening) != HARDENING_ALL_OK;
 
     if (t1 != t2) {
         if (t1)
@@ -675,7 +687,7 @@ static int cmp_dht_entry(const void *a, const void *b)
             return 1;
     }
 
-    int close = id_closest(cmp_public_key, entry1.client_id, entry2.client_id);
+    int close = id_closest(cmp1->base_public_key, entry1->client_id, entry2->client_id);
 
     if (close == 1)
         return 1;
@@ -686,14 +698,37 @@ static int cmp_dht_entry(const void *a, const void *b)
     return 0;
 }
 
+/* Sorts list with the entries that are timed out or failed hardening first and then from the
+ * furthest from base_public_key to the closest.
+ */
+static void sort_client_list(const Mono_Time *mono_time, Client_data *list, unsigned int length,
+                             const uint8_t *base_public_key)
+{
+    Cmp_data cmp_list[length];
+    unsigned int i;
+
+    for (i = 0; i < length; ++i) {
+        cmp_list[i].mono_time = mono_time;
+        cmp_list[i].base_public_key = base_public_key;
+        cmp_list[i].entry = list[i];
+    }
+
+    qsort(cmp_list, length, sizeof(Cmp_data), cmp_dht_entry);
+
+    for (i = 0; i < length; ++i)
+        list[i] = cmp_list[i].entry;
+}
+
 /* Is it ok to store node with client_id in client.
  *
  * return 0 if node can't be stored.
  * return 1 if it can.
  */
-static unsigned int store_node_ok(const Client_data *client, const uint8_t *client_id, const uint8_t *comp_client_id)
+static unsigned int store_node_ok(const Mono_Time *mono_time, const Client_data *client, const uint8_t *client_id,
+                                  const uint8_t *comp_client_id)
 {
-    if ((is_timeout(client->assoc4.timestamp, BAD_NODE_TIMEOUT) && is_timeout(client->assoc6.timestamp, BAD_NODE_TIMEOUT))
+    if ((is_timeout(mono_time, client->assoc4.timestamp, BAD_NODE_TIMEOUT)
+            && is_timeout(mono_time, client->assoc6.timestamp, BAD_NODE_TIMEOUT))
             || (id_closest(comp_client_id, client->client_id, client_id) == 2)) {
         return 1;
     } else {
@@ -714,7 +749,8 @@ static unsigned int store_node_ok(const Client_data *client, const uint8_t *clie
  *  than client_id.
  *
  *  returns True(1) when the item was stored, False(0) otherwise */
-static int replace_all(   Client_data    *list,
+static int replace_all(   const Mono_Time *mono_time,
+                          Client_data    *list,
                           uint16_t        length,
                           const uint8_t  *client_id,
                           IP_Port         ip_port,
@@ -723,12 +759,11 @@ static int replace_all(   Client_data    *list,
     if ((ip_port.ip.family != AF_INET) && (ip_port.ip.family != AF_INET6))
         return 0;
 
-    memcpy(cmp_public_key, comp_client_id, crypto_box_PUBLICKEYBYTES);
-    qsort(list, length, sizeof(Client_data), cmp_dht_entry);
+    sort_client_list(mono_time, list, length, comp_client_id);
 
     Client_data *client = &list[0];
 
-    if (store_node_ok(client, client_id, comp_client_id)) {
+    if (store_node_ok(mono_time, client, client_id, comp_client_id)) {
         IPPTsPng *ipptp_write = NULL;
         IPPTsPng *ipptp_clear = NULL;
 
@@ -742,7 +777,7 @@ static int replace_all(   Client_data    *list,
 
         id_copy(client->client_id, client_id);
         ipptp_write->ip_port = ip_port;
-        ipptp_write->timestamp = unix_time();
+        ipptp_write->timestamp = unix_time(mono_time);
 
         ip_reset(&ipptp_write->ret_ip_port.ip);
         ipptp_write->ret_ip_port.port = 0;
@@ -765,14 +800,14 @@ static int replace_all(   Client_data    *list,
  */
 static unsigned int ping_node_from_getnodes_ok(DHT *dht, const uint8_t *client_id)
 {
-    if (store_node_ok(&dht->close_clientlist[0], client_id, dht->self_public_key)) {
+    if (store_node_ok(dht->mono_time, &dht->close_clientlist[0], client_id, dht->self_public_key)) {
         return 1;
     }
 
     unsigned int i;
 
     for (i = 0; i < dht->num_friends; ++i) {
-        if (store_node_ok(&dht->friends_list[i].client_list[0], client_id, dht->self_public_key)) {
+        if (store_node_ok(dht->mono_time, &dht->friends_list[i].client_list[0], client_id, dht->self_public_key)) {
             return 1;
         }
     }
@@ -798,8 +833,8 @@ int addto_lists(DHT *dht, IP_Port ip_port, const uint8_t *client_id)
     /* NOTE: Current behavior if there are two clients with the same id is
      * to replace the first ip by the second.
      */
-    if (!client_or_ip_port_in_list(dht->close_clientlist, LCLIENT_LIST, client_id, ip_port)) {
-        if (replace_all(dht->close_clientlist, LCLIENT_LIST, client_id, ip_port, dht->self_public_key))
+    if (!client_or_ip_port_in_list(dht->mono_time, dht->close_clientlist, LCLIENT_LIST, client_id, ip_port)) {
+        if (replace_all(dht->mono_time, dht->close_clientlist, LCLIENT_LIST, client_id, ip_port, dht->self_public_key))
             used++;
     } else
         used++;
@@ -807,9 +842,9 @@ int addto_lists(DHT *dht, IP_Port ip_port, const uint8_t *client_id)
     DHT_Friend *friend_foundip = 0;
 
     for (i = 0; i < dht->num_friends; ++i) {
-        if (!client_or_ip_port_in_list(dht->friends_list[i].client_list,
+        if (!client_or_ip_port_in_list(dht->mono_time, dht->friends_list[i].client_list,
                                        MAX_FRIEND_CLIENTS, client_id, ip_port)) {
-            if (replace_all(dht->friends_list[i].client_list, MAX_FRIEND_CLIENTS,
+            if (replace_all(dht->mono_time, dht->friends_list[i].client_list, MAX_FRIEND_CLIENTS,
                             client_id, ip_port, dht->friends_list[i].client_id)) {
 
                 DHT_Friend *friend = &dht->friends_list[i];
@@ -847,7 +882,7 @@ int addto_lists(DHT *dht, IP_Port ip_port, const uint8_t *client_id)
         IPPTs ippts;
 
         ippts.ip_port = ip_port;
-        ippts.timestamp = unix_time();
+        ippts.timestamp = unix_time(dht->mono_time);
 
         Assoc_add_entry(dht->assoc, client_id, &ippts, NULL, used ? 1 : 0);
     }
@@ -862,7 +897,7 @@ int addto_lists(DHT *dht, IP_Port ip_port, const uint8_t *client_id)
 static int returnedip_ports(DHT *dht, IP_Port ip_port, const uint8_t *client_id, const uint8_t *nodeclient_id)
 {
     uint32_t i, j;
-    uint64_t temp_time = unix_time();
+    uint64_t temp_time = unix_time(dht->mono_time);
 
     uint32_t used = 0;
 
@@ -1326,7 +1361,7 @@ int DHT_getfriendip(const DHT *dht, const uint8_t *client_id, IP_Port *ip_port)
                     uint32_t a;
 
                     for (a = 0, assoc = &client->assoc6; a < 2; a++, assoc = &client->assoc4)
-                        if (!is_timeout(assoc->timestamp, BAD_NODE_TIMEOUT)) {
+                        if (!is_timeout(dht->mono_time, assoc->timestamp, BAD_NODE_TIMEOUT)) {
                             *ip_port = assoc->ip_port;
                             return 1;
                         }
@@ -1346,7 +1381,7 @@ static uint8_t do_ping_and_sendnode_requests(DHT *dht, uint64_t *lastgetnode, co
 {
     uint32_t i;
     uint8_t not_kill = 0;
-    uint64_t temp_time = unix_time();
+    uint64_t temp_time = unix_time(dht->mono_time);
 
     uint32_t num_nodes = 0;
     Client_data *client_list[list_count * 2];
@@ -1359,16 +1394,16 @@ static uint8_t do_ping_and_sendnode_requests(DHT *dht, uint64_t *lastgetnode, co
         uint32_t a;
 
         for (a = 0, assoc = &client->assoc6; a < 2; a++, assoc = &client->assoc4)
-            if (!is_timeout(assoc->timestamp, KILL_NODE_TIMEOUT)) {
+            if (!is_timeout(dht->mono_time, assoc->timestamp, KILL_NODE_TIMEOUT)) {
                 not_kill++;
 
-                if (is_timeout(assoc->last_pinged, PING_INTERVAL)) {
+                if (is_timeout(dht->mono_time, assoc->last_pinged, PING_INTERVAL)) {
                     send_ping_request(dht->ping, assoc->ip_port, client->client_id );
                     assoc->last_pinged = temp_time;
                 }
 
                 /* If node is good. */
-                if (!is_timeout(assoc->timestamp, BAD_NODE_TIMEOUT)) {
+                if (!is_timeout(dht->mono_time, assoc->timestamp, BAD_NODE_TIMEOUT)) {
                     client_list[num_nodes] = client;
                     assoc_list[num_nodes] = assoc;
                     ++num_nodes;
@@ -1376,7 +1411,8 @@ static uint8_t do_ping_and_sendnode_requests(DHT *dht, uint64_t *lastgetnode, co
             }
     }
 
-    if ((num_nodes != 0) && (is_timeout(*lastgetnode, GET_NODE_INTERVAL) || *bootstrap_times < MAX_BOOTSTRAP_TIMES)) {
+    if ((num_nodes != 0) && (is_timeout(dht->mono_time, *lastgetnode, GET_NODE_INTERVAL)
+                             || *bootstrap_times < MAX_BOOTSTRAP_TIMES)) {
         uint32_t rand_node = rand() % num_nodes;
         getnodes(dht, assoc_list[rand_node]->ip_port, client_list[rand_node]->client_id,
                  client_id, NULL);
@@ -1414,7 +1450,7 @@ static void do_Close(DHT *dht)
          *
          * so: reset all nodes to be BAD_NODE_TIMEOUT, but not
          * KILL_NODE_TIMEOUT, so we at least keep trying pings */
-        uint64_t badonly = unix_time() - BAD_NODE_TIMEOUT;
+        uint64_t badonly = unix_time(dht->mono_time) - BAD_NODE_TIMEOUT;
         size_t i, a;
 
         for (i = 0; i < LCLIENT_LIST; i++) {
@@ -1524,18 +1560,21 @@ static int friend_iplist(const DHT *dht, IP_Port *ip_portlist, uint16_t friend_n
         client = &(friend->client_list[i]);
 
         /* If ip is not zero and node is good. */
-        if (ip_isset(&client->assoc4.ret_ip_port.ip) && !is_timeout(client->assoc4.ret_timestamp, BAD_NODE_TIMEOUT)) {
+        if (ip_isset(&client->assoc4.ret_ip_port.ip)
+                && !is_timeout(dht->mono_time, client->assoc4.ret_timestamp, BAD_NODE_TIMEOUT)) {
             ipv4s[num_ipv4s] = client->assoc4.ret_ip_port;
             ++num_ipv4s;
         }
 
-        if (ip_isset(&client->assoc6.ret_ip_port.ip) && !is_timeout(client->assoc6.ret_timestamp, BAD_NODE_TIMEOUT)) {
+        if (ip_isset(&client->assoc6.ret_ip_port.ip)
+                && !is_timeout(dht->mono_time, client->assoc6.ret_timestamp, BAD_NODE_TIMEOUT)) {
             ipv6s[num_ipv6s] = client->assoc6.ret_ip_port;
             ++num_ipv6s;
         }
 
         if (id_equal(client->client_id, friend->client_id))
-            if (!is_timeout(client->assoc6.timestamp, BAD_NODE_TIMEOUT) || !is_timeout(client->assoc4.timestamp, BAD_NODE_TIMEOUT))
+            if (!is_timeout(dht->mono_time, client->assoc6.timestamp, BAD_NODE_TIMEOUT)
+                    || !is_timeout(dht->mono_time, client->assoc4.timestamp, BAD_NODE_TIMEOUT))
                 return 0; /* direct connectivity */
     }
 
@@ -1613,7 +1652,7 @@ int route_tofriend(const DHT *dht, const uint8_t *friend_id, const uint8_t *pack
 
             /* If ip is not zero and node is good. */
             if (ip_isset(&assoc->ret_ip_port.ip) &&
-                    !is_timeout(assoc->ret_timestamp, BAD_NODE_TIMEOUT)) {
+                    !is_timeout(dht->mono_time, assoc->ret_timestamp, BAD_NODE_TIMEOUT)) {
                 int retval = sendpacket(dht->net, assoc->ip_port, packet, length);
 
                 if ((unsigned int)retval == length) {
@@ -1659,7 +1698,8 @@ static int routeone_tofriend(DHT *dht, const uint8_t *friend_id, const uint8_t *
                 assoc = &client->assoc6;
 
             /* If ip is not zero and node is good. */
-            if (ip_isset(&assoc->ret_ip_port.ip) && !is_timeout(assoc->ret_timestamp, BAD_NODE_TIMEOUT)) {
+            if (ip_isset(&assoc->ret_ip_port.ip)
+                    && !is_timeout(dht->mono_time, assoc->ret_timestamp, BAD_NODE_TIMEOUT)) {
                 ip_list[n] = assoc->ip_port;
                 ++n;
             }
@@ -1727,7 +1767,7 @@ static int handle_NATping(void *object, IP_Port source, const uint8_t *source_pu
     if (packet[0] == NAT_PING_REQUEST) {
         /* 1 is reply */
         send_NATping(dht, source_pubkey, ping_id, NAT_PING_RESPONSE);
-        friend->nat.recvNATping_timestamp = unix_time();
+        friend->nat.recvNATping_timestamp = unix_time(dht->mono_time);
         return 0;
     } else if (packet[0] == NAT_PING_RESPONSE) {
         if (friend->nat.NATping_id == ping_id) {
@@ -1843,7 +1883,7 @@ static void punch_holes(DHT *dht, IP ip, uint16_t *port_list, uint16_t numports,
 static void do_NAT(DHT *dht)
 {
     uint32_t i;
-    uint64_t temp_time = unix_time();
+    uint64_t temp_time = unix_time(dht->mono_time);
 
     for (i = 0; i < dht->num_friends; ++i) {
         IP_Port ip_list[MAX_FRIEND_CLIENTS];
@@ -1973,7 +2013,7 @@ static uint32_t have_nodes_closelist(DHT *dht, Node_format *nodes, uint16_t num)
         IPPTsPng *temp = get_closelist_IPPTsPng(dht, nodes[i].public_key, nodes[i].ip_port.ip.family);
 
         if (temp) {
-            if (!is_timeout(temp->timestamp, BAD_NODE_TIMEOUT)) {
+            if (!is_timeout(dht->mono_time, temp->timestamp, BAD_NODE_TIMEOUT)) {
                 ++counter;
             }
         }
@@ -2037,7 +2077,7 @@ static int handle_hardening(void *object, IP_Port source, const uint8_t *source_
             if (temp == NULL)
                 return 1;
 
-            if (is_timeout(temp->hardening.send_nodes_timestamp, HARDENING_INTERVAL))
+            if (is_timeout(dht->mono_time, temp->hardening.send_nodes_timestamp, HARDENING_INTERVAL))
                 return 1;
 
             if (memcmp(temp->hardening.send_nodes_pingedid, source_pubkey, CLIENT_ID_SIZE) != 0)
@@ -2092,10 +2132,10 @@ uint16_t closelist_nodes(DHT *dht, Node_format *nodes, uint16_t max_num)
     for (i = LCLIENT_LIST; i != 0; --i) {
         IPPTsPng *assoc = NULL;
 
-        if (!is_timeout(list[i - 1].assoc4.timestamp, BAD_NODE_TIMEOUT))
+        if (!is_timeout(dht->mono_time, list[i - 1].assoc4.timestamp, BAD_NODE_TIMEOUT))
             assoc = &list[i - 1].assoc4;
 
-        if (!is_timeout(list[i - 1].assoc6.timestamp, BAD_NODE_TIMEOUT)) {
+        if (!is_timeout(dht->mono_time, list[i - 1].assoc6.timestamp, BAD_NODE_TIMEOUT)) {
             if (assoc == NULL)
                 assoc = &list[i - 1].assoc6;
             else if (rand() % 2)
@@ -2132,11 +2172,11 @@ void do_hardening(DHT *dht)
             sa_family = AF_INET6;
         }
 
-        if (is_timeout(cur_iptspng->timestamp, BAD_NODE_TIMEOUT))
+        if (is_timeout(dht->mono_time, cur_iptspng->timestamp, BAD_NODE_TIMEOUT))
             continue;
 
         if (cur_iptspng->hardening.send_nodes_ok == 0) {
-            if (is_timeout(cur_iptspng->hardening.send_nodes_timestamp, HARDENING_INTERVAL)) {
+            if (is_timeout(dht->mono_time, cur_iptspng->hardening.send_nodes_timestamp, HARDENING_INTERVAL)) {
                 Node_format rand_node = random_node(dht, sa_family);
 
                 if (!ipport_isset(&rand_node.ip_port))
@@ -2152,11 +2192,11 @@ void do_hardening(DHT *dht)
                 //TODO: The search id should maybe not be ours?
                 if (send_hardening_getnode_req(dht, &rand_node, &to_test, dht->self_public_key) > 0) {
                     memcpy(cur_iptspng->hardening.send_nodes_pingedid, rand_node.public_key, crypto_box_PUBLICKEYBYTES);
-                    cur_iptspng->hardening.send_nodes_timestamp = unix_time();
+                    cur_iptspng->hardening.send_nodes_timestamp = unix_time(dht->mono_time);
                 }
             }
         } else {
-            if (is_timeout(cur_iptspng->hardening.send_nodes_timestamp, HARDEN_TIMEOUT)) {
+            if (is_timeout(dht->mono_time, cur_iptspng->hardening.send_nodes_timestamp, HARDEN_TIMEOUT)) {
                 cur_iptspng->hardening.send_nodes_ok = 0;
             }
         }
@@ -2211,18 +2251,19 @@ static int cryptopacket_handle(void *object, IP_Port source, const uint8_t *pack
 
 DHT *new_DHT(Networking_Core *net)
 {
-    /* init time */
-    unix_time_update();
-
     if (net == NULL)
         return NULL;
 
+    /* init time */
+    unix_time_update(net->mono_time);
+
     DHT *dht = calloc(1, sizeof(DHT));
 
     if (dht == NULL)
         return NULL;
 
     dht->net = net;
+    dht->mono_time = net->mono_time;
     dht->ping = new_ping(dht);
 
     if (dht->ping == NULL) {
@@ -2239,10 +2280,16 @@ DHT *new_DHT(Networking_Core *net)
     new_symmetric_key(dht->secret_symmetric_key);
     crypto_box_keypair(dht->self_public_key, dht->self_secret_key);
 
-    ping_array_init(&dht->dht_ping_array, DHT_PING_ARRAY_SIZE, PING_TIMEOUT);
-    ping_array_init(&dht->dht_harden_ping_array, DHT_PING_ARRAY_SIZE, PING_TIMEOUT);
+    if (ping_array_init(&dht->dht_ping_array, dht->mono_time, DHT_PING_ARRAY_SIZE, PING_TIMEOUT,
+                        sizeof(Node_format)) != 0
+            || ping_array_init(&dht->dht_harden_ping_array, dht->mono_time, DHT_PING_ARRAY_SIZE, PING_TIMEOUT,
+                               sizeof(Node_format) * 2) != 0) {
+        kill_DHT(dht);
+        return NULL;
+    }
+
 #ifdef ENABLE_ASSOC_DHT
-    dht->assoc = new_Assoc_default(dht->self_public_key);
+    dht->assoc = new_Assoc_default(dht->mono_time, dht->self_public_key);
 #endif
     uint32_t i;
 
@@ -2257,9 +2304,9 @@ DHT *new_DHT(Networking_Core *net)
 
 void do_DHT(DHT *dht)
 {
-    unix_time_update();
+    unix_time_update(dht->mono_time);
 
-    if (dht->last_run == unix_time()) {
+    if (dht->last_run == unix_time(dht->mono_time)) {
         return;
     }
 
@@ -2279,7 +2326,7 @@ void do_DHT(DHT *dht)
         do_Assoc(dht->assoc, dht);
 
 #endif
-    dht->last_run = unix_time();
+    dht->last_run = unix_time(dht->mono_time);
 }
 void kill_DHT(DHT *dht)
 {
@@ -2482,13 +2529,13 @@ int DHT_load(DHT *dht, const uint8_t *data, uint32_t length)
 int DHT_isconnected(const DHT *dht)
 {
     uint32_t i, count=0;
-    unix_time_update();
+    unix_time_update(dht->mono_time);
 
     for (i = 0; i < LCLIENT_LIST; ++i) {
         const Client_data *client = &dht->close_clientlist[i];
 
-        if (!is_timeout(client->assoc4.timestamp, BAD_NODE_TIMEOUT) ||
-                !is_timeout(client->assoc6.timestamp, BAD_NODE_TIMEOUT))
+        if (!is_timeout(dht->mono_time, client->assoc4.timestamp, BAD_NODE_TIMEOUT) ||
+                !is_timeout(dht->mono_time, client->assoc6.timestamp, BAD_NODE_TIMEOUT))
             count++;
     }
 
@@ -2501,15 +2548,17 @@ int DHT_isconnected(const DHT *dht)
 int DHT_non_lan_connected(const DHT *dht)
 {
     uint32_t i;
-    unix_time_update();
+    unix_time_update(dht->mono_time);
 
     for (i = 0; i < LCLIENT_LIST; ++i) {
         const Client_data *client = &dht->close_clientlist[i];
 
-        if (!is_timeout(client->assoc4.timestamp, BAD_NODE_TIMEOUT) && LAN_ip(client->assoc4.ip_port.ip) == -1)
+        if (!is_timeout(dht->mono_time, client->assoc4.timestamp, BAD_NODE_TIMEOUT)
+                && LAN_ip(client->assoc4.ip_port.ip) == -1)
             return 1;
 
-        if (!is_timeout(client->assoc6.timestamp, BAD_NODE_TIMEOUT) && LAN_ip(client->assoc6.ip_port.ip) == -1)
+        if (!is_timeout(dht->mono_time, client->assoc6.timestamp, BAD_NODE_TIMEOUT)
+                && LAN_ip(client->assoc6.ip_port.ip) == -1)
             return 1;
 
     }
@@ -230,6 +230,7 @@ typedef struct {
 
 typedef struct {
     Networking_Core *net;
+    Mono_Time       *mono_time;   /* the one of net */
 
     Client_data    close_clientlist[LCLIENT_LIST];
     uint64_t       close_lastgetnodes;
@@ -257,6 +258,7 @@ typedef struct {
 #ifdef ENABLE_ASSOC_DHT
     struct Assoc  *assoc;
 #endif
+    struct Broadcast_Info *broadcast;   /* set up by LANdiscovery_init() */
     uint64_t       last_run;
 
     Cryptopacket_Handles cryptopackethandlers[256];
@@ -269,7 +271,8 @@ typedef struct {
  * If shared key is already in shared_keys, copy it to shared_key.
  * else generate it into shared_key and copy it to shared_keys
  */
-void get_shared_key(Shared_Keys *shared_keys, uint8_t *shared_key, const uint8_t *secret_key, const uint8_t *client_id);
+void get_shared_key(const Mono_Time *mono_time, Shared_Keys *shared_keys, uint8_t *shared_key,
+                    const uint8_t *secret_key, const uint8_t *client_id);
 
 /* Copy shared_key to encrypt/decrypt DHT packet from client_id into shared_key
  * for packets that we receive.
@@ -33,21 +33,49 @@
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
 #include <linux/netdevice.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #endif
 
 #define MAX_INTERFACES 16
 
+#ifdef __linux__
 
-static int     broadcast_count = -1;
-static IP_Port broadcast_ip_port[MAX_INTERFACES];
+/* An interface as reported by netlink. */
+typedef struct {
+    int   index;   /* 0 if the slot is free */
+    _Bool running;
+    IP    broadcast;   /* family 0 if it has no IPv4 broadcast address */
+    _Bool link_local;   /* has an IPv6 link-local address, the IPv6 multicast is sent on it */
+} LAN_Interface;
+
+#endif
+
+/* The broadcast addresses of a DHT, kept per instance so that instances on different threads
+ * and ports don't share them.
+ */
+struct Broadcast_Info {
+    int     count;   /* -1 until fetched */
+    IP_Port ip_ports[MAX_INTERFACES];
+
+#ifdef __linux__
+    /* When netlink is available the interfaces are kept up to date from the changes the kernel
+     * reports on it, and ip_ports isn't used.
+     */
+    sock_t        netlink;   /* -1 if not available */
+    LAN_Interface interfaces[MAX_INTERFACES];
+    _Bool         changed;   /* an interface came up or got an address since the last poll */
+    uint64_t      last_change;   /* when LANdiscovery_poll() last reported a change */
+#endif
+};
 
 #if defined(_WIN32) || defined(__WIN32__) || defined (WIN32)
 
 #include <iphlpapi.h>
 
-static void fetch_broadcast_info(uint16_t port)
+static void fetch_broadcast_info(Broadcast_Info *broadcast, uint16_t port)
 {
-    broadcast_count = 0;
+    broadcast->count = 0;
 
     IP_ADAPTER_INFO *pAdapterInfo = malloc(sizeof(pAdapterInfo));
     unsigned long ulOutBufLen = sizeof(pAdapterInfo);
@@ -76,15 +104,15 @@ static void fetch_broadcast_info(uint16_t port)
             if (addr_parse_ip(pAdapter->IpAddressList.IpMask.String, &subnet_mask)
                     && addr_parse_ip(pAdapter->GatewayList.IpAddress.String, &gateway)) {
                 if (gateway.family == AF_INET && subnet_mask.family == AF_INET) {
-                    IP_Port *ip_port = &broadcast_ip_port[broadcast_count];
+                    IP_Port *ip_port = &broadcast->ip_ports[broadcast->count];
                     ip_port->ip.family = AF_INET;
                     uint32_t gateway_ip = ntohl(gateway.ip4.uint32), subnet_ip = ntohl(subnet_mask.ip4.uint32);
                     uint32_t broadcast_ip = gateway_ip + ~subnet_ip - 1;
                     ip_port->ip.ip4.uint32 = htonl(broadcast_ip);
                     ip_port->port = port;
-                    broadcast_count++;
+                    broadcast->count++;
 
-                    if (broadcast_count >= MAX_INTERFACES) {
+                    if (broadcast->count >= MAX_INTERFACES) {
                         return;
                     }
                 }
@@ -101,13 +129,13 @@ static void fetch_broadcast_info(uint16_t port)
 
 #elif defined(__linux__)
 
-static void fetch_broadcast_info(uint16_t port)
+static void fetch_broadcast_info(Broadcast_Info *broadcast, uint16_t port)
 {
     /* Not sure how many platforms this will run on,
      * so it's wrapped in __linux for now.
      * Definitely won't work like this on Windows...
      */
-    broadcast_count = 0;
+    broadcast->count = 0;
     sock_t sock = 0;
 
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
@@ -144,12 +172,12 @@ static void fetch_broadcast_info(uint16_t port)
 
         struct sockaddr_in *sock4 = (struct sockaddr_in *)&i_faces[i].ifr_broadaddr;
 
-        if (broadcast_count >= MAX_INTERFACES) {
+        if (broadcast->count >= MAX_INTERFACES) {
             close(sock);
             return;
         }
 
-        IP_Port *ip_port = &broadcast_ip_port[broadcast_count];
+        IP_Port *ip_port = &broadcast->ip_ports[broadcast->count];
         ip_port->ip.family = AF_INET;
         ip_port->ip.ip4.in_addr = sock4->sin_addr;
 
@@ -158,7 +186,7 @@ static void fetch_broadcast_info(uint16_t port)
         // }
 
         ip_port->port = port;
-        broadcast_count++;
+        broadcast->count++;
     }
 
     close(sock);
@@ -166,9 +194,235 @@ static void fetch_broadcast_info(uint16_t port)
 
 #else //TODO: Other platforms?
 
-static void fetch_broadcast_info(uint16_t port)
+static void fetch_broadcast_info(Broadcast_Info *broadcast, uint16_t port)
+{
+    broadcast->count = 0;
+}
+
+#endif
+
+#ifdef __linux__
+
+static LAN_Interface *get_interface(Broadcast_Info *broadcast, int index, _Bool add)
+{
+    LAN_Interface *free_slot = NULL;
+    int i;
+
+    for (i = 0; i < MAX_INTERFACES; ++i) {
+        if (broadcast->interfaces[i].index == index)
+            return &broadcast->interfaces[i];
+
+        if (free_slot == NULL && broadcast->interfaces[i].index == 0)
+            free_slot = &broadcast->interfaces[i];
+    }
+
+    if (!add || free_slot == NULL)
+        return NULL;
+
+    memset(free_slot, 0, sizeof(LAN_Interface));
+    free_slot->index = index;
+    return free_slot;
+}
+
+static void handle_link(Broadcast_Info *broadcast, const struct nlmsghdr *header)
+{
+    const struct ifinfomsg *info = NLMSG_DATA(header);
+
+    if (header->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+        return;
+
+    _Bool running = header->nlmsg_type == RTM_NEWLINK && (info->ifi_flags & IFF_RUNNING)
+                    && !(info->ifi_flags & IFF_LOOPBACK);
+    LAN_Interface *interface = get_interface(broadcast, info->ifi_index, running);
+
+    if (interface == NULL)
+        return;
+
+    if (header->nlmsg_type == RTM_DELLINK) {
+        memset(interface, 0, sizeof(LAN_Interface));
+        return;
+    }
+
+    if (running && !interface->running)
+        broadcast->changed = 1;
+
+    interface->running = running;
+}
+
+static void handle_address(Broadcast_Info *broadcast, const struct nlmsghdr *header)
+{
+    const struct ifaddrmsg *address = NLMSG_DATA(header);
+
+    if (header->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg)))
+        return;
+
+    _Bool added = header->nlmsg_type == RTM_NEWADDR;
+    LAN_Interface *interface = get_interface(broadcast, address->ifa_index, added);
+
+    if (interface == NULL)
+        return;
+
+    const struct rtattr *attribute = IFA_RTA(address);
+    int length = IFA_PAYLOAD(header);
+
+    for (; RTA_OK(attribute, length); attribute = RTA_NEXT(attribute, length)) {
+        if (address->ifa_family == AF_INET && attribute->rta_type == IFA_BROADCAST && RTA_PAYLOAD(attribute) == 4) {
+            IP ip;
+            ip_init(&ip, 0);
+            memcpy(&ip.ip4.in_addr, RTA_DATA(attribute), 4);
+
+            if (added) {
+                interface->broadcast = ip;
+                broadcast->changed |= interface->running;
+            } else if (ip_equal(&interface->broadcast, &ip)) {
+                ip_reset(&interface->broadcast);
+            }
+        } else if (address->ifa_family == AF_INET6 && attribute->rta_type == IFA_ADDRESS
+                   && RTA_PAYLOAD(attribute) == 16) {
+            const uint8_t *ip6 = RTA_DATA(attribute);
+
+            /* FE80::/10 */
+            if (ip6[0] != 0xFE || (ip6[1] & 0xC0) != 0x80)
+                continue;
+
+            interface->link_local = added;
+            broadcast->changed |= added && interface->running;
+        }
+    }
+}
+
+/* Reads everything the kernel sent on the netlink socket.
+ *
+ * return -1 if messages were lost and the interfaces need to be fetched again.
+ * return 0 otherwise.
+ */
+static int read_netlink(Broadcast_Info *broadcast)
+{
+    uint32_t buffer[2048];   /* aligned for struct nlmsghdr */
+
+    while (1) {
+        ssize_t length = recv(broadcast->netlink, buffer, sizeof(buffer), 0);
+
+        if (length < 0)
+            return errno == ENOBUFS ? -1 : 0;
+
+        if (length == 0)
+            return 0;
+
+        const struct nlmsghdr *header = (const struct nlmsghdr *)buffer;
+
+        for (; NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+            switch (header->nlmsg_type) {
+                case RTM_NEWLINK:
+                case RTM_DELLINK:
+                    handle_link(broadcast, header);
+                    break;
+
+                case RTM_NEWADDR:
+                case RTM_DELADDR:
+                    handle_address(broadcast, header);
+                    break;
+            }
+        }
+    }
+}
+
+static int request_dump(Broadcast_Info *broadcast, uint16_t type)
+{
+    struct {
+        struct nlmsghdr header;
+        struct rtgenmsg message;
+    } request;
+
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+    request.header.nlmsg_type = type;
+    request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.message.rtgen_family = AF_UNSPEC;
+
+    if (send(broadcast->netlink, &request, request.header.nlmsg_len, 0) < 0)
+        return -1;
+
+    /* The kernel makes the next part of a dump each time the last one was read, so this gets all
+     * of it without blocking.
+     */
+    return read_netlink(broadcast);
+}
+
+/* Fetches all the interfaces and their addresses, the links first so that it is known which are
+ * running when their addresses arrive.
+ */
+static int fetch_interfaces(Broadcast_Info *broadcast)
+{
+    memset(broadcast->interfaces, 0, sizeof(broadcast->interfaces));
+
+    if (request_dump(broadcast, RTM_GETLINK) == -1 || request_dump(broadcast, RTM_GETADDR) == -1)
+        return -1;
+
+    return 0;
+}
+
+static void start_monitor(Broadcast_Info *broadcast)
 {
-    broadcast_count = 0;
+    broadcast->netlink = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+    if (!sock_valid(broadcast->netlink))
+        return;
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+
+    if (bind(broadcast->netlink, (struct sockaddr *)&addr, sizeof(addr)) != 0 || fetch_interfaces(broadcast) == -1) {
+        kill_sock(broadcast->netlink);
+        broadcast->netlink = -1;
+        return;
+    }
+
+    /* What was there already isn't a change */
+    broadcast->changed = 0;
+}
+
+static void stop_monitor(Broadcast_Info *broadcast)
+{
+    if (sock_valid(broadcast->netlink))
+        kill_sock(broadcast->netlink);
+}
+
+/* Sends the IPv6 multicast out of every interface with a link-local address instead of only the
+ * one the kernel picks.
+ *
+ * return the number of interfaces it was sent on, -1 if the interfaces aren't known.
+ */
+static int send_multicast(Broadcast_Info *broadcast, Networking_Core *net, IP_Port ip_port, const uint8_t *data,
+                          uint16_t length)
+{
+    if (broadcast == NULL || !sock_valid(broadcast->netlink) || net->transport.send)
+        return -1;
+
+    int i, sent = 0, found = 0;
+
+    for (i = 0; i < MAX_INTERFACES; ++i) {
+        const LAN_Interface *interface = &broadcast->interfaces[i];
+
+        if (interface->index == 0 || !interface->running || !interface->link_local)
+            continue;
+
+        unsigned int index = interface->index;
+        found = 1;
+
+        if (setsockopt(net->sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &index, sizeof(index)) == 0
+                && sendpacket(net, ip_port, data, length) > 0)
+            ++sent;
+    }
+
+    if (!found)
+        return -1;
+
+    unsigned int index = 0;
+    setsockopt(net->sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &index, sizeof(index));
+    return sent;
 }
 
 #endif
@@ -177,20 +431,47 @@ static void fetch_broadcast_info(uint16_t port)
  *  return 1 if sent to at least one broadcast target.
  *  return 0 on failure to find any valid broadcast target.
  */
-static uint32_t send_broadcasts(Networking_Core *net, uint16_t port, const uint8_t *data, uint16_t length)
+static uint32_t send_broadcasts(Broadcast_Info *broadcast, Networking_Core *net, uint16_t port, const uint8_t *data,
+                                uint16_t length)
 {
+    if (broadcast == NULL)
+        return 0;
+
+    int i;
+
+#ifdef __linux__
+
+    if (sock_valid(broadcast->netlink)) {
+        uint32_t res = 0;
+
+        for (i = 0; i < MAX_INTERFACES; ++i) {
+            const LAN_Interface *interface = &broadcast->interfaces[i];
+
+            if (interface->index == 0 || !interface->running || interface->broadcast.family != AF_INET)
+                continue;
+
+            IP_Port ip_port;
+            ip_port.ip = interface->broadcast;
+            ip_port.port = port;
+            sendpacket(net, ip_port, data, length);
+            res = 1;
+        }
+
+        return res;
+    }
+
+#endif
+
     /* fetch only once? on every packet? every X seconds?
      * old: every packet, new: once */
-    if (broadcast_count < 0)
-        fetch_broadcast_info(port);
+    if (broadcast->count < 0)
+        fetch_broadcast_info(broadcast, port);
 
-    if (!broadcast_count)
+    if (!broadcast->count)
         return 0;
 
-    int i;
-
-    for (i = 0; i < broadcast_count; i++)
-        sendpacket(net, broadcast_ip_port[i], data, length);
+    for (i = 0; i < broadcast->count; i++)
+        sendpacket(net, broadcast->ip_ports[i], data, length);
 
     return 1;
 }
@@ -327,7 +608,7 @@ int send_LANdiscovery(uint16_t port, DHT *dht)
     data[0] = NET_PACKET_LAN_DISCOVERY;
     id_copy(data + 1, dht->self_public_key);
 
-    send_broadcasts(dht->net, port, data, 1 + crypto_box_PUBLICKEYBYTES);
+    send_broadcasts(dht->broadcast, dht->net, port, data, 1 + crypto_box_PUBLICKEYBYTES);
 
     int res = -1;
     IP_Port ip_port;
@@ -337,9 +618,18 @@ int send_LANdiscovery(uint16_t port, DHT *dht)
     if (dht->net->family == AF_INET6) {
         ip_port.ip = broadcast_ip(AF_INET6, AF_INET6);
 
-        if (ip_isset(&ip_port.ip))
-            if (sendpacket(dht->net, ip_port, data, 1 + crypto_box_PUBLICKEYBYTES) > 0)
+        if (ip_isset(&ip_port.ip)) {
+            int sent = -1;
+#ifdef __linux__
+            sent = send_multicast(dht->broadcast, dht->net, ip_port, data, 1 + crypto_box_PUBLICKEYBYTES);
+#endif
+
+            if (sent == -1)
+                sent = sendpacket(dht->net, ip_port, data, 1 + crypto_box_PUBLICKEYBYTES) > 0;
+
+            if (sent > 0)
                 res = 1;
+        }
     }
 
     /* IPv4 broadcast (has to be IPv4-in-IPv6 mapping if socket is AF_INET6 */
@@ -353,12 +643,62 @@ int send_LANdiscovery(uint16_t port, DHT *dht)
 }
 
 
+int LANdiscovery_poll(DHT *dht)
+{
+#ifdef __linux__
+    Broadcast_Info *broadcast = dht->broadcast;
+
+    if (broadcast == NULL || !sock_valid(broadcast->netlink))
+        return 0;
+
+    if (read_netlink(broadcast) == -1) {
+        /* Whatever was missed may have been an interface coming up */
+        fetch_interfaces(broadcast);
+        broadcast->changed = 1;
+    }
+
+    if (!broadcast->changed || broadcast->last_change == unix_time(dht->mono_time))
+        return 0;
+
+    broadcast->changed = 0;
+    broadcast->last_change = unix_time(dht->mono_time);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 void LANdiscovery_init(DHT *dht)
 {
+    if (dht->broadcast == NULL) {
+        dht->broadcast = calloc(1, sizeof(Broadcast_Info));
+
+        if (dht->broadcast) {
+            dht->broadcast->count = -1;
+#ifdef __linux__
+            dht->broadcast->netlink = -1;
+
+            /* Simulated networks have no interfaces to watch */
+            if (!dht->net->transport.send)
+                start_monitor(dht->broadcast);
+
+#endif
+        }
+    }
+
     networking_registerhandler(dht->net, NET_PACKET_LAN_DISCOVERY, &handle_LANdiscovery, dht);
 }
 
 void LANdiscovery_kill(DHT *dht)
 {
     networking_registerhandler(dht->net, NET_PACKET_LAN_DISCOVERY, NULL, NULL);
+
+#ifdef __linux__
+
+    if (dht->broadcast)
+        stop_monitor(dht->broadcast);
+
+#endif
+    free(dht->broadcast);
+    dht->broadcast = NULL;
 }
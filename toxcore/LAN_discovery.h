@@ -31,13 +31,25 @@
 /* Interval in seconds between LAN discovery packet sending. */
 #define LAN_DISCOVERY_INTERVAL 10
 
+typedef struct Broadcast_Info Broadcast_Info;
+
 /* Send a LAN discovery pcaket to the broadcast address with port port. */
 int send_LANdiscovery(uint16_t port, DHT *dht);
 
-/* Sets up packet handlers. */
+/* Sets up packet handlers and the broadcast addresses of dht.
+ * On Linux the interfaces are then tracked through netlink, so the broadcast addresses stay
+ * current and the IPv6 multicast goes out of every interface with a link-local address.
+ */
 void LANdiscovery_init(DHT *dht);
 
-/* Clear packet handlers. */
+/* Checks for interfaces that came up or got an address, at most once a second.
+ *
+ * return 1 if there was one and LAN discovery should be sent right away.
+ * return 0 if not.
+ */
+int LANdiscovery_poll(DHT *dht);
+
+/* Clear packet handlers and free the broadcast addresses. */
 void LANdiscovery_kill(DHT *dht);
 
 /* Is IP a local ip or not. */
@@ -78,6 +78,132 @@ int realloc_friendlist(Messenger *m, uint32_t num)
     return 0;
 }
 
+typedef enum {
+    QUEUED_MESSAGE,
+    QUEUED_FILE_DATA,
+    QUEUED_LOSSY,
+    QUEUED_LOSSLESS,
+} QUEUED_SEND_TYPE;
+
+struct Queued_Send {
+    MPSC_Node node;   /* must be first, the queue hands back its address */
+    QUEUED_SEND_TYPE type;
+    uint8_t message_type;
+    uint32_t number;   /* message id or file number */
+    uint64_t position;
+    uint32_t length;
+    uint8_t data[];
+};
+
+static void write_lock_friendlist(Messenger *m)
+{
+    if (m->options.concurrent_send)
+        pthread_rwlock_wrlock(&m->friendlist_lock);
+}
+
+static void unlock_friendlist(Messenger *m)
+{
+    if (m->options.concurrent_send)
+        pthread_rwlock_unlock(&m->friendlist_lock);
+}
+
+static Send_Queue *new_send_queue(void)
+{
+    Send_Queue *send_queue = calloc(1, sizeof(Send_Queue));
+
+    if (send_queue)
+        mpsc_queue_init(&send_queue->queue);
+
+    return send_queue;
+}
+
+/* Drops everything queued. Only called from the thread that runs do_messenger(). */
+static void clear_send_queue(Send_Queue *send_queue)
+{
+    if (send_queue->retry) {
+        free(send_queue->retry);
+        send_queue->retry = NULL;
+        __atomic_sub_fetch(&send_queue->num_queued, 1, __ATOMIC_RELAXED);
+    }
+
+    MPSC_Node *node;
+
+    while ((node = mpsc_queue_pop(&send_queue->queue))) {
+        free(node);
+        __atomic_sub_fetch(&send_queue->num_queued, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void kill_send_queue(Send_Queue *send_queue)
+{
+    if (send_queue == NULL)
+        return;
+
+    clear_send_queue(send_queue);
+    free(send_queue);
+}
+
+static struct Queued_Send *new_queued_send(QUEUED_SEND_TYPE type, const uint8_t *data, uint32_t length)
+{
+    struct Queued_Send *item = malloc(sizeof(struct Queued_Send) + length);
+
+    if (item == NULL)
+        return NULL;
+
+    item->type = type;
+    item->length = length;
+
+    if (length != 0)
+        memcpy(item->data, data, length);
+
+    return item;
+}
+
+/* Queues item for friendnumber, from any thread. If message_id isn't NULL item is given the next
+ * message id of the friend, which is put in it. item is freed on failure.
+ *
+ * return -1 if friend not valid.
+ * return -2 if friend not online.
+ * return -3 if the queue is full.
+ * return 0 on success.
+ */
+static int queue_send(const Messenger *m, int32_t friendnumber, struct Queued_Send *item, uint32_t *message_id)
+{
+    pthread_rwlock_t *lock = (pthread_rwlock_t *)&m->friendlist_lock;
+    pthread_rwlock_rdlock(lock);
+
+    /* Only the writers of the lock set send_queue and numfriends */
+    if ((uint32_t)friendnumber >= m->numfriends || m->friendlist[friendnumber].send_queue == NULL) {
+        pthread_rwlock_unlock(lock);
+        free(item);
+        return -1;
+    }
+
+    Send_Queue *send_queue = m->friendlist[friendnumber].send_queue;
+
+    if (!__atomic_load_n(&send_queue->online, __ATOMIC_RELAXED)) {
+        pthread_rwlock_unlock(lock);
+        free(item);
+        return -2;
+    }
+
+    if (__atomic_add_fetch(&send_queue->num_queued, 1, __ATOMIC_RELAXED) > MAX_QUEUED_SENDS) {
+        __atomic_sub_fetch(&send_queue->num_queued, 1, __ATOMIC_RELAXED);
+        pthread_rwlock_unlock(lock);
+        free(item);
+        return -3;
+    }
+
+    if (message_id) {
+        item->number = __atomic_add_fetch(&send_queue->message_id, 1, __ATOMIC_RELAXED);
+        *message_id = item->number;
+    }
+
+    mpsc_queue_push(&send_queue->queue, &item->node);
+    pthread_rwlock_unlock(lock);
+    return 0;
+}
+
 /*  return the friend id associated to that public key.
  *  return -1 if no such friend.
  */
@@ -172,22 +298,42 @@ static int handle_custom_lossy_packet(void *object, int friend_num, const uint8_
 
 static int32_t init_new_friend(Messenger *m, const uint8_t *real_pk, uint8_t status)
 {
+    Send_Queue *send_queue = NULL;
+
+    if (m->options.concurrent_send && (send_queue = new_send_queue()) == NULL)
+        return FAERR_NOMEM;
+
     /* Resize the friend list if necessary. */
-    if (realloc_friendlist(m, m->numfriends + 1) != 0)
+    write_lock_friendlist(m);
+
+    if (realloc_friendlist(m, m->numfriends + 1) != 0) {
+        unlock_friendlist(m);
+        kill_send_queue(send_queue);
         return FAERR_NOMEM;
+    }
 
     memset(&(m->friendlist[m->numfriends]), 0, sizeof(Friend));
+    unlock_friendlist(m);
 
     int friendcon_id = new_friend_connection(m->fr_c, real_pk);
 
-    if (friendcon_id == -1)
+    if (friendcon_id == -1) {
+        kill_send_queue(send_queue);
         return FAERR_NOMEM;
+    }
 
     uint32_t i;
 
     for (i = 0; i <= m->numfriends; ++i) {
         if (m->friendlist[i].status == NOFRIEND) {
+            write_lock_friendlist(m);
             m->friendlist[i].status = status;
+            m->friendlist[i].send_queue = send_queue;
+
+            if (m->numfriends == i)
+                ++m->numfriends;
+
+            unlock_friendlist(m);
             m->friendlist[i].friendcon_id = friendcon_id;
             m->friendlist[i].friendrequest_lastsent = 0;
             id_copy(m->friendlist[i].real_pk, real_pk);
@@ -198,9 +344,6 @@ static int32_t init_new_friend(Messenger *m, const uint8_t *real_pk, uint8_t sta
             friend_connection_callbacks(m->fr_c, friendcon_id, MESSENGER_CALLBACK_INDEX, &handle_status, &handle_packet,
                                         &handle_custom_lossy_packet, m, i);
 
-            if (m->numfriends == i)
-                ++m->numfriends;
-
             if (friend_con_connected(m->fr_c, friendcon_id) == FRIENDCONN_STATUS_CONNECTED) {
                 send_online_packet(m, i);
             }
@@ -209,6 +352,7 @@ static int32_t init_new_friend(Messenger *m, const uint8_t *real_pk, uint8_t sta
         }
     }
 
+    kill_send_queue(send_queue);
     return FAERR_NOMEM;
 }
 
@@ -398,6 +542,8 @@ int m_delfriend(Messenger *m, int32_t friendnumber)
     }
 
     kill_friend_connection(m->fr_c, m->friendlist[friendnumber].friendcon_id);
+    write_lock_friendlist(m);
+    kill_send_queue(m->friendlist[friendnumber].send_queue);
     memset(&(m->friendlist[friendnumber]), 0, sizeof(Friend));
     uint32_t i;
 
@@ -407,13 +553,34 @@ int m_delfriend(Messenger *m, int32_t friendnumber)
     }
 
     m->numfriends = i;
+    int ret = realloc_friendlist(m, m->numfriends);
+    unlock_friendlist(m);
 
-    if (realloc_friendlist(m, m->numfriends) != 0)
+    if (ret != 0)
         return FAERR_NOMEM;
 
     return 0;
 }
 
+/* Copy a snapshot of the connection to the friend into stats.
+ *
+ * return -1 if the friend number is invalid.
+ * return -2 if there is no connection to the friend.
+ * return 0 on success.
+ */
+int m_get_friend_connection_stats(const Messenger *m, int32_t friendnumber, Crypto_Connection_Stats *stats)
+{
+    if (friend_not_valid(m, friendnumber))
+        return -1;
+
+    int crypt_connection_id = friend_connection_crypt_connection_id(m->fr_c, m->friendlist[friendnumber].friendcon_id);
+
+    if (crypto_connection_stats(m->net_crypto, crypt_connection_id, stats) != 0)
+        return -2;
+
+    return 0;
+}
+
 int m_get_friend_connectionstatus(const Messenger *m, int32_t friendnumber)
 {
     if (friend_not_valid(m, friendnumber))
@@ -456,18 +623,9 @@ int m_friend_exists(const Messenger *m, int32_t friendnumber)
  * return -5 if bad type.
  * return 0 if success.
  */
-int m_send_message_generic(Messenger *m, int32_t friendnumber, uint8_t type, const uint8_t *message, uint32_t length,
-                           uint32_t *message_id)
+static int send_message(Messenger *m, int32_t friendnumber, uint8_t type, const uint8_t *message, uint32_t length,
+                        uint32_t msg_id)
 {
-    if (type > MESSAGE_ACTION)
-        return -5;
-
-    if (friend_not_valid(m, friendnumber))
-        return -1;
-
-    if (length >= MAX_CRYPTO_DATA_SIZE)
-        return -2;
-
     if (m->friendlist[friendnumber].status != FRIEND_ONLINE)
         return -3;
 
@@ -483,9 +641,54 @@ int m_send_message_generic(Messenger *m, int32_t friendnumber, uint8_t type, con
     if (packet_num == -1)
         return -4;
 
-    uint32_t msg_id = ++m->friendlist[friendnumber].message_id;
-
     add_receipt(m, friendnumber, packet_num, msg_id);
+    return 0;
+}
+
+int m_send_message_generic(Messenger *m, int32_t friendnumber, uint8_t type, const uint8_t *message, uint32_t length,
+                           uint32_t *message_id)
+{
+    if (type > MESSAGE_ACTION)
+        return -5;
+
+    if (m->options.concurrent_send) {
+        if (length >= MAX_CRYPTO_DATA_SIZE)
+            return -2;
+
+        struct Queued_Send *item = new_queued_send(QUEUED_MESSAGE, message, length);
+
+        if (item == NULL)
+            return -4;
+
+        item->message_type = type;
+
+        switch (queue_send(m, friendnumber, item, message_id)) {
+            case -1:
+                return -1;
+
+            case -2:
+                return -3;
+
+            case -3:
+                return -4;
+        }
+
+        return 0;
+    }
+
+    if (friend_not_valid(m, friendnumber))
+        return -1;
+
+    if (length >= MAX_CRYPTO_DATA_SIZE)
+        return -2;
+
+    uint32_t msg_id = m->friendlist[friendnumber].message_id + 1;
+    int ret = send_message(m, friendnumber, type, message, length, msg_id);
+
+    if (ret != 0)
+        return ret;
+
+    m->friendlist[friendnumber].message_id = msg_id;
 
     if (message_id)
         *message_id = msg_id;
@@ -869,6 +1072,14 @@ static void check_friend_connectionstatus(Messenger *m, int32_t friendnumber, ui
     const uint8_t is_online = status == FRIEND_ONLINE;
 
     if (is_online != was_online) {
+        Send_Queue *send_queue = m->friendlist[friendnumber].send_queue;
+
+        /* Whatever was queued was meant for the connection that is gone or for none at all */
+        if (send_queue) {
+            __atomic_store_n(&send_queue->online, is_online, __ATOMIC_RELAXED);
+            clear_send_queue(send_queue);
+        }
+
         if (was_online) {
             break_files(m, friendnumber);
             clear_receipts(m, friendnumber);
@@ -1326,8 +1537,8 @@ static int64_t send_file_data_packet(const Messenger *m, int32_t friendnumber, u
  *  return -6 if packet queue full.
  *  return -7 if wrong position.
  */
-int file_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uint64_t position, const uint8_t *data,
-              uint16_t length)
+static int send_file_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uint64_t position,
+                          const uint8_t *data, uint16_t length)
 {
     if (friend_not_valid(m, friendnumber))
         return -1;
@@ -1385,6 +1596,37 @@ int file_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uin
 
 }
 
+int file_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uint64_t position, const uint8_t *data,
+              uint16_t length)
+{
+    if (!m->options.concurrent_send)
+        return send_file_data(m, friendnumber, filenumber, position, data, length);
+
+    if (length > MAX_FILE_DATA_SIZE)
+        return -5;
+
+    struct Queued_Send *item = new_queued_send(QUEUED_FILE_DATA, data, length);
+
+    if (item == NULL)
+        return -6;
+
+    item->number = filenumber;
+    item->position = position;
+
+    switch (queue_send(m, friendnumber, item, NULL)) {
+        case -1:
+            return -1;
+
+        case -2:
+            return -2;
+
+        case -3:
+            return -6;
+    }
+
+    return 0;
+}
+
 /* Give the number of bytes left to be sent/received.
  *
  *  send_receive is 0 if we want the sending files, 1 if we want the receiving.
@@ -1671,9 +1913,34 @@ int m_callback_rtp_packet(Messenger *m, int32_t friendnumber, uint8_t byte, int
 }
 
 
+/* Queues a custom packet of type with concurrent_send, with the return values of
+ * send_custom_lossy_packet() once the packet is known to be valid.
+ */
+static int queue_custom_packet(const Messenger *m, int32_t friendnumber, QUEUED_SEND_TYPE type, const uint8_t *data,
+                               uint32_t length)
+{
+    struct Queued_Send *item = new_queued_send(type, data, length);
+
+    if (item == NULL)
+        return -5;
+
+    switch (queue_send(m, friendnumber, item, NULL)) {
+        case -1:
+            return -1;
+
+        case -2:
+            return -4;
+
+        case -3:
+            return -5;
+    }
+
+    return 0;
+}
+
 int send_custom_lossy_packet(const Messenger *m, int32_t friendnumber, const uint8_t *data, uint32_t length)
 {
-    if (friend_not_valid(m, friendnumber))
+    if (!m->options.concurrent_send && friend_not_valid(m, friendnumber))
         return -1;
 
     if (length == 0 || length > MAX_CRYPTO_DATA_SIZE)
@@ -1685,6 +1952,9 @@ int send_custom_lossy_packet(const Messenger *m, int32_t friendnumber, const uin
     if (data[0] >= (PACKET_ID_LOSSY_RANGE_START + PACKET_ID_LOSSY_RANGE_SIZE))
         return -3;
 
+    if (m->options.concurrent_send)
+        return queue_custom_packet(m, friendnumber, QUEUED_LOSSY, data, length);
+
     if (m->friendlist[friendnumber].status != FRIEND_ONLINE)
         return -4;
 
@@ -1696,6 +1966,47 @@ int send_custom_lossy_packet(const Messenger *m, int32_t friendnumber, const uin
     }
 }
 
+int m_set_lossy_fec(const Messenger *m, int32_t friendnumber, uint8_t byte, uint8_t num_data, uint8_t num_parity)
+{
+    if (friend_not_valid(m, friendnumber))
+        return -1;
+
+    if (num_data > FEC_MAX_DATA_PACKETS || num_parity > FEC_MAX_PARITY_PACKETS || (num_data != 0 && num_parity == 0))
+        return -2;
+
+    if (byte < PACKET_ID_LOSSY_RANGE_START)
+        return -3;
+
+    if (byte >= (PACKET_ID_LOSSY_RANGE_START + PACKET_ID_LOSSY_RANGE_SIZE))
+        return -3;
+
+    if (m->friendlist[friendnumber].status != FRIEND_ONLINE)
+        return -4;
+
+    if (crypto_connection_set_fec(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
+                                  m->friendlist[friendnumber].friendcon_id), byte, num_data, num_parity) == -1) {
+        return -5;
+    } else {
+        return 0;
+    }
+}
+
+int m_flush_lossy_fec(const Messenger *m, int32_t friendnumber, uint8_t byte)
+{
+    if (friend_not_valid(m, friendnumber))
+        return -1;
+
+    if (m->friendlist[friendnumber].status != FRIEND_ONLINE)
+        return -4;
+
+    if (crypto_connection_fec_flush(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
+                                    m->friendlist[friendnumber].friendcon_id), byte) == -1) {
+        return -5;
+    } else {
+        return 0;
+    }
+}
+
 static int handle_custom_lossless_packet(void *object, int friend_num, const uint8_t *packet, uint16_t length)
 {
     Messenger *m = object;
@@ -1724,7 +2035,7 @@ void custom_lossless_packet_registerhandler(Messenger *m, void (*packet_handler_
 
 int send_custom_lossless_packet(const Messenger *m, int32_t friendnumber, const uint8_t *data, uint32_t length)
 {
-    if (friend_not_valid(m, friendnumber))
+    if (!m->options.concurrent_send && friend_not_valid(m, friendnumber))
         return -1;
 
     if (length == 0 || length > MAX_CRYPTO_DATA_SIZE)
@@ -1736,6 +2047,9 @@ int send_custom_lossless_packet(const Messenger *m, int32_t friendnumber, const
     if (data[0] >= (PACKET_ID_LOSSLESS_RANGE_START + PACKET_ID_LOSSLESS_RANGE_SIZE))
         return -3;
 
+    if (m->options.concurrent_send)
+        return queue_custom_packet(m, friendnumber, QUEUED_LOSSLESS, data, length);
+
     if (m->friendlist[friendnumber].status != FRIEND_ONLINE)
         return -4;
 
@@ -1758,6 +2072,110 @@ static int friend_already_added(const uint8_t *real_pk, void *data)
     return -1;
 }
 
+/* Kills m if the lock of its friend list can't be created.
+ *
+ * return -1 on failure.
+ */
+static int init_concurrent_send(Messenger *m)
+{
+    if (!m->options.concurrent_send || pthread_rwlock_init(&m->friendlist_lock, NULL) == 0)
+        return 0;
+
+    m->options.concurrent_send = 0;
+    kill_groupchats(m->group_handler);
+    kill_messenger(m);
+    return -1;
+}
+
+/* Sets up the parts of an account of options->host that aren't shared with its other accounts.
+ * m is freed on failure.
+ */
+static Messenger *new_hosted_messenger(Messenger *m, Messenger_Options *options, unsigned int *error)
+{
+    Messenger_Host *host = options->host;
+
+    Messenger **accounts = realloc(host->accounts, (host->num_accounts + 1) * sizeof(Messenger *));
+
+    if (accounts == NULL) {
+        free(m);
+        return NULL;
+    }
+
+    host->accounts = accounts;
+
+    m->host = host;
+    m->net = host->net;
+    m->dht = host->dht;
+    m->onion = host->onion;
+    m->onion_a = host->onion_a;
+    m->group_announce = host->group_announce;
+
+    m->net_crypto = new_net_crypto_hosted(host->net_crypto);
+
+    if (m->net_crypto == NULL) {
+        free(m);
+        return NULL;
+    }
+
+    if (set_crypto_pipeline_threads(m->net_crypto, options->crypto_threads) != 0
+            || set_congestion_control(m->net_crypto, options->congestion_control) != 0) {
+        kill_net_crypto(m->net_crypto);
+        free(m);
+        return NULL;
+    }
+
+    set_packet_coalescing(m->net_crypto, options->coalesce_packets);
+
+    m->group_handler = new_groupchats(m);
+
+    if (m->group_handler == NULL) {
+        kill_net_crypto(m->net_crypto);
+        free(m);
+        return NULL;
+    }
+
+    if (options->group_history_dir != NULL
+            && gc_set_history_dir(m->group_handler, options->group_history_dir, options->group_history_size) != 0) {
+        kill_groupchats(m->group_handler);
+        kill_net_crypto(m->net_crypto);
+        free(m);
+        return NULL;
+    }
+
+    m->onion_c = new_onion_client_hosted(host->onion_c, m->net_crypto);
+    m->fr_c = new_friend_connections(m->onion_c);
+
+    if (!(m->onion_c && m->fr_c)) {
+        kill_friend_connections(m->fr_c);
+        kill_onion_client(m->onion_c);
+        kill_groupchats(m->group_handler);
+        kill_net_crypto(m->net_crypto);
+        free(m);
+        return NULL;
+    }
+
+    m->options = *options;
+    m->options.ipv6enabled = host->options.ipv6enabled;
+    m->options.udp_disabled = host->options.udp_disabled;
+    m->options.proxy_info = host->options.proxy_info;
+    m->options.tcp_server_port = 0;
+
+    if (init_concurrent_send(m) == -1)
+        return NULL;
+
+    friendreq_init(&(m->fr), m->fr_c);
+    set_nospam(&(m->fr), random_int());
+    set_filter_function(&(m->fr), &friend_already_added, m);
+
+    host->accounts[host->num_accounts] = m;
+    ++host->num_accounts;
+
+    if (error)
+        *error = MESSENGER_ERROR_NONE;
+
+    return m;
+}
+
 /* Run this at startup. */
 Messenger *new_messenger(Messenger_Options *options, unsigned int *error)
 {
@@ -1769,15 +2187,20 @@ Messenger *new_messenger(Messenger_Options *options, unsigned int *error)
     if ( ! m )
         return NULL;
 
+    if (options->host)
+        return new_hosted_messenger(m, options, error);
+
     unsigned int net_err = 0;
 
     if (options->udp_disabled) {
         /* this is the easiest way to completely disable UDP without changing too much code. */
-        m->net = calloc(1, sizeof(Networking_Core));
+        m->net = new_networking_no_udp(&options->clock);
+    } else if (options->transport.send) {
+        m->net = new_networking_transport(&options->transport, &options->clock);
     } else {
         IP ip;
         ip_init(&ip, options->ipv6enabled);
-        m->net = new_networking_ex(ip, options->port_range[0], options->port_range[1], &net_err);
+        m->net = new_networking_ex(ip, options->port_range[0], options->port_range[1], &options->clock, &net_err);
     }
 
     if (m->net == NULL) {
@@ -1807,6 +2230,17 @@ Messenger *new_messenger(Messenger_Options *options, unsigned int *error)
         return NULL;
     }
 
+    if (set_crypto_pipeline_threads(m->net_crypto, options->crypto_threads) != 0
+            || set_congestion_control(m->net_crypto, options->congestion_control) != 0) {
+        kill_net_crypto(m->net_crypto);
+        kill_DHT(m->dht);
+        kill_networking(m->net);
+        free(m);
+        return NULL;
+    }
+
+    set_packet_coalescing(m->net_crypto, options->coalesce_packets);
+
     m->group_announce = new_gca(m->dht);
 
     if (m->group_announce == NULL) {
@@ -1828,6 +2262,17 @@ Messenger *new_messenger(Messenger_Options *options, unsigned int *error)
         return NULL;
     }
 
+    if (options->group_history_dir != NULL
+            && gc_set_history_dir(m->group_handler, options->group_history_dir, options->group_history_size) != 0) {
+        kill_groupchats(m->group_handler);
+        kill_networking(m->net);
+        kill_net_crypto(m->net_crypto);
+        kill_DHT(m->dht);
+        kill_gca(m->group_announce);
+        free(m);
+        return NULL;
+    }
+
     m->onion = new_onion(m->dht);
     m->onion_a = new_onion_announce(m->dht);
     m->onion_c =  new_onion_client(m->net_crypto);
@@ -1848,7 +2293,8 @@ Messenger *new_messenger(Messenger_Options *options, unsigned int *error)
     }
 
     if (options->tcp_server_port) {
-        m->tcp_server = new_TCP_server(options->ipv6enabled, 1, &options->tcp_server_port, m->dht->self_secret_key, m->onion);
+        m->tcp_server = new_TCP_server(m->net->mono_time, options->ipv6enabled, 1, &options->tcp_server_port,
+                                       m->dht->self_secret_key, m->onion);
 
         if (m->tcp_server == NULL) {
             kill_friend_connections(m->fr_c);
@@ -1868,6 +2314,10 @@ Messenger *new_messenger(Messenger_Options *options, unsigned int *error)
     }
 
     m->options = *options;
+
+    if (init_concurrent_send(m) == -1)
+        return NULL;
+
     friendreq_init(&(m->fr), m->fr_c);
     set_nospam(&(m->fr), random_int());
     set_filter_function(&(m->fr), &friend_already_added, m);
@@ -1891,17 +2341,34 @@ void kill_messenger(Messenger *m)
     }
 
     kill_friend_connections(m->fr_c);
-    kill_onion(m->onion);
-    kill_onion_announce(m->onion_a);
     kill_onion_client(m->onion_c);
     kill_net_crypto(m->net_crypto);
-    kill_DHT(m->dht);
-    kill_networking(m->net);
+
+    if (m->host) {
+        Messenger_Host *host = m->host;
+
+        for (i = 0; i < host->num_accounts; ++i) {
+            if (host->accounts[i] == m) {
+                --host->num_accounts;
+                host->accounts[i] = host->accounts[host->num_accounts];
+                break;
+            }
+        }
+    } else {
+        kill_onion(m->onion);
+        kill_onion_announce(m->onion_a);
+        kill_DHT(m->dht);
+        kill_networking(m->net);
+    }
 
     for (i = 0; i < m->numfriends; ++i) {
         clear_receipts(m, i);
+        kill_send_queue(m->friendlist[i].send_queue);
     }
 
+    if (m->options.concurrent_send)
+        pthread_rwlock_destroy(&m->friendlist_lock);
+
     free(m->friendlist);
     free(m);
 }
@@ -2202,10 +2669,60 @@ static int handle_packet(void *object, int i, uint8_t *temp, uint16_t len)
     return 0;
 }
 
+/* return 0 if item couldn't be sent because the send queue is full and must be tried again later. */
+static int send_queued(Messenger *m, int32_t friendnumber, const struct Queued_Send *item)
+{
+    int crypt_connection_id = friend_connection_crypt_connection_id(m->fr_c, m->friendlist[friendnumber].friendcon_id);
+
+    switch (item->type) {
+        case QUEUED_MESSAGE:
+            return send_message(m, friendnumber, item->message_type, item->data, item->length, item->number) != -4;
+
+        case QUEUED_FILE_DATA:
+            return send_file_data(m, friendnumber, item->number, item->position, item->data, item->length) != -6;
+
+        case QUEUED_LOSSY:
+            send_lossy_cryptpacket(m->net_crypto, crypt_connection_id, item->data, item->length);
+            return 1;
+
+        case QUEUED_LOSSLESS:
+            return write_cryptpacket(m->net_crypto, crypt_connection_id, item->data, item->length, 1) != -1;
+    }
+
+    return 1;
+}
+
+/* Sends what the other threads queued for an online friend, in the order it was queued, until the
+ * send queue of the connection is full.
+ */
+static void do_send_queue(Messenger *m, int32_t friendnumber)
+{
+    Send_Queue *send_queue = m->friendlist[friendnumber].send_queue;
+
+    while (1) {
+        struct Queued_Send *item = send_queue->retry;
+        send_queue->retry = NULL;
+
+        if (item == NULL)
+            item = (struct Queued_Send *)mpsc_queue_pop(&send_queue->queue);
+
+        if (item == NULL)
+            return;
+
+        if (!send_queued(m, friendnumber, item)) {
+            send_queue->retry = item;
+            return;
+        }
+
+        free(item);
+        __atomic_sub_fetch(&send_queue->num_queued, 1, __ATOMIC_RELAXED);
+    }
+}
+
 void do_friends(Messenger *m)
 {
     uint32_t i;
-    uint64_t temp_time = unix_time();
+    uint64_t temp_time = unix_time(m->net->mono_time);
 
     for (i = 0; i < m->numfriends; ++i) {
         if (m->friendlist[i].status == FRIEND_ADDED) {
@@ -2254,6 +2771,9 @@ void do_friends(Messenger *m)
             do_receipts(m, i);
             do_reqchunk_filecb(m, i);
 
+            if (m->friendlist[i].send_queue)
+                do_send_queue(m, i);
+
             m->friendlist[i].last_seen_time = (uint64_t) time(NULL);
         }
     }
@@ -2274,17 +2794,16 @@ static void connection_status_cb(Messenger *m)
 
 #ifdef LOGGING
 #define DUMPING_CLIENTS_FRIENDS_EVERY_N_SECONDS 60UL
-static time_t lastdump = 0;
-static char IDString[crypto_box_PUBLICKEYBYTES * 2 + 1];
-static char *ID2String(const uint8_t *pk)
+#define IDSTRING_LEN (crypto_box_PUBLICKEYBYTES * 2 + 1)
+static char *ID2String(const uint8_t *pk, char *id_string)
 {
     uint32_t i;
 
     for (i = 0; i < crypto_box_PUBLICKEYBYTES; i++)
-        sprintf(&IDString[i * 2], "%02X", pk[i]);
+        sprintf(&id_string[i * 2], "%02X", pk[i]);
 
-    IDString[crypto_box_PUBLICKEYBYTES * 2] = 0;
-    return IDString;
+    id_string[crypto_box_PUBLICKEYBYTES * 2] = 0;
+    return id_string;
 }
 #endif
 
@@ -2331,9 +2850,10 @@ void do_messenger(Messenger *m)
         }
     }
 
-    unix_time_update();
+    unix_time_update(m->net->mono_time);
 
-    if (!m->options.udp_disabled) {
+    /* The host runs the parts its accounts share */
+    if (!m->options.udp_disabled && !m->host) {
         networking_poll(m->net);
         do_DHT(m->dht);
     }
@@ -2346,20 +2866,24 @@ void do_messenger(Messenger *m)
     do_onion_client(m->onion_c);
     do_friend_connections(m->fr_c);
     do_gc(m->group_handler);
-    do_gca(m->group_handler->announce);
+
+    if (!m->host)
+        do_gca(m->group_handler->announce);
+
     do_friends(m);
     connection_status_cb(m);
 
 #ifdef LOGGING
 
-    if (unix_time() > lastdump + DUMPING_CLIENTS_FRIENDS_EVERY_N_SECONDS) {
+    if (unix_time(m->net->mono_time) > m->lastdump + DUMPING_CLIENTS_FRIENDS_EVERY_N_SECONDS) {
 
 #ifdef ENABLE_ASSOC_DHT
         Assoc_status(m->dht->assoc);
 #endif
 
-        lastdump = unix_time();
+        m->lastdump = unix_time(m->net->mono_time);
         uint32_t client, last_pinged;
+        char id_string[IDSTRING_LEN];
 
         for (client = 0; client < LCLIENT_LIST; client++) {
             Client_data *cptr = &m->dht->close_clientlist[client];
@@ -2368,14 +2892,14 @@ void do_messenger(Messenger *m)
 
             for (a = 0, assoc = &cptr->assoc4; a < 2; a++, assoc = &cptr->assoc6)
                 if (ip_isset(&assoc->ip_port.ip)) {
-                    last_pinged = lastdump - assoc->last_pinged;
+                    last_pinged = m->lastdump - assoc->last_pinged;
 
                     if (last_pinged > 999)
                         last_pinged = 999;
 
                     LOGGER_TRACE("C[%2u] %s:%u [%3u] %s",
                                  client, ip_ntoa(&assoc->ip_port.ip), ntohs(assoc->ip_port.port),
-                                 last_pinged, ID2String(cptr->client_id));
+                                 last_pinged, ID2String(cptr->client_id, id_string));
                 }
         }
 
@@ -2423,9 +2947,9 @@ void do_messenger(Messenger *m)
             if (msgfptr) {
                 LOGGER_TRACE("F[%2u:%2u] <%s> %s",
                              dht2m[friend], friend, msgfptr->name,
-                             ID2String(msgfptr->real_pk));
+                             ID2String(msgfptr->real_pk, id_string));
             } else {
-                LOGGER_TRACE("F[--:%2u] %s", friend, ID2String(dhtfptr->client_id));
+                LOGGER_TRACE("F[--:%2u] %s", friend, ID2String(dhtfptr->client_id, id_string));
             }
 
             for (client = 0; client < MAX_FRIEND_CLIENTS; client++) {
@@ -2435,7 +2959,7 @@ void do_messenger(Messenger *m)
 
                 for (a = 0, assoc = &cptr->assoc4; a < 2; a++, assoc = &cptr->assoc6)
                     if (ip_isset(&assoc->ip_port.ip)) {
-                        last_pinged = lastdump - assoc->last_pinged;
+                        last_pinged = m->lastdump - assoc->last_pinged;
 
                         if (last_pinged > 999)
                             last_pinged = 999;
@@ -2443,7 +2967,7 @@ void do_messenger(Messenger *m)
                         LOGGER_TRACE("F[%2u] => C[%2u] %s:%u [%3u] %s",
                                      friend, client, ip_ntoa(&assoc->ip_port.ip),
                                      ntohs(assoc->ip_port.port), last_pinged,
-                                     ID2String(cptr->client_id));
+                                     ID2String(cptr->client_id, id_string));
                     }
             }
         }
@@ -2452,6 +2976,180 @@ void do_messenger(Messenger *m)
 #endif /* LOGGING */
 }
 
+/* Net_Crypto_Host callback: new connections from real_pk go to the account it is a friend of. */
+static Net_Crypto *host_find_account(void *object, const uint8_t *real_pk)
+{
+    Messenger_Host *host = object;
+    uint32_t i;
+
+    for (i = 0; i < host->num_accounts; ++i) {
+        if (getfriend_conn_id_pk(host->accounts[i]->fr_c, real_pk) != -1)
+            return host->accounts[i]->net_crypto;
+    }
+
+    return NULL;
+}
+
+Messenger_Host *new_messenger_host(Messenger_Options *options, unsigned int *error)
+{
+    Messenger_Host *host = calloc(1, sizeof(Messenger_Host));
+
+    if (error)
+        *error = MESSENGER_ERROR_OTHER;
+
+    if (host == NULL)
+        return NULL;
+
+    unsigned int net_err = 0;
+
+    if (options->udp_disabled) {
+        host->net = new_networking_no_udp(&options->clock);
+    } else if (options->transport.send) {
+        host->net = new_networking_transport(&options->transport, &options->clock);
+    } else {
+        IP ip;
+        ip_init(&ip, options->ipv6enabled);
+        host->net = new_networking_ex(ip, options->port_range[0], options->port_range[1], &options->clock, &net_err);
+    }
+
+    if (host->net == NULL) {
+        free(host);
+
+        if (error && net_err == 1) {
+            *error = MESSENGER_ERROR_PORT;
+        }
+
+        return NULL;
+    }
+
+    host->dht = new_DHT(host->net);
+
+    if (host->dht == NULL) {
+        kill_messenger_host(host);
+        return NULL;
+    }
+
+    host->net_crypto = new_net_crypto_host(host->dht, &options->proxy_info);
+    host->onion_c = new_onion_client_host(host->net_crypto);
+    host->group_announce = new_gca(host->dht);
+    host->onion = new_onion(host->dht);
+    host->onion_a = new_onion_announce(host->dht);
+
+    if (!(host->net_crypto && host->onion_c && host->group_announce && host->onion && host->onion_a)) {
+        kill_messenger_host(host);
+        return NULL;
+    }
+
+    if (options->tcp_server_port) {
+        host->tcp_server = new_TCP_server(host->net->mono_time, options->ipv6enabled, 1, &options->tcp_server_port,
+                                          host->dht->self_secret_key, host->onion);
+
+        if (host->tcp_server == NULL) {
+            kill_messenger_host(host);
+
+            if (error)
+                *error = MESSENGER_ERROR_TCP_SERVER;
+
+            return NULL;
+        }
+    }
+
+    net_crypto_host_account_handler(host->net_crypto, &host_find_account, host);
+    new_groupchats_host(host);
+    LANdiscovery_init(host->dht);
+    host->options = *options;
+    host->options.host = NULL;
+
+    if (error)
+        *error = MESSENGER_ERROR_NONE;
+
+    return host;
+}
+
+void kill_messenger_host(Messenger_Host *host)
+{
+    if (!host)
+        return;
+
+    if (host->tcp_server)
+        kill_TCP_server(host->tcp_server);
+
+    if (host->group_announce) {
+        kill_groupchats_host(host);
+        kill_gca(host->group_announce);
+    }
+
+    kill_onion(host->onion);
+    kill_onion_announce(host->onion_a);
+    kill_onion_client_host(host->onion_c);
+    kill_net_crypto_host(host->net_crypto);
+
+    if (host->dht) {
+        LANdiscovery_kill(host->dht);
+        kill_DHT(host->dht);
+    }
+
+    kill_networking(host->net);
+    free(host->accounts);
+    free(host);
+}
+
+void do_messenger_host(Messenger_Host *host)
+{
+    if (host->has_added_relays == 0) {
+        host->has_added_relays = 1;
+
+        if (host->tcp_server) {
+            /* Add self tcp server. */
+            IP_Port local_ip_port;
+            local_ip_port.port = host->options.tcp_server_port;
+            local_ip_port.ip.family = AF_INET;
+            local_ip_port.ip.ip4.uint32 = INADDR_LOOPBACK;
+            add_tcp_relay_host(host->net_crypto, local_ip_port, host->tcp_server->public_key);
+        }
+    }
+
+    unix_time_update(host->net->mono_time);
+
+    if (!host->options.udp_disabled) {
+        networking_poll(host->net);
+        do_DHT(host->dht);
+    }
+
+    if (host->tcp_server) {
+        do_TCP_server(host->tcp_server);
+    }
+
+    do_net_crypto_host(host->net_crypto);
+    do_gca(host->group_announce);
+
+    if (LANdiscovery_poll(host->dht)
+            || host->last_LANdiscovery + LAN_DISCOVERY_INTERVAL < unix_time(host->net->mono_time)) {
+        send_LANdiscovery(htons(TOX_PORT_DEFAULT), host->dht);
+        host->last_LANdiscovery = unix_time(host->net->mono_time);
+    }
+
+    uint32_t i;
+
+    for (i = 0; i < host->num_accounts; ++i)
+        do_messenger(host->accounts[i]);
+}
+
+uint32_t messenger_host_run_interval(const Messenger_Host *host)
+{
+    uint32_t interval = MIN_RUN_INTERVAL;
+    uint32_t i;
+
+    for (i = 0; i < host->num_accounts; ++i) {
+        uint32_t account_interval = messenger_run_interval(host->accounts[i]);
+
+        if (account_interval < interval)
+            interval = account_interval;
+    }
+
+    return interval;
+}
+
 /* new messenger format for load/save, more robust and forward compatible */
 
 #define MESSENGER_STATE_COOKIE_GLOBAL 0x15ed1b1f
@@ -2463,9 +3161,11 @@ void do_messenger(Messenger *m)
 #define MESSENGER_STATE_TYPE_NAME          4
 #define MESSENGER_STATE_TYPE_STATUSMESSAGE 5
 #define MESSENGER_STATE_TYPE_STATUS        6
-#define MESSENGER_STATE_TYPE_GROUPS        7
+#define MESSENGER_STATE_TYPE_GROUPS_V0     7   /* SAVED_GROUP before topology, groups are loaded as full mesh */
 #define MESSENGER_STATE_TYPE_TCP_RELAY     10
 #define MESSENGER_STATE_TYPE_PATH_NODE     11
+#define MESSENGER_STATE_TYPE_FRIEND_CONNECTIONS 12
+#define MESSENGER_STATE_TYPE_GROUPS        13
 
 #define SAVED_FRIEND_REQUEST_SIZE 1024
 #define NUM_SAVED_PATH_NODES 8
@@ -2570,9 +3270,145 @@ static int friends_list_load(Messenger *m, const uint8_t *data, uint32_t length)
     return num;
 }
 
+/* A saved friend connection is [real_pk][dht_temp_pk][uint64_t dht_pk_time][uint64_t ip_port_time]
+ * [ip_port][tcp relay]*FRIEND_CACHED_TCP_RELAYS, times in network byte order. Addresses are packed
+ * with pack_ip_port() into slots of SAVED_IP_PORT_SIZE, relays with pack_nodes() into slots of
+ * SAVED_NODE_SIZE, so that the size doesn't depend on the platform. Unused slots are zeroes.
+ */
+#define SAVED_IP_PORT_SIZE (1 + SIZE_IP6 + sizeof(uint16_t))
+#define SAVED_NODE_SIZE (SAVED_IP_PORT_SIZE + crypto_box_PUBLICKEYBYTES)
+#define SAVED_FRIEND_CONNECTION_SIZE (crypto_box_PUBLICKEYBYTES * 2 + sizeof(uint64_t) * 2 + SAVED_IP_PORT_SIZE \
+                                      + FRIEND_CACHED_TCP_RELAYS * SAVED_NODE_SIZE)
+
+static uint32_t saved_friend_connections_size(const Messenger *m)
+{
+    return count_friendlist(m) * SAVED_FRIEND_CONNECTION_SIZE;
+}
+
+static void pack_friend_connection(uint8_t *data, const uint8_t *real_pk, const Friend_Conn_Cache *cache)
+{
+    memset(data, 0, SAVED_FRIEND_CONNECTION_SIZE);
+    memcpy(data, real_pk, crypto_box_PUBLICKEYBYTES);
+    data += crypto_box_PUBLICKEYBYTES;
+    memcpy(data, cache->dht_temp_pk, crypto_box_PUBLICKEYBYTES);
+    data += crypto_box_PUBLICKEYBYTES;
+    U64_to_bytes(data, cache->dht_pk_time);
+    data += sizeof(uint64_t);
+
+    /* An address that can't be packed is saved as unknown */
+    if (pack_ip_port(data + sizeof(uint64_t), SAVED_IP_PORT_SIZE, 0, &cache->ip_port) != -1)
+        U64_to_bytes(data, cache->ip_port_time);
+
+    data += sizeof(uint64_t) + SAVED_IP_PORT_SIZE;
+
+    unsigned int i;
+
+    for (i = 0; i < FRIEND_CACHED_TCP_RELAYS; ++i) {
+        if (cache->tcp_relays[i].ip_port.ip.family != 0)
+            pack_nodes(data + i * SAVED_NODE_SIZE, SAVED_NODE_SIZE, &cache->tcp_relays[i], 1);
+    }
+}
+
+/* return -1 if the entry is invalid.
+ * return 0 on success.
+ */
+static int unpack_friend_connection(uint8_t *real_pk, Friend_Conn_Cache *cache, const uint8_t *data)
+{
+    memset(cache, 0, sizeof(Friend_Conn_Cache));
+    memcpy(real_pk, data, crypto_box_PUBLICKEYBYTES);
+    data += crypto_box_PUBLICKEYBYTES;
+    memcpy(cache->dht_temp_pk, data, crypto_box_PUBLICKEYBYTES);
+    data += crypto_box_PUBLICKEYBYTES;
+    bytes_to_U64(&cache->dht_pk_time, data);
+    data += sizeof(uint64_t);
+    bytes_to_U64(&cache->ip_port_time, data);
+    data += sizeof(uint64_t);
+
+    if (data[0] != 0) {
+        if (unpack_ip_port(&cache->ip_port, 0, data, SAVED_IP_PORT_SIZE, 0) == -1)
+            return -1;
+    } else if (cache->ip_port_time != 0) {
+        return -1;
+    }
+
+    data += SAVED_IP_PORT_SIZE;
+
+    unsigned int i;
+
+    for (i = 0; i < FRIEND_CACHED_TCP_RELAYS; ++i) {
+        const uint8_t *slot = data + i * SAVED_NODE_SIZE;
+
+        if (slot[0] != 0 && unpack_nodes(&cache->tcp_relays[i], 1, NULL, slot, SAVED_NODE_SIZE, 1) != 1)
+            return -1;
+    }
+
+    return 0;
+}
+
+static uint32_t friend_connections_save(const Messenger *m, uint8_t *data)
+{
+    uint32_t i;
+    uint32_t num = 0;
+
+    for (i = 0; i < m->numfriends; i++) {
+        if (m->friendlist[i].status > 0) {
+            Friend_Conn_Cache cache;
+
+            if (get_friendcon_cache(m->fr_c, m->friendlist[i].friendcon_id, &cache) == -1)
+                memset(&cache, 0, sizeof(Friend_Conn_Cache));
+
+            pack_friend_connection(data + num * SAVED_FRIEND_CONNECTION_SIZE, m->friendlist[i].real_pk, &cache);
+            num++;
+        }
+    }
+
+    return num * SAVED_FRIEND_CONNECTION_SIZE;
+}
+
+/* Must be loaded after the friends. Entries that don't parse are dropped.
+ *
+ * return -1 if the length is wrong.
+ * return the number of loaded entries on success.
+ */
+static int friend_connections_load(Messenger *m, const uint8_t *data, uint32_t length)
+{
+    if (length % SAVED_FRIEND_CONNECTION_SIZE != 0) {
+        return -1;
+    }
+
+    uint32_t num = length / SAVED_FRIEND_CONNECTION_SIZE;
+    uint32_t i;
+    int loaded = 0;
+
+    for (i = 0; i < num; ++i) {
+        uint8_t real_pk[crypto_box_PUBLICKEYBYTES];
+        Friend_Conn_Cache cache;
+
+        if (unpack_friend_connection(real_pk, &cache, data + i * SAVED_FRIEND_CONNECTION_SIZE) == -1) {
+            LOGGER_WARNING("Dropping invalid saved friend connection %u", i);
+            continue;
+        }
+
+        int friendcon_id = getfriend_conn_id_pk(m->fr_c, real_pk);
+
+        if (friendcon_id == -1)
+            continue;
+
+        if (set_friendcon_cache(m->fr_c, friendcon_id, &cache) == 0)
+            ++loaded;
+    }
+
+    return loaded;
+}
+
+/* The groups are saved as [uint32_t SAVED_GROUPS_VERSION][struct SAVED_GROUP]*, increment the version when
+ * SAVED_GROUP changes.
+ */
+#define SAVED_GROUPS_VERSION 1
+
 static uint32_t saved_groups_size(const Messenger *m)
 {
-    return gc_count_groups(m->group_handler) * sizeof(struct SAVED_GROUP);
+    return sizeof(uint32_t) + gc_count_groups(m->group_handler) * sizeof(struct SAVED_GROUP);
 }
 
 static uint32_t groups_save(const Messenger *m, uint8_t *data)
@@ -2581,6 +3417,9 @@ static uint32_t groups_save(const Messenger *m, uint8_t *data)
     uint32_t num = 0;
     GC_Session *c = m->group_handler;
 
+    host_to_lendian32(data, SAVED_GROUPS_VERSION);
+    data += sizeof(uint32_t);
+
     for (i = 0; i < c->num_chats; i++) {
         if (c->chats[i].connection_state > CS_NONE && c->chats[i].connection_state < CS_INVALID) {
             struct SAVED_GROUP temp;
@@ -2590,6 +3429,7 @@ static uint32_t groups_save(const Messenger *m, uint8_t *data)
             temp.group_name_len = htons(c->chats[i].shared_state.group_name_len);
             memcpy(temp.group_name, c->chats[i].shared_state.group_name, MAX_GC_GROUP_NAME_SIZE);
             temp.privacy_state = c->chats[i].shared_state.privacy_state;
+            temp.topology = c->chats[i].shared_state.topology;
             temp.maxpeers = htons(c->chats[i].shared_state.maxpeers);
             temp.passwd_len = htons(c->chats[i].shared_state.passwd_len);
             memcpy(temp.passwd, c->chats[i].shared_state.passwd, MAX_GC_PASSWD_SIZE);
@@ -2620,10 +3460,13 @@ static uint32_t groups_save(const Messenger *m, uint8_t *data)
         }
     }
 
-    return num * sizeof(struct SAVED_GROUP);
+    return sizeof(uint32_t) + num * sizeof(struct SAVED_GROUP);
 }
 
-static int groups_load(Messenger *m, const uint8_t *data, uint32_t length)
+/* Loads the SAVED_GROUP entries in data. Those of MESSENGER_STATE_TYPE_GROUPS_V0 have no topology, the
+ * groups were all full mesh then.
+ */
+static int groups_load(Messenger *m, const uint8_t *data, uint32_t length, bool with_topology)
 {
     if (length % sizeof(struct SAVED_GROUP) != 0)
         return -1;
@@ -2634,6 +3477,9 @@ static int groups_load(Messenger *m, const uint8_t *data, uint32_t length)
         struct SAVED_GROUP temp;
         memcpy(&temp, data + i * sizeof(struct SAVED_GROUP), sizeof(struct SAVED_GROUP));
 
+        if (!with_topology)
+            temp.topology = GT_FULL_MESH;
+
         int ret = gc_group_load(m->group_handler, &temp);
 
         if (ret == -1)
@@ -2651,6 +3497,7 @@ uint32_t messenger_size(const Messenger *m)
              + sizesubhead + sizeof(uint32_t) + crypto_box_PUBLICKEYBYTES + crypto_box_SECRETKEYBYTES
              + sizesubhead + DHT_size(m->dht)                  // DHT
              + sizesubhead + saved_friendslist_size(m)         // Friendlist itself.
+             + sizesubhead + saved_friend_connections_size(m)  // How to reach the friends.
              + sizesubhead + saved_groups_size(m)              // Groupchats
              + sizesubhead + m->name_length                    // Own nickname.
              + sizesubhead + m->statusmessage_length           // status message
@@ -2703,6 +3550,12 @@ void messenger_save(const Messenger *m, uint8_t *data)
     friends_list_save(m, data);
     data += len;
 
+    len = saved_friend_connections_size(m);
+    type = MESSENGER_STATE_TYPE_FRIEND_CONNECTIONS;
+    data = z_state_save_subheader(data, len, type);
+    friend_connections_save(m, data);
+    data += len;
+
     len = saved_groups_size(m);
     type = MESSENGER_STATE_TYPE_GROUPS;
     data = z_state_save_subheader(data, len, type);
@@ -2771,10 +3624,31 @@ static int messenger_load_state_callback(void *outer, const uint8_t *data, uint3
             friends_list_load(m, data, length);
             break;
 
-        case MESSENGER_STATE_TYPE_GROUPS:
-            groups_load(m, data, length);
+        case MESSENGER_STATE_TYPE_FRIEND_CONNECTIONS:
+            friend_connections_load(m, data, length);
+            break;
+
+        case MESSENGER_STATE_TYPE_GROUPS_V0:
+            groups_load(m, data, length, false);
             break;
 
+        case MESSENGER_STATE_TYPE_GROUPS: {
+            uint32_t version;
+
+            if (length < sizeof(uint32_t))
+                return -1;
+
+            lendian_to_host32(&version, data);
+
+            if (version != SAVED_GROUPS_VERSION) {
+                LOGGER_WARNING("Unknown version %u of the saved groups", version);
+                break;
+            }
+
+            groups_load(m, data + sizeof(uint32_t), length - sizeof(uint32_t), true);
+            break;
+        }
+
         case MESSENGER_STATE_TYPE_NAME:
             if ((length > 0) && (length <= MAX_NAME_LENGTH)) {
                 setname(m, data, length);
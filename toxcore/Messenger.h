@@ -30,6 +30,7 @@
 #include "friend_connection.h"
 #include "group_chats.h"
 #include "group_announce.h"
+#include "mpsc_queue.h"
 
 #define MAX_NAME_LENGTH 128
 /* TODO: this must depend on other variable. */
@@ -63,12 +64,40 @@ enum {
 #define PACKET_ID_LOSSLESS_RANGE_SIZE 32
 #define PACKET_LOSSY_AV_RESERVED 8 /* Number of lossy packet types at start of range reserved for A/V. */
 
+typedef struct Messenger_Host Messenger_Host;
+
 typedef struct {
     uint8_t ipv6enabled;
     uint8_t udp_disabled;
     TCP_Proxy_Info proxy_info;
     uint16_t port_range[2];
     uint16_t tcp_server_port;
+    uint32_t crypto_threads;
+    CONGESTION_CONTROL_TYPE congestion_control;
+    _Bool coalesce_packets;
+    const char *group_history_dir;
+    uint32_t group_history_size;
+
+    /* If set groups we create or join from now on use one encryption key, derived from our long term
+     * key, and share a single connection to each relay. Peers and relays can then tell that the
+     * groups are joined by the same user.
+     */
+    _Bool shared_group_key;
+
+    /* If its send is set the packets go over it instead of a UDP socket, see new_networking_transport() */
+    Net_Transport transport;
+
+    /* If its function is set the instance reads the time from it instead of the system clock */
+    Net_Clock clock;
+
+    /* If set the instance is an account of the host and its network options are ignored. */
+    Messenger_Host *host;
+
+    /* If set m_send_message_generic(), file_data(), send_custom_lossy_packet() and
+     * send_custom_lossless_packet() may be called from any thread. They only queue what they send
+     * and do_messenger() sends it.
+     */
+    _Bool concurrent_send;
 } Messenger_Options;
 
 
@@ -78,6 +107,21 @@ struct Receipts {
     struct Receipts *next;
 };
 
+/* Sends a friend can have queued with concurrent_send, those past it fail like a full send queue. */
+#define MAX_QUEUED_SENDS 1024
+
+/* The sends queued for a friend with concurrent_send. The queue and the counters are shared with
+ * the threads that send, the rest is only touched by the thread that runs do_messenger().
+ */
+typedef struct {
+    MPSC_Queue queue;
+    uint32_t num_queued;
+    uint32_t message_id;   /* last id given to a queued message */
+    uint8_t online;   /* if the friend is online, sends to a friend that isn't fail right away */
+
+    struct Queued_Send *retry;   /* popped but not sent because the send queue was full */
+} Send_Queue;
+
 /* Status definitions. */
 enum {
     NOFRIEND,
@@ -203,6 +247,8 @@ typedef struct {
 
     struct Receipts *receipts_start;
     struct Receipts *receipts_end;
+
+    Send_Queue *send_queue;   /* Only with concurrent_send */
 } Friend;
 
 
@@ -212,6 +258,9 @@ struct Messenger {
     Net_Crypto *net_crypto;
     DHT *dht;
 
+    /* If set, net, dht, onion, onion_a and group_announce belong to the host. */
+    Messenger_Host *host;
+
     Onion *onion;
     Onion_Announce *onion_a;
     Onion_Client *onion_c;
@@ -231,6 +280,11 @@ struct Messenger {
     Friend *friendlist;
     uint32_t numfriends;
 
+    /* With concurrent_send, held for writing while friendlist is resized or a friend added or
+     * removed, and for reading by the threads that queue sends to find the Send_Queue of a friend.
+     */
+    pthread_rwlock_t friendlist_lock;
+
     GC_Session *group_handler;
     GC_Announce *group_announce;
 
@@ -280,6 +334,34 @@ struct Messenger {
     void *core_connection_change_userdata;
     unsigned int last_connection_status;
 
+    uint64_t lastdump;   /* when the DHT and friends were last logged */
+
+    Messenger_Options options;
+};
+
+/* Many accounts sharing one socket, DHT, onion and TCP relay connections, each with keys,
+ * friends and net_crypto connections of its own. Every account costs the background traffic of
+ * announcing itself on the onion but not the one of keeping a DHT and relays up.
+ *
+ * The DHT key is shared too, which peers see: they can't be friends with two accounts of the
+ * same host, and two accounts of a host can't be friends with each other or be in the same group.
+ */
+struct Messenger_Host {
+    Networking_Core *net;
+    DHT *dht;
+    Onion *onion;
+    Onion_Announce *onion_a;
+    Net_Crypto_Host *net_crypto;
+    Onion_Client_Host *onion_c;
+    GC_Announce *group_announce;
+    TCP_Server *tcp_server;
+
+    Messenger **accounts;
+    uint32_t num_accounts;
+
+    uint8_t has_added_relays;
+    uint64_t last_LANdiscovery;
+
     Messenger_Options options;
 };
 
@@ -357,6 +439,14 @@ int m_delfriend(Messenger *m, int32_t friendnumber);
  */
 int m_get_friend_connectionstatus(const Messenger *m, int32_t friendnumber);
 
+/* Copy a snapshot of the connection to the friend into stats.
+ *
+ * return -1 if the friend number is invalid.
+ * return -2 if there is no connection to the friend.
+ * return 0 on success.
+ */
+int m_get_friend_connection_stats(const Messenger *m, int32_t friendnumber, Crypto_Connection_Stats *stats);
+
 /* Checks if there exists a friend with given friendnumber.
  *
  *  return 1 if friend exists.
@@ -374,6 +464,9 @@ int m_friend_exists(const Messenger *m, int32_t friendnumber);
  * return 0 if success.
  *
  *  the value in message_id will be passed to your read_receipt callback when the other receives the message.
+ *
+ *  With concurrent_send the message is queued, -4 means the queue of the friend is full and a message that can't
+ *  be sent later is dropped without a read receipt.
  */
 int m_send_message_generic(Messenger *m, int32_t friendnumber, uint8_t type, const uint8_t *message, uint32_t length,
                            uint32_t *message_id);
@@ -659,6 +752,9 @@ int file_seek(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uin
  *  return -5 if bad data size.
  *  return -6 if packet queue full.
  *  return -7 if wrong position.
+ *
+ *  With concurrent_send the data is queued and -3, -4 and -7 are only checked when it is sent. Data that fails
+ *  them then is dropped.
  */
 int file_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uint64_t position, const uint8_t *data,
               uint16_t length);
@@ -712,9 +808,34 @@ void custom_lossy_packet_registerhandler(Messenger *m, void (*packet_handler_cal
  * return -4 if friend offline.
  * return -5 if packet failed to send because of other error.
  * return 0 on success.
+ *
+ * With concurrent_send the packet is queued and -5 means the queue of the friend is full.
  */
 int send_custom_lossy_packet(const Messenger *m, int32_t friendnumber, const uint8_t *data, uint32_t length);
 
+/* Protect the custom lossy packets starting with byte sent to friendnumber with num_parity
+ * parity packets for every num_data packets, so that lost ones can be recovered by the
+ * friend without being sent again. num_data 0 disables it.
+ *
+ * return -1 if friend invalid.
+ * return -2 if num_data or num_parity invalid.
+ * return -3 if byte invalid.
+ * return -4 if friend offline.
+ * return -5 if it failed because of other error.
+ * return 0 on success.
+ */
+int m_set_lossy_fec(const Messenger *m, int32_t friendnumber, uint8_t byte, uint8_t num_data, uint8_t num_parity);
+
+/* Send the parity packets for the custom lossy packets starting with byte sent to friendnumber
+ * so far, for example at the end of a video frame.
+ *
+ * return -1 if friend invalid.
+ * return -4 if friend offline.
+ * return -5 if it failed because of other error.
+ * return 0 on success.
+ */
+int m_flush_lossy_fec(const Messenger *m, int32_t friendnumber, uint8_t byte);
+
 
 /* Set handlers for custom lossless packets.
  *
@@ -730,6 +851,8 @@ void custom_lossless_packet_registerhandler(Messenger *m, void (*packet_handler_
  * return -4 if friend offline.
  * return -5 if packet failed to send because of other error.
  * return 0 on success.
+ *
+ * With concurrent_send the packet is queued and -5 means the queue of the friend is full.
  */
 int send_custom_lossless_packet(const Messenger *m, int32_t friendnumber, const uint8_t *data, uint32_t length);
 
@@ -765,6 +888,29 @@ void do_messenger(Messenger *m);
  */
 uint32_t messenger_run_interval(const Messenger *m);
 
+/* Create a host that accounts are created on by passing it in the options of new_messenger().
+ * The network options of options are used for the socket and relays of the host.
+ *
+ *  return allocated instance of Messenger_Host on success.
+ *  return NULL if there are problems.
+ *
+ *  if error is not NULL it will be set to one of the values in the enum above.
+ */
+Messenger_Host *new_messenger_host(Messenger_Options *options, unsigned int *error);
+
+/* Kill the host. Its accounts must have been killed before.
+ */
+void kill_messenger_host(Messenger_Host *host);
+
+/* The main loop of the host and all its accounts, which don't need do_messenger() to be run
+ * on them. All the accounts of a host must be used from the thread running it.
+ */
+void do_messenger_host(Messenger_Host *host);
+
+/* Return the time in milliseconds before do_messenger_host() should be called again.
+ */
+uint32_t messenger_host_run_interval(const Messenger_Host *host);
+
 /* SAVING AND LOADING FUNCTIONS: */
 
 /* return size of the messenger data (for saving). */
@@ -395,6 +395,8 @@ static int write_packet_TCP_secure_connection(TCP_Client_Connection *con, const
         }
 
         increment_nonce(con->sent_nonce);
+        ++con->packets_sent;
+        con->bytes_sent += sizeof(packet);
 
         if ((unsigned int)len == sizeof(packet)) {
             return 1;
@@ -409,6 +411,8 @@ static int write_packet_TCP_secure_connection(TCP_Client_Connection *con, const
         return 0;
 
     increment_nonce(con->sent_nonce);
+    ++con->packets_sent;
+    con->bytes_sent += sizeof(packet);
 
     if ((unsigned int)len == sizeof(packet))
         return 1;
@@ -608,8 +612,8 @@ void onion_response_handler(TCP_Client_Connection *con, int (*onion_callback)(vo
 
 /* Create new TCP connection to ip_port/public_key
  */
-TCP_Client_Connection *new_TCP_connection(IP_Port ip_port, const uint8_t *public_key, const uint8_t *self_public_key,
-        const uint8_t *self_secret_key, TCP_Proxy_Info *proxy_info)
+TCP_Client_Connection *new_TCP_connection(Mono_Time *mono_time, IP_Port ip_port, const uint8_t *public_key,
+        const uint8_t *self_public_key, const uint8_t *self_secret_key, TCP_Proxy_Info *proxy_info)
 {
     if (networking_at_startup() != 0) {
         return NULL;
@@ -654,6 +658,7 @@ TCP_Client_Connection *new_TCP_connection(IP_Port ip_port, const uint8_t *public
         return NULL;
     }
 
+    temp->mono_time = mono_time;
     temp->sock = sock;
     memcpy(temp->public_key, public_key, crypto_box_PUBLICKEYBYTES);
     memcpy(temp->self_public_key, self_public_key, crypto_box_PUBLICKEYBYTES);
@@ -684,7 +689,7 @@ TCP_Client_Connection *new_TCP_connection(IP_Port ip_port, const uint8_t *public
             break;
     }
 
-    temp->kill_at = unix_time() + TCP_CONNECTION_TIMEOUT;
+    temp->kill_at = unix_time(mono_time) + TCP_CONNECTION_TIMEOUT;
 
     return temp;
 }
@@ -833,7 +838,7 @@ static int do_confirmed_TCP(TCP_Client_Connection *conn)
     uint8_t packet[MAX_PACKET_SIZE];
     int len;
 
-    if (is_timeout(conn->last_pinged, TCP_PING_FREQUENCY)) {
+    if (is_timeout(conn->mono_time, conn->last_pinged, TCP_PING_FREQUENCY)) {
         uint64_t ping_id = random_64b();
 
         if (!ping_id)
@@ -841,10 +846,10 @@ static int do_confirmed_TCP(TCP_Client_Connection *conn)
 
         conn->ping_request_id = conn->ping_id = ping_id;
         send_ping_request(conn);
-        conn->last_pinged = unix_time();
+        conn->last_pinged = unix_time(conn->mono_time);
     }
 
-    if (conn->ping_id && is_timeout(conn->last_pinged, TCP_PING_TIMEOUT)) {
+    if (conn->ping_id && is_timeout(conn->mono_time, conn->last_pinged, TCP_PING_TIMEOUT)) {
         conn->status = TCP_CLIENT_DISCONNECTED;
         return 0;
     }
@@ -856,6 +861,9 @@ static int do_confirmed_TCP(TCP_Client_Connection *conn)
             break;
         }
 
+        ++conn->packets_received;
+        conn->bytes_received += sizeof(uint16_t) + len + crypto_box_MACBYTES;
+
         if (handle_TCP_packet(conn, packet, len) == -1) {
             conn->status = TCP_CLIENT_DISCONNECTED;
             break;
@@ -869,7 +877,7 @@ static int do_confirmed_TCP(TCP_Client_Connection *conn)
  */
 void do_TCP_connection(TCP_Client_Connection *TCP_connection)
 {
-    unix_time_update();
+    unix_time_update(TCP_connection->mono_time);
 
     if (TCP_connection->status == TCP_CLIENT_DISCONNECTED) {
         return;
@@ -948,7 +956,7 @@ void do_TCP_connection(TCP_Client_Connection *TCP_connection)
         do_confirmed_TCP(TCP_connection);
     }
 
-    if (TCP_connection->kill_at <= unix_time()) {
+    if (TCP_connection->kill_at <= unix_time(TCP_connection->mono_time)) {
         TCP_connection->status = TCP_CLIENT_DISCONNECTED;
     }
 }
@@ -51,6 +51,7 @@ enum {
     TCP_CLIENT_DISCONNECTED,
 };
 typedef struct  {
+    Mono_Time *mono_time;
     uint8_t status;
     sock_t  sock;
     uint8_t self_public_key[crypto_box_PUBLICKEYBYTES]; /* our public key */
@@ -78,6 +79,12 @@ typedef struct  {
     uint64_t ping_response_id;
     uint64_t ping_request_id;
 
+    /* Of the packets of the confirmed connection, bytes including the length and MAC. */
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    uint64_t packets_received;
+    uint64_t bytes_received;
+
     struct {
         uint8_t status; /* 0 if not used, 1 if other is offline, 2 if other is online. */
         uint8_t public_key[crypto_box_PUBLICKEYBYTES];
@@ -102,8 +109,8 @@ typedef struct  {
 
 /* Create new TCP connection to ip_port/public_key
  */
-TCP_Client_Connection *new_TCP_connection(IP_Port ip_port, const uint8_t *public_key, const uint8_t *self_public_key,
-        const uint8_t *self_secret_key, TCP_Proxy_Info *proxy_info);
+TCP_Client_Connection *new_TCP_connection(Mono_Time *mono_time, IP_Port ip_port, const uint8_t *public_key,
+        const uint8_t *self_public_key, const uint8_t *self_secret_key, TCP_Proxy_Info *proxy_info);
 
 /* Run the TCP connection
  */
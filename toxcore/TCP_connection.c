@@ -449,6 +449,23 @@ int new_tcp_connection_to(TCP_Connections *tcp_c, const uint8_t *public_key, int
     return connections_number;
 }
 
+/* Set the object the data callback gets for packets of the connection, for when the users of
+ * tcp_c don't share one. NULL means the object set with set_packet_tcp_connection_callback().
+ *
+ * return 0 on success.
+ * return -1 on failure.
+ */
+int set_tcp_connection_to_object(TCP_Connections *tcp_c, int connections_number, void *object)
+{
+    TCP_Connection_to *con_to = get_connection(tcp_c, connections_number);
+
+    if (!con_to)
+        return -1;
+
+    con_to->object = object;
+    return 0;
+}
+
 /* return 0 on success.
  * return -1 on failure.
  */
@@ -552,6 +569,65 @@ int set_tcp_connection_to_status(TCP_Connections *tcp_c, int connections_number,
     }
 }
 
+int share_tcp_connection_to(TCP_Connections *tcp_c, const uint8_t *public_key, int id)
+{
+    int connections_number = find_tcp_connection_to(tcp_c, public_key);
+
+    if (connections_number == -1) {
+        connections_number = new_tcp_connection_to(tcp_c, public_key, id);
+
+        if (connections_number == -1)
+            return -1;
+    }
+
+    TCP_Connection_to *con_to = get_connection(tcp_c, connections_number);
+
+    ++con_to->users;
+    ++con_to->users_in_use;
+    set_tcp_connection_to_status(tcp_c, connections_number, 1);
+    return connections_number;
+}
+
+int use_tcp_connection_to(TCP_Connections *tcp_c, int connections_number, _Bool in_use)
+{
+    TCP_Connection_to *con_to = get_connection(tcp_c, connections_number);
+
+    if (!con_to)
+        return -1;
+
+    if (in_use) {
+        if (con_to->users_in_use == con_to->users)
+            return -1;
+
+        ++con_to->users_in_use;
+    } else {
+        if (con_to->users_in_use == 0)
+            return -1;
+
+        --con_to->users_in_use;
+    }
+
+    set_tcp_connection_to_status(tcp_c, connections_number, con_to->users_in_use != 0);
+    return 0;
+}
+
+int release_tcp_connection_to(TCP_Connections *tcp_c, int connections_number, _Bool in_use)
+{
+    TCP_Connection_to *con_to = get_connection(tcp_c, connections_number);
+
+    if (!con_to || con_to->users == 0)
+        return -1;
+
+    if (con_to->users == 1)
+        return kill_tcp_connection_to(tcp_c, connections_number);
+
+    if (in_use)
+        use_tcp_connection_to(tcp_c, connections_number, 0);
+
+    --con_to->users;
+    return 0;
+}
+
 static _Bool tcp_connection_in_conn(TCP_Connection_to *con_to, unsigned int tcp_connections_number)
 {
     unsigned int i;
@@ -679,6 +755,15 @@ static int kill_tcp_relay_connection(TCP_Connections *tcp_c, int tcp_connections
     return wipe_tcp_connection(tcp_c, tcp_connections_number);
 }
 
+/* Add the counters of the connection to the relay to the ones of the relay before killing it. */
+static void save_relay_counters(TCP_con *tcp_con)
+{
+    tcp_con->counters.packets_sent += tcp_con->connection->packets_sent;
+    tcp_con->counters.bytes_sent += tcp_con->connection->bytes_sent;
+    tcp_con->counters.packets_received += tcp_con->connection->packets_received;
+    tcp_con->counters.bytes_received += tcp_con->connection->bytes_received;
+}
+
 static int reconnect_tcp_relay_connection(TCP_Connections *tcp_c, int tcp_connections_number)
 {
     TCP_con *tcp_con = get_tcp_connection(tcp_c, tcp_connections_number);
@@ -692,9 +777,11 @@ static int reconnect_tcp_relay_connection(TCP_Connections *tcp_c, int tcp_connec
     IP_Port ip_port = tcp_con->connection->ip_port;
     uint8_t relay_pk[crypto_box_PUBLICKEYBYTES];
     memcpy(relay_pk, tcp_con->connection->public_key, crypto_box_PUBLICKEYBYTES);
+    save_relay_counters(tcp_con);
+    ++tcp_con->reconnects;
     kill_TCP_connection(tcp_con->connection);
-    tcp_con->connection = new_TCP_connection(ip_port, relay_pk, tcp_c->self_public_key, tcp_c->self_secret_key,
-                          &tcp_c->proxy_info);
+    tcp_con->connection = new_TCP_connection(tcp_c->mono_time, ip_port, relay_pk, tcp_c->self_public_key,
+                          tcp_c->self_secret_key, &tcp_c->proxy_info);
 
     if (!tcp_con->connection) {
         kill_tcp_relay_connection(tcp_c, tcp_connections_number);
@@ -741,6 +828,7 @@ static int sleep_tcp_relay_connection(TCP_Connections *tcp_c, int tcp_connection
     tcp_con->ip_port = tcp_con->connection->ip_port;
     memcpy(tcp_con->relay_pk, tcp_con->connection->public_key, crypto_box_PUBLICKEYBYTES);
 
+    save_relay_counters(tcp_con);
     kill_TCP_connection(tcp_con->connection);
     tcp_con->connection = NULL;
 
@@ -778,8 +866,8 @@ static int unsleep_tcp_relay_connection(TCP_Connections *tcp_c, int tcp_connecti
     if (tcp_con->status != TCP_CONN_SLEEPING)
         return -1;
 
-    tcp_con->connection = new_TCP_connection(tcp_con->ip_port, tcp_con->relay_pk, tcp_c->self_public_key,
-                          tcp_c->self_secret_key, &tcp_c->proxy_info);
+    tcp_con->connection = new_TCP_connection(tcp_c->mono_time, tcp_con->ip_port, tcp_con->relay_pk,
+                          tcp_c->self_public_key, tcp_c->self_secret_key, &tcp_c->proxy_info);
 
     if (!tcp_con->connection) {
         kill_tcp_relay_connection(tcp_c, tcp_connections_number);
@@ -900,7 +988,8 @@ static int tcp_data_callback(void *object, uint32_t number, uint8_t connection_i
         return -1;
 
     if (tcp_c->tcp_data_callback)
-        tcp_c->tcp_data_callback(tcp_c->tcp_data_callback_object, con_to->id, data, length);
+        tcp_c->tcp_data_callback(con_to->object ? con_to->object : tcp_c->tcp_data_callback_object, con_to->id, data,
+                                 length);
 
     return 0;
 }
@@ -995,7 +1084,7 @@ static int tcp_relay_on_online(TCP_Connections *tcp_c, int tcp_connections_numbe
 
     /* If this connection isn't used by any connection, we don't need to wait for them to come online. */
     if (sent) {
-        tcp_con->connected_time = unix_time();
+        tcp_con->connected_time = unix_time(tcp_c->mono_time);
     } else {
         tcp_con->connected_time = 0;
     }
@@ -1027,8 +1116,8 @@ static int add_tcp_relay_instance(TCP_Connections *tcp_c, IP_Port ip_port, const
     TCP_con *tcp_con = &tcp_c->tcp_connections[tcp_connections_number];
 
 
-    tcp_con->connection = new_TCP_connection(ip_port, relay_pk, tcp_c->self_public_key, tcp_c->self_secret_key,
-                          &tcp_c->proxy_info);
+    tcp_con->connection = new_TCP_connection(tcp_c->mono_time, ip_port, relay_pk, tcp_c->self_public_key,
+                          tcp_c->self_secret_key, &tcp_c->proxy_info);
 
     if (!tcp_con->connection)
         return -1;
@@ -1082,7 +1171,7 @@ int add_tcp_number_relay_connection(TCP_Connections *tcp_c, int connections_numb
 
     if (tcp_con->status == TCP_CONN_CONNECTED) {
         if (send_tcp_relay_routing_request(tcp_c, tcp_connections_number, con_to->public_key) == 0) {
-            tcp_con->connected_time = unix_time();
+            tcp_con->connected_time = unix_time(tcp_c->mono_time);
         }
     }
 
@@ -1174,6 +1263,53 @@ unsigned int tcp_copy_connected_relays(TCP_Connections *tcp_c, Node_format *tcp_
     return copied;
 }
 
+/* Copy a snapshot of a maximum of max_num of the relay connections, sleeping ones included, to stats.
+ * If stats is NULL, only count them.
+ *
+ * return number of relays copied to stats.
+ */
+unsigned int tcp_copy_relay_stats(const TCP_Connections *tcp_c, TCP_Relay_Stats *stats, unsigned int max_num)
+{
+    unsigned int i, copied = 0;
+
+    for (i = 0; (i < tcp_c->tcp_connections_length) && (!stats || copied < max_num); ++i) {
+        const TCP_con *tcp_con = &tcp_c->tcp_connections[i];
+
+        if (tcp_con->status == TCP_CONN_NONE)
+            continue;
+
+        if (!stats) {
+            ++copied;
+            continue;
+        }
+
+        TCP_Relay_Stats *relay = &stats[copied];
+        relay->status = tcp_con->status;
+        relay->onion = tcp_con->onion;
+        relay->lock_count = tcp_con->lock_count;
+        relay->connected_time = tcp_con->connected_time;
+        relay->reconnects = tcp_con->reconnects;
+        relay->counters = tcp_con->counters;
+
+        if (tcp_con->status == TCP_CONN_SLEEPING) {
+            memcpy(relay->public_key, tcp_con->relay_pk, crypto_box_PUBLICKEYBYTES);
+            relay->ip_port = tcp_con->ip_port;
+        } else {
+            const TCP_Client_Connection *connection = tcp_con->connection;
+            memcpy(relay->public_key, connection->public_key, crypto_box_PUBLICKEYBYTES);
+            relay->ip_port = connection->ip_port;
+            relay->counters.packets_sent += connection->packets_sent;
+            relay->counters.bytes_sent += connection->bytes_sent;
+            relay->counters.packets_received += connection->packets_received;
+            relay->counters.bytes_received += connection->bytes_received;
+        }
+
+        ++copied;
+    }
+
+    return copied;
+}
+
 /* Set if we want TCP_connection to allocate some connection for onion use.
  *
  * If status is 1, allocate some connections. if status is 0, don't.
@@ -1248,7 +1384,7 @@ int set_tcp_onion_status(TCP_Connections *tcp_c, _Bool status)
  *
  * Returns NULL on failure.
  */
-TCP_Connections *new_tcp_connections(const uint8_t *secret_key, TCP_Proxy_Info *proxy_info)
+TCP_Connections *new_tcp_connections(Mono_Time *mono_time, const uint8_t *secret_key, TCP_Proxy_Info *proxy_info)
 {
     if (secret_key == NULL)
         return NULL;
@@ -1258,6 +1394,7 @@ TCP_Connections *new_tcp_connections(const uint8_t *secret_key, TCP_Proxy_Info *
     if (temp == NULL)
         return NULL;
 
+    temp->mono_time = mono_time;
     memcpy(temp->self_secret_key, secret_key, crypto_box_SECRETKEYBYTES);
     crypto_scalarmult_curve25519_base(temp->self_public_key, temp->self_secret_key);
     temp->proxy_info = *proxy_info;
@@ -1295,7 +1432,7 @@ static void do_tcp_conns(TCP_Connections *tcp_c)
 
                 if (tcp_con->status == TCP_CONN_CONNECTED && !tcp_con->onion && tcp_con->lock_count
                         && tcp_con->lock_count == tcp_con->sleep_count
-                        && is_timeout(tcp_con->connected_time, TCP_CONNECTION_ANNOUNCE_TIMEOUT)) {
+                        && is_timeout(tcp_c->mono_time, tcp_con->connected_time, TCP_CONNECTION_ANNOUNCE_TIMEOUT)) {
                     sleep_tcp_relay_connection(tcp_c, i);
                 }
             }
@@ -1319,7 +1456,8 @@ static void kill_nonused_tcp(TCP_Connections *tcp_c)
 
         if (tcp_con) {
             if (tcp_con->status == TCP_CONN_CONNECTED) {
-                if (!tcp_con->onion && !tcp_con->lock_count && is_timeout(tcp_con->connected_time, TCP_CONNECTION_ANNOUNCE_TIMEOUT)) {
+                if (!tcp_con->onion && !tcp_con->lock_count
+                        && is_timeout(tcp_c->mono_time, tcp_con->connected_time, TCP_CONNECTION_ANNOUNCE_TIMEOUT)) {
                     to_kill[num_kill] = i;
                     ++num_kill;
                 }
@@ -62,8 +62,20 @@ typedef struct {
     } connections[MAX_FRIEND_TCP_CONNECTIONS];
 
     int id; /* id used in callbacks. */
+    void *object; /* if not NULL, passed to the data callback instead of the object it was set with. */
+
+    /* Only used by connections shared with share_tcp_connection_to(). */
+    uint32_t users;
+    uint32_t users_in_use;
 } TCP_Connection_to;
 
+typedef struct {
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    uint64_t packets_received;
+    uint64_t bytes_received;
+} TCP_Relay_Counters;
+
 typedef struct {
     uint8_t status;
     TCP_Client_Connection *connection;
@@ -76,10 +88,27 @@ typedef struct {
     IP_Port ip_port;
     uint8_t relay_pk[crypto_box_PUBLICKEYBYTES];
     _Bool unsleep; /* set to 1 to unsleep connection. */
+
+    /* Of the connections to the relay that were already killed by reconnecting or sleeping. */
+    TCP_Relay_Counters counters;
+    uint32_t reconnects;
 } TCP_con;
 
+/* A snapshot of a relay connection for monitoring it. */
+typedef struct {
+    uint8_t public_key[crypto_box_PUBLICKEYBYTES];
+    IP_Port ip_port;
+    uint8_t status; /* One of TCP_CONN_* */
+    _Bool onion;
+    uint32_t lock_count; /* Number of connections using the relay. */
+    uint64_t connected_time;
+    uint32_t reconnects;
+    TCP_Relay_Counters counters;
+} TCP_Relay_Stats;
+
 typedef struct {
     DHT *dht;
+    Mono_Time *mono_time;
 
     uint8_t self_public_key[crypto_box_PUBLICKEYBYTES];
     uint8_t self_secret_key[crypto_box_SECRETKEYBYTES];
@@ -174,6 +203,14 @@ void set_oob_packet_tcp_connection_callback(TCP_Connections *tcp_c, int (*tcp_oo
  */
 int new_tcp_connection_to(TCP_Connections *tcp_c, const uint8_t *public_key, int id);
 
+/* Set the object the data callback gets for packets of the connection, for when the users of
+ * tcp_c don't share one. NULL means the object set with set_packet_tcp_connection_callback().
+ *
+ * return 0 on success.
+ * return -1 on failure.
+ */
+int set_tcp_connection_to_object(TCP_Connections *tcp_c, int connections_number, void *object);
+
 /* return 0 on success.
  * return -1 on failure.
  */
@@ -191,6 +228,35 @@ int kill_tcp_connection_to(TCP_Connections *tcp_c, int connections_number);
  */
 int set_tcp_connection_to_status(TCP_Connections *tcp_c, int connections_number, _Bool status);
 
+/* Like new_tcp_connection_to() but if tcp_c already has a connection to public_key it is
+ * returned with one more user instead of failing, so that several users of tcp_c can talk
+ * to the same peer. Each user starts out using the connection.
+ *
+ * Connections gotten this way must have their status set with use_tcp_connection_to() and
+ * be let go of with release_tcp_connection_to().
+ *
+ * return connections_number on success.
+ * return -1 on failure.
+ */
+int share_tcp_connection_to(TCP_Connections *tcp_c, const uint8_t *public_key, int id);
+
+/* Sets whether one of the users of a shared connection is using it.
+ *
+ * The connection is used as long as one of its users is using it.
+ *
+ * return 0 on success.
+ * return -1 on failure.
+ */
+int use_tcp_connection_to(TCP_Connections *tcp_c, int connections_number, _Bool in_use);
+
+/* Lets go of one of the users of a shared connection, in_use being whether it was using it.
+ * The connection is killed when its last user lets go of it.
+ *
+ * return 0 on success.
+ * return -1 on failure.
+ */
+int release_tcp_connection_to(TCP_Connections *tcp_c, int connections_number, _Bool in_use);
+
 /* return number of online tcp relays tied to the connection on success.
  * return 0 on failure.
  */
@@ -230,6 +296,13 @@ int add_tcp_relay_global(TCP_Connections *tcp_c, IP_Port ip_port, const uint8_t
  */
 unsigned int tcp_copy_connected_relays(TCP_Connections *tcp_c, Node_format *tcp_relays, uint16_t max_num);
 
+/* Copy a snapshot of a maximum of max_num of the relay connections, sleeping ones included, to stats.
+ * If stats is NULL, only count them.
+ *
+ * return number of relays copied to stats.
+ */
+unsigned int tcp_copy_relay_stats(const TCP_Connections *tcp_c, TCP_Relay_Stats *stats, unsigned int max_num);
+
 /* Returns a new TCP_Connections object associated with the secret_key.
  *
  * In order for others to connect to this instance new_tcp_connection_to() must be called with the
@@ -237,7 +310,7 @@ unsigned int tcp_copy_connected_relays(TCP_Connections *tcp_c, Node_format *tcp_
  *
  * Returns NULL on failure.
  */
-TCP_Connections *new_tcp_connections(const uint8_t *secret_key, TCP_Proxy_Info *proxy_info);
+TCP_Connections *new_tcp_connections(Mono_Time *mono_time, const uint8_t *secret_key, TCP_Proxy_Info *proxy_info);
 
 void do_tcp_connections(TCP_Connections *tcp_c);
 void kill_tcp_connections(TCP_Connections *tcp_c);
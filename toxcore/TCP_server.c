@@ -147,7 +147,7 @@ static int add_accepted(TCP_Server *TCP_server, const TCP_Secure_Connection *con
     TCP_server->accepted_connection_array[index].status = TCP_STATUS_CONFIRMED;
     ++TCP_server->num_accepted_connections;
     TCP_server->accepted_connection_array[index].identifier = ++TCP_server->counter;
-    TCP_server->accepted_connection_array[index].last_pinged = unix_time();
+    TCP_server->accepted_connection_array[index].last_pinged = unix_time(TCP_server->mono_time);
     TCP_server->accepted_connection_array[index].ping_id = 0;
 
     return index;
@@ -939,8 +939,8 @@ static sock_t new_listening_TCP_socket(int family, uint16_t port)
     return sock;
 }
 
-TCP_Server *new_TCP_server(uint8_t ipv6_enabled, uint16_t num_sockets, const uint16_t *ports, const uint8_t *secret_key,
-                           Onion *onion)
+TCP_Server *new_TCP_server(Mono_Time *mono_time, uint8_t ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
+                           const uint8_t *secret_key, Onion *onion)
 {
     if (num_sockets == 0 || ports == NULL)
         return NULL;
@@ -954,6 +954,7 @@ TCP_Server *new_TCP_server(uint8_t ipv6_enabled, uint16_t num_sockets, const uin
     if (temp == NULL)
         return NULL;
 
+    temp->mono_time = mono_time;
     temp->socks_listening = calloc(num_sockets, sizeof(sock_t));
 
     if (temp->socks_listening == NULL) {
@@ -1129,10 +1130,10 @@ static void do_TCP_confirmed(TCP_Server *TCP_server)
 {
 #ifdef TCP_SERVER_USE_EPOLL
 
-    if (TCP_server->last_run_pinged == unix_time())
+    if (TCP_server->last_run_pinged == unix_time(TCP_server->mono_time))
         return;
 
-    TCP_server->last_run_pinged = unix_time();
+    TCP_server->last_run_pinged = unix_time(TCP_server->mono_time);
 #endif
     uint32_t i;
 
@@ -1142,7 +1143,7 @@ static void do_TCP_confirmed(TCP_Server *TCP_server)
         if (conn->status != TCP_STATUS_CONFIRMED)
             continue;
 
-        if (is_timeout(conn->last_pinged, TCP_PING_FREQUENCY)) {
+        if (is_timeout(TCP_server->mono_time, conn->last_pinged, TCP_PING_FREQUENCY)) {
             uint8_t ping[1 + sizeof(uint64_t)];
             ping[0] = TCP_PACKET_PING;
             uint64_t ping_id = random_64b();
@@ -1154,17 +1155,17 @@ static void do_TCP_confirmed(TCP_Server *TCP_server)
             int ret = write_packet_TCP_secure_connection(conn, ping, sizeof(ping), 1);
 
             if (ret == 1) {
-                conn->last_pinged = unix_time();
+                conn->last_pinged = unix_time(TCP_server->mono_time);
                 conn->ping_id = ping_id;
             } else {
-                if (is_timeout(conn->last_pinged, TCP_PING_FREQUENCY + TCP_PING_TIMEOUT)) {
+                if (is_timeout(TCP_server->mono_time, conn->last_pinged, TCP_PING_FREQUENCY + TCP_PING_TIMEOUT)) {
                     kill_accepted(TCP_server, i);
                     continue;
                 }
             }
         }
 
-        if (conn->ping_id && is_timeout(conn->last_pinged, TCP_PING_TIMEOUT)) {
+        if (conn->ping_id && is_timeout(TCP_server->mono_time, conn->last_pinged, TCP_PING_TIMEOUT)) {
             kill_accepted(TCP_server, i);
             continue;
         }
@@ -1304,7 +1305,7 @@ static void do_TCP_epoll(TCP_Server *TCP_server)
 
 void do_TCP_server(TCP_Server *TCP_server)
 {
-    unix_time_update();
+    unix_time_update(TCP_server->mono_time);
 
 #ifdef TCP_SERVER_USE_EPOLL
     do_TCP_epoll(TCP_server);
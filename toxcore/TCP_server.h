@@ -116,6 +116,7 @@ typedef struct TCP_Secure_Connection {
 
 
 typedef struct {
+    Mono_Time *mono_time;
     Onion *onion;
 
 #ifdef TCP_SERVER_USE_EPOLL
@@ -143,8 +144,8 @@ typedef struct {
 
 /* Create new TCP server instance.
  */
-TCP_Server *new_TCP_server(uint8_t ipv6_enabled, uint16_t num_sockets, const uint16_t *ports, const uint8_t *secret_key,
-                           Onion *onion);
+TCP_Server *new_TCP_server(Mono_Time *mono_time, uint8_t ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
+                           const uint8_t *secret_key, Onion *onion);
 
 /* Run the TCP_server
  */
@@ -86,6 +86,7 @@ typedef struct candidates_bucket {
 } candidates_bucket;
 
 struct Assoc {
+    const Mono_Time       *mono_time;
     hash_t                 self_hash;                          /* hash of self_client_id */
     uint8_t                self_client_id[CLIENT_ID_SIZE];     /* don't store entries for this */
 
@@ -271,7 +272,7 @@ static IP_Port *entry_heard_get(Client_entry *entry, const IP_Port *ipp)
  * LAN ip
  *
  * returns 1 if the entry did change */
-static int entry_heard_store(Client_entry *entry, const IPPTs *ippts)
+static int entry_heard_store(const Mono_Time *mono_time, Client_entry *entry, const IPPTs *ippts)
 {
     if (!entry || !ippts)
         return 0;
@@ -304,7 +305,7 @@ static int entry_heard_store(Client_entry *entry, const IPPTs *ippts)
     uint8_t LAN_ipp = LAN_ip(ipp->ip) == 0;
     uint8_t LAN_entry = LAN_ip(heard->ip) == 0;
 
-    if (LAN_ipp && !LAN_entry && !is_timeout(entry->heard_at, CANDIDATES_HEARD_TIMEOUT))
+    if (LAN_ipp && !LAN_entry && !is_timeout(mono_time, entry->heard_at, CANDIDATES_HEARD_TIMEOUT))
         return 0;
 
     *heard = *ipp;
@@ -378,7 +379,7 @@ static void candidates_update_assoc(const Assoc *assoc, Client_entry *entry, uin
         return;
 
     if (used)
-        entry->used_at = unix_time();
+        entry->used_at = unix_time(assoc->mono_time);
 
     /* do NOT do anything related to wanted, that's handled outside,
      * just update the assoc (in the most sensible way)
@@ -387,15 +388,15 @@ static void candidates_update_assoc(const Assoc *assoc, Client_entry *entry, uin
         ipptsp->ip_port = ippts_send->ip_port;
         ipptsp->timestamp = ippts_send->timestamp;
         ipptsp->ret_ip_port = *ipp_recv;
-        ipptsp->ret_timestamp = unix_time();
+        ipptsp->ret_timestamp = unix_time(assoc->mono_time);
 
-        entry->seen_at = unix_time();
+        entry->seen_at = unix_time(assoc->mono_time);
         entry->seen_family = ippts_send->ip_port.ip.family;
 
         return;
     }
 
-    entry_heard_store(entry, ippts_send);
+    entry_heard_store(assoc->mono_time, entry, ippts_send);
 }
 
 static uint8_t candidates_create_internal(const Assoc *assoc, hash_t const hash, const uint8_t *id, uint8_t seen,
@@ -428,11 +429,11 @@ static uint8_t candidates_create_internal(const Assoc *assoc, hash_t const hash,
          * 2. seen good
          * 3. used */
         // enumerated lists are superior to magic numbers
-        if (!is_timeout(entry->used_at, BAD_NODE_TIMEOUT))
+        if (!is_timeout(assoc->mono_time, entry->used_at, BAD_NODE_TIMEOUT))
             check = USED;
-        else if (!is_timeout(entry->seen_at, CANDIDATES_SEEN_TIMEOUT))
+        else if (!is_timeout(assoc->mono_time, entry->seen_at, CANDIDATES_SEEN_TIMEOUT))
             check = SEENG;
-        else if (!is_timeout(entry->heard_at, CANDIDATES_HEARD_TIMEOUT))
+        else if (!is_timeout(assoc->mono_time, entry->heard_at, CANDIDATES_HEARD_TIMEOUT))
             check = SEENB_HEARDG;
         else
             check = BAD;
@@ -479,7 +480,7 @@ static uint8_t candidates_create_new(const Assoc *assoc, hash_t hash, const uint
     id_copy(entry->client.client_id, id);
 
     if (used)
-        entry->used_at = unix_time();
+        entry->used_at = unix_time(assoc->mono_time);
 
     if (ipp_recv && !ipport_isset(ipp_recv))
         ipp_recv = NULL;
@@ -491,7 +492,7 @@ static uint8_t candidates_create_new(const Assoc *assoc, hash_t hash, const uint
         ipptsp->ip_port = ippts_send->ip_port;
         ipptsp->timestamp = ippts_send->timestamp;
         ipptsp->ret_ip_port = *ipp_recv;
-        ipptsp->ret_timestamp = unix_time();
+        ipptsp->ret_timestamp = unix_time(assoc->mono_time);
     } else {
         IP_Port *heard = entry_heard_get(entry, &ippts_send->ip_port);
 
@@ -711,12 +712,14 @@ uint8_t Assoc_get_close_entries(Assoc *assoc, Assoc_close_entries *state)
                 taken_last = i;
             } else {
                 if (state->flags & (ProtoIPv4 | ProtoIPv6)) {
-                    if ((state->flags & ProtoIPv4) && is_timeout(entry->client.assoc4.timestamp, BAD_NODE_TIMEOUT))
+                    if ((state->flags & ProtoIPv4)
+                            && is_timeout(assoc->mono_time, entry->client.assoc4.timestamp, BAD_NODE_TIMEOUT))
                         continue;
 
-                    if ((state->flags & ProtoIPv6) && is_timeout(entry->client.assoc6.timestamp, BAD_NODE_TIMEOUT))
+                    if ((state->flags & ProtoIPv6)
+                            && is_timeout(assoc->mono_time, entry->client.assoc6.timestamp, BAD_NODE_TIMEOUT))
                         continue;
-                } else if (is_timeout(entry->seen_at, BAD_NODE_TIMEOUT))
+                } else if (is_timeout(assoc->mono_time, entry->seen_at, BAD_NODE_TIMEOUT))
                     continue;
 
                 state->result[pos++] = &entry->client;
@@ -776,7 +779,7 @@ static size_t prime_upto_min9(size_t limit)
 }
 
 /* create */
-Assoc *new_Assoc(size_t bits, size_t entries, const uint8_t *public_id)
+Assoc *new_Assoc(const Mono_Time *mono_time, size_t bits, size_t entries, const uint8_t *public_id)
 {
     if (!public_id)
         return NULL;
@@ -786,6 +789,8 @@ Assoc *new_Assoc(size_t bits, size_t entries, const uint8_t *public_id)
     if (!assoc)
         return NULL;
 
+    assoc->mono_time = mono_time;
+
     /*
      * bits must be in [ 2 .. 15 ]
      * entries must be a prime
@@ -853,7 +858,7 @@ Assoc *new_Assoc(size_t bits, size_t entries, const uint8_t *public_id)
     }
 
     assoc->candidates = lists;
-    assoc->getnodes = unix_time();
+    assoc->getnodes = unix_time(assoc->mono_time);
 
     id_copy(assoc->self_client_id, public_id);
     client_id_self_update(assoc);
@@ -861,11 +866,11 @@ Assoc *new_Assoc(size_t bits, size_t entries, const uint8_t *public_id)
     return assoc;
 }
 
-Assoc *new_Assoc_default(const uint8_t *public_id)
+Assoc *new_Assoc_default(const Mono_Time *mono_time, const uint8_t *public_id)
 {
     /* original 8, 251 averages to ~32k entries... probably the whole DHT :D
      * 320 entries is fine, hopefully */
-    return new_Assoc(6, 15, public_id);
+    return new_Assoc(mono_time, 6, 15, public_id);
 }
 
 /* own client_id, assocs for this have to be ignored */
@@ -885,8 +890,8 @@ static char *idpart2str(uint8_t *id, size_t len);
 /* refresh buckets */
 void do_Assoc(Assoc *assoc, DHT *dht)
 {
-    if (is_timeout(assoc->getnodes, ASSOC_BUCKET_REFRESH)) {
-        assoc->getnodes = unix_time();
+    if (is_timeout(assoc->mono_time, assoc->getnodes, ASSOC_BUCKET_REFRESH)) {
+        assoc->getnodes = unix_time(assoc->mono_time);
 
         size_t candidate = (rand() % assoc->candidates_bucket_count) + assoc->candidates_bucket_count;
 
@@ -910,7 +915,7 @@ void do_Assoc(Assoc *assoc, DHT *dht)
                 if (assoc->candidates[bckt].list[m].hash) {
                     Client_entry *entry = &assoc->candidates[bckt].list[m];
 
-                    if (!is_timeout(entry->getnodes, CANDIDATES_SEEN_TIMEOUT))
+                    if (!is_timeout(assoc->mono_time, entry->getnodes, CANDIDATES_SEEN_TIMEOUT))
                         continue;
 
                     if (!target_id)
@@ -918,13 +923,13 @@ void do_Assoc(Assoc *assoc, DHT *dht)
 
                     if (entry->seen_at) {
                         if (!seen)
-                            if (!is_timeout(entry->seen_at, CANDIDATES_SEEN_TIMEOUT))
+                            if (!is_timeout(assoc->mono_time, entry->seen_at, CANDIDATES_SEEN_TIMEOUT))
                                 seen = entry;
                     }
 
                     if (entry->heard_at) {
                         if (!heard)
-                            if (!is_timeout(entry->heard_at, CANDIDATES_HEARD_TIMEOUT))
+                            if (!is_timeout(assoc->mono_time, entry->heard_at, CANDIDATES_HEARD_TIMEOUT))
                                 heard = entry;
                     }
 
@@ -943,7 +948,7 @@ void do_Assoc(Assoc *assoc, DHT *dht)
                          idpart2str(seen->client.client_id, 8), ip_ntoa(&ippts->ip_port.ip), htons(ippts->ip_port.port));
 
             DHT_getnodes(dht, &ippts->ip_port, seen->client.client_id, target_id);
-            seen->getnodes = unix_time();
+            seen->getnodes = unix_time(assoc->mono_time);
         }
 
         if (heard && (heard != seen)) {
@@ -953,7 +958,7 @@ void do_Assoc(Assoc *assoc, DHT *dht)
                          idpart2str(heard->client.client_id, 8), ip_ntoa(&ipp->ip), htons(ipp->port));
 
             DHT_getnodes(dht, ipp, heard->client.client_id, target_id);
-            heard->getnodes = unix_time();
+            heard->getnodes = unix_time(assoc->mono_time);
         }
 
         LOGGER_SCOPE (
@@ -1013,10 +1018,10 @@ void Assoc_status(const Assoc *assoc)
 
                 LOGGER_TRACE("[%3i:%3i] %08x => [%s...] %i, %i(%c), %i(%c)\n",
                              (int)bid, (int)cid, entry->hash, idpart2str(entry->client.client_id, 8),
-                             entry->used_at ? (int)(unix_time() - entry->used_at) : 0,
-                             entry->seen_at ? (int)(unix_time() - entry->seen_at) : 0,
+                             entry->used_at ? (int)(unix_time(assoc->mono_time) - entry->used_at) : 0,
+                             entry->seen_at ? (int)(unix_time(assoc->mono_time) - entry->seen_at) : 0,
                              entry->seen_at ? (entry->seen_family == AF_INET ? '4' : (entry->seen_family == AF_INET6 ? '6' : '?')) : '?',
-                             entry->heard_at ? (int)(unix_time() - entry->heard_at) : 0,
+                             entry->heard_at ? (int)(unix_time(assoc->mono_time) - entry->heard_at) : 0,
                              entry->heard_at ? (entry->heard_family == AF_INET ? '4' : (entry->heard_family == AF_INET6 ? '6' : '?')) : '?');
             }
         }
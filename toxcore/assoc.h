@@ -73,7 +73,7 @@ uint8_t Assoc_get_close_entries(Assoc *assoc, Assoc_close_entries *close_entries
 /*****************************************************************************/
 
 /* create: default sizes (6, 5 => 320 entries) */
-Assoc *new_Assoc_default(const uint8_t *public_id);
+Assoc *new_Assoc_default(const Mono_Time *mono_time, const uint8_t *public_id);
 
 /* create: customized sizes
  * total is (2^bits) * entries
@@ -82,7 +82,7 @@ Assoc *new_Assoc_default(const uint8_t *public_id);
  *
  * preferably bits should be large and entries small to ensure spread
  * in the search space (e. g. 5, 5 is preferable to 2, 41) */
-Assoc *new_Assoc(size_t bits, size_t entries, const uint8_t *public_id);
+Assoc *new_Assoc(const Mono_Time *mono_time, size_t bits, size_t entries, const uint8_t *public_id);
 
 /* public_id changed (loaded), update which entry isn't stored */
 void Assoc_self_client_id_changed(Assoc *assoc, const uint8_t *public_id);
@@ -0,0 +1,504 @@
+/* congestion_control.c
+ *
+ * Congestion control algorithms used by net_crypto connections.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "congestion_control.h"
+
+#include <string.h>
+
+/* Longest burst in ms of packets the paced algorithms allow. */
+#define CONGESTION_PACING_BURST_TIME 20
+
+/* Smallest burst in packets the paced algorithms allow. */
+#define CONGESTION_MIN_BURST 10
+
+/* Shortest time in ms the delivery rate is measured over. */
+#define CONGESTION_MIN_ROUND_TIME (CONGESTION_CONTROL_INTERVAL * 2)
+
+/* Timeout for increasing speed after congestion event (in ms). */
+#define CONGESTION_EVENT_TIMEOUT 2000
+
+/* Time in ms after which min_rtt is replaced by the next sample even if it is larger. */
+#define DEFAULT_MIN_RTT_WINDOW (10 * 60 * 1000)
+#define BBR_MIN_RTT_WINDOW (10 * 1000)
+
+/* LEDBAT: queuing delay in ms we try to stay at. */
+#define LEDBAT_TARGET_DELAY 100
+#define LEDBAT_GAIN 1.0
+#define LEDBAT_MIN_CWND 2.0
+#define LEDBAT_INITIAL_CWND 10.0
+#define LEDBAT_MAX_CWND 16384.0
+
+/* BBR */
+#define BBR_HIGH_GAIN 2.885
+#define BBR_CWND_GAIN 2.0
+#define BBR_INITIAL_CWND 10.0
+#define BBR_FULL_BW_THRESHOLD 1.25
+#define BBR_FULL_BW_COUNT 3
+#define BBR_PROBE_RTT_TIME 200
+#define BBR_PROBE_RTT_PACKETS 4.0
+#define BBR_GAIN_CYCLE_LENGTH 8
+
+enum {
+    BBR_STARTUP,
+    BBR_DRAIN,
+    BBR_PROBE_BW,
+    BBR_PROBE_RTT
+};
+
+static const double bbr_gain_cycle[BBR_GAIN_CYCLE_LENGTH] = {1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+
+/* return the RTT in ms the algorithms should base their calculations on.
+ */
+static uint64_t base_rtt(const Congestion_Control *cc)
+{
+    if (cc->min_rtt)
+        return cc->min_rtt;
+
+    return cc->smoothed_rtt;
+}
+
+/* return the estimated queuing delay in ms.
+ */
+static uint64_t queuing_delay(const Congestion_Control *cc)
+{
+    if (cc->min_rtt == 0 || cc->latest_rtt < cc->min_rtt)
+        return 0;
+
+    return cc->latest_rtt - cc->min_rtt;
+}
+
+/* Pacing for the newer algorithms: packets are added at exactly send_rate, carrying over
+ * fractions of packets between calls, and bursts are kept short.
+ */
+static void paced_pace(Congestion_Control *cc, uint64_t now, uint32_t *packets_left)
+{
+    uint32_t max_burst = cc->send_rate * (CONGESTION_PACING_BURST_TIME / 1000.0);
+
+    if (max_burst < CONGESTION_MIN_BURST)
+        max_burst = CONGESTION_MIN_BURST;
+
+    if (cc->last_packets_left_set == 0) {
+        cc->last_packets_left_set = now;
+        *packets_left = max_burst;
+        return;
+    }
+
+    double credit = cc->pacing_credit + cc->send_rate * ((double)(now - cc->last_packets_left_set) / 1000.0);
+    uint32_t num_packets = credit;
+    cc->pacing_credit = credit - num_packets;
+    cc->last_packets_left_set = now;
+
+    if (*packets_left + num_packets > max_burst) {
+        if (*packets_left < max_burst)
+            *packets_left = max_burst;
+
+        cc->pacing_credit = 0;
+    } else {
+        *packets_left += num_packets;
+    }
+}
+
+/** Default: send rate from the change of the send queue size over time. **/
+
+static void default_init(Congestion_Control *cc, uint64_t now)
+{
+    cc->min_rtt_window = DEFAULT_MIN_RTT_WINDOW;
+}
+
+static void default_on_ack(Congestion_Control *cc, uint64_t now, uint32_t num_acked)
+{
+}
+
+static void default_on_loss(Congestion_Control *cc, uint64_t now, uint32_t num_lost)
+{
+}
+
+static void default_update(Congestion_Control *cc, uint64_t now, uint32_t send_queue_size)
+{
+    unsigned int pos = cc->last_sendqueue_counter % CONGESTION_QUEUE_ARRAY_SIZE;
+    cc->last_sendqueue_size[pos] = send_queue_size;
+    ++cc->last_sendqueue_counter;
+
+    unsigned int j;
+    long signed int sum = 0;
+    sum = (long signed int)cc->last_sendqueue_size[(pos) % CONGESTION_QUEUE_ARRAY_SIZE] -
+          (long signed int)cc->last_sendqueue_size[(pos - (CONGESTION_QUEUE_ARRAY_SIZE - 1)) % CONGESTION_QUEUE_ARRAY_SIZE];
+
+    cc->last_num_packets_sent[pos] = cc->packets_sent;
+    long signed int total_sent = 0;
+
+    for (j = 0; j < CONGESTION_QUEUE_ARRAY_SIZE; ++j) {
+        total_sent += cc->last_num_packets_sent[j];
+    }
+
+    total_sent -= sum;
+
+    double min_speed = 1000.0 * (((double)(total_sent)) / ((double)(CONGESTION_QUEUE_ARRAY_SIZE) *
+                                 CONGESTION_CONTROL_INTERVAL));
+
+    if (cc->last_congestion_event + CONGESTION_EVENT_TIMEOUT < now) {
+        cc->send_rate = min_speed * 1.25;
+    } else {
+        cc->send_rate = min_speed;
+    }
+}
+
+static void default_pace(Congestion_Control *cc, uint64_t now, uint32_t *packets_left)
+{
+    if (cc->last_packets_left_set == 0) {
+        cc->last_packets_left_set = now;
+        *packets_left = CONGESTION_MIN_QUEUE_LENGTH;
+    } else if (((uint64_t)((1000.0 / cc->send_rate) + 0.5) + cc->last_packets_left_set) < now) {
+        uint32_t num_packets = cc->send_rate * ((double)(now - cc->last_packets_left_set) / 1000.0) + 0.5;
+
+        if (*packets_left > num_packets * 4 + CONGESTION_MIN_QUEUE_LENGTH) {
+            *packets_left = num_packets * 4 + CONGESTION_MIN_QUEUE_LENGTH;
+        } else {
+            *packets_left += num_packets;
+        }
+
+        cc->last_packets_left_set = now;
+    }
+}
+
+/** LEDBAT: delay based window that keeps the queuing delay at LEDBAT_TARGET_DELAY. **/
+
+static void ledbat_init(Congestion_Control *cc, uint64_t now)
+{
+    cc->min_rtt_window = DEFAULT_MIN_RTT_WINDOW;
+    cc->cwnd = LEDBAT_INITIAL_CWND;
+    cc->slow_start = 1;
+    cc->send_rate = (cc->cwnd * 1000.0) / cc->smoothed_rtt;
+}
+
+static void ledbat_on_ack(Congestion_Control *cc, uint64_t now, uint32_t num_acked)
+{
+    uint64_t delay = queuing_delay(cc);
+
+    if (cc->slow_start && delay > LEDBAT_TARGET_DELAY / 2)
+        cc->slow_start = 0;
+
+    if (cc->slow_start) {
+        cc->cwnd += num_acked;
+    } else {
+        double off_target = ((double)LEDBAT_TARGET_DELAY - (double)delay) / LEDBAT_TARGET_DELAY;
+        cc->cwnd += (LEDBAT_GAIN * off_target * num_acked) / cc->cwnd;
+    }
+
+    if (cc->cwnd < LEDBAT_MIN_CWND)
+        cc->cwnd = LEDBAT_MIN_CWND;
+
+    if (cc->cwnd > LEDBAT_MAX_CWND)
+        cc->cwnd = LEDBAT_MAX_CWND;
+}
+
+static void ledbat_on_loss(Congestion_Control *cc, uint64_t now, uint32_t num_lost)
+{
+    cc->slow_start = 0;
+
+    /* At most once per RTT. */
+    if (cc->last_cwnd_decrease + cc->smoothed_rtt > now)
+        return;
+
+    cc->cwnd /= 2.0;
+
+    if (cc->cwnd < LEDBAT_MIN_CWND)
+        cc->cwnd = LEDBAT_MIN_CWND;
+
+    cc->last_cwnd_decrease = now;
+}
+
+static void ledbat_update(Congestion_Control *cc, uint64_t now, uint32_t send_queue_size)
+{
+    cc->send_rate = (cc->cwnd * 1000.0) / cc->smoothed_rtt;
+}
+
+/** BBR: send at the estimated bottleneck bandwidth, periodically probing for more. **/
+
+static void bbr_init(Congestion_Control *cc, uint64_t now)
+{
+    cc->min_rtt_window = BBR_MIN_RTT_WINDOW;
+    cc->bbr_state = BBR_STARTUP;
+    cc->bbr_pacing_gain = BBR_HIGH_GAIN;
+    cc->send_rate = (BBR_HIGH_GAIN * BBR_INITIAL_CWND * 1000.0) / cc->smoothed_rtt;
+}
+
+static void bbr_on_ack(Congestion_Control *cc, uint64_t now, uint32_t num_acked)
+{
+}
+
+static void bbr_on_loss(Congestion_Control *cc, uint64_t now, uint32_t num_lost)
+{
+}
+
+static void bbr_update(Congestion_Control *cc, uint64_t now, uint32_t send_queue_size)
+{
+    uint64_t rtt = base_rtt(cc);
+    double bandwidth = cc->max_bandwidth;
+
+    if (bandwidth == 0)
+        bandwidth = (BBR_INITIAL_CWND * 1000.0) / rtt;
+
+    double bdp = (bandwidth * rtt) / 1000.0;
+
+    if (cc->bbr_state == BBR_STARTUP && cc->bbr_round != cc->round_count) {
+        cc->bbr_round = cc->round_count;
+
+        if (cc->max_bandwidth >= cc->bbr_full_bandwidth * BBR_FULL_BW_THRESHOLD) {
+            cc->bbr_full_bandwidth = cc->max_bandwidth;
+            cc->bbr_full_bandwidth_count = 0;
+        } else if (++cc->bbr_full_bandwidth_count >= BBR_FULL_BW_COUNT) {
+            cc->bbr_state = BBR_DRAIN;
+            cc->bbr_pacing_gain = 1.0 / BBR_HIGH_GAIN;
+        }
+    }
+
+    if (cc->bbr_state == BBR_DRAIN && send_queue_size <= bdp) {
+        cc->bbr_state = BBR_PROBE_BW;
+        cc->bbr_cycle_index = 0;
+        cc->bbr_cycle_start = now;
+        cc->bbr_pacing_gain = bbr_gain_cycle[0];
+    }
+
+    if (cc->bbr_state == BBR_PROBE_BW && cc->bbr_cycle_start + rtt <= now) {
+        cc->bbr_cycle_index = (cc->bbr_cycle_index + 1) % BBR_GAIN_CYCLE_LENGTH;
+        cc->bbr_cycle_start = now;
+        cc->bbr_pacing_gain = bbr_gain_cycle[cc->bbr_cycle_index];
+    }
+
+    if (cc->min_rtt_expired) {
+        cc->min_rtt_expired = 0;
+
+        if (cc->bbr_state != BBR_PROBE_RTT) {
+            cc->bbr_prior_state = cc->bbr_state;
+            cc->bbr_state = BBR_PROBE_RTT;
+            cc->bbr_probe_rtt_done = now + BBR_PROBE_RTT_TIME;
+        }
+    }
+
+    if (cc->bbr_state == BBR_PROBE_RTT) {
+        if (cc->bbr_probe_rtt_done <= now) {
+            cc->bbr_state = cc->bbr_prior_state;
+            cc->bbr_cycle_start = now;
+            /* The samples taken while the queue was drained are the new min_rtt. */
+            cc->min_rtt_time = now;
+        } else {
+            cc->send_rate = (BBR_PROBE_RTT_PACKETS * 1000.0) / rtt;
+            return;
+        }
+    }
+
+    cc->send_rate = cc->bbr_pacing_gain * bandwidth;
+
+    /* Too many packets in flight for the estimated path, drain them. */
+    if (cc->bbr_state != BBR_STARTUP && send_queue_size > BBR_CWND_GAIN * bdp + CONGESTION_MIN_QUEUE_LENGTH)
+        cc->send_rate = bandwidth / BBR_HIGH_GAIN;
+}
+
+/* Take a delivery rate sample once a round (at least one RTT) has passed since the
+ * last one. Rounds start and end on acks so every one covers whole ack intervals.
+ */
+static void update_bandwidth(Congestion_Control *cc, uint64_t now)
+{
+    uint64_t round_length = base_rtt(cc);
+
+    if (round_length < CONGESTION_MIN_ROUND_TIME)
+        round_length = CONGESTION_MIN_ROUND_TIME;
+
+    if (cc->round_start + round_length > now)
+        return;
+
+    double round_time = now - cc->round_start;
+    double bandwidth = (cc->round_acked * 1000.0) / round_time;
+    double send_rate = (cc->round_sent * 1000.0) / round_time;
+    double max_send_rate = send_rate > cc->last_round_send_rate ? send_rate : cc->last_round_send_rate;
+
+    /* Packets acked in this round were sent in this one or the one before. They can't have been
+     * delivered faster than they were sent, it only looks like it when acks get bunched up.
+     */
+    if (cc->round_count != 0 && bandwidth > max_send_rate)
+        bandwidth = max_send_rate;
+
+    cc->round_bandwidth[cc->round_count % CONGESTION_BW_ROUNDS] = bandwidth;
+    cc->last_round_send_rate = send_rate;
+    ++cc->round_count;
+    cc->round_start = now;
+    cc->round_acked = 0;
+    cc->round_sent = 0;
+    cc->max_bandwidth = 0;
+
+    uint32_t i;
+
+    for (i = 0; i < CONGESTION_BW_ROUNDS; ++i) {
+        if (cc->round_bandwidth[i] > cc->max_bandwidth)
+            cc->max_bandwidth = cc->round_bandwidth[i];
+    }
+}
+
+static const Congestion_Control_Algorithm algorithms[CONGESTION_CONTROL_INVALID] = {
+    {"default", default_init, default_on_ack, default_on_loss, default_update, default_pace},
+    {"ledbat", ledbat_init, ledbat_on_ack, ledbat_on_loss, ledbat_update, paced_pace},
+    {"bbr", bbr_init, bbr_on_ack, bbr_on_loss, bbr_update, paced_pace},
+};
+
+/* Initialize cc to use the algorithm type.
+ *
+ * return -1 on failure (unknown algorithm).
+ * return 0 on success.
+ */
+int congestion_control_init(Congestion_Control *cc, CONGESTION_CONTROL_TYPE type, uint64_t now)
+{
+    if ((unsigned int)type >= CONGESTION_CONTROL_INVALID)
+        return -1;
+
+    memset(cc, 0, sizeof(Congestion_Control));
+    cc->algorithm = &algorithms[type];
+    cc->type = type;
+    cc->send_rate = CONGESTION_MIN_SEND_RATE;
+    cc->smoothed_rtt = CONGESTION_INITIAL_RTT;
+    cc->rtt_var = CONGESTION_INITIAL_RTT / 2;
+    cc->last_update = now;
+    cc->round_start = now;
+    cc->algorithm->init(cc, now);
+
+    if (cc->send_rate < CONGESTION_MIN_SEND_RATE)
+        cc->send_rate = CONGESTION_MIN_SEND_RATE;
+
+    return 0;
+}
+
+/* return the name of the algorithm type or NULL if it does not exist.
+ */
+const char *congestion_control_name(CONGESTION_CONTROL_TYPE type)
+{
+    if ((unsigned int)type >= CONGESTION_CONTROL_INVALID)
+        return NULL;
+
+    return algorithms[type].name;
+}
+
+/* num packets subject to congestion control were sent for the first time.
+ */
+void congestion_control_on_sent(Congestion_Control *cc, uint32_t num)
+{
+    cc->packets_sent += num;
+    cc->round_sent += num;
+    cc->total_sent += num;
+}
+
+/* A packet sent rtt ms ago was acknowledged.
+ */
+void congestion_control_on_rtt_sample(Congestion_Control *cc, uint64_t now, uint64_t rtt)
+{
+    if (rtt == 0)
+        rtt = 1;
+
+    cc->latest_rtt = rtt;
+
+    if (cc->min_rtt == 0) {
+        cc->smoothed_rtt = rtt;
+        cc->rtt_var = rtt / 2;
+    } else {
+        uint64_t diff = cc->smoothed_rtt > rtt ? cc->smoothed_rtt - rtt : rtt - cc->smoothed_rtt;
+        cc->rtt_var = (3 * cc->rtt_var + diff) / 4;
+        cc->smoothed_rtt = (7 * cc->smoothed_rtt + rtt) / 8;
+
+        if (cc->smoothed_rtt == 0)
+            cc->smoothed_rtt = 1;
+    }
+
+    _Bool expired = cc->min_rtt != 0 && cc->min_rtt_time + cc->min_rtt_window < now;
+
+    if (cc->min_rtt == 0 || rtt <= cc->min_rtt || expired) {
+        cc->min_rtt = rtt;
+        cc->min_rtt_time = now;
+
+        if (expired)
+            cc->min_rtt_expired = 1;
+    }
+}
+
+/* num_acked packets were received by the other side.
+ */
+void congestion_control_on_ack(Congestion_Control *cc, uint64_t now, uint32_t num_acked)
+{
+    if (num_acked == 0)
+        return;
+
+    cc->packets_acked += num_acked;
+    cc->total_acked += num_acked;
+    cc->round_acked += num_acked;
+    update_bandwidth(cc, now);
+    cc->algorithm->on_ack(cc, now, num_acked);
+}
+
+/* num_lost packets were requested again by the other side.
+ */
+void congestion_control_on_loss(Congestion_Control *cc, uint64_t now, uint32_t num_lost)
+{
+    if (num_lost == 0)
+        return;
+
+    cc->packets_lost += num_lost;
+    cc->total_lost += num_lost;
+    cc->algorithm->on_loss(cc, now, num_lost);
+}
+
+/* The connection used up all the packets it was allowed to send.
+ */
+void congestion_control_on_congestion_event(Congestion_Control *cc, uint64_t now)
+{
+    cc->last_congestion_event = now;
+}
+
+/* Calculate a new send rate, must be called every CONGESTION_CONTROL_INTERVAL.
+ * send_queue_size is the number of packets sent but not yet acknowledged.
+ */
+void congestion_control_update(Congestion_Control *cc, uint64_t now, uint32_t send_queue_size)
+{
+    if (now > cc->last_update)
+        cc->delivery_rate = (cc->packets_acked * 1000.0) / (now - cc->last_update);
+
+    cc->algorithm->update(cc, now, send_queue_size);
+
+    if (cc->send_rate < CONGESTION_MIN_SEND_RATE)
+        cc->send_rate = CONGESTION_MIN_SEND_RATE;
+
+    cc->packets_sent = 0;
+    cc->packets_acked = 0;
+    cc->packets_lost = 0;
+    cc->last_update = now;
+}
+
+/* Add the packets we are allowed to send since the last call to packets_left.
+ *
+ * Packets are paced at cc->send_rate, how large bursts can get depends on the algorithm.
+ */
+void congestion_control_pace(Congestion_Control *cc, uint64_t now, uint32_t *packets_left)
+{
+    cc->algorithm->pace(cc, now, packets_left);
+}
@@ -0,0 +1,181 @@
+/* congestion_control.h
+ *
+ * Congestion control algorithms used by net_crypto connections.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CONGESTION_CONTROL_H
+#define CONGESTION_CONTROL_H
+
+#include <stdint.h>
+
+/* Interval in ms at which congestion_control_update() must be called. */
+#define CONGESTION_CONTROL_INTERVAL 50
+
+/* Minimum packet rate per second. */
+#define CONGESTION_MIN_SEND_RATE 8.0
+
+/* Minimum packet queue max length. */
+#define CONGESTION_MIN_QUEUE_LENGTH 64
+
+/* RTT in ms assumed before the first sample is taken. */
+#define CONGESTION_INITIAL_RTT 200
+
+/* Base current transfer speed on last CONGESTION_QUEUE_ARRAY_SIZE number of points taken
+   every CONGESTION_CONTROL_INTERVAL. */
+#define CONGESTION_QUEUE_ARRAY_SIZE 24
+
+/* Number of rounds (roughly one RTT each) the bandwidth estimate is kept for. */
+#define CONGESTION_BW_ROUNDS 10
+
+typedef enum {
+    CONGESTION_CONTROL_DEFAULT,
+    CONGESTION_CONTROL_LEDBAT,
+    CONGESTION_CONTROL_BBR,
+    CONGESTION_CONTROL_INVALID
+} CONGESTION_CONTROL_TYPE;
+
+typedef struct Congestion_Control Congestion_Control;
+
+/* The functions every algorithm implements. The shared RTT and bandwidth estimates
+ * in Congestion_Control are updated before any of them is called.
+ */
+typedef struct {
+    const char *name;
+
+    void (*init)(Congestion_Control *cc, uint64_t now);
+
+    /* num_acked packets were received by the other side. */
+    void (*on_ack)(Congestion_Control *cc, uint64_t now, uint32_t num_acked);
+
+    /* num_lost packets were requested again by the other side. */
+    void (*on_loss)(Congestion_Control *cc, uint64_t now, uint32_t num_lost);
+
+    /* Called every CONGESTION_CONTROL_INTERVAL, must set cc->send_rate. */
+    void (*update)(Congestion_Control *cc, uint64_t now, uint32_t send_queue_size);
+
+    /* Add the packets that can be sent since the last call to packets_left. */
+    void (*pace)(Congestion_Control *cc, uint64_t now, uint32_t *packets_left);
+} Congestion_Control_Algorithm;
+
+struct Congestion_Control {
+    const Congestion_Control_Algorithm *algorithm;
+    CONGESTION_CONTROL_TYPE type;
+
+    double send_rate; /* Packets per second we are allowed to send. */
+    uint64_t last_packets_left_set;
+    double pacing_credit; /* Fraction of a packet carried over to the next pace call. */
+
+    /* Packets counted since the last update. */
+    uint32_t packets_sent;
+    uint32_t packets_acked;
+    uint32_t packets_lost;
+    uint64_t last_update;
+    uint64_t last_congestion_event; /* Last time we ran out of packets to send. */
+
+    uint64_t total_sent;
+    uint64_t total_acked;
+    uint64_t total_lost;
+
+    /* RTT estimation (ms). */
+    uint64_t latest_rtt;
+    uint64_t smoothed_rtt;
+    uint64_t rtt_var;
+    uint64_t min_rtt;
+    uint64_t min_rtt_time; /* When min_rtt was last lowered or refreshed. */
+    uint64_t min_rtt_window; /* min_rtt is replaced by the next sample once it is this old. */
+    _Bool min_rtt_expired; /* Set when that happens, for the algorithm to reset. */
+
+    /* Bandwidth estimation (packets per second), max of the delivery rate
+     * over the last CONGESTION_BW_ROUNDS rounds.
+     */
+    double delivery_rate;
+    double max_bandwidth;
+    double round_bandwidth[CONGESTION_BW_ROUNDS];
+    uint32_t round_count;
+    uint64_t round_start;
+    uint32_t round_acked;
+    uint32_t round_sent;
+    double last_round_send_rate;
+
+    /* CONGESTION_CONTROL_DEFAULT */
+    uint32_t last_sendqueue_size[CONGESTION_QUEUE_ARRAY_SIZE], last_sendqueue_counter;
+    long signed int last_num_packets_sent[CONGESTION_QUEUE_ARRAY_SIZE];
+
+    /* CONGESTION_CONTROL_LEDBAT */
+    double cwnd; /* In packets. */
+    _Bool slow_start;
+    uint64_t last_cwnd_decrease;
+
+    /* CONGESTION_CONTROL_BBR */
+    uint8_t bbr_state;
+    uint8_t bbr_cycle_index;
+    uint64_t bbr_cycle_start;
+    double bbr_pacing_gain;
+    double bbr_full_bandwidth;
+    uint8_t bbr_full_bandwidth_count;
+    uint32_t bbr_round;
+    uint64_t bbr_probe_rtt_done;
+    uint8_t bbr_prior_state;
+};
+
+/* Initialize cc to use the algorithm type.
+ *
+ * return -1 on failure (unknown algorithm).
+ * return 0 on success.
+ */
+int congestion_control_init(Congestion_Control *cc, CONGESTION_CONTROL_TYPE type, uint64_t now);
+
+/* return the name of the algorithm type or NULL if it does not exist.
+ */
+const char *congestion_control_name(CONGESTION_CONTROL_TYPE type);
+
+/* num packets subject to congestion control were sent for the first time.
+ */
+void congestion_control_on_sent(Congestion_Control *cc, uint32_t num);
+
+/* A packet sent rtt ms ago was acknowledged.
+ */
+void congestion_control_on_rtt_sample(Congestion_Control *cc, uint64_t now, uint64_t rtt);
+
+/* num_acked packets were received by the other side.
+ */
+void congestion_control_on_ack(Congestion_Control *cc, uint64_t now, uint32_t num_acked);
+
+/* num_lost packets were requested again by the other side.
+ */
+void congestion_control_on_loss(Congestion_Control *cc, uint64_t now, uint32_t num_lost);
+
+/* The connection used up all the packets it was allowed to send.
+ */
+void congestion_control_on_congestion_event(Congestion_Control *cc, uint64_t now);
+
+/* Calculate a new send rate, must be called every CONGESTION_CONTROL_INTERVAL.
+ * send_queue_size is the number of packets sent but not yet acknowledged.
+ */
+void congestion_control_update(Congestion_Control *cc, uint64_t now, uint32_t send_queue_size);
+
+/* Add the packets we are allowed to send since the last call to packets_left.
+ *
+ * Packets are paced at cc->send_rate, how large bursts can get depends on the algorithm.
+ */
+void congestion_control_pace(Congestion_Control *cc, uint64_t now, uint32_t *packets_left);
+
+#endif
@@ -30,6 +30,9 @@
 #include "crypto_core.h"
 #include "util.h"
 
+#include <pthread.h>
+#include <stdlib.h>
+
 // Need dht because of ENC_SECRET_KEY and ENC_PUBLIC_KEY
 #include "DHT.h"
 
@@ -61,26 +64,161 @@ int public_key_cmp(const uint8_t *pk1, const uint8_t *pk2)
     return crypto_verify_32(pk1, pk2);
 }
 
+#ifndef VANILLA_NACL
+
+/* Bytes of stream generated at once, the first crypto_stream_chacha20_KEYBYTES become the next key */
+#define RANDOM_BUFFER_SIZE 512
+
+typedef struct {
+    uint8_t key[crypto_stream_chacha20_KEYBYTES];
+    uint8_t stream[crypto_stream_chacha20_KEYBYTES + RANDOM_BUFFER_SIZE];
+    uint32_t available;   /* unused bytes at the end of stream */
+    uint32_t since_reseed;
+    uint32_t generation;   /* random_generation when the key was taken from the OS */
+    _Bool seeded;
+} Random_State;
+
+static pthread_key_t random_state_key;
+static pthread_once_t random_state_once = PTHREAD_ONCE_INIT;
+static _Bool random_state_ok;
+
+/* Bumped in the child after fork() so that it doesn't repeat the stream of its parent. Only ever
+ * written while the child has a single thread.
+ */
+static uint32_t random_generation;
+
+static void free_random_state(void *state)
+{
+    sodium_memzero(state, sizeof(Random_State));
+    free(state);
+}
+
+static void random_after_fork(void)
+{
+    ++random_generation;
+}
+
+static void random_init_key(void)
+{
+    random_state_ok = pthread_key_create(&random_state_key, &free_random_state) == 0
+                      && pthread_atfork(NULL, NULL, &random_after_fork) == 0;
+}
+
+/* return the state of the calling thread, NULL if it can't be allocated. */
+static Random_State *random_state(void)
+{
+    pthread_once(&random_state_once, &random_init_key);
+
+    if (!random_state_ok)
+        return NULL;
+
+    Random_State *state = pthread_getspecific(random_state_key);
+
+    if (state)
+        return state;
+
+    state = calloc(1, sizeof(Random_State));
+
+    if (state == NULL)
+        return NULL;
+
+    if (pthread_setspecific(random_state_key, state) != 0) {
+        free(state);
+        return NULL;
+    }
+
+    return state;
+}
+
+/* Generates the next buffer and key. Each key is only used once, so the nonce can stay zero. */
+static void random_refill(Random_State *state)
+{
+    static const uint8_t nonce[crypto_stream_chacha20_NONCEBYTES];
+
+    if (!state->seeded || state->since_reseed >= RANDOM_RESEED_BYTES) {
+        randombytes(state->key, sizeof(state->key));
+        state->since_reseed = 0;
+        state->generation = random_generation;
+        state->seeded = 1;
+    }
+
+    crypto_stream_chacha20(state->stream, sizeof(state->stream), nonce, state->key);
+    memcpy(state->key, state->stream, sizeof(state->key));
+    sodium_memzero(state->stream, sizeof(state->key));
+    state->available = RANDOM_BUFFER_SIZE;
+    state->since_reseed += RANDOM_BUFFER_SIZE;
+}
+
+void random_bytes(uint8_t *bytes, size_t length)
+{
+    Random_State *state = random_state();
+
+    if (state == NULL) {
+        randombytes(bytes, length);
+        return;
+    }
+
+    if (state->generation != random_generation) {
+        state->available = 0;
+        state->seeded = 0;
+    }
+
+    while (length) {
+        if (state->available == 0)
+            random_refill(state);
+
+        size_t n = MIN(length, state->available);
+        uint8_t *unused = state->stream + sizeof(state->stream) - state->available;
+
+        /* Bytes handed out are wiped so that they can't be recovered from the state later */
+        memcpy(bytes, unused, n);
+        memset(unused, 0, n);
+        state->available -= n;
+        bytes += n;
+        length -= n;
+    }
+}
+
+#else
+
+void random_bytes(uint8_t *bytes, size_t length)
+{
+    randombytes(bytes, length);
+}
+
+#endif
+
 /*  return a random uint32_t.
  */
 uint32_t random_int(void)
 {
     uint32_t randnum;
-    randombytes((uint8_t *)&randnum , sizeof(randnum));
+    random_bytes((uint8_t *)&randnum , sizeof(randnum));
     return randnum;
 }
 
 uint64_t random_64b(void)
 {
     uint64_t randnum;
-    randombytes((uint8_t *)&randnum, sizeof(randnum));
+    random_bytes((uint8_t *)&randnum, sizeof(randnum));
     return randnum;
 }
 
 /* Return a value between 0 and upper_bound using a uniform distribution */
 uint32_t random_int_range(uint32_t upper_bound)
 {
-    return randombytes_uniform(upper_bound);
+    if (upper_bound < 2)
+        return 0;
+
+    /* Reject the values below 2^32 % upper_bound, the rest are a multiple of upper_bound long */
+    uint32_t min = (0U - upper_bound) % upper_bound;
+    uint32_t randnum;
+
+    do {
+        randnum = random_int();
+    } while (randnum < min);
+
+    return randnum % upper_bound;
 }
 
 /* Check if a Tox public key crypto_box_PUBLICKEYBYTES is valid or not.
@@ -201,7 +339,7 @@ void increment_nonce_number(uint8_t *nonce, uint32_t num)
 /* Fill the given nonce with random bytes. */
 void random_nonce(uint8_t *nonce)
 {
-    randombytes(nonce, crypto_box_NONCEBYTES);
+    random_bytes(nonce, crypto_box_NONCEBYTES);
 }
 
 /* Fill a key crypto_box_KEYBYTES big with random bytes */
@@ -52,6 +52,16 @@ void create_extended_keypair(uint8_t *pk, uint8_t *sk);
    return -1 if they are not. */
 int public_key_cmp(const uint8_t *pk1, const uint8_t *pk2);
 
+/* The random numbers, nonces and ping ids below come from a ChaCha20 stream kept for each thread
+ * and keyed from the OS random source, instead of asking the OS for every few bytes. The key is
+ * replaced by stream output every time the buffer is refilled and taken from the OS again after
+ * RANDOM_RESEED_BYTES and in a child after fork(). Keys still come from the OS directly.
+ */
+#define RANDOM_RESEED_BYTES (1024 * 1024)
+
+/* Fill bytes of length length with random bytes. */
+void random_bytes(uint8_t *bytes, size_t length);
+
 /*  return a random number.
  *
  * random_int for a 32bin int.
@@ -0,0 +1,227 @@
+/* crypto_pipeline.c
+ *
+ * Pool of worker threads used to encrypt and decrypt batches of data packets in parallel.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "crypto_pipeline.h"
+
+static void run_job(Crypto_Job *job)
+{
+    switch (job->type) {
+        case CRYPTO_JOB_ENCRYPT:
+            job->result = encrypt_data_symmetric(job->shared_key, job->nonce, job->input, job->input_length,
+                                                 job->output);
+            break;
+
+        case CRYPTO_JOB_DECRYPT:
+            job->result = decrypt_data_symmetric(job->shared_key, job->nonce, job->input, job->input_length,
+                                                 job->output);
+            break;
+
+        case CRYPTO_JOB_VERIFY:
+            job->result = crypto_sign_verify_detached(job->signature, job->input, job->input_length,
+                                                      job->public_sig_key);
+            break;
+
+        default:
+            job->result = -1;
+            break;
+    }
+}
+
+/* Take up to CRYPTO_PIPELINE_JOB_CHUNK jobs from the current batch and run them.
+ * pipeline->mutex must be locked when calling this, it is unlocked while the jobs run.
+ *
+ * return number of jobs that were run.
+ */
+static uint32_t run_job_chunk(Crypto_Pipeline *pipeline)
+{
+    uint32_t start = pipeline->next_job;
+
+    if (start >= pipeline->num_jobs)
+        return 0;
+
+    uint32_t end = start + CRYPTO_PIPELINE_JOB_CHUNK;
+
+    if (end > pipeline->num_jobs)
+        end = pipeline->num_jobs;
+
+    pipeline->next_job = end;
+    Crypto_Job *jobs = pipeline->jobs;
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    uint32_t i;
+
+    for (i = start; i < end; ++i) {
+        run_job(&jobs[i]);
+    }
+
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->jobs_done += end - start;
+
+    if (pipeline->jobs_done == pipeline->num_jobs)
+        pthread_cond_signal(&pipeline->done_cond);
+
+    return end - start;
+}
+
+static void *crypto_pipeline_worker(void *arg)
+{
+    Crypto_Pipeline *pipeline = arg;
+    uint64_t last_batch = 0;
+
+    pthread_mutex_lock(&pipeline->mutex);
+
+    while (1) {
+        while (!pipeline->shutdown && pipeline->batch_number == last_batch) {
+            pthread_cond_wait(&pipeline->work_cond, &pipeline->mutex);
+        }
+
+        if (pipeline->shutdown)
+            break;
+
+        last_batch = pipeline->batch_number;
+
+        while (run_job_chunk(pipeline) != 0);
+    }
+
+    pthread_mutex_unlock(&pipeline->mutex);
+    return NULL;
+}
+
+/* Create a new pipeline with num_workers worker threads.
+ * num_workers must be between 1 and CRYPTO_PIPELINE_MAX_WORKERS.
+ *
+ * return NULL on failure.
+ * return new pipeline on success.
+ */
+Crypto_Pipeline *new_crypto_pipeline(uint32_t num_workers)
+{
+    if (num_workers == 0 || num_workers > CRYPTO_PIPELINE_MAX_WORKERS)
+        return NULL;
+
+    Crypto_Pipeline *pipeline = calloc(1, sizeof(Crypto_Pipeline));
+
+    if (pipeline == NULL)
+        return NULL;
+
+    if (pthread_mutex_init(&pipeline->mutex, NULL) != 0) {
+        free(pipeline);
+        return NULL;
+    }
+
+    if (pthread_cond_init(&pipeline->work_cond, NULL) != 0) {
+        pthread_mutex_destroy(&pipeline->mutex);
+        free(pipeline);
+        return NULL;
+    }
+
+    if (pthread_cond_init(&pipeline->done_cond, NULL) != 0) {
+        pthread_cond_destroy(&pipeline->work_cond);
+        pthread_mutex_destroy(&pipeline->mutex);
+        free(pipeline);
+        return NULL;
+    }
+
+    uint32_t i;
+
+    for (i = 0; i < num_workers; ++i) {
+        if (pthread_create(&pipeline->workers[i], NULL, crypto_pipeline_worker, pipeline) != 0) {
+            pipeline->num_workers = i;
+            kill_crypto_pipeline(pipeline);
+            return NULL;
+        }
+    }
+
+    pipeline->num_workers = num_workers;
+    return pipeline;
+}
+
+/* Run all num_jobs jobs, splitting them between the worker threads and the
+ * calling thread. If pipeline is NULL all jobs are run on the calling thread.
+ *
+ * This function returns once every job has its result set. Jobs are independent
+ * of each other so their order of completion is not defined, the caller is responsible
+ * for handling the results in order.
+ */
+void crypto_pipeline_run(Crypto_Pipeline *pipeline, Crypto_Job *jobs, uint32_t num_jobs)
+{
+    if (num_jobs == 0)
+        return;
+
+    /* Not worth waking up the workers for a single chunk. */
+    if (pipeline == NULL || num_jobs <= CRYPTO_PIPELINE_JOB_CHUNK) {
+        uint32_t i;
+
+        for (i = 0; i < num_jobs; ++i) {
+            run_job(&jobs[i]);
+        }
+
+        return;
+    }
+
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->jobs = jobs;
+    pipeline->num_jobs = num_jobs;
+    pipeline->next_job = 0;
+    pipeline->jobs_done = 0;
+    ++pipeline->batch_number;
+    pthread_cond_broadcast(&pipeline->work_cond);
+
+    while (run_job_chunk(pipeline) != 0);
+
+    while (pipeline->jobs_done != pipeline->num_jobs) {
+        pthread_cond_wait(&pipeline->done_cond, &pipeline->mutex);
+    }
+
+    pipeline->jobs = NULL;
+    pipeline->num_jobs = 0;
+    pipeline->next_job = 0;
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+/* Stop all the worker threads and free the pipeline.
+ */
+void kill_crypto_pipeline(Crypto_Pipeline *pipeline)
+{
+    if (pipeline == NULL)
+        return;
+
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->shutdown = 1;
+    pthread_cond_broadcast(&pipeline->work_cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    uint32_t i;
+
+    for (i = 0; i < pipeline->num_workers; ++i) {
+        pthread_join(pipeline->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pipeline->done_cond);
+    pthread_cond_destroy(&pipeline->work_cond);
+    pthread_mutex_destroy(&pipeline->mutex);
+    free(pipeline);
+}
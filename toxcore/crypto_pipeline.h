@@ -0,0 +1,96 @@
+/* crypto_pipeline.h
+ *
+ * Pool of worker threads used to encrypt and decrypt batches of data packets, or verify batches
+ * of signatures, in parallel.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CRYPTO_PIPELINE_H
+#define CRYPTO_PIPELINE_H
+
+#include "crypto_core.h"
+#include <pthread.h>
+
+/* Maximum number of worker threads a pipeline can have. */
+#define CRYPTO_PIPELINE_MAX_WORKERS 64
+
+/* Number of jobs a worker takes from the batch at once. */
+#define CRYPTO_PIPELINE_JOB_CHUNK 4
+
+typedef enum {
+    CRYPTO_JOB_ENCRYPT,
+    CRYPTO_JOB_DECRYPT,
+    CRYPTO_JOB_VERIFY /* Verify the detached signature of input. */
+} CRYPTO_JOB_TYPE;
+
+typedef struct {
+    uint8_t shared_key[crypto_box_BEFORENMBYTES];
+    uint8_t nonce[crypto_box_NONCEBYTES];
+
+    const uint8_t *input;
+    uint16_t input_length;
+    uint8_t *output; /* Must have room for input_length + crypto_box_MACBYTES bytes. */
+
+    const uint8_t *signature; /* Verify jobs only. */
+    const uint8_t *public_sig_key; /* Verify jobs only. */
+
+    uint8_t type; /* One of CRYPTO_JOB_TYPE. */
+    int result; /* Return value of encrypt_data_symmetric()/decrypt_data_symmetric()/crypto_sign_verify_detached(). */
+} Crypto_Job;
+
+typedef struct {
+    pthread_t workers[CRYPTO_PIPELINE_MAX_WORKERS];
+    uint32_t num_workers;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond; /* Signaled when a new batch is available or on shutdown. */
+    pthread_cond_t done_cond; /* Signaled when the last job of a batch is finished. */
+
+    Crypto_Job *jobs;
+    uint32_t num_jobs;
+    uint32_t next_job; /* Index of the next job that hasn't been taken by a thread yet. */
+    uint32_t jobs_done;
+    uint64_t batch_number; /* Incremented every time a new batch is submitted. */
+
+    _Bool shutdown;
+} Crypto_Pipeline;
+
+/* Create a new pipeline with num_workers worker threads.
+ * num_workers must be between 1 and CRYPTO_PIPELINE_MAX_WORKERS.
+ *
+ * return NULL on failure.
+ * return new pipeline on success.
+ */
+Crypto_Pipeline *new_crypto_pipeline(uint32_t num_workers);
+
+/* Run all num_jobs jobs, splitting them between the worker threads and the
+ * calling thread. If pipeline is NULL all jobs are run on the calling thread.
+ *
+ * This function returns once every job has its result set. Jobs are independent
+ * of each other so their order of completion is not defined, the caller is responsible
+ * for handling the results in order.
+ */
+void crypto_pipeline_run(Crypto_Pipeline *pipeline, Crypto_Job *jobs, uint32_t num_jobs);
+
+/* Stop all the worker threads and free the pipeline.
+ */
+void kill_crypto_pipeline(Crypto_Pipeline *pipeline);
+
+#endif
@@ -0,0 +1,691 @@
+/* fec.c
+ *
+ * Forward error correction for lossy packets.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "fec.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1. */
+#define GF_POLYNOMIAL 0x11d
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static pthread_once_t gf_tables_once = PTHREAD_ONCE_INIT;
+
+static void gf_init_tables(void)
+{
+    unsigned int i, x = 1;
+
+    for (i = 0; i < 255; ++i) {
+        gf_exp[i] = x;
+        gf_log[x] = i;
+        x <<= 1;
+
+        if (x & 0x100)
+            x ^= GF_POLYNOMIAL;
+    }
+
+    /* So that gf_exp[gf_log[a] + gf_log[b]] never needs a modulo. */
+    for (i = 255; i < sizeof(gf_exp); ++i)
+        gf_exp[i] = gf_exp[i - 255];
+}
+
+static uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static uint8_t gf_inv(uint8_t a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+/* dst ^= coefficient * src */
+static void gf_mul_add(uint8_t *dst, const uint8_t *src, uint8_t coefficient, uint16_t length)
+{
+    uint16_t i;
+
+    if (coefficient == 0)
+        return;
+
+    if (coefficient == 1) {
+        for (i = 0; i < length; ++i)
+            dst[i] ^= src[i];
+
+        return;
+    }
+
+    const uint8_t *exp = gf_exp + gf_log[coefficient];
+
+    for (i = 0; i < length; ++i) {
+        if (src[i])
+            dst[i] ^= exp[gf_log[src[i]]];
+    }
+}
+
+/* Coefficient of data symbol data_index in parity symbol parity_index.
+ *
+ * A single parity symbol is a plain XOR. Otherwise the rows are those of a Cauchy matrix
+ * 1 / (x_j + y_i) with x_j = FEC_MAX_DATA_PACKETS + j and y_i = i, any square submatrix
+ * of which is invertible.
+ */
+static uint8_t fec_coefficient(uint8_t num_parity, uint8_t parity_index, uint8_t data_index)
+{
+    if (num_parity == 1)
+        return 1;
+
+    return gf_inv((FEC_MAX_DATA_PACKETS + parity_index) ^ data_index);
+}
+
+static _Bool fec_params_valid(uint8_t num_data, uint8_t num_parity)
+{
+    return num_data != 0 && num_data <= FEC_MAX_DATA_PACKETS && num_parity != 0 && num_parity <= FEC_MAX_PARITY_PACKETS;
+}
+
+int fec_encode(const uint8_t *const *data, uint8_t num_data, uint8_t *const *parity, uint8_t num_parity,
+               uint16_t symbol_length)
+{
+    if (!fec_params_valid(num_data, num_parity))
+        return -1;
+
+    pthread_once(&gf_tables_once, gf_init_tables);
+
+    uint8_t i, j;
+
+    for (j = 0; j < num_parity; ++j) {
+        memset(parity[j], 0, symbol_length);
+
+        for (i = 0; i < num_data; ++i)
+            gf_mul_add(parity[j], data[i], fec_coefficient(num_parity, j, i), symbol_length);
+    }
+
+    return 0;
+}
+
+int fec_decode(const uint8_t *const *data, uint8_t num_data, const uint8_t *const *parity, uint8_t num_parity,
+               uint8_t *const *recovered, uint16_t symbol_length)
+{
+    if (!fec_params_valid(num_data, num_parity))
+        return -1;
+
+    pthread_once(&gf_tables_once, gf_init_tables);
+
+    uint8_t missing[FEC_MAX_PARITY_PACKETS], rows[FEC_MAX_PARITY_PACKETS];
+    uint8_t num_missing = 0, num_rows = 0;
+    uint8_t i, j, k;
+
+    for (i = 0; i < num_data; ++i) {
+        if (data[i] != NULL)
+            continue;
+
+        if (num_missing == num_parity)
+            return -1;
+
+        missing[num_missing] = i;
+        ++num_missing;
+    }
+
+    if (num_missing == 0)
+        return 0;
+
+    for (j = 0; j < num_parity && num_rows < num_missing; ++j) {
+        if (parity[j] != NULL) {
+            rows[num_rows] = j;
+            ++num_rows;
+        }
+    }
+
+    if (num_rows < num_missing)
+        return -1;
+
+    /* Invert the num_missing x num_missing matrix of the coefficients of the missing symbols. */
+    uint8_t matrix[FEC_MAX_PARITY_PACKETS][FEC_MAX_PARITY_PACKETS];
+    uint8_t inverse[FEC_MAX_PARITY_PACKETS][FEC_MAX_PARITY_PACKETS];
+    memset(inverse, 0, sizeof(inverse));
+
+    for (j = 0; j < num_missing; ++j) {
+        for (i = 0; i < num_missing; ++i)
+            matrix[j][i] = fec_coefficient(num_parity, rows[j], missing[i]);
+
+        inverse[j][j] = 1;
+    }
+
+    for (i = 0; i < num_missing; ++i) {
+        for (j = i; j < num_missing && matrix[j][i] == 0; ++j);
+
+        if (j == num_missing)
+            return -1;
+
+        if (j != i) {
+            uint8_t temp[FEC_MAX_PARITY_PACKETS];
+            memcpy(temp, matrix[i], sizeof(temp));
+            memcpy(matrix[i], matrix[j], sizeof(temp));
+            memcpy(matrix[j], temp, sizeof(temp));
+            memcpy(temp, inverse[i], sizeof(temp));
+            memcpy(inverse[i], inverse[j], sizeof(temp));
+            memcpy(inverse[j], temp, sizeof(temp));
+        }
+
+        uint8_t pivot_inverse = gf_inv(matrix[i][i]);
+
+        for (k = 0; k < num_missing; ++k) {
+            matrix[i][k] = gf_mul(matrix[i][k], pivot_inverse);
+            inverse[i][k] = gf_mul(inverse[i][k], pivot_inverse);
+        }
+
+        for (j = 0; j < num_missing; ++j) {
+            uint8_t factor = matrix[j][i];
+
+            if (j == i || factor == 0)
+                continue;
+
+            for (k = 0; k < num_missing; ++k) {
+                matrix[j][k] ^= gf_mul(factor, matrix[i][k]);
+                inverse[j][k] ^= gf_mul(factor, inverse[i][k]);
+            }
+        }
+    }
+
+    /* Remove the received data symbols from the parity symbols, then multiply by the inverse. */
+    uint8_t *syndromes = malloc((size_t)num_missing * symbol_length);
+
+    if (syndromes == NULL)
+        return -1;
+
+    for (j = 0; j < num_missing; ++j) {
+        uint8_t *syndrome = syndromes + (size_t)j * symbol_length;
+        memcpy(syndrome, parity[rows[j]], symbol_length);
+
+        for (i = 0; i < num_data; ++i) {
+            if (data[i] != NULL)
+                gf_mul_add(syndrome, data[i], fec_coefficient(num_parity, rows[j], i), symbol_length);
+        }
+    }
+
+    for (i = 0; i < num_missing; ++i) {
+        uint8_t *out = recovered[missing[i]];
+        memset(out, 0, symbol_length);
+
+        for (j = 0; j < num_missing; ++j)
+            gf_mul_add(out, syndromes + (size_t)j * symbol_length, inverse[i][j], symbol_length);
+    }
+
+    free(syndromes);
+    return num_missing;
+}
+
+FEC_Session *new_fec_session(uint8_t header_id, uint16_t max_packet_length)
+{
+    if (max_packet_length > FEC_MAX_PACKET_SIZE || max_packet_length <= FEC_OVERHEAD)
+        return NULL;
+
+    FEC_Session *fec = calloc(1, sizeof(FEC_Session));
+
+    if (fec == NULL)
+        return NULL;
+
+    fec->header_id = header_id;
+    fec->max_packet_length = max_packet_length;
+    return fec;
+}
+
+void kill_fec_session(FEC_Session *fec)
+{
+    if (fec == NULL)
+        return;
+
+    uint32_t i, j, k;
+
+    for (i = 0; i < FEC_MAX_STREAMS; ++i) {
+        FEC_Stream *stream = &fec->streams[i];
+        free(stream->send_symbols);
+
+        for (j = 0; j < FEC_RECV_GROUPS; ++j) {
+            for (k = 0; k < FEC_MAX_DATA_PACKETS; ++k)
+                free(stream->recv_groups[j].data[k]);
+
+            for (k = 0; k < FEC_MAX_PARITY_PACKETS; ++k)
+                free(stream->recv_groups[j].parity[k]);
+        }
+    }
+
+    free(fec);
+}
+
+static FEC_Stream *get_stream(FEC_Session *fec, uint8_t packet_id)
+{
+    uint32_t i;
+
+    if (packet_id == 0)
+        return NULL;
+
+    for (i = 0; i < FEC_MAX_STREAMS; ++i) {
+        if (fec->streams[i].packet_id == packet_id)
+            return &fec->streams[i];
+    }
+
+    return NULL;
+}
+
+/* return the stream for packet_id, taking a free one if there is none yet.
+ * return NULL if there are no free streams left.
+ */
+static FEC_Stream *get_new_stream(FEC_Session *fec, uint8_t packet_id)
+{
+    FEC_Stream *stream = get_stream(fec, packet_id);
+
+    if (stream != NULL || packet_id == 0)
+        return stream;
+
+    uint32_t i;
+
+    for (i = 0; i < FEC_MAX_STREAMS; ++i) {
+        if (fec->streams[i].packet_id == 0) {
+            fec->streams[i].packet_id = packet_id;
+            return &fec->streams[i];
+        }
+    }
+
+    return NULL;
+}
+
+int fec_set_stream(FEC_Session *fec, uint8_t packet_id, uint8_t num_data, uint8_t num_parity)
+{
+    if (num_data != 0 && !fec_params_valid(num_data, num_parity))
+        return -1;
+
+    FEC_Stream *stream = num_data ? get_new_stream(fec, packet_id) : get_stream(fec, packet_id);
+
+    if (stream == NULL)
+        return num_data ? -1 : 0;
+
+    if (num_data > stream->num_data) {
+        uint8_t *symbols = realloc(stream->send_symbols, (size_t)num_data * FEC_MAX_PACKET_SIZE);
+
+        if (symbols == NULL)
+            return -1;
+
+        stream->send_symbols = symbols;
+    }
+
+    /* Packets of the current group won't be protected. */
+    if (stream->send_count != 0) {
+        ++stream->send_group;
+        stream->send_count = 0;
+        stream->send_symbol_length = 0;
+    }
+
+    stream->num_data = num_data;
+    stream->num_parity = num_parity;
+    return 0;
+}
+
+_Bool fec_packet_protected(const FEC_Session *fec, const uint8_t *data, uint16_t length)
+{
+    if (length == 0 || length > fec->max_packet_length - FEC_OVERHEAD)
+        return 0;
+
+    const FEC_Stream *stream = get_stream((FEC_Session *)fec, data[0]);
+    return stream != NULL && stream->num_data != 0;
+}
+
+static void write_header(const FEC_Session *fec, const FEC_Stream *stream, uint16_t group, uint8_t index,
+                         uint8_t num_data, uint8_t *packet)
+{
+    packet[0] = fec->header_id;
+    packet[1] = stream->packet_id;
+    packet[2] = group >> 8;
+    packet[3] = group & 0xff;
+    packet[4] = index;
+    packet[5] = num_data;
+    packet[6] = stream->num_parity;
+}
+
+int fec_wrap_packet(FEC_Session *fec, const uint8_t *data, uint16_t length, uint8_t *packet, uint64_t now)
+{
+    if (!fec_packet_protected(fec, data, length))
+        return -1;
+
+    FEC_Stream *stream = get_stream(fec, data[0]);
+
+    /* Flushing the previous full group is up to the caller, start a new one if it didn't. */
+    if (stream->send_count == stream->num_data) {
+        ++stream->send_group;
+        stream->send_count = 0;
+        stream->send_symbol_length = 0;
+    }
+
+    if (stream->send_count == 0)
+        stream->send_group_start = now;
+
+    uint8_t *symbol = stream->send_symbols + (size_t)stream->send_count * FEC_MAX_PACKET_SIZE;
+    symbol[0] = length >> 8;
+    symbol[1] = length & 0xff;
+    memcpy(symbol + sizeof(uint16_t), data, length);
+    memset(symbol + sizeof(uint16_t) + length, 0, FEC_MAX_PACKET_SIZE - sizeof(uint16_t) - length);
+
+    if (stream->send_symbol_length < sizeof(uint16_t) + length)
+        stream->send_symbol_length = sizeof(uint16_t) + length;
+
+    write_header(fec, stream, stream->send_group, stream->send_count, stream->num_data, packet);
+    memcpy(packet + FEC_HEADER_LENGTH, symbol, sizeof(uint16_t) + length);
+    ++stream->send_count;
+    return FEC_OVERHEAD + length;
+}
+
+uint32_t fec_parity_packets(FEC_Session *fec, uint8_t packet_id, _Bool flush,
+                            uint8_t packets[FEC_MAX_PARITY_PACKETS][FEC_MAX_PACKET_SIZE],
+                            uint16_t lengths[FEC_MAX_PARITY_PACKETS])
+{
+    FEC_Stream *stream = get_stream(fec, packet_id);
+
+    if (stream == NULL || stream->num_data == 0 || stream->send_count == 0)
+        return 0;
+
+    if (stream->send_count < stream->num_data && !flush)
+        return 0;
+
+    const uint8_t *data[FEC_MAX_DATA_PACKETS];
+    uint8_t *parity[FEC_MAX_PARITY_PACKETS];
+    uint32_t i;
+
+    for (i = 0; i < stream->send_count; ++i)
+        data[i] = stream->send_symbols + (size_t)i * FEC_MAX_PACKET_SIZE;
+
+    for (i = 0; i < stream->num_parity; ++i) {
+        write_header(fec, stream, stream->send_group, FEC_MAX_DATA_PACKETS + i, stream->send_count, packets[i]);
+        parity[i] = packets[i] + FEC_HEADER_LENGTH;
+        lengths[i] = FEC_HEADER_LENGTH + stream->send_symbol_length;
+    }
+
+    if (fec_encode(data, stream->send_count, parity, stream->num_parity, stream->send_symbol_length) != 0)
+        return 0;
+
+    ++stream->send_group;
+    stream->send_count = 0;
+    stream->send_symbol_length = 0;
+    fec->parity_packets_sent += stream->num_parity;
+    return stream->num_parity;
+}
+
+uint32_t fec_timed_out_parity_packets(FEC_Session *fec, uint64_t now, uint64_t timeout,
+                                      uint8_t packets[FEC_MAX_PARITY_PACKETS][FEC_MAX_PACKET_SIZE],
+                                      uint16_t lengths[FEC_MAX_PARITY_PACKETS])
+{
+    uint32_t i;
+
+    for (i = 0; i < FEC_MAX_STREAMS; ++i) {
+        FEC_Stream *stream = &fec->streams[i];
+
+        if (stream->num_data == 0 || stream->send_count == 0)
+            continue;
+
+        if (stream->send_group_start + timeout <= now)
+            return fec_parity_packets(fec, stream->packet_id, 1, packets, lengths);
+    }
+
+    return 0;
+}
+
+/* return the receive group for group, replacing the oldest one if it isn't there.
+ * return NULL if group is older than all the groups we keep.
+ */
+static FEC_Recv_Group *get_recv_group(FEC_Stream *stream, uint16_t group)
+{
+    FEC_Recv_Group *oldest = NULL;
+    uint32_t i;
+
+    for (i = 0; i < FEC_RECV_GROUPS; ++i) {
+        FEC_Recv_Group *recv_group = &stream->recv_groups[i];
+
+        if (!recv_group->in_use) {
+            if (oldest == NULL || oldest->in_use)
+                oldest = recv_group;
+
+            continue;
+        }
+
+        if (recv_group->group == group)
+            return recv_group;
+
+        if (oldest == NULL || (oldest->in_use && (int16_t)(recv_group->group - oldest->group) < 0))
+            oldest = recv_group;
+    }
+
+    if (oldest->in_use && (int16_t)(group - oldest->group) < 0)
+        return NULL;
+
+    oldest->in_use = 1;
+    oldest->done = 0;
+    oldest->group = group;
+    oldest->num_data = 0;
+    oldest->num_parity = 0;
+    oldest->symbol_length = 0;
+    oldest->received = 0;
+    oldest->delivered = 0;
+    oldest->parity_received = 0;
+    return oldest;
+}
+
+/* return length of the lossy packet in symbol. */
+static uint16_t symbol_packet_length(const uint8_t *symbol)
+{
+    return ((uint16_t)symbol[0] << 8) | symbol[1];
+}
+
+static uint8_t *symbol_buffer(uint8_t **buffer)
+{
+    if (*buffer == NULL)
+        *buffer = malloc(FEC_MAX_PACKET_SIZE);
+
+    return *buffer;
+}
+
+static uint32_t count_bits(uint32_t bits)
+{
+    uint32_t count = 0;
+
+    for (; bits; bits &= bits - 1)
+        ++count;
+
+    return count;
+}
+
+/* Try to recover the missing data packets of recv_group.
+ *
+ * return number of packets put in packets and lengths.
+ */
+static uint32_t recover_packets(FEC_Session *fec, FEC_Recv_Group *recv_group,
+                                uint8_t packets[][FEC_MAX_PACKET_SIZE], uint16_t lengths[])
+{
+    if (recv_group->done || recv_group->num_data == 0)
+        return 0;
+
+    uint32_t all_data = recv_group->num_data == 32 ? 0xffffffff : ((1u << recv_group->num_data) - 1);
+    uint32_t received = recv_group->received & all_data;
+
+    if (received == all_data) {
+        recv_group->done = 1;
+        return 0;
+    }
+
+    if (count_bits(received) + count_bits(recv_group->parity_received) < recv_group->num_data)
+        return 0;
+
+    const uint8_t *data[FEC_MAX_DATA_PACKETS];
+    const uint8_t *parity[FEC_MAX_PARITY_PACKETS];
+    uint8_t *recovered[FEC_MAX_DATA_PACKETS];
+    uint32_t i;
+
+    for (i = 0; i < recv_group->num_data; ++i) {
+        if (received & (1u << i)) {
+            data[i] = recv_group->data[i];
+            recovered[i] = NULL;
+        } else {
+            data[i] = NULL;
+            recovered[i] = symbol_buffer(&recv_group->data[i]);
+
+            if (recovered[i] == NULL)
+                return 0;
+        }
+    }
+
+    for (i = 0; i < recv_group->num_parity; ++i)
+        parity[i] = (recv_group->parity_received & (1u << i)) ? recv_group->parity[i] : NULL;
+
+    if (fec_decode(data, recv_group->num_data, parity, recv_group->num_parity, recovered,
+                   recv_group->symbol_length) <= 0)
+        return 0;
+
+    recv_group->done = 1;
+    uint32_t count = 0;
+
+    for (i = 0; i < recv_group->num_data; ++i) {
+        if (recovered[i] == NULL)
+            continue;
+
+        uint16_t length = symbol_packet_length(recovered[i]);
+
+        if (length == 0 || sizeof(uint16_t) + length > recv_group->symbol_length)
+            continue;
+
+        recv_group->received |= 1u << i;
+        recv_group->delivered |= 1u << i;
+        memcpy(packets[count], recovered[i] + sizeof(uint16_t), length);
+        lengths[count] = length;
+        ++count;
+    }
+
+    fec->packets_recovered += count;
+    return count;
+}
+
+int fec_handle_packet(FEC_Session *fec, const uint8_t *data, uint16_t length,
+                      uint8_t packets[FEC_MAX_PARITY_PACKETS + 1][FEC_MAX_PACKET_SIZE],
+                      uint16_t lengths[FEC_MAX_PARITY_PACKETS + 1])
+{
+    if (length <= FEC_OVERHEAD || length > fec->max_packet_length || data[0] != fec->header_id)
+        return -1;
+
+    uint16_t group = ((uint16_t)data[2] << 8) | data[3];
+    uint8_t index = data[4];
+    uint8_t num_data = data[5];
+    uint8_t num_parity = data[6];
+    const uint8_t *payload = data + FEC_HEADER_LENGTH;
+    uint16_t payload_length = length - FEC_HEADER_LENGTH;
+
+    if (!fec_params_valid(num_data, num_parity))
+        return -1;
+
+    FEC_Stream *stream = get_new_stream(fec, data[1]);
+
+    if (index < FEC_MAX_DATA_PACKETS) {
+        uint16_t packet_length = symbol_packet_length(payload);
+
+        if (index >= num_data || sizeof(uint16_t) + packet_length != payload_length)
+            return -1;
+
+        FEC_Recv_Group *recv_group = stream ? get_recv_group(stream, group) : NULL;
+
+        /* Lossy packets are passed on even if we can't use them for recovery. */
+        if (recv_group == NULL) {
+            memcpy(packets[0], payload + sizeof(uint16_t), packet_length);
+            lengths[0] = packet_length;
+            return 1;
+        }
+
+        if (recv_group->delivered & (1u << index))
+            return 0;
+
+        if (recv_group->num_data != 0 && (index >= recv_group->num_data || payload_length > recv_group->symbol_length))
+            return -1;
+
+        memcpy(packets[0], payload + sizeof(uint16_t), packet_length);
+        lengths[0] = packet_length;
+        recv_group->delivered |= 1u << index;
+
+        uint8_t *symbol = symbol_buffer(&recv_group->data[index]);
+
+        if (symbol != NULL) {
+            memcpy(symbol, payload, payload_length);
+            memset(symbol + payload_length, 0, FEC_MAX_PACKET_SIZE - payload_length);
+            recv_group->received |= 1u << index;
+        }
+
+        return 1 + recover_packets(fec, recv_group, packets + 1, lengths + 1);
+    }
+
+    uint8_t parity_index = index - FEC_MAX_DATA_PACKETS;
+
+    if (parity_index >= num_parity || stream == NULL)
+        return -1;
+
+    FEC_Recv_Group *recv_group = get_recv_group(stream, group);
+
+    if (recv_group == NULL || recv_group->done)
+        return 0;
+
+    if (recv_group->num_data == 0) {
+        uint32_t i;
+
+        /* Data packets we got so far must fit in the group. */
+        for (i = num_data; i < FEC_MAX_DATA_PACKETS; ++i) {
+            if (recv_group->received & (1u << i))
+                return -1;
+        }
+
+        for (i = 0; i < num_data; ++i) {
+            if ((recv_group->received & (1u << i))
+                    && sizeof(uint16_t) + symbol_packet_length(recv_group->data[i]) > payload_length)
+                return -1;
+        }
+
+        recv_group->num_data = num_data;
+        recv_group->num_parity = num_parity;
+        recv_group->symbol_length = payload_length;
+    } else if (recv_group->num_data != num_data || recv_group->num_parity != num_parity
+               || recv_group->symbol_length != payload_length) {
+        return -1;
+    }
+
+    if (recv_group->parity_received & (1u << parity_index))
+        return 0;
+
+    uint8_t *symbol = symbol_buffer(&recv_group->parity[parity_index]);
+
+    if (symbol == NULL)
+        return -1;
+
+    memcpy(symbol, payload, payload_length);
+    recv_group->parity_received |= 1u << parity_index;
+    return recover_packets(fec, recv_group, packets, lengths);
+}
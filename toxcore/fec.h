@@ -0,0 +1,175 @@
+/* fec.h
+ *
+ * Forward error correction for lossy packets.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+
+/* Maximum number of lossy packets in a group. */
+#define FEC_MAX_DATA_PACKETS 32
+
+/* Maximum number of parity packets sent for a group. */
+#define FEC_MAX_PARITY_PACKETS 8
+
+/* Maximum number of lossy packet ids (streams) a session can protect or receive at once. */
+#define FEC_MAX_STREAMS 4
+
+/* Number of groups per stream kept on the receiving side to recover packets from. */
+#define FEC_RECV_GROUPS 4
+
+/* Maximum size of the packets handled by a session. */
+#define FEC_MAX_PACKET_SIZE 1400
+
+/* [uint8_t packet_id][uint8_t stream id][uint16_t group][uint8_t index][uint8_t num data][uint8_t num parity] */
+#define FEC_HEADER_LENGTH 7
+
+/* Lossy packets are encoded with their length as [uint16_t length][packet]. */
+#define FEC_OVERHEAD (FEC_HEADER_LENGTH + sizeof(uint16_t))
+
+/* Compute num_parity parity symbols from num_data data symbols, all of symbol_length bytes.
+ *
+ * A single parity symbol is the XOR of the data symbols. More are computed with a
+ * Cauchy Reed-Solomon code, so any num_data of the num_data + num_parity symbols are
+ * enough to get back the data symbols.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int fec_encode(const uint8_t *const *data, uint8_t num_data, uint8_t *const *parity, uint8_t num_parity,
+               uint16_t symbol_length);
+
+/* Recover the missing data symbols of a group encoded with fec_encode().
+ *
+ * data[i] and parity[i] are NULL for the symbols that were lost. Missing data symbols
+ * are written to recovered[i], which must then point to symbol_length bytes.
+ *
+ * return -1 if there aren't enough symbols to recover the missing ones.
+ * return number of recovered data symbols on success.
+ */
+int fec_decode(const uint8_t *const *data, uint8_t num_data, const uint8_t *const *parity, uint8_t num_parity,
+               uint8_t *const *recovered, uint16_t symbol_length);
+
+typedef struct {
+    _Bool in_use;
+    _Bool done; /* Every data packet was received or recovered. */
+    uint16_t group;
+    uint8_t num_data; /* 0 until a parity packet was received. */
+    uint8_t num_parity;
+    uint16_t symbol_length;
+    uint32_t received; /* Bitmask of the data symbols we have. */
+    uint32_t delivered; /* Bitmask of the data packets already passed on. */
+    uint8_t parity_received; /* Bitmask of the parity symbols we have. */
+
+    /* Buffers of FEC_MAX_PACKET_SIZE bytes, allocated when first needed and kept for the next groups. */
+    uint8_t *data[FEC_MAX_DATA_PACKETS];
+    uint8_t *parity[FEC_MAX_PARITY_PACKETS];
+} FEC_Recv_Group;
+
+typedef struct {
+    uint8_t packet_id; /* 0 if the stream is unused, packet id 0 can't be protected. */
+
+    /* Sending, num_data is 0 if packets of this stream are not protected. */
+    uint8_t num_data;
+    uint8_t num_parity;
+    uint16_t send_group;
+    uint8_t send_count;
+    uint16_t send_symbol_length;
+    uint64_t send_group_start;
+    uint8_t *send_symbols; /* num_data symbols of FEC_MAX_PACKET_SIZE bytes. */
+
+    FEC_Recv_Group recv_groups[FEC_RECV_GROUPS];
+} FEC_Stream;
+
+typedef struct {
+    uint8_t header_id; /* First byte of every FEC packet. */
+    uint16_t max_packet_length;
+    FEC_Stream streams[FEC_MAX_STREAMS];
+
+    uint64_t packets_recovered;
+    uint64_t parity_packets_sent;
+} FEC_Session;
+
+/* Create a new FEC session for packets of at most max_packet_length bytes
+ * (FEC_MAX_PACKET_SIZE at most). Every packet it creates starts with header_id.
+ *
+ * return NULL on failure.
+ */
+FEC_Session *new_fec_session(uint8_t header_id, uint16_t max_packet_length);
+
+void kill_fec_session(FEC_Session *fec);
+
+/* Protect the packets starting with packet_id with num_parity parity packets for every
+ * num_data packets. num_data 0 stops protecting them.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int fec_set_stream(FEC_Session *fec, uint8_t packet_id, uint8_t num_data, uint8_t num_parity);
+
+/* return 1 if the lossy packet data of length would be protected.
+ * return 0 if it should be sent as is.
+ */
+_Bool fec_packet_protected(const FEC_Session *fec, const uint8_t *data, uint16_t length);
+
+/* Put the lossy packet data of length in a FEC packet.
+ *
+ * packet must have room for max_packet_length bytes.
+ *
+ * return -1 on failure.
+ * return length of packet on success.
+ */
+int fec_wrap_packet(FEC_Session *fec, const uint8_t *data, uint16_t length, uint8_t *packet, uint64_t now);
+
+/* Create the parity packets of the current group of stream packet_id if it is complete or if
+ * flush is set and it has any packets in it.
+ *
+ * return number of parity packets put in packets and lengths.
+ */
+uint32_t fec_parity_packets(FEC_Session *fec, uint8_t packet_id, _Bool flush,
+                            uint8_t packets[FEC_MAX_PARITY_PACKETS][FEC_MAX_PACKET_SIZE],
+                            uint16_t lengths[FEC_MAX_PARITY_PACKETS]);
+
+/* Call fec_parity_packets() with flush set for the first stream whose current group was
+ * started more than timeout ms ago. Call it until it returns 0 to flush every stream.
+ *
+ * return number of parity packets put in packets and lengths.
+ */
+uint32_t fec_timed_out_parity_packets(FEC_Session *fec, uint64_t now, uint64_t timeout,
+                                      uint8_t packets[FEC_MAX_PARITY_PACKETS][FEC_MAX_PACKET_SIZE],
+                                      uint16_t lengths[FEC_MAX_PARITY_PACKETS]);
+
+/* Handle a FEC packet.
+ *
+ * The lossy packet it contains and the ones it made it possible to recover are
+ * copied to packets and lengths. Packets already returned for the same group are not
+ * returned again.
+ *
+ * return -1 on failure.
+ * return number of lossy packets put in packets on success.
+ */
+int fec_handle_packet(FEC_Session *fec, const uint8_t *data, uint16_t length,
+                      uint8_t packets[FEC_MAX_PARITY_PACKETS + 1][FEC_MAX_PACKET_SIZE],
+                      uint16_t lengths[FEC_MAX_PARITY_PACKETS + 1]);
+
+#endif
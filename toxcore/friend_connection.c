@@ -237,7 +237,7 @@ static unsigned int send_relays(Friend_Connections *fr_c, int friendcon_id)
     ++length;
 
     if (write_cryptpacket(fr_c->net_crypto, friend_con->crypt_connection_id, data, length, 0) != -1) {
-        friend_con->share_relays_lastsent = unix_time();
+        friend_con->share_relays_lastsent = unix_time(fr_c->mono_time);
         return 1;
     }
 
@@ -276,7 +276,7 @@ static void dht_ip_callback(void *object, int32_t number, IP_Port ip_port)
 
     set_direct_ip_port(fr_c->net_crypto, friend_con->crypt_connection_id, ip_port, 1);
     friend_con->dht_ip_port = ip_port;
-    friend_con->dht_ip_port_lastrecv = unix_time();
+    friend_con->dht_ip_port_lastrecv = unix_time(fr_c->mono_time);
 
     if (friend_con->hosting_tcp_relay) {
         friend_add_tcp_relay(fr_c, number, ip_port, friend_con->dht_temp_pk);
@@ -291,7 +291,7 @@ static void change_dht_pk(Friend_Connections *fr_c, int friendcon_id, const uint
     if (!friend_con)
         return;
 
-    friend_con->dht_pk_lastrecv = unix_time();
+    friend_con->dht_pk_lastrecv = unix_time(fr_c->mono_time);
 
     if (friend_con->dht_lock) {
         if (DHT_delfriend(fr_c->dht, friend_con->dht_temp_pk, friend_con->dht_lock) != 0) {
@@ -319,13 +319,13 @@ static int handle_status(void *object, int number, uint8_t status)
     if (status) {  /* Went online. */
         call_cb = 1;
         friend_con->status = FRIENDCONN_STATUS_CONNECTED;
-        friend_con->ping_lastrecv = unix_time();
+        friend_con->ping_lastrecv = unix_time(fr_c->mono_time);
         friend_con->share_relays_lastsent = 0;
         onion_set_friend_online(fr_c->onion_c, friend_con->onion_friendnum, status);
     } else {  /* Went offline. */
         if (friend_con->status != FRIENDCONN_STATUS_CONNECTING) {
             call_cb = 1;
-            friend_con->dht_pk_lastrecv = unix_time();
+            friend_con->dht_pk_lastrecv = unix_time(fr_c->mono_time);
             onion_set_friend_online(fr_c->onion_c, friend_con->onion_friendnum, status);
         }
 
@@ -389,7 +389,7 @@ static int handle_packet(void *object, int number, uint8_t *data, uint16_t lengt
 
         return 0;
     } else if (data[0] == PACKET_ID_ALIVE) {
-        friend_con->ping_lastrecv = unix_time();
+        friend_con->ping_lastrecv = unix_time(fr_c->mono_time);
         return 0;
     } else if (data[0] == PACKET_ID_SHARE_RELAYS) {
         Node_format nodes[MAX_SHARED_RELAYS];
@@ -476,7 +476,7 @@ static int handle_new_connections(void *object, New_Connection *n_c)
             set_direct_ip_port(fr_c->net_crypto, friend_con->crypt_connection_id, friend_con->dht_ip_port, 0);
         } else {
             friend_con->dht_ip_port = n_c->source;
-            friend_con->dht_ip_port_lastrecv = unix_time();
+            friend_con->dht_ip_port_lastrecv = unix_time(fr_c->mono_time);
         }
 
         if (memcmp(friend_con->dht_temp_pk, n_c->dht_public_key, crypto_box_PUBLICKEYBYTES) != 0) {
@@ -531,7 +531,7 @@ static int send_ping(const Friend_Connections *fr_c, int friendcon_id)
     int64_t ret = write_cryptpacket(fr_c->net_crypto, friend_con->crypt_connection_id, &ping, sizeof(ping), 0);
 
     if (ret != -1) {
-        friend_con->ping_lastsent = unix_time();
+        friend_con->ping_lastsent = unix_time(fr_c->mono_time);
         return 0;
     }
 
@@ -596,6 +596,93 @@ void set_dht_temp_pk(Friend_Connections *fr_c, int friendcon_id, const uint8_t *
     dht_pk_callback(fr_c, friendcon_id, dht_temp_pk);
 }
 
+/* Copy what is known about reaching the friend into cache.
+ *
+ * return 0 on success.
+ * return -1 on failure.
+ */
+int get_friendcon_cache(const Friend_Connections *fr_c, int friendcon_id, Friend_Conn_Cache *cache)
+{
+    Friend_Conn *friend_con = get_conn(fr_c, friendcon_id);
+
+    if (!friend_con)
+        return -1;
+
+    memset(cache, 0, sizeof(Friend_Conn_Cache));
+
+    _Bool connected = friend_con->status == FRIENDCONN_STATUS_CONNECTED;
+    uint64_t temp_time = unix_time(fr_c->mono_time);
+
+    /* Keys and addresses of a connected friend are good now, otherwise since we last heard of them. */
+    if (friend_con->dht_lock) {
+        memcpy(cache->dht_temp_pk, friend_con->dht_temp_pk, crypto_box_PUBLICKEYBYTES);
+        cache->dht_pk_time = connected ? temp_time : friend_con->dht_pk_lastrecv;
+    }
+
+    if (connected && crypto_connection_direct_ip_port(fr_c->net_crypto, friend_con->crypt_connection_id,
+            &cache->ip_port) == 0) {
+        cache->ip_port_time = temp_time;
+    } else if (friend_con->dht_ip_port.ip.family != 0) {
+        cache->ip_port = friend_con->dht_ip_port;
+        cache->ip_port_time = friend_con->dht_ip_port_lastrecv;
+    }
+
+    unsigned int i, num = 0;
+
+    for (i = 0; (i < FRIEND_MAX_STORED_TCP_RELAYS) && (num < FRIEND_CACHED_TCP_RELAYS); ++i) {
+        uint16_t index = (friend_con->tcp_relay_counter - (i + 1)) % FRIEND_MAX_STORED_TCP_RELAYS;
+
+        if (friend_con->tcp_relays[index].ip_port.ip.family) {
+            cache->tcp_relays[num] = friend_con->tcp_relays[index];
+            ++num;
+        }
+    }
+
+    return 0;
+}
+
+/* Start connecting to the friend with a cache saved by get_friendcon_cache().
+ *
+ * return 0 on success.
+ * return -1 on failure.
+ */
+int set_friendcon_cache(Friend_Connections *fr_c, int friendcon_id, const Friend_Conn_Cache *cache)
+{
+    Friend_Conn *friend_con = get_conn(fr_c, friendcon_id);
+
+    if (!friend_con)
+        return -1;
+
+    uint64_t temp_time = unix_time(fr_c->mono_time);
+
+    /* The key gets FRIEND_DHT_TIMEOUT like one from the onion would, if it is stale the onion replaces it. */
+    if (!friend_con->dht_lock && cache->dht_pk_time != 0 && cache->dht_pk_time + FRIEND_CACHE_TIMEOUT >= temp_time) {
+        set_dht_temp_pk(fr_c, friendcon_id, cache->dht_temp_pk);
+
+        if (friend_con->crypt_connection_id != -1 && cache->ip_port_time != 0
+                && cache->ip_port_time + FRIEND_CACHE_TIMEOUT >= temp_time
+                && set_direct_ip_port(fr_c->net_crypto, friend_con->crypt_connection_id, cache->ip_port, 0) == 0) {
+            friend_con->dht_ip_port = cache->ip_port;
+            friend_con->dht_ip_port_lastrecv = temp_time;
+
+            /* If they are still there their DHT answers and confirms the address. */
+            DHT_bootstrap(fr_c->dht, cache->ip_port, cache->dht_temp_pk);
+        }
+    }
+
+    unsigned int i;
+
+    /* Oldest first, so that they keep their order. */
+    for (i = FRIEND_CACHED_TCP_RELAYS; i != 0; --i) {
+        const Node_format *relay = &cache->tcp_relays[i - 1];
+
+        if (relay->ip_port.ip.family != 0)
+            friend_add_tcp_relay(fr_c, friendcon_id, relay->ip_port, relay->public_key);
+    }
+
+    return 0;
+}
+
 /* Set the callbacks for the friend connection.
  * index is the index (0 to (MAX_FRIEND_CONNECTION_CALLBACKS - 1)) we want the callback to set in the array.
  *
@@ -769,21 +856,25 @@ Friend_Connections *new_friend_connections(Onion_Client *onion_c)
         return NULL;
 
     temp->dht = onion_c->dht;
+    temp->mono_time = onion_c->dht->mono_time;
     temp->net_crypto = onion_c->c;
     temp->onion_c = onion_c;
 
     new_connection_handler(temp->net_crypto, &handle_new_connections, temp);
-    LANdiscovery_init(temp->dht);
+
+    /* The accounts of a host share its LAN discovery */
+    if (!temp->net_crypto->host)
+        LANdiscovery_init(temp->dht);
 
     return temp;
 }
 
-/* Send a LAN discovery packet every LAN_DISCOVERY_INTERVAL seconds. */
+/* Send a LAN discovery packet every LAN_DISCOVERY_INTERVAL seconds and when an interface comes up. */
 static void LANdiscovery(Friend_Connections *fr_c)
 {
-    if (fr_c->last_LANdiscovery + LAN_DISCOVERY_INTERVAL < unix_time()) {
+    if (LANdiscovery_poll(fr_c->dht) || fr_c->last_LANdiscovery + LAN_DISCOVERY_INTERVAL < unix_time(fr_c->mono_time)) {
         send_LANdiscovery(htons(TOX_PORT_DEFAULT), fr_c->dht);
-        fr_c->last_LANdiscovery = unix_time();
+        fr_c->last_LANdiscovery = unix_time(fr_c->mono_time);
     }
 }
 
@@ -791,7 +882,7 @@ static void LANdiscovery(Friend_Connections *fr_c)
 void do_friend_connections(Friend_Connections *fr_c)
 {
     uint32_t i;
-    uint64_t temp_time = unix_time();
+    uint64_t temp_time = unix_time(fr_c->mono_time);
 
     for (i = 0; i < fr_c->num_cons; ++i) {
         Friend_Conn *friend_con = get_conn(fr_c, i);
@@ -835,7 +926,8 @@ void do_friend_connections(Friend_Connections *fr_c)
         }
     }
 
-    LANdiscovery(fr_c);
+    if (!fr_c->net_crypto->host)
+        LANdiscovery(fr_c);
 }
 
 /* Free everything related with friend_connections. */
@@ -850,6 +942,8 @@ void kill_friend_connections(Friend_Connections *fr_c)
         kill_friend_connection(fr_c, i);
     }
 
-    LANdiscovery_kill(fr_c->dht);
+    if (!fr_c->net_crypto->host)
+        LANdiscovery_kill(fr_c->dht);
+
     free(fr_c);
 }
@@ -56,6 +56,12 @@
 /* Interval between the sending of tcp relay information */
 #define SHARE_RELAYS_INTERVAL (5 * 60)
 
+/* Number of tcp relays of a friend kept in its connection cache. */
+#define FRIEND_CACHED_TCP_RELAYS (MAX_FRIEND_TCP_CONNECTIONS / 2)
+
+/* How long a cached DHT public key or address of a friend is worth trying after a restart. */
+#define FRIEND_CACHE_TIMEOUT (24 * 60 * 60)
+
 
 enum {
     FRIENDCONN_STATUS_NONE,
@@ -100,10 +106,25 @@ typedef struct {
     _Bool hosting_tcp_relay;
 } Friend_Conn;
 
+/* What was last known about reaching a friend, kept across restarts so that the connection can be
+ * tried right away instead of after the onion found the friend again.
+ *
+ * The times are unix times of when the key or address was last known to be good, 0 if it isn't known.
+ * The relays are the ones last associated with the friend, most recent first.
+ */
+typedef struct {
+    uint8_t dht_temp_pk[crypto_box_PUBLICKEYBYTES];
+    uint64_t dht_pk_time;
+    IP_Port ip_port;
+    uint64_t ip_port_time;
+    Node_format tcp_relays[FRIEND_CACHED_TCP_RELAYS];
+} Friend_Conn_Cache;
+
 
 typedef struct {
     Net_Crypto *net_crypto;
     DHT *dht;
+    Mono_Time *mono_time; /* the one of dht */
     Onion_Client *onion_c;
 
     Friend_Conn *conns;
@@ -151,6 +172,24 @@ void set_dht_temp_pk(Friend_Connections *fr_c, int friendcon_id, const uint8_t *
  */
 int friend_add_tcp_relay(Friend_Connections *fr_c, int friendcon_id, IP_Port ip_port, const uint8_t *public_key);
 
+/* Copy what is known about reaching the friend into cache.
+ *
+ * return 0 on success.
+ * return -1 on failure.
+ */
+int get_friendcon_cache(const Friend_Connections *fr_c, int friendcon_id, Friend_Conn_Cache *cache);
+
+/* Start connecting to the friend with a cache saved by get_friendcon_cache().
+ *
+ * The cached DHT public key and address are only used if they aren't older than FRIEND_CACHE_TIMEOUT
+ * and nothing newer is known. The connection is attempted directly and through the relays right
+ * away, the onion keeps looking for the friend at the same time in case they changed.
+ *
+ * return 0 on success.
+ * return -1 on failure.
+ */
+int set_friendcon_cache(Friend_Connections *fr_c, int friendcon_id, const Friend_Conn_Cache *cache);
+
 /* Set the callbacks for the friend connection.
  * index is the index (0 to (MAX_FRIEND_CONNECTION_CALLBACKS - 1)) we want the callback to set in the array.
  *
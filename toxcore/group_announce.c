@@ -236,8 +236,6 @@ static int wrap_gca_packet(const uint8_t *send_public_key, const uint8_t *send_s
 }
 
 static void remove_gca_self_announce(GC_Announce *announce, const uint8_t *chat_id);
-static size_t add_gc_announced_node(GC_Announce *announce, const uint8_t *chat_id, const GC_Announce_Node node,
-                                    const uint8_t *packet_data, uint32_t length, bool self);
 
 static int dispatch_packet_announce_request(GC_Announce *announce, const uint8_t *chat_id, const uint8_t *sender_pk,
                                             const uint8_t *data, uint32_t length, bool self)
@@ -271,7 +269,9 @@ static int dispatch_packet_announce_request(GC_Announce *announce, const uint8_t
         if (unpack_gca_nodes(&node, 1, 0, data + 1 + CHAT_ID_SIZE, length - 1 - CHAT_ID_SIZE, 0) != 1)
             return -1;
 
-        add_gc_announced_node(announce, chat_id, node, data, length, self);
+        if (gca_store_add(&announce->announcements, chat_id, &node, self,
+                          unix_time(announce->dht->mono_time) + GCA_PING_INTERVAL) == -1)
+            return -1;
 
         /* We will never need to ping or renew our own announcement */
         if (self)
@@ -357,71 +357,6 @@ static int add_requested_gc_nodes(GC_Announce *announce, const GC_Announce_Node
     return -1;
 }
 
-static size_t add_announced_nodes_helper(GC_Announce *announce, const uint8_t *chat_id, const GC_Announce_Node node,
-                                         size_t idx, const uint8_t *packet_data, uint32_t length, bool self)
-{
-    ipport_copy(&announce->announcements[idx].node.ip_port, &node.ip_port);
-    memcpy(announce->announcements[idx].node.public_key, node.public_key, ENC_PUBLIC_KEY);
-    memcpy(announce->announcements[idx].chat_id, chat_id, CHAT_ID_SIZE);
-    announce->announcements[idx].last_rcvd_ping = unix_time();
-    announce->announcements[idx].last_sent_ping = unix_time();
-    announce->announcements[idx].time_added = unix_time();
-    announce->announcements[idx].self = self;
-
-    return idx;
-}
-
-/* Add announced node to announcements. If no slots are free replace the oldest node.
- *
- * Returns index of added node.
- */
-static size_t add_gc_announced_node(GC_Announce *announce, const uint8_t *chat_id, const GC_Announce_Node node,
-                                    const uint8_t *packet_data, uint32_t length, bool self)
-{
-    size_t i, oldest_idx = 0;
-    uint64_t oldest_announce = 0;
-
-    for (i = 0; i < MAX_GCA_ANNOUNCED_NODES; ++i) {
-        if (oldest_announce < announce->announcements[i].time_added) {
-            oldest_announce = announce->announcements[i].time_added;
-            oldest_idx = i;
-        }
-
-        if (id_equal(announce->announcements[i].node.public_key, node.public_key)
-            && chat_id_equal(announce->announcements[i].chat_id, chat_id))
-            return add_announced_nodes_helper(announce, chat_id, node, i, packet_data, length, self);
-
-        if (!ipport_isset(&announce->announcements[i].node.ip_port))
-            return add_announced_nodes_helper(announce, chat_id, node, i, packet_data, length, self);
-    }
-
-    return add_announced_nodes_helper(announce, chat_id, node, oldest_idx, packet_data, length, self);
-}
-
-/* Gets up to MAX_GCA_SENT_NODES nodes that hold chat_id from announcements and add them to nodes array.
- * Returns the number of added nodes.
- */
-static uint32_t get_gc_announced_nodes(GC_Announce *announce, const uint8_t *chat_id, GC_Announce_Node *nodes)
-{
-    size_t i;
-    uint32_t num = 0;
-
-    for (i = 0; i < MAX_GCA_ANNOUNCED_NODES; i++) {
-        if (!ipport_isset(&announce->announcements[i].node.ip_port))
-            continue;
-
-        if (chat_id_equal(announce->announcements[i].chat_id, chat_id)) {
-            memcpy(nodes[num].public_key, announce->announcements[i].node.public_key, ENC_PUBLIC_KEY);
-            ipport_copy(&nodes[num].ip_port, &announce->announcements[i].node.ip_port);
-
-            if (++num == MAX_GCA_SENT_NODES)
-                break;
-        }
-    }
-
-    return num;
-}
-
 /* Initiates requests holder for our nodes request responses for chat_id.
  * If all slots are full the oldest entry is replaced
  */
@@ -445,7 +380,7 @@ static void init_gca_self_request(GC_Announce *announce, const uint8_t *chat_id,
 
     memset(&announce->requests[idx], 0, sizeof(struct GC_AnnounceRequest));
     announce->requests[idx].req_id = req_id;
-    announce->requests[idx].time_added = unix_time();
+    announce->requests[idx].time_added = unix_time(announce->dht->mono_time);
     memcpy(announce->requests[idx].chat_id, chat_id, CHAT_ID_SIZE);
     memcpy(announce->requests[idx].self_public_key, self_public_key, ENC_PUBLIC_KEY);
     memcpy(announce->requests[idx].self_secret_key, self_secret_key, ENC_SECRET_KEY);
@@ -463,7 +398,7 @@ static int add_gca_self_announce(GC_Announce *announce, const uint8_t *chat_id,
 
     for (i = 0; i < MAX_GCA_SELF_ANNOUNCEMENTS; ++i) {
         if (!announce->self_announce[i].is_set) {
-            announce->self_announce[i].last_rcvd_ping = unix_time();
+            announce->self_announce[i].last_rcvd_ping = unix_time(announce->dht->mono_time);
             announce->self_announce[i].is_set = true;
             memcpy(announce->self_announce[i].chat_id, chat_id, CHAT_ID_SIZE);
             memcpy(announce->self_announce[i].self_public_key, self_public_key, ENC_PUBLIC_KEY);
@@ -684,7 +619,7 @@ int handle_gc_get_announced_nodes_request(void *ancp, IP_Port ipp, const uint8_t
     }
 
     GC_Announce_Node nodes[MAX_GCA_SENT_NODES];
-    uint32_t num_nodes = get_gc_announced_nodes(announce, data + 1, nodes);
+    uint32_t num_nodes = gca_store_get_nodes(&announce->announcements, data + 1, nodes, MAX_GCA_SENT_NODES);
 
     if (num_nodes) {
         uint64_t request_id;
@@ -811,21 +746,15 @@ int handle_gca_ping_response(void *ancp, IP_Port ipp, const uint8_t *packet, uin
     uint64_t ping_id;
     memcpy(&ping_id, data + 1, RAND_ID_SIZE);
 
-    size_t i;
-
-    for (i = 0; i < MAX_GCA_ANNOUNCED_NODES; ++i) {
-        if (announce->announcements[i].ping_id == ping_id) {
-            announce->announcements[i].ping_id = 0;
-
-            if (!ipport_isset(&announce->announcements[i].node.ip_port))
-                return -1;
+    uint32_t nodenumber = gca_store_find_ping(&announce->announcements, ping_id);
+    struct GC_AnnouncedNode *node = gca_store_get(&announce->announcements, nodenumber);
 
-            announce->announcements[i].last_rcvd_ping = unix_time();
-            return 0;
-        }
-    }
+    if (node == NULL)
+        return -1;
 
-    return -1;
+    gca_store_set_ping(&announce->announcements, nodenumber, 0);
+    node->last_rcvd_ping = unix_time(announce->dht->mono_time);
+    return 0;
 }
 
 static int send_gca_ping_response(DHT *dht, IP_Port ipp, const uint8_t *data, const uint8_t *rcv_pk)
@@ -882,7 +811,7 @@ int handle_gca_ping_request(void *ancp, IP_Port ipp, const uint8_t *packet, uint
         return -1;
     }
 
-    announce->self_announce[i].last_rcvd_ping = unix_time();
+    announce->self_announce[i].last_rcvd_ping = unix_time(announce->dht->mono_time);
 
     return send_gca_ping_response(dht, ipp, data, public_key);
 }
@@ -907,21 +836,30 @@ static int send_gca_ping_request(DHT *dht, GC_Announce_Node *node, uint64_t ping
     return sendpacket(dht->net, node->ip_port, packet, len);
 }
 
-static void ping_gca_nodes(GC_Announce *announce)
+/* Pings the announced nodes whose ping interval is over and removes the ones that timed out.
+ * Only the nodes that are due are looked at.
+ */
+static void do_gca_nodes(GC_Announce *announce)
 {
-    size_t i;
+    GCA_Store *store = &announce->announcements;
+    uint32_t nodenumber;
 
-    for (i = 0; i < MAX_GCA_ANNOUNCED_NODES; ++i) {
-        if (!ipport_isset(&announce->announcements[i].node.ip_port))
-            continue;
+    while ((nodenumber = gca_store_due(store, unix_time(announce->dht->mono_time))) != GCA_STORE_NONE) {
+        struct GC_AnnouncedNode *node = gca_store_get(store, nodenumber);
 
-        if (announce->announcements[i].self || !is_timeout(announce->announcements[i].last_sent_ping, GCA_PING_INTERVAL))
+        if (is_timeout(announce->dht->mono_time, node->last_rcvd_ping, GCA_NODES_EXPIRATION)) {
+            gca_store_remove(store, nodenumber);
             continue;
+        }
 
         uint64_t ping_id = random_64b();
-        announce->announcements[i].ping_id = ping_id;
-        announce->announcements[i].last_sent_ping = unix_time();
-        send_gca_ping_request(announce->dht, &announce->announcements[i].node, ping_id);
+
+        if (gca_store_set_ping(store, nodenumber, ping_id) == 0)
+            send_gca_ping_request(announce->dht, &node->node, ping_id);
+
+        node->last_sent_ping = unix_time(announce->dht->mono_time);
+        gca_store_set_deadline(store, nodenumber, MIN(node->last_sent_ping + GCA_PING_INTERVAL,
+                               node->last_rcvd_ping + GCA_NODES_EXPIRATION));
     }
 }
 
@@ -936,8 +874,8 @@ static void renew_gca_self_announces(GC_Announce *announce)
         if (!announce->self_announce[i].is_set)
             continue;
 
-        if (is_timeout(announce->self_announce[i].last_rcvd_ping, SELF_ANNOUNCE_TIMEOUT)) {
-            announce->self_announce[i].last_rcvd_ping = unix_time();
+        if (is_timeout(announce->dht->mono_time, announce->self_announce[i].last_rcvd_ping, SELF_ANNOUNCE_TIMEOUT)) {
+            announce->self_announce[i].last_rcvd_ping = unix_time(announce->dht->mono_time);
             announce->self_announce[i].is_set = false;
             gca_send_announce_request(announce, announce->self_announce[i].self_public_key,
                                       announce->self_announce[i].self_secret_key,
@@ -946,24 +884,9 @@ static void renew_gca_self_announces(GC_Announce *announce)
     }
 }
 
-static void check_gca_node_timeouts(GC_Announce *announce)
-{
-    size_t i;
-
-    for (i = 0; i < MAX_GCA_ANNOUNCED_NODES; i++) {
-        if (!ipport_isset(&announce->announcements[i].node.ip_port))
-            continue;
-
-        if (!announce->announcements[i].self && is_timeout(announce->announcements[i].last_rcvd_ping, GCA_NODES_EXPIRATION))
-            memset(&announce->announcements[i], 0, sizeof(struct GC_AnnouncedNode));
-
-    }
-}
-
 void do_gca(GC_Announce *announce)
 {
-    ping_gca_nodes(announce);
-    check_gca_node_timeouts(announce);
+    do_gca_nodes(announce);
     renew_gca_self_announces(announce);
 }
 
@@ -990,14 +913,7 @@ void gca_peer_cleanup(GC_Announce *announce, const uint8_t *chat_id, const uint8
 
 void gca_cleanup(GC_Announce *announce, const uint8_t *chat_id)
 {
-    size_t i;
-
-    /* Remove self announcements for chat_id */
-    for (i = 0; i < MAX_GCA_ANNOUNCED_NODES; ++i) {
-        if (announce->announcements[i].self && chat_id_equal(announce->announcements[i].chat_id, chat_id))
-            memset(&announce->announcements[i], 0, sizeof(struct GC_AnnouncedNode));
-    }
-
+    gca_store_remove_self(&announce->announcements, chat_id);
     remove_gca_self_announce(announce, chat_id);
 }
 
@@ -1009,6 +925,8 @@ GC_Announce *new_gca(DHT *dht)
         return NULL;
 
     announce->dht = dht;
+    gca_store_init(&announce->announcements, dht->mono_time, GCA_STORE_DEFAULT_MAX_NODES,
+                   GCA_STORE_DEFAULT_MAX_GROUP_NODES);
     networking_registerhandler(announce->dht->net, NET_PACKET_GCA_ANNOUNCE, &handle_gca_request, announce);
     networking_registerhandler(announce->dht->net, NET_PACKET_GCA_GET_NODES, &handle_gc_get_announced_nodes_request, announce);
     networking_registerhandler(announce->dht->net, NET_PACKET_GCA_SEND_NODES, &handle_gca_get_nodes_response, announce);
@@ -1025,6 +943,12 @@ void kill_gca(GC_Announce *announce)
     networking_registerhandler(announce->dht->net, NET_PACKET_GCA_PING_REQUEST, NULL, NULL);
     networking_registerhandler(announce->dht->net, NET_PACKET_GCA_PING_RESPONSE, NULL, NULL);
 
+    gca_store_free(&announce->announcements);
     free(announce);
     announce = NULL;
 }
+
+int gca_set_limits(GC_Announce *announce, uint32_t max_nodes, uint32_t max_group_nodes)
+{
+    return gca_store_set_limits(&announce->announcements, max_nodes, max_group_nodes);
+}
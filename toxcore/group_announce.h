@@ -22,21 +22,16 @@
 #define GROUP_ANNOUNCE_H
 
 #include "DHT.h"
+#include "group_announce_store.h"
 #include "stdbool.h"
 
 typedef struct GC_Announce GC_Announce;
 typedef struct GC_Session GC_Session;
 
 #define MAX_GCA_SELF_REQUESTS 30
-#define MAX_GCA_ANNOUNCED_NODES 30
 #define MAX_GCA_SELF_ANNOUNCEMENTS 30
 #define MAX_GCA_SENT_NODES 4
 
-typedef struct {
-    uint8_t public_key[ENC_PUBLIC_KEY];
-    IP_Port ip_port;
-} GC_Announce_Node;
-
 /* Holds nodes that we receive when we send a request. Used to join groups */
 struct GC_AnnounceRequest {
     GC_Announce_Node nodes[MAX_GCA_SENT_NODES];
@@ -48,17 +43,6 @@ struct GC_AnnounceRequest {
     bool ready;
 };
 
-/* Holds announced nodes we get via DHT announcements */
-struct GC_AnnouncedNode {
-    uint8_t chat_id[CHAT_ID_SIZE];
-    GC_Announce_Node node;
-    uint64_t last_rcvd_ping;
-    uint64_t last_sent_ping;
-    uint64_t time_added;
-    uint64_t ping_id;
-    bool self;   /* true if this is our own announcement; will never be pinged or timeout */
-};
-
 /* Holds our own announcements when we join a group.
  * Currently will only keep track of up to MAX_GCA_SELF_ANNOUNCEMENTS groups at once.
  */
@@ -75,7 +59,7 @@ struct GC_Announce {
     void (*update_addresses)(GC_Announce *, const uint8_t *, void *);
     void *update_addresses_obj;
 
-    struct GC_AnnouncedNode announcements[MAX_GCA_ANNOUNCED_NODES];
+    GCA_Store announcements;   /* nodes announced to us for the chat_ids close to us */
     struct GC_AnnounceRequest requests[MAX_GCA_SELF_REQUESTS];
     struct GC_AnnouncedSelf self_announce[MAX_GCA_SELF_ANNOUNCEMENTS];
 };
@@ -118,6 +102,13 @@ void gca_cleanup(GC_Announce *announce, const uint8_t *chat_id);
 
 GC_Announce *new_gca(DHT *dht);
 
+/* Sets the number of announced nodes we hold, in total and for each group.
+ *
+ * Returns 0 on success.
+ * Returns -1 if a limit is 0.
+ */
+int gca_set_limits(GC_Announce *announce, uint32_t max_nodes, uint32_t max_group_nodes);
+
 /* Called when associated Messenger object is killed. */
 void kill_gca(GC_Announce *announce);
 
@@ -0,0 +1,566 @@
+/* group_announce_store.c
+ *
+ * Storage for the group announcements DHT nodes hold for the chat_ids close to them
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "group_announce_store.h"
+#include "util.h"
+
+#include <stdlib.h>
+
+/* Nodes live in one array whose unused entries form a free list, it grows up to max_nodes and
+ * never moves a node to another node number. Groups are kept in a dense array, removing one moves
+ * the last group into its place.
+ */
+
+#define GCA_STORE_MIN_SIZE 16
+
+typedef struct {
+    const uint8_t *chat_id;
+    const uint8_t *public_key;
+} Node_Key;
+
+static uint32_t get_chat_id_hash(const uint8_t *chat_id)
+{
+    return jenkins_one_at_a_time_hash(chat_id, CHAT_ID_SIZE);
+}
+
+static uint32_t get_node_key_hash(const uint8_t *public_key)
+{
+    return jenkins_one_at_a_time_hash(public_key, ENC_PUBLIC_KEY);
+}
+
+static bool group_match(const void *object, uint32_t value, const void *key)
+{
+    const GCA_Store *store = object;
+    return chat_id_equal(store->groups[value].chat_id, key);
+}
+
+static bool node_match(const void *object, uint32_t value, const void *key)
+{
+    const GCA_Store *store = object;
+    const Node_Key *node_key = key;
+
+    return id_equal(store->nodes[value].node.public_key, node_key->public_key)
+           && chat_id_equal(store->nodes[value].chat_id, node_key->chat_id);
+}
+
+static uint32_t get_ping_id_hash(uint64_t ping_id)
+{
+    return (uint32_t)ping_id ^ (uint32_t)(ping_id >> 32);
+}
+
+static bool ping_match(const void *object, uint32_t value, const void *key)
+{
+    const GCA_Store *store = object;
+    return store->nodes[value].ping_id == *(const uint64_t *)key;
+}
+
+static uint32_t find_group(const GCA_Store *store, const uint8_t *chat_id)
+{
+    if (store->num_groups == 0)
+        return GCA_STORE_NONE;
+
+    return hash_index_find(&store->group_index, get_chat_id_hash(chat_id), &group_match, store, chat_id);
+}
+
+static uint32_t find_node(const GCA_Store *store, const uint8_t *chat_id, const uint8_t *public_key)
+{
+    if (store->count == 0)
+        return GCA_STORE_NONE;
+
+    Node_Key key = {chat_id, public_key};
+    return hash_index_find(&store->node_index, get_node_key_hash(public_key), &node_match, store, &key);
+}
+
+static void heap_set(GCA_Store *store, uint32_t pos, uint32_t nodenumber)
+{
+    store->heap[pos] = nodenumber;
+    store->nodes[nodenumber].heap_pos = pos;
+}
+
+static uint64_t heap_deadline(const GCA_Store *store, uint32_t pos)
+{
+    return store->nodes[store->heap[pos]].deadline;
+}
+
+static void heap_sift_up(GCA_Store *store, uint32_t pos)
+{
+    uint32_t nodenumber = store->heap[pos];
+    uint64_t deadline = store->nodes[nodenumber].deadline;
+
+    while (pos > 0 && heap_deadline(store, (pos - 1) / 2) > deadline) {
+        heap_set(store, pos, store->heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+
+    heap_set(store, pos, nodenumber);
+}
+
+static void heap_sift_down(GCA_Store *store, uint32_t pos)
+{
+    uint32_t nodenumber = store->heap[pos];
+    uint64_t deadline = store->nodes[nodenumber].deadline;
+
+    while (2 * pos + 1 < store->heap_count) {
+        uint32_t child = 2 * pos + 1;
+
+        if (child + 1 < store->heap_count && heap_deadline(store, child + 1) < heap_deadline(store, child))
+            ++child;
+
+        if (deadline <= heap_deadline(store, child))
+            break;
+
+        heap_set(store, pos, store->heap[child]);
+        pos = child;
+    }
+
+    heap_set(store, pos, nodenumber);
+}
+
+static void heap_push(GCA_Store *store, uint32_t nodenumber)
+{
+    heap_set(store, store->heap_count++, nodenumber);
+    heap_sift_up(store, store->heap_count - 1);
+}
+
+static void heap_remove(GCA_Store *store, uint32_t nodenumber)
+{
+    uint32_t pos = store->nodes[nodenumber].heap_pos;
+    uint32_t last = store->heap[--store->heap_count];
+
+    store->nodes[nodenumber].heap_pos = GCA_STORE_NONE;
+
+    if (pos == store->heap_count)
+        return;
+
+    heap_set(store, pos, last);
+    heap_sift_up(store, pos);
+    heap_sift_down(store, store->nodes[last].heap_pos);
+}
+
+static uint32_t add_group(GCA_Store *store, const uint8_t *chat_id)
+{
+    if (store->num_groups == store->groups_size) {
+        uint32_t size = store->groups_size ? store->groups_size * 2 : GCA_STORE_MIN_SIZE;
+        GCA_Store_Group *groups = realloc(store->groups, size * sizeof(GCA_Store_Group));
+
+        if (groups == NULL)
+            return GCA_STORE_NONE;
+
+        store->groups = groups;
+        store->groups_size = size;
+    }
+
+    uint32_t g = store->num_groups;
+
+    if (hash_index_add(&store->group_index, get_chat_id_hash(chat_id), g) == -1)
+        return GCA_STORE_NONE;
+
+    memcpy(store->groups[g].chat_id, chat_id, CHAT_ID_SIZE);
+    store->groups[g].head = GCA_STORE_NONE;
+    store->groups[g].count = 0;
+    ++store->num_groups;
+
+    return g;
+}
+
+static void remove_group(GCA_Store *store, uint32_t g)
+{
+    uint32_t last = store->num_groups - 1;
+
+    hash_index_remove(&store->group_index, get_chat_id_hash(store->groups[g].chat_id), g);
+
+    if (g != last) {
+        /* Can't fail, the index just got smaller */
+        hash_index_remove(&store->group_index, get_chat_id_hash(store->groups[last].chat_id), last);
+        store->groups[g] = store->groups[last];
+        hash_index_add(&store->group_index, get_chat_id_hash(store->groups[g].chat_id), g);
+
+        uint32_t n;
+
+        for (n = store->groups[g].head; n != GCA_STORE_NONE; n = store->nodes[n].next)
+            store->nodes[n].group = g;
+    }
+
+    --store->num_groups;
+}
+
+/* Returns a free node number, GCA_STORE_NONE if the store is full. */
+static uint32_t alloc_node(GCA_Store *store)
+{
+    if (store->count >= store->max_nodes)
+        return GCA_STORE_NONE;
+
+    if (store->free_head == GCA_STORE_NONE) {
+        if (store->nodes_size >= store->max_nodes)
+            return GCA_STORE_NONE;
+
+        uint32_t size = store->nodes_size ? store->nodes_size * 2 : GCA_STORE_MIN_SIZE;
+
+        if (size > store->max_nodes)
+            size = store->max_nodes;
+
+        struct GC_AnnouncedNode *nodes = realloc(store->nodes, size * sizeof(struct GC_AnnouncedNode));
+
+        if (nodes == NULL)
+            return GCA_STORE_NONE;
+
+        store->nodes = nodes;
+
+        uint32_t *heap = realloc(store->heap, size * sizeof(uint32_t));
+
+        if (heap == NULL)
+            return GCA_STORE_NONE;
+
+        store->heap = heap;
+
+        uint32_t i;
+
+        for (i = size; i > store->nodes_size; --i) {
+            memset(&store->nodes[i - 1], 0, sizeof(struct GC_AnnouncedNode));
+            store->nodes[i - 1].next = store->free_head;
+            store->free_head = i - 1;
+        }
+
+        store->nodes_size = size;
+    }
+
+    uint32_t nodenumber = store->free_head;
+    store->free_head = store->nodes[nodenumber].next;
+    return nodenumber;
+}
+
+static void free_node(GCA_Store *store, uint32_t nodenumber)
+{
+    memset(&store->nodes[nodenumber], 0, sizeof(struct GC_AnnouncedNode));
+    store->nodes[nodenumber].next = store->free_head;
+    store->free_head = nodenumber;
+}
+
+static void link_node(GCA_Store *store, uint32_t nodenumber, uint32_t g)
+{
+    struct GC_AnnouncedNode *node = &store->nodes[nodenumber];
+    GCA_Store_Group *group = &store->groups[g];
+
+    node->group = g;
+    node->prev = GCA_STORE_NONE;
+    node->next = group->head;
+
+    if (group->head != GCA_STORE_NONE)
+        store->nodes[group->head].prev = nodenumber;
+
+    group->head = nodenumber;
+    ++group->count;
+}
+
+/* Takes the node out of its group list, removing the group if it's left empty. */
+static void unlink_node(GCA_Store *store, uint32_t nodenumber)
+{
+    struct GC_AnnouncedNode *node = &store->nodes[nodenumber];
+    GCA_Store_Group *group = &store->groups[node->group];
+
+    if (node->prev != GCA_STORE_NONE)
+        store->nodes[node->prev].next = node->next;
+    else
+        group->head = node->next;
+
+    if (node->next != GCA_STORE_NONE)
+        store->nodes[node->next].prev = node->prev;
+
+    if (--group->count == 0)
+        remove_group(store, node->group);
+}
+
+void gca_store_remove(GCA_Store *store, uint32_t nodenumber)
+{
+    if (nodenumber >= store->nodes_size || !store->nodes[nodenumber].in_use)
+        return;
+
+    struct GC_AnnouncedNode *node = &store->nodes[nodenumber];
+
+    if (node->heap_pos != GCA_STORE_NONE)
+        heap_remove(store, nodenumber);
+
+    gca_store_set_ping(store, nodenumber, 0);
+    hash_index_remove(&store->node_index, get_node_key_hash(node->node.public_key), nodenumber);
+    unlink_node(store, nodenumber);
+    free_node(store, nodenumber);
+    --store->count;
+}
+
+/* Removes the oldest announcement of group g that isn't a self announcement.
+ *
+ * Returns 0 on success.
+ * Returns -1 if the group only holds self announcements.
+ */
+static int evict_group_node(GCA_Store *store, uint32_t g)
+{
+    uint32_t n, oldest = GCA_STORE_NONE;
+
+    for (n = store->groups[g].head; n != GCA_STORE_NONE; n = store->nodes[n].next) {
+        if (!store->nodes[n].self)
+            oldest = n;
+    }
+
+    if (oldest == GCA_STORE_NONE)
+        return -1;
+
+    gca_store_remove(store, oldest);
+    return 0;
+}
+
+/* Removes the announcement with the earliest deadline, the one we heard from the longest ago.
+ *
+ * Returns 0 on success.
+ * Returns -1 if the store only holds self announcements.
+ */
+static int evict_node(GCA_Store *store)
+{
+    if (store->heap_count == 0)
+        return -1;
+
+    gca_store_remove(store, store->heap[0]);
+    return 0;
+}
+
+void gca_store_init(GCA_Store *store, const Mono_Time *mono_time, uint32_t max_nodes, uint32_t max_group_nodes)
+{
+    memset(store, 0, sizeof(GCA_Store));
+    store->mono_time = mono_time;
+    store->free_head = GCA_STORE_NONE;
+    store->max_nodes = max_nodes;
+    store->max_group_nodes = max_group_nodes;
+}
+
+void gca_store_free(GCA_Store *store)
+{
+    free(store->nodes);
+    free(store->groups);
+    free(store->heap);
+    hash_index_free(&store->group_index);
+    hash_index_free(&store->node_index);
+    hash_index_free(&store->ping_index);
+    gca_store_init(store, store->mono_time, store->max_nodes, store->max_group_nodes);
+}
+
+int gca_store_set_limits(GCA_Store *store, uint32_t max_nodes, uint32_t max_group_nodes)
+{
+    if (max_nodes == 0 || max_group_nodes == 0)
+        return -1;
+
+    store->max_nodes = max_nodes;
+    store->max_group_nodes = max_group_nodes;
+
+    while (store->count > max_nodes && evict_node(store) == 0)
+        ;
+
+    uint32_t g;
+
+    for (g = 0; g < store->num_groups; ++g) {
+        while (store->groups[g].count > max_group_nodes && evict_group_node(store, g) == 0)
+            ;
+    }
+
+    return 0;
+}
+
+int gca_store_add(GCA_Store *store, const uint8_t *chat_id, const GC_Announce_Node *node, bool self,
+                  uint64_t deadline)
+{
+    uint32_t nodenumber = find_node(store, chat_id, node->public_key);
+    uint32_t g;
+
+    if (nodenumber == GCA_STORE_NONE) {
+        g = find_group(store, chat_id);
+
+        if (g != GCA_STORE_NONE && store->groups[g].count >= store->max_group_nodes) {
+            if (evict_group_node(store, g) == -1)
+                return -1;
+        }
+
+        nodenumber = alloc_node(store);
+
+        if (nodenumber == GCA_STORE_NONE) {
+            if (evict_node(store) == -1)
+                return -1;
+
+            nodenumber = alloc_node(store);
+        }
+
+        /* The evictions may have removed the group */
+        g = find_group(store, chat_id);
+
+        if (g == GCA_STORE_NONE)
+            g = add_group(store, chat_id);
+
+        if (g == GCA_STORE_NONE
+                || hash_index_add(&store->node_index, get_node_key_hash(node->public_key), nodenumber) == -1) {
+            if (g != GCA_STORE_NONE && store->groups[g].count == 0)
+                remove_group(store, g);
+
+            free_node(store, nodenumber);
+            return -1;
+        }
+
+        struct GC_AnnouncedNode *entry = &store->nodes[nodenumber];
+        memcpy(entry->chat_id, chat_id, CHAT_ID_SIZE);
+        memcpy(entry->node.public_key, node->public_key, ENC_PUBLIC_KEY);
+        entry->in_use = true;
+        entry->heap_pos = GCA_STORE_NONE;
+        link_node(store, nodenumber, g);
+        ++store->count;
+    } else {
+        /* Refreshed announcements become the newest of their group */
+        g = store->nodes[nodenumber].group;
+
+        if (store->groups[g].head != nodenumber) {
+            struct GC_AnnouncedNode *entry = &store->nodes[nodenumber];
+            store->nodes[entry->prev].next = entry->next;
+
+            if (entry->next != GCA_STORE_NONE)
+                store->nodes[entry->next].prev = entry->prev;
+
+            --store->groups[g].count;
+            link_node(store, nodenumber, g);
+        }
+    }
+
+    struct GC_AnnouncedNode *entry = &store->nodes[nodenumber];
+
+    ipport_copy(&entry->node.ip_port, &node->ip_port);
+    entry->last_rcvd_ping = unix_time(store->mono_time);
+    entry->last_sent_ping = unix_time(store->mono_time);
+    entry->time_added = unix_time(store->mono_time);
+    entry->self = self;
+
+    if (self) {
+        if (entry->heap_pos != GCA_STORE_NONE)
+            heap_remove(store, nodenumber);
+    } else {
+        gca_store_set_deadline(store, nodenumber, deadline);
+    }
+
+    return nodenumber;
+}
+
+struct GC_AnnouncedNode *gca_store_get(GCA_Store *store, uint32_t nodenumber)
+{
+    if (nodenumber >= store->nodes_size || !store->nodes[nodenumber].in_use)
+        return NULL;
+
+    return &store->nodes[nodenumber];
+}
+
+void gca_store_remove_self(GCA_Store *store, const uint8_t *chat_id)
+{
+    uint32_t g = find_group(store, chat_id);
+
+    if (g == GCA_STORE_NONE)
+        return;
+
+    uint32_t n = store->groups[g].head;
+
+    while (n != GCA_STORE_NONE) {
+        uint32_t next = store->nodes[n].next;
+
+        if (store->nodes[n].self) {
+            /* The group goes away with its last node */
+            bool last = store->groups[g].count == 1;
+            gca_store_remove(store, n);
+
+            if (last)
+                return;
+        }
+
+        n = next;
+    }
+}
+
+uint32_t gca_store_get_nodes(const GCA_Store *store, const uint8_t *chat_id, GC_Announce_Node *nodes,
+                             uint32_t max_nodes)
+{
+    uint32_t g = find_group(store, chat_id);
+    uint32_t n, num = 0;
+
+    if (g == GCA_STORE_NONE)
+        return 0;
+
+    for (n = store->groups[g].head; n != GCA_STORE_NONE && num < max_nodes; n = store->nodes[n].next) {
+        memcpy(nodes[num].public_key, store->nodes[n].node.public_key, ENC_PUBLIC_KEY);
+        ipport_copy(&nodes[num].ip_port, &store->nodes[n].node.ip_port);
+        ++num;
+    }
+
+    return num;
+}
+
+int gca_store_set_ping(GCA_Store *store, uint32_t nodenumber, uint64_t ping_id)
+{
+    struct GC_AnnouncedNode *node = &store->nodes[nodenumber];
+
+    if (node->ping_id != 0)
+        hash_index_remove(&store->ping_index, get_ping_id_hash(node->ping_id), nodenumber);
+
+    node->ping_id = 0;
+
+    if (ping_id == 0)
+        return 0;
+
+    if (hash_index_add(&store->ping_index, get_ping_id_hash(ping_id), nodenumber) == -1)
+        return -1;
+
+    node->ping_id = ping_id;
+    return 0;
+}
+
+uint32_t gca_store_find_ping(const GCA_Store *store, uint64_t ping_id)
+{
+    if (store->count == 0 || ping_id == 0)
+        return GCA_STORE_NONE;
+
+    return hash_index_find(&store->ping_index, get_ping_id_hash(ping_id), &ping_match, store, &ping_id);
+}
+
+uint32_t gca_store_due(const GCA_Store *store, uint64_t time)
+{
+    if (store->heap_count == 0 || store->nodes[store->heap[0]].deadline > time)
+        return GCA_STORE_NONE;
+
+    return store->heap[0];
+}
+
+void gca_store_set_deadline(GCA_Store *store, uint32_t nodenumber, uint64_t deadline)
+{
+    struct GC_AnnouncedNode *node = &store->nodes[nodenumber];
+    node->deadline = deadline;
+
+    if (node->heap_pos == GCA_STORE_NONE) {
+        heap_push(store, nodenumber);
+    } else {
+        heap_sift_up(store, node->heap_pos);
+        heap_sift_down(store, node->heap_pos);
+    }
+}
@@ -0,0 +1,154 @@
+/* group_announce_store.h
+ *
+ * Storage for the group announcements DHT nodes hold for the chat_ids close to them
+ * -Announced nodes are indexed by chat_id, lookups don't depend on the number of stored groups
+ * -Each group holds a limited number of nodes so that popular groups can't evict all others
+ * -Pings and timeouts are driven by a min-heap of the time each node must next be looked at
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GROUP_ANNOUNCE_STORE_H
+#define GROUP_ANNOUNCE_STORE_H
+
+#include "DHT.h"
+#include "hash_index.h"
+
+/* Default limits, memory is only allocated for the nodes actually stored. */
+#define GCA_STORE_DEFAULT_MAX_NODES 65536
+#define GCA_STORE_DEFAULT_MAX_GROUP_NODES 16
+
+/* Value of unused node numbers and heap positions. */
+#define GCA_STORE_NONE UINT32_MAX
+
+typedef struct {
+    uint8_t public_key[ENC_PUBLIC_KEY];
+    IP_Port ip_port;
+} GC_Announce_Node;
+
+/* Holds announced nodes we get via DHT announcements */
+struct GC_AnnouncedNode {
+    uint8_t chat_id[CHAT_ID_SIZE];
+    GC_Announce_Node node;
+    uint64_t last_rcvd_ping;
+    uint64_t last_sent_ping;
+    uint64_t time_added;
+    uint64_t ping_id;
+    uint64_t deadline;   /* unix time the node must next be pinged or timed out at */
+    bool self;   /* true if this is our own announcement; will never be pinged or timeout */
+
+    bool in_use;
+    uint32_t group;   /* index in the groups array */
+    uint32_t prev, next;   /* nodes of the same group, newest first, or free nodes */
+    uint32_t heap_pos;   /* GCA_STORE_NONE for self announcements */
+};
+
+typedef struct {
+    uint8_t chat_id[CHAT_ID_SIZE];
+    uint32_t head;   /* newest node of the group */
+    uint32_t count;
+} GCA_Store_Group;
+
+/* A zeroed GCA_Store with limits set by gca_store_init is a valid empty store. */
+typedef struct {
+    const Mono_Time *mono_time;
+
+    struct GC_AnnouncedNode *nodes;
+    uint32_t nodes_size;
+    uint32_t count;
+    uint32_t free_head;
+
+    GCA_Store_Group *groups;
+    uint32_t groups_size;
+    uint32_t num_groups;
+
+    uint32_t *heap;   /* node numbers of the nodes that aren't self announcements, ordered by deadline */
+    uint32_t heap_count;
+
+    Hash_Index group_index;   /* groups by hash of chat_id */
+    Hash_Index node_index;   /* nodes by hash of their public key */
+    Hash_Index ping_index;   /* nodes by hash of the ping_id we are waiting for */
+
+    uint32_t max_nodes;
+    uint32_t max_group_nodes;
+} GCA_Store;
+
+/* Initiates an empty store holding up to max_nodes, at most max_group_nodes of them for the same group.
+ * Nodes are timestamped with the unix time of mono_time.
+ */
+void gca_store_init(GCA_Store *store, const Mono_Time *mono_time, uint32_t max_nodes, uint32_t max_group_nodes);
+
+/* Frees the memory used by store and empties it, the limits are kept. */
+void gca_store_free(GCA_Store *store);
+
+/* Changes the limits of store, evicting the nodes above them.
+ *
+ * Returns 0 on success.
+ * Returns -1 if a limit is 0.
+ */
+int gca_store_set_limits(GCA_Store *store, uint32_t max_nodes, uint32_t max_group_nodes);
+
+/* Adds or refreshes the announcement of node for chat_id.
+ *
+ * If the group is full its oldest announcement is replaced, if the store is full the announcement with the
+ * earliest deadline is replaced. Self announcements are never replaced.
+ *
+ * deadline is the unix time the announcement must first be looked at, unused for self announcements.
+ *
+ * Returns the node number on success.
+ * Returns -1 on failure.
+ */
+int gca_store_add(GCA_Store *store, const uint8_t *chat_id, const GC_Announce_Node *node, bool self,
+                  uint64_t deadline);
+
+/* Returns the stored node with nodenumber, NULL if there is none. */
+struct GC_AnnouncedNode *gca_store_get(GCA_Store *store, uint32_t nodenumber);
+
+/* Removes the node with nodenumber from store. */
+void gca_store_remove(GCA_Store *store, uint32_t nodenumber);
+
+/* Removes our own announcements for chat_id. */
+void gca_store_remove_self(GCA_Store *store, const uint8_t *chat_id);
+
+/* Copies up to max_nodes of the newest nodes announced for chat_id to nodes.
+ *
+ * Returns the number of copied nodes.
+ */
+uint32_t gca_store_get_nodes(const GCA_Store *store, const uint8_t *chat_id, GC_Announce_Node *nodes,
+                             uint32_t max_nodes);
+
+/* Sets the ping_id of the ping we sent to the node with nodenumber, 0 once answered.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+int gca_store_set_ping(GCA_Store *store, uint32_t nodenumber, uint64_t ping_id);
+
+/* Returns the node number of the node we sent ping_id to, GCA_STORE_NONE if there is none. */
+uint32_t gca_store_find_ping(const GCA_Store *store, uint64_t ping_id);
+
+/* Returns the node number of the node with the earliest deadline if it is at or before time,
+ * GCA_STORE_NONE otherwise.
+ */
+uint32_t gca_store_due(const GCA_Store *store, uint64_t time);
+
+/* Sets the deadline of the node with nodenumber, which isn't a self announcement. */
+void gca_store_set_deadline(GCA_Store *store, uint32_t nodenumber, uint64_t deadline);
+
+#endif
@@ -33,6 +33,7 @@
 #include "group_announce.h"
 #include "group_connection.h"
 #include "group_moderation.h"
+#include "group_history.h"
 #include "LAN_discovery.h"
 #include "util.h"
 #include "Messenger.h"
@@ -40,14 +41,25 @@
 #define GC_MAX_PACKET_PADDING 8
 #define GC_PACKET_PADDING_LENGTH(length) (((MAX_GC_PACKET_SIZE - (length)) % GC_MAX_PACKET_PADDING))
 
+/* Version of the formats of the packets sent once connected, exchanged in the handshake. Peers only connect
+ * to peers of the same version, as the formats can't be told apart on the wire.
+ *
+ * 1: lossless packets carry a cumulative ack after their message id and GP_MESSAGE_ACK carries the cumulative
+ *    ack and the ranges received past the first gap, instead of acking messages one by one.
+ *    The shared state carries the group topology after the privacy state.
+ * 2: GM_PLAIN_MESSAGE and GM_ACTION_MESSAGE carry the time they were sent at and the signature of their sender
+ *    before the message, so that they can be passed on in message logs.
+ */
+#define GC_PROTOCOL_VERSION 2
+
 #define GC_PLAIN_HS_PACKET_SIZE (sizeof(uint8_t) + HASH_ID_BYTES + ENC_PUBLIC_KEY + SIG_PUBLIC_KEY\
-                                 + sizeof(uint8_t) + sizeof(uint8_t))
+                                 + sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint8_t))
 
 #define GC_ENCRYPTED_HS_PACKET_SIZE (sizeof(uint8_t) + HASH_ID_BYTES + ENC_PUBLIC_KEY + crypto_box_NONCEBYTES\
                                      + GC_PLAIN_HS_PACKET_SIZE + crypto_box_MACBYTES)
 
 #define GC_PACKED_SHARED_STATE_SIZE (EXT_PUBLIC_KEY + sizeof(uint32_t) + MAX_GC_GROUP_NAME_SIZE + sizeof(uint16_t)\
-                                     + sizeof(uint8_t) + sizeof(uint16_t) + MAX_GC_PASSWD_SIZE\
+                                     + sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint16_t) + MAX_GC_PASSWD_SIZE\
                                      + GC_MODERATION_HASH_SIZE + sizeof(uint32_t))
 
 #define GC_SHARED_STATE_ENC_PACKET_SIZE (HASH_ID_BYTES + SIGNATURE_SIZE + GC_PACKED_SHARED_STATE_SIZE)
@@ -55,27 +67,47 @@
 /* Header information attached to all broadcast messages. broadcast_type, public key hash, timestamp */
 #define GC_BROADCAST_ENC_HEADER_SIZE (1 + HASH_ID_BYTES + TIME_STAMP_SIZE)
 
+/* Time and signature in front of group messages */
+#define GC_MESSAGE_HEADER_SIZE (TIME_STAMP_SIZE + SIGNATURE_SIZE)
+
 #define MESSAGE_ID_BYTES (sizeof(uint64_t))
 
-#define MIN_GC_LOSSLESS_PACKET_SIZE (sizeof(uint8_t) + MESSAGE_ID_BYTES + HASH_ID_BYTES + ENC_PUBLIC_KEY\
+/* Peers drop broadcasts numbered lower than the ones they've seen from us, so every session numbers its
+ * broadcasts after those of the previous ones: its start time in the upper half.
+ */
+#define GC_GOSSIP_FIRST_SEQ(time) ((uint64_t)(time) << 32)
+
+/* Number of peer addresses we send joining peers of overlay groups in the sync response */
+#define GC_OVERLAY_SYNC_ADDRS (GC_OVERLAY_NEIGHBOURS * 4)
+
+/* Lossless packets carry their message_id and the id of the last message we received in sequence (ack_id) */
+#define MIN_GC_LOSSLESS_PACKET_SIZE (sizeof(uint8_t) + (MESSAGE_ID_BYTES * 2) + HASH_ID_BYTES + ENC_PUBLIC_KEY\
                                      + crypto_box_NONCEBYTES + sizeof(uint8_t) + crypto_box_MACBYTES)
 
-#define MIN_GC_LOSSY_PACKET_SIZE (MIN_GC_LOSSLESS_PACKET_SIZE - MESSAGE_ID_BYTES)
+#define MIN_GC_LOSSY_PACKET_SIZE (MIN_GC_LOSSLESS_PACKET_SIZE - (MESSAGE_ID_BYTES * 2))
 
 #define MAX_GC_PACKET_SIZE 65507
 
+/* Smallest number of peers the peer list has room for */
+#define GC_MIN_PEERS_CAPACITY 8
+
 /* approximation of the sync response packet size limit */
 #define MAX_GC_NUM_PEERS ((MAX_GC_PACKET_SIZE - MAX_GC_TOPIC_SIZE - sizeof(uint16_t)) / (ENC_PUBLIC_KEY + sizeof(IP_Port)))
 
 /* Size of a ping packet which contains a peer count, the shared state version, and the sanctions list version */
 #define GC_PING_PACKET_DATA_SIZE (sizeof(uint32_t) * 3)
 
+/* Pings also carry our cumulative ack (ack_id) for the peer */
+#define GC_PING_PACKET_ACK_SIZE (GC_PING_PACKET_DATA_SIZE + MESSAGE_ID_BYTES)
+
 static int groupnumber_valid(const GC_Session *c, int groupnumber);
 static int peer_add(Messenger *m, int groupnumber, IP_Port *ipp, const uint8_t *public_key);
+static int relayed_peer_add(Messenger *m, int groupnumber, const uint8_t *public_key);
 static int peer_update(Messenger *m, int groupnumber, GC_GroupPeer *peer, uint32_t peernumber);
 static int group_delete(GC_Session *c, GC_Chat *chat);
 static int get_nick_peernumber(const GC_Chat *chat, const uint8_t *nick, uint16_t length);
 static int sync_gc_announced_nodes(const GC_Session *c, GC_Chat *chat);
+static int start_gc_history_sync(GC_Chat *chat, uint32_t peernumber);
 
 enum {
     GH_REQUEST,
@@ -100,19 +132,32 @@ static void print_peer(const GC_GroupPeer *peer, const GC_Connection *gconn)
     fprintf(stderr, "Ignore: %d\n", gconn->ignore);
 }
 
+static bool chat_index_match(const void *object, uint32_t value, const void *key)
+{
+    const GC_Session *c = object;
+    return value < c->num_chats && c->chats[value].connection_state != CS_NONE;
+}
+
 static GC_Chat *get_chat_by_hash(GC_Session *c, uint32_t hash)
 {
     if (!c)
         return NULL;
 
-    uint32_t i;
+    uint32_t groupnumber = hash_index_find(&c->chat_index, hash, &chat_index_match, c, NULL);
 
-    for (i = 0; i < c->num_chats; i ++) {
-        if (c->chats[i].chat_id_hash == hash)
-            return &c->chats[i];
-    }
+    if (groupnumber == HASH_INDEX_NONE)
+        return NULL;
+
+    return &c->chats[groupnumber];
+}
+
+/* Returns the worker threads sanctions list signatures are verified on, NULL if there are none. */
+static Crypto_Pipeline *get_gc_crypto_pipeline(const Messenger *m)
+{
+    if (m->net_crypto->pipeline == NULL)
+        return NULL;
 
-    return NULL;
+    return m->net_crypto->pipeline->pipeline;
 }
 
 /* Returns the jenkins hash of a 32 byte public encryption key */
@@ -121,12 +166,57 @@ static uint32_t get_peer_key_hash(const uint8_t *public_key)
     return jenkins_one_at_a_time_hash(public_key, ENC_PUBLIC_KEY);
 }
 
+/* Returns the jenkins hash of a 32 byte public signature key */
+static uint32_t get_peer_sig_key_hash(const uint8_t *public_sig_key)
+{
+    return jenkins_one_at_a_time_hash(public_sig_key, SIG_PUBLIC_KEY);
+}
+
 /* Returns the jenkins hash of a 32 byte chat_id. */
 static uint32_t get_chat_id_hash(const uint8_t *chat_id)
 {
     return jenkins_one_at_a_time_hash(chat_id, CHAT_ID_SIZE);
 }
 
+/* Opens the message log of chat if we keep them. A log that fails to open isn't kept. */
+static void init_gc_history(const GC_Session *c, GC_Chat *chat)
+{
+    if (c->history_dir == NULL || chat->history != NULL)
+        return;
+
+    char path[strlen(c->history_dir) + CHAT_ID_SIZE * 2 + 8];
+    snprintf(path, sizeof(path), "%s/%s.log", c->history_dir, id_toa(CHAT_ID(chat->chat_public_key)));
+    chat->history = gc_history_open(path, c->history_size);
+
+    if (chat->history == NULL)
+        fprintf(stderr, "gc_history_open failed for %s\n", path);
+}
+
+/* Sets chat_id_hash from the chat_id in chat's public key, adds chat to the chat index and
+ * opens its message log.
+ *
+ * Return 0 on success.
+ * Return -1 on failure.
+ */
+static int set_chat_id_hash(GC_Session *c, GC_Chat *chat)
+{
+    chat->chat_id_hash = get_chat_id_hash(CHAT_ID(chat->chat_public_key));
+    init_gc_history(c, chat);
+    return hash_index_add(&c->chat_index, chat->chat_id_hash, chat->groupnumber);
+}
+
+static bool enc_pk_index_match(const void *object, uint32_t value, const void *key)
+{
+    const GC_Connection *gconn = gcc_get_connection(object, value);
+    return gconn && memcmp(gconn->addr.public_key, key, ENC_PUBLIC_KEY) == 0;
+}
+
+static bool sig_pk_index_match(const void *object, uint32_t value, const void *key)
+{
+    const GC_Connection *gconn = gcc_get_connection(object, value);
+    return gconn && memcmp(SIG_PK(gconn->addr.public_key), key, SIG_PUBLIC_KEY) == 0;
+}
+
 /* Check if peer with the public encryption key is in peer list.
  *
  * return peernumber if peer is in chat.
@@ -134,14 +224,14 @@ static uint32_t get_chat_id_hash(const uint8_t *chat_id)
  */
 static int get_peernum_of_enc_pk(const GC_Chat *chat, const uint8_t *public_enc_key)
 {
-    uint32_t i;
+    uint32_t handle = hash_index_find(&chat->enc_pk_index, get_peer_key_hash(public_enc_key), &enc_pk_index_match,
+                                      chat, public_enc_key);
+    const GC_Connection *gconn = gcc_get_connection(chat, handle);
 
-    for (i = 0; i < chat->numpeers; ++i) {
-        if (memcmp(chat->gcc[i].addr.public_key, public_enc_key, ENC_PUBLIC_KEY) == 0)
-            return i;
-    }
+    if (gconn == NULL)
+        return -1;
 
-    return -1;
+    return gconn->peernumber;
 }
 
 /* Check if peer with the public signature key is in peer list.
@@ -151,14 +241,35 @@ static int get_peernum_of_enc_pk(const GC_Chat *chat, const uint8_t *public_enc_
  */
 static int get_peernum_of_sig_pk(const GC_Chat *chat, const uint8_t *public_sig_key)
 {
-    uint32_t i;
+    uint32_t handle = hash_index_find(&chat->sig_pk_index, get_peer_sig_key_hash(public_sig_key), &sig_pk_index_match,
+                                      chat, public_sig_key);
+    const GC_Connection *gconn = gcc_get_connection(chat, handle);
 
-    for (i = 0; i < chat->numpeers; ++i) {
-        if (memcmp(SIG_PK(chat->gcc[i].addr.public_key), public_sig_key, SIG_PUBLIC_KEY) == 0)
-            return i;
+    if (gconn == NULL)
+        return -1;
+
+    return gconn->peernumber;
+}
+
+/* Sets gconn's public signature key and indexes the peer by it.
+ *
+ * Return 0 on success.
+ * Return -1 on failure.
+ */
+static int set_peer_sig_key(GC_Chat *chat, GC_Connection *gconn, const uint8_t *public_sig_key)
+{
+    if (gconn->has_sig_key) {
+        hash_index_remove(&chat->sig_pk_index, get_peer_sig_key_hash(SIG_PK(gconn->addr.public_key)), gconn->handle);
+        gconn->has_sig_key = false;
     }
 
-    return -1;
+    memcpy(SIG_PK(gconn->addr.public_key), public_sig_key, SIG_PUBLIC_KEY);
+
+    if (hash_index_add(&chat->sig_pk_index, get_peer_sig_key_hash(public_sig_key), gconn->handle) == -1)
+        return -1;
+
+    gconn->has_sig_key = true;
+    return 0;
 }
 
 /* Validates peernumber's group role.
@@ -173,26 +284,26 @@ static int validate_gc_peer_role(const GC_Chat *chat, uint32_t peernumber)
 
     switch (chat->group[peernumber].role) {
         case GR_FOUNDER: {
-            if (memcmp(chat->shared_state.founder_public_key, chat->gcc[peernumber].addr.public_key, ENC_PUBLIC_KEY) != 0)
+            if (memcmp(chat->shared_state.founder_public_key, chat->gcc[peernumber]->addr.public_key, ENC_PUBLIC_KEY) != 0)
                 return -1;
 
             break;
         }
         case GR_MODERATOR: {
-            if (mod_list_index_of_sig_pk(chat, SIG_PK(chat->gcc[peernumber].addr.public_key)) == -1)
+            if (mod_list_index_of_sig_pk(chat, SIG_PK(chat->gcc[peernumber]->addr.public_key)) == -1)
                 return -1;
 
             break;
         }
         case GR_USER: {
-            if (sanctions_list_is_observer(chat, chat->gcc[peernumber].addr.public_key))
+            if (sanctions_list_is_observer(chat, chat->gcc[peernumber]->addr.public_key))
                 return -1;
 
             break;
         }
         case GR_OBSERVER: {
             /* Don't validate self as this is called when we don't have the sanctions list yet */
-            if (!sanctions_list_is_observer(chat, chat->gcc[peernumber].addr.public_key) && peernumber != 0)
+            if (!sanctions_list_is_observer(chat, chat->gcc[peernumber]->addr.public_key) && peernumber != 0)
                 return -1;
 
             break;
@@ -211,16 +322,51 @@ static bool peernumber_valid(const GC_Chat *chat, int peernumber)
     return peernumber >= 0 && peernumber < chat->numpeers;
 }
 
+/* Returns true if we exchange packets with peernumber directly and it's a confirmed member of the group */
+static bool peer_is_connected(const GC_Chat *chat, uint32_t peernumber)
+{
+    const GC_Connection *gconn = chat->gcc[peernumber];
+    return gconn->confirmed && gconn->handshaked && !gconn->relayed;
+}
+
+/* Returns the number of peers we are connected to or connecting to directly, not counting ourself */
+static uint32_t get_gc_neighbour_count(const GC_Chat *chat)
+{
+    uint32_t i, count = 0;
+
+    for (i = 1; i < chat->numpeers; ++i) {
+        if (!chat->gcc[i]->relayed)
+            ++count;
+    }
+
+    return count;
+}
+
+/* Returns true if the group is an overlay and we have all the neighbours we look for */
+static bool gc_overlay_full(const GC_Chat *chat)
+{
+    return chat->shared_state.topology == GT_OVERLAY && get_gc_neighbour_count(chat) >= GC_OVERLAY_NEIGHBOURS;
+}
+
+/* Returns true if we can share peernumber's address with others. Relayed peers only
+ * have one if they told us theirs in their announcement.
+ */
+static bool peer_addr_known(const GC_Chat *chat, uint32_t peernumber)
+{
+    const GC_Connection *gconn = chat->gcc[peernumber];
+    return gconn->confirmed && (!gconn->relayed || ipport_isset(&gconn->addr.ip_port));
+}
+
 /* Returns true if sender_pk_hash is equal to peernumber's public key hash */
 static bool peer_pk_hash_match(GC_Chat *chat, uint32_t peernumber, uint32_t sender_pk_hash)
 {
-    return sender_pk_hash == chat->gcc[peernumber].public_key_hash;
+    return sender_pk_hash == chat->gcc[peernumber]->public_key_hash;
 }
 
 static void self_gc_connected(GC_Chat *chat)
 {
     chat->connection_state = CS_CONNECTED;
-    chat->gcc[0].time_added = unix_time();
+    chat->gcc[0]->time_added = unix_time(chat->net->mono_time);
 }
 
 /* Sets the password for the group (locally only).
@@ -291,6 +437,19 @@ static void copy_gc_peer_addr(GC_PeerAddress *dest, const GC_PeerAddress *src)
     memcpy(dest, src, sizeof(GC_PeerAddress));
 }
 
+/* Puts the num addresses in addrs in random order */
+static void shuffle_gc_addrs(GC_PeerAddress *addrs, uint32_t num)
+{
+    uint32_t i;
+
+    for (i = num; i > 1; --i) {
+        uint32_t j = random_int() % i;
+        GC_PeerAddress tmp = addrs[i - 1];
+        addrs[i - 1] = addrs[j];
+        addrs[j] = tmp;
+    }
+}
+
 /* Copies up to max_addrs peer addresses from chat to addrs.
  *
  * Returns number of addresses copied.
@@ -301,8 +460,8 @@ uint16_t gc_copy_peer_addrs(const GC_Chat *chat, GC_PeerAddress *addrs, size_t m
     uint16_t num = 0;
 
     for (i = 1; i < chat->numpeers && i < max_addrs; ++i) {
-        if (chat->gcc[i].confirmed)
-            addrs[num++] = chat->gcc[i].addr;
+        if (peer_addr_known(chat, i))
+            addrs[num++] = chat->gcc[i]->addr;
     }
 
     return num;
@@ -369,7 +528,7 @@ static uint32_t get_gc_confirmed_numpeers(const GC_Chat *chat)
     uint32_t i, count = 0;
 
     for (i = 0; i < chat->numpeers; ++i) {
-        if (chat->gcc[i].confirmed)
+        if (chat->gcc[i]->confirmed)
             ++count;
     }
 
@@ -568,6 +727,8 @@ static uint16_t pack_gc_shared_state(uint8_t *data, uint16_t length, const GC_Sh
     packed_len += MAX_GC_GROUP_NAME_SIZE;
     memcpy(data + packed_len, &shared_state->privacy_state, sizeof(uint8_t));
     packed_len += sizeof(uint8_t);
+    memcpy(data + packed_len, &shared_state->topology, sizeof(uint8_t));
+    packed_len += sizeof(uint8_t);
     U16_to_bytes(data + packed_len, shared_state->passwd_len);
     packed_len += sizeof(uint16_t);
     memcpy(data + packed_len, shared_state->passwd, MAX_GC_PASSWD_SIZE);
@@ -602,6 +763,8 @@ static uint16_t unpack_gc_shared_state(GC_SharedState *shared_state, const uint8
     len_processed += MAX_GC_GROUP_NAME_SIZE;
     memcpy(&shared_state->privacy_state, data + len_processed, sizeof(uint8_t));
     len_processed += sizeof(uint8_t);
+    memcpy(&shared_state->topology, data + len_processed, sizeof(uint8_t));
+    len_processed += sizeof(uint8_t);
     bytes_to_U16(&shared_state->passwd_len, data + len_processed);
     len_processed += sizeof(uint16_t);
     memcpy(shared_state->passwd, data + len_processed, MAX_GC_PASSWD_SIZE);
@@ -674,7 +837,7 @@ static int sign_gc_shared_state(GC_Chat *chat)
  * Returns length of the plaintext data on success.
  * Returns -1 on failure.
  */
-static int unwrap_group_packet(const uint8_t *shared_key, uint8_t *data, uint64_t *message_id,
+static int unwrap_group_packet(const uint8_t *shared_key, uint8_t *data, uint64_t *message_id, uint64_t *ack_id,
                                uint8_t *packet_type, const uint8_t *packet, uint16_t length)
 {
     uint8_t plain[MAX_GC_PACKET_SIZE];
@@ -690,7 +853,7 @@ static int unwrap_group_packet(const uint8_t *shared_key, uint8_t *data, uint64_
         return -1;
     }
 
-    int min_plain_len = message_id != NULL ? 1 + MESSAGE_ID_BYTES : 1;
+    int min_plain_len = message_id != NULL ? 1 + (MESSAGE_ID_BYTES * 2) : 1;
 
     /* remove padding */
     uint8_t *real_plain = plain;
@@ -708,8 +871,9 @@ static int unwrap_group_packet(const uint8_t *shared_key, uint8_t *data, uint64_
 
     if (message_id != NULL) {
         bytes_to_U64(message_id, real_plain + sizeof(uint8_t));
-        plain_len -= MESSAGE_ID_BYTES;
-        header_len += MESSAGE_ID_BYTES;
+        bytes_to_U64(ack_id, real_plain + sizeof(uint8_t) + MESSAGE_ID_BYTES);
+        plain_len -= MESSAGE_ID_BYTES * 2;
+        header_len += MESSAGE_ID_BYTES * 2;
     }
 
     memcpy(data, real_plain + header_len, plain_len);
@@ -719,7 +883,7 @@ static int unwrap_group_packet(const uint8_t *shared_key, uint8_t *data, uint64_
 
 /* Encrypts data of length using the peer's shared key and a new nonce.
  *
- * Adds encrypted header consisting of: packet type, message_id (only for lossless packets)
+ * Adds encrypted header consisting of: packet type, message_id and ack_id (only for lossless packets)
  * Adds plaintext header consisting of: packet identifier, chat_id_hash, self public encryption key, nonce.
  *
  * Returns length of encrypted packet on success.
@@ -727,7 +891,7 @@ static int unwrap_group_packet(const uint8_t *shared_key, uint8_t *data, uint64_
  */
 static int wrap_group_packet(const uint8_t *self_pk, const uint8_t *shared_key, uint8_t *packet,
                              uint32_t packet_size, const uint8_t *data, uint32_t length, uint64_t message_id,
-                             uint8_t packet_type, uint32_t chat_id_hash, uint8_t packet_id)
+                             uint64_t ack_id, uint8_t packet_type, uint32_t chat_id_hash, uint8_t packet_id)
 {
     uint16_t padding_len = GC_PACKET_PADDING_LENGTH(length);
 
@@ -743,7 +907,8 @@ static int wrap_group_packet(const uint8_t *self_pk, const uint8_t *shared_key,
 
     if (packet_id == NET_PACKET_GC_LOSSLESS) {
         U64_to_bytes(plain + padding_len + sizeof(uint8_t), message_id);
-        enc_header_len += MESSAGE_ID_BYTES;
+        U64_to_bytes(plain + padding_len + sizeof(uint8_t) + MESSAGE_ID_BYTES, ack_id);
+        enc_header_len += MESSAGE_ID_BYTES * 2;
     }
 
     memcpy(plain + padding_len + enc_header_len, data, length);
@@ -781,7 +946,7 @@ static int send_lossy_group_packet(const GC_Chat *chat, uint32_t peernumber, con
     if (peernumber == 0)
         return -1;
 
-    GC_Connection *gconn = &chat->gcc[peernumber];
+    GC_Connection *gconn = chat->gcc[peernumber];
 
     if (!gconn->handshaked)
         return -1;
@@ -791,7 +956,7 @@ static int send_lossy_group_packet(const GC_Chat *chat, uint32_t peernumber, con
 
     uint8_t packet[MAX_GC_PACKET_SIZE];
     int len = wrap_group_packet(chat->self_public_key, gconn->shared_key, packet, sizeof(packet),
-                                data, length, 0, packet_type, chat->chat_id_hash, NET_PACKET_GC_LOSSY);
+                                data, length, 0, 0, packet_type, chat->chat_id_hash, NET_PACKET_GC_LOSSY);
     if (len == -1) {
         fprintf(stderr, "wrap_group_packet failed (type: %u, len: %d)\n", packet_type, len);
         return -1;
@@ -814,7 +979,7 @@ static int send_lossless_group_packet(GC_Chat *chat, uint32_t peernumber, const
     if (peernumber == 0)
         return -1;
 
-    GC_Connection *gconn = &chat->gcc[peernumber];
+    GC_Connection *gconn = chat->gcc[peernumber];
 
     if (!gconn->handshaked)
         return -1;
@@ -823,9 +988,10 @@ static int send_lossless_group_packet(GC_Chat *chat, uint32_t peernumber, const
         return -1;
 
     uint64_t message_id = gconn->send_message_id;
+    uint64_t ack_id = gconn->recv_message_id;
     uint8_t packet[MAX_GC_PACKET_SIZE];
     int len = wrap_group_packet(chat->self_public_key, gconn->shared_key, packet, sizeof(packet), data, length,
-                                message_id, packet_type, chat->chat_id_hash, NET_PACKET_GC_LOSSLESS);
+                                message_id, ack_id, packet_type, chat->chat_id_hash, NET_PACKET_GC_LOSSLESS);
     if (len == -1) {
         fprintf(stderr, "wrap_group_packet failed (type: %u, len: %d)\n", packet_type, len);
         return -1;
@@ -837,6 +1003,8 @@ static int send_lossless_group_packet(GC_Chat *chat, uint32_t peernumber, const
     if (gcc_send_group_packet(chat, gconn, packet, len, packet_type) == -1)
         return -1;
 
+    gcc_ack_sent(gconn, ack_id);
+
     return 0;
 }
 
@@ -845,10 +1013,10 @@ static int send_lossless_group_packet(GC_Chat *chat, uint32_t peernumber, const
  */
 static int send_gc_sync_request(GC_Chat *chat, uint32_t peernumber, uint32_t num_peers)
 {
-    if (chat->gcc[peernumber].pending_sync_request)
+    if (chat->gcc[peernumber]->pending_sync_request)
         return -1;
 
-    chat->gcc[peernumber].pending_sync_request = true;
+    chat->gcc[peernumber]->pending_sync_request = true;
 
     uint32_t length = HASH_ID_BYTES + sizeof(uint32_t) + MAX_GC_PASSWD_SIZE;
     uint8_t data[length];
@@ -880,10 +1048,10 @@ static int handle_gc_sync_response(Messenger *m, int groupnumber, uint32_t peern
     if (chat == NULL)
         return -1;
 
-    if (!chat->gcc[peernumber].pending_sync_request)
+    if (!chat->gcc[peernumber]->pending_sync_request)
         return 0;
 
-    chat->gcc[peernumber].pending_sync_request = false;
+    chat->gcc[peernumber]->pending_sync_request = false;
 
     uint32_t unpacked_len = 0;
 
@@ -922,21 +1090,25 @@ static int handle_gc_sync_response(Messenger *m, int groupnumber, uint32_t peern
         return -1;
     }
 
-    unix_time_update();
+    unix_time_update(chat->net->mono_time);
 
     unpacked_len += addrs_len;
 
     uint32_t i;
 
-    for (i = 0; i < num_peers; i++) {
+    if (chat->shared_state.topology == GT_OVERLAY)
+        shuffle_gc_addrs(addrs, num_peers);
+
+    for (i = 0; i < num_peers && !gc_overlay_full(chat); i++) {
         if (get_peernum_of_enc_pk(chat, addrs[i].public_key) == -1)
             send_gc_handshake_request(m, groupnumber, addrs[i].ip_port, addrs[i].public_key,
                                       HS_PEER_INFO_EXCHANGE, chat->join_type);
     }
 
     for (i = 0; i < chat->numpeers; ++i) {
-        chat->gcc[i].pending_sync_request = false;
-        chat->gcc[i].pending_state_sync = false;
+        chat->gcc[i]->pending_sync_request = false;
+        chat->gcc[i]->pending_state_sync = false;
+        chat->gcc[i]->pending_delta_sync = false;
     }
 
     free(addrs);
@@ -950,6 +1122,7 @@ static int handle_gc_sync_response(Messenger *m, int groupnumber, uint32_t peern
     self_gc_connected(chat);
     send_gc_peer_exchange(c, chat, peernumber);
     group_announce_request(c, chat);
+    start_gc_history_sync(chat, peernumber);
 
     if (chat->num_addrs > 0)
         sync_gc_announced_nodes(c, chat);
@@ -993,6 +1166,10 @@ static int handle_gc_sync_request(const Messenger *m, int groupnumber, uint32_t
     if (req_num_peers > 0 && req_num_peers >= get_gc_confirmed_numpeers(chat))
         return 0;
 
+    /* The peers of an overlay group a joining peer won't connect to are known from their announcements */
+    if (req_num_peers == 0 && chat->shared_state.topology == GT_OVERLAY)
+        chat->gcc[peernumber]->pending_announcements = true;
+
     if (chat->shared_state.passwd_len > 0) {
         uint8_t passwd[MAX_GC_PASSWD_SIZE];
         memcpy(passwd, data + sizeof(uint32_t), MAX_GC_PASSWD_SIZE);
@@ -1020,18 +1197,27 @@ static int handle_gc_sync_request(const Messenger *m, int groupnumber, uint32_t
     memcpy(response + len, chat->topic, chat->topic_len);
     len += chat->topic_len;
 
-    size_t packed_addrs_size = (ENC_PUBLIC_KEY + sizeof(IP_Port)) * (chat->numpeers - 1);   /* approx. */
+    uint32_t max_addrs = chat->numpeers - 1;
+    uint32_t start = 0;
+
+    /* Joining peers of overlay groups only pick their neighbours from a few random peers */
+    if (chat->shared_state.topology == GT_OVERLAY && max_addrs > GC_OVERLAY_SYNC_ADDRS) {
+        max_addrs = GC_OVERLAY_SYNC_ADDRS;
+        start = random_int() % (chat->numpeers - 1);
+    }
+
+    size_t packed_addrs_size = (ENC_PUBLIC_KEY + sizeof(IP_Port)) * max_addrs;   /* approx. */
 
     /* This is the technical limit to the number of peers you can have in a group (TODO: split packet?) */
     if ((HASH_ID_BYTES + packed_addrs_size + sizeof(uint16_t) + chat->topic_len) > MAX_GC_PACKET_SIZE)
         return -1;
 
-    GC_PeerAddress *peer_addrs = calloc(1, sizeof(GC_PeerAddress) * (chat->numpeers - 1));
+    GC_PeerAddress *peer_addrs = calloc(1, sizeof(GC_PeerAddress) * max_addrs);
 
     if (peer_addrs == NULL)
         return -1;
 
-    uint32_t i, num = 0;
+    uint32_t i, j, num = 0;
 
     /* must add self separately because reasons */
     GC_PeerAddress self_addr;
@@ -1039,9 +1225,11 @@ static int handle_gc_sync_request(const Messenger *m, int groupnumber, uint32_t
     ipport_self_copy(m->dht, &self_addr.ip_port);
     copy_gc_peer_addr(&peer_addrs[num++], &self_addr);
 
-    for (i = 1; i < chat->numpeers; ++i) {
-        if (chat->gcc[i].public_key_hash != chat->gcc[peernumber].public_key_hash && chat->gcc[i].confirmed)
-            copy_gc_peer_addr(&peer_addrs[num++], &chat->gcc[i].addr);
+    for (j = 0; j < chat->numpeers - 1 && num < max_addrs; ++j) {
+        i = 1 + (start + j) % (chat->numpeers - 1);
+
+        if (chat->gcc[i]->public_key_hash != chat->gcc[peernumber]->public_key_hash && peer_addr_known(chat, i))
+            copy_gc_peer_addr(&peer_addrs[num++], &chat->gcc[i]->addr);
     }
 
     U32_to_bytes(response + len, num);
@@ -1060,91 +1248,120 @@ static int handle_gc_sync_request(const Messenger *m, int groupnumber, uint32_t
     return send_gc_sync_response(chat, peernumber, response, len);
 }
 
-static void self_to_peer(const GC_Session *c, const GC_Chat *chat, GC_GroupPeer *peer);
-static int send_gc_peer_info_request(GC_Chat *chat, uint32_t peernumber);
-
-/* Compares our peerlist with our announced nodes and attempts to do a handshake
- * with any nodes that are not in our peerlist.
+/* Sends a sync request to peernumber describing the group state we have so that only what we
+ * are missing is sent back: our shared state and sanctions credentials versions, the hash of our
+ * mod list, the ids of our sanctions and, if need_peers is true, the public key hashes of the
+ * peers we know about. Peers of overlay groups aren't synced this way.
  *
  * Returns 0 on success.
- * Returns -1 on faillure.
+ * Returns -1 on failure.
  */
-static int sync_gc_announced_nodes(const GC_Session *c, GC_Chat *chat)
+static int send_gc_sync_delta_request(GC_Chat *chat, uint32_t peernumber, bool need_peers)
 {
-    GC_GroupPeer self;
-    self_to_peer(c, chat, &self);
-
     uint8_t data[MAX_GC_PACKET_SIZE];
+    uint32_t length = 0;
+
     U32_to_bytes(data, chat->self_public_key_hash);
-    uint32_t len = HASH_ID_BYTES;
+    length += HASH_ID_BYTES;
+    U32_to_bytes(data + length, chat->shared_state.version);
+    length += sizeof(uint32_t);
+    U32_to_bytes(data + length, chat->moderation.sanctions_creds.version);
+    length += sizeof(uint32_t);
+    mod_list_make_hash(chat, data + length);
+    length += GC_MODERATION_HASH_SIZE;
+    memcpy(data + length, chat->shared_state.passwd, MAX_GC_PASSWD_SIZE);
+    length += MAX_GC_PASSWD_SIZE;
 
-    int peers_len = pack_gc_peer(data + len, sizeof(data) - len, &self);
-    len += peers_len;
+    int ids_len = sanctions_list_pack_ids(chat, data + length, sizeof(data) - length);
 
-    if (peers_len <= 0) {
-        fprintf(stderr, "pack_gc_peer failed in sync_gc_announced_nodes %d\n", peers_len);
+    if (ids_len == -1)
         return -1;
-    }
 
-    uint16_t i;
+    length += ids_len;
 
-    for (i = 0; i < chat->num_addrs; ++i) {
-        if (get_peernum_of_enc_pk(chat, chat->addr_list[i].public_key) == -1)
-            send_gc_handshake_request(c->messenger, chat->groupnumber, chat->addr_list[i].ip_port,
-                                      chat->addr_list[i].public_key, HS_PEER_INFO_EXCHANGE, HJ_PUBLIC);
+    uint32_t i, num_peers = need_peers ? chat->numpeers - 1 : 0;
+
+    if (length + sizeof(uint32_t) + num_peers * HASH_ID_BYTES > sizeof(data))
+        return -1;
+
+    U32_to_bytes(data + length, num_peers);
+    length += sizeof(uint32_t);
+
+    for (i = 0; i < num_peers; ++i) {
+        U32_to_bytes(data + length, chat->gcc[i + 1]->public_key_hash);
+        length += HASH_ID_BYTES;
     }
 
-    return 0;
+    return send_lossless_group_packet(chat, peernumber, data, length, GP_SYNC_DELTA_REQUEST);
 }
 
-/* Shares our TCP relays with peernumber and adds shared relays to our connection with them.
+static int cmp_gc_key_hash(const void *a, const void *b)
+{
+    uint32_t hash_a = *(const uint32_t *)a;
+    uint32_t hash_b = *(const uint32_t *)b;
+
+    return hash_a < hash_b ? -1 : hash_a > hash_b;
+}
+
+/* Packs into data the addresses of our peers whose public key hash isn't one of the num_known
+ * sorted known_hashes, leaving out peernumber. Addresses that don't fit are left for the next sync.
  *
- * Returns 0 on success.
+ * Returns the number of packed addresses on success and puts their length in addrs_len.
  * Returns -1 on failure.
  */
-static int send_gc_tcp_relays(GC_Chat *chat, uint32_t peernumber)
+static int pack_gc_unknown_addresses(const GC_Chat *chat, uint32_t peernumber, const uint32_t *known_hashes,
+                                     uint32_t num_known, uint8_t *data, uint32_t length, uint32_t *addrs_len)
 {
-    Node_format tcp_relays[GCC_MAX_TCP_SHARED_RELAYS];
-    unsigned int i, num = tcp_copy_connected_relays(chat->tcp_conn, tcp_relays, GCC_MAX_TCP_SHARED_RELAYS);
+    uint32_t max_addrs = MIN(chat->numpeers, length / (ENC_PUBLIC_KEY + sizeof(IP_Port)));
+    GC_PeerAddress *addrs = calloc(1, sizeof(GC_PeerAddress) * (max_addrs + 1));
 
-    if (num == 0)
-        return 0;
+    if (addrs == NULL)
+        return -1;
 
-    uint8_t data[HASH_ID_BYTES + sizeof(tcp_relays)];
-    U32_to_bytes(data, chat->self_public_key_hash);
-    uint32_t length = HASH_ID_BYTES;
+    uint32_t i, num = 0;
 
-    for (i = 0; i < num; ++i)
-        add_tcp_relay_connection(chat->tcp_conn, chat->gcc[peernumber].tcp_connection_num, tcp_relays[i].ip_port,
-                                 tcp_relays[i].public_key);
+    for (i = 1; i < chat->numpeers && num < max_addrs; ++i) {
+        if (i == peernumber || !peer_addr_known(chat, i))
+            continue;
 
-    int nodes_len = pack_nodes(data + length, sizeof(data) - length, tcp_relays, num);
+        if (bsearch(&chat->gcc[i]->public_key_hash, known_hashes, num_known, sizeof(uint32_t), cmp_gc_key_hash))
+            continue;
 
-    if (nodes_len <= 0)
-        return -1;
+        copy_gc_peer_addr(&addrs[num++], &chat->gcc[i]->addr);
+    }
 
-    length += nodes_len;
+    int len = 0;
 
-    if (send_lossy_group_packet(chat, peernumber, data, length, GP_TCP_RELAYS) == -1)
+    if (num > 0)
+        len = pack_gc_addresses(data, length, addrs, num);
+
+    free(addrs);
+
+    if (len < 0)
         return -1;
 
-    chat->gcc[peernumber].last_tcp_relays_shared = unix_time();
-    return 0;
+    *addrs_len = len;
+    return num;
 }
 
-/* Adds peernumber's shared TCP relays to our connection with them.
+/* Handles a delta sync request. The shared state and mod list are sent in their own packets if
+ * the peer's are out of date. The response holds the sanctions list delta and, if the request
+ * holds the peers the requester knows about, the addresses of the others. It isn't sent if both
+ * are empty. The full sanctions list is sent instead of the delta if the requester has none of
+ * our entries.
  *
- * Returns 0 on success.
+ * Returns non-negative value on success.
  * Returns -1 on failure.
  */
-static int handle_gc_tcp_relays(Messenger *m, int groupnumber, uint32_t peernumber, const uint8_t *data,
-                                uint32_t length)
+static int handle_gc_sync_delta_request(const Messenger *m, int groupnumber, uint32_t peernumber,
+                                        const uint8_t *data, uint32_t length)
 {
-    if (length == 0)
+    uint32_t header_len = sizeof(uint32_t) * 2 + GC_MODERATION_HASH_SIZE + MAX_GC_PASSWD_SIZE;
+
+    if (length < header_len || length > MAX_GC_PACKET_SIZE)
         return -1;
 
-    GC_Session *c = m->group_handler;
-    GC_Chat *chat = gc_get_group(c, groupnumber);
+    GC_Chat *chat = gc_get_group(m->group_handler, groupnumber);
 
     if (chat == NULL)
         return -1;
@@ -1152,90 +1369,640 @@ static int handle_gc_tcp_relays(Messenger *m, int groupnumber, uint32_t peernumb
     if (chat->connection_state != CS_CONNECTED)
         return -1;
 
-    if (!chat->gcc[peernumber].confirmed)
+    uint32_t sstate_version, screds_version;
+    bytes_to_U32(&sstate_version, data);
+    bytes_to_U32(&screds_version, data + sizeof(uint32_t));
+
+    const uint8_t *mod_list_hash = data + sizeof(uint32_t) * 2;
+    const uint8_t *passwd = mod_list_hash + GC_MODERATION_HASH_SIZE;
+
+    if (chat->shared_state.passwd_len > 0
+            && memcmp(chat->shared_state.passwd, passwd, chat->shared_state.passwd_len) != 0)
         return -1;
 
-    Node_format tcp_relays[GCC_MAX_TCP_SHARED_RELAYS];
-    int num_nodes = unpack_nodes(tcp_relays, GCC_MAX_TCP_SHARED_RELAYS, NULL, data, length, 1);
+    uint32_t sanction_ids[MAX_GC_SANCTIONS];
+    uint16_t num_ids;
+    int ids_len = sanctions_list_unpack_ids(sanction_ids, MAX_GC_SANCTIONS, &num_ids, data + header_len,
+                                            length - header_len);
 
-    if (num_nodes <= 0)
+    if (ids_len == -1 || length - header_len - ids_len < sizeof(uint32_t))
         return -1;
 
-    int i;
+    uint32_t num_peers, peers_pos = header_len + ids_len + sizeof(uint32_t);
+    bytes_to_U32(&num_peers, data + header_len + ids_len);
 
-    for (i = 0; i < num_nodes; ++i)
-        add_tcp_relay_connection(chat->tcp_conn, chat->gcc[peernumber].tcp_connection_num, tcp_relays[i].ip_port,
-                                 tcp_relays[i].public_key);
+    if (num_peers > MAX_GC_NUM_PEERS || length - peers_pos != num_peers * HASH_ID_BYTES)
+        return -1;
 
-    return 0;
-}
+    if (sstate_version < chat->shared_state.version && send_peer_shared_state(chat, peernumber) == -1)
+        return -1;
 
-/* Send invite request to peernumber. Invite packet contains your nick and the group password.
- * If no group password is necessary the password field will be ignored by the invitee.
- *
- * Return -1 if fail
- * Return 0 if success
- */
-static int send_gc_invite_request(GC_Chat *chat, uint32_t peernumber)
-{
-    uint8_t data[MAX_GC_PACKET_SIZE];
-    U32_to_bytes(data, chat->self_public_key_hash);
-    uint32_t length = HASH_ID_BYTES;
-    U16_to_bytes(data + length, chat->group[0].nick_len);
-    length += sizeof(uint16_t);
-    memcpy(data + length, chat->group[0].nick, chat->group[0].nick_len);
-    length += chat->group[0].nick_len;
-    memcpy(data + length, chat->shared_state.passwd, MAX_GC_PASSWD_SIZE);
-    length += MAX_GC_PASSWD_SIZE;
+    /* A mod list that doesn't match the peer's newer shared state would be rejected */
+    if (sstate_version <= chat->shared_state.version) {
+        uint8_t our_mod_list_hash[GC_MODERATION_HASH_SIZE];
+        mod_list_make_hash(chat, our_mod_list_hash);
 
-    return send_lossless_group_packet(chat, peernumber, data, length, GP_INVITE_REQUEST);
-}
+        if (memcmp(our_mod_list_hash, mod_list_hash, GC_MODERATION_HASH_SIZE) != 0
+                && send_peer_mod_list(chat, peernumber) == -1)
+            return -1;
+    }
 
-/* Return -1 if fail
- * Return 0 if succes
- */
-static int send_gc_invite_response(GC_Chat *chat, uint32_t peernumber)
-{
-    uint32_t length = HASH_ID_BYTES;
-    uint8_t  data[length];
-    U32_to_bytes(data, chat->self_public_key_hash);
+    uint8_t response[MAX_GC_PACKET_SIZE];
+    U32_to_bytes(response, chat->self_public_key_hash);
+    uint32_t len = HASH_ID_BYTES;
 
-    return send_lossless_group_packet(chat, peernumber, data, length, GP_INVITE_RESPONSE);
-}
+    /* Response packet contains: sanctions delta length, sanctions delta, number of addresses, addresses */
+    uint16_t delta_len = 0;
 
-/* Return -1 if fail
- * Return 0 if success
- */
-static int handle_gc_invite_response(Messenger *m, int groupnumber, uint32_t peernumber, const uint8_t *data,
-                                     uint32_t length)
-{
-    GC_Session *c = m->group_handler;
-    GC_Chat *chat = gc_get_group(c, groupnumber);
+    if (screds_version < chat->moderation.sanctions_creds.version) {
+        uint16_t num_new;
+        int packed_len = sanctions_list_pack_delta(chat, sanction_ids, num_ids, response + len + sizeof(uint16_t),
+                                                   sizeof(response) - len - sizeof(uint16_t) - sizeof(uint32_t),
+                                                   &num_new);
 
-    if (chat == NULL)
-        return -1;
+        if (packed_len == -1 || num_new == chat->moderation.num_sanctions) {
+            if (send_peer_sanctions_list(chat, peernumber) == -1)
+                return -1;
+        } else {
+            delta_len = packed_len;
+        }
+    }
 
-    if (chat->connection_state == CS_CONNECTED)
-        return 0;
+    U16_to_bytes(response + len, delta_len);
+    len += sizeof(uint16_t) + delta_len;
 
-    return send_gc_sync_request(chat, peernumber, 0);
-}
+    int num_addrs = 0;
+    uint32_t addrs_len = 0;
 
-static int handle_gc_invite_response_reject(Messenger *m, int groupnumber, const uint8_t *data, uint32_t length)
-{
-    if (length != sizeof(uint8_t))
-        return -1;
+    if (num_peers > 0 && chat->shared_state.topology != GT_OVERLAY) {
+        uint32_t *known_hashes = malloc(sizeof(uint32_t) * (num_peers + 1));
 
-    GC_Session *c = m->group_handler;
-    GC_Chat *chat = gc_get_group(c, groupnumber);
+        if (known_hashes == NULL)
+            return -1;
 
-    if (chat == NULL)
-        return -1;
+        uint32_t i;
 
-    if (chat->connection_state == CS_CONNECTED)
-        return 0;
+        for (i = 0; i < num_peers; ++i)
+            bytes_to_U32(&known_hashes[i], data + peers_pos + i * HASH_ID_BYTES);
 
-    uint8_t type = data[0];
+        qsort(known_hashes, num_peers, sizeof(uint32_t), cmp_gc_key_hash);
+
+        num_addrs = pack_gc_unknown_addresses(chat, peernumber, known_hashes, num_peers,
+                                              response + len + sizeof(uint32_t),
+                                              sizeof(response) - len - sizeof(uint32_t), &addrs_len);
+        free(known_hashes);
+
+        if (num_addrs == -1)
+            return -1;
+    }
+
+    if (delta_len == 0 && num_addrs == 0)
+        return 0;
+
+    U32_to_bytes(response + len, num_addrs);
+    len += sizeof(uint32_t) + addrs_len;
+
+    return send_lossless_group_packet(chat, peernumber, response, len, GP_SYNC_DELTA_RESPONSE);
+}
+
+/* Handles a delta sync response. If the sanctions list can't be rebuilt from the delta,
+ * which happens if two entries have the same id, we ask peernumber for a full sync.
+ *
+ * Returns non-negative value on success.
+ * Returns -1 on failure.
+ */
+static int handle_gc_sync_delta_response(Messenger *m, int groupnumber, uint32_t peernumber, const uint8_t *data,
+                                         uint32_t length)
+{
+    if (length < sizeof(uint16_t) + sizeof(uint32_t))
+        return -1;
+
+    GC_Session *c = m->group_handler;
+    GC_Chat *chat = gc_get_group(c, groupnumber);
+
+    if (chat == NULL)
+        return -1;
+
+    chat->gcc[peernumber]->pending_delta_sync = false;
+
+    uint16_t delta_len;
+    bytes_to_U16(&delta_len, data);
+
+    if (length - sizeof(uint16_t) - sizeof(uint32_t) < delta_len)
+        return -1;
+
+    bool full_sync = false;
+
+    if (delta_len > 0) {
+        if (sanctions_list_apply_delta(chat, data + sizeof(uint16_t), delta_len,
+                                       get_gc_crypto_pipeline(m)) != delta_len) {
+            fprintf(stderr, "sanctions_list_apply_delta failed in handle_gc_sync_delta_response\n");
+            full_sync = true;
+        } else if (chat->group[0].role == GR_OBSERVER) {
+            if (!sanctions_list_is_observer(chat, chat->self_public_key))
+                chat->group[0].role = GR_USER;
+        }
+    }
+
+    uint32_t unpacked_len = sizeof(uint16_t) + delta_len;
+    uint32_t num_addrs;
+    bytes_to_U32(&num_addrs, data + unpacked_len);
+    unpacked_len += sizeof(uint32_t);
+
+    if (num_addrs > MAX_GC_NUM_PEERS)
+        return -1;
+
+    if (num_addrs > 0) {
+        GC_PeerAddress *addrs = calloc(1, sizeof(GC_PeerAddress) * num_addrs);
+
+        if (addrs == NULL)
+            return -1;
+
+        uint16_t addrs_len = 0;
+        int unpacked_addrs = unpack_gc_addresses(addrs, num_addrs, &addrs_len, data + unpacked_len,
+                                                 length - unpacked_len, 1);
+
+        if (unpacked_addrs != num_addrs || addrs_len == 0) {
+            free(addrs);
+            fprintf(stderr, "unpack_gc_addresses failed: got %d expected %d\n", unpacked_addrs, num_addrs);
+            return -1;
+        }
+
+        uint32_t i;
+
+        for (i = 0; i < num_addrs; ++i) {
+            if (get_peernum_of_enc_pk(chat, addrs[i].public_key) == -1)
+                send_gc_handshake_request(m, groupnumber, addrs[i].ip_port, addrs[i].public_key,
+                                          HS_PEER_INFO_EXCHANGE, chat->join_type);
+        }
+
+        free(addrs);
+
+        if (c->peerlist_update)
+            (*c->peerlist_update)(m, groupnumber, c->peerlist_update_userdata);
+    }
+
+    if (full_sync)
+        return send_gc_sync_request(chat, peernumber, 0);
+
+    return 0;
+}
+
+/* Size of the entries in one history response, small enough for a TCP relay to pass on. */
+#define GC_HISTORY_BATCH_SIZE 1700
+
+/* Number of history responses we send for one request. */
+#define GC_HISTORY_BATCHES_PER_REQUEST 16
+
+/* Each peer may ask for our log GC_HISTORY_MAX_REQUESTS times per GC_HISTORY_REQUEST_INTERVAL seconds,
+ * and we send at most GC_HISTORY_MAX_BATCHES history responses per interval to all peers together.
+ */
+#define GC_HISTORY_REQUEST_INTERVAL 10
+#define GC_HISTORY_MAX_REQUESTS 8
+#define GC_HISTORY_MAX_BATCHES 256
+
+/* We ask again if the peer we catch up with doesn't send anything for this many seconds. Requests
+ * over the limits above go unanswered.
+ */
+#define GC_HISTORY_SYNC_TIMEOUT (GC_HISTORY_REQUEST_INTERVAL * 2)
+#define GC_HISTORY_MAX_RETRIES 3
+
+typedef enum GROUP_HISTORY_BATCH_STATE {
+    GC_HISTORY_BATCH_MORE,   /* more batches follow */
+    GC_HISTORY_BATCH_ASK,    /* the last batch for this request, ask for more */
+    GC_HISTORY_BATCH_DONE,   /* nothing more to send */
+} GROUP_HISTORY_BATCH_STATE;
+
+#define GC_HISTORY_RESPONSE_HEADER_SIZE (sizeof(uint64_t) + sizeof(uint8_t))
+
+/* Adds the signed message in entry, which peernumber sent, to our message log with the nick of peernumber. */
+static void log_gc_message(GC_Chat *chat, uint32_t peernumber, GC_History_Entry *entry)
+{
+    if (chat->history == NULL)
+        return;
+
+    entry->nick_len = chat->group[peernumber].nick_len;
+    memcpy(entry->nick, chat->group[peernumber].nick, entry->nick_len);
+
+    if (gc_history_append(chat->history, entry) == -1)
+        fprintf(stderr, "gc_history_append failed in log_gc_message\n");
+}
+
+/* Asks peernumber for the entries of its message log from sequence number from_seq on, or
+ * if from_seq is 0 for the entries logged at since_time or later.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+static int send_gc_history_request(GC_Chat *chat, uint32_t peernumber, uint64_t since_time, uint64_t from_seq)
+{
+    uint8_t data[HASH_ID_BYTES + TIME_STAMP_SIZE + sizeof(uint64_t)];
+    U32_to_bytes(data, chat->self_public_key_hash);
+    U64_to_bytes(data + HASH_ID_BYTES, since_time);
+    U64_to_bytes(data + HASH_ID_BYTES + TIME_STAMP_SIZE, from_seq);
+
+    return send_lossless_group_packet(chat, peernumber, data, sizeof(data), GP_HISTORY_REQUEST);
+}
+
+/* Starts catching up with peernumber on the messages logged since our newest entry.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+static int start_gc_history_sync(GC_Chat *chat, uint32_t peernumber)
+{
+    if (chat->history == NULL)
+        return 0;
+
+    uint64_t last_time = gc_history_last_time(chat->history);
+
+    chat->history_peer_hash = chat->gcc[peernumber]->public_key_hash;
+    chat->history_sync_seq = gc_history_next_seq(chat->history);
+    chat->history_since = last_time > GC_HISTORY_MAX_CLOCK_SKEW ? last_time - GC_HISTORY_MAX_CLOCK_SKEW : 0;
+    chat->history_next_seq = 0;
+    chat->last_history_response = unix_time(chat->net->mono_time);
+    chat->history_retries = 0;
+
+    return send_gc_history_request(chat, peernumber, chat->history_since, 0);
+}
+
+/* Asks the peer we catch up with again if it stopped sending entries, and gives up on it after
+ * GC_HISTORY_MAX_RETRIES requests without an answer or if it left.
+ */
+static void do_gc_history_sync(GC_Chat *chat)
+{
+    if (chat->history_peer_hash == 0
+            || !is_timeout(chat->net->mono_time, chat->last_history_response, GC_HISTORY_SYNC_TIMEOUT))
+        return;
+
+    uint32_t i;
+
+    for (i = 1; i < chat->numpeers; ++i) {
+        if (chat->gcc[i]->public_key_hash == chat->history_peer_hash)
+            break;
+    }
+
+    if (i == chat->numpeers || chat->history_retries >= GC_HISTORY_MAX_RETRIES) {
+        chat->history_peer_hash = 0;
+        return;
+    }
+
+    ++chat->history_retries;
+    chat->last_history_response = unix_time(chat->net->mono_time);
+
+    if (chat->history_next_seq != 0)
+        send_gc_history_request(chat, i, 0, chat->history_next_seq);
+    else
+        send_gc_history_request(chat, i, chat->history_since, 0);
+}
+
+/* Sends peernumber up to GC_HISTORY_BATCHES_PER_REQUEST batches of our message log. Without
+ * a log we send a single empty response, so that the peer doesn't wait for one.
+ *
+ * Requests over the limits of GC_HISTORY_MAX_REQUESTS and GC_HISTORY_MAX_BATCHES are ignored
+ * or cut short, the peer asks again after GC_HISTORY_SYNC_TIMEOUT.
+ *
+ * Returns non-negative value on success.
+ * Returns -1 on failure.
+ */
+static int handle_gc_history_request(const Messenger *m, int groupnumber, uint32_t peernumber, const uint8_t *data,
+                                     uint32_t length)
+{
+    if (length != TIME_STAMP_SIZE + sizeof(uint64_t))
+        return -1;
+
+    const GC_Session *c = m->group_handler;
+    GC_Chat *chat = gc_get_group(c, groupnumber);
+
+    if (chat == NULL)
+        return -1;
+
+    GC_Connection *gconn = chat->gcc[peernumber];
+
+    if (is_timeout(chat->net->mono_time, gconn->history_requests_time, GC_HISTORY_REQUEST_INTERVAL)) {
+        gconn->history_requests_time = unix_time(chat->net->mono_time);
+        gconn->history_requests = 0;
+    }
+
+    if (gconn->history_requests >= GC_HISTORY_MAX_REQUESTS)
+        return 0;
+
+    ++gconn->history_requests;
+
+    if (is_timeout(chat->net->mono_time, chat->history_batches_time, GC_HISTORY_REQUEST_INTERVAL)) {
+        chat->history_batches_time = unix_time(chat->net->mono_time);
+        chat->history_batches = 0;
+    }
+
+    uint8_t response[HASH_ID_BYTES + GC_HISTORY_RESPONSE_HEADER_SIZE + GC_HISTORY_BATCH_SIZE];
+    U32_to_bytes(response, chat->self_public_key_hash);
+
+    uint8_t *header = response + HASH_ID_BYTES;
+    uint8_t *batch = header + GC_HISTORY_RESPONSE_HEADER_SIZE;
+
+    if (chat->history == NULL) {
+        U64_to_bytes(header, 0);
+        header[sizeof(uint64_t)] = GC_HISTORY_BATCH_DONE;
+        return send_lossless_group_packet(chat, peernumber, response, HASH_ID_BYTES + GC_HISTORY_RESPONSE_HEADER_SIZE,
+                                          GP_HISTORY_RESPONSE);
+    }
+
+    uint64_t since_time, seq;
+    bytes_to_U64(&since_time, data);
+    bytes_to_U64(&seq, data + TIME_STAMP_SIZE);
+
+    if (seq == 0)
+        seq = gc_history_find_time(chat->history, since_time);
+
+    uint32_t i;
+
+    for (i = 0; i < GC_HISTORY_BATCHES_PER_REQUEST && chat->history_batches < GC_HISTORY_MAX_BATCHES; ++i) {
+        uint64_t next_seq;
+        int batch_len = gc_history_pack_batch(chat->history, seq, batch, GC_HISTORY_BATCH_SIZE, &next_seq);
+
+        if (batch_len == -1)
+            return -1;
+
+        uint8_t state = GC_HISTORY_BATCH_MORE;
+
+        if (next_seq >= gc_history_next_seq(chat->history))
+            state = GC_HISTORY_BATCH_DONE;
+        else if (i == GC_HISTORY_BATCHES_PER_REQUEST - 1)
+            state = GC_HISTORY_BATCH_ASK;
+
+        U64_to_bytes(header, next_seq);
+        header[sizeof(uint64_t)] = state;
+
+        if (send_lossless_group_packet(chat, peernumber, response,
+                                       HASH_ID_BYTES + GC_HISTORY_RESPONSE_HEADER_SIZE + batch_len,
+                                       GP_HISTORY_RESPONSE) == -1)
+            return -1;
+
+        ++chat->history_batches;
+
+        if (state == GC_HISTORY_BATCH_DONE)
+            break;
+
+        seq = next_seq;
+    }
+
+    return 0;
+}
+
+typedef struct {
+    Messenger *m;
+    GC_Chat *chat;
+} GC_History_Sync;
+
+/* Logs an entry we got from the peer we catch up with, unless we had it already or its sender
+ * didn't sign it.
+ */
+static void handle_gc_history_entry(void *object, const GC_History_Entry *entry)
+{
+    const GC_History_Sync *sync = object;
+    GC_Chat *chat = sync->chat;
+
+    if (!gc_history_verify(entry, CHAT_ID(chat->chat_public_key))
+            || gc_history_contains(chat->history, entry, chat->history_sync_seq))
+        return;
+
+    if (gc_history_append(chat->history, entry) == -1)
+        return;
+
+    GC_Session *c = sync->m->group_handler;
+    unsigned int cb_type = entry->type == GC_MESSAGE_TYPE_ACTION ? MESSAGE_ACTION : MESSAGE_NORMAL;
+
+    if (c->history_message)
+        (*c->history_message)(sync->m, chat->groupnumber, entry->public_key, entry->nick, entry->nick_len, cb_type,
+                              entry->time, entry->message, entry->length, c->history_message_userdata);
+}
+
+/* Handles a batch of the message log of the peer we catch up with. Batches from anyone else
+ * are ignored.
+ *
+ * Returns non-negative value on success.
+ * Returns -1 on failure.
+ */
+static int handle_gc_history_response(Messenger *m, int groupnumber, uint32_t peernumber, const uint8_t *data,
+                                      uint32_t length)
+{
+    if (length < GC_HISTORY_RESPONSE_HEADER_SIZE || length > GC_HISTORY_RESPONSE_HEADER_SIZE + GC_HISTORY_BATCH_SIZE)
+        return -1;
+
+    GC_Session *c = m->group_handler;
+    GC_Chat *chat = gc_get_group(c, groupnumber);
+
+    if (chat == NULL)
+        return -1;
+
+    if (chat->history == NULL || chat->history_peer_hash != chat->gcc[peernumber]->public_key_hash)
+        return 0;
+
+    uint64_t next_seq;
+    bytes_to_U64(&next_seq, data);
+    uint8_t state = data[sizeof(uint64_t)];
+
+    chat->last_history_response = unix_time(chat->net->mono_time);
+    chat->history_retries = 0;
+
+    if (next_seq != 0)
+        chat->history_next_seq = next_seq;
+
+    if (length > GC_HISTORY_RESPONSE_HEADER_SIZE) {
+        GC_History_Sync sync = {m, chat};
+
+        if (gc_history_unpack_batch(data + GC_HISTORY_RESPONSE_HEADER_SIZE, length - GC_HISTORY_RESPONSE_HEADER_SIZE,
+                                    &handle_gc_history_entry, &sync) == -1) {
+            chat->history_peer_hash = 0;
+            return -1;
+        }
+    }
+
+    if (state == GC_HISTORY_BATCH_ASK && next_seq != 0)
+        return send_gc_history_request(chat, peernumber, 0, next_seq);
+
+    if (state != GC_HISTORY_BATCH_MORE)
+        chat->history_peer_hash = 0;
+
+    return 0;
+}
+
+static void self_to_peer(const GC_Session *c, const GC_Chat *chat, GC_GroupPeer *peer);
+static int send_gc_peer_info_request(GC_Chat *chat, uint32_t peernumber);
+
+/* Compares our peerlist with our announced nodes and attempts to do a handshake
+ * with any nodes that are not in our peerlist.
+ *
+ * Returns 0 on success.
+ * Returns -1 on faillure.
+ */
+static int sync_gc_announced_nodes(const GC_Session *c, GC_Chat *chat)
+{
+    GC_GroupPeer self;
+    self_to_peer(c, chat, &self);
+
+    uint8_t data[MAX_GC_PACKET_SIZE];
+    U32_to_bytes(data, chat->self_public_key_hash);
+    uint32_t len = HASH_ID_BYTES;
+
+    int peers_len = pack_gc_peer(data + len, sizeof(data) - len, &self);
+    len += peers_len;
+
+    if (peers_len <= 0) {
+        fprintf(stderr, "pack_gc_peer failed in sync_gc_announced_nodes %d\n", peers_len);
+        return -1;
+    }
+
+    uint16_t i;
+
+    for (i = 0; i < chat->num_addrs && !gc_overlay_full(chat); ++i) {
+        if (get_peernum_of_enc_pk(chat, chat->addr_list[i].public_key) == -1)
+            send_gc_handshake_request(c->messenger, chat->groupnumber, chat->addr_list[i].ip_port,
+                                      chat->addr_list[i].public_key, HS_PEER_INFO_EXCHANGE, HJ_PUBLIC);
+    }
+
+    return 0;
+}
+
+/* Shares our TCP relays with peernumber and adds shared relays to our connection with them.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+static int send_gc_tcp_relays(GC_Chat *chat, uint32_t peernumber)
+{
+    Node_format tcp_relays[GCC_MAX_TCP_SHARED_RELAYS];
+    unsigned int i, num = tcp_copy_connected_relays(chat->tcp_conn, tcp_relays, GCC_MAX_TCP_SHARED_RELAYS);
+
+    if (num == 0)
+        return 0;
+
+    uint8_t data[HASH_ID_BYTES + sizeof(tcp_relays)];
+    U32_to_bytes(data, chat->self_public_key_hash);
+    uint32_t length = HASH_ID_BYTES;
+
+    for (i = 0; i < num; ++i)
+        add_tcp_relay_connection(chat->tcp_conn, chat->gcc[peernumber]->tcp_connection_num, tcp_relays[i].ip_port,
+                                 tcp_relays[i].public_key);
+
+    int nodes_len = pack_nodes(data + length, sizeof(data) - length, tcp_relays, num);
+
+    if (nodes_len <= 0)
+        return -1;
+
+    length += nodes_len;
+
+    if (send_lossy_group_packet(chat, peernumber, data, length, GP_TCP_RELAYS) == -1)
+        return -1;
+
+    chat->gcc[peernumber]->last_tcp_relays_shared = unix_time(chat->net->mono_time);
+    return 0;
+}
+
+/* Adds peernumber's shared TCP relays to our connection with them.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+static int handle_gc_tcp_relays(Messenger *m, int groupnumber, uint32_t peernumber, const uint8_t *data,
+                                uint32_t length)
+{
+    if (length == 0)
+        return -1;
+
+    GC_Session *c = m->group_handler;
+    GC_Chat *chat = gc_get_group(c, groupnumber);
+
+    if (chat == NULL)
+        return -1;
+
+    if (chat->connection_state != CS_CONNECTED)
+        return -1;
+
+    if (!chat->gcc[peernumber]->confirmed)
+        return -1;
+
+    Node_format tcp_relays[GCC_MAX_TCP_SHARED_RELAYS];
+    int num_nodes = unpack_nodes(tcp_relays, GCC_MAX_TCP_SHARED_RELAYS, NULL, data, length, 1);
+
+    if (num_nodes <= 0)
+        return -1;
+
+    int i;
+
+    for (i = 0; i < num_nodes; ++i)
+        add_tcp_relay_connection(chat->tcp_conn, chat->gcc[peernumber]->tcp_connection_num, tcp_relays[i].ip_port,
+                                 tcp_relays[i].public_key);
+
+    return 0;
+}
+
+/* Send invite request to peernumber. Invite packet contains your nick and the group password.
+ * If no group password is necessary the password field will be ignored by the invitee.
+ *
+ * Return -1 if fail
+ * Return 0 if success
+ */
+static int send_gc_invite_request(GC_Chat *chat, uint32_t peernumber)
+{
+    uint8_t data[MAX_GC_PACKET_SIZE];
+    U32_to_bytes(data, chat->self_public_key_hash);
+    uint32_t length = HASH_ID_BYTES;
+    U16_to_bytes(data + length, chat->group[0].nick_len);
+    length += sizeof(uint16_t);
+    memcpy(data + length, chat->group[0].nick, chat->group[0].nick_len);
+    length += chat->group[0].nick_len;
+    memcpy(data + length, chat->shared_state.passwd, MAX_GC_PASSWD_SIZE);
+    length += MAX_GC_PASSWD_SIZE;
+
+    return send_lossless_group_packet(chat, peernumber, data, length, GP_INVITE_REQUEST);
+}
+
+/* Return -1 if fail
+ * Return 0 if succes
+ */
+static int send_gc_invite_response(GC_Chat *chat, uint32_t peernumber)
+{
+    uint32_t length = HASH_ID_BYTES;
+    uint8_t  data[length];
+    U32_to_bytes(data, chat->self_public_key_hash);
+
+    return send_lossless_group_packet(chat, peernumber, data, length, GP_INVITE_RESPONSE);
+}
+
+/* Return -1 if fail
+ * Return 0 if success
+ */
+static int handle_gc_invite_response(Messenger *m, int groupnumber, uint32_t peernumber, const uint8_t *data,
+                                     uint32_t length)
+{
+    GC_Session *c = m->group_handler;
+    GC_Chat *chat = gc_get_group(c, groupnumber);
+
+    if (chat == NULL)
+        return -1;
+
+    if (chat->connection_state == CS_CONNECTED)
+        return 0;
+
+    return send_gc_sync_request(chat, peernumber, 0);
+}
+
+static int handle_gc_invite_response_reject(Messenger *m, int groupnumber, const uint8_t *data, uint32_t length)
+{
+    if (length != sizeof(uint8_t))
+        return -1;
+
+    GC_Session *c = m->group_handler;
+    GC_Chat *chat = gc_get_group(c, groupnumber);
+
+    if (chat == NULL)
+        return -1;
+
+    if (chat->connection_state == CS_CONNECTED)
+        return 0;
+
+    uint8_t type = data[0];
 
     if (type >= GJ_INVALID)
         type = GJ_INVITE_FAILED;
@@ -1288,7 +2055,7 @@ int handle_gc_invite_request(Messenger *m, int groupnumber, uint32_t peernumber,
         goto failed_invite;
     }
 
-    GC_Connection *gconn = &chat->gcc[peernumber];
+    GC_Connection *gconn = chat->gcc[peernumber];
 
     uint16_t nick_len;
     bytes_to_U16(&nick_len, data);
@@ -1340,7 +2107,7 @@ static uint32_t make_gc_broadcast_header(GC_Chat *chat, const uint8_t *data, uin
     header_len += HASH_ID_BYTES;
     packet[header_len] = bc_type;
     header_len += sizeof(uint8_t);
-    U64_to_bytes(packet + header_len, unix_time());
+    U64_to_bytes(packet + header_len, unix_time(chat->net->mono_time));
     header_len += TIME_STAMP_SIZE;
 
     if (length > 0)
@@ -1349,22 +2116,68 @@ static uint32_t make_gc_broadcast_header(GC_Chat *chat, const uint8_t *data, uin
     return length + header_len;
 }
 
-/* sends a group broadcast packet to all confirmed peers.
+/* Sends the gossip packet in data to all our neighbours except except_peer and the peer with origin_pk.
+ * data starts with our public key hash.
+ */
+static void relay_gc_gossip(GC_Chat *chat, const uint8_t *data, uint32_t length, uint32_t except_peer,
+                            const uint8_t *origin_pk)
+{
+    uint32_t i;
+
+    for (i = 1; i < chat->numpeers; ++i) {
+        if (i == except_peer || !peer_is_connected(chat, i))
+            continue;
+
+        if (origin_pk && id_equal(chat->gcc[i]->addr.public_key, origin_pk))
+            continue;
+
+        send_lossless_group_packet(chat, i, data, length, GP_GOSSIP);
+    }
+}
+
+/* Signs the broadcast packet made with make_gc_broadcast_header and sends it to our neighbours,
+ * which relay it to the rest of the group.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+static int send_gc_gossip(GC_Chat *chat, const uint8_t *packet, uint32_t length)
+{
+    uint32_t broadcast_len = length - HASH_ID_BYTES;
+    uint8_t data[HASH_ID_BYTES + GC_GOSSIP_OVERHEAD + broadcast_len];
+
+    U32_to_bytes(data, chat->self_public_key_hash);
+    int gossip_len = gc_gossip_pack(data + HASH_ID_BYTES, sizeof(data) - HASH_ID_BYTES,
+                                    CHAT_ID(chat->chat_public_key), chat->self_public_key, chat->self_secret_key,
+                                    chat->gossip_seq + 1, packet + HASH_ID_BYTES, broadcast_len);
+
+    if (gossip_len == -1)
+        return -1;
+
+    ++chat->gossip_seq;
+    relay_gc_gossip(chat, data, HASH_ID_BYTES + gossip_len, 0, NULL);
+    return 0;
+}
+
+/* sends a group broadcast packet to all confirmed peers, or to our neighbours in overlay groups.
  *
  * Returns 0 on success.
  * Returns -1 on failure.
  */
 static int send_gc_broadcast_message(GC_Chat *chat, const uint8_t *data, uint32_t length, uint8_t bc_type)
 {
-    if (length + GC_BROADCAST_ENC_HEADER_SIZE > MAX_GC_PACKET_SIZE)
+    if (length + GC_BROADCAST_ENC_HEADER_SIZE + GC_GOSSIP_OVERHEAD > MAX_GC_PACKET_SIZE)
         return -1;
 
     uint8_t packet[length + GC_BROADCAST_ENC_HEADER_SIZE];
     uint32_t packet_len = make_gc_broadcast_header(chat, data, length, packet, bc_type);
     uint32_t i;
 
+    if (chat->shared_state.topology == GT_OVERLAY)
+        return send_gc_gossip(chat, packet, packet_len);
+
     for (i = 1; i < chat->numpeers; ++i) {
-        if (chat->gcc[i].confirmed)
+        if (peer_is_connected(chat, i))
             send_lossless_group_packet(chat, i, packet, packet_len, GP_BROADCAST);
     }
 
@@ -1377,7 +2190,7 @@ static void send_gc_packet_all_peers(GC_Chat *chat, uint8_t *data, uint32_t leng
     uint32_t i;
 
     for (i = 1; i < chat->numpeers; ++i) {
-        if (chat->gcc[i].confirmed)
+        if (peer_is_connected(chat, i))
             send_lossless_group_packet(chat, i, data, length, type);
     }
 }
@@ -1385,7 +2198,9 @@ static void send_gc_packet_all_peers(GC_Chat *chat, uint8_t *data, uint32_t leng
 /* Compares a peer's group sync info that we received in a ping packet to our own.
  *
  * If their info appears to be more recent than ours we will first set a sync request flag.
- * If the flag is already set we send a sync request to this peer then set the flag back to false.
+ * If the flag is already set we send a delta sync request to this peer, then set the flag back to false.
+ * A full sync request is sent instead if that fails or if our last delta sync request to the peer
+ * is still unanswered, so that a peer that can't or won't answer them doesn't leave us behind.
  *
  * This function should only be called from handle_gc_ping().
  */
@@ -1400,12 +2215,21 @@ static void do_gc_peer_state_sync(GC_Chat *chat, GC_Connection *gconn, uint32_t
     bytes_to_U32(&sstate_version, sync_data + sizeof(uint32_t));
     bytes_to_U32(&screds_version, sync_data + (sizeof(uint32_t) * 2));
 
-    if (other_num_peers > get_gc_confirmed_numpeers(chat)
+    /* Peers of overlay groups learn about each other from their announcements, not from syncing */
+    bool more_peers = chat->shared_state.topology != GT_OVERLAY && other_num_peers > get_gc_confirmed_numpeers(chat);
+
+    if (more_peers
         || sstate_version > chat->shared_state.version
         || screds_version > chat->moderation.sanctions_creds.version) {
 
-        if (gconn->pending_state_sync) {
-            send_gc_sync_request(chat, peernumber, 0);
+        if (gconn->pending_state_sync) {
+            if (gconn->pending_delta_sync || send_gc_sync_delta_request(chat, peernumber, more_peers) == -1) {
+                send_gc_sync_request(chat, peernumber, 0);
+                gconn->pending_delta_sync = false;
+            } else {
+                gconn->pending_delta_sync = true;
+            }
+
             gconn->pending_state_sync = false;
             return;
         }
@@ -1415,6 +2239,7 @@ static void do_gc_peer_state_sync(GC_Chat *chat, GC_Connection *gconn, uint32_t
     }
 
     gconn->pending_state_sync = false;
+    gconn->pending_delta_sync = false;
 }
 
 /* Handles a ping packet.
@@ -1424,20 +2249,25 @@ static void do_gc_peer_state_sync(GC_Chat *chat, GC_Connection *gconn, uint32_t
  */
 static int handle_gc_ping(Messenger *m, int groupnumber, uint32_t peernumber, const uint8_t *data, uint32_t length)
 {
-    if (length != GC_PING_PACKET_DATA_SIZE)
+    if (length != GC_PING_PACKET_ACK_SIZE)
         return -1;
 
     GC_Chat *chat = gc_get_group(m->group_handler, groupnumber);
-    GC_Connection *gconn = &chat->gcc[peernumber];
 
     if (!chat)
         return -1;
 
+    GC_Connection *gconn = chat->gcc[peernumber];
+
     if (!gconn->confirmed)
         return -1;
 
-    do_gc_peer_state_sync(chat, gconn, peernumber, data, length);
-    gconn->last_rcvd_ping = unix_time();
+    uint64_t ack_id;
+    bytes_to_U64(&ack_id, data + GC_PING_PACKET_DATA_SIZE);
+    gcc_handle_cumulative_ack(chat->net->mono_time, gconn, ack_id);
+
+    do_gc_peer_state_sync(chat, gconn, peernumber, data, GC_PING_PACKET_DATA_SIZE);
+    gconn->last_rcvd_ping = unix_time(chat->net->mono_time);
 
     return 0;
 }
@@ -1555,6 +2385,8 @@ static int send_self_to_peer(const GC_Session *c, GC_Chat *chat, uint32_t peernu
     return send_lossless_group_packet(chat, peernumber, data, length, GP_PEER_INFO_RESPONSE);
 }
 
+static void send_gc_announcements(GC_Chat *chat, uint32_t peernumber);
+
 static int handle_gc_peer_info_request(Messenger *m, int groupnumber, uint32_t peernumber)
 {
     GC_Session *c = m->group_handler;
@@ -1563,10 +2395,21 @@ static int handle_gc_peer_info_request(Messenger *m, int groupnumber, uint32_t p
     if (chat == NULL)
         return -1;
 
-    if (!chat->gcc[peernumber].confirmed && get_gc_confirmed_numpeers(chat) >= chat->shared_state.maxpeers)
+    GC_Connection *gconn = chat->gcc[peernumber];
+
+    if (!gconn->confirmed && get_gc_confirmed_numpeers(chat) >= chat->shared_state.maxpeers)
+        return -1;
+
+    if (send_self_to_peer(c, chat, peernumber) == -1)
         return -1;
 
-    return send_self_to_peer(c, chat, peernumber);
+    /* Sent after our info so that the joining peer confirmed us when they arrive */
+    if (gconn->pending_announcements && gconn->confirmed) {
+        gconn->pending_announcements = false;
+        send_gc_announcements(chat, peernumber);
+    }
+
+    return 0;
 }
 
 static int send_gc_peer_info_request(GC_Chat *chat, uint32_t peernumber)
@@ -1611,7 +2454,7 @@ static int handle_gc_peer_info_response(Messenger *m, int groupnumber, uint32_t
     if (chat->connection_state != CS_CONNECTED)
         return -1;
 
-    if (!chat->gcc[peernumber].confirmed && get_gc_confirmed_numpeers(chat) >= chat->shared_state.maxpeers)
+    if (!chat->gcc[peernumber]->confirmed && get_gc_confirmed_numpeers(chat) >= chat->shared_state.maxpeers)
         return -1;
 
     if (chat->shared_state.passwd_len > 0) {
@@ -1641,13 +2484,13 @@ static int handle_gc_peer_info_response(Messenger *m, int groupnumber, uint32_t
         return -1;
     }
 
-    bool do_callback = chat->gcc[peernumber].time_added - chat->gcc[0].time_added > 1
-                      || chat->gcc[0].time_added - chat->gcc[peernumber].time_added > 1;
+    bool do_callback = chat->gcc[peernumber]->time_added - chat->gcc[0]->time_added > 1
+                      || chat->gcc[0]->time_added - chat->gcc[peernumber]->time_added > 1;
 
-    if (do_callback && c->peer_join && !chat->gcc[peernumber].confirmed)
+    if (do_callback && c->peer_join && !chat->gcc[peernumber]->confirmed)
         (*c->peer_join)(m, groupnumber, peernumber, c->peer_join_userdata);
 
-    chat->gcc[peernumber].confirmed = true;
+    chat->gcc[peernumber]->confirmed = true;
 
     return 0;
 }
@@ -1749,6 +2592,9 @@ static int validate_gc_shared_state(const GC_SharedState *state)
     if (state->group_name_len == 0 || state->group_name_len > MAX_GC_GROUP_NAME_SIZE)
         return -1;
 
+    if (state->topology >= GT_INVALID)
+        return -1;
+
     return 0;
 }
 
@@ -1904,7 +2750,7 @@ static int handle_gc_sanctions_list(Messenger *m, int groupnumber, uint32_t peer
         goto on_error;
     }
 
-    if (sanctions_list_check_integrity(chat, &creds, sanctions, num_sanctions) == -1) {
+    if (sanctions_list_check_integrity(chat, &creds, sanctions, num_sanctions, get_gc_crypto_pipeline(m)) == -1) {
         fprintf(stderr, "sanctions_list_check_integrity failed in handle_gc_sanctions_list\n");
         free(sanctions);
         goto on_error;
@@ -2387,7 +3233,7 @@ static int send_gc_set_mod(GC_Chat *chat, uint32_t peernumber, bool add_mod)
     uint32_t length = 1 + SIG_PUBLIC_KEY;
     uint8_t data[length];
     data[0] = (uint8_t) add_mod;
-    memcpy(data + 1, SIG_PK(chat->gcc[peernumber].addr.public_key), SIG_PUBLIC_KEY);
+    memcpy(data + 1, SIG_PK(chat->gcc[peernumber]->addr.public_key), SIG_PUBLIC_KEY);
 
     if (send_gc_broadcast_message(chat, data, length, GM_SET_MOD) == -1)
         return -1;
@@ -2410,13 +3256,13 @@ int founder_gc_set_moderator(GC_Chat *chat, uint32_t peernumber, bool add_mod)
         if (chat->moderation.num_mods >= MAX_GC_MODERATORS)
             prune_gc_mod_list(chat);
 
-        if (mod_list_add_entry(chat, SIG_PK(chat->gcc[peernumber].addr.public_key)) == -1)
+        if (mod_list_add_entry(chat, SIG_PK(chat->gcc[peernumber]->addr.public_key)) == -1)
             return -1;
     } else {
-        if (mod_list_remove_entry(chat, SIG_PK(chat->gcc[peernumber].addr.public_key)) == -1)
+        if (mod_list_remove_entry(chat, SIG_PK(chat->gcc[peernumber]->addr.public_key)) == -1)
             return -1;
 
-        if (update_gc_sanctions_list(chat,  SIG_PK(chat->gcc[peernumber].addr.public_key)) == -1)
+        if (update_gc_sanctions_list(chat,  SIG_PK(chat->gcc[peernumber]->addr.public_key)) == -1)
             return -1;
     }
 
@@ -2506,7 +3352,7 @@ static int send_gc_set_observer(GC_Chat *chat, uint32_t peernumber, const uint8_
     uint32_t packet_len = 1 + EXT_PUBLIC_KEY + length;
     uint8_t packet[packet_len];
     packet[0] = (uint8_t) add_obs;
-    memcpy(packet + 1, chat->gcc[peernumber].addr.public_key, EXT_PUBLIC_KEY);
+    memcpy(packet + 1, chat->gcc[peernumber]->addr.public_key, EXT_PUBLIC_KEY);
     memcpy(packet + 1 + EXT_PUBLIC_KEY, sanction_data, length);
 
     if (send_gc_broadcast_message(chat, packet, packet_len, GM_SET_OBSERVER) == -1)
@@ -2544,7 +3390,7 @@ static int mod_gc_set_observer(GC_Chat *chat, uint32_t peernumber, bool add_obs)
 
         length += packed_len;
     } else {
-        if (sanctions_list_remove_observer(chat, chat->gcc[peernumber].addr.public_key, NULL) == -1)
+        if (sanctions_list_remove_observer(chat, chat->gcc[peernumber]->addr.public_key, NULL) == -1)
             return -1;
 
         uint16_t packed_len = sanctions_creds_pack(&chat->moderation.sanctions_creds, sanction_data,
@@ -2583,7 +3429,7 @@ int gc_set_peer_role(Messenger *m, int groupnumber, uint32_t peernumber, uint8_t
     if (peernumber == 0 || !peernumber_valid(chat, peernumber))
         return -2;
 
-    if (!chat->gcc[peernumber].confirmed)
+    if (!chat->gcc[peernumber]->confirmed)
         return -2;
 
     if (chat->group[0].role >= GR_USER)
@@ -2711,6 +3557,54 @@ int gc_founder_set_privacy_state(Messenger *m, int groupnumber, uint8_t new_priv
     return 0;
 }
 
+/* Returns the group topology. */
+uint8_t gc_get_topology(const GC_Chat *chat)
+{
+    return chat->shared_state.topology;
+}
+
+/* Sets the group topology and distributes the new shared state to the group.
+ *
+ * This function requires that the shared state be re-signed and will only work for the group founder.
+ *
+ * Returns 0 on success.
+ * Returns -1 if groupnumber is invalid.
+ * Returns -2 if the topology is an invalid type.
+ * Returns -3 if the caller does not have sufficient permissions for this action.
+ * Returns -4 if the topology could not be set.
+ * Returns -5 if the packet failed to send.
+ */
+int gc_founder_set_topology(Messenger *m, int groupnumber, uint8_t topology)
+{
+    GC_Chat *chat = gc_get_group(m->group_handler, groupnumber);
+
+    if (chat == NULL)
+        return -1;
+
+    if (topology >= GT_INVALID)
+        return -2;
+
+    if (chat->group[0].role != GR_FOUNDER)
+        return -3;
+
+    uint8_t old_topology = chat->shared_state.topology;
+
+    if (topology == old_topology)
+        return 0;
+
+    chat->shared_state.topology = topology;
+
+    if (sign_gc_shared_state(chat) == -1) {
+        chat->shared_state.topology = old_topology;
+        return -4;
+    }
+
+    if (broadcast_gc_shared_state(chat) == -1)
+        return -5;
+
+    return 0;
+}
+
 /* Returns the group peer limit. */
 uint32_t gc_get_max_peers(const GC_Chat *chat)
 {
@@ -2773,18 +3667,36 @@ int gc_send_message(GC_Chat *chat, const uint8_t *message, uint16_t length, uint
     if (chat->group[0].role >= GR_OBSERVER)
         return -4;
 
+    GC_History_Entry entry;
+    entry.time = unix_time(chat->net->mono_time);
+    memcpy(entry.public_key, chat->self_public_key, EXT_PUBLIC_KEY);
+    entry.type = type;
+    entry.length = length;
+    memcpy(entry.message, message, length);
+
+    if (gc_history_sign(&entry, CHAT_ID(chat->chat_public_key), chat->self_secret_key) == -1)
+        return -5;
+
+    uint8_t data[GC_MESSAGE_HEADER_SIZE + length];
+    U64_to_bytes(data, entry.time);
+    memcpy(data + TIME_STAMP_SIZE, entry.signature, SIGNATURE_SIZE);
+    memcpy(data + GC_MESSAGE_HEADER_SIZE, message, length);
+
     uint8_t packet_type = type == GC_MESSAGE_TYPE_NORMAL ? GM_PLAIN_MESSAGE : GM_ACTION_MESSAGE;
 
-    if (send_gc_broadcast_message(chat, message, length, packet_type) == -1)
+    if (send_gc_broadcast_message(chat, data, sizeof(data), packet_type) == -1)
         return -5;
 
+    log_gc_message(chat, 0, &entry);
+
     return 0;
 }
 
+/* Messages are [u64 time they were sent at][signature of the sender][message], see gc_history_sign(). */
 static int handle_bc_message(Messenger *m, int groupnumber, uint32_t peernumber, const uint8_t *data,
                              uint32_t length, uint8_t type)
 {
-    if (length > MAX_GC_MESSAGE_SIZE || length == 0)
+    if (length > GC_MESSAGE_HEADER_SIZE + MAX_GC_MESSAGE_SIZE || length <= GC_MESSAGE_HEADER_SIZE)
         return -1;
 
     GC_Session *c = m->group_handler;
@@ -2793,16 +3705,29 @@ static int handle_bc_message(Messenger *m, int groupnumber, uint32_t peernumber,
     if (chat == NULL)
         return -1;
 
-    if (chat->gcc[peernumber].ignore || chat->group[peernumber].role >= GR_OBSERVER)
+    if (chat->gcc[peernumber]->ignore || chat->group[peernumber].role >= GR_OBSERVER)
         return 0;
 
     if (type != GM_PLAIN_MESSAGE && type != GM_ACTION_MESSAGE)
         return -1;
 
+    GC_History_Entry entry;
+    bytes_to_U64(&entry.time, data);
+    memcpy(entry.signature, data + TIME_STAMP_SIZE, SIGNATURE_SIZE);
+    memcpy(entry.public_key, chat->gcc[peernumber]->addr.public_key, EXT_PUBLIC_KEY);
+    entry.type = type == GM_PLAIN_MESSAGE ? GC_MESSAGE_TYPE_NORMAL : GC_MESSAGE_TYPE_ACTION;
+    entry.length = length - GC_MESSAGE_HEADER_SIZE;
+    memcpy(entry.message, data + GC_MESSAGE_HEADER_SIZE, entry.length);
+
+    if (!chat->gcc[peernumber]->has_sig_key || !gc_history_verify(&entry, CHAT_ID(chat->chat_public_key)))
+        return -1;
+
+    log_gc_message(chat, peernumber, &entry);
+
     unsigned int cb_type = (type == GM_PLAIN_MESSAGE) ? MESSAGE_NORMAL : MESSAGE_ACTION;
 
     if (c->message)
-        (*c->message)(m, groupnumber, peernumber, cb_type, data, length, c->message_userdata);
+        (*c->message)(m, groupnumber, peernumber, cb_type, entry.message, entry.length, c->message_userdata);
 
     return 0;
 }
@@ -2851,7 +3776,7 @@ static int handle_bc_private_message(Messenger *m, int groupnumber, uint32_t pee
     if (chat == NULL)
         return -1;
 
-    if (chat->gcc[peernumber].ignore || chat->group[peernumber].role >= GR_OBSERVER)
+    if (chat->gcc[peernumber]->ignore || chat->group[peernumber].role >= GR_OBSERVER)
         return 0;
 
     if (c->private_message)
@@ -2937,7 +3862,7 @@ static int send_gc_remove_peer(GC_Chat *chat, uint32_t peernumber, struct GC_San
     uint32_t length = 1 + ENC_PUBLIC_KEY;
     uint8_t packet[MAX_GC_PACKET_SIZE];
     packet[0] = mod_event;
-    memcpy(packet + 1, chat->gcc[peernumber].addr.public_key, ENC_PUBLIC_KEY);
+    memcpy(packet + 1, chat->gcc[peernumber]->addr.public_key, ENC_PUBLIC_KEY);
 
     if (mod_event == MV_BAN) {
         int packed_len = sanctions_list_pack(packet + length, sizeof(packet) - length, sanction,
@@ -2974,7 +3899,7 @@ int gc_remove_peer(Messenger *m, int groupnumber, uint32_t peernumber, bool set_
     if (!peernumber_valid(chat, peernumber))
         return -2;
 
-    if (!chat->gcc[peernumber].confirmed)
+    if (!chat->gcc[peernumber]->confirmed)
         return -2;
 
     if (chat->group[0].role >= GR_USER || chat->group[peernumber].role == GR_FOUNDER)
@@ -3089,58 +4014,29 @@ int gc_remove_ban(GC_Chat *chat, uint32_t ban_id)
     return 0;
 }
 
-#define VALID_GC_MESSAGE_ACK(a, b) (((a) == 0) || ((b) == 0))
-
-/* If read_id is non-zero sends a read-receipt for read_id's packet.
- * If request_id is non-zero sends a request for the respective id's packet.
+/* Sends peernumber an ack for all the messages we received from them, including
+ * the ranges of messages received out of sequence.
  */
-int gc_send_message_ack(const GC_Chat *chat, uint32_t peernumber, uint64_t read_id, uint64_t request_id)
+int gc_send_message_ack(const GC_Chat *chat, uint32_t peernumber)
 {
-    if (!VALID_GC_MESSAGE_ACK(read_id, request_id))
-        return -1;
-
-    uint32_t length = HASH_ID_BYTES + (MESSAGE_ID_BYTES * 2);
-    uint8_t data[length];
+    uint8_t data[HASH_ID_BYTES + GCC_MAX_ACK_SIZE];
     U32_to_bytes(data, chat->self_public_key_hash);
-    U64_to_bytes(data + HASH_ID_BYTES, read_id);
-    U64_to_bytes(data + HASH_ID_BYTES + MESSAGE_ID_BYTES, request_id);
+
+    uint32_t length = HASH_ID_BYTES + gcc_pack_ack(chat->gcc[peernumber], data + HASH_ID_BYTES,
+                                                   sizeof(data) - HASH_ID_BYTES);
 
     return send_lossy_group_packet(chat, peernumber, data, length, GP_MESSAGE_ACK);
 }
 
-/* If packet contains a non-zero request_id we try to resend its respective packet.
- * If packet contains a non-zero read_id we remove the packet from our send array.
+/* Removes the messages peernumber acked from our send array and resends the
+ * ones they are missing.
  *
  * Returns non-negative value on success.
- * Return -1 if error or we fail to send a packet in case of a request response.
+ * Return -1 if the ack is invalid.
  */
 static int handle_gc_message_ack(GC_Chat *chat, uint32_t peernumber, const uint8_t *data, uint32_t length)
 {
-    if (length != MESSAGE_ID_BYTES * 2)
-        return -1;
-
-    uint64_t read_id, request_id;
-    bytes_to_U64(&read_id, data);
-    bytes_to_U64(&request_id, data + MESSAGE_ID_BYTES);
-
-    if (!VALID_GC_MESSAGE_ACK(read_id, request_id))
-        return -1;
-
-    if (read_id > 0)
-        return gcc_handle_ack(&chat->gcc[peernumber], read_id);
-
-    GC_Connection *gconn = &chat->gcc[peernumber];
-    uint64_t tm = unix_time();
-    uint16_t idx = get_ary_index(request_id);
-
-    /* re-send requested packet */
-    if (gconn->send_ary[idx].message_id == request_id
-        && (gconn->send_ary[idx].last_send_try != tm || gconn->send_ary[idx].time_added == tm)) {
-        gconn->send_ary[idx].last_send_try = tm;
-        return sendpacket(chat->net, gconn->addr.ip_port, gconn->send_ary[idx].data, gconn->send_ary[idx].data_length);
-    }
-
-    return -1;
+    return gcc_handle_ack_packet(chat, chat->gcc[peernumber], data, length);
 }
 
 /* Sends a handshake response ack to peernumber.
@@ -3170,10 +4066,10 @@ static int handle_gc_hs_response_ack(Messenger *m, int groupnumber, uint32_t pee
     if (chat == NULL)
         return -1;
 
-    GC_Connection *gconn = &chat->gcc[peernumber];
+    GC_Connection *gconn = chat->gcc[peernumber];
     gconn->handshaked = true;
 
-    return gcc_handle_ack(gconn, 1);
+    return gcc_handle_ack(chat->net->mono_time, gconn, 1);
 }
 
 /* Toggles ignore for peernumber.
@@ -3186,7 +4082,89 @@ int gc_toggle_ignore(GC_Chat *chat, uint32_t peernumber, bool ignore)
     if (!peernumber_valid(chat, peernumber))
         return -1;
 
-    chat->gcc[peernumber].ignore = ignore;
+    chat->gcc[peernumber]->ignore = ignore;
+    return 0;
+}
+
+/* Broadcasts our info and address to the whole overlay group so that the peers we aren't connected
+ * to know us and can pick us as a neighbour.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+static int send_gc_self_announce(const GC_Session *c, GC_Chat *chat)
+{
+    GC_GroupPeer self;
+    self_to_peer(c, chat, &self);
+
+    uint8_t data[PACKED_GC_PEER_SIZE + SIZE_IPPORT];
+    int len = pack_gc_peer(data, sizeof(data), &self);
+
+    if (len == -1)
+        return -1;
+
+    IP_Port ipp;
+    memset(&ipp, 0, sizeof(IP_Port));
+
+    if (ipport_self_copy(c->messenger->dht, &ipp) == 0) {
+        int ipp_len = pack_ip_port(data, sizeof(data), len, &ipp);
+
+        if (ipp_len > 0)
+            len += ipp_len;
+    }
+
+    return send_gc_broadcast_message(chat, data, len, GM_PEER_INFO);
+}
+
+/* Handles the announcement a peer of an overlay group broadcasts about itself. It carries the info
+ * and address of the peer, which we only need if we aren't connected to it.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+static int handle_bc_peer_info(Messenger *m, int groupnumber, uint32_t peernumber, const uint8_t *data,
+                               uint32_t length)
+{
+    GC_Session *c = m->group_handler;
+    GC_Chat *chat = gc_get_group(c, groupnumber);
+
+    if (chat == NULL)
+        return -1;
+
+    GC_Connection *gconn = chat->gcc[peernumber];
+
+    /* We got the info of our neighbours in the peer info exchange */
+    if (!gconn->relayed)
+        return 0;
+
+    if (!gconn->confirmed && get_gc_confirmed_numpeers(chat) >= chat->shared_state.maxpeers)
+        return -1;
+
+    GC_GroupPeer peer;
+    memset(&peer, 0, sizeof(GC_GroupPeer));
+
+    int unpacked_len = unpack_gc_peer(&peer, data, length);
+
+    if (unpacked_len == -1)
+        return -1;
+
+    IP_Port ipp;
+
+    if (length > unpacked_len && unpack_ip_port(&ipp, unpacked_len, data, length, 0) != -1)
+        ipport_copy(&gconn->addr.ip_port, &ipp);
+
+    if (peer_update(m, groupnumber, &peer, peernumber) == -1)
+        return -1;
+
+    if (validate_gc_peer_role(chat, peernumber) == -1) {
+        gc_peer_delete(m, groupnumber, peernumber, NULL, 0);
+        return -1;
+    }
+
+    if (c->peer_join && !gconn->confirmed)
+        (*c->peer_join)(m, groupnumber, peernumber, c->peer_join_userdata);
+
+    gconn->confirmed = true;
     return 0;
 }
 
@@ -3208,7 +4186,8 @@ static int handle_gc_broadcast(Messenger *m, int groupnumber, uint32_t peernumbe
     uint8_t broadcast_type;
     memcpy(&broadcast_type, data, sizeof(uint8_t));
 
-    if (!chat->gcc[peernumber].confirmed)
+    /* Relayed peers are confirmed by their announcement */
+    if (!chat->gcc[peernumber]->confirmed && broadcast_type != GM_PEER_INFO)
         return -1;
 
     uint32_t m_len = length - (1 + TIME_STAMP_SIZE);
@@ -3238,6 +4217,8 @@ static int handle_gc_broadcast(Messenger *m, int groupnumber, uint32_t peernumbe
             return handle_bc_set_mod(m, groupnumber, peernumber, message, m_len);
         case GM_SET_OBSERVER:
             return handle_bc_set_observer(m, groupnumber, peernumber, message, m_len);
+        case GM_PEER_INFO:
+            return handle_bc_peer_info(m, groupnumber, peernumber, message, m_len);
         default:
             fprintf(stderr, "Warning: handle_gc_broadcast received an invalid broadcast type %u\n", broadcast_type);
             return -1;
@@ -3246,6 +4227,121 @@ static int handle_gc_broadcast(Messenger *m, int groupnumber, uint32_t peernumbe
     return -1;
 }
 
+/* Keeps the signed announcement of peernumber so that we can pass it on to peers joining through us. */
+static void store_gc_announcement(GC_Chat *chat, uint32_t peernumber, const uint8_t *data, uint32_t length)
+{
+    GC_Connection *gconn = chat->gcc[peernumber];
+    uint8_t *announcement = realloc(gconn->announcement, length);
+
+    if (announcement == NULL)
+        return;
+
+    memcpy(announcement, data, length);
+    gconn->announcement = announcement;
+    gconn->announcement_len = length;
+}
+
+/* Sends the announcements we know about to peernumber, which joined the group through us.
+ * They keep the signature of their origin and aren't relayed any further.
+ */
+static void send_gc_announcements(GC_Chat *chat, uint32_t peernumber)
+{
+    uint32_t i;
+
+    for (i = 1; i < chat->numpeers; ++i) {
+        const GC_Connection *gconn = chat->gcc[i];
+
+        if (i == peernumber || !gconn->confirmed || gconn->announcement == NULL)
+            continue;
+
+        uint8_t data[HASH_ID_BYTES + gconn->announcement_len];
+        U32_to_bytes(data, chat->self_public_key_hash);
+        memcpy(data + HASH_ID_BYTES, gconn->announcement, gconn->announcement_len);
+        data[HASH_ID_BYTES] = GC_GOSSIP_MAX_HOPS;
+
+        if (send_lossless_group_packet(chat, peernumber, data, sizeof(data), GP_GOSSIP) == -1)
+            break;
+    }
+}
+
+/* Handles a gossip packet relayed to us by peernumber. Broadcasts we haven't seen yet are verified,
+ * relayed to our other neighbours and handled like a broadcast from their origin.
+ *
+ * Returns non-negative value on success.
+ * Returns -1 on failure.
+ */
+static int handle_gc_gossip(Messenger *m, int groupnumber, uint32_t peernumber, const uint8_t *data,
+                            uint32_t length)
+{
+    GC_Chat *chat = gc_get_group(m->group_handler, groupnumber);
+
+    if (chat == NULL)
+        return -1;
+
+    if (chat->connection_state != CS_CONNECTED || !chat->gcc[peernumber]->confirmed)
+        return -1;
+
+    GC_Gossip gossip;
+
+    if (gc_gossip_unpack(&gossip, data, length) == -1)
+        return -1;
+
+    const uint8_t *origin_sig_pk = SIG_PK(gossip.origin_pk);
+
+    /* Our other neighbours relay the same broadcast, the copies are dropped before checking the signature */
+    if (id_equal(gossip.origin_pk, chat->self_public_key)
+            || gc_gossip_cache_has(&chat->gossip_cache, origin_sig_pk, gossip.seq))
+        return 0;
+
+    if (!gc_gossip_verify(CHAT_ID(chat->chat_public_key), data, length))
+        return -1;
+
+    if (gc_gossip_cache_add(&chat->gossip_cache, origin_sig_pk, gossip.seq) == -1)
+        return -1;
+
+    if (gossip.hops < GC_GOSSIP_MAX_HOPS) {
+        uint8_t relay[HASH_ID_BYTES + length];
+        U32_to_bytes(relay, chat->self_public_key_hash);
+        memcpy(relay + HASH_ID_BYTES, data, length);
+        relay[HASH_ID_BYTES] = gossip.hops + 1;
+        relay_gc_gossip(chat, relay, sizeof(relay), peernumber, gossip.origin_pk);
+    }
+
+    uint8_t broadcast_type = gossip.payload[0];
+
+    /* Private messages are sent to their recipient only */
+    if (broadcast_type == GM_PRVT_MESSAGE)
+        return -1;
+
+    int origin = get_peernum_of_enc_pk(chat, gossip.origin_pk);
+
+    if (origin == -1) {
+        /* Peers we don't know about introduce themselves with their announcement */
+        if (broadcast_type != GM_PEER_INFO)
+            return 0;
+
+        origin = relayed_peer_add(m, groupnumber, gossip.origin_pk);
+
+        if (origin == -1)
+            return -1;
+    } else if (memcmp(SIG_PK(chat->gcc[origin]->addr.public_key), origin_sig_pk, SIG_PUBLIC_KEY) != 0) {
+        return -1;
+    }
+
+    if (chat->gcc[origin]->relayed)
+        chat->gcc[origin]->last_rcvd_ping = unix_time(chat->net->mono_time);
+
+    if (handle_gc_broadcast(m, groupnumber, origin, gossip.payload, gossip.length) == -1)
+        return -1;
+
+    /* The broadcast may have removed peers, the origin among them */
+    if (broadcast_type == GM_PEER_INFO && peernumber_valid(chat, origin)
+            && id_equal(chat->gcc[origin]->addr.public_key, gossip.origin_pk))
+        store_gc_announcement(chat, origin, data, length);
+
+    return 0;
+}
+
 /* Decrypts data of length using self secret key and sender's public key.
  *
  * Returns length of plaintext data on success.
@@ -3310,8 +4406,8 @@ static int wrap_group_handshake_packet(const uint8_t *self_pk, const uint8_t *se
 /* Makes, wraps and encrypts a group handshake packet (both request and response are the same format).
  *
  * Packet contains the handshake header, the handshake type, self pk hash, session pk, self public signature key,
- * the request type (GROUP_HANDSHAKE_REQUEST_TYPE), the join type (GROUP_HANDSHAKE_JOIN_TYPE),
- * and a list of tcp relay nodes we share with this peer.
+ * the request type (GROUP_HANDSHAKE_REQUEST_TYPE), the join type (GROUP_HANDSHAKE_JOIN_TYPE)
+ * and GC_PROTOCOL_VERSION.
  *
  * Returns length of encrypted packet on success.
  * Returns -1 on failure.
@@ -3339,6 +4435,8 @@ int make_gc_handshake_packet(GC_Chat *chat, const GC_Connection *gconn, uint8_t
     length += sizeof(uint8_t);
     memcpy(data + length, &join_type, sizeof(uint8_t));
     length += sizeof(uint8_t);
+    data[length] = GC_PROTOCOL_VERSION;
+    length += sizeof(uint8_t);
 
     int enc_len = wrap_group_handshake_packet(chat->self_public_key, chat->self_secret_key,
                                               gconn->addr.public_key, packet, packet_size,
@@ -3358,7 +4456,7 @@ int make_gc_handshake_packet(GC_Chat *chat, const GC_Connection *gconn, uint8_t
 static int send_gc_handshake_packet(GC_Chat *chat, uint32_t peernumber, uint8_t handshake_type,
                                     uint8_t request_type, uint8_t join_type)
 {
-    GC_Connection *gconn = &chat->gcc[peernumber];
+    GC_Connection *gconn = chat->gcc[peernumber];
 
     uint8_t packet[GC_ENCRYPTED_HS_PACKET_SIZE];
     int length = make_gc_handshake_packet(chat, gconn, handshake_type, request_type, join_type, packet, sizeof(packet));
@@ -3436,17 +4534,19 @@ static int handle_gc_handshake_response(Messenger *m, int groupnumber, const uin
     if (peernumber == -1)
         return -1;
 
-    GC_Connection *gconn = &chat->gcc[peernumber];
+    GC_Connection *gconn = chat->gcc[peernumber];
 
     uint8_t sender_session_pk[ENC_PUBLIC_KEY];
     memcpy(sender_session_pk, data, ENC_PUBLIC_KEY);
     encrypt_precompute(sender_session_pk, gconn->session_secret_key, gconn->shared_key);
 
-    memcpy(SIG_PK(chat->gcc[peernumber].addr.public_key), data + ENC_PUBLIC_KEY, SIG_PUBLIC_KEY);
+    if (set_peer_sig_key(chat, gconn, data + ENC_PUBLIC_KEY) == -1)
+        return -1;
+
     uint8_t request_type = data[ENC_PUBLIC_KEY + SIG_PUBLIC_KEY];
 
     /* This packet is an implied handshake request acknowledgement */
-    gcc_handle_ack(gconn, 1);
+    gcc_handle_ack(chat->net->mono_time, gconn, 1);
     ++gconn->recv_message_id;
 
     gconn->handshaked = true;
@@ -3513,11 +4613,19 @@ static int handle_gc_handshake_request(Messenger *m, int groupnumber, IP_Port *i
         return -1;
     }
 
-    ++chat->connection_O_metre;
-
     int peer_exists = get_peernum_of_enc_pk(chat, sender_pk);
+    bool new_neighbour = peer_exists == -1 || chat->gcc[peer_exists]->relayed;
+    uint8_t request_type = data[ENC_PUBLIC_KEY + SIG_PUBLIC_KEY];
+
+    /* Peers of overlay groups find other neighbours, joining peers are still let in */
+    if (chat->shared_state.topology == GT_OVERLAY && new_neighbour && request_type == HS_PEER_INFO_EXCHANGE
+            && get_gc_neighbour_count(chat) >= GC_OVERLAY_MAX_NEIGHBOURS)
+        return -1;
+
+    ++chat->connection_O_metre;
 
-    if (peer_exists != -1)
+    /* Relayed peers keep their entry, peer_add connects to them */
+    if (peer_exists != -1 && !chat->gcc[peer_exists]->relayed)
         gc_peer_delete(m, groupnumber, peer_exists, NULL, 0);
 
     int peernumber = peer_add(m, groupnumber, ipp, sender_pk);
@@ -3527,16 +4635,18 @@ static int handle_gc_handshake_request(Messenger *m, int groupnumber, IP_Port *i
         return -1;
     }
 
-    GC_Connection *gconn = &chat->gcc[peernumber];
+    GC_Connection *gconn = chat->gcc[peernumber];
 
     uint8_t sender_session_pk[ENC_PUBLIC_KEY];
     memcpy(sender_session_pk, data, ENC_PUBLIC_KEY);
 
     encrypt_precompute(sender_session_pk, gconn->session_secret_key, gconn->shared_key);
 
-    memcpy(SIG_PK(gconn->addr.public_key), public_sig_key, SIG_PUBLIC_KEY);
+    if (set_peer_sig_key(chat, gconn, public_sig_key) == -1) {
+        gc_peer_delete(m, groupnumber, peernumber, NULL, 0);
+        return -1;
+    }
 
-    uint8_t request_type = data[ENC_PUBLIC_KEY + SIG_PUBLIC_KEY];
     uint8_t join_type = data[ENC_PUBLIC_KEY + SIG_PUBLIC_KEY + 1];
 
     if (join_type == HJ_PUBLIC && chat->shared_state.privacy_state != GI_PUBLIC) {
@@ -3579,6 +4689,9 @@ static int handle_gc_handshake_packet(Messenger *m, GC_Chat *chat, IP_Port *ipp,
     if (public_key_hash != get_peer_key_hash(sender_pk))
         return -1;
 
+    if (data[plain_len - 1] != GC_PROTOCOL_VERSION)
+        return -1;
+
     const uint8_t *real_data = data + (sizeof(uint8_t) + HASH_ID_BYTES);
     uint16_t real_len = plain_len - (sizeof(uint8_t) - HASH_ID_BYTES);
 
@@ -3597,7 +4710,7 @@ static int handle_gc_handshake_packet(Messenger *m, GC_Chat *chat, IP_Port *ipp,
     }
 
     if (peernumber > 0 && direct_conn)
-        chat->gcc[peernumber].last_recv_direct_time = unix_time();
+        chat->gcc[peernumber]->last_recv_direct_time = unix_time(chat->net->mono_time);
 
     return peernumber;
 }
@@ -3608,6 +4721,8 @@ int handle_gc_lossless_helper(Messenger *m, int groupnumber, uint32_t peernumber
     switch (packet_type) {
         case GP_BROADCAST:
             return handle_gc_broadcast(m, groupnumber, peernumber, data, length);
+        case GP_GOSSIP:
+            return handle_gc_gossip(m, groupnumber, peernumber, data, length);
         case GP_PEER_INFO_RESPONSE:
             return handle_gc_peer_info_response(m, groupnumber, peernumber, data, length);
         case GP_PEER_INFO_REQUEST:
@@ -3616,6 +4731,14 @@ int handle_gc_lossless_helper(Messenger *m, int groupnumber, uint32_t peernumber
             return handle_gc_sync_request(m, groupnumber, peernumber, data, length);
         case GP_SYNC_RESPONSE:
             return handle_gc_sync_response(m, groupnumber, peernumber, data, length);
+        case GP_SYNC_DELTA_REQUEST:
+            return handle_gc_sync_delta_request(m, groupnumber, peernumber, data, length);
+        case GP_SYNC_DELTA_RESPONSE:
+            return handle_gc_sync_delta_response(m, groupnumber, peernumber, data, length);
+        case GP_HISTORY_REQUEST:
+            return handle_gc_history_request(m, groupnumber, peernumber, data, length);
+        case GP_HISTORY_RESPONSE:
+            return handle_gc_history_response(m, groupnumber, peernumber, data, length);
         case GP_INVITE_REQUEST:
             return handle_gc_invite_request(m, groupnumber, peernumber, data, length);
         case GP_INVITE_RESPONSE:
@@ -3653,13 +4776,13 @@ static int handle_gc_lossless_message(Messenger *m, GC_Chat *chat, const uint8_t
     if (!peernumber_valid(chat, peernumber))
         return -1;
 
-    GC_Connection *gconn = &chat->gcc[peernumber];
+    GC_Connection *gconn = chat->gcc[peernumber];
 
     uint8_t data[MAX_GC_PACKET_SIZE];
     uint8_t packet_type;
-    uint64_t message_id;
+    uint64_t message_id, ack_id;
 
-    int len = unwrap_group_packet(gconn->shared_key, data, &message_id, &packet_type, packet, length);
+    int len = unwrap_group_packet(gconn->shared_key, data, &message_id, &ack_id, &packet_type, packet, length);
 
     if (len <= 0)
         return -1;
@@ -3676,6 +4799,9 @@ static int handle_gc_lossless_message(Messenger *m, GC_Chat *chat, const uint8_t
     const uint8_t *real_data = data + HASH_ID_BYTES;
     uint16_t real_len = len - HASH_ID_BYTES;
 
+    /* The ack piggybacked on the packet, it can be old if the packet was resent */
+    gcc_handle_cumulative_ack(chat->net->mono_time, gconn, ack_id);
+
     int lossless_ret = gcc_handle_recv_message(chat, peernumber, real_data, real_len, packet_type, message_id);
 
     if (lossless_ret == -1) {
@@ -3683,16 +4809,16 @@ static int handle_gc_lossless_message(Messenger *m, GC_Chat *chat, const uint8_t
         return -1;
     }
 
-    /* Duplicate packet */
-    if (lossless_ret == 0) {
-        fprintf(stderr, "got duplicate packet %lu (type %u)\n", message_id, packet_type);
-        return gc_send_message_ack(chat, peernumber, message_id, 0);
-    }
+    /* Duplicate packet, it is acked with the next batch, or dropped out of order packet */
+    if (lossless_ret == 0)
+        return 0;
 
-    /* request missing packet */
+    /* out of order packet, the ack telling peer what is missing may be due right away */
     if (lossless_ret == 1) {
-        fprintf(stderr, "recieved out of order packet. expeceted %lu, got %lu\n", gconn->recv_message_id + 1, message_id);
-        return gc_send_message_ack(chat, peernumber, 0, gconn->recv_message_id + 1);
+        if (gcc_ack_due(gconn, current_time_monotonic(chat->net->mono_time)))
+            return gc_send_message_ack(chat, peernumber);
+
+        return 0;
     }
 
     int ret = handle_gc_lossless_helper(m, chat->groupnumber, peernumber, real_data, real_len, message_id, packet_type);
@@ -3706,11 +4832,13 @@ static int handle_gc_lossless_message(Messenger *m, GC_Chat *chat, const uint8_t
     peernumber = get_peernum_of_enc_pk(chat, sender_pk);
 
     if (lossless_ret == 2 && peernumber != -1) {
-        gc_send_message_ack(chat, peernumber, message_id, 0);
         gcc_check_recv_ary(m, chat->groupnumber, peernumber);
 
+        if (gcc_ack_due(chat->gcc[peernumber], current_time_monotonic(chat->net->mono_time)))
+            gc_send_message_ack(chat, peernumber);
+
         if (direct_conn)
-            chat->gcc[peernumber].last_recv_direct_time = unix_time();
+            chat->gcc[peernumber]->last_recv_direct_time = unix_time(chat->net->mono_time);
     }
 
     return ret;
@@ -3734,7 +4862,7 @@ static int handle_gc_lossy_message(Messenger *m, GC_Chat *chat, const uint8_t *p
     if (!peernumber_valid(chat, peernumber))
         return -1;
 
-    GC_Connection *gconn = &chat->gcc[peernumber];
+    GC_Connection *gconn = chat->gcc[peernumber];
 
     if (!gconn->handshaked)
         return -1;
@@ -3742,7 +4870,7 @@ static int handle_gc_lossy_message(Messenger *m, GC_Chat *chat, const uint8_t *p
     uint8_t data[MAX_GC_PACKET_SIZE];
     uint8_t packet_type;
 
-    int len = unwrap_group_packet(gconn->shared_key, data, NULL, &packet_type, packet, length);
+    int len = unwrap_group_packet(gconn->shared_key, data, NULL, NULL, &packet_type, packet, length);
     if (len <= 0)
         return -1;
 
@@ -3776,7 +4904,7 @@ static int handle_gc_lossy_message(Messenger *m, GC_Chat *chat, const uint8_t *p
     }
 
     if (ret != -1 && direct_conn)
-        gconn->last_recv_direct_time = unix_time();
+        gconn->last_recv_direct_time = unix_time(chat->net->mono_time);
 
     return ret;
 }
@@ -3892,6 +5020,15 @@ void gc_callback_private_message(Messenger *m, void (*function)(Messenger *m, ui
     c->private_message_userdata = userdata;
 }
 
+void gc_callback_history_message(Messenger *m, void (*function)(Messenger *m, uint32_t, const uint8_t *,
+                                 const uint8_t *, size_t, unsigned int, uint64_t, const uint8_t *, size_t, void *),
+                                 void *userdata)
+{
+    GC_Session *c = m->group_handler;
+    c->history_message = function;
+    c->history_message_userdata = userdata;
+}
+
 void gc_callback_moderation(Messenger *m, void (*function)(Messenger *m, uint32_t, uint32_t, uint32_t, unsigned int,
                             void *), void *userdata)
 {
@@ -3982,6 +5119,36 @@ void gc_callback_rejected(Messenger *m, void (*function)(Messenger *m, uint32_t,
     c->rejected_userdata = userdata;
 }
 
+/* Resizes the group and gcc arrays of chat to hold capacity peers.
+ *
+ * Return 0 on success.
+ * Return -1 on failure.
+ */
+static int realloc_peer_list(GC_Chat *chat, uint32_t capacity)
+{
+    if (capacity < GC_MIN_PEERS_CAPACITY)
+        capacity = GC_MIN_PEERS_CAPACITY;
+
+    if (capacity < chat->numpeers || capacity == chat->peers_capacity)
+        return 0;
+
+    GC_GroupPeer *tmp_group = realloc(chat->group, sizeof(GC_GroupPeer) * capacity);
+
+    if (tmp_group == NULL)
+        return -1;
+
+    chat->group = tmp_group;
+
+    GC_Connection **tmp_gcc = realloc(chat->gcc, sizeof(GC_Connection *) * capacity);
+
+    if (tmp_gcc == NULL)
+        return -1;
+
+    chat->gcc = tmp_gcc;
+    chat->peers_capacity = capacity;
+    return 0;
+}
+
 /* Deletets peernumber from group.
  *
  * Return 0 on success.
@@ -4000,36 +5167,37 @@ int gc_peer_delete(Messenger *m, int groupnumber, uint32_t peernumber, const uin
         return -1;
 
     /* Needs to occur before peer is removed*/
-    if (c->peer_exit && chat->gcc[peernumber].confirmed)
+    if (c->peer_exit && chat->gcc[peernumber]->confirmed)
         (*c->peer_exit)(m, groupnumber, peernumber, data, length, c->peer_exit_userdata);
 
-    kill_tcp_connection_to(chat->tcp_conn, chat->gcc[peernumber].tcp_connection_num);
-    gca_peer_cleanup(m->group_handler->announce, CHAT_ID(chat->chat_public_key), chat->gcc[peernumber].addr.public_key);
-    gcc_peer_cleanup(&chat->gcc[peernumber]);
+    GC_Connection *gconn = chat->gcc[peernumber];
+
+    release_tcp_connection_to(chat->tcp_conn, gconn->tcp_connection_num, gconn->tcp_in_use);
+    gca_peer_cleanup(m->group_handler->announce, CHAT_ID(chat->chat_public_key), gconn->addr.public_key);
+    gcc_peer_cleanup(chat, gconn);
+
+    hash_index_remove(&chat->enc_pk_index, gconn->public_key_hash, gconn->handle);
+
+    if (gconn->has_sig_key)
+        hash_index_remove(&chat->sig_pk_index, get_peer_sig_key_hash(SIG_PK(gconn->addr.public_key)), gconn->handle);
+
+    gcc_free_connection(chat, gconn);
 
     --chat->numpeers;
 
+    /* The last peer takes the freed peernumber, only its connection pointer moves */
     if (chat->numpeers != peernumber) {
         memcpy(&chat->group[peernumber], &chat->group[chat->numpeers], sizeof(GC_GroupPeer));
-        memcpy(&chat->gcc[peernumber], &chat->gcc[chat->numpeers], sizeof(GC_Connection));
+        chat->gcc[peernumber] = chat->gcc[chat->numpeers];
+        chat->gcc[peernumber]->peernumber = peernumber;
     }
 
     memset(&chat->group[chat->numpeers], 0, sizeof(GC_GroupPeer));
-    memset(&chat->gcc[chat->numpeers], 0, sizeof(GC_Connection));
-
-    GC_GroupPeer *tmp_group = realloc(chat->group, sizeof(GC_GroupPeer) * chat->numpeers);
-
-    if (tmp_group == NULL)
-        return -1;
-
-    chat->group = tmp_group;
-
-    GC_Connection *tmp_gcc = realloc(chat->gcc, sizeof(GC_Connection) * chat->numpeers);
-
-    if (tmp_gcc == NULL)
-        return -1;
+    chat->gcc[chat->numpeers] = NULL;
 
-    chat->gcc = tmp_gcc;
+    /* Shrinking is only an optimization, the peer list stays valid if it fails */
+    if (chat->numpeers < chat->peers_capacity / 4)
+        realloc_peer_list(chat, chat->peers_capacity / 2);
 
     /* Needs to occur after peer is removed */
     if (c->peerlist_update)
@@ -4072,13 +5240,13 @@ static int peer_update(Messenger *m, int groupnumber, GC_GroupPeer *peer, uint32
     return peernumber;
 }
 
-/* Adds a new peer to groupnumber's peer list.
+/* Adds a new peer to groupnumber's peer list. Relayed peers get neither a TCP connection
+ * nor the buffers for lossless packets as we don't exchange packets with them.
  *
  * Return peernumber if success.
  * Return -1 on failure.
- * Returns -2 if a peer with public_key is already in our peerlist.
  */
-static int peer_add(Messenger *m, int groupnumber, IP_Port *ipp, const uint8_t *public_key)
+static int new_peer(Messenger *m, int groupnumber, IP_Port *ipp, const uint8_t *public_key, bool relayed)
 {
     GC_Session *c = m->group_handler;
     GC_Chat *chat = gc_get_group(c, groupnumber);
@@ -4086,41 +5254,42 @@ static int peer_add(Messenger *m, int groupnumber, IP_Port *ipp, const uint8_t *
     if (chat == NULL)
         return -1;
 
-    if (get_peernum_of_enc_pk(chat, public_key) != -1)
-        return -2;
-
     int tcp_connection_num = -1;
 
-    if (chat->numpeers > 0) {
-        tcp_connection_num = new_tcp_connection_to(chat->tcp_conn, public_key, 0);
+    if (chat->numpeers > 0 && !relayed) {
+        tcp_connection_num = share_tcp_connection_to(chat->tcp_conn, public_key, 0);
 
         if (tcp_connection_num == -1)
             return -1;
     }
 
-    GC_Connection *tmp_gcc = realloc(chat->gcc, sizeof(GC_Connection) * (chat->numpeers + 1));
-
-    if (tmp_gcc == NULL) {
-        kill_tcp_connection_to(chat->tcp_conn, tcp_connection_num);
+    /* Grow geometrically so that joins don't realloc every time */
+    if (chat->numpeers == chat->peers_capacity && realloc_peer_list(chat, chat->peers_capacity * 2) == -1) {
+        release_tcp_connection_to(chat->tcp_conn, tcp_connection_num, true);
         return -1;
     }
 
-    GC_GroupPeer *tmp_group = realloc(chat->group, sizeof(GC_GroupPeer) * (chat->numpeers + 1));
+    int peernumber = chat->numpeers;
+    GC_Connection *gconn = gcc_new_connection(chat, peernumber);
 
-    if (tmp_group == NULL) {
-        kill_tcp_connection_to(chat->tcp_conn, tcp_connection_num);
+    if (gconn == NULL) {
+        release_tcp_connection_to(chat->tcp_conn, tcp_connection_num, true);
         return -1;
     }
 
-    int peernumber = chat->numpeers++;
-
-    memset(&tmp_group[peernumber], 0, sizeof(GC_GroupPeer));
-    memset(&tmp_gcc[peernumber], 0, sizeof(GC_Connection));
+    gconn->public_key_hash = get_peer_key_hash(public_key);
 
-    chat->gcc = tmp_gcc;
-    chat->group = tmp_group;
+    if ((!relayed && gcc_init_buffers(gconn) == -1)
+            || hash_index_add(&chat->enc_pk_index, gconn->public_key_hash, gconn->handle) == -1) {
+        gcc_peer_cleanup(chat, gconn);
+        gcc_free_connection(chat, gconn);
+        release_tcp_connection_to(chat->tcp_conn, tcp_connection_num, true);
+        return -1;
+    }
 
-    GC_Connection *gconn = &chat->gcc[peernumber];
+    ++chat->numpeers;
+    memset(&chat->group[peernumber], 0, sizeof(GC_GroupPeer));
+    chat->gcc[peernumber] = gconn;
 
     if (ipp)
         ipport_copy(&gconn->addr.ip_port, ipp);
@@ -4128,13 +5297,15 @@ static int peer_add(Messenger *m, int groupnumber, IP_Port *ipp, const uint8_t *
     chat->group[peernumber].role = GR_INVALID;
     crypto_box_keypair(gconn->session_public_key, gconn->session_secret_key);
     memcpy(gconn->addr.public_key, public_key, ENC_PUBLIC_KEY);  /* we get the sig key in the handshake */
-    gconn->public_key_hash = get_peer_key_hash(public_key);
-    gconn->last_rcvd_ping = unix_time();
-    gconn->time_added = unix_time();
+    gconn->last_rcvd_ping = unix_time(chat->net->mono_time);
+    gconn->time_added = unix_time(chat->net->mono_time);
     gconn->send_message_id = 1;
     gconn->send_ary_start = 1;
     gconn->recv_message_id = 0;
+    gconn->rto = GCC_INITIAL_RTO;
     gconn->tcp_connection_num = tcp_connection_num;
+    gconn->tcp_in_use = tcp_connection_num != -1;
+    gconn->relayed = relayed;
 
     if (c->peerlist_update)
         (*c->peerlist_update)(m, groupnumber, c->peerlist_update_userdata);
@@ -4142,6 +5313,112 @@ static int peer_add(Messenger *m, int groupnumber, IP_Port *ipp, const uint8_t *
     return peernumber;
 }
 
+/* Makes the relayed peer peernumber one of our neighbours so that we can handshake with it.
+ * Its info and role stay as we got them from its broadcasts until the peer info exchange.
+ *
+ * Return peernumber on success.
+ * Return -1 on failure.
+ */
+static int connect_relayed_peer(GC_Chat *chat, uint32_t peernumber, IP_Port *ipp)
+{
+    GC_Connection *gconn = chat->gcc[peernumber];
+    int tcp_connection_num = share_tcp_connection_to(chat->tcp_conn, gconn->addr.public_key, 0);
+
+    if (tcp_connection_num == -1)
+        return -1;
+
+    if (gcc_init_buffers(gconn) == -1) {
+        release_tcp_connection_to(chat->tcp_conn, tcp_connection_num, true);
+        return -1;
+    }
+
+    if (ipp)
+        ipport_copy(&gconn->addr.ip_port, ipp);
+
+    crypto_box_keypair(gconn->session_public_key, gconn->session_secret_key);
+    gconn->last_rcvd_ping = unix_time(chat->net->mono_time);
+    gconn->send_message_id = 1;
+    gconn->send_ary_start = 1;
+    gconn->send_acked_id = 0;
+    gconn->recv_message_id = 0;
+    gconn->recv_highest_id = 0;
+    gconn->acks_owed = 0;
+    gconn->rtt = 0;
+    gconn->rtt_var = 0;
+    gconn->rto = GCC_INITIAL_RTO;
+    gconn->tcp_connection_num = tcp_connection_num;
+    gconn->tcp_in_use = true;
+    gconn->relayed = false;
+
+    return peernumber;
+}
+
+/* Stops connecting to peernumber directly and goes back to hearing from it through our neighbours,
+ * used when a relayed peer we tried to connect to doesn't take us as a neighbour.
+ */
+static void disconnect_relayed_peer(GC_Chat *chat, uint32_t peernumber)
+{
+    GC_Connection *gconn = chat->gcc[peernumber];
+
+    release_tcp_connection_to(chat->tcp_conn, gconn->tcp_connection_num, gconn->tcp_in_use);
+    gcc_free_buffers(chat, gconn);
+    gconn->tcp_connection_num = -1;
+    gconn->handshaked = false;
+    gconn->relayed = true;
+    gconn->last_rcvd_ping = unix_time(chat->net->mono_time);
+}
+
+/* Adds a new peer to groupnumber's peer list, or connects to it if we only knew it from
+ * its relayed broadcasts.
+ *
+ * Return peernumber if success.
+ * Return -1 on failure.
+ * Returns -2 if a peer with public_key is already in our peerlist.
+ */
+static int peer_add(Messenger *m, int groupnumber, IP_Port *ipp, const uint8_t *public_key)
+{
+    GC_Chat *chat = gc_get_group(m->group_handler, groupnumber);
+
+    if (chat == NULL)
+        return -1;
+
+    int peernumber = get_peernum_of_enc_pk(chat, public_key);
+
+    if (peernumber == -1)
+        return new_peer(m, groupnumber, ipp, public_key, false);
+
+    if (chat->gcc[peernumber]->relayed)
+        return connect_relayed_peer(chat, peernumber, ipp);
+
+    return -2;
+}
+
+/* Adds the peer with the extended public_key, whose broadcasts reach us through our neighbours,
+ * to groupnumber's peer list. The peer is confirmed once its info is validated.
+ *
+ * Return peernumber on success.
+ * Return -1 on failure.
+ */
+static int relayed_peer_add(Messenger *m, int groupnumber, const uint8_t *public_key)
+{
+    GC_Chat *chat = gc_get_group(m->group_handler, groupnumber);
+
+    if (chat == NULL)
+        return -1;
+
+    int peernumber = new_peer(m, groupnumber, NULL, public_key, true);
+
+    if (peernumber == -1)
+        return -1;
+
+    if (set_peer_sig_key(chat, chat->gcc[peernumber], SIG_PK(public_key)) == -1) {
+        gc_peer_delete(m, groupnumber, peernumber, NULL, 0);
+        return -1;
+    }
+
+    return peernumber;
+}
+
 /* Copies own peer data to peer */
 static void self_to_peer(const GC_Session *c, const GC_Chat *chat, GC_GroupPeer *peer)
 {
@@ -4157,7 +5434,7 @@ static void self_to_peer(const GC_Session *c, const GC_Chat *chat, GC_GroupPeer
  */
 static bool peer_timed_out(const GC_Chat *chat, uint32_t peernumber)
 {
-    return is_timeout(chat->gcc[peernumber].last_rcvd_ping, chat->gcc[peernumber].confirmed
+    return is_timeout(chat->net->mono_time, chat->gcc[peernumber]->last_rcvd_ping, chat->gcc[peernumber]->confirmed
                                                             ? GC_CONFIRMED_PEER_TIMEOUT
                                                             : GC_UNCONFRIMED_PEER_TIMEOUT);
 }
@@ -4169,17 +5446,40 @@ static void do_peer_connections(Messenger *m, int groupnumber)
     if (chat == NULL)
         return;
 
+    uint64_t tm = current_time_monotonic(chat->net->mono_time);
     uint32_t i;
 
     for (i = 1; i < chat->numpeers; ++i) {
-        if (chat->gcc[i].confirmed) {
-            if (is_timeout(chat->gcc[i].last_tcp_relays_shared, GCC_TCP_SHARED_RELAYS_TIMEOUT))
+        /* We hear from relayed peers through their announcements */
+        if (chat->gcc[i]->relayed) {
+            if (is_timeout(chat->net->mono_time, chat->gcc[i]->last_rcvd_ping, GC_OVERLAY_PEER_TIMEOUT))
+                gc_peer_delete(m, groupnumber, i, (uint8_t *) "Timed out", 9);
+
+            if (i >= chat->numpeers)
+                break;
+
+            continue;
+        }
+
+        if (peer_is_connected(chat, i)) {
+            if (is_timeout(chat->net->mono_time, chat->gcc[i]->last_tcp_relays_shared, GCC_TCP_SHARED_RELAYS_TIMEOUT))
                 send_gc_tcp_relays(chat, i);
         }
 
+        /* A relayed peer we tried to connect to that didn't answer our handshake */
+        if (chat->gcc[i]->confirmed && !chat->gcc[i]->handshaked
+                && is_timeout(chat->net->mono_time, chat->gcc[i]->last_rcvd_ping, GC_UNCONFRIMED_PEER_TIMEOUT)) {
+            disconnect_relayed_peer(chat, i);
+            continue;
+        }
+
         if (peer_timed_out(chat, i)) {
             gc_peer_delete(m, groupnumber, i, (uint8_t *) "Timed out", 9);
         } else {
+            /* acks that no other packet carried in time */
+            if (gcc_ack_due(chat->gcc[i], tm))
+                gc_send_message_ack(chat, i);
+
             gcc_resend_packets(m, chat, i);   // This function may delete the peer
         }
 
@@ -4189,14 +5489,14 @@ static void do_peer_connections(Messenger *m, int groupnumber)
 }
 
 /* Ping packet includes your confirmed peer count, shared state version
- * and sanctions list version for syncing purposes
+ * and sanctions list version for syncing purposes, and your ack for the peer
  */
 static void ping_group(GC_Chat *chat)
 {
-    if (!is_timeout(chat->last_sent_ping_time, GC_PING_INTERVAL))
+    if (!is_timeout(chat->net->mono_time, chat->last_sent_ping_time, GC_PING_INTERVAL))
         return;
 
-    uint32_t length = HASH_ID_BYTES + GC_PING_PACKET_DATA_SIZE;
+    uint32_t length = HASH_ID_BYTES + GC_PING_PACKET_ACK_SIZE;
     uint8_t data[length];
 
     uint32_t num_confirmed_peers = get_gc_confirmed_numpeers(chat);
@@ -4208,11 +5508,53 @@ static void ping_group(GC_Chat *chat)
     uint32_t i;
 
     for (i = 1; i < chat->numpeers; ++i) {
-        if (chat->gcc[i].confirmed)
-            send_lossy_group_packet(chat, i, data, length, GP_PING);
+        GC_Connection *gconn = chat->gcc[i];
+
+        if (!peer_is_connected(chat, i))
+            continue;
+
+        U64_to_bytes(data + HASH_ID_BYTES + GC_PING_PACKET_DATA_SIZE, gconn->recv_message_id);
+
+        if (send_lossy_group_packet(chat, i, data, length, GP_PING) == 0)
+            gcc_ack_sent(gconn, gconn->recv_message_id);
+    }
+
+    chat->last_sent_ping_time = unix_time(chat->net->mono_time);
+}
+
+/* Keeps us part of an overlay group: announces us to the group periodically and connects to relayed
+ * peers while we have fewer neighbours than we look for. Peers of full mesh groups connect to all the
+ * relayed peers left from the time the group was an overlay.
+ */
+static void do_gc_overlay(GC_Session *c, GC_Chat *chat)
+{
+    bool overlay = chat->shared_state.topology == GT_OVERLAY;
+
+    /* The first announcement waits until we have a neighbour to relay it */
+    if (overlay && (chat->last_overlay_announce == 0 ? get_gc_confirmed_numpeers(chat) > 1
+                    : is_timeout(chat->net->mono_time, chat->last_overlay_announce, GC_OVERLAY_ANNOUNCE_INTERVAL))) {
+        send_gc_self_announce(c, chat);
+        chat->last_overlay_announce = unix_time(chat->net->mono_time);
     }
 
-    chat->last_sent_ping_time = unix_time();
+    if (gc_overlay_full(chat) || !is_timeout(chat->net->mono_time, chat->last_overlay_connect, GC_PING_INTERVAL))
+        return;
+
+    chat->last_overlay_connect = unix_time(chat->net->mono_time);
+
+    uint32_t i, j, connects = overlay ? 1 : GC_OVERLAY_NEIGHBOURS;
+    uint32_t start = random_int() % chat->numpeers;
+
+    for (j = 0; j < chat->numpeers && connects > 0; ++j) {
+        i = (start + j) % chat->numpeers;
+
+        if (i == 0 || !chat->gcc[i]->relayed || !peer_addr_known(chat, i))
+            continue;
+
+        send_gc_handshake_request(c->messenger, chat->groupnumber, chat->gcc[i]->addr.ip_port,
+                                  chat->gcc[i]->addr.public_key, HS_PEER_INFO_EXCHANGE, chat->join_type);
+        --connects;
+    }
 }
 
 /* Searches the DHT for nodes belonging to the group periodically in case of a split group.
@@ -4221,10 +5563,10 @@ static void ping_group(GC_Chat *chat)
 #define GROUP_SEARCH_ANNOUNCE_INTERVAL 300
 static void search_gc_announce(GC_Session *c, GC_Chat *chat)
 {
-    if (!is_timeout(chat->announce_search_timer, GROUP_SEARCH_ANNOUNCE_INTERVAL))
+    if (!is_timeout(chat->net->mono_time, chat->announce_search_timer, GROUP_SEARCH_ANNOUNCE_INTERVAL))
         return;
 
-    chat->announce_search_timer = unix_time();
+    chat->announce_search_timer = unix_time(chat->net->mono_time);
     uint32_t cnumpeers = get_gc_confirmed_numpeers(chat);
 
     if (random_int_range(cnumpeers) == 0) {
@@ -4238,7 +5580,7 @@ static void do_new_connection_cooldown(GC_Chat *chat)
     if (chat->connection_O_metre == 0)
         return;
 
-    uint64_t tm = unix_time();
+    uint64_t tm = unix_time(chat->net->mono_time);
 
     if (chat->connection_cooldown_timer < tm) {
         chat->connection_cooldown_timer = tm;
@@ -4255,14 +5597,21 @@ static void do_group_tcp(GC_Chat *chat)
     if (!chat->tcp_conn)
         return;
 
-    do_tcp_connections(chat->tcp_conn);
+    /* The session's connections are done once for all the groups that share them */
+    if (!chat->shared_tcp)
+        do_tcp_connections(chat->tcp_conn);
 
     uint32_t i;
 
     for (i = 1; i < chat->numpeers; ++i) {
-        GC_Connection *gconn = &chat->gcc[i];
-        bool tcp_set = gcc_connection_is_direct(gconn) ? false : true;
-        set_tcp_connection_to_status(chat->tcp_conn, gconn->tcp_connection_num, tcp_set);
+        GC_Connection *gconn = chat->gcc[i];
+        bool tcp_set = gcc_connection_is_direct(chat->net->mono_time, gconn) ? false : true;
+
+        if (gconn->tcp_connection_num == -1 || gconn->tcp_in_use == tcp_set)
+            continue;
+
+        if (use_tcp_connection_to(chat->tcp_conn, gconn->tcp_connection_num, tcp_set) == 0)
+            gconn->tcp_in_use = tcp_set;
     }
 }
 
@@ -4280,9 +5629,15 @@ void do_gc(GC_Session *c)
     if (!c)
         return;
 
-    uint32_t i;
+    if (c->tcp_conn)
+        do_tcp_connections(c->tcp_conn);
 
-    for (i = 0; i < c->num_chats; ++i) {
+    /* Groups that share relay connections take turns at going first so that none of them
+     * gets the room left in the relays' send queues every time */
+    uint32_t n, start = c->next_chat_turn++;
+
+    for (n = 0; n < c->num_chats; ++n) {
+        uint32_t i = (start + n) % c->num_chats;
         GC_Chat *chat = &c->chats[i];
 
         if (!chat)
@@ -4293,8 +5648,10 @@ void do_gc(GC_Session *c)
         switch (chat->connection_state) {
             case CS_CONNECTED: {
                 ping_group(chat);
+                do_gc_overlay(c, chat);
                 do_peer_connections(c->messenger, i);
                 do_new_connection_cooldown(chat);
+                do_gc_history_sync(chat);
                 search_gc_announce(c, chat);
                 break;
             }
@@ -4314,9 +5671,9 @@ void do_gc(GC_Session *c)
                     break;
                 }
 
-                if (is_timeout(chat->last_get_nodes_attempt, GROUP_GET_NEW_NODES_INTERVAL)) {
+                if (is_timeout(chat->net->mono_time, chat->last_get_nodes_attempt, GROUP_GET_NEW_NODES_INTERVAL)) {
                     ++chat->get_nodes_attempts;
-                    chat->last_get_nodes_attempt = unix_time();
+                    chat->last_get_nodes_attempt = unix_time(chat->net->mono_time);
                     group_get_nodes_request(c, chat);
                 }
 
@@ -4325,12 +5682,13 @@ void do_gc(GC_Session *c)
             }
 
             case CS_DISCONNECTED: {
-                if (chat->num_addrs && is_timeout(chat->last_join_attempt, GROUP_JOIN_ATTEMPT_INTERVAL)) {
+                if (chat->num_addrs
+                        && is_timeout(chat->net->mono_time, chat->last_join_attempt, GROUP_JOIN_ATTEMPT_INTERVAL)) {
                     send_gc_handshake_request(c->messenger, i, chat->addr_list[chat->addrs_idx].ip_port,
                                               chat->addr_list[chat->addrs_idx].public_key, HS_INVITE_REQUEST,
                                               chat->join_type);
 
-                    chat->last_join_attempt = unix_time();
+                    chat->last_join_attempt = unix_time(chat->net->mono_time);
                     chat->addrs_idx = (chat->addrs_idx + 1) % chat->num_addrs;
                 }
 
@@ -4377,8 +5735,10 @@ static int get_new_group_index(GC_Session *c)
     uint32_t i;
 
     for (i = 0; i < c->num_chats; ++i) {
-        if (c->chats[i].connection_state == CS_NONE)
+        if (c->chats[i].connection_state == CS_NONE) {
+            c->chats[i].recv_arena.budget = &c->recv_budget;
             return i;
+        }
     }
 
     if (realloc_groupchats(c, c->num_chats + 1) != 0)
@@ -4386,19 +5746,80 @@ static int get_new_group_index(GC_Session *c)
 
     int new_index = c->num_chats;
     memset(&(c->chats[new_index]), 0, sizeof(GC_Chat));
+    c->chats[new_index].recv_arena.budget = &c->recv_budget;
 
     ++c->num_chats;
 
     return new_index;
 }
 
-static int init_gc_tcp_connection(Messenger *m, GC_Chat *chat)
+#define GC_TCP_KEY_CONTEXT "tox group relay key"
+
+/* Makes our group key, which groups created with Messenger_Options.shared_group_key set use as
+ * their encryption key so that a single connection to each relay serves all of them. It comes
+ * from our long term secret key so that it stays the same across sessions, while peers can't
+ * tell our Tox ID from it.
+ */
+static void make_gc_group_key(GC_Session *c)
 {
-    chat->tcp_conn = new_tcp_connections(chat->self_secret_key, &m->options.proxy_info);
+    uint8_t data[ENC_SECRET_KEY + sizeof(GC_TCP_KEY_CONTEXT)];
+    memcpy(data, c->messenger->net_crypto->self_secret_key, ENC_SECRET_KEY);
+    memcpy(data + ENC_SECRET_KEY, GC_TCP_KEY_CONTEXT, sizeof(GC_TCP_KEY_CONTEXT));
+    crypto_hash_sha256(c->tcp_secret_key, data, sizeof(data));
+    crypto_scalarmult_curve25519_base(c->tcp_public_key, c->tcp_secret_key);
+}
 
-    if (chat->tcp_conn == NULL)
+/* Makes the relay connections of the session, which the groups that use our group key share.
+ *
+ * Return 0 on success.
+ * Return -1 on failure.
+ */
+static int init_gc_session_tcp(GC_Session *c)
+{
+    if (c->tcp_conn)
+        return 0;
+
+    Messenger *m = c->messenger;
+    make_gc_group_key(c);
+
+    c->tcp_conn = new_tcp_connections(m->net->mono_time, c->tcp_secret_key, &m->options.proxy_info);
+
+    if (c->tcp_conn == NULL)
         return -1;
 
+    set_packet_tcp_connection_callback(c->tcp_conn, &handle_gc_tcp_packet, m);
+    set_oob_packet_tcp_connection_callback(c->tcp_conn, &handle_gc_tcp_oob_packet, m);
+    return 0;
+}
+
+/* Sets up the relay connections of chat once its keys are set. Groups whose encryption key is
+ * our group key use the session's, also when loaded with shared_group_key unset, as relays take
+ * only one connection per key. Others get connections of their own.
+ *
+ * Return 0 on success.
+ * Return -1 on failure.
+ */
+static int init_gc_tcp_connection(Messenger *m, GC_Chat *chat)
+{
+    GC_Session *c = m->group_handler;
+
+    if (c->tcp_conn == NULL)
+        make_gc_group_key(c);
+
+    if (memcmp(chat->self_secret_key, c->tcp_secret_key, ENC_SECRET_KEY) == 0 && init_gc_session_tcp(c) == 0) {
+        chat->tcp_conn = c->tcp_conn;
+        chat->shared_tcp = true;
+    } else {
+        chat->tcp_conn = new_tcp_connections(m->net->mono_time, chat->self_secret_key, &m->options.proxy_info);
+
+        if (chat->tcp_conn == NULL)
+            return -1;
+
+        chat->shared_tcp = false;
+        set_packet_tcp_connection_callback(chat->tcp_conn, &handle_gc_tcp_packet, m);
+        set_oob_packet_tcp_connection_callback(chat->tcp_conn, &handle_gc_tcp_oob_packet, m);
+    }
+
     uint16_t num_relays = m->net_crypto->tcp_c->tcp_connections_length;
     Node_format tcp_relays[num_relays];
     unsigned int i, num = tcp_copy_connected_relays(m->net_crypto->tcp_c, tcp_relays, num_relays);
@@ -4406,11 +5827,34 @@ static int init_gc_tcp_connection(Messenger *m, GC_Chat *chat)
     for (i = 0; i < num; ++i)
         add_tcp_relay_global(chat->tcp_conn, tcp_relays[i].ip_port, tcp_relays[i].public_key);
 
-    set_packet_tcp_connection_callback(chat->tcp_conn, &handle_gc_tcp_packet, m);
-    set_oob_packet_tcp_connection_callback(chat->tcp_conn, &handle_gc_tcp_oob_packet, m);
     return 0;
 }
 
+/* Lets go of the relay connections of chat: the ones to its peers if it shares the session's,
+ * all of them if it has its own.
+ */
+static void kill_gc_tcp_connection(GC_Chat *chat)
+{
+    if (chat->tcp_conn == NULL)
+        return;
+
+    if (!chat->shared_tcp) {
+        kill_tcp_connections(chat->tcp_conn);
+        chat->tcp_conn = NULL;
+        return;
+    }
+
+    uint32_t i;
+
+    for (i = 1; i < chat->numpeers; ++i) {
+        GC_Connection *gconn = chat->gcc[i];
+        release_tcp_connection_to(chat->tcp_conn, gconn->tcp_connection_num, gconn->tcp_in_use);
+        gconn->tcp_connection_num = -1;
+    }
+
+    chat->tcp_conn = NULL;
+}
+
 static int create_new_group(GC_Session *c, bool founder)
 {
     int groupnumber = get_new_group_index(c);
@@ -4421,22 +5865,29 @@ static int create_new_group(GC_Session *c, bool founder)
     Messenger *m = c->messenger;
     GC_Chat *chat = &c->chats[groupnumber];
 
+    chat->groupnumber = groupnumber;
     create_extended_keypair(chat->self_public_key, chat->self_secret_key);
 
+    /* Sharing the key links our groups together for peers and relays, so it's opt-in */
+    if (m->options.shared_group_key && init_gc_session_tcp(c) == 0) {
+        memcpy(ENC_KEY(chat->self_public_key), c->tcp_public_key, ENC_PUBLIC_KEY);
+        memcpy(ENC_KEY(chat->self_secret_key), c->tcp_secret_key, ENC_SECRET_KEY);
+    }
+
     if (init_gc_tcp_connection(m, chat) == -1) {
         group_delete(c, chat);
         return -1;
     }
 
-    chat->groupnumber = groupnumber;
     chat->numpeers = 0;
     chat->connection_state = CS_DISCONNECTED;
     chat->net = m->net;
     memcpy(chat->topic, " ", 1);
     chat->topic_len = 1;
-    chat->last_get_nodes_attempt = unix_time();
-    chat->last_sent_ping_time = unix_time();
-    chat->announce_search_timer = unix_time();
+    chat->last_get_nodes_attempt = unix_time(chat->net->mono_time);
+    chat->last_sent_ping_time = unix_time(chat->net->mono_time);
+    chat->announce_search_timer = unix_time(chat->net->mono_time);
+    chat->gossip_seq = GC_GOSSIP_FIRST_SEQ(unix_time(chat->net->mono_time));
 
     if (peer_add(m, groupnumber, NULL, chat->self_public_key) != 0) {    /* you are always peernumber/index 0 */
         group_delete(c, chat);
@@ -4447,9 +5898,13 @@ static int create_new_group(GC_Session *c, bool founder)
     chat->group[0].nick_len = m->name_length;
     chat->group[0].status = m->userstatus;
     chat->group[0].role = founder ? GR_FOUNDER : GR_USER;
-    chat->gcc[0].confirmed = true;
-    chat->self_public_key_hash = chat->gcc[0].public_key_hash;
-    memcpy(chat->gcc[0].addr.public_key, chat->self_public_key, EXT_PUBLIC_KEY);
+    chat->gcc[0]->confirmed = true;
+    chat->self_public_key_hash = chat->gcc[0]->public_key_hash;
+
+    if (set_peer_sig_key(chat, chat->gcc[0], SIG_PK(chat->self_public_key)) == -1) {
+        group_delete(c, chat);
+        return -1;
+    }
 
     return groupnumber;
 }
@@ -4496,13 +5951,9 @@ int gc_group_load(GC_Session *c, struct SAVED_GROUP *save)
     if (groupnumber == -1)
         return -1;
 
-    uint64_t tm = unix_time();
-
     Messenger *m = c->messenger;
     GC_Chat *chat = &c->chats[groupnumber];
-
-    if (init_gc_tcp_connection(m, chat) == -1)
-        return -1;
+    uint64_t tm = unix_time(m->net->mono_time);
 
     chat->groupnumber = groupnumber;
     chat->numpeers = 0;
@@ -4512,11 +5963,13 @@ int gc_group_load(GC_Session *c, struct SAVED_GROUP *save)
     chat->last_get_nodes_attempt = tm;
     chat->last_sent_ping_time = tm;
     chat->announce_search_timer = tm;
+    chat->gossip_seq = GC_GOSSIP_FIRST_SEQ(tm);
 
     memcpy(chat->shared_state.founder_public_key, save->founder_public_key, EXT_PUBLIC_KEY);
     chat->shared_state.group_name_len = ntohs(save->group_name_len);
     memcpy(chat->shared_state.group_name, save->group_name, MAX_GC_GROUP_NAME_SIZE);
     chat->shared_state.privacy_state = save->privacy_state;
+    chat->shared_state.topology = save->topology;
     chat->shared_state.maxpeers = ntohs(save->maxpeers);
     chat->shared_state.passwd_len = ntohs(save->passwd_len);
     memcpy(chat->shared_state.passwd, save->passwd, MAX_GC_PASSWD_SIZE);
@@ -4535,7 +5988,13 @@ int gc_group_load(GC_Session *c, struct SAVED_GROUP *save)
 
     memcpy(chat->self_public_key, save->self_public_key, EXT_PUBLIC_KEY);
     memcpy(chat->self_secret_key, save->self_secret_key, EXT_SECRET_KEY);
-    chat->chat_id_hash = get_chat_id_hash(CHAT_ID(chat->chat_public_key));
+
+    if (init_gc_tcp_connection(m, chat) == -1)
+        return -1;
+
+    if (set_chat_id_hash(c, chat) == -1)
+        return -1;
+
     chat->self_public_key_hash = get_peer_key_hash(chat->self_public_key);
 
     if (peer_add(m, groupnumber, NULL, save->self_public_key) != 0)
@@ -4545,8 +6004,10 @@ int gc_group_load(GC_Session *c, struct SAVED_GROUP *save)
     chat->group[0].nick_len = ntohs(save->self_nick_len);
     chat->group[0].role = save->self_role;
     chat->group[0].status = save->self_status;
-    chat->gcc[0].confirmed = true;
-    memcpy(chat->gcc[0].addr.public_key, chat->self_public_key, EXT_PUBLIC_KEY);
+    chat->gcc[0]->confirmed = true;
+
+    if (set_peer_sig_key(chat, chat->gcc[0], SIG_PK(chat->self_public_key)) == -1)
+        return -1;
 
     if (save->self_role == GR_FOUNDER) {
         if (init_gc_shared_state(chat, save->privacy_state, save->group_name, chat->shared_state.group_name_len) == -1)
@@ -4611,7 +6072,11 @@ int gc_group_add(GC_Session *c, uint8_t privacy_state, const uint8_t *group_name
         return -5;
     }
 
-    chat->chat_id_hash = get_chat_id_hash(CHAT_ID(chat->chat_public_key));
+    if (set_chat_id_hash(c, chat) == -1) {
+        group_delete(c, chat);
+        return -4;
+    }
+
     chat->join_type = HJ_PRIVATE;
     self_gc_connected(chat);
 
@@ -4648,7 +6113,12 @@ int gc_group_join(GC_Session *c, const uint8_t *chat_id, const uint8_t *passwd,
         return -2;
 
     expand_chat_id(chat->chat_public_key, chat_id);
-    chat->chat_id_hash = get_chat_id_hash(CHAT_ID(chat->chat_public_key));
+
+    if (set_chat_id_hash(c, chat) == -1) {
+        group_delete(c, chat);
+        return -1;
+    }
+
     chat->join_type = HJ_PUBLIC;
 
     if (passwd != NULL && passwd_len > 0) {
@@ -4678,10 +6148,11 @@ void gc_rejoin_group(GC_Session *c, GC_Chat *chat)
             break;
 
     chat->connection_state = CS_DISCONNECTED;
-    chat->last_get_nodes_attempt = chat->num_addrs > 0 ? unix_time() : 0;  /* Reconnect using saved peers or DHT */
-    chat->last_sent_ping_time = unix_time();
-    chat->last_join_attempt = unix_time();
-    chat->announce_search_timer = unix_time();
+    /* Reconnect using saved peers or DHT */
+    chat->last_get_nodes_attempt = chat->num_addrs > 0 ? unix_time(chat->net->mono_time) : 0;
+    chat->last_sent_ping_time = unix_time(chat->net->mono_time);
+    chat->last_join_attempt = unix_time(chat->net->mono_time);
+    chat->announce_search_timer = unix_time(chat->net->mono_time);
     chat->get_nodes_attempts = 0;
 }
 
@@ -4749,9 +6220,12 @@ int gc_accept_invite(GC_Session *c, const uint8_t *data, uint16_t length, const
         goto on_error;
 
     expand_chat_id(chat->chat_public_key, chat_id);
-    chat->chat_id_hash = get_chat_id_hash(CHAT_ID(chat->chat_public_key));
+
+    if (set_chat_id_hash(c, chat) == -1)
+        goto on_error;
+
     chat->join_type = HJ_PRIVATE;
-    chat->last_join_attempt = unix_time();
+    chat->last_join_attempt = unix_time(chat->net->mono_time);
 
     if (passwd != NULL && passwd_len > 0) {
         err = -3;
@@ -4782,15 +6256,64 @@ GC_Session *new_groupchats(Messenger* m)
 
     c->messenger = m;
     c->announce = m->group_announce;
-
-    networking_registerhandler(m->net, NET_PACKET_GC_LOSSLESS, &handle_gc_udp_packet, m);
-    networking_registerhandler(m->net, NET_PACKET_GC_LOSSY, &handle_gc_udp_packet, m);
-    networking_registerhandler(m->net, NET_PACKET_GC_HANDSHAKE, &handle_gc_udp_packet, m);
-    group_callback_update_addresses(c->announce, update_gc_addresses_cb, c);
+    c->recv_budget.limit = GC_RECV_BUDGET_DEFAULT;
+
+    /* The packets and announces of the accounts of a host are handed out by new_groupchats_host() */
+    if (!m->host) {
+        networking_registerhandler(m->net, NET_PACKET_GC_LOSSLESS, &handle_gc_udp_packet, m);
+        networking_registerhandler(m->net, NET_PACKET_GC_LOSSY, &handle_gc_udp_packet, m);
+        networking_registerhandler(m->net, NET_PACKET_GC_HANDSHAKE, &handle_gc_udp_packet, m);
+        group_callback_update_addresses(c->announce, update_gc_addresses_cb, c);
+    }
 
     return c;
 }
 
+/* Hands the group packets of the shared socket to the account in the group they are for. */
+static int handle_gc_host_udp_packet(void *object, IP_Port ipp, const uint8_t *packet, uint16_t length)
+{
+    if (length <= 1 + sizeof(uint32_t))
+        return -1;
+
+    uint32_t chat_id_hash;
+    bytes_to_U32(&chat_id_hash, packet + 1);
+
+    Messenger_Host *host = object;
+    uint32_t i;
+
+    for (i = 0; i < host->num_accounts; ++i) {
+        if (get_chat_by_hash(host->accounts[i]->group_handler, chat_id_hash))
+            return handle_gc_udp_packet(host->accounts[i], ipp, packet, length);
+    }
+
+    return -1;
+}
+
+static void update_gc_host_addresses_cb(GC_Announce *announce, const uint8_t *chat_id, void *object)
+{
+    Messenger_Host *host = object;
+    uint32_t i;
+
+    for (i = 0; i < host->num_accounts; ++i)
+        update_gc_addresses_cb(announce, chat_id, host->accounts[i]->group_handler);
+}
+
+void new_groupchats_host(Messenger_Host *host)
+{
+    networking_registerhandler(host->net, NET_PACKET_GC_LOSSLESS, &handle_gc_host_udp_packet, host);
+    networking_registerhandler(host->net, NET_PACKET_GC_LOSSY, &handle_gc_host_udp_packet, host);
+    networking_registerhandler(host->net, NET_PACKET_GC_HANDSHAKE, &handle_gc_host_udp_packet, host);
+    group_callback_update_addresses(host->group_announce, update_gc_host_addresses_cb, host);
+}
+
+void kill_groupchats_host(Messenger_Host *host)
+{
+    networking_registerhandler(host->net, NET_PACKET_GC_LOSSY, NULL, NULL);
+    networking_registerhandler(host->net, NET_PACKET_GC_LOSSLESS, NULL, NULL);
+    networking_registerhandler(host->net, NET_PACKET_GC_HANDSHAKE, NULL, NULL);
+    group_callback_update_addresses(host->group_announce, NULL, NULL);
+}
+
 /* Deletes chat from group chat array and cleans up.
  *
  * Return 0 on success.
@@ -4803,9 +6326,13 @@ static int group_delete(GC_Session* c, GC_Chat *chat)
 
     mod_list_cleanup(chat);
     sanctions_list_cleanup(chat);
-    kill_tcp_connections(chat->tcp_conn);
+    sanctions_cache_cleanup(chat);
+    kill_gc_tcp_connection(chat);
     gca_cleanup(c->announce, CHAT_ID(chat->chat_public_key));
     gcc_cleanup(chat);
+    gc_gossip_cache_free(&chat->gossip_cache);
+    gc_history_close(chat->history);
+    hash_index_remove(&c->chat_index, chat->chat_id_hash, chat->groupnumber);
 
     if (chat->group)
         free(chat->group);
@@ -4854,18 +6381,87 @@ void kill_groupchats(GC_Session *c)
         if (c->chats[i].connection_state != CS_NONE) {
             GC_Chat *chat = &c->chats[i];
             send_gc_self_exit(chat, NULL, 0);
-            kill_tcp_connections(chat->tcp_conn);
+            kill_gc_tcp_connection(chat);
+            gc_history_close(chat->history);
         }
     }
 
-    networking_registerhandler(c->messenger->net, NET_PACKET_GC_LOSSY, NULL, NULL);
-    networking_registerhandler(c->messenger->net, NET_PACKET_GC_LOSSLESS, NULL, NULL);
-    networking_registerhandler(c->messenger->net, NET_PACKET_GC_HANDSHAKE, NULL, NULL);
-    group_callback_update_addresses(c->announce, NULL, NULL);
-    kill_gca(c->announce);
+    if (c->tcp_conn)
+        kill_tcp_connections(c->tcp_conn);
+
+    /* The announces of the accounts of a host are its own */
+    if (!c->messenger->host) {
+        networking_registerhandler(c->messenger->net, NET_PACKET_GC_LOSSY, NULL, NULL);
+        networking_registerhandler(c->messenger->net, NET_PACKET_GC_LOSSLESS, NULL, NULL);
+        networking_registerhandler(c->messenger->net, NET_PACKET_GC_HANDSHAKE, NULL, NULL);
+        group_callback_update_addresses(c->announce, NULL, NULL);
+        kill_gca(c->announce);
+    }
+
+    hash_index_free(&c->chat_index);
+    free(c->history_dir);
     free(c);
 }
 
+int gc_set_history_dir(GC_Session *c, const char *dir, uint32_t size)
+{
+    if (size == 0)
+        size = GC_HISTORY_DEFAULT_SIZE;
+
+    if (size < GC_HISTORY_MIN_SIZE)
+        return -1;
+
+    char *history_dir = NULL;
+
+    if (dir != NULL) {
+        history_dir = malloc(strlen(dir) + 1);
+
+        if (history_dir == NULL)
+            return -1;
+
+        memcpy(history_dir, dir, strlen(dir) + 1);
+    }
+
+    free(c->history_dir);
+    c->history_dir = history_dir;
+    c->history_size = size;
+    return 0;
+}
+
+void gc_set_recv_budget(GC_Session *c, uint64_t limit)
+{
+    c->recv_budget.limit = limit;
+}
+
+void gc_get_recv_budget(const GC_Session *c, uint64_t *used, uint64_t *dropped)
+{
+    if (used)
+        *used = c->recv_budget.used;
+
+    if (dropped)
+        *dropped = c->recv_budget.dropped;
+}
+
+int gc_get_peer_recv_buffer(const GC_Chat *chat, uint32_t peernumber, uint32_t *num_messages, uint32_t *bytes,
+                            uint32_t *dropped)
+{
+    if (!peernumber_valid(chat, peernumber))
+        return -1;
+
+    const GC_Connection *gconn = chat->gcc[peernumber];
+
+    if (num_messages)
+        *num_messages = gconn->recv_ary_count;
+
+    if (bytes)
+        *bytes = gconn->recv_ary_bytes;
+
+    if (dropped)
+        *dropped = gconn->recv_dropped;
+
+    return 0;
+}
+
 /* Return 1 if groupnumber is a valid group chat index
  * Return 0 otherwise
  */
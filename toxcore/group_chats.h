@@ -27,8 +27,11 @@
 
 #include <stdbool.h>
 #include "TCP_connection.h"
+#include "hash_index.h"
+#include "group_gossip.h"
 
 typedef struct Messenger Messenger;
+typedef struct Messenger_Host Messenger_Host;
 
 #define TIME_STAMP_SIZE (sizeof(uint64_t))
 #define HASH_ID_BYTES (sizeof(uint32_t))
@@ -48,12 +51,33 @@ typedef struct Messenger Messenger;
 #define GC_CONFIRMED_PEER_TIMEOUT (GC_PING_INTERVAL * 4 + 10)
 #define GC_UNCONFRIMED_PEER_TIMEOUT GC_PING_INTERVAL
 
+/* Number of neighbours we connect to in overlay groups, and the most we accept connections from */
+#define GC_OVERLAY_NEIGHBOURS 8
+#define GC_OVERLAY_MAX_NEIGHBOURS (GC_OVERLAY_NEIGHBOURS * 3)
+
+/* Peers of overlay groups announce themselves to the whole group this often, and are
+ * removed from our peer list if we stop hearing from them */
+#define GC_OVERLAY_ANNOUNCE_INTERVAL 60
+#define GC_OVERLAY_PEER_TIMEOUT (GC_OVERLAY_ANNOUNCE_INTERVAL * 3)
+
 typedef enum GROUP_PRIVACY_STATE {
     GI_PUBLIC,
     GI_PRIVATE,
     GI_INVALID
 } GROUP_PRIVACY_STATE;
 
+/* How peers of a group are connected.
+ *
+ * - FULL_MESH: every peer connects to every other peer and sends its broadcasts to each of them.
+ * - OVERLAY: every peer connects to a few neighbours, broadcasts are signed by their sender
+ *   and relayed from neighbour to neighbour.
+ */
+typedef enum GROUP_TOPOLOGY {
+    GT_FULL_MESH,
+    GT_OVERLAY,
+    GT_INVALID
+} GROUP_TOPOLOGY;
+
 typedef enum GROUP_MODERATION_EVENT {
     MV_KICK,
     MV_BAN,
@@ -114,7 +138,8 @@ typedef enum GROUP_BROADCAST_TYPE {
     GM_REMOVE_PEER,
     GM_REMOVE_BAN,
     GM_SET_MOD,
-    GM_SET_OBSERVER
+    GM_SET_OBSERVER,
+    GM_PEER_INFO
 } GROUP_BROADCAST_TYPE;
 
 typedef enum GROUP_PACKET_TYPE {
@@ -137,6 +162,11 @@ typedef enum GROUP_PACKET_TYPE {
     GP_SANCTIONS_LIST = 29,
     GP_FRIEND_INVITE = 30,
     GP_HS_RESPONSE_ACK = 31,
+    GP_GOSSIP = 32,
+    GP_SYNC_DELTA_REQUEST = 33,
+    GP_SYNC_DELTA_RESPONSE = 34,
+    GP_HISTORY_REQUEST = 35,
+    GP_HISTORY_RESPONSE = 36,
 } GROUP_PACKET_TYPE;
 
 typedef enum GROUP_HANDSHAKE_JOIN_TYPE {
@@ -161,8 +191,18 @@ typedef struct GC_Moderation {
     struct GC_Sanction_Creds sanctions_creds;
     uint32_t    num_sanctions;
 
+    /* Hashes of the packed sanctions whose signatures we have already verified */
+    uint8_t     (*verified)[GC_MODERATION_HASH_SIZE];
+    uint32_t    num_verified;
+    uint32_t    verified_size;
+    Hash_Index  verified_index;
+
     uint8_t     **mod_list;    /* Array of public signature keys of all the mods */
     uint16_t    num_mods;
+
+    /* Running hash of the first num_hashed_mods entries of mod_list */
+    crypto_hash_sha256_state mod_list_hash_state;
+    uint16_t    num_hashed_mods;
 } GC_Moderation;
 
 typedef struct GC_PeerAddress {
@@ -183,6 +223,7 @@ typedef struct {
     uint16_t    group_name_len;
     uint8_t     group_name[MAX_GC_GROUP_NAME_SIZE];
     uint8_t     privacy_state;   /* GI_PUBLIC (uses DHT) or GI_PRIVATE (invite only) */
+    uint8_t     topology;   /* GT_FULL_MESH or GT_OVERLAY */
     uint16_t    passwd_len;
     uint8_t     passwd[MAX_GC_PASSWD_SIZE];
     uint8_t     mod_list_hash[GC_MODERATION_HASH_SIZE];
@@ -191,13 +232,41 @@ typedef struct {
 
 typedef struct GC_Announce GC_Announce;
 typedef struct GC_Connection GC_Connection;
+typedef struct GC_Peer_Slot GC_Peer_Slot;
+typedef struct GC_History GC_History;
+
+/* Default number of bytes the out of order messages of all groups may take */
+#define GC_RECV_BUDGET_DEFAULT (16 * 1024 * 1024)
+
+/* The out of order messages of a single peer may take 1 / GC_RECV_PEER_SHARE of the budget, so that
+ * one peer can't use it up for all the others.
+ */
+#define GC_RECV_PEER_SHARE 8
+
+/* Memory the out of order messages of all groups may take, see gcc_handle_recv_message() */
+typedef struct {
+    uint64_t    limit;   /* bytes, 0 if there is none */
+    uint64_t    used;
+    uint64_t    dropped;   /* messages dropped because the budget was used up */
+} GC_Recv_Budget;
+
+/* Slots the out of order messages of a group are kept in, allocated a block at a time */
+typedef struct {
+    GC_Recv_Budget  *budget;   /* NULL if there is no limit */
+    uint8_t     **blocks;
+    uint32_t    num_blocks;
+    uint8_t     *free_slots;   /* each free slot starts with a pointer to the next one */
+    uint32_t    used_slots;
+} GC_Recv_Arena;
 
 typedef struct GC_Chat {
     Networking_Core *net;
     TCP_Connections *tcp_conn;
+    bool        shared_tcp;   /* tcp_conn is the session's, shared with the other groups that use our group key */
 
     GC_GroupPeer    *group;
-    GC_Connection   *gcc;
+    GC_Connection   **gcc;   /* indexed by peernumber like group, the connections themselves never move */
+    uint32_t    peers_capacity;   /* number of peers group and gcc have room for */
     GC_Moderation   moderation;
     GC_SharedState  shared_state;
     uint8_t     shared_state_sig[SIGNATURE_SIZE];    /* Signed by founder using the chat secret key */
@@ -205,6 +274,12 @@ typedef struct GC_Chat {
     uint32_t    numpeers;
     int         groupnumber;
 
+    GC_Peer_Slot    *peer_slots;   /* peer handle slots, see gcc_get_connection() */
+    uint32_t    num_peer_slots;
+    uint32_t    free_peer_slot;   /* 1 + index of the first free slot, 0 if there are none */
+    Hash_Index  enc_pk_index;   /* peer handles by public_key_hash */
+    Hash_Index  sig_pk_index;   /* peer handles by hash of their public signature key */
+
     uint8_t     chat_public_key[EXT_PUBLIC_KEY];    /* the chat_id is the sig portion */
     uint8_t     chat_secret_key[EXT_SECRET_KEY];    /* only used by the founder */
     uint32_t    chat_id_hash;    /* 32-bit hash of the chat_id */
@@ -233,6 +308,25 @@ typedef struct GC_Chat {
     GC_PeerAddress addr_list[MAX_GC_PEER_ADDRS];
     uint16_t    num_addrs;
     uint16_t    addrs_idx;
+
+    /* Overlay groups */
+    uint64_t    gossip_seq;   /* sequence number of our last broadcast */
+    GC_Gossip_Cache gossip_cache;   /* broadcasts we already relayed */
+    uint64_t    last_overlay_announce;   /* 0 until we first announced ourselves */
+    uint64_t    last_overlay_connect;   /* last time we tried to connect to a new neighbour */
+
+    /* Message log, NULL if we don't keep one */
+    GC_History  *history;
+    uint32_t    history_peer_hash;   /* public key hash of the peer we catch up with, 0 if none */
+    uint64_t    history_sync_seq;   /* sequence number of our first entry logged after we started catching up */
+    uint64_t    history_since;   /* time we asked the peer for the entries from */
+    uint64_t    history_next_seq;   /* sequence number in the peer's log we ask for next, 0 until it answered */
+    uint64_t    last_history_response;   /* last time we asked the peer for entries or got some */
+    uint8_t     history_retries;
+    uint64_t    history_batches_time;   /* start of the interval the batches we sent are counted in */
+    uint32_t    history_batches;   /* batches of our log we sent in the interval */
+
+    GC_Recv_Arena   recv_arena;
 } GC_Chat;
 
 typedef struct GC_Session {
@@ -241,11 +335,28 @@ typedef struct GC_Session {
     GC_Announce *announce;
 
     uint32_t num_chats;
+    Hash_Index chat_index;   /* groupnumbers by chat_id_hash */
+
+    char *history_dir;   /* directory the message logs of groups are kept in, NULL if we keep none */
+    uint32_t history_size;
+
+    GC_Recv_Budget recv_budget;
+
+    /* The relay connections of every group whose encryption key is our group key, see
+     * Messenger_Options.shared_group_key. Relays only take one key per connection so groups
+     * with keys of their own have connections of their own. */
+    TCP_Connections *tcp_conn;
+    uint8_t tcp_public_key[ENC_PUBLIC_KEY];
+    uint8_t tcp_secret_key[ENC_SECRET_KEY];
+    uint32_t next_chat_turn;   /* the group do_gc() starts with, so that no group always goes first */
 
     void (*message)(Messenger *m, uint32_t, uint32_t, unsigned int, const uint8_t *, size_t, void *);
     void *message_userdata;
     void (*private_message)(Messenger *m, uint32_t, uint32_t, const uint8_t *, size_t, void *);
     void *private_message_userdata;
+    void (*history_message)(Messenger *m, uint32_t, const uint8_t *, const uint8_t *, size_t, unsigned int, uint64_t,
+                            const uint8_t *, size_t, void *);
+    void *history_message_userdata;
     void (*moderation)(Messenger *m, uint32_t, uint32_t, uint32_t, unsigned int, void *);
     void *moderation_userdata;
     void (*nick_change)(Messenger *m, uint32_t, uint32_t, const uint8_t *, size_t, void *);
@@ -281,6 +392,7 @@ struct SAVED_GROUP {
     uint16_t  group_name_len;
     uint8_t   group_name[MAX_GC_GROUP_NAME_SIZE];
     uint8_t   privacy_state;
+    uint8_t   topology;
     uint16_t  passwd_len;
     uint8_t   passwd[MAX_GC_PASSWD_SIZE];
     uint8_t   mod_list_hash[GC_MODERATION_HASH_SIZE];
@@ -364,6 +476,9 @@ uint16_t gc_get_password_size(const GC_Chat *chat);
 /* Returns group privacy state */
 uint8_t gc_get_privacy_state(const GC_Chat *chat);
 
+/* Returns the group topology. */
+uint8_t gc_get_topology(const GC_Chat *chat);
+
 /* Returns the group peer limit. */
 uint32_t gc_get_max_peers(const GC_Chat *chat);
 
@@ -460,6 +575,20 @@ int gc_founder_set_password(GC_Chat *chat, const uint8_t *passwd, uint16_t passw
  */
 int gc_founder_set_privacy_state(Messenger *m, int groupnumber, uint8_t new_privacy_state);
 
+/* Sets the group topology and distributes the new shared state to the group.
+ *
+ * Peers keep the connections they have, the new topology is used for the next ones and for broadcasts.
+ * This function requires that the shared state be re-signed and will only work for the group founder.
+ *
+ * Returns 0 on success.
+ * Returns -1 if groupnumber is invalid.
+ * Returns -2 if the topology is an invalid type.
+ * Returns -3 if the caller does not have sufficient permissions for this action.
+ * Returns -4 if the topology fails to set.
+ * Returns -5 if the packet fails to send.
+ */
+int gc_founder_set_topology(Messenger *m, int groupnumber, uint8_t topology);
+
 /* Sets the peer limit to maxpeers and distributes the new shared state to the group.
  *
  * This function requires that the shared state be re-signed and will only work for the group founder.
@@ -503,6 +632,14 @@ void gc_callback_message(Messenger *m, void (*function)(Messenger *m, uint32_t,
 void gc_callback_private_message(Messenger *m, void (*function)(Messenger *m, uint32_t, uint32_t, const uint8_t *,
                                  size_t, void *), void *userdata);
 
+/* Sets the callback for messages we get from a peer's message log when we catch up on a group.
+ * The arguments are the groupnumber, the sender's public key, nick and nick length, the message
+ * type, the unix time the message was logged at, the message and its length.
+ */
+void gc_callback_history_message(Messenger *m, void (*function)(Messenger *m, uint32_t, const uint8_t *,
+                                 const uint8_t *, size_t, unsigned int, uint64_t, const uint8_t *, size_t, void *),
+                                 void *userdata);
+
 void gc_callback_moderation(Messenger *m, void (*function)(Messenger *m, uint32_t, uint32_t, uint32_t, unsigned int,
                             void *), void *userdata);
 
@@ -545,6 +682,42 @@ GC_Session* new_groupchats(Messenger* m);
 /* Cleans up groupchat structures and calls gc_group_exit() for every group chat */
 void kill_groupchats(GC_Session *c);
 
+/* Hands the group packets and announce results of the socket shared by the accounts of host to
+ * the accounts in the groups they are for. Two accounts of a host can't be in the same group.
+ */
+void new_groupchats_host(Messenger_Host *host);
+
+void kill_groupchats_host(Messenger_Host *host);
+
+/* Keeps a message log of at most size bytes for every group we join from now on, in a file
+ * named after the chat_id in dir. If size is 0 GC_HISTORY_DEFAULT_SIZE is used.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+int gc_set_history_dir(GC_Session *c, const char *dir, uint32_t size);
+
+/* Sets the number of bytes the out of order messages of all groups may take, 0 for no limit.
+ * Those of a single peer may take 1 / GC_RECV_PEER_SHARE of it.
+ * Out of order messages that don't fit are dropped and sent again by their peer.
+ */
+void gc_set_recv_budget(GC_Session *c, uint64_t limit);
+
+/* Puts the number of bytes out of order messages of all groups take in used and the number
+ * of them dropped so far in dropped. Either may be NULL.
+ */
+void gc_get_recv_budget(const GC_Session *c, uint64_t *used, uint64_t *dropped);
+
+/* Puts the number of out of order messages of peernumber we keep, the bytes of the receive
+ * budget they take and the number of them dropped so far in num_messages, bytes and dropped.
+ * Any of them may be NULL.
+ *
+ * Returns 0 on success.
+ * Returns -1 if peernumber is invalid.
+ */
+int gc_get_peer_recv_buffer(const GC_Chat *chat, uint32_t peernumber, uint32_t *num_messages, uint32_t *bytes,
+                            uint32_t *dropped);
+
 /* Loads a previously saved group and attempts to join it.
  *
  * Returns groupnumber on success.
@@ -634,10 +807,10 @@ void pack_gc_mod_list(const GC_Chat *chat, uint8_t *data);
  */
 uint16_t gc_copy_peer_addrs(const GC_Chat *chat, GC_PeerAddress *addrs, size_t max_addrs);
 
-/* If read_id is non-zero sends a read-receipt for ack_id's packet.
- * If request_id is non-zero sends a request for the respective id's packet.
+/* Sends peernum an ack for all the messages we received from them, including
+ * the ranges of messages received out of sequence.
  */
-int gc_send_message_ack(const GC_Chat *chat, uint32_t peernum, uint64_t read_id, uint64_t request_id);
+int gc_send_message_ack(const GC_Chat *chat, uint32_t peernum);
 
 int handle_gc_lossless_helper(Messenger *m, int groupnumber, uint32_t peernumber, const uint8_t *data,
                               uint16_t length, uint64_t message_id, uint8_t packet_type);
@@ -50,12 +50,185 @@ uint16_t get_ary_index(uint64_t message_id)
     return message_id % GCC_BUFFER_SIZE;
 }
 
+/* Returns the number of bytes of the receive budget a message of length takes. */
+static uint32_t recv_slot_cost(uint32_t length)
+{
+    return length <= GCC_RECV_SLOT_SIZE ? GCC_RECV_SLOT_SIZE : length;
+}
+
+/* Returns true if a message of length from gconn fits in the receive budget, and in the share of it
+ * gconn may take.
+ */
+static bool recv_arena_has_room(const GC_Recv_Arena *arena, const GC_Connection *gconn, uint32_t length)
+{
+    const GC_Recv_Budget *budget = arena->budget;
+
+    if (budget == NULL || budget->limit == 0)
+        return true;
+
+    uint64_t peer_limit = budget->limit / GC_RECV_PEER_SHARE;
+
+    if (peer_limit < GCC_RECV_SLOT_SIZE)
+        peer_limit = GCC_RECV_SLOT_SIZE;
+
+    return budget->used + recv_slot_cost(length) <= budget->limit
+           && gconn->recv_ary_bytes + recv_slot_cost(length) <= peer_limit;
+}
+
+/* Puts the slots of block on the free list of arena. */
+static void recv_arena_add_free_slots(GC_Recv_Arena *arena, uint8_t *block)
+{
+    uint32_t i;
+
+    for (i = 0; i < GCC_RECV_BLOCK_SLOTS; ++i) {
+        uint8_t *slot = block + i * GCC_RECV_SLOT_SIZE;
+        memcpy(slot, &arena->free_slots, sizeof(uint8_t *));
+        arena->free_slots = slot;
+    }
+}
+
+/* Allocates a new block of slots for arena.
+ *
+ * Return 0 on success.
+ * Return -1 on failure.
+ */
+static int recv_arena_grow(GC_Recv_Arena *arena)
+{
+    uint8_t **blocks = realloc(arena->blocks, sizeof(uint8_t *) * (arena->num_blocks + 1));
+
+    if (blocks == NULL)
+        return -1;
+
+    arena->blocks = blocks;
+
+    uint8_t *block = malloc(GCC_RECV_SLOT_SIZE * GCC_RECV_BLOCK_SLOTS);
+
+    if (block == NULL)
+        return -1;
+
+    arena->blocks[arena->num_blocks] = block;
+    ++arena->num_blocks;
+    recv_arena_add_free_slots(arena, block);
+    return 0;
+}
+
+/* Takes room for a message of length from arena and charges it to the receive budget.
+ * recv_arena_has_room() must be true.
+ *
+ * Return NULL on failure.
+ */
+static uint8_t *recv_arena_alloc(GC_Recv_Arena *arena, uint32_t length)
+{
+    uint8_t *data;
+
+    if (length > GCC_RECV_SLOT_SIZE) {
+        data = malloc(length);
+
+        if (data == NULL)
+            return NULL;
+    } else {
+        if (arena->free_slots == NULL && recv_arena_grow(arena) == -1)
+            return NULL;
+
+        data = arena->free_slots;
+        memcpy(&arena->free_slots, data, sizeof(uint8_t *));
+        ++arena->used_slots;
+    }
+
+    if (arena->budget)
+        arena->budget->used += recv_slot_cost(length);
+
+    return data;
+}
+
+/* Gives the room of a message of length taken with recv_arena_alloc() back to arena. */
+static void recv_arena_release(GC_Recv_Arena *arena, uint8_t *data, uint32_t length)
+{
+    if (arena->budget)
+        arena->budget->used -= recv_slot_cost(length);
+
+    if (length > GCC_RECV_SLOT_SIZE) {
+        free(data);
+        return;
+    }
+
+    memcpy(data, &arena->free_slots, sizeof(uint8_t *));
+    arena->free_slots = data;
+    --arena->used_slots;
+
+    /* Every message is handled, the first block is kept for the next ones */
+    if (arena->used_slots == 0 && arena->num_blocks > 1) {
+        uint32_t i;
+
+        for (i = 1; i < arena->num_blocks; ++i)
+            free(arena->blocks[i]);
+
+        arena->num_blocks = 1;
+        arena->free_slots = NULL;
+        recv_arena_add_free_slots(arena, arena->blocks[0]);
+    }
+}
+
+/* Frees the blocks of arena, its messages must all be released. */
+static void recv_arena_free(GC_Recv_Arena *arena)
+{
+    uint32_t i;
+
+    for (i = 0; i < arena->num_blocks; ++i)
+        free(arena->blocks[i]);
+
+    free(arena->blocks);
+    arena->blocks = NULL;
+    arena->num_blocks = 0;
+    arena->free_slots = NULL;
+    arena->used_slots = 0;
+}
+
+/* Adds an out of order message to gconn's recv_ary, in chat's receive arena.
+ *
+ * Return 0 on success.
+ * Return -1 on failure.
+ */
+static int add_to_recv_ary(GC_Chat *chat, GC_Connection *gconn, const uint8_t *data, uint32_t length,
+                           uint8_t packet_type, uint64_t message_id, uint16_t idx)
+{
+    if (!data || !length)
+        return -1;
+
+    struct GC_Message_Ary *item = &gconn->recv_ary[idx];
+    item->data = recv_arena_alloc(&chat->recv_arena, length);
+
+    if (item->data == NULL)
+        return -1;
+
+    memcpy(item->data, data, length);
+    item->data_length = length;
+    item->packet_type = packet_type;
+    item->message_id = message_id;
+    item->time_added = current_time_monotonic(chat->net->mono_time);
+
+    ++gconn->recv_ary_count;
+    gconn->recv_ary_bytes += recv_slot_cost(length);
+    return 0;
+}
+
+/* Removes the message at idx from gconn's recv_ary. */
+static void rm_from_recv_ary(GC_Chat *chat, GC_Connection *gconn, uint16_t idx)
+{
+    struct GC_Message_Ary *item = &gconn->recv_ary[idx];
+
+    recv_arena_release(&chat->recv_arena, item->data, item->data_length);
+    --gconn->recv_ary_count;
+    gconn->recv_ary_bytes -= recv_slot_cost(item->data_length);
+    memset(item, 0, sizeof(struct GC_Message_Ary));
+}
+
 /* Adds a group message to ary.
  *
  * Return 0 on success.
  * Return -1 on failure.
  */
-static int add_to_ary(struct GC_Message_Ary *ary, const uint8_t *data, uint32_t length,
+static int add_to_ary(Mono_Time *mono_time, struct GC_Message_Ary *ary, const uint8_t *data, uint32_t length,
                       uint8_t packet_type, uint64_t message_id, uint16_t idx)
 {
     if (!data || !length)
@@ -72,9 +245,10 @@ static int add_to_ary(struct GC_Message_Ary *ary, const uint8_t *data, uint32_t
     memcpy(ary[idx].data, data, length);
     ary[idx].data_length = length;
     ary[idx].packet_type = packet_type;
+    ary[idx].send_count = 1;
     ary[idx].message_id = message_id;
-    ary[idx].time_added = unix_time();
-    ary[idx].last_send_try = unix_time();
+    ary[idx].time_added = current_time_monotonic(mono_time);
+    ary[idx].last_send_try = ary[idx].time_added;
 
     return 0;
 }
@@ -87,9 +261,9 @@ static int add_to_ary(struct GC_Message_Ary *ary, const uint8_t *data, uint32_t
 int gcc_add_send_ary(GC_Chat *chat, const uint8_t *data, uint32_t length, uint32_t peernum,
                      uint8_t packet_type)
 {
-    GC_Connection *gconn = &chat->gcc[peernum];
+    GC_Connection *gconn = chat->gcc[peernum];
 
-    if (!gconn)
+    if (!gconn || !gconn->send_ary)
         return -1;
 
     /* check if send_ary is full */
@@ -101,7 +275,7 @@ int gcc_add_send_ary(GC_Chat *chat, const uint8_t *data, uint32_t length, uint32
     if (gconn->send_ary[idx].data != NULL)
         return -1;
 
-    if (add_to_ary(gconn->send_ary, data, length, packet_type, gconn->send_message_id, idx) == -1)
+    if (add_to_ary(chat->net->mono_time, gconn->send_ary, data, length, packet_type, gconn->send_message_id, idx) == -1)
         return -1;
 
     ++gconn->send_message_id;
@@ -109,14 +283,38 @@ int gcc_add_send_ary(GC_Chat *chat, const uint8_t *data, uint32_t length, uint32
     return 0;
 }
 
+/* Updates the smoothed RTT and the retransmission timeout of gconn with a new RTT sample (RFC 6298). */
+static void update_rtt(GC_Connection *gconn, uint64_t rtt)
+{
+    if (gconn->rtt == 0) {
+        gconn->rtt = rtt;
+        gconn->rtt_var = rtt / 2;
+    } else {
+        uint64_t diff = gconn->rtt > rtt ? gconn->rtt - rtt : rtt - gconn->rtt;
+        gconn->rtt_var = (3 * gconn->rtt_var + diff) / 4;
+        gconn->rtt = (7 * gconn->rtt + rtt) / 8;
+    }
+
+    if (gconn->rtt == 0)
+        gconn->rtt = 1;
+
+    gconn->rto = gconn->rtt + 4 * gconn->rtt_var;
+
+    if (gconn->rto < GCC_MIN_RTO)
+        gconn->rto = GCC_MIN_RTO;
+
+    if (gconn->rto > GCC_MAX_RTO)
+        gconn->rto = GCC_MAX_RTO;
+}
+
 /* Removes send_ary item with message_id.
  *
  * Returns 0 if success.
  * Returns -1 on failure.
  */
-int gcc_handle_ack(GC_Connection *gconn, uint64_t message_id)
+int gcc_handle_ack(Mono_Time *mono_time, GC_Connection *gconn, uint64_t message_id)
 {
-    if (!gconn)
+    if (!gconn || !gconn->send_ary)
         return -1;
 
     uint16_t idx = get_ary_index(message_id);
@@ -127,6 +325,10 @@ int gcc_handle_ack(GC_Connection *gconn, uint64_t message_id)
     if (gconn->send_ary[idx].message_id != message_id)  // wrap-around indicates a connection problem
         return -1;
 
+    /* Acks of resent messages could be for any of the copies (Karn's algorithm) */
+    if (gconn->send_ary[idx].send_count == 1)
+        update_rtt(gconn, current_time_monotonic(mono_time) - gconn->send_ary[idx].last_send_try);
+
     rm_from_ary(gconn->send_ary, idx);
 
     /* Put send_ary_start in proper position */
@@ -142,6 +344,181 @@ int gcc_handle_ack(GC_Connection *gconn, uint64_t message_id)
     return 0;
 }
 
+int gcc_handle_cumulative_ack(Mono_Time *mono_time, GC_Connection *gconn, uint64_t ack_id)
+{
+    if (!gconn)
+        return -1;
+
+    if (ack_id >= gconn->send_message_id)
+        return -1;
+
+    /* Acks can be older than the last one we got, they are carried by resent packets */
+    for (; gconn->send_acked_id < ack_id; ++gconn->send_acked_id)
+        gcc_handle_ack(mono_time, gconn, gconn->send_acked_id + 1);
+
+    return 0;
+}
+
+uint32_t gcc_pack_ack(GC_Connection *gconn, uint8_t *data, uint32_t length)
+{
+    if (length < GCC_MAX_ACK_SIZE || !gconn->recv_ary)
+        return 0;
+
+    U64_to_bytes(data, gconn->recv_message_id);
+    uint32_t packed_len = sizeof(uint64_t) + sizeof(uint8_t);
+    uint8_t num_ranges = 0;
+
+    /* recv_message_id + 1 is missing, everything after it that we have is in recv_ary */
+    uint64_t id = gconn->recv_message_id + 2;
+    uint64_t end = gconn->recv_message_id + GCC_BUFFER_SIZE - 1;
+
+    if (gconn->recv_highest_id < end)
+        end = gconn->recv_highest_id;
+
+    while (id <= end && num_ranges < GCC_MAX_ACK_RANGES) {
+        if (gconn->recv_ary[get_ary_index(id)].data == NULL) {
+            ++id;
+            continue;
+        }
+
+        uint64_t first = id;
+
+        while (id <= end && gconn->recv_ary[get_ary_index(id)].data != NULL && id - first < UINT16_MAX)
+            ++id;
+
+        U64_to_bytes(data + packed_len, first);
+        packed_len += sizeof(uint64_t);
+        U16_to_bytes(data + packed_len, id - first);
+        packed_len += sizeof(uint16_t);
+        ++num_ranges;
+    }
+
+    data[sizeof(uint64_t)] = num_ranges;
+    gconn->acks_owed = 0;
+
+    return packed_len;
+}
+
+/* Sends message_id again if it is still unacked.
+ *
+ * The first resend is immediate, a resent copy is only sent again after an RTT so that
+ * acks sent before the copy arrived don't make us send it over and over.
+ */
+static void resend_missing_message(const GC_Chat *chat, GC_Connection *gconn, uint64_t message_id,
+                                   uint64_t current_time)
+{
+    struct GC_Message_Ary *item = &gconn->send_ary[get_ary_index(message_id)];
+
+    if (item->data == NULL || item->message_id != message_id)
+        return;
+
+    uint64_t interval = gconn->rtt ? gconn->rtt + GCC_ACK_DELAY : GCC_MIN_RTO;
+
+    if (item->send_count > 1 && current_time - item->last_send_try < interval)
+        return;
+
+    gcc_send_group_packet(chat, gconn, item->data, item->data_length, item->packet_type);
+    item->last_send_try = current_time;
+
+    if (item->send_count < UINT8_MAX)
+        ++item->send_count;
+}
+
+int gcc_handle_ack_packet(const GC_Chat *chat, GC_Connection *gconn, const uint8_t *data, uint32_t length)
+{
+    if (length < sizeof(uint64_t) + sizeof(uint8_t) || !gconn->send_ary)
+        return -1;
+
+    uint64_t ack_id;
+    bytes_to_U64(&ack_id, data);
+    uint8_t num_ranges = data[sizeof(uint64_t)];
+
+    if (num_ranges > GCC_MAX_ACK_RANGES
+            || length != sizeof(uint64_t) + sizeof(uint8_t) + num_ranges * (sizeof(uint64_t) + sizeof(uint16_t)))
+        return -1;
+
+    if (ack_id >= gconn->send_message_id)
+        return -1;
+
+    uint64_t next_id = ack_id + 1;
+    uint32_t i, processed = sizeof(uint64_t) + sizeof(uint8_t);
+
+    /* Ranges must be in order, within what we sent and within the send buffer past ack_id. The
+     * checks are written so that nothing overflows, each id between them costs a loop iteration.
+     */
+    for (i = 0; i < num_ranges; ++i) {
+        uint64_t first;
+        uint16_t num;
+        bytes_to_U64(&first, data + processed);
+        processed += sizeof(uint64_t);
+        bytes_to_U16(&num, data + processed);
+        processed += sizeof(uint16_t);
+
+        if (first < next_id || num == 0 || first >= gconn->send_message_id || num > gconn->send_message_id - first)
+            return -1;
+
+        if (first - ack_id > GCC_BUFFER_SIZE || num > GCC_BUFFER_SIZE - (first - ack_id))
+            return -1;
+
+        next_id = first + num;
+    }
+
+    if (gcc_handle_cumulative_ack(chat->net->mono_time, gconn, ack_id) == -1)
+        return -1;
+
+    uint64_t current_time = current_time_monotonic(chat->net->mono_time);
+    next_id = ack_id + 1;
+    processed = sizeof(uint64_t) + sizeof(uint8_t);
+
+    for (i = 0; i < num_ranges; ++i) {
+        uint64_t first;
+        uint16_t num;
+        bytes_to_U64(&first, data + processed);
+        processed += sizeof(uint64_t);
+        bytes_to_U16(&num, data + processed);
+        processed += sizeof(uint16_t);
+
+        /* Peer got messages after these ones, they were most likely lost */
+        for (; next_id < first; ++next_id)
+            resend_missing_message(chat, gconn, next_id, current_time);
+
+        for (; next_id < first + num; ++next_id)
+            gcc_handle_ack(chat->net->mono_time, gconn, next_id);
+    }
+
+    return 0;
+}
+
+void gcc_ack_sent(GC_Connection *gconn, uint64_t ack_id)
+{
+    /* A cumulative ack is enough only if we aren't missing anything */
+    if (ack_id == gconn->recv_message_id && gconn->recv_highest_id <= gconn->recv_message_id)
+        gconn->acks_owed = 0;
+}
+
+bool gcc_ack_due(const GC_Connection *gconn, uint64_t current_time)
+{
+    if (gconn->acks_owed == 0)
+        return false;
+
+    return gconn->acks_owed >= GCC_ACK_FREQUENCY || current_time >= gconn->ack_due_time;
+}
+
+/* Notes that we owe peer an ack for a message, due right away if urgent is set. */
+static void owe_ack(Mono_Time *mono_time, GC_Connection *gconn, bool urgent)
+{
+    uint64_t current_time = current_time_monotonic(mono_time);
+
+    if (gconn->acks_owed == 0)
+        gconn->ack_due_time = current_time + GCC_ACK_DELAY;
+
+    if (urgent)
+        gconn->ack_due_time = current_time;
+
+    if (gconn->acks_owed < UINT16_MAX)
+        ++gconn->acks_owed;
+}
+
 /* Decides if message need to be put in recv_ary or immediately handled.
  *
  * Return 2 if message is in correct sequence and may be handled immediately.
@@ -152,37 +529,65 @@ int gcc_handle_ack(GC_Connection *gconn, uint64_t message_id)
 int gcc_handle_recv_message(GC_Chat *chat, uint32_t peernum, const uint8_t *data, uint32_t length,
                             uint8_t packet_type, uint64_t message_id)
 {
-    GC_Connection *gconn = &chat->gcc[peernum];
+    GC_Connection *gconn = chat->gcc[peernum];
 
-    if (!gconn)
+    if (!gconn || !gconn->recv_ary)
         return -1;
 
-    /* Appears to be a duplicate packet so we discard it */
-    if (message_id < gconn->recv_message_id + 1)
+    /* Appears to be a duplicate packet so we discard it, peer didn't get our ack */
+    if (message_id < gconn->recv_message_id + 1) {
+        owe_ack(chat->net->mono_time, gconn, false);
         return 0;
+    }
 
     /* we're missing an older message from this peer so we store it in recv_ary */
     if (message_id > gconn->recv_message_id + 1) {
+        if (message_id >= gconn->recv_message_id + GCC_BUFFER_SIZE)
+            return -1;
+
         uint16_t idx = get_ary_index(message_id);
 
-        if (gconn->recv_ary[idx].data != NULL)
-            return -1;
+        if (gconn->recv_ary[idx].data != NULL) {
+            owe_ack(chat->net->mono_time, gconn, false);
+            return 0;
+        }
+
+        /* Not acked, so the peer sends it again */
+        if (!recv_arena_has_room(&chat->recv_arena, gconn, length)) {
+            ++gconn->recv_dropped;
+            ++chat->recv_arena.budget->dropped;
+            return 0;
+        }
 
-        if (add_to_ary(gconn->recv_ary, data, length, packet_type, message_id, idx) == -1)
+        if (add_to_recv_ary(chat, gconn, data, length, packet_type, message_id, idx) == -1)
             return -1;
 
+        uint64_t highest_id = gconn->recv_highest_id > gconn->recv_message_id ? gconn->recv_highest_id
+                              : gconn->recv_message_id;
+
+        /* Tell peer right away when a new gap shows up so that it can resend the missing messages */
+        owe_ack(chat->net->mono_time, gconn, message_id > highest_id + 1);
+
+        if (message_id > gconn->recv_highest_id)
+            gconn->recv_highest_id = message_id;
+
         return 1;
     }
 
     ++gconn->recv_message_id;
 
+    if (gconn->recv_message_id > gconn->recv_highest_id)
+        gconn->recv_highest_id = gconn->recv_message_id;
+
+    owe_ack(chat->net->mono_time, gconn, false);
+
     return 2;
 }
 
 /* Handles peernum's recv_ary message at idx with appropriate handler and removes from it. */
 static int process_recv_ary_item(GC_Chat *chat, Messenger *m, int groupnum, uint32_t peernum, uint16_t idx)
 {
-    GC_Connection *gconn = &chat->gcc[peernum];
+    GC_Connection *gconn = chat->gcc[peernum];
 
     if (!gconn)
         return -1;
@@ -193,14 +598,9 @@ static int process_recv_ary_item(GC_Chat *chat, Messenger *m, int groupnum, uint
 
     int ret = handle_gc_lossless_helper(m, groupnum, peernum, data, length, gconn->recv_ary[idx].message_id,
                                         gconn->recv_ary[idx].packet_type);
-    rm_from_ary(gconn->recv_ary, idx);
+    rm_from_recv_ary(chat, gconn, idx);
 
-    if (ret == -1) {
-        gc_send_message_ack(chat, peernum, 0, gconn->recv_ary[idx].message_id);
-        return -1;
-    }
-
-    gc_send_message_ack(chat, peernum, gconn->recv_ary[idx].message_id, 0);
+    /* It was already counted in acks_owed when it arrived */
     ++gconn->recv_message_id;
 
     return ret;
@@ -219,9 +619,9 @@ int gcc_check_recv_ary(Messenger *m, int groupnum, uint32_t peernum)
     if (!chat)
         return -1;
 
-    GC_Connection *gconn = &chat->gcc[peernum];
+    GC_Connection *gconn = chat->gcc[peernum];
 
-    if (!gconn)
+    if (!gconn || !gconn->recv_ary)
         return -1;
 
     uint16_t idx = (gconn->recv_message_id + 1) % GCC_BUFFER_SIZE;
@@ -238,35 +638,39 @@ int gcc_check_recv_ary(Messenger *m, int groupnum, uint32_t peernum)
 
 void gcc_resend_packets(Messenger *m, GC_Chat *chat, uint32_t peernum)
 {
-    GC_Connection *gconn = &chat->gcc[peernum];
+    GC_Connection *gconn = chat->gcc[peernum];
 
-    if (!gconn)
+    if (!gconn || !gconn->send_ary)
         return;
 
-    uint64_t tm = unix_time();
+    uint64_t tm = current_time_monotonic(chat->net->mono_time);
     uint16_t i, start = gconn->send_ary_start, end = gconn->send_message_id % GCC_BUFFER_SIZE;
 
     for (i = start; i != end; i = (i + 1) % GCC_BUFFER_SIZE) {
-        if (gconn->send_ary[i].data == NULL)
-            continue;
-
-        if (tm == gconn->send_ary[i].last_send_try)
-            continue;
+        struct GC_Message_Ary *item = &gconn->send_ary[i];
 
-        uint64_t delta = gconn->send_ary[i].last_send_try - gconn->send_ary[i].time_added;
-        gconn->send_ary[i].last_send_try = tm;
-
-        /* if this occurrs less than once per second this won't be reliable */
-        if (delta > 1 && POWER_OF_2(delta)) {
-            gcc_send_group_packet(chat, gconn, gconn->send_ary[i].data, gconn->send_ary[i].data_length,
-                                  gconn->send_ary[i].packet_type);
+        if (item->data == NULL)
             continue;
-        }
 
-        if (is_timeout(gconn->send_ary[i].time_added, GC_CONFIRMED_PEER_TIMEOUT)) {
+        if (tm - item->time_added >= GC_CONFIRMED_PEER_TIMEOUT * 1000) {
             gc_peer_delete(m, chat->groupnumber, peernum, (uint8_t *) "Peer timed out", 14);
             return;
         }
+
+        /* back off exponentially while the message stays unacked */
+        uint64_t timeout = gconn->rto << (item->send_count < 6 ? item->send_count - 1 : 5);
+
+        if (timeout > GCC_MAX_RTO)
+            timeout = GCC_MAX_RTO;
+
+        if (tm - item->last_send_try < timeout)
+            continue;
+
+        gcc_send_group_packet(chat, gconn, item->data, item->data_length, item->packet_type);
+        item->last_send_try = tm;
+
+        if (item->send_count < UINT8_MAX)
+            ++item->send_count;
     }
 }
 
@@ -287,7 +691,7 @@ int gcc_send_group_packet(const GC_Chat *chat, const GC_Connection *gconn, const
     bool direct_send_attempt = false;
 
     if (gconn->addr.ip_port.ip.family != 0) {
-        if (gcc_connection_is_direct(gconn)) {
+        if (gcc_connection_is_direct(chat->net->mono_time, gconn)) {
             if ((uint16_t) sendpacket(chat->net, gconn->addr.ip_port, packet, length) == length)
                 return 0;
 
@@ -309,33 +713,153 @@ int gcc_send_group_packet(const GC_Chat *chat, const GC_Connection *gconn, const
 }
 
 /* Returns true if we have a direct connection with this group connection */
-bool gcc_connection_is_direct(const GC_Connection *gconn)
+bool gcc_connection_is_direct(const Mono_Time *mono_time, const GC_Connection *gconn)
 {
     if (!gconn)
         return false;
 
-    return ((GCC_UDP_DIRECT_TIMEOUT + gconn->last_recv_direct_time) > unix_time());
+    return ((GCC_UDP_DIRECT_TIMEOUT + gconn->last_recv_direct_time) > unix_time(mono_time));
 }
 
-/* called when a peer leaves the group */
-void gcc_peer_cleanup(GC_Connection *gconn)
+/* Returns the index of a free peer slot, growing the slot array if needed.
+ * Returns -1 on failure.
+ */
+static int get_free_peer_slot(GC_Chat *chat)
 {
-    if (!gconn)
+    if (chat->free_peer_slot != 0) {
+        uint32_t slot = chat->free_peer_slot - 1;
+        chat->free_peer_slot = chat->peer_slots[slot].next_free;
+        return slot;
+    }
+
+    if (chat->num_peer_slots >= GCC_MAX_PEER_SLOTS)
+        return -1;
+
+    uint32_t num_slots = chat->num_peer_slots ? chat->num_peer_slots * 2 : 8;
+
+    if (num_slots > GCC_MAX_PEER_SLOTS)
+        num_slots = GCC_MAX_PEER_SLOTS;
+
+    GC_Peer_Slot *tmp_slots = realloc(chat->peer_slots, sizeof(GC_Peer_Slot) * num_slots);
+
+    if (tmp_slots == NULL)
+        return -1;
+
+    memset(&tmp_slots[chat->num_peer_slots], 0, sizeof(GC_Peer_Slot) * (num_slots - chat->num_peer_slots));
+
+    /* Chain the new slots after the one we return, lowest index first. */
+    uint32_t i;
+
+    for (i = chat->num_peer_slots + 1; i < num_slots; ++i)
+        tmp_slots[i].next_free = (i + 1 < num_slots) ? i + 2 : 0;
+
+    int slot = chat->num_peer_slots;
+    chat->free_peer_slot = (slot + 1 < num_slots) ? slot + 2 : 0;
+    chat->peer_slots = tmp_slots;
+    chat->num_peer_slots = num_slots;
+    return slot;
+}
+
+GC_Connection *gcc_new_connection(GC_Chat *chat, uint32_t peernumber)
+{
+    GC_Connection *gconn = calloc(1, sizeof(GC_Connection));
+
+    if (gconn == NULL)
+        return NULL;
+
+    int slot = get_free_peer_slot(chat);
+
+    if (slot == -1) {
+        free(gconn);
+        return NULL;
+    }
+
+    chat->peer_slots[slot].gconn = gconn;
+    gconn->peernumber = peernumber;
+    gconn->handle = (chat->peer_slots[slot].generation << GCC_HANDLE_SLOT_BITS) | slot;
+    return gconn;
+}
+
+int gcc_init_buffers(GC_Connection *gconn)
+{
+    if (gconn->send_ary && gconn->recv_ary)
+        return 0;
+
+    struct GC_Message_Ary *send_ary = calloc(GCC_BUFFER_SIZE, sizeof(struct GC_Message_Ary));
+    struct GC_Message_Ary *recv_ary = calloc(GCC_BUFFER_SIZE, sizeof(struct GC_Message_Ary));
+
+    if (send_ary == NULL || recv_ary == NULL) {
+        free(send_ary);
+        free(recv_ary);
+        return -1;
+    }
+
+    gconn->send_ary = send_ary;
+    gconn->recv_ary = recv_ary;
+    return 0;
+}
+
+void gcc_free_connection(GC_Chat *chat, GC_Connection *gconn)
+{
+    if (gconn == NULL)
         return;
 
+    uint32_t slot = gconn->handle & GCC_HANDLE_SLOT_MASK;
+
+    if (slot < chat->num_peer_slots && chat->peer_slots[slot].gconn == gconn) {
+        GC_Peer_Slot *peer_slot = &chat->peer_slots[slot];
+        peer_slot->gconn = NULL;
+        peer_slot->generation = (peer_slot->generation + 1) & (UINT32_MAX >> GCC_HANDLE_SLOT_BITS);
+        peer_slot->next_free = chat->free_peer_slot;
+        chat->free_peer_slot = slot + 1;
+    }
+
+    free(gconn);
+}
+
+GC_Connection *gcc_get_connection(const GC_Chat *chat, uint32_t handle)
+{
+    uint32_t slot = handle & GCC_HANDLE_SLOT_MASK;
+
+    if (slot >= chat->num_peer_slots)
+        return NULL;
+
+    GC_Connection *gconn = chat->peer_slots[slot].gconn;
+
+    if (gconn == NULL || gconn->handle != handle)
+        return NULL;
+
+    return gconn;
+}
+
+void gcc_free_buffers(GC_Chat *chat, GC_Connection *gconn)
+{
     size_t i;
 
-    for (i = 0; i < GCC_BUFFER_SIZE; ++i) {
-        if (gconn->send_ary[i].data) {
-            free(gconn->send_ary[i].data);
-            gconn->send_ary[i].data = NULL;
-        }
+    for (i = 0; gconn->send_ary && i < GCC_BUFFER_SIZE; ++i)
+        free(gconn->send_ary[i].data);
 
-        if (gconn->recv_ary[i].data) {
-            free(gconn->recv_ary[i].data);
-            gconn->recv_ary[i].data = NULL;
-        }
+    for (i = 0; gconn->recv_ary && i < GCC_BUFFER_SIZE && gconn->recv_ary_count > 0; ++i) {
+        if (gconn->recv_ary[i].data != NULL)
+            rm_from_recv_ary(chat, gconn, i);
     }
+
+    free(gconn->send_ary);
+    free(gconn->recv_ary);
+    gconn->send_ary = NULL;
+    gconn->recv_ary = NULL;
+}
+
+/* called when a peer leaves the group */
+void gcc_peer_cleanup(GC_Chat *chat, GC_Connection *gconn)
+{
+    if (!gconn)
+        return;
+
+    gcc_free_buffers(chat, gconn);
+    free(gconn->announcement);
+    gconn->announcement = NULL;
+    gconn->announcement_len = 0;
 }
 
 /* called on group exit */
@@ -344,10 +868,21 @@ void gcc_cleanup(GC_Chat *chat)
     uint32_t i;
 
     for (i = 0; i < chat->numpeers; ++i) {
-        if (&chat->gcc[i])
-            gcc_peer_cleanup(&chat->gcc[i]);
+        if (chat->gcc[i]) {
+            gcc_peer_cleanup(chat, chat->gcc[i]);
+            gcc_free_connection(chat, chat->gcc[i]);
+        }
     }
 
     free(chat->gcc);
     chat->gcc = NULL;
+
+    free(chat->peer_slots);
+    chat->peer_slots = NULL;
+    chat->num_peer_slots = 0;
+    chat->free_peer_slot = 0;
+
+    hash_index_free(&chat->enc_pk_index);
+    hash_index_free(&chat->sig_pk_index);
+    recv_arena_free(&chat->recv_arena);
 }
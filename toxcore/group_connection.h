@@ -39,43 +39,130 @@
 /* The time before the direct UDP connection is considered dead */
 #define GCC_UDP_DIRECT_TIMEOUT (GC_PING_INTERVAL * 2 + 2)
 
+/* Peer handles are [12 bits slot generation][20 bits slot index] */
+#define GCC_HANDLE_SLOT_BITS 20
+#define GCC_HANDLE_SLOT_MASK ((1 << GCC_HANDLE_SLOT_BITS) - 1)
+
+/* The last slot index is never used so that no handle is equal to HASH_INDEX_NONE */
+#define GCC_MAX_PEER_SLOTS GCC_HANDLE_SLOT_MASK
+
+/* Max number of ranges of out of order messages we tell the peer we have in an ack */
+#define GCC_MAX_ACK_RANGES 8
+
+/* [uint64_t ack_id][uint8_t num ranges][[uint64_t first message_id][uint16_t number of messages] * num ranges] */
+#define GCC_MAX_ACK_SIZE (sizeof(uint64_t) + sizeof(uint8_t) + GCC_MAX_ACK_RANGES * (sizeof(uint64_t) + sizeof(uint16_t)))
+
+/* Number of messages received in sequence after which we ack them right away */
+#define GCC_ACK_FREQUENCY 8
+
+/* Max time in ms we wait for more messages or outgoing traffic to carry an ack */
+#define GCC_ACK_DELAY 20
+
+/* Out of order messages up to this size are kept in a slot of the group's receive arena,
+ * larger ones get their own allocation */
+#define GCC_RECV_SLOT_SIZE 1536
+
+/* Number of slots the receive arena of a group allocates at a time */
+#define GCC_RECV_BLOCK_SLOTS 32
+
+/* Retransmission timeouts in ms */
+#define GCC_INITIAL_RTO 1000
+#define GCC_MIN_RTO 200
+#define GCC_MAX_RTO 8000
+
 struct GC_Message_Ary {
     uint8_t *data;
     uint32_t data_length;
     uint8_t  packet_type;
+    uint8_t  send_count;   /* number of times we sent it, RTT samples are only taken if it is 1 */
     uint64_t message_id;
-    uint64_t time_added;
-    uint64_t last_send_try;
+    uint64_t time_added;   /* ms */
+    uint64_t last_send_try;   /* ms */
 };
 
 typedef struct GC_Connection {
     uint64_t send_message_id;   /* message_id of the next message we send to peer */
 
     uint16_t send_ary_start;   /* send_ary index of oldest item */
-    struct GC_Message_Ary send_ary[GCC_BUFFER_SIZE];
+    struct GC_Message_Ary *send_ary;   /* GCC_BUFFER_SIZE items, NULL for relayed peers */
+    uint64_t send_acked_id;   /* peer acked every message up to this one */
 
     uint64_t recv_message_id;   /* message_id of peer's last message to us */
-    struct GC_Message_Ary recv_ary[GCC_BUFFER_SIZE];
+    uint64_t recv_highest_id;   /* highest message_id received, higher than recv_message_id if some are missing */
+    struct GC_Message_Ary *recv_ary;   /* GCC_BUFFER_SIZE items, NULL for relayed peers */
+    uint16_t recv_ary_count;   /* out of order messages in recv_ary */
+    uint32_t recv_ary_bytes;   /* bytes of the receive budget they take */
+    uint32_t recv_dropped;   /* out of order messages dropped because the receive budget or our share was used up */
+
+    uint16_t acks_owed;   /* messages received since we last told peer about them */
+    uint64_t ack_due_time;   /* ms, when we send an ack if no other packet carried it before */
+
+    uint64_t rtt;   /* smoothed round trip time in ms, 0 until the first sample */
+    uint64_t rtt_var;
+    uint64_t rto;   /* retransmission timeout in ms */
 
     GC_PeerAddress   addr;   /* holds peer's extended real public key and ip_port */
     uint32_t    public_key_hash;   /* hash of peer's real encryption public key */
+    bool        has_sig_key;   /* true once the peer's public signature key is in addr and indexed */
+
+    uint32_t    peernumber;   /* index in chat->gcc and chat->group, changes when other peers leave */
+    uint32_t    handle;   /* stays the same until the peer leaves */
     uint8_t     session_public_key[ENC_PUBLIC_KEY];   /* self session public key for this peer */
     uint8_t     session_secret_key[ENC_SECRET_KEY];   /* self session secret key for this peer */
     uint8_t     shared_key[crypto_box_BEFORENMBYTES];  /* made with our session sk and peer's session pk */
 
     int         tcp_connection_num;
+    bool        tcp_in_use;   /* whether we use tcp_connection_num, which other groups may share */
     uint64_t    last_recv_direct_time;   /* the last time we received a direct packet from this peer */
     uint64_t    last_tcp_relays_shared;  /* the last time we tried to send this peer our tcp relays */
 
     uint64_t    last_rcvd_ping;
     uint64_t    time_added;
+
+    uint8_t     *announcement;   /* last gossip packet the peer announced itself with in overlay groups */
+    uint16_t    announcement_len;
+    bool        pending_announcements;   /* joined the group through us, gets the announcements we know about */
+
+    uint64_t    history_requests_time;   /* start of the interval the peer's requests for our log are counted in */
+    uint8_t     history_requests;
+
     bool        pending_sync_request;   /* true if we have sent this peer a sync request and have not received a reply*/
     bool        pending_state_sync;    /* used for group state syncing */
+    bool        pending_delta_sync;    /* true if our delta sync request to this peer wasn't answered yet */
     bool        ignore;
     bool        handshaked; /* true if we've successfully handshaked with this peer */
     bool        confirmed;  /* true if this peer has given us their info */
+    bool        relayed;    /* true if we only know this peer from its broadcasts relayed by our neighbours */
 } GC_Connection;
 
+struct GC_Peer_Slot {
+    GC_Connection *gconn;   /* NULL if the slot is free */
+    uint32_t generation;   /* incremented when the slot is freed so that old handles stop working */
+    uint32_t next_free;   /* same as chat->free_peer_slot */
+};
+
+/* Allocates a zeroed connection for peernumber and gives it a handle.
+ *
+ * Returns the new connection on success.
+ * Returns NULL on failure.
+ */
+GC_Connection *gcc_new_connection(GC_Chat *chat, uint32_t peernumber);
+
+/* Allocates the send and recv arrays of gconn, which are needed to exchange lossless packets with the peer.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+int gcc_init_buffers(GC_Connection *gconn);
+
+/* Frees gconn and releases its handle. */
+void gcc_free_connection(GC_Chat *chat, GC_Connection *gconn);
+
+/* Returns the connection of the peer with handle.
+ * Returns NULL if handle is invalid or the peer has left.
+ */
+GC_Connection *gcc_get_connection(const GC_Chat *chat, uint32_t handle);
+
 
 /* Adds data of length to peernum's send_ary.
  *
@@ -86,10 +173,12 @@ int gcc_add_send_ary(GC_Chat *chat, const uint8_t *data, uint32_t length, uint32
                      uint8_t packet_type);
 
 /* Decides if message need to be put in recv_ary or immediately handled.
+ * Out of order messages are kept in the chat's receive arena, they are dropped if the
+ * receive budget or the peer's share of it is used up and the peer sends them again.
  *
  * Return 2 if message is in correct sequence and may be handled immediately.
  * Return 1 if packet is out of sequence and added to recv_ary.
- * Return 0 if message is a duplicate.
+ * Return 0 if message is a duplicate or was dropped.
  * Return -1 on failure
  */
 int gcc_handle_recv_message(GC_Chat *chat, uint32_t peernum, const uint8_t *data, uint32_t length,
@@ -103,7 +192,38 @@ uint16_t get_ary_index(uint64_t message_id);
  * Returns 0 if success.
  * Returns -1 on failure.
  */
-int gcc_handle_ack(GC_Connection *gconn, uint64_t message_id);
+int gcc_handle_ack(Mono_Time *mono_time, GC_Connection *gconn, uint64_t message_id);
+
+/* Removes every send_ary item up to ack_id, which peer told us it received in sequence.
+ *
+ * Returns 0 if success.
+ * Returns -1 if ack_id is invalid.
+ */
+int gcc_handle_cumulative_ack(Mono_Time *mono_time, GC_Connection *gconn, uint64_t ack_id);
+
+/* Packs an ack for the messages we received from peer in data of length bytes
+ * (at least GCC_MAX_ACK_SIZE), and marks them as acked.
+ *
+ * Returns length of the ack.
+ */
+uint32_t gcc_pack_ack(GC_Connection *gconn, uint8_t *data, uint32_t length);
+
+/* Handles an ack packed with gcc_pack_ack(). Messages peer is missing while it received
+ * later ones are sent again right away.
+ *
+ * An ack with a range out of order, past what we sent or past the send buffer is rejected as
+ * a whole.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+int gcc_handle_ack_packet(const GC_Chat *chat, GC_Connection *gconn, const uint8_t *data, uint32_t length);
+
+/* Called when a packet carrying ack_id as cumulative ack is sent to peer. */
+void gcc_ack_sent(GC_Connection *gconn, uint64_t ack_id);
+
+/* Returns true if we should send peer an ack now instead of waiting for other traffic to carry it. */
+bool gcc_ack_due(const GC_Connection *gconn, uint64_t current_time);
 
 /* Checks for and handles messages that are in proper sequence in peernum's recv_ary.
  * This should always be called after a new packet is successfully handled.
@@ -116,7 +236,7 @@ int gcc_check_recv_ary(Messenger *m, int groupnum, uint32_t peernum);
 void gcc_resend_packets(Messenger *m, GC_Chat *chat, uint32_t peernumber);
 
 /* Returns true if we have a direct connection with this group connection */
-bool gcc_connection_is_direct(const GC_Connection *gconn);
+bool gcc_connection_is_direct(const Mono_Time *mono_time, const GC_Connection *gconn);
 
 /* Sends a packet to the peer associated with gconn.
  *
@@ -126,10 +246,13 @@ bool gcc_connection_is_direct(const GC_Connection *gconn);
 int gcc_send_group_packet(const GC_Chat *chat, const GC_Connection *gconn, const uint8_t *packet,
                           uint16_t length, uint8_t packet_type);
 
+/* Frees the send and recv arrays of gconn, for peers we stop exchanging lossless packets with. */
+void gcc_free_buffers(GC_Chat *chat, GC_Connection *gconn);
+
 /* called when a peer leaves the group */
-void gcc_peer_cleanup(GC_Connection *gconn);
+void gcc_peer_cleanup(GC_Chat *chat, GC_Connection *gconn);
 
-/* called on group exit */
+/* called on group exit, frees all the connections */
 void gcc_cleanup(GC_Chat *chat);
 
 #endif  /* GROUP_CONNECTION_H */
@@ -0,0 +1,196 @@
+/* group_gossip.c
+ *
+ * Signed gossip used to relay group broadcasts between neighbours in overlay groups
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "group_gossip.h"
+#include "util.h"
+
+#include <stdlib.h>
+
+/* Packets are [header][payload][signature], the signature is made over
+ * [chat_id][header without the hop count][payload].
+ */
+
+#define GOSSIP_SIGNED_OFFSET sizeof(uint8_t)
+
+int gc_gossip_pack(uint8_t *packet, uint32_t max_length, const uint8_t *chat_id, const uint8_t *self_public_key,
+                   const uint8_t *self_secret_key, uint64_t seq, const uint8_t *payload, uint32_t length)
+{
+    if (length == 0 || max_length < GC_GOSSIP_OVERHEAD || length > max_length - GC_GOSSIP_OVERHEAD)
+        return -1;
+
+    uint32_t packed_len = 0;
+
+    packet[packed_len] = 0;
+    packed_len += sizeof(uint8_t);
+    memcpy(packet + packed_len, self_public_key, EXT_PUBLIC_KEY);
+    packed_len += EXT_PUBLIC_KEY;
+    U64_to_bytes(packet + packed_len, seq);
+    packed_len += sizeof(uint64_t);
+    memcpy(packet + packed_len, payload, length);
+    packed_len += length;
+
+    uint32_t signed_len = CHAT_ID_SIZE + packed_len - GOSSIP_SIGNED_OFFSET;
+    uint8_t *to_sign = malloc(signed_len);
+
+    if (to_sign == NULL)
+        return -1;
+
+    memcpy(to_sign, chat_id, CHAT_ID_SIZE);
+    memcpy(to_sign + CHAT_ID_SIZE, packet + GOSSIP_SIGNED_OFFSET, packed_len - GOSSIP_SIGNED_OFFSET);
+
+    int ret = crypto_sign_detached(packet + packed_len, NULL, to_sign, signed_len, SIG_SK(self_secret_key));
+    free(to_sign);
+
+    if (ret != 0)
+        return -1;
+
+    return packed_len + SIGNATURE_SIZE;
+}
+
+int gc_gossip_unpack(GC_Gossip *gossip, const uint8_t *packet, uint32_t length)
+{
+    if (length <= GC_GOSSIP_OVERHEAD)
+        return -1;
+
+    gossip->hops = packet[0];
+    gossip->origin_pk = packet + sizeof(uint8_t);
+    bytes_to_U64(&gossip->seq, packet + sizeof(uint8_t) + EXT_PUBLIC_KEY);
+    gossip->payload = packet + GC_GOSSIP_HEADER_SIZE;
+    gossip->length = length - GC_GOSSIP_OVERHEAD;
+
+    return 0;
+}
+
+bool gc_gossip_verify(const uint8_t *chat_id, const uint8_t *packet, uint32_t length)
+{
+    if (length <= GC_GOSSIP_OVERHEAD)
+        return false;
+
+    uint32_t signed_len = CHAT_ID_SIZE + length - SIGNATURE_SIZE - GOSSIP_SIGNED_OFFSET;
+    uint8_t *to_verify = malloc(signed_len);
+
+    if (to_verify == NULL)
+        return false;
+
+    memcpy(to_verify, chat_id, CHAT_ID_SIZE);
+    memcpy(to_verify + CHAT_ID_SIZE, packet + GOSSIP_SIGNED_OFFSET, length - SIGNATURE_SIZE - GOSSIP_SIGNED_OFFSET);
+
+    const uint8_t *origin_sig_pk = SIG_PK(packet + sizeof(uint8_t));
+    int ret = crypto_sign_verify_detached(packet + length - SIGNATURE_SIZE, to_verify, signed_len, origin_sig_pk);
+    free(to_verify);
+
+    return ret == 0;
+}
+
+static uint32_t gossip_hash(const uint8_t *origin_sig_pk)
+{
+    return jenkins_one_at_a_time_hash(origin_sig_pk, SIG_PUBLIC_KEY);
+}
+
+static bool gossip_cache_match(const void *object, uint32_t value, const void *key)
+{
+    const GC_Gossip_Cache *cache = object;
+    return memcmp(cache->sig_pks[value], key, SIG_PUBLIC_KEY) == 0;
+}
+
+static uint32_t gossip_cache_find(const GC_Gossip_Cache *cache, const uint8_t *origin_sig_pk)
+{
+    if (cache->count == 0)
+        return HASH_INDEX_NONE;
+
+    return hash_index_find(&cache->index, gossip_hash(origin_sig_pk), &gossip_cache_match, cache, origin_sig_pk);
+}
+
+bool gc_gossip_cache_has(const GC_Gossip_Cache *cache, const uint8_t *origin_sig_pk, uint64_t seq)
+{
+    uint32_t pos = gossip_cache_find(cache, origin_sig_pk);
+
+    if (pos == HASH_INDEX_NONE || seq > cache->highest[pos])
+        return false;
+
+    uint64_t age = cache->highest[pos] - seq;
+
+    if (age >= GC_GOSSIP_WINDOW)
+        return true;
+
+    return (cache->windows[pos] >> age) & 1;
+}
+
+int gc_gossip_cache_add(GC_Gossip_Cache *cache, const uint8_t *origin_sig_pk, uint64_t seq)
+{
+    if (cache->sig_pks == NULL) {
+        cache->sig_pks = malloc(GC_GOSSIP_CACHE_SIZE * SIG_PUBLIC_KEY);
+        cache->highest = malloc(GC_GOSSIP_CACHE_SIZE * sizeof(uint64_t));
+        cache->windows = malloc(GC_GOSSIP_CACHE_SIZE * sizeof(uint64_t));
+
+        if (cache->sig_pks == NULL || cache->highest == NULL || cache->windows == NULL) {
+            gc_gossip_cache_free(cache);
+            return -1;
+        }
+    }
+
+    uint32_t pos = gossip_cache_find(cache, origin_sig_pk);
+
+    if (pos != HASH_INDEX_NONE) {
+        if (seq > cache->highest[pos]) {
+            uint64_t shift = seq - cache->highest[pos];
+            cache->windows[pos] = shift >= GC_GOSSIP_WINDOW ? 1 : (cache->windows[pos] << shift) | 1;
+            cache->highest[pos] = seq;
+        } else if (cache->highest[pos] - seq < GC_GOSSIP_WINDOW) {
+            cache->windows[pos] |= (uint64_t)1 << (cache->highest[pos] - seq);
+        }
+
+        return 0;
+    }
+
+    pos = cache->next;
+
+    if (cache->count == GC_GOSSIP_CACHE_SIZE) {
+        hash_index_remove(&cache->index, gossip_hash(cache->sig_pks[pos]), pos);
+        --cache->count;
+    }
+
+    if (hash_index_add(&cache->index, gossip_hash(origin_sig_pk), pos) == -1)
+        return -1;
+
+    memcpy(cache->sig_pks[pos], origin_sig_pk, SIG_PUBLIC_KEY);
+    cache->highest[pos] = seq;
+    cache->windows[pos] = 1;
+    cache->next = (pos + 1) % GC_GOSSIP_CACHE_SIZE;
+    ++cache->count;
+
+    return 0;
+}
+
+void gc_gossip_cache_free(GC_Gossip_Cache *cache)
+{
+    free(cache->sig_pks);
+    free(cache->highest);
+    free(cache->windows);
+    hash_index_free(&cache->index);
+    memset(cache, 0, sizeof(GC_Gossip_Cache));
+}
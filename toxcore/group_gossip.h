@@ -0,0 +1,108 @@
+/* group_gossip.h
+ *
+ * Signed gossip used to relay group broadcasts between neighbours in overlay groups
+ * -Each broadcast is signed once by its origin and verified by every peer it reaches
+ * -Relaying peers only change the hop count, which isn't signed
+ * -A window of the recently seen sequence numbers of each origin stops each peer from relaying
+ *  a broadcast more than once, older broadcasts are dropped
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GROUP_GOSSIP_H
+#define GROUP_GOSSIP_H
+
+#include "DHT.h"
+#include "hash_index.h"
+
+/* [uint8_t hops][origin extended public key][uint64_t sequence number] */
+#define GC_GOSSIP_HEADER_SIZE (sizeof(uint8_t) + EXT_PUBLIC_KEY + sizeof(uint64_t))
+
+/* Header and signature of the origin added to the broadcast. */
+#define GC_GOSSIP_OVERHEAD (GC_GOSSIP_HEADER_SIZE + SIGNATURE_SIZE)
+
+/* Broadcasts that went through more peers than this are not relayed anymore. */
+#define GC_GOSSIP_MAX_HOPS 16
+
+/* Number of origins whose broadcasts are remembered for duplicate suppression. */
+#define GC_GOSSIP_CACHE_SIZE 4096
+
+/* Broadcasts of an origin this much older than its newest one are dropped, as they can't be told
+ * apart from replays anymore. The window is a uint64_t bitmap.
+ */
+#define GC_GOSSIP_WINDOW 64
+
+typedef struct {
+    uint8_t     hops;
+    const uint8_t *origin_pk;   /* EXT_PUBLIC_KEY bytes, points into the packet */
+    uint64_t    seq;
+    const uint8_t *payload;   /* points into the packet */
+    uint32_t    length;
+} GC_Gossip;
+
+/* A zeroed GC_Gossip_Cache is a valid empty cache, memory is allocated on the first add.
+ *
+ * Origins must number their broadcasts in increasing order, also across sessions. Only once more
+ * than GC_GOSSIP_CACHE_SIZE other origins were added is an origin forgotten.
+ */
+typedef struct {
+    uint8_t     (*sig_pks)[SIG_PUBLIC_KEY];   /* ring of remembered origins, oldest first from next */
+    uint64_t    *highest;   /* the highest sequence number seen of each origin */
+    uint64_t    *windows;   /* bit i is set if highest - i was seen */
+    uint32_t    next;
+    uint32_t    count;
+    Hash_Index  index;   /* ring positions by hash of origin */
+} GC_Gossip_Cache;
+
+/* Packs payload of length as a gossip packet from self with sequence number seq and signs it.
+ *
+ * The signature covers chat_id as well so that broadcasts can't be replayed in other groups.
+ *
+ * Returns length of the packet on success.
+ * Returns -1 on failure.
+ */
+int gc_gossip_pack(uint8_t *packet, uint32_t max_length, const uint8_t *chat_id, const uint8_t *self_public_key,
+                   const uint8_t *self_secret_key, uint64_t seq, const uint8_t *payload, uint32_t length);
+
+/* Unpacks the gossip packet of length into gossip without checking the signature.
+ *
+ * Returns 0 on success.
+ * Returns -1 if the packet is malformed.
+ */
+int gc_gossip_unpack(GC_Gossip *gossip, const uint8_t *packet, uint32_t length);
+
+/* Returns true if the gossip packet of length was signed by its origin for chat_id. */
+bool gc_gossip_verify(const uint8_t *chat_id, const uint8_t *packet, uint32_t length);
+
+/* Returns true if the broadcast of origin with seq was seen already or is older than the window,
+ * either way it must be dropped.
+ */
+bool gc_gossip_cache_has(const GC_Gossip_Cache *cache, const uint8_t *origin_sig_pk, uint64_t seq);
+
+/* Adds the broadcast of origin with seq to cache, forgetting the oldest origin if the cache is full.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+int gc_gossip_cache_add(GC_Gossip_Cache *cache, const uint8_t *origin_sig_pk, uint64_t seq);
+
+/* Frees the memory used by cache and empties it. */
+void gc_gossip_cache_free(GC_Gossip_Cache *cache);
+
+#endif
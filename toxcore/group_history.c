@@ -0,0 +1,687 @@
+/* group_history.c
+ *
+ * Bounded, append-only log of the messages of a group chat.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "group_history.h"
+#include "util.h"
+
+#include <stdlib.h>
+
+#if !(defined(_WIN32) || defined(__WIN32__) || defined (WIN32))
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GC_HISTORY_MMAP
+#endif
+
+/* The file starts with a GC_History_Header, followed by the ring of entries. Positions in the
+ * ring only ever grow, an entry at position pos is at data[pos % data_size] and may wrap around.
+ *
+ * An entry is [u16 entry length][u64 time][public key][signature][u8 type][u8 nick length][nick][message].
+ */
+#define GC_HISTORY_MAGIC "toxgchl2"
+#define GC_HISTORY_MAGIC_SIZE 8
+#define GC_HISTORY_ENTRY_HEADER_SIZE (sizeof(uint16_t) + TIME_STAMP_SIZE + EXT_PUBLIC_KEY + SIGNATURE_SIZE\
+                                      + sizeof(uint8_t) * 2)
+#define GC_HISTORY_MAX_ENTRY_SIZE (GC_HISTORY_ENTRY_HEADER_SIZE + MAX_GC_NICK_SIZE + MAX_GC_MESSAGE_SIZE)
+
+typedef struct {
+    uint8_t     magic[GC_HISTORY_MAGIC_SIZE];
+    uint64_t    data_size;
+    uint64_t    start;   /* position of the oldest entry */
+    uint64_t    end;     /* position after the newest entry */
+    uint64_t    first_seq;
+    uint64_t    next_seq;
+} GC_History_Header;
+
+struct GC_History {
+    int         fd;
+    uint8_t     *map;
+    size_t      map_size;
+
+    GC_History_Header *header;
+    uint8_t     *data;
+
+    /* Positions of the entries, indexed by sequence number modulo positions_size, a power of 2 */
+    uint64_t    *positions;
+    uint64_t    positions_size;
+};
+
+static void ring_read(const GC_History *history, uint64_t pos, uint8_t *data, uint32_t length)
+{
+    uint64_t offset = pos % history->header->data_size;
+    uint64_t first = history->header->data_size - offset;
+
+    if (first >= length) {
+        memcpy(data, history->data + offset, length);
+    } else {
+        memcpy(data, history->data + offset, first);
+        memcpy(data + first, history->data, length - first);
+    }
+}
+
+static void ring_write(GC_History *history, uint64_t pos, const uint8_t *data, uint32_t length)
+{
+    uint64_t offset = pos % history->header->data_size;
+    uint64_t first = history->header->data_size - offset;
+
+    if (first >= length) {
+        memcpy(history->data + offset, data, length);
+    } else {
+        memcpy(history->data + offset, data, first);
+        memcpy(history->data, data + first, length - first);
+    }
+}
+
+static uint64_t get_position(const GC_History *history, uint64_t seq)
+{
+    return history->positions[seq & (history->positions_size - 1)];
+}
+
+/* Makes room in positions for the entries up to and including seq. The positions of the
+ * entries before seq must be set.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int reserve_positions(GC_History *history, uint64_t seq)
+{
+    uint64_t needed = seq - history->header->first_seq + 1;
+
+    if (needed <= history->positions_size)
+        return 0;
+
+    uint64_t new_size = history->positions_size ? history->positions_size : 256;
+
+    while (new_size < needed)
+        new_size *= 2;
+
+    uint64_t *positions = malloc(sizeof(uint64_t) * new_size);
+
+    if (positions == NULL)
+        return -1;
+
+    uint64_t i;
+
+    for (i = history->header->first_seq; i < seq; ++i)
+        positions[i & (new_size - 1)] = get_position(history, i);
+
+    free(history->positions);
+    history->positions = positions;
+    history->positions_size = new_size;
+    return 0;
+}
+
+static uint16_t get_entry_length(const GC_History *history, uint64_t pos)
+{
+    uint8_t data[sizeof(uint16_t)];
+    ring_read(history, pos, data, sizeof(data));
+
+    uint16_t length;
+    bytes_to_U16(&length, data);
+    return length;
+}
+
+static uint64_t get_entry_time(const GC_History *history, uint64_t seq)
+{
+    uint8_t data[TIME_STAMP_SIZE];
+    ring_read(history, get_position(history, seq) + sizeof(uint16_t), data, sizeof(data));
+
+    uint64_t time;
+    bytes_to_U64(&time, data);
+    return time;
+}
+
+/* Empties the log. */
+static void init_header(GC_History_Header *header, uint64_t data_size)
+{
+    memset(header, 0, sizeof(GC_History_Header));
+    memcpy(header->magic, GC_HISTORY_MAGIC, GC_HISTORY_MAGIC_SIZE);
+    header->data_size = data_size;
+    header->first_seq = 1;
+    header->next_seq = 1;
+}
+
+/* Finds the positions of all entries, the log is cut short at the first entry that is cut short.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int load_positions(GC_History *history)
+{
+    GC_History_Header *header = history->header;
+
+    if (memcmp(header->magic, GC_HISTORY_MAGIC, GC_HISTORY_MAGIC_SIZE) != 0
+            || header->end < header->start || header->end - header->start > header->data_size
+            || header->next_seq < header->first_seq || header->first_seq == 0)
+        init_header(header, header->data_size);
+
+    uint64_t seq, pos = header->start;
+
+    for (seq = header->first_seq; seq < header->next_seq; ++seq) {
+        uint16_t length = pos < header->end ? get_entry_length(history, pos) : 0;
+
+        if (length < GC_HISTORY_ENTRY_HEADER_SIZE || length > GC_HISTORY_MAX_ENTRY_SIZE || pos + length > header->end)
+            break;
+
+        if (reserve_positions(history, seq) == -1)
+            return -1;
+
+        history->positions[seq & (history->positions_size - 1)] = pos;
+        pos += length;
+    }
+
+    header->next_seq = seq;
+    header->end = pos;
+    return 0;
+}
+
+GC_History *gc_history_open(const char *path, uint32_t size)
+{
+    if (size < GC_HISTORY_MIN_SIZE)
+        return NULL;
+
+    GC_History *history = calloc(1, sizeof(GC_History));
+
+    if (history == NULL)
+        return NULL;
+
+    history->fd = -1;
+    history->map_size = sizeof(GC_History_Header) + size;
+
+#ifdef GC_HISTORY_MMAP
+    history->fd = open(path, O_RDWR | O_CREAT, 0600);
+
+    if (history->fd == -1) {
+        free(history);
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(history->fd, &st) == -1 || ((size_t)st.st_size != history->map_size
+                                           && (ftruncate(history->fd, 0) == -1
+                                               || ftruncate(history->fd, history->map_size) == -1))) {
+        close(history->fd);
+        free(history);
+        return NULL;
+    }
+
+    history->map = mmap(NULL, history->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, history->fd, 0);
+
+    if (history->map == MAP_FAILED) {
+        close(history->fd);
+        free(history);
+        return NULL;
+    }
+
+#else
+    /* No mapped files, the log is kept in memory only */
+    history->map = calloc(1, history->map_size);
+
+    if (history->map == NULL) {
+        free(history);
+        return NULL;
+    }
+
+#endif
+
+    history->header = (GC_History_Header *)history->map;
+    history->data = history->map + sizeof(GC_History_Header);
+
+    if (history->header->data_size != size)
+        init_header(history->header, size);
+
+    if (load_positions(history) == -1) {
+        gc_history_close(history);
+        return NULL;
+    }
+
+    return history;
+}
+
+void gc_history_close(GC_History *history)
+{
+    if (history == NULL)
+        return;
+
+#ifdef GC_HISTORY_MMAP
+    munmap(history->map, history->map_size);
+    close(history->fd);
+#else
+    free(history->map);
+#endif
+
+    free(history->positions);
+    free(history);
+}
+
+int64_t gc_history_append(GC_History *history, const GC_History_Entry *entry)
+{
+    if (entry->nick_len > MAX_GC_NICK_SIZE || entry->length > MAX_GC_MESSAGE_SIZE)
+        return -1;
+
+    GC_History_Header *header = history->header;
+    uint16_t length = GC_HISTORY_ENTRY_HEADER_SIZE + entry->nick_len + entry->length;
+
+    if (reserve_positions(history, header->next_seq) == -1)
+        return -1;
+
+    while (header->end - header->start + length > header->data_size) {
+        header->start += get_entry_length(history, header->start);
+        ++header->first_seq;
+    }
+
+    uint8_t data[GC_HISTORY_MAX_ENTRY_SIZE];
+    uint16_t packed_len = 0;
+
+    U16_to_bytes(data, length);
+    packed_len += sizeof(uint16_t);
+    U64_to_bytes(data + packed_len, entry->time);
+    packed_len += TIME_STAMP_SIZE;
+    memcpy(data + packed_len, entry->public_key, EXT_PUBLIC_KEY);
+    packed_len += EXT_PUBLIC_KEY;
+    memcpy(data + packed_len, entry->signature, SIGNATURE_SIZE);
+    packed_len += SIGNATURE_SIZE;
+    data[packed_len++] = entry->type;
+    data[packed_len++] = entry->nick_len;
+    memcpy(data + packed_len, entry->nick, entry->nick_len);
+    packed_len += entry->nick_len;
+    memcpy(data + packed_len, entry->message, entry->length);
+
+    ring_write(history, header->end, data, length);
+    history->positions[header->next_seq & (history->positions_size - 1)] = header->end;
+    header->end += length;
+
+    return header->next_seq++;
+}
+
+uint64_t gc_history_first_seq(const GC_History *history)
+{
+    return history->header->first_seq;
+}
+
+uint64_t gc_history_next_seq(const GC_History *history)
+{
+    return history->header->next_seq;
+}
+
+uint64_t gc_history_last_time(const GC_History *history)
+{
+    if (history->header->next_seq == history->header->first_seq)
+        return 0;
+
+    return get_entry_time(history, history->header->next_seq - 1);
+}
+
+int gc_history_get(const GC_History *history, uint64_t seq, GC_History_Entry *entry)
+{
+    if (seq < history->header->first_seq || seq >= history->header->next_seq)
+        return -1;
+
+    uint64_t pos = get_position(history, seq);
+    uint16_t length = get_entry_length(history, pos);
+    uint8_t data[GC_HISTORY_MAX_ENTRY_SIZE];
+    ring_read(history, pos, data, length);
+
+    uint16_t unpacked_len = sizeof(uint16_t);
+    bytes_to_U64(&entry->time, data + unpacked_len);
+    unpacked_len += TIME_STAMP_SIZE;
+    memcpy(entry->public_key, data + unpacked_len, EXT_PUBLIC_KEY);
+    unpacked_len += EXT_PUBLIC_KEY;
+    memcpy(entry->signature, data + unpacked_len, SIGNATURE_SIZE);
+    unpacked_len += SIGNATURE_SIZE;
+    entry->type = data[unpacked_len++];
+    entry->nick_len = data[unpacked_len++];
+
+    if (entry->nick_len > MAX_GC_NICK_SIZE || unpacked_len + entry->nick_len > length)
+        return -1;
+
+    memcpy(entry->nick, data + unpacked_len, entry->nick_len);
+    unpacked_len += entry->nick_len;
+    entry->length = length - unpacked_len;
+    memcpy(entry->message, data + unpacked_len, entry->length);
+
+    return 0;
+}
+
+uint64_t gc_history_find_time(const GC_History *history, uint64_t time)
+{
+    uint64_t seq;
+
+    for (seq = history->header->first_seq; seq < history->header->next_seq; ++seq) {
+        if (get_entry_time(history, seq) >= time)
+            break;
+    }
+
+    return seq;
+}
+
+bool gc_history_contains(const GC_History *history, const GC_History_Entry *entry, uint64_t before_seq)
+{
+    if (before_seq > history->header->next_seq)
+        before_seq = history->header->next_seq;
+
+    GC_History_Entry logged;
+    uint64_t seq;
+
+    for (seq = before_seq; seq > history->header->first_seq; --seq) {
+        if (gc_history_get(history, seq - 1, &logged) == -1 || logged.time + GC_HISTORY_MAX_CLOCK_SKEW < entry->time)
+            break;
+
+        if (memcmp(logged.signature, entry->signature, SIGNATURE_SIZE) == 0
+                && memcmp(SIG_PK(logged.public_key), SIG_PK(entry->public_key), SIG_PUBLIC_KEY) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/* Puts the data the signature of entry is made over in data, which must have room for
+ * GC_HISTORY_MAX_SIGNED_SIZE bytes.
+ *
+ * return length of the data.
+ */
+#define GC_HISTORY_MAX_SIGNED_SIZE (CHAT_ID_SIZE + TIME_STAMP_SIZE + sizeof(uint8_t) + MAX_GC_MESSAGE_SIZE)
+static uint32_t make_signed_data(const GC_History_Entry *entry, const uint8_t *chat_id, uint8_t *data)
+{
+    uint32_t len = 0;
+    memcpy(data, chat_id, CHAT_ID_SIZE);
+    len += CHAT_ID_SIZE;
+    U64_to_bytes(data + len, entry->time);
+    len += TIME_STAMP_SIZE;
+    data[len++] = entry->type;
+    memcpy(data + len, entry->message, entry->length);
+    return len + entry->length;
+}
+
+int gc_history_sign(GC_History_Entry *entry, const uint8_t *chat_id, const uint8_t *secret_key)
+{
+    if (entry->length > MAX_GC_MESSAGE_SIZE)
+        return -1;
+
+    uint8_t data[GC_HISTORY_MAX_SIGNED_SIZE];
+    uint32_t length = make_signed_data(entry, chat_id, data);
+
+    if (crypto_sign_detached(entry->signature, NULL, data, length, SIG_SK(secret_key)) != 0)
+        return -1;
+
+    return 0;
+}
+
+bool gc_history_verify(const GC_History_Entry *entry, const uint8_t *chat_id)
+{
+    if (entry->length > MAX_GC_MESSAGE_SIZE)
+        return false;
+
+    uint8_t data[GC_HISTORY_MAX_SIGNED_SIZE];
+    uint32_t length = make_signed_data(entry, chat_id, data);
+
+    return crypto_sign_verify_detached(entry->signature, data, length, SIG_PK(entry->public_key)) == 0;
+}
+
+
+/********* Batches *********/
+
+/* A batch is [u8 number of senders][senders][u16 number of entries][u64 time of the first entry][entries]
+ *
+ * A sender is [public key][u8 nick length][nick], an entry is [u8 sender index][u8 type]
+ * [varint zigzag encoded time difference with the entry before][signature][varint message length][message].
+ */
+#define GC_HISTORY_BATCH_HEADER_SIZE (sizeof(uint8_t) + sizeof(uint16_t) + TIME_STAMP_SIZE)
+#define GC_HISTORY_MAX_SENDERS UINT8_MAX
+#define MAX_VARINT_SIZE 10
+
+static uint16_t pack_varint(uint8_t *data, uint64_t value)
+{
+    uint16_t len = 0;
+
+    while (value >= 0x80) {
+        data[len++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    data[len++] = value;
+    return len;
+}
+
+/* return -1 on failure.
+ * return number of bytes unpacked on success.
+ */
+static int unpack_varint(uint64_t *value, const uint8_t *data, uint16_t length)
+{
+    uint16_t len = 0;
+    *value = 0;
+
+    while (len < length && len < MAX_VARINT_SIZE) {
+        *value |= (uint64_t)(data[len] & 0x7F) << (7 * len);
+
+        if ((data[len++] & 0x80) == 0)
+            return len;
+    }
+
+    return -1;
+}
+
+static uint64_t zigzag_encode(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t zigzag_decode(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+int gc_history_pack_batch(const GC_History *history, uint64_t seq, uint8_t *data, uint16_t length,
+                          uint64_t *next_seq)
+{
+    if (length < GC_HISTORY_BATCH_HEADER_SIZE)
+        return -1;
+
+    if (seq < history->header->first_seq)
+        seq = history->header->first_seq;
+
+    uint8_t senders[length];
+    uint8_t entries[length];
+    uint16_t sender_offsets[GC_HISTORY_MAX_SENDERS];
+    uint16_t senders_len = 0, entries_len = 0, num_entries = 0;
+    uint8_t num_senders = 0;
+    uint64_t base_time = 0, prev_time = 0;
+    GC_History_Entry entry;
+
+    for (; seq < history->header->next_seq && num_entries < UINT16_MAX; ++seq) {
+        if (gc_history_get(history, seq, &entry) == -1)
+            return -1;
+
+        uint8_t sender_len = EXT_PUBLIC_KEY + sizeof(uint8_t) + entry.nick_len;
+        uint16_t i;
+
+        for (i = 0; i < num_senders; ++i) {
+            if (memcmp(senders + sender_offsets[i], entry.public_key, EXT_PUBLIC_KEY) == 0
+                    && senders[sender_offsets[i] + EXT_PUBLIC_KEY] == entry.nick_len
+                    && memcmp(senders + sender_offsets[i] + EXT_PUBLIC_KEY + 1, entry.nick, entry.nick_len) == 0)
+                break;
+        }
+
+        bool new_sender = i == num_senders;
+
+        if (new_sender && num_senders == GC_HISTORY_MAX_SENDERS)
+            break;
+
+        if (num_entries == 0)
+            base_time = prev_time = entry.time;
+
+        uint8_t packed[2 + MAX_VARINT_SIZE * 2 + SIGNATURE_SIZE + MAX_GC_MESSAGE_SIZE];
+        uint16_t packed_len = 0;
+
+        packed[packed_len++] = i;
+        packed[packed_len++] = entry.type;
+        packed_len += pack_varint(packed + packed_len, zigzag_encode((int64_t)(entry.time - prev_time)));
+        memcpy(packed + packed_len, entry.signature, SIGNATURE_SIZE);
+        packed_len += SIGNATURE_SIZE;
+        packed_len += pack_varint(packed + packed_len, entry.length);
+        memcpy(packed + packed_len, entry.message, entry.length);
+        packed_len += entry.length;
+
+        if ((uint32_t)GC_HISTORY_BATCH_HEADER_SIZE + senders_len + (new_sender ? sender_len : 0) + entries_len
+                + packed_len > length)
+            break;
+
+        if (new_sender) {
+            sender_offsets[num_senders++] = senders_len;
+            memcpy(senders + senders_len, entry.public_key, EXT_PUBLIC_KEY);
+            senders[senders_len + EXT_PUBLIC_KEY] = entry.nick_len;
+            memcpy(senders + senders_len + EXT_PUBLIC_KEY + 1, entry.nick, entry.nick_len);
+            senders_len += sender_len;
+        }
+
+        memcpy(entries + entries_len, packed, packed_len);
+        entries_len += packed_len;
+        prev_time = entry.time;
+        ++num_entries;
+    }
+
+    /* An entry that doesn't fit on its own would stop the batches there */
+    if (num_entries == 0 && seq < history->header->next_seq)
+        return -1;
+
+    uint16_t len = 0;
+    data[len++] = num_senders;
+    memcpy(data + len, senders, senders_len);
+    len += senders_len;
+    U16_to_bytes(data + len, num_entries);
+    len += sizeof(uint16_t);
+    U64_to_bytes(data + len, base_time);
+    len += TIME_STAMP_SIZE;
+    memcpy(data + len, entries, entries_len);
+    len += entries_len;
+
+    *next_seq = seq;
+    return len;
+}
+
+/* Unpacks a batch, calling function with object for each entry if function is non-NULL.
+ *
+ * return -1 on failure.
+ * return number of unpacked entries on success.
+ */
+static int unpack_batch(const uint8_t *data, uint16_t length, gc_history_entry_cb *function, void *object)
+{
+    if (length < GC_HISTORY_BATCH_HEADER_SIZE)
+        return -1;
+
+    uint16_t sender_offsets[GC_HISTORY_MAX_SENDERS];
+    uint16_t len = 0;
+    uint8_t num_senders = data[len++];
+    uint16_t i;
+
+    for (i = 0; i < num_senders; ++i) {
+        if (len + EXT_PUBLIC_KEY + sizeof(uint8_t) > length)
+            return -1;
+
+        uint8_t nick_len = data[len + EXT_PUBLIC_KEY];
+
+        if (nick_len > MAX_GC_NICK_SIZE || len + EXT_PUBLIC_KEY + sizeof(uint8_t) + nick_len > length)
+            return -1;
+
+        sender_offsets[i] = len;
+        len += EXT_PUBLIC_KEY + sizeof(uint8_t) + nick_len;
+    }
+
+    if (len + sizeof(uint16_t) + TIME_STAMP_SIZE > length)
+        return -1;
+
+    uint16_t num_entries;
+    bytes_to_U16(&num_entries, data + len);
+    len += sizeof(uint16_t);
+
+    uint64_t time;
+    bytes_to_U64(&time, data + len);
+    len += TIME_STAMP_SIZE;
+
+    GC_History_Entry entry;
+
+    for (i = 0; i < num_entries; ++i) {
+        if (len + 2 > length || data[len] >= num_senders)
+            return -1;
+
+        const uint8_t *sender = data + sender_offsets[data[len++]];
+        entry.type = data[len++];
+
+        uint64_t delta, message_len;
+        int delta_len = unpack_varint(&delta, data + len, length - len);
+
+        if (delta_len == -1)
+            return -1;
+
+        len += delta_len;
+
+        if (len + SIGNATURE_SIZE > length)
+            return -1;
+
+        const uint8_t *signature = data + len;
+        len += SIGNATURE_SIZE;
+        int message_len_len = unpack_varint(&message_len, data + len, length - len);
+
+        if (message_len_len == -1 || message_len > MAX_GC_MESSAGE_SIZE || len + message_len_len + message_len > length)
+            return -1;
+
+        len += message_len_len;
+        time += zigzag_decode(delta);
+
+        if (function == NULL) {
+            len += message_len;
+            continue;
+        }
+
+        entry.time = time;
+        memcpy(entry.public_key, sender, EXT_PUBLIC_KEY);
+        entry.nick_len = sender[EXT_PUBLIC_KEY];
+        memcpy(entry.nick, sender + EXT_PUBLIC_KEY + 1, entry.nick_len);
+        memcpy(entry.signature, signature, SIGNATURE_SIZE);
+        entry.length = message_len;
+        memcpy(entry.message, data + len, message_len);
+        len += message_len;
+
+        function(object, &entry);
+    }
+
+    if (len != length)
+        return -1;
+
+    return num_entries;
+}
+
+int gc_history_unpack_batch(const uint8_t *data, uint16_t length, gc_history_entry_cb *function, void *object)
+{
+    /* A batch is checked as a whole before any of its entries is handed over */
+    if (unpack_batch(data, length, NULL, NULL) == -1)
+        return -1;
+
+    return unpack_batch(data, length, function, object);
+}
@@ -0,0 +1,132 @@
+/* group_history.h
+ *
+ * Bounded, append-only log of the messages of a group chat.
+ *
+ * The log of a group is a ring kept in a memory mapped file, when it's full the oldest
+ * messages make room for new ones. Every logged message gets a sequence number that only
+ * means something to us, peers who catch up on missed messages ask us for ranges of them.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GROUP_HISTORY_H
+#define GROUP_HISTORY_H
+
+#include "group_chats.h"
+
+/* Default number of bytes of messages the log of a group holds. */
+#define GC_HISTORY_DEFAULT_SIZE (4 * 1024 * 1024)
+
+/* Smallest log, it must have room for a few of the largest messages. */
+#define GC_HISTORY_MIN_SIZE (64 * 1024)
+
+/* Clocks of peers may be this many seconds apart, entries are looked for this much before their time. */
+#define GC_HISTORY_MAX_CLOCK_SKEW 600
+
+typedef struct {
+    uint64_t    time;   /* Unix time the sender sent the message at, by its clock */
+    uint8_t     public_key[EXT_PUBLIC_KEY];   /* Of the sender */
+    uint8_t     nick[MAX_GC_NICK_SIZE];
+    uint8_t     nick_len;
+    uint8_t     type;   /* GROUP_MESSAGE_TYPE */
+    uint8_t     message[MAX_GC_MESSAGE_SIZE];
+    uint16_t    length;
+    uint8_t     signature[SIGNATURE_SIZE];   /* the sender's, see gc_history_sign() */
+} GC_History_Entry;
+
+/* Signs the time, type and message of entry with secret_key, the extended secret key of its sender.
+ * The signature covers chat_id as well so that messages can't be passed off as sent in other groups.
+ * The nick isn't signed, it's the one the sender had when the message was logged.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int gc_history_sign(GC_History_Entry *entry, const uint8_t *chat_id, const uint8_t *secret_key);
+
+/* return true if the signature of entry was made by its sender for the group with chat_id. */
+bool gc_history_verify(const GC_History_Entry *entry, const uint8_t *chat_id);
+
+/* Opens the log kept in the file at path, creating it if needed. size is the number of bytes
+ * of messages it holds, at least GC_HISTORY_MIN_SIZE. A file that isn't a log of that size is
+ * started over.
+ *
+ * return NULL on failure.
+ * return the log on success.
+ */
+GC_History *gc_history_open(const char *path, uint32_t size);
+
+/* Unmaps and closes the log. */
+void gc_history_close(GC_History *history);
+
+/* Appends entry to the log, dropping the oldest entries if there is no room for it.
+ *
+ * return -1 on failure.
+ * return the sequence number of the entry on success.
+ */
+int64_t gc_history_append(GC_History *history, const GC_History_Entry *entry);
+
+/* return the sequence number of the oldest entry in the log. */
+uint64_t gc_history_first_seq(const GC_History *history);
+
+/* return the sequence number the next entry will get. */
+uint64_t gc_history_next_seq(const GC_History *history);
+
+/* return the time of the newest entry in the log, 0 if it's empty. */
+uint64_t gc_history_last_time(const GC_History *history);
+
+/* Copies the entry with sequence number seq into entry.
+ *
+ * return -1 if the log doesn't hold it.
+ * return 0 on success.
+ */
+int gc_history_get(const GC_History *history, uint64_t seq, GC_History_Entry *entry);
+
+/* return the sequence number of the first entry with a time of at least time.
+ * return gc_history_next_seq() if there is none.
+ */
+uint64_t gc_history_find_time(const GC_History *history, uint64_t time);
+
+/* return true if one of the entries before sequence number before_seq has the same sender and
+ * signature as entry. Only the entries with a time of at least GC_HISTORY_MAX_CLOCK_SKEW before
+ * the time of entry are looked at, from newest to oldest.
+ */
+bool gc_history_contains(const GC_History *history, const GC_History_Entry *entry, uint64_t before_seq);
+
+/* Packs the entries from sequence number seq on into data, as many as fit in length bytes.
+ * The sender of each entry is packed only once per batch and times are packed as deltas, the
+ * signatures are packed as they are so that the receiver can check them.
+ * The sequence number of the first entry that wasn't packed is put in next_seq.
+ *
+ * return -1 on failure.
+ * return length of packed data on success.
+ */
+int gc_history_pack_batch(const GC_History *history, uint64_t seq, uint8_t *data, uint16_t length,
+                          uint64_t *next_seq);
+
+typedef void gc_history_entry_cb(void *object, const GC_History_Entry *entry);
+
+/* Unpacks a batch packed by gc_history_pack_batch, calling function with object and each
+ * entry in order.
+ *
+ * return -1 on failure, function isn't called then.
+ * return number of unpacked entries on success.
+ */
+int gc_history_unpack_batch(const uint8_t *data, uint16_t length, gc_history_entry_cb *function, void *object);
+
+#endif /* GROUP_HISTORY_H */
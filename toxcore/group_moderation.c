@@ -96,9 +96,20 @@ void mod_list_make_hash(GC_Chat *chat, uint8_t *hash)
         return;
     }
 
-    uint8_t data[chat->moderation.num_mods * GC_MOD_LIST_ENTRY_SIZE];
-    mod_list_pack(chat, data);
-    crypto_hash_sha256(hash, data, sizeof(data));
+    GC_Moderation *moderation = &chat->moderation;
+
+    /* Entries only added since the last hash are appended to the running hash */
+    if (moderation->num_hashed_mods == 0)
+        crypto_hash_sha256_init(&moderation->mod_list_hash_state);
+
+    for (; moderation->num_hashed_mods < moderation->num_mods; ++moderation->num_hashed_mods) {
+        crypto_hash_sha256_update(&moderation->mod_list_hash_state, moderation->mod_list[moderation->num_hashed_mods],
+                                  GC_MOD_LIST_ENTRY_SIZE);
+    }
+
+    crypto_hash_sha256_state state;
+    memcpy(&state, &moderation->mod_list_hash_state, sizeof(crypto_hash_sha256_state));
+    crypto_hash_sha256_final(&state, hash);
 }
 
 /* Returns moderator list index for public_sig_key.
@@ -152,6 +163,10 @@ int mod_list_remove_index(GC_Chat *chat, size_t index)
 
     --chat->moderation.num_mods;
 
+    /* The running hash covers the entries we move or remove */
+    if (index < chat->moderation.num_hashed_mods)
+        chat->moderation.num_hashed_mods = 0;
+
     if (index != chat->moderation.num_mods)
         memcpy(chat->moderation.mod_list[index], chat->moderation.mod_list[chat->moderation.num_mods], GC_MOD_LIST_ENTRY_SIZE);
 
@@ -203,6 +218,7 @@ int mod_list_add_entry(GC_Chat *chat, const uint8_t *mod_data)
 
     if (tmp_list == NULL) {
         chat->moderation.num_mods = 0;
+        chat->moderation.num_hashed_mods = 0;
         return -1;
     }
 
@@ -223,6 +239,7 @@ void mod_list_cleanup(GC_Chat *chat)
 {
     free_uint8_t_pointer_array(chat->moderation.mod_list, chat->moderation.num_mods);
     chat->moderation.num_mods = 0;
+    chat->moderation.num_hashed_mods = 0;
     chat->moderation.mod_list = NULL;
 }
 
@@ -431,12 +448,67 @@ void sanctions_list_make_hash(struct GC_Sanction *sanctions, uint32_t new_versio
     crypto_hash_sha256(hash, data, sizeof(data));
 }
 
+/* Returns the hash index key of the hash of a packed sanction. */
+static uint32_t get_sanction_hash_key(const uint8_t *hash)
+{
+    uint32_t key;
+    memcpy(&key, hash, sizeof(uint32_t));
+    return key;
+}
+
+static bool sanction_hash_match(const void *object, uint32_t value, const void *key)
+{
+    const GC_Moderation *moderation = object;
+    return memcmp(moderation->verified[value], key, GC_MODERATION_HASH_SIZE) == 0;
+}
+
+/* Returns true if the signature of the packed sanction with hash was verified before. */
+static bool sanctions_cache_has(const GC_Moderation *moderation, const uint8_t *hash)
+{
+    return hash_index_find(&moderation->verified_index, get_sanction_hash_key(hash), &sanction_hash_match,
+                           moderation, hash) != HASH_INDEX_NONE;
+}
+
+/* Remembers that the signature of the packed sanction with hash is valid.
+ * The cache keeps room for at least min_size entries and is emptied when full.
+ */
+static void sanctions_cache_add(GC_Moderation *moderation, const uint8_t *hash, uint32_t min_size)
+{
+    if (sanctions_cache_has(moderation, hash))
+        return;
+
+    if (min_size < GC_SANCTIONS_CACHE_SIZE)
+        min_size = GC_SANCTIONS_CACHE_SIZE;
+
+    if (moderation->verified_size < min_size) {
+        uint8_t (*tmp)[GC_MODERATION_HASH_SIZE] = realloc(moderation->verified, min_size * GC_MODERATION_HASH_SIZE);
+
+        if (tmp == NULL)
+            return;
+
+        moderation->verified = tmp;
+        moderation->verified_size = min_size;
+    }
+
+    if (moderation->num_verified == moderation->verified_size) {
+        hash_index_free(&moderation->verified_index);
+        moderation->num_verified = 0;
+    }
+
+    if (hash_index_add(&moderation->verified_index, get_sanction_hash_key(hash), moderation->num_verified) == -1)
+        return;
+
+    memcpy(moderation->verified[moderation->num_verified], hash, GC_MODERATION_HASH_SIZE);
+    ++moderation->num_verified;
+}
+
 /* Verifies that sanction contains valid info and was assigned by a current mod or group founder.
+ * Does not verify its signature.
  *
  * Returns 0 on success.
  * Returns -1 on failure.
  */
-static int sanctions_list_validate_entry(const GC_Chat *chat, struct GC_Sanction *sanction)
+static int sanctions_list_validate_fields(const GC_Chat *chat, const struct GC_Sanction *sanction)
 {
     if (!mod_list_verify_sig_pk(chat, sanction->public_sig_key))
         return -1;
@@ -458,16 +530,36 @@ static int sanctions_list_validate_entry(const GC_Chat *chat, struct GC_Sanction
             return -1;
     }
 
+    return 0;
+}
+
+/* Verifies that sanction contains valid info and was assigned by a current mod or group founder.
+ *
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+static int sanctions_list_validate_entry(GC_Chat *chat, struct GC_Sanction *sanction)
+{
+    if (sanctions_list_validate_fields(chat, sanction) == -1)
+        return -1;
+
     uint8_t packed_data[sizeof(struct GC_Sanction)];
     int packed_len = sanctions_list_pack(packed_data, sizeof(packed_data), sanction, NULL, 1);
 
     if (packed_len <= SIGNATURE_SIZE)
         return -1;
 
+    uint8_t hash[GC_MODERATION_HASH_SIZE];
+    crypto_hash_sha256(hash, packed_data, packed_len);
+
+    if (sanctions_cache_has(&chat->moderation, hash))
+        return 0;
+
     if (crypto_sign_verify_detached(sanction->signature, packed_data, packed_len - SIGNATURE_SIZE,
                                     sanction->public_sig_key) == -1)
         return -1;
 
+    sanctions_cache_add(&chat->moderation, hash, chat->moderation.num_sanctions + 1);
     return 0;
 }
 
@@ -529,24 +621,245 @@ static int sanctions_creds_validate(const GC_Chat *chat, struct GC_Sanction *san
 }
 
 /* Validates all sanction list entries as well as its credentials.
+ *
+ * Entries whose signature was verified before are skipped, the others are verified in one batch
+ * on pipeline's worker threads, or on the calling thread if pipeline is NULL.
  *
  * Returns 0 if all entries are valid.
  * Returns -1 if the list contains an invalid entry or the credentials are invalid.
  */
-int sanctions_list_check_integrity(const GC_Chat *chat, struct GC_Sanction_Creds *creds,
-                                   struct GC_Sanction *sanctions, uint32_t num_sanctions)
+int sanctions_list_check_integrity(GC_Chat *chat, struct GC_Sanction_Creds *creds,
+                                   struct GC_Sanction *sanctions, uint32_t num_sanctions, Crypto_Pipeline *pipeline)
 {
-    uint32_t i;
+    if (num_sanctions == 0)
+        return sanctions_creds_validate(chat, sanctions, creds, num_sanctions);
+
+    uint8_t *packed = malloc(sizeof(struct GC_Sanction) * num_sanctions);
+    uint8_t (*hashes)[GC_MODERATION_HASH_SIZE] = malloc(GC_MODERATION_HASH_SIZE * num_sanctions);
+    Crypto_Job *jobs = calloc(num_sanctions, sizeof(Crypto_Job));
+    uint32_t i, num_jobs = 0;
+    int ret = -1;
+
+    if (packed == NULL || hashes == NULL || jobs == NULL)
+        goto out;
 
     for (i = 0; i < num_sanctions; ++i) {
-        if (sanctions_list_validate_entry(chat, &sanctions[i]) == -1)
-            return -1;
+        if (sanctions_list_validate_fields(chat, &sanctions[i]) == -1)
+            goto out;
+
+        uint8_t *data = packed + i * sizeof(struct GC_Sanction);
+        int packed_len = sanctions_list_pack(data, sizeof(struct GC_Sanction), &sanctions[i], NULL, 1);
+
+        if (packed_len <= SIGNATURE_SIZE)
+            goto out;
+
+        crypto_hash_sha256(hashes[i], data, packed_len);
+
+        if (sanctions_cache_has(&chat->moderation, hashes[i]))
+            continue;
+
+        Crypto_Job *job = &jobs[num_jobs++];
+        job->type = CRYPTO_JOB_VERIFY;
+        job->input = data;
+        job->input_length = packed_len - SIGNATURE_SIZE;
+        job->signature = sanctions[i].signature;
+        job->public_sig_key = sanctions[i].public_sig_key;
+    }
+
+    crypto_pipeline_run(pipeline, jobs, num_jobs);
+
+    for (i = 0; i < num_jobs; ++i) {
+        if (jobs[i].result != 0)
+            goto out;
     }
 
+    for (i = 0; i < num_sanctions; ++i)
+        sanctions_cache_add(&chat->moderation, hashes[i], num_sanctions * 2);
+
     if (sanctions_creds_validate(chat, sanctions, creds, num_sanctions) == -1)
+        goto out;
+
+    ret = 0;
+
+out:
+    free(packed);
+    free(hashes);
+    free(jobs);
+    return ret;
+}
+
+/* Returns the id that tells sanction apart from other entries when syncing sanctions lists. */
+static uint32_t sanctions_list_entry_id(const struct GC_Sanction *sanction)
+{
+    return jenkins_one_at_a_time_hash(sanction->signature, SIGNATURE_SIZE);
+}
+
+/* Packs the number of entries in our sanctions list followed by their ids in list order.
+ *
+ * Returns length of packed data on success.
+ * Returns -1 on failure.
+ */
+int sanctions_list_pack_ids(const GC_Chat *chat, uint8_t *data, uint16_t length)
+{
+    uint32_t i, num_sanctions = chat->moderation.num_sanctions;
+
+    if (num_sanctions > MAX_GC_SANCTIONS || sizeof(uint16_t) + num_sanctions * sizeof(uint32_t) > length)
         return -1;
 
-    return 0;
+    U16_to_bytes(data, num_sanctions);
+    uint16_t packed_len = sizeof(uint16_t);
+
+    for (i = 0; i < num_sanctions; ++i) {
+        U32_to_bytes(data + packed_len, sanctions_list_entry_id(&chat->moderation.sanctions[i]));
+        packed_len += sizeof(uint32_t);
+    }
+
+    return packed_len;
+}
+
+/* Unpacks sanction ids packed by sanctions_list_pack_ids into ids and puts their number in num_ids.
+ *
+ * Returns length of the data processed on success.
+ * Returns -1 on failure.
+ */
+int sanctions_list_unpack_ids(uint32_t *ids, uint16_t max_ids, uint16_t *num_ids, const uint8_t *data,
+                              uint16_t length)
+{
+    if (length < sizeof(uint16_t))
+        return -1;
+
+    uint16_t i, num;
+    bytes_to_U16(&num, data);
+
+    if (num > max_ids || sizeof(uint16_t) + num * sizeof(uint32_t) > length)
+        return -1;
+
+    for (i = 0; i < num; ++i)
+        bytes_to_U32(&ids[i], data + sizeof(uint16_t) + i * sizeof(uint32_t));
+
+    *num_ids = num;
+    return sizeof(uint16_t) + num * sizeof(uint32_t);
+}
+
+/* Packs what a peer whose sanctions list holds the num_known entries with known_ids needs to
+ * get ours: the ids of all our entries in list order, the entries that aren't known and our
+ * credentials. The number of entries that aren't known is put in num_new.
+ *
+ * Returns length of packed data on success.
+ * Returns -1 on failure.
+ */
+int sanctions_list_pack_delta(GC_Chat *chat, const uint32_t *known_ids, uint16_t num_known, uint8_t *data,
+                              uint16_t length, uint16_t *num_new)
+{
+    int ids_len = sanctions_list_pack_ids(chat, data, length);
+
+    if (ids_len == -1 || ids_len + sizeof(uint16_t) > length)
+        return -1;
+
+    struct GC_Sanction *new_entries = malloc(sizeof(struct GC_Sanction) * (chat->moderation.num_sanctions + 1));
+
+    if (new_entries == NULL)
+        return -1;
+
+    uint32_t i, j;
+    uint16_t num = 0;
+
+    for (i = 0; i < chat->moderation.num_sanctions; ++i) {
+        uint32_t id = sanctions_list_entry_id(&chat->moderation.sanctions[i]);
+
+        for (j = 0; j < num_known && known_ids[j] != id; ++j);
+
+        if (j == num_known)
+            memcpy(&new_entries[num++], &chat->moderation.sanctions[i], sizeof(struct GC_Sanction));
+    }
+
+    U16_to_bytes(data + ids_len, num);
+    uint16_t packed_len = ids_len + sizeof(uint16_t);
+
+    int entries_len = sanctions_list_pack(data + packed_len, length - packed_len, new_entries,
+                                          &chat->moderation.sanctions_creds, num);
+    free(new_entries);
+
+    if (entries_len == -1)
+        return -1;
+
+    *num_new = num;
+    return packed_len + entries_len;
+}
+
+/* Rebuilds our sanctions list from its entries and a delta packed by sanctions_list_pack_delta.
+ * The new list replaces ours only if it and its credentials are valid.
+ *
+ * Returns length of the data processed on success.
+ * Returns -1 on failure.
+ */
+int sanctions_list_apply_delta(GC_Chat *chat, const uint8_t *data, uint16_t length, Crypto_Pipeline *pipeline)
+{
+    uint32_t ids[MAX_GC_SANCTIONS];
+    uint16_t num_ids, num_new;
+    int ids_len = sanctions_list_unpack_ids(ids, MAX_GC_SANCTIONS, &num_ids, data, length);
+
+    if (ids_len == -1 || length - ids_len < sizeof(uint16_t))
+        return -1;
+
+    bytes_to_U16(&num_new, data + ids_len);
+
+    if (num_new > num_ids)
+        return -1;
+
+    uint16_t processed_len = ids_len + sizeof(uint16_t);
+    uint32_t num_old = chat->moderation.num_sanctions;
+    struct GC_Sanction *new_entries = malloc(sizeof(struct GC_Sanction) * (num_new + 1));
+    struct GC_Sanction *sanctions = malloc(sizeof(struct GC_Sanction) * (num_ids + 1));
+    bool *used = calloc(num_old + 1, sizeof(bool));
+    int ret = -1;
+
+    if (new_entries == NULL || sanctions == NULL || used == NULL)
+        goto out;
+
+    struct GC_Sanction_Creds creds;
+    uint16_t entries_len;
+
+    if (sanctions_list_unpack(new_entries, &creds, num_new, data + processed_len, length - processed_len,
+                              &entries_len) != num_new)
+        goto out;
+
+    /* Entries we have are taken from our list, the others come from the delta in order */
+    uint32_t i, j, next_new = 0;
+
+    for (i = 0; i < num_ids; ++i) {
+        for (j = 0; j < num_old; ++j) {
+            if (!used[j] && sanctions_list_entry_id(&chat->moderation.sanctions[j]) == ids[i])
+                break;
+        }
+
+        if (j < num_old) {
+            used[j] = true;
+            memcpy(&sanctions[i], &chat->moderation.sanctions[j], sizeof(struct GC_Sanction));
+        } else if (next_new < num_new) {
+            memcpy(&sanctions[i], &new_entries[next_new++], sizeof(struct GC_Sanction));
+        } else {
+            goto out;
+        }
+    }
+
+    /* Colliding ids make the list hash differ from the one in the credentials */
+    if (next_new != num_new || sanctions_list_check_integrity(chat, &creds, sanctions, num_ids, pipeline) == -1)
+        goto out;
+
+    sanctions_list_cleanup(chat);
+    memcpy(&chat->moderation.sanctions_creds, &creds, sizeof(struct GC_Sanction_Creds));
+    chat->moderation.sanctions = sanctions;
+    chat->moderation.num_sanctions = num_ids;
+    sanctions = NULL;
+
+    ret = processed_len + entries_len;
+
+out:
+    free(new_entries);
+    free(sanctions);
+    free(used);
+    return ret;
 }
 
 /* Removes index-th sanction list entry. New credentials will be validated if creds is non-null.
@@ -798,21 +1111,21 @@ int sanctions_list_make_entry(GC_Chat *chat, uint32_t peernumber, struct GC_Sanc
     memset(sanction, 0, sizeof(struct GC_Sanction));
 
     if (type == SA_BAN) {
-        if (chat->gcc[peernumber].addr.ip_port.ip.family == TCP_FAMILY)
+        if (chat->gcc[peernumber]->addr.ip_port.ip.family == TCP_FAMILY)
             return -1;
 
-        ipport_copy(&sanction->ban_info.ip_port, &chat->gcc[peernumber].addr.ip_port);
+        ipport_copy(&sanction->ban_info.ip_port, &chat->gcc[peernumber]->addr.ip_port);
         memcpy(sanction->ban_info.nick, chat->group[peernumber].nick, MAX_GC_NICK_SIZE);
         sanction->ban_info.nick_len = chat->group[peernumber].nick_len;
         sanction->ban_info.id = get_new_ban_id(chat);
     } else if (type == SA_OBSERVER) {
-        memcpy(sanction->target_pk, chat->gcc[peernumber].addr.public_key, ENC_PUBLIC_KEY);
+        memcpy(sanction->target_pk, chat->gcc[peernumber]->addr.public_key, ENC_PUBLIC_KEY);
     } else {
         return -1;
     }
 
     memcpy(sanction->public_sig_key, SIG_PK(chat->self_public_key), SIG_PUBLIC_KEY);
-    sanction->time_set = unix_time();
+    sanction->time_set = unix_time(chat->net->mono_time);
     sanction->type = type;
 
     if (sanctions_list_sign_entry(chat, sanction) == -1)
@@ -862,6 +1175,15 @@ void sanctions_list_cleanup(GC_Chat *chat)
     chat->moderation.num_sanctions = 0;
 }
 
+void sanctions_cache_cleanup(GC_Chat *chat)
+{
+    hash_index_free(&chat->moderation.verified_index);
+    free(chat->moderation.verified);
+    chat->moderation.verified = NULL;
+    chat->moderation.num_verified = 0;
+    chat->moderation.verified_size = 0;
+}
+
 
 /********* Ban list queries *********/
 
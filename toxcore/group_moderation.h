@@ -25,7 +25,12 @@
 #ifndef GROUP_MODERATION_H
 #define GROUP_MODERATION_H
 
+#include "crypto_pipeline.h"
+
 #define MAX_GC_SANCTIONS 200
+
+/* Minimum number of verified sanctions list entries we remember */
+#define GC_SANCTIONS_CACHE_SIZE (MAX_GC_SANCTIONS * 2)
 #define GC_SANCTIONS_CREDENTIALS_SIZE (sizeof(uint32_t) + GC_MODERATION_HASH_SIZE + SIG_PUBLIC_KEY + SIGNATURE_SIZE)
 
 typedef enum GROUP_SANCTION_TYPE {
@@ -149,12 +154,50 @@ uint16_t sanctions_creds_unpack(struct GC_Sanction_Creds *creds, const uint8_t *
 int sanctions_list_make_creds(GC_Chat *chat);
 
 /* Validates all sanctions list entries as well as the list itself.
+ *
+ * Entries whose signature was verified before are skipped, the others are verified in one batch
+ * on pipeline's worker threads, or on the calling thread if pipeline is NULL.
  *
  * Returns 0 if all entries are valid.
  * Returns -1 if one or more entries are invalid.
  */
-int sanctions_list_check_integrity(const GC_Chat *chat, struct GC_Sanction_Creds *creds,
-                                   struct GC_Sanction *sanctions, uint32_t num_sanctions);
+int sanctions_list_check_integrity(GC_Chat *chat, struct GC_Sanction_Creds *creds,
+                                   struct GC_Sanction *sanctions, uint32_t num_sanctions, Crypto_Pipeline *pipeline);
+
+/* Packs the number of entries in our sanctions list followed by their ids in list order.
+ * The id of an entry is a hash of its signature.
+ *
+ * Returns length of packed data on success.
+ * Returns -1 on failure.
+ */
+int sanctions_list_pack_ids(const GC_Chat *chat, uint8_t *data, uint16_t length);
+
+/* Unpacks sanction ids packed by sanctions_list_pack_ids into ids and puts their number in num_ids.
+ *
+ * Returns length of the data processed on success.
+ * Returns -1 on failure.
+ */
+int sanctions_list_unpack_ids(uint32_t *ids, uint16_t max_ids, uint16_t *num_ids, const uint8_t *data,
+                              uint16_t length);
+
+/* Packs what a peer whose sanctions list holds the num_known entries with known_ids needs to
+ * get ours: the ids of all our entries in list order, the entries that aren't known and our
+ * credentials. The number of entries that aren't known is put in num_new.
+ *
+ * Returns length of packed data on success.
+ * Returns -1 on failure.
+ */
+int sanctions_list_pack_delta(GC_Chat *chat, const uint32_t *known_ids, uint16_t num_known, uint8_t *data,
+                              uint16_t length, uint16_t *num_new);
+
+/* Rebuilds our sanctions list from its entries and a delta packed by sanctions_list_pack_delta.
+ * The new list replaces ours only if it and its credentials are valid, ours is kept otherwise.
+ * Signatures are verified as in sanctions_list_check_integrity.
+ *
+ * Returns length of the data processed on success.
+ * Returns -1 on failure.
+ */
+int sanctions_list_apply_delta(GC_Chat *chat, const uint8_t *data, uint16_t length, Crypto_Pipeline *pipeline);
 
 /* Adds an entry to the sanctions list. The entry is first validated and the resulting
  * new sanction list is compared against the new credentials.
@@ -213,6 +256,9 @@ void sanctions_list_make_hash(struct GC_Sanction *sanctions, uint32_t new_versio
 
 void sanctions_list_cleanup(GC_Chat *chat);
 
+/* Frees the memory used to remember verified sanctions list entries. */
+void sanctions_cache_cleanup(GC_Chat *chat);
+
 
 
 /********* Ban list queries *********/
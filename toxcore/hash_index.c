@@ -0,0 +1,184 @@
+/* hash_index.c
+ *
+ * Open addressing hash table mapping 32 bit hashes to 32 bit values (indexes, handles...)
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "hash_index.h"
+#include "crypto_core.h"
+
+#include <stdlib.h>
+
+/* Values are found by linear probing from the bucket of their hash. The table is kept at
+ * most half full so that probe sequences stay short, and removals shift the following
+ * entries back instead of leaving tombstones behind.
+ */
+
+#define HASH_INDEX_MIN_SIZE 16
+
+static uint32_t bucket_of(const Hash_Index *index, uint32_t hash)
+{
+    /* The hashes given are often of keys peers chose, mix them with the secret seed. */
+    uint32_t h = hash ^ index->seed;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h & (index->size - 1);
+}
+
+static void insert_bucket(Hash_Index *index, uint32_t hash, uint32_t value)
+{
+    uint32_t i = bucket_of(index, hash);
+
+    while (index->values[i] != HASH_INDEX_NONE)
+        i = (i + 1) & (index->size - 1);
+
+    index->hashes[i] = hash;
+    index->values[i] = value;
+}
+
+static int resize_index(Hash_Index *index, uint32_t size)
+{
+    uint32_t *hashes = malloc(size * sizeof(uint32_t));
+    uint32_t *values = malloc(size * sizeof(uint32_t));
+
+    if (hashes == NULL || values == NULL) {
+        free(hashes);
+        free(values);
+        return -1;
+    }
+
+    uint32_t *old_hashes = index->hashes;
+    uint32_t *old_values = index->values;
+    uint32_t old_size = index->size;
+    uint32_t i;
+
+    for (i = 0; i < size; ++i)
+        values[i] = HASH_INDEX_NONE;
+
+    if (old_size == 0)
+        index->seed = random_int();
+
+    index->hashes = hashes;
+    index->values = values;
+    index->size = size;
+
+    for (i = 0; i < old_size; ++i) {
+        if (old_values[i] != HASH_INDEX_NONE)
+            insert_bucket(index, old_hashes[i], old_values[i]);
+    }
+
+    free(old_hashes);
+    free(old_values);
+    return 0;
+}
+
+void hash_index_free(Hash_Index *index)
+{
+    free(index->hashes);
+    free(index->values);
+    index->hashes = NULL;
+    index->values = NULL;
+    index->size = 0;
+    index->count = 0;
+}
+
+int hash_index_add(Hash_Index *index, uint32_t hash, uint32_t value)
+{
+    if (value == HASH_INDEX_NONE)
+        return -1;
+
+    if ((index->count + 1) * 2 > index->size) {
+        if (resize_index(index, index->size ? index->size * 2 : HASH_INDEX_MIN_SIZE) == -1)
+            return -1;
+    }
+
+    insert_bucket(index, hash, value);
+    ++index->count;
+    return 0;
+}
+
+int hash_index_remove(Hash_Index *index, uint32_t hash, uint32_t value)
+{
+    if (index->count == 0 || value == HASH_INDEX_NONE)
+        return -1;
+
+    uint32_t mask = index->size - 1;
+    uint32_t i = bucket_of(index, hash);
+
+    while (index->hashes[i] != hash || index->values[i] != value) {
+        if (index->values[i] == HASH_INDEX_NONE)
+            return -1;
+
+        i = (i + 1) & mask;
+    }
+
+    /* Move back the following entries of the run that can't be reached anymore once i is empty,
+     * that is those whose bucket isn't between i and their position. */
+    uint32_t j = i;
+
+    while (1) {
+        j = (j + 1) & mask;
+
+        if (index->values[j] == HASH_INDEX_NONE)
+            break;
+
+        uint32_t bucket = bucket_of(index, index->hashes[j]);
+
+        if (((j - bucket) & mask) >= ((j - i) & mask)) {
+            index->hashes[i] = index->hashes[j];
+            index->values[i] = index->values[j];
+            i = j;
+        }
+    }
+
+    index->values[i] = HASH_INDEX_NONE;
+    --index->count;
+
+    /* Shrinking is only an optimization, the index stays valid if it fails. */
+    if (index->size > HASH_INDEX_MIN_SIZE && index->count * 8 < index->size)
+        resize_index(index, index->size / 2);
+
+    return 0;
+}
+
+uint32_t hash_index_find(const Hash_Index *index, uint32_t hash, hash_index_match_cb *match, const void *object,
+                         const void *key)
+{
+    if (index->count == 0)
+        return HASH_INDEX_NONE;
+
+    uint32_t i = bucket_of(index, hash);
+
+    while (index->values[i] != HASH_INDEX_NONE) {
+        if (index->hashes[i] == hash && (match == NULL || match(object, index->values[i], key)))
+            return index->values[i];
+
+        i = (i + 1) & (index->size - 1);
+    }
+
+    return HASH_INDEX_NONE;
+}
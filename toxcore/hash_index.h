@@ -0,0 +1,75 @@
+/* hash_index.h
+ *
+ * Open addressing hash table mapping 32 bit hashes to 32 bit values (indexes, handles...)
+ * -Used to find objects by key in constant time without moving the objects themselves
+ * -Several values may share the same hash, a match function tells them apart
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Value of empty buckets, can't be stored in an index. */
+#define HASH_INDEX_NONE UINT32_MAX
+
+/* A zeroed Hash_Index is a valid empty index, memory is allocated on the first add. */
+typedef struct {
+    uint32_t *hashes;
+    uint32_t *values;
+    uint32_t size; /* Number of buckets, a power of 2. */
+    uint32_t count;
+    uint32_t seed; /* Random, so that peers can't pick keys that end up in the same buckets. */
+} Hash_Index;
+
+/* return true if value is the one stored for key. */
+typedef bool hash_index_match_cb(const void *object, uint32_t value, const void *key);
+
+/* Free the memory used by index and empty it. */
+void hash_index_free(Hash_Index *index);
+
+/* Add value with hash to index.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int hash_index_add(Hash_Index *index, uint32_t hash, uint32_t value);
+
+/* Remove value with hash from index.
+ *
+ * return -1 if it wasn't in the index.
+ * return 0 on success.
+ */
+int hash_index_remove(Hash_Index *index, uint32_t hash, uint32_t value);
+
+/* Find the value stored for key, whose hash is hash.
+ *
+ * match is called with object and key for every value with the same hash until it
+ * returns true. If match is NULL the first value with the same hash is returned.
+ *
+ * return HASH_INDEX_NONE if not found.
+ * return value on success.
+ */
+uint32_t hash_index_find(const Hash_Index *index, uint32_t hash, hash_index_match_cb *match, const void *object,
+                         const void *key);
+
+#endif
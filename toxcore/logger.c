@@ -47,7 +47,6 @@
 struct logger {
     FILE *log_file;
     LOG_LEVEL level;
-    uint64_t start_time; /* Time when lib loaded */
     char *id;
 
     /* Allocate these once */
@@ -59,7 +58,9 @@ struct logger {
     pthread_mutex_t mutex[1];
 };
 
+/* Shared by every instance in the process, instances on other threads create and kill it too */
 Logger *global = NULL;
+static pthread_mutex_t global_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 const char *LOG_LEVEL_STR [] = {
     [LOG_TRACE]   = "TRACE",
@@ -126,7 +127,6 @@ Logger *logger_new (const char *file_name, LOG_LEVEL level, const char *id)
     }
 
     retu->level = level;
-    retu->start_time = current_time_monotonic();
 
     fprintf(retu->log_file, "Successfully created and running logger id: %s; time: %s" WIN_CR "\n",
             retu->id, strtime(retu->tstr, 16));
@@ -171,8 +171,14 @@ void logger_kill(Logger *log)
 
 void logger_kill_global(void)
 {
+#ifndef LOGGING /* Disabled */
+    return;
+#endif
+
+    pthread_mutex_lock(&global_mutex);
     logger_kill(global);
     global = NULL;
+    pthread_mutex_unlock(&global_mutex);
 }
 
 void logger_set_global(Logger *log)
@@ -181,7 +187,9 @@ void logger_set_global(Logger *log)
     return;
 #endif
 
+    pthread_mutex_lock(&global_mutex);
     global = log;
+    pthread_mutex_unlock(&global_mutex);
 }
 
 Logger *logger_get_global(void)
@@ -190,7 +198,10 @@ Logger *logger_get_global(void)
     return NULL;
 #endif
 
-    return global;
+    pthread_mutex_lock(&global_mutex);
+    Logger *log = global;
+    pthread_mutex_unlock(&global_mutex);
+    return log;
 }
 
 void logger_write (Logger *log, LOG_LEVEL level, const char *file, int line, const char *format, ...)
@@ -0,0 +1,84 @@
+/* mpsc_queue.c
+ *
+ * Lock-free queue any number of threads can push to and one thread pops from.
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "mpsc_queue.h"
+
+#include <stddef.h>
+
+/* The queue is a linked list from tail to head that always holds at least one node, the stub
+ * when nothing else is left. A producer first swaps itself in as the head and only then links
+ * the old head to itself, which is the short window in which the list is broken.
+ */
+
+void mpsc_queue_init(MPSC_Queue *queue)
+{
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+}
+
+void mpsc_queue_push(MPSC_Queue *queue, MPSC_Node *node)
+{
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    MPSC_Node *prev = __atomic_exchange_n(&queue->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+MPSC_Node *mpsc_queue_pop(MPSC_Queue *queue)
+{
+    MPSC_Node *tail = queue->tail;
+    MPSC_Node *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &queue->stub) {
+        if (next == NULL)
+            return NULL;
+
+        queue->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+
+    /* tail is the last node linked, if it isn't the head a push is in the middle of linking it */
+    if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    /* Push the stub so that tail can be popped while the list still holds a node */
+    mpsc_queue_push(queue, &queue->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
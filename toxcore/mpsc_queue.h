@@ -0,0 +1,55 @@
+/* mpsc_queue.h
+ *
+ * Lock-free queue any number of threads can push to and one thread pops from.
+ * -Intrusive: the items embed an MPSC_Node, the queue never allocates
+ * -A push is one atomic exchange, so producers don't wait on each other or on the consumer
+ *
+ *  Copyright (C) 2016 Tox project All Rights Reserved.
+ *
+ *  This file is part of Tox.
+ *
+ *  Tox is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Tox is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <stdint.h>
+
+typedef struct MPSC_Node {
+    struct MPSC_Node *next;
+} MPSC_Node;
+
+typedef struct {
+    MPSC_Node *head;   /* last pushed, swapped by the producers */
+    MPSC_Node *tail;   /* next to pop, only touched by the consumer */
+    MPSC_Node stub;
+} MPSC_Queue;
+
+void mpsc_queue_init(MPSC_Queue *queue);
+
+/* Appends node to the queue. Safe to call from any thread. */
+void mpsc_queue_push(MPSC_Queue *queue, MPSC_Node *node);
+
+/* Removes the oldest node of the queue. Must only be called from one thread at a time.
+ *
+ * A producer that has been preempted in the middle of a push hides the nodes pushed after its own
+ * until it is done, so this can return NULL while the queue isn't empty. Call it again later.
+ *
+ * return the node or NULL if there is none to pop.
+ */
+MPSC_Node *mpsc_queue_pop(MPSC_Queue *queue);
+
+#endif
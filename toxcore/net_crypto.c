@@ -94,10 +94,11 @@ static int create_cookie_request(const Net_Crypto *c, uint8_t *packet, uint8_t *
  * return -1 on failure.
  * return 0 on success.
  */
-static int create_cookie(uint8_t *cookie, const uint8_t *bytes, const uint8_t *encryption_key)
+static int create_cookie(const Mono_Time *mono_time, uint8_t *cookie, const uint8_t *bytes,
+                         const uint8_t *encryption_key)
 {
     uint8_t contents[COOKIE_CONTENTS_LENGTH];
-    uint64_t temp_time = unix_time();
+    uint64_t temp_time = unix_time(mono_time);
     memcpy(contents, &temp_time, sizeof(temp_time));
     memcpy(contents + sizeof(temp_time), bytes, COOKIE_DATA_LENGTH);
     new_nonce(cookie);
@@ -114,7 +115,8 @@ static int create_cookie(uint8_t *cookie, const uint8_t *bytes, const uint8_t *e
  * return -1 on failure.
  * return 0 on success.
  */
-static int open_cookie(uint8_t *bytes, const uint8_t *cookie, const uint8_t *encryption_key)
+static int open_cookie(const Mono_Time *mono_time, uint8_t *bytes, const uint8_t *cookie,
+                       const uint8_t *encryption_key)
 {
     uint8_t contents[COOKIE_CONTENTS_LENGTH];
     int len = decrypt_data_symmetric(encryption_key, cookie, cookie + crypto_box_NONCEBYTES,
@@ -125,7 +127,7 @@ static int open_cookie(uint8_t *bytes, const uint8_t *cookie, const uint8_t *enc
 
     uint64_t cookie_time;
     memcpy(&cookie_time, contents, sizeof(cookie_time));
-    uint64_t temp_time = unix_time();
+    uint64_t temp_time = unix_time(mono_time);
 
     if (cookie_time + COOKIE_TIMEOUT < temp_time || temp_time < cookie_time)
         return -1;
@@ -150,7 +152,7 @@ static int create_cookie_response(const Net_Crypto *c, uint8_t *packet, const ui
     memcpy(cookie_plain + crypto_box_PUBLICKEYBYTES, dht_public_key, crypto_box_PUBLICKEYBYTES);
     uint8_t plain[COOKIE_LENGTH + sizeof(uint64_t)];
 
-    if (create_cookie(plain, cookie_plain, c->secret_symmetric_key) != 0)
+    if (create_cookie(c->mono_time, plain, cookie_plain, c->secret_symmetric_key) != 0)
         return -1;
 
     memcpy(plain + COOKIE_LENGTH, request_plain + COOKIE_DATA_LENGTH, sizeof(uint64_t));
@@ -302,8 +304,8 @@ static int create_crypto_handshake(const Net_Crypto *c, uint8_t *packet, const u
     memcpy(cookie_plain, peer_real_pk, crypto_box_PUBLICKEYBYTES);
     memcpy(cookie_plain + crypto_box_PUBLICKEYBYTES, peer_dht_pubkey, crypto_box_PUBLICKEYBYTES);
 
-    if (create_cookie(plain + crypto_box_NONCEBYTES + crypto_box_PUBLICKEYBYTES + crypto_hash_sha512_BYTES, cookie_plain,
-                      c->secret_symmetric_key) != 0)
+    if (create_cookie(c->mono_time, plain + crypto_box_NONCEBYTES + crypto_box_PUBLICKEYBYTES
+                      + crypto_hash_sha512_BYTES, cookie_plain, c->secret_symmetric_key) != 0)
         return -1;
 
     new_nonce(packet + 1 + COOKIE_LENGTH);
@@ -345,7 +347,7 @@ static int handle_crypto_handshake(const Net_Crypto *c, uint8_t *nonce, uint8_t
 
     uint8_t cookie_plain[COOKIE_DATA_LENGTH];
 
-    if (open_cookie(cookie_plain, packet + 1, c->secret_symmetric_key) != 0)
+    if (open_cookie(c->mono_time, cookie_plain, packet + 1, c->secret_symmetric_key) != 0)
         return -1;
 
     if (expected_real_pk)
@@ -384,6 +386,53 @@ static Crypto_Connection *get_crypto_connection(const Net_Crypto *c, int crypt_c
 }
 
 
+/* Must be called with conn->mutex held. */
+static void count_packet_sent(Crypto_Connection *conn, uint16_t length, _Bool tcp)
+{
+    ++conn->counters.packets_sent;
+    conn->counters.bytes_sent += length;
+
+    if (tcp)
+        ++conn->counters.packets_sent_tcp;
+}
+
+static void count_packet_received(const Net_Crypto *c, int crypt_connection_id, uint16_t length, _Bool tcp)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return;
+
+    pthread_mutex_lock(&conn->mutex);
+    ++conn->counters.packets_received;
+    conn->counters.bytes_received += length;
+
+    if (tcp)
+        ++conn->counters.packets_received_tcp;
+
+    pthread_mutex_unlock(&conn->mutex);
+}
+
+/* reason is one of CRYPTO_DROP_* */
+static void count_packet_dropped(const Net_Crypto *c, int crypt_connection_id, unsigned int reason)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return;
+
+    pthread_mutex_lock(&conn->mutex);
+    ++conn->counters.drops[reason];
+    pthread_mutex_unlock(&conn->mutex);
+}
+
+static void count_retransmits(Crypto_Connection *conn, uint32_t num)
+{
+    pthread_mutex_lock(&conn->mutex);
+    conn->counters.retransmits += num;
+    pthread_mutex_unlock(&conn->mutex);
+}
+
 /* Sends a packet to the peer using the fastest route.
  *
  * return -1 on failure.
@@ -408,6 +457,7 @@ static int send_packet_to(Net_Crypto *c, int crypt_connection_id, const uint8_t
 
         if (direct_connected) {
             if ((uint32_t)sendpacket(c->dht->net, conn->ip_port, data, length) == length) {
+                count_packet_sent(conn, length, 0);
                 pthread_mutex_unlock(&conn->mutex);
                 return 0;
             } else {
@@ -424,11 +474,14 @@ static int send_packet_to(Net_Crypto *c, int crypt_connection_id, const uint8_t
     }
 
     pthread_mutex_unlock(&conn->mutex);
-    pthread_mutex_lock(&c->tcp_mutex);
+    pthread_mutex_lock(c->tcp_mutex);
     int ret = send_packet_tcp_connection(c->tcp_c, conn->connection_number_tcp, data, length);
-    pthread_mutex_unlock(&c->tcp_mutex);
+    pthread_mutex_unlock(c->tcp_mutex);
 
     if (ret == 0 || direct_send_attempt) {
+        pthread_mutex_lock(&conn->mutex);
+        count_packet_sent(conn, length, !direct_send_attempt);
+        pthread_mutex_unlock(&conn->mutex);
         return 0;
     }
 
@@ -545,7 +598,7 @@ static int64_t read_data_beg_buffer(Packets_Array *array, Packet_Data *data)
 /* Delete all packets in array before number (but not number)
  *
  * return -1 on failure.
- * return 0 on success
+ * return number of deleted packets on success.
  */
 static int clear_buffer_until(Packets_Array *array, uint32_t number)
 {
@@ -555,6 +608,7 @@ static int clear_buffer_until(Packets_Array *array, uint32_t number)
         return -1;
 
     uint32_t i;
+    int deleted = 0;
 
     for (i = array->buffer_start; i != number; ++i) {
         uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
@@ -562,11 +616,12 @@ static int clear_buffer_until(Packets_Array *array, uint32_t number)
         if (array->buffer[num]) {
             free(array->buffer[num]);
             array->buffer[num] = NULL;
+            ++deleted;
         }
     }
 
     array->buffer_start = i;
-    return 0;
+    return deleted;
 }
 
 static int clear_buffer(Packets_Array *array)
@@ -652,15 +707,59 @@ static int generate_request_packet(uint8_t *data, uint16_t length, const Packets
     return cur_len;
 }
 
+/* The other side received packet number i, remove it from send_array.
+ */
+static void request_packet_received(Packets_Array *send_array, uint32_t i, uint64_t *l_sent_time, uint32_t *num_acked)
+{
+    uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+
+    if (send_array->buffer[num]) {
+        uint64_t sent_time = send_array->buffer[num]->sent_time;
+
+        if (!send_array->buffer[num]->requested && *l_sent_time < sent_time)
+            *l_sent_time = sent_time;
+
+        free(send_array->buffer[num]);
+        send_array->buffer[num] = NULL;
+        ++*num_acked;
+    }
+}
+
+/* The other side is missing packet number i, mark it to be sent again if it
+ * was sent more than rtt_time ago.
+ */
+static void request_packet_missing(Packets_Array *send_array, uint32_t i, uint64_t temp_time, uint64_t rtt_time,
+                                   uint32_t *num_lost)
+{
+    uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+
+    if (send_array->buffer[num]) {
+        uint64_t sent_time = send_array->buffer[num]->sent_time;
+
+        if (sent_time != 0 && (sent_time + rtt_time) < temp_time) {
+            send_array->buffer[num]->sent_time = 0;
+            send_array->buffer[num]->requested = 1;
+            ++*num_lost;
+        }
+    }
+}
+
 /* Handle a request data packet.
  * Remove all the packets the other received from the array.
  *
+ * num_acked is set to the number of removed packets and num_lost to the number
+ * of packets marked to be sent again.
+ *
  * return -1 on failure.
  * return number of requested packets on success.
  */
-static int handle_request_packet(Packets_Array *send_array, const uint8_t *data, uint16_t length,
-                                 uint64_t *latest_send_time, uint64_t rtt_time)
+static int handle_request_packet(Mono_Time *mono_time, Packets_Array *send_array, const uint8_t *data,
+                                 uint16_t length, uint64_t *latest_send_time, uint64_t rtt_time, uint32_t *num_acked,
+                                 uint32_t *num_lost)
 {
+    *num_acked = 0;
+    *num_lost = 0;
+
     if (length < 1)
         return -1;
 
@@ -676,38 +775,22 @@ static int handle_request_packet(Packets_Array *send_array, const uint8_t *data,
     uint32_t i, n = 1;
     uint32_t requested = 0;
 
-    uint64_t temp_time = current_time_monotonic();
-    uint64_t l_sent_time = ~0;
+    uint64_t temp_time = current_time_monotonic(mono_time);
+    uint64_t l_sent_time = 0;
 
     for (i = send_array->buffer_start; i != send_array->buffer_end; ++i) {
         if (length == 0)
             break;
 
-        uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
-
         if (n == data[0]) {
-            if (send_array->buffer[num]) {
-                uint64_t sent_time = send_array->buffer[num]->sent_time;
-
-                if ((sent_time + rtt_time) < temp_time) {
-                    send_array->buffer[num]->sent_time = 0;
-                }
-            }
+            request_packet_missing(send_array, i, temp_time, rtt_time, num_lost);
 
             ++data;
             --length;
             n = 0;
             ++requested;
         } else {
-            if (send_array->buffer[num]) {
-                uint64_t sent_time = send_array->buffer[num]->sent_time;
-
-                if (l_sent_time < sent_time)
-                    l_sent_time = sent_time;
-
-                free(send_array->buffer[num]);
-                send_array->buffer[num] = NULL;
-            }
+            request_packet_received(send_array, i, &l_sent_time, num_acked);
         }
 
         if (n == 255) {
@@ -729,6 +812,246 @@ static int handle_request_packet(Packets_Array *send_array, const uint8_t *data,
     return requested;
 }
 
+#define SACK_HEADER_LENGTH (1 + sizeof(uint16_t))
+
+/* High bit of a block header, set for bitmap blocks. */
+#define SACK_BITMAP_BLOCK 0x8000
+
+/* Missing packet runs of at least this length are sent as range blocks, runs of
+ * received packets of at least this length end a bitmap block.
+ */
+#define SACK_MIN_RUN_LENGTH 16
+
+/* Maximum length in bytes of the bitmap in a bitmap block. */
+#define SACK_MAX_BITMAP_LENGTH 255
+
+static _Bool sack_packet_received(const Packets_Array *recv_array, uint32_t pos)
+{
+    return recv_array->buffer[(recv_array->buffer_start + pos) % CRYPTO_PACKET_BUFFER_SIZE] != NULL;
+}
+
+/* return number of consecutive missing packets in recv_array from pos (relative to buffer_start) to end.
+ */
+static uint32_t sack_missing_run(const Packets_Array *recv_array, uint32_t pos, uint32_t end)
+{
+    uint32_t i = pos;
+
+    while (i < end && !sack_packet_received(recv_array, i))
+        ++i;
+
+    return i - pos;
+}
+
+/* Create a selective request packet from recv_array into data of length.
+ *
+ * Unlike the PACKET_ID_REQUEST packet, which uses a byte per missing packet, holes are
+ * described with blocks so that a single packet covers the whole window even with burst loss:
+ *
+ * [uint8_t PACKET_ID_SACK][uint16_t number of packets covered, starting at recv_array->buffer_start]
+ * then for each block:
+ * [uint16_t number of received packets since the end of the last block, | SACK_BITMAP_BLOCK for a bitmap block]
+ * range block: [uint16_t number of missing packets]
+ * bitmap block: [uint8_t length][bitmap of length bytes, bit set (lsb first) for each missing packet]
+ *
+ * Covered packets not described by a block were received. If length is too small to
+ * describe every hole, the packets after the last block that fits are not covered.
+ *
+ * return -1 on failure.
+ * return length of packet on success.
+ */
+static int generate_sack_packet(uint8_t *data, uint16_t length, const Packets_Array *recv_array)
+{
+    if (length < SACK_HEADER_LENGTH)
+        return -1;
+
+    data[0] = PACKET_ID_SACK;
+
+    uint16_t cur_len = SACK_HEADER_LENGTH;
+    uint32_t covered = num_packets_array(recv_array);
+    uint32_t pos = 0, block_end = 0;
+
+    while (pos < covered) {
+        if (sack_packet_received(recv_array, pos)) {
+            ++pos;
+            continue;
+        }
+
+        uint16_t header = pos - block_end;
+        uint32_t run = sack_missing_run(recv_array, pos, covered);
+
+        if (run >= SACK_MIN_RUN_LENGTH) {
+            if (length - cur_len < sizeof(uint16_t) * 2)
+                break;
+
+            uint16_t run_length = htons(run);
+            header = htons(header);
+            memcpy(data + cur_len, &header, sizeof(uint16_t));
+            memcpy(data + cur_len + sizeof(uint16_t), &run_length, sizeof(uint16_t));
+            cur_len += sizeof(uint16_t) * 2;
+            pos += run;
+            block_end = pos;
+            continue;
+        }
+
+        if (length - cur_len < sizeof(uint16_t) + 2)
+            break;
+
+        /* Find where the bitmap should end: before a long run of received or missing packets. */
+        uint32_t i, end = pos + run, received = 0;
+        uint32_t max_end = pos + SACK_MAX_BITMAP_LENGTH * 8;
+
+        if (max_end > covered)
+            max_end = covered;
+
+        for (i = end; i < max_end && received < SACK_MIN_RUN_LENGTH; ++i) {
+            if (sack_packet_received(recv_array, i)) {
+                ++received;
+                continue;
+            }
+
+            if (sack_missing_run(recv_array, i, covered) >= SACK_MIN_RUN_LENGTH)
+                break;
+
+            received = 0;
+            end = i + 1;
+        }
+
+        uint32_t bitmap_length = (end - pos + 7) / 8;
+
+        if (bitmap_length > length - cur_len - (sizeof(uint16_t) + 1))
+            bitmap_length = length - cur_len - (sizeof(uint16_t) + 1);
+
+        header = htons(header | SACK_BITMAP_BLOCK);
+        memcpy(data + cur_len, &header, sizeof(uint16_t));
+        cur_len += sizeof(uint16_t);
+        data[cur_len] = bitmap_length;
+        ++cur_len;
+        memset(data + cur_len, 0, bitmap_length);
+
+        for (i = 0; i < bitmap_length * 8 && pos + i < covered; ++i) {
+            if (!sack_packet_received(recv_array, pos + i))
+                data[cur_len + i / 8] |= 1 << (i % 8);
+        }
+
+        cur_len += bitmap_length;
+        pos += bitmap_length * 8;
+        block_end = pos;
+    }
+
+    if (pos < covered)
+        covered = pos;
+
+    uint16_t num_covered = htons(covered);
+    memcpy(data + 1, &num_covered, sizeof(uint16_t));
+    return cur_len;
+}
+
+/* Handle a selective request packet created by generate_sack_packet().
+ * Remove all the packets the other received from the array and mark the missing
+ * ones to be sent again.
+ *
+ * num_acked is set to the number of removed packets and num_lost to the number
+ * of packets marked to be sent again.
+ *
+ * return -1 on failure.
+ * return number of requested packets on success.
+ */
+static int handle_sack_packet(Mono_Time *mono_time, Packets_Array *send_array, const uint8_t *data,
+                              uint16_t length, uint64_t *latest_send_time, uint64_t rtt_time, uint32_t *num_acked,
+                              uint32_t *num_lost)
+{
+    *num_acked = 0;
+    *num_lost = 0;
+
+    if (length < SACK_HEADER_LENGTH)
+        return -1;
+
+    if (data[0] != PACKET_ID_SACK)
+        return -1;
+
+    uint16_t covered;
+    memcpy(&covered, data + 1, sizeof(uint16_t));
+    covered = ntohs(covered);
+
+    if (covered > num_packets_array(send_array))
+        return -1;
+
+    data += SACK_HEADER_LENGTH;
+    length -= SACK_HEADER_LENGTH;
+
+    uint32_t pos = 0, requested = 0;
+    uint32_t start = send_array->buffer_start;
+
+    uint64_t temp_time = current_time_monotonic(mono_time);
+    uint64_t l_sent_time = 0;
+
+    while (length != 0) {
+        if (length < sizeof(uint16_t) + 1)
+            return -1;
+
+        uint16_t header;
+        memcpy(&header, data, sizeof(uint16_t));
+        header = ntohs(header);
+
+        uint32_t block_start = pos + (header & ~SACK_BITMAP_BLOCK);
+
+        if (block_start > covered)
+            return -1;
+
+        for (; pos < block_start; ++pos) {
+            request_packet_received(send_array, start + pos, &l_sent_time, num_acked);
+        }
+
+        if (header & SACK_BITMAP_BLOCK) {
+            uint32_t i, bitmap_length = data[sizeof(uint16_t)];
+            const uint8_t *bitmap = data + sizeof(uint16_t) + 1;
+
+            if (bitmap_length == 0 || length < sizeof(uint16_t) + 1 + bitmap_length)
+                return -1;
+
+            for (i = 0; i < bitmap_length * 8 && pos < covered; ++i, ++pos) {
+                if (bitmap[i / 8] & (1 << (i % 8))) {
+                    request_packet_missing(send_array, start + pos, temp_time, rtt_time, num_lost);
+                    ++requested;
+                } else {
+                    request_packet_received(send_array, start + pos, &l_sent_time, num_acked);
+                }
+            }
+
+
+            data += sizeof(uint16_t) + 1 + bitmap_length;
+            length -= sizeof(uint16_t) + 1 + bitmap_length;
+        } else {
+            if (length < sizeof(uint16_t) * 2)
+                return -1;
+
+            uint16_t run;
+            memcpy(&run, data + sizeof(uint16_t), sizeof(uint16_t));
+            run = ntohs(run);
+
+            if (run == 0 || block_start + run > covered)
+                return -1;
+
+            for (; pos < block_start + run; ++pos) {
+                request_packet_missing(send_array, start + pos, temp_time, rtt_time, num_lost);
+            }
+
+            requested += run;
+            data += sizeof(uint16_t) * 2;
+            length -= sizeof(uint16_t) * 2;
+        }
+    }
+
+    for (; pos < covered; ++pos) {
+        request_packet_received(send_array, start + pos, &l_sent_time, num_acked);
+    }
+
+    if (*latest_send_time < l_sent_time)
+        *latest_send_time = l_sent_time;
+
+    return requested;
+}
+
 /** END: Array Related functions **/
 
 #define MAX_DATA_DATA_PACKET_SIZE (MAX_CRYPTO_PACKET_SIZE - (1 + sizeof(uint16_t) + crypto_box_MACBYTES))
@@ -765,13 +1088,14 @@ static int send_data_packet(Net_Crypto *c, int crypt_connection_id, const uint8_
     return send_packet_to(c, crypt_connection_id, packet, sizeof(packet));
 }
 
-/* Creates and sends a data packet with buffer_start and num to the peer using the fastest route.
+/* Put the unencrypted contents of a data packet with buffer_start and num in plain.
+ * plain must be at least MAX_DATA_DATA_PACKET_SIZE big.
  *
  * return -1 on failure.
- * return 0 on success.
+ * return length of the contents on success.
  */
-static int send_data_packet_helper(Net_Crypto *c, int crypt_connection_id, uint32_t buffer_start, uint32_t num,
-                                   const uint8_t *data, uint16_t length)
+static int create_data_packet_plain(uint8_t *plain, uint32_t buffer_start, uint32_t num, const uint8_t *data,
+                                    uint16_t length)
 {
     if (length == 0 || length > MAX_CRYPTO_DATA_SIZE)
         return -1;
@@ -779,13 +1103,92 @@ static int send_data_packet_helper(Net_Crypto *c, int crypt_connection_id, uint3
     num = htonl(num);
     buffer_start = htonl(buffer_start);
     uint16_t padding_length = (MAX_CRYPTO_DATA_SIZE - length) % CRYPTO_MAX_PADDING;
-    uint8_t packet[sizeof(uint32_t) + sizeof(uint32_t) + padding_length + length];
-    memcpy(packet, &buffer_start, sizeof(uint32_t));
-    memcpy(packet + sizeof(uint32_t), &num, sizeof(uint32_t));
-    memset(packet + (sizeof(uint32_t) * 2), PACKET_ID_PADDING, padding_length);
-    memcpy(packet + (sizeof(uint32_t) * 2) + padding_length, data, length);
+    memcpy(plain, &buffer_start, sizeof(uint32_t));
+    memcpy(plain + sizeof(uint32_t), &num, sizeof(uint32_t));
+    memset(plain + (sizeof(uint32_t) * 2), PACKET_ID_PADDING, padding_length);
+    memcpy(plain + (sizeof(uint32_t) * 2) + padding_length, data, length);
+
+    return (sizeof(uint32_t) * 2) + padding_length + length;
+}
+
+/* Creates and sends a data packet with buffer_start and num to the peer using the fastest route.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int send_data_packet_helper(Net_Crypto *c, int crypt_connection_id, uint32_t buffer_start, uint32_t num,
+                                   const uint8_t *data, uint16_t length)
+{
+    uint8_t packet[MAX_DATA_DATA_PACKET_SIZE];
+    int len = create_data_packet_plain(packet, buffer_start, num, data, length);
+
+    if (len == -1)
+        return -1;
+
+    return send_data_packet(c, crypt_connection_id, packet, len);
+}
+
+/* Encrypt the data packets in a batch using the crypto pipeline and send them in order.
+ * packets[i] is sent with the packet number numbers[i].
+ *
+ * Nonces are given to the packets in order before they are handed to the worker
+ * threads so the other side sees them in the same order as if they were sent one by one.
+ *
+ * return number of packets that were sent, starting from the first one.
+ */
+static uint32_t send_data_packets_pipelined(Net_Crypto *c, int crypt_connection_id, Packet_Data *const *packets,
+        const uint32_t *numbers, uint32_t num)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return 0;
+
+    Net_Crypto_Pipeline *p = c->pipeline;
+
+    if (num > CRYPTO_PIPELINE_BATCH_SIZE)
+        num = CRYPTO_PIPELINE_BATCH_SIZE;
+
+    uint32_t i;
+
+    pthread_mutex_lock(&conn->mutex);
+
+    for (i = 0; i < num; ++i) {
+        int len = create_data_packet_plain(p->plain[i], conn->recv_array.buffer_start, numbers[i], packets[i]->data,
+                                           packets[i]->length);
+
+        if (len == -1)
+            break;
+
+        Crypto_Job *job = &p->jobs[i];
+        memcpy(job->shared_key, conn->shared_key, crypto_box_BEFORENMBYTES);
+        memcpy(job->nonce, conn->sent_nonce, crypto_box_NONCEBYTES);
+        job->input = p->plain[i];
+        job->input_length = len;
+        job->output = p->packets[i] + 1 + sizeof(uint16_t);
+        job->type = CRYPTO_JOB_ENCRYPT;
+
+        p->packets[i][0] = NET_PACKET_CRYPTO_DATA;
+        memcpy(p->packets[i] + 1, conn->sent_nonce + (crypto_box_NONCEBYTES - sizeof(uint16_t)), sizeof(uint16_t));
+        increment_nonce(conn->sent_nonce);
+    }
+
+    pthread_mutex_unlock(&conn->mutex);
+
+    num = i;
+    crypto_pipeline_run(p->pipeline, p->jobs, num);
+
+    for (i = 0; i < num; ++i) {
+        const Crypto_Job *job = &p->jobs[i];
+
+        if (job->result != job->input_length + (int)crypto_box_MACBYTES)
+            break;
+
+        if (send_packet_to(c, crypt_connection_id, p->packets[i], 1 + sizeof(uint16_t) + job->result) != 0)
+            break;
+    }
 
-    return send_data_packet(c, crypt_connection_id, packet, sizeof(packet));
+    return i;
 }
 
 static int reset_max_speed_reached(Net_Crypto *c, int crypt_connection_id)
@@ -810,7 +1213,7 @@ static int reset_max_speed_reached(Net_Crypto *c, int crypt_connection_id)
                                             dt->length) != 0) {
                     send_failed = 1;
                 } else {
-                    dt->sent_time = current_time_monotonic();
+                    dt->sent_time = current_time_monotonic(c->mono_time);
                 }
             }
         }
@@ -825,52 +1228,196 @@ static int reset_max_speed_reached(Net_Crypto *c, int crypt_connection_id)
     return 0;
 }
 
-/*  return -1 if data could not be put in packet queue.
- *  return positive packet number if data was put into the queue.
+/* Add the lossless packet data of length to the unsent packet in dt, turning it into
+ * a PACKET_ID_COALESCED packet first if it isn't one:
+ *
+ * [uint8_t PACKET_ID_COALESCED]
+ * then for each packet:
+ * [uint16_t length][packet of length]
+ *
+ * return -1 if it doesn't fit.
+ * return number of bytes added to dt on success.
  */
-static int64_t send_lossless_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *data, uint16_t length,
-                                    uint8_t congestion_control)
+static int coalesce_packet(Packet_Data *dt, const uint8_t *data, uint16_t length)
 {
-    if (length == 0 || length > MAX_CRYPTO_DATA_SIZE)
-        return -1;
+    uint32_t added = sizeof(uint16_t) + length;
 
-    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+    if (dt->data[0] != PACKET_ID_COALESCED)
+        added += 1 + sizeof(uint16_t);
 
-    if (conn == 0)
+    if (dt->length + added > MAX_CRYPTO_DATA_SIZE)
         return -1;
 
-    /* If last packet send failed, try to send packet again.
-       If sending it fails we won't be able to send the new packet. */
-    reset_max_speed_reached(c, crypt_connection_id);
+    uint16_t packet_length;
 
-    if (conn->maximum_speed_reached && congestion_control) {
-        return -1;
+    if (dt->data[0] != PACKET_ID_COALESCED) {
+        memmove(dt->data + 1 + sizeof(uint16_t), dt->data, dt->length);
+        dt->data[0] = PACKET_ID_COALESCED;
+        packet_length = htons(dt->length);
+        memcpy(dt->data + 1, &packet_length, sizeof(uint16_t));
+        dt->length += 1 + sizeof(uint16_t);
     }
 
-    Packet_Data dt;
-    dt.sent_time = 0;
-    dt.length = length;
-    memcpy(dt.data, data, length);
-    pthread_mutex_lock(&conn->mutex);
-    int64_t packet_num = add_data_end_of_buffer(&conn->send_array, &dt);
-    pthread_mutex_unlock(&conn->mutex);
+    packet_length = htons(length);
+    memcpy(dt->data + dt->length, &packet_length, sizeof(uint16_t));
+    memcpy(dt->data + dt->length + sizeof(uint16_t), data, length);
+    dt->length += sizeof(uint16_t) + length;
+    return added;
+}
 
-    if (packet_num == -1)
-        return -1;
+/* return 1 if data of length is a PACKET_ID_COALESCED packet containing only lossless packets.
+ * return 0 if it isn't.
+ */
+static _Bool coalesced_packet_valid(const uint8_t *data, uint16_t length)
+{
+    if (length < 1 || data[0] != PACKET_ID_COALESCED)
+        return 0;
 
-    if (!congestion_control && conn->maximum_speed_reached) {
-        return packet_num;
-    }
+    uint32_t pos = 1;
 
-    if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, packet_num, data, length) == 0) {
-        Packet_Data *dt1 = NULL;
+    if (pos == length)
+        return 0;
 
-        if (get_data_pointer(&conn->send_array, &dt1, packet_num) == 1)
-            dt1->sent_time = current_time_monotonic();
-    } else {
-        conn->maximum_speed_reached = 1;
-        LOGGER_ERROR("send_data_packet failed\n");
-    }
+    while (pos < length) {
+        if (length - pos < sizeof(uint16_t) + 1)
+            return 0;
+
+        uint16_t packet_length;
+        memcpy(&packet_length, data + pos, sizeof(uint16_t));
+        packet_length = ntohs(packet_length);
+        pos += sizeof(uint16_t);
+
+        if (packet_length == 0 || packet_length > length - pos)
+            return 0;
+
+        if (data[pos] < CRYPTO_RESERVED_PACKETS || data[pos] >= PACKET_ID_LOSSY_RANGE_START)
+            return 0;
+
+        pos += packet_length;
+    }
+
+    return 1;
+}
+
+/* Lossless packets up to this length are coalesced. */
+#define CRYPTO_COALESCE_MAX_LENGTH 512
+
+/* Send the packet lossless packets are being coalesced into, if there is one.
+ */
+static void send_coalesced_packet(Net_Crypto *c, int crypt_connection_id)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0 || !conn->coalesce_open)
+        return;
+
+    conn->coalesce_open = 0;
+
+    Packet_Data *dt;
+    uint32_t packet_num = conn->send_array.buffer_end - 1;
+
+    if (get_data_pointer(&conn->send_array, &dt, packet_num) != 1 || dt->sent_time != 0)
+        return;
+
+    if (conn->maximum_speed_reached)
+        return;
+
+    if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, packet_num, dt->data,
+                                dt->length) == 0) {
+        dt->sent_time = current_time_monotonic(c->mono_time);
+    } else {
+        conn->maximum_speed_reached = 1;
+        LOGGER_ERROR("send_data_packet failed\n");
+    }
+}
+
+/* Add data of length to the unsent packet at the end of the send queue.
+ *
+ * return -1 if there is no such packet or data doesn't fit in it.
+ * return packet number of the packet on success.
+ */
+static int64_t coalesce_lossless_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *data, uint16_t length)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0 || !conn->coalesce_open)
+        return -1;
+
+    Packet_Data *dt;
+    uint32_t packet_num = conn->send_array.buffer_end - 1;
+
+    if (get_data_pointer(&conn->send_array, &dt, packet_num) != 1 || dt->sent_time != 0)
+        return -1;
+
+    pthread_mutex_lock(&conn->mutex);
+    int added = coalesce_packet(dt, data, length);
+    pthread_mutex_unlock(&conn->mutex);
+
+    if (added == -1)
+        return -1;
+
+    ++c->coalesced_packets_saved;
+    c->coalesced_bytes_saved += CRYPTO_DATA_PACKET_MIN_SIZE - (added - length);
+    return packet_num;
+}
+
+/*  If coalesce is set the packet isn't sent right away, small lossless packets written
+ *  after it may be added to it until send_coalesced_packet() is called.
+ *
+ *  return -1 if data could not be put in packet queue.
+ *  return positive packet number if data was put into the queue.
+ */
+static int64_t send_lossless_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *data, uint16_t length,
+                                    uint8_t congestion_control, _Bool coalesce)
+{
+    if (length == 0 || length > MAX_CRYPTO_DATA_SIZE)
+        return -1;
+
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    /* If last packet send failed, try to send packet again.
+       If sending it fails we won't be able to send the new packet. */
+    reset_max_speed_reached(c, crypt_connection_id);
+
+    if (conn->maximum_speed_reached && congestion_control) {
+        return -1;
+    }
+
+    send_coalesced_packet(c, crypt_connection_id);
+
+    Packet_Data dt;
+    dt.sent_time = 0;
+    dt.length = length;
+    dt.requested = 0;
+    memcpy(dt.data, data, length);
+    pthread_mutex_lock(&conn->mutex);
+    int64_t packet_num = add_data_end_of_buffer(&conn->send_array, &dt);
+    pthread_mutex_unlock(&conn->mutex);
+
+    if (packet_num == -1)
+        return -1;
+
+    if (coalesce) {
+        conn->coalesce_open = 1;
+        return packet_num;
+    }
+
+    if (!congestion_control && conn->maximum_speed_reached) {
+        return packet_num;
+    }
+
+    if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, packet_num, data, length) == 0) {
+        Packet_Data *dt1 = NULL;
+
+        if (get_data_pointer(&conn->send_array, &dt1, packet_num) == 1)
+            dt1->sent_time = current_time_monotonic(c->mono_time);
+    } else {
+        conn->maximum_speed_reached = 1;
+        LOGGER_ERROR("send_data_packet failed\n");
+    }
 
     return packet_num;
 }
@@ -887,6 +1434,22 @@ static uint16_t get_nonce_uint16(const uint8_t *nonce)
 
 #define DATA_NUM_THRESHOLD 21845
 
+/* Put the nonce the data packet was encrypted with in nonce.
+ *
+ * return the difference between the packet nonce number and the one of recv_nonce.
+ */
+static uint16_t get_data_packet_nonce(const Crypto_Connection *conn, uint8_t *nonce, const uint8_t *packet)
+{
+    memcpy(nonce, conn->recv_nonce, crypto_box_NONCEBYTES);
+    uint16_t num_cur_nonce = get_nonce_uint16(nonce);
+    uint16_t num;
+    memcpy(&num, packet + 1, sizeof(uint16_t));
+    num = ntohs(num);
+    uint16_t diff = num - num_cur_nonce;
+    increment_nonce_number(nonce, diff);
+    return diff;
+}
+
 /* Handle a data packet.
  * Decrypt packet of length and put it into data.
  * data must be at least MAX_DATA_DATA_PACKET_SIZE big.
@@ -906,13 +1469,7 @@ static int handle_data_packet(const Net_Crypto *c, int crypt_connection_id, uint
         return -1;
 
     uint8_t nonce[crypto_box_NONCEBYTES];
-    memcpy(nonce, conn->recv_nonce, crypto_box_NONCEBYTES);
-    uint16_t num_cur_nonce = get_nonce_uint16(nonce);
-    uint16_t num;
-    memcpy(&num, packet + 1, sizeof(uint16_t));
-    num = ntohs(num);
-    uint16_t diff = num - num_cur_nonce;
-    increment_nonce_number(nonce, diff);
+    uint16_t diff = get_data_packet_nonce(conn, nonce, packet);
     int len = decrypt_data_symmetric(conn->shared_key, nonce, packet + 1 + sizeof(uint16_t),
                                      length - (1 + sizeof(uint16_t)), data);
 
@@ -939,7 +1496,13 @@ static int send_request_packet(Net_Crypto *c, int crypt_connection_id)
         return -1;
 
     uint8_t data[MAX_CRYPTO_DATA_SIZE];
-    int len = generate_request_packet(data, sizeof(data), &conn->recv_array);
+    int len;
+
+    if (conn->peer_capabilities & CRYPTO_CAPABILITY_SACK) {
+        len = generate_sack_packet(data, sizeof(data), &conn->recv_array);
+    } else {
+        len = generate_request_packet(data, sizeof(data), &conn->recv_array);
+    }
 
     if (len == -1)
         return -1;
@@ -948,216 +1511,548 @@ static int send_request_packet(Net_Crypto *c, int crypt_connection_id)
                                    len);
 }
 
-/* Send up to max num previously requested data packets.
- *
- * return -1 on failure.
- * return number of packets sent on success.
- */
-static int send_requested_packets(Net_Crypto *c, int crypt_connection_id, uint32_t max_num)
-{
-    if (max_num == 0)
-        return -1;
-
-    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
-
-    if (conn == 0)
-        return -1;
-
-    uint64_t temp_time = current_time_monotonic();
-    uint32_t i, num_sent = 0, array_size = num_packets_array(&conn->send_array);
-
-    for (i = 0; i < array_size; ++i) {
-        Packet_Data *dt;
-        uint32_t packet_num = (i + conn->send_array.buffer_start);
-        int ret = get_data_pointer(&conn->send_array, &dt, packet_num);
-
-        if (ret == -1) {
-            return -1;
-        } else if (ret == 0) {
-            continue;
-        }
-
-        if (dt->sent_time) {
-            continue;
-        }
-
-        if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, packet_num, dt->data,
-                                    dt->length) == 0) {
-            dt->sent_time = temp_time;
-            ++num_sent;
-        }
-
-        if (num_sent >= max_num)
-            break;
-    }
+/* Maximum number of PACKET_ID_CAPABILITIES packets sent to a peer that never sent us one. */
+#define MAX_CAPABILITIES_SENT 8
 
-    return num_sent;
-}
+/* Interval in ms between PACKET_ID_CAPABILITIES packets. */
+#define CAPABILITIES_SEND_INTERVAL 1000
 
+#define CAPABILITIES_PACKET_LENGTH (1 + sizeof(uint32_t) + 1)
 
-/* Add a new temp packet to send repeatedly.
+/* Send a capabilities packet.
+ *
+ * The packet contains our CRYPTO_CAPABILITY_* flags and whether we have received
+ * the capabilities of the other side. Peers that don't know this packet drop it.
  *
  * return -1 on failure.
  * return 0 on success.
  */
-static int new_temp_packet(const Net_Crypto *c, int crypt_connection_id, const uint8_t *packet, uint16_t length)
+static int send_capabilities_packet(Net_Crypto *c, int crypt_connection_id)
 {
-    if (length == 0 || length > MAX_CRYPTO_PACKET_SIZE)
-        return -1;
-
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
     if (conn == 0)
         return -1;
 
-    uint8_t *temp_packet = malloc(length);
+    uint8_t data[CAPABILITIES_PACKET_LENGTH];
+    uint32_t capabilities = htonl(CRYPTO_CAPABILITIES);
+    data[0] = PACKET_ID_CAPABILITIES;
+    memcpy(data + 1, &capabilities, sizeof(uint32_t));
+    data[1 + sizeof(uint32_t)] = conn->capabilities_received;
 
-    if (temp_packet == 0)
+    if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, conn->send_array.buffer_end, data,
+                                sizeof(data)) != 0)
         return -1;
 
-    if (conn->temp_packet)
-        free(conn->temp_packet);
-
-    memcpy(temp_packet, packet, length);
-    conn->temp_packet = temp_packet;
-    conn->temp_packet_length = length;
-    conn->temp_packet_sent_time = 0;
-    conn->temp_packet_num_sent = 0;
+    ++conn->capabilities_sent;
+    conn->last_capabilities_sent = current_time_monotonic(c->mono_time);
     return 0;
 }
 
-/* Clear the temp packet.
+/* Handle a capabilities packet.
  *
  * return -1 on failure.
  * return 0 on success.
  */
-static int clear_temp_packet(const Net_Crypto *c, int crypt_connection_id)
+static int handle_capabilities_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *data, uint16_t length)
 {
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
     if (conn == 0)
         return -1;
 
-    if (conn->temp_packet)
-        free(conn->temp_packet);
+    if (length < CAPABILITIES_PACKET_LENGTH)
+        return -1;
+
+    uint32_t capabilities;
+    memcpy(&capabilities, data + 1, sizeof(uint32_t));
+    conn->peer_capabilities = ntohl(capabilities);
+    conn->capabilities_received = 1;
+
+    /* The other side doesn't have ours yet. */
+    if (!data[1 + sizeof(uint32_t)])
+        send_capabilities_packet(c, crypt_connection_id);
 
-    conn->temp_packet = 0;
-    conn->temp_packet_length = 0;
-    conn->temp_packet_sent_time = 0;
-    conn->temp_packet_num_sent = 0;
     return 0;
 }
 
+/* Incomplete groups of FEC protected lossy packets are flushed after this long (ms). */
+#define FEC_GROUP_TIMEOUT 40
 
-/* Send the temp packet.
+/* Create the FEC session of the connection and its work buffers if they don't exist yet.
+ * Must be called with conn->mutex held.
  *
  * return -1 on failure.
  * return 0 on success.
  */
-static int send_temp_packet(Net_Crypto *c, int crypt_connection_id)
+static int create_fec_session(Crypto_Connection *conn)
 {
-    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+    if (conn->fec)
+        return 0;
 
-    if (conn == 0)
-        return -1;
+    FEC_Buffers *buffers = malloc(sizeof(FEC_Buffers));
 
-    if (!conn->temp_packet)
+    if (buffers == NULL)
         return -1;
 
-    if (send_packet_to(c, crypt_connection_id, conn->temp_packet, conn->temp_packet_length) != 0)
+    conn->fec = new_fec_session(PACKET_ID_FEC, MAX_CRYPTO_DATA_SIZE);
+
+    if (conn->fec == NULL) {
+        free(buffers);
         return -1;
+    }
 
-    conn->temp_packet_sent_time = current_time_monotonic();
-    ++conn->temp_packet_num_sent;
+    conn->fec_buffers = buffers;
     return 0;
 }
 
-/* Create a handshake packet and set it as a temp packet.
- * cookie must be COOKIE_LENGTH.
+/* Send num packets created by the FEC session of the connection.
  *
  * return -1 on failure.
  * return 0 on success.
  */
-static int create_send_handshake(Net_Crypto *c, int crypt_connection_id, const uint8_t *cookie,
-                                 const uint8_t *dht_public_key)
+static int send_fec_packets(Net_Crypto *c, int crypt_connection_id, uint8_t packets[][FEC_MAX_PACKET_SIZE],
+                            const uint16_t *lengths, uint32_t num)
 {
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
     if (conn == 0)
         return -1;
 
-    uint8_t handshake_packet[HANDSHAKE_PACKET_LENGTH];
+    pthread_mutex_lock(&conn->mutex);
+    uint32_t buffer_start = conn->recv_array.buffer_start;
+    uint32_t buffer_end = conn->send_array.buffer_end;
+    pthread_mutex_unlock(&conn->mutex);
 
-    if (create_crypto_handshake(c, handshake_packet, cookie, conn->sent_nonce, conn->sessionpublic_key,
-                                conn->public_key, dht_public_key) != sizeof(handshake_packet))
-        return -1;
+    uint32_t i;
+    int ret = 0;
 
-    if (new_temp_packet(c, crypt_connection_id, handshake_packet, sizeof(handshake_packet)) != 0)
-        return -1;
+    for (i = 0; i < num; ++i) {
+        if (send_data_packet_helper(c, crypt_connection_id, buffer_start, buffer_end, packets[i], lengths[i]) != 0)
+            ret = -1;
+    }
 
-    send_temp_packet(c, crypt_connection_id);
-    return 0;
+    return ret;
 }
 
-/* Send a kill packet.
- *
- * return -1 on failure.
- * return 0 on success.
+/* Send the parity packets of the FEC groups that were started more than FEC_GROUP_TIMEOUT ago.
  */
-static int send_kill_packet(Net_Crypto *c, int crypt_connection_id)
+static void send_timed_out_fec_packets(Net_Crypto *c, int crypt_connection_id, uint64_t current_time)
 {
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
     if (conn == 0)
-        return -1;
+        return;
 
-    uint8_t kill_packet = PACKET_ID_KILL;
-    return send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, conn->send_array.buffer_end,
-                                   &kill_packet, sizeof(kill_packet));
-}
+    pthread_mutex_lock(&conn->fec_mutex);
 
-static void connection_kill(Net_Crypto *c, int crypt_connection_id)
-{
-    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+    while (1) {
+        uint32_t num = 0;
+        pthread_mutex_lock(&conn->mutex);
+        FEC_Buffers *buffers = conn->fec_buffers;
 
-    if (conn == 0)
-        return;
+        if (conn->fec)
+            num = fec_timed_out_parity_packets(conn->fec, current_time, FEC_GROUP_TIMEOUT, buffers->parity_packets,
+                                               buffers->parity_lengths);
 
-    if (conn->connection_status_callback) {
-        conn->connection_status_callback(conn->connection_status_callback_object, conn->connection_status_callback_id, 0);
+        pthread_mutex_unlock(&conn->mutex);
+
+        if (num == 0)
+            break;
+
+        send_fec_packets(c, crypt_connection_id, buffers->parity_packets, buffers->parity_lengths, num);
     }
 
-    crypto_kill(c, crypt_connection_id);
+    pthread_mutex_unlock(&conn->fec_mutex);
 }
 
-/* Handle a received data packet.
+/* Handle a PACKET_ID_FEC packet, passing the lossy packet it contains and any it made it
+ * possible to recover to the lossy packet callback.
  *
  * return -1 on failure.
  * return 0 on success.
  */
-static int handle_data_packet_helper(Net_Crypto *c, int crypt_connection_id, const uint8_t *packet, uint16_t length)
+static int handle_fec_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *data, uint16_t length)
 {
-    if (length > MAX_CRYPTO_PACKET_SIZE || length <= CRYPTO_DATA_PACKET_MIN_SIZE)
-        return -1;
-
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
     if (conn == 0)
         return -1;
 
-    uint8_t data[MAX_DATA_DATA_PACKET_SIZE];
-    int len = handle_data_packet(c, crypt_connection_id, data, packet, length);
+    FEC_Buffers *buffers = NULL;
+    int num = -1;
 
-    if (len <= (int)(sizeof(uint32_t) * 2))
-        return -1;
+    pthread_mutex_lock(&conn->mutex);
 
-    uint32_t buffer_start, num;
-    memcpy(&buffer_start, data, sizeof(uint32_t));
-    memcpy(&num, data + sizeof(uint32_t), sizeof(uint32_t));
-    buffer_start = ntohl(buffer_start);
-    num = ntohl(num);
+    if (create_fec_session(conn) == 0) {
+        buffers = conn->fec_buffers;
+        num = fec_handle_packet(conn->fec, data, length, buffers->recv_packets, buffers->recv_lengths);
+    }
 
-    uint64_t rtt_calc_time = 0;
+    pthread_mutex_unlock(&conn->mutex);
+
+    int i;
+
+    for (i = 0; i < num; ++i) {
+        const uint8_t *packet = buffers->recv_packets[i];
+
+        if (packet[0] < PACKET_ID_LOSSY_RANGE_START
+                || packet[0] >= (PACKET_ID_LOSSY_RANGE_START + PACKET_ID_LOSSY_RANGE_SIZE))
+            continue;
+
+        if (conn->connection_lossy_data_callback)
+            conn->connection_lossy_data_callback(conn->connection_lossy_data_callback_object,
+                                                 conn->connection_lossy_data_callback_id, packet,
+                                                 buffers->recv_lengths[i]);
+
+        conn = get_crypto_connection(c, crypt_connection_id);
+
+        /* The callback may have killed the connection and freed the buffers with it. */
+        if (conn == 0 || conn->fec_buffers != buffers)
+            return -1;
+    }
+
+    return num == -1 ? -1 : 0;
+}
+
+/* Send up to max num previously requested data packets.
+ *
+ * return -1 on failure.
+ * return number of packets sent on success.
+ */
+static int send_requested_packets(Net_Crypto *c, int crypt_connection_id, uint32_t max_num)
+{
+    if (max_num == 0)
+        return -1;
+
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    uint64_t temp_time = current_time_monotonic(c->mono_time);
+    uint32_t i, num_sent = 0, array_size = num_packets_array(&conn->send_array);
+
+    for (i = 0; i < array_size; ++i) {
+        Packet_Data *dt;
+        uint32_t packet_num = (i + conn->send_array.buffer_start);
+        int ret = get_data_pointer(&conn->send_array, &dt, packet_num);
+
+        if (ret == -1) {
+            return -1;
+        } else if (ret == 0) {
+            continue;
+        }
+
+        if (dt->sent_time) {
+            continue;
+        }
+
+        if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, packet_num, dt->data,
+                                    dt->length) == 0) {
+            dt->sent_time = temp_time;
+            ++num_sent;
+
+            if (dt->requested)
+                count_retransmits(conn, 1);
+        }
+
+        if (num_sent >= max_num)
+            break;
+    }
+
+    return num_sent;
+}
+
+/* Same as send_requested_packets() but the packets are encrypted in batches by the crypto pipeline.
+ *
+ * return -1 on failure.
+ * return number of packets sent on success.
+ */
+static int send_requested_packets_pipelined(Net_Crypto *c, int crypt_connection_id, uint32_t max_num)
+{
+    if (max_num == 0)
+        return -1;
+
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    Packet_Data *batch[CRYPTO_PIPELINE_BATCH_SIZE];
+    uint32_t batch_numbers[CRYPTO_PIPELINE_BATCH_SIZE];
+    uint32_t batch_length = 0;
+
+    uint64_t temp_time = current_time_monotonic(c->mono_time);
+    uint32_t i, num_sent = 0, array_size = num_packets_array(&conn->send_array);
+
+    for (i = 0; i < array_size && num_sent + batch_length < max_num; ++i) {
+        Packet_Data *dt;
+        uint32_t packet_num = (i + conn->send_array.buffer_start);
+        int ret = get_data_pointer(&conn->send_array, &dt, packet_num);
+
+        if (ret == -1) {
+            return -1;
+        } else if (ret == 0) {
+            continue;
+        }
+
+        if (dt->sent_time) {
+            continue;
+        }
+
+        batch[batch_length] = dt;
+        batch_numbers[batch_length] = packet_num;
+        ++batch_length;
+
+        if (batch_length == CRYPTO_PIPELINE_BATCH_SIZE) {
+            uint32_t j, sent = send_data_packets_pipelined(c, crypt_connection_id, batch, batch_numbers, batch_length);
+
+            uint32_t retransmits = 0;
+
+            for (j = 0; j < sent; ++j) {
+                batch[j]->sent_time = temp_time;
+                retransmits += batch[j]->requested;
+            }
+
+            if (retransmits)
+                count_retransmits(conn, retransmits);
+
+            num_sent += sent;
+
+            if (sent != batch_length)
+                return num_sent;
+
+            batch_length = 0;
+        }
+    }
+
+    if (batch_length) {
+        uint32_t j, sent = send_data_packets_pipelined(c, crypt_connection_id, batch, batch_numbers, batch_length);
+
+        uint32_t retransmits = 0;
+
+        for (j = 0; j < sent; ++j) {
+            batch[j]->sent_time = temp_time;
+            retransmits += batch[j]->requested;
+        }
+
+        if (retransmits)
+            count_retransmits(conn, retransmits);
+
+        num_sent += sent;
+    }
+
+    return num_sent;
+}
+
+
+/* Add a new temp packet to send repeatedly.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int new_temp_packet(const Net_Crypto *c, int crypt_connection_id, const uint8_t *packet, uint16_t length)
+{
+    if (length == 0 || length > MAX_CRYPTO_PACKET_SIZE)
+        return -1;
+
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    uint8_t *temp_packet = malloc(length);
+
+    if (temp_packet == 0)
+        return -1;
+
+    if (conn->temp_packet)
+        free(conn->temp_packet);
+
+    memcpy(temp_packet, packet, length);
+    conn->temp_packet = temp_packet;
+    conn->temp_packet_length = length;
+    conn->temp_packet_sent_time = 0;
+    conn->temp_packet_num_sent = 0;
+    return 0;
+}
+
+/* Clear the temp packet.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int clear_temp_packet(const Net_Crypto *c, int crypt_connection_id)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    if (conn->temp_packet)
+        free(conn->temp_packet);
+
+    conn->temp_packet = 0;
+    conn->temp_packet_length = 0;
+    conn->temp_packet_sent_time = 0;
+    conn->temp_packet_num_sent = 0;
+    return 0;
+}
+
+
+/* Send the temp packet.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int send_temp_packet(Net_Crypto *c, int crypt_connection_id)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    if (!conn->temp_packet)
+        return -1;
+
+    if (send_packet_to(c, crypt_connection_id, conn->temp_packet, conn->temp_packet_length) != 0)
+        return -1;
+
+    conn->temp_packet_sent_time = current_time_monotonic(c->mono_time);
+    ++conn->temp_packet_num_sent;
+    return 0;
+}
+
+/* Create a handshake packet and set it as a temp packet.
+ * cookie must be COOKIE_LENGTH.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int create_send_handshake(Net_Crypto *c, int crypt_connection_id, const uint8_t *cookie,
+                                 const uint8_t *dht_public_key)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    uint8_t handshake_packet[HANDSHAKE_PACKET_LENGTH];
+
+    if (create_crypto_handshake(c, handshake_packet, cookie, conn->sent_nonce, conn->sessionpublic_key,
+                                conn->public_key, dht_public_key) != sizeof(handshake_packet))
+        return -1;
+
+    if (new_temp_packet(c, crypt_connection_id, handshake_packet, sizeof(handshake_packet)) != 0)
+        return -1;
+
+    send_temp_packet(c, crypt_connection_id);
+    return 0;
+}
+
+/* Send a kill packet.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int send_kill_packet(Net_Crypto *c, int crypt_connection_id)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    uint8_t kill_packet = PACKET_ID_KILL;
+    return send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, conn->send_array.buffer_end,
+                                   &kill_packet, sizeof(kill_packet));
+}
+
+static void connection_kill(Net_Crypto *c, int crypt_connection_id)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return;
+
+    if (conn->connection_status_callback) {
+        conn->connection_status_callback(conn->connection_status_callback_object, conn->connection_status_callback_id, 0);
+    }
+
+    crypto_kill(c, crypt_connection_id);
+}
+
+/* Pass a lossless packet taken from the recv_array to the data callback, one packet
+ * at a time for PACKET_ID_COALESCED packets.
+ *
+ * return -1 if the connection was killed in the callback.
+ * return 0 otherwise.
+ */
+static int deliver_lossless_packet(Net_Crypto *c, int crypt_connection_id, uint8_t *data, uint16_t length)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    if (data[0] != PACKET_ID_COALESCED) {
+        if (conn->connection_data_callback)
+            conn->connection_data_callback(conn->connection_data_callback_object, conn->connection_data_callback_id, data,
+                                           length);
+
+        /* conn might get killed in callback. */
+        return get_crypto_connection(c, crypt_connection_id) ? 0 : -1;
+    }
+
+    uint32_t pos = 1;
+
+    while (pos < length) {
+        uint16_t packet_length;
+        memcpy(&packet_length, data + pos, sizeof(uint16_t));
+        packet_length = ntohs(packet_length);
+        pos += sizeof(uint16_t);
+
+        if (conn->connection_data_callback)
+            conn->connection_data_callback(conn->connection_data_callback_object, conn->connection_data_callback_id, data + pos,
+                                           packet_length);
+
+        pos += packet_length;
+
+        /* conn might get killed in callback. */
+        conn = get_crypto_connection(c, crypt_connection_id);
+
+        if (conn == 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Handle the decrypted contents of a received data packet.
+ *
+ * return -1 on failure.
+ * return -2 if the packet didn't fit in the receive window.
+ * return 0 on success.
+ */
+static int handle_decrypted_data_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *data, uint16_t len)
+{
+    if (len <= sizeof(uint32_t) * 2)
+        return -1;
+
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    uint32_t buffer_start, num;
+    memcpy(&buffer_start, data, sizeof(uint32_t));
+    memcpy(&num, data + sizeof(uint32_t), sizeof(uint32_t));
+    buffer_start = ntohl(buffer_start);
+    num = ntohl(num);
+
+    uint64_t rtt_calc_time = 0;
+    uint64_t latest_acked_time = 0;
+    uint32_t num_acked = 0, num_lost = 0;
 
     if (buffer_start != conn->send_array.buffer_start) {
         Packet_Data *packet_time;
@@ -1166,12 +2061,20 @@ static int handle_data_packet_helper(Net_Crypto *c, int crypt_connection_id, con
             rtt_calc_time = packet_time->sent_time;
         }
 
-        if (clear_buffer_until(&conn->send_array, buffer_start) != 0) {
+        if (get_data_pointer(&conn->send_array, &packet_time, buffer_start - 1) == 1 && !packet_time->requested) {
+            latest_acked_time = packet_time->sent_time;
+        }
+
+        int deleted = clear_buffer_until(&conn->send_array, buffer_start);
+
+        if (deleted == -1) {
             return -1;
         }
+
+        num_acked = deleted;
     }
 
-    uint8_t *real_data = data + (sizeof(uint32_t) * 2);
+    const uint8_t *real_data = data + (sizeof(uint32_t) * 2);
     uint16_t real_length = len - (sizeof(uint32_t) * 2);
 
     while (real_data[0] == PACKET_ID_PADDING) { /* Remove Padding */
@@ -1190,13 +2093,36 @@ static int handle_data_packet_helper(Net_Crypto *c, int crypt_connection_id, con
     if (conn->status == CRYPTO_CONN_NOT_CONFIRMED) {
         clear_temp_packet(c, crypt_connection_id);
         conn->status = CRYPTO_CONN_ESTABLISHED;
+        pthread_mutex_lock(&conn->mutex);
+        conn->handshake_time = current_time_monotonic(c->mono_time) - conn->created_time;
+        pthread_mutex_unlock(&conn->mutex);
+        crypto_histogram_add(c->handshake_histogram, conn->handshake_time);
 
         if (conn->connection_status_callback)
             conn->connection_status_callback(conn->connection_status_callback_object, conn->connection_status_callback_id, 1);
     }
 
-    if (real_data[0] == PACKET_ID_REQUEST) {
-        int requested = handle_request_packet(&conn->send_array, real_data, real_length, &rtt_calc_time, conn->rtt_time);
+    if (real_data[0] == PACKET_ID_REQUEST || real_data[0] == PACKET_ID_SACK) {
+        uint64_t request_sent_time = 0;
+        uint32_t request_acked;
+        int requested;
+
+        if (real_data[0] == PACKET_ID_SACK) {
+            requested = handle_sack_packet(c->mono_time, &conn->send_array, real_data, real_length, &request_sent_time,
+                                           conn->rtt_time, &request_acked, &num_lost);
+        } else {
+            requested = handle_request_packet(c->mono_time, &conn->send_array, real_data, real_length,
+                                              &request_sent_time, conn->rtt_time, &request_acked, &num_lost);
+        }
+
+        num_acked += request_acked;
+
+        /* The default algorithm only takes its RTT from the data packets, as it always has. */
+        if (conn->congestion_control.type != CONGESTION_CONTROL_DEFAULT && rtt_calc_time < request_sent_time)
+            rtt_calc_time = request_sent_time;
+
+        if (latest_acked_time < request_sent_time)
+            latest_acked_time = request_sent_time;
 
         if (requested == -1) {
             return -1;
@@ -1205,13 +2131,26 @@ static int handle_data_packet_helper(Net_Crypto *c, int crypt_connection_id, con
         }
 
         set_buffer_end(&conn->recv_array, num);
-    } else if (real_data[0] >= CRYPTO_RESERVED_PACKETS && real_data[0] < PACKET_ID_LOSSY_RANGE_START) {
+    } else if (real_data[0] == PACKET_ID_CAPABILITIES) {
+        if (handle_capabilities_packet(c, crypt_connection_id, real_data, real_length) != 0)
+            return -1;
+
+        set_buffer_end(&conn->recv_array, num);
+    } else if (real_data[0] == PACKET_ID_FEC) {
+        set_buffer_end(&conn->recv_array, num);
+
+        if (handle_fec_packet(c, crypt_connection_id, real_data, real_length) != 0)
+            return -1;
+
+        conn = get_crypto_connection(c, crypt_connection_id);
+    } else if ((real_data[0] >= CRYPTO_RESERVED_PACKETS && real_data[0] < PACKET_ID_LOSSY_RANGE_START)
+               || (real_data[0] == PACKET_ID_COALESCED && coalesced_packet_valid(real_data, real_length))) {
         Packet_Data dt;
         dt.length = real_length;
         memcpy(dt.data, real_data, real_length);
 
         if (add_data_to_buffer(&conn->recv_array, num, &dt) != 0)
-            return -1;
+            return -2;
 
 
         while (1) {
@@ -1222,15 +2161,10 @@ static int handle_data_packet_helper(Net_Crypto *c, int crypt_connection_id, con
             if (ret == -1)
                 break;
 
-            if (conn->connection_data_callback)
-                conn->connection_data_callback(conn->connection_data_callback_object, conn->connection_data_callback_id, dt.data,
-                                               dt.length);
+            if (deliver_lossless_packet(c, crypt_connection_id, dt.data, dt.length) == -1)
+                return -1;
 
-            /* conn might get killed in callback. */
             conn = get_crypto_connection(c, crypt_connection_id);
-
-            if (conn == 0)
-                return -1;
         }
 
         /* Packet counter. */
@@ -1248,13 +2182,183 @@ static int handle_data_packet_helper(Net_Crypto *c, int crypt_connection_id, con
         return -1;
     }
 
+    uint64_t temp_time = current_time_monotonic(c->mono_time);
+
     if (rtt_calc_time != 0) {
-        uint64_t rtt_time = current_time_monotonic() - rtt_calc_time;
+        uint64_t rtt_time = temp_time - rtt_calc_time;
 
         if (rtt_time < conn->rtt_time)
             conn->rtt_time = rtt_time;
     }
 
+    /* The most recently sent of the acknowledged packets gives the best RTT sample. */
+    if (latest_acked_time != 0) {
+        congestion_control_on_rtt_sample(&conn->congestion_control, temp_time, temp_time - latest_acked_time);
+        pthread_mutex_lock(&conn->mutex);
+        crypto_histogram_add(conn->counters.rtt_histogram, temp_time - latest_acked_time);
+        pthread_mutex_unlock(&conn->mutex);
+    }
+
+    congestion_control_on_ack(&conn->congestion_control, temp_time, num_acked);
+    congestion_control_on_loss(&conn->congestion_control, temp_time, num_lost);
+    return 0;
+}
+
+/* Handle a received data packet.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int handle_data_packet_helper(Net_Crypto *c, int crypt_connection_id, const uint8_t *packet, uint16_t length)
+{
+    if (length > MAX_CRYPTO_PACKET_SIZE || length <= CRYPTO_DATA_PACKET_MIN_SIZE) {
+        count_packet_dropped(c, crypt_connection_id, CRYPTO_DROP_INVALID);
+        return -1;
+    }
+
+    uint8_t data[MAX_DATA_DATA_PACKET_SIZE];
+    int len = handle_data_packet(c, crypt_connection_id, data, packet, length);
+
+    if (len == -1) {
+        count_packet_dropped(c, crypt_connection_id, CRYPTO_DROP_DECRYPT);
+        return -1;
+    }
+
+    int ret = handle_decrypted_data_packet(c, crypt_connection_id, data, len);
+
+    if (ret != 0) {
+        count_packet_dropped(c, crypt_connection_id, ret == -2 ? CRYPTO_DROP_WINDOW : CRYPTO_DROP_INVALID);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Decrypt all the queued data packets with the crypto pipeline and handle them in the order they were received.
+ */
+static void handle_pipeline_packets(Net_Crypto *c)
+{
+    Net_Crypto_Pipeline *p = c->pipeline;
+
+    if (p == NULL)
+        return;
+
+    uint32_t start = 0;
+
+    while (start < p->recv_queue_length) {
+        uint32_t i, num = 0;
+        _Bool move_nonce = 0;
+
+        /* A packet that moves the recv_nonce of its connection forward ends the batch so that
+           the nonces of the packets after it are calculated from the updated recv_nonce. */
+        for (i = start; i < p->recv_queue_length && !move_nonce; ++i) {
+            const Pipeline_Packet *queued = &p->recv_queue[i];
+            Crypto_Job *job = &p->jobs[num];
+            ++num;
+
+            job->input_length = 0;
+            job->result = -1;
+
+            Crypto_Connection *conn = get_crypto_connection(c, queued->crypt_connection_id);
+
+            if (conn == 0)
+                continue;
+
+            pthread_mutex_lock(&conn->mutex);
+            uint16_t diff = get_data_packet_nonce(conn, job->nonce, queued->data);
+            memcpy(job->shared_key, conn->shared_key, crypto_box_BEFORENMBYTES);
+            pthread_mutex_unlock(&conn->mutex);
+
+            job->input = queued->data + 1 + sizeof(uint16_t);
+            job->input_length = queued->length - (1 + sizeof(uint16_t));
+            job->output = p->plain[num - 1];
+            job->type = CRYPTO_JOB_DECRYPT;
+
+            if (diff > DATA_NUM_THRESHOLD * 2)
+                move_nonce = 1;
+        }
+
+        crypto_pipeline_run(p->pipeline, p->jobs, num);
+
+        for (i = 0; i < num; ++i) {
+            const Pipeline_Packet *queued = &p->recv_queue[start + i];
+            const Crypto_Job *job = &p->jobs[i];
+
+            if (job->input_length == 0)
+                continue;
+
+            if (job->result != job->input_length - (int)crypto_box_MACBYTES) {
+                count_packet_dropped(c, queued->crypt_connection_id, CRYPTO_DROP_DECRYPT);
+                continue;
+            }
+
+            /* conn might have been killed or replaced by one of the callbacks. */
+            Crypto_Connection *conn = get_crypto_connection(c, queued->crypt_connection_id);
+
+            if (conn == 0 || public_key_cmp(conn->shared_key, job->shared_key) != 0)
+                continue;
+
+            if (move_nonce && i == num - 1) {
+                pthread_mutex_lock(&conn->mutex);
+                increment_nonce_number(conn->recv_nonce, DATA_NUM_THRESHOLD);
+                pthread_mutex_unlock(&conn->mutex);
+            }
+
+            int ret = handle_decrypted_data_packet(c, queued->crypt_connection_id, p->plain[i], job->result);
+
+            if (ret != 0) {
+                count_packet_dropped(c, queued->crypt_connection_id,
+                                     ret == -2 ? CRYPTO_DROP_WINDOW : CRYPTO_DROP_INVALID);
+                continue;
+            }
+
+            conn = get_crypto_connection(c, queued->crypt_connection_id);
+
+            if (conn == 0)
+                continue;
+
+            pthread_mutex_lock(&conn->mutex);
+            conn->direct_lastrecv_time = unix_time(c->mono_time);
+            pthread_mutex_unlock(&conn->mutex);
+        }
+
+        start += num;
+    }
+
+    p->recv_queue_length = 0;
+}
+
+/* Queue a received data packet so that it gets decrypted with the next pipeline batch.
+ * If the queue is full, the packets in it are handled first.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int queue_pipeline_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *packet, uint16_t length)
+{
+    if (length > MAX_CRYPTO_PACKET_SIZE || length <= CRYPTO_DATA_PACKET_MIN_SIZE)
+        return -1;
+
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    if (conn->status != CRYPTO_CONN_NOT_CONFIRMED && conn->status != CRYPTO_CONN_ESTABLISHED) {
+        count_packet_dropped(c, crypt_connection_id, CRYPTO_DROP_STATE);
+        return -1;
+    }
+
+    Net_Crypto_Pipeline *p = c->pipeline;
+
+    if (p->recv_queue_length == CRYPTO_PIPELINE_BATCH_SIZE)
+        handle_pipeline_packets(c);
+
+    Pipeline_Packet *queued = &p->recv_queue[p->recv_queue_length];
+    queued->crypt_connection_id = crypt_connection_id;
+    queued->length = length;
+    memcpy(queued->data, packet, length);
+    ++p->recv_queue_length;
     return 0;
 }
 
@@ -1275,17 +2379,23 @@ static int handle_packet_connection(Net_Crypto *c, int crypt_connection_id, cons
 
     switch (packet[0]) {
         case NET_PACKET_COOKIE_RESPONSE: {
-            if (conn->status != CRYPTO_CONN_COOKIE_REQUESTING)
+            if (conn->status != CRYPTO_CONN_COOKIE_REQUESTING) {
+                count_packet_dropped(c, crypt_connection_id, CRYPTO_DROP_STATE);
                 return -1;
+            }
 
             uint8_t cookie[COOKIE_LENGTH];
             uint64_t number;
 
-            if (handle_cookie_response(cookie, &number, packet, length, conn->shared_key) != sizeof(cookie))
+            if (handle_cookie_response(cookie, &number, packet, length, conn->shared_key) != sizeof(cookie)) {
+                count_packet_dropped(c, crypt_connection_id, CRYPTO_DROP_DECRYPT);
                 return -1;
+            }
 
-            if (number != conn->cookie_request_number)
+            if (number != conn->cookie_request_number) {
+                count_packet_dropped(c, crypt_connection_id, CRYPTO_DROP_INVALID);
                 return -1;
+            }
 
             if (create_send_handshake(c, crypt_connection_id, cookie, conn->dht_public_key) != 0)
                 return -1;
@@ -1302,8 +2412,10 @@ static int handle_packet_connection(Net_Crypto *c, int crypt_connection_id, cons
                 uint8_t cookie[COOKIE_LENGTH];
 
                 if (handle_crypto_handshake(c, conn->recv_nonce, conn->peersessionpublic_key, peer_real_pk, dht_public_key, cookie,
-                                            packet, length, conn->public_key) != 0)
+                                            packet, length, conn->public_key) != 0) {
+                    count_packet_dropped(c, crypt_connection_id, CRYPTO_DROP_DECRYPT);
                     return -1;
+                }
 
                 if (public_key_cmp(dht_public_key, conn->dht_public_key) == 0) {
                     encrypt_precompute(conn->peersessionpublic_key, conn->sessionsecret_key, conn->shared_key);
@@ -1320,6 +2432,7 @@ static int handle_packet_connection(Net_Crypto *c, int crypt_connection_id, cons
                 }
 
             } else {
+                count_packet_dropped(c, crypt_connection_id, CRYPTO_DROP_STATE);
                 return -1;
             }
 
@@ -1330,6 +2443,7 @@ static int handle_packet_connection(Net_Crypto *c, int crypt_connection_id, cons
             if (conn->status == CRYPTO_CONN_NOT_CONFIRMED || conn->status == CRYPTO_CONN_ESTABLISHED) {
                 return handle_data_packet_helper(c, crypt_connection_id, packet, length);
             } else {
+                count_packet_dropped(c, crypt_connection_id, CRYPTO_DROP_STATE);
                 return -1;
             }
 
@@ -1337,6 +2451,7 @@ static int handle_packet_connection(Net_Crypto *c, int crypt_connection_id, cons
         }
 
         default: {
+            count_packet_dropped(c, crypt_connection_id, CRYPTO_DROP_INVALID);
             return -1;
         }
     }
@@ -1402,12 +2517,38 @@ static int create_crypto_connection(Net_Crypto *c)
             pthread_mutex_unlock(&c->connections_mutex);
             return -1;
         }
+
+        if (pthread_mutex_init(&c->crypto_connections[id].fec_mutex, NULL) != 0) {
+            pthread_mutex_destroy(&c->crypto_connections[id].mutex);
+            pthread_mutex_unlock(&c->connections_mutex);
+            return -1;
+        }
     }
 
     pthread_mutex_unlock(&c->connections_mutex);
     return id;
 }
 
+static void add_counters(Crypto_Connection_Counters *total, const Crypto_Connection_Counters *counters)
+{
+    unsigned int i;
+
+    total->packets_sent += counters->packets_sent;
+    total->bytes_sent += counters->bytes_sent;
+    total->packets_sent_tcp += counters->packets_sent_tcp;
+    total->packets_received += counters->packets_received;
+    total->bytes_received += counters->bytes_received;
+    total->packets_received_tcp += counters->packets_received_tcp;
+    total->retransmits += counters->retransmits;
+    total->congestion_events += counters->congestion_events;
+
+    for (i = 0; i < CRYPTO_DROP_REASONS; ++i)
+        total->drops[i] += counters->drops[i];
+
+    for (i = 0; i < CRYPTO_HISTOGRAM_BUCKETS; ++i)
+        total->rtt_histogram[i] += counters->rtt_histogram[i];
+}
+
 /* Wipe a crypto connection.
  *
  * return -1 on failure.
@@ -1420,14 +2561,25 @@ static int wipe_crypto_connection(Net_Crypto *c, int crypt_connection_id)
 
     uint32_t i;
 
-    /* Keep mutex, only destroy it when connection is realloced out. */
+    pthread_mutex_lock(&c->crypto_connections[crypt_connection_id].fec_mutex);
+    kill_fec_session(c->crypto_connections[crypt_connection_id].fec);
+    free(c->crypto_connections[crypt_connection_id].fec_buffers);
+    pthread_mutex_unlock(&c->crypto_connections[crypt_connection_id].fec_mutex);
+    pthread_mutex_lock(&c->crypto_connections[crypt_connection_id].mutex);
+    add_counters(&c->killed_counters, &c->crypto_connections[crypt_connection_id].counters);
+    pthread_mutex_unlock(&c->crypto_connections[crypt_connection_id].mutex);
+
+    /* Keep mutexes, only destroy them when connection is realloced out. */
     pthread_mutex_t mutex = c->crypto_connections[crypt_connection_id].mutex;
+    pthread_mutex_t fec_mutex = c->crypto_connections[crypt_connection_id].fec_mutex;
     memset(&(c->crypto_connections[crypt_connection_id]), 0 , sizeof(Crypto_Connection));
     c->crypto_connections[crypt_connection_id].mutex = mutex;
+    c->crypto_connections[crypt_connection_id].fec_mutex = fec_mutex;
 
     for (i = c->crypto_connections_length; i != 0; --i) {
         if (c->crypto_connections[i - 1].status == CRYPTO_CONN_NO_CONNECTION) {
             pthread_mutex_destroy(&c->crypto_connections[i - 1].mutex);
+            pthread_mutex_destroy(&c->crypto_connections[i - 1].fec_mutex);
         } else {
             break;
         }
@@ -1482,7 +2634,7 @@ static int crypto_connection_add_source(Net_Crypto *c, int crypt_connection_id,
             conn->ip_port = source;
         }
 
-        conn->direct_lastrecv_time = unix_time();
+        conn->direct_lastrecv_time = unix_time(c->mono_time);
         return 0;
     } else if (source.ip.family == TCP_FAMILY) {
         if (add_tcp_number_relay_connection(c->tcp_c, conn->connection_number_tcp, source.ip.ip6.uint32[0]) == 0)
@@ -1552,14 +2704,32 @@ static int handle_new_connection_handshake(Net_Crypto *c, IP_Port source, const
                 }
             }
 
-            free(n_c.cookie);
-            return ret;
-        }
-    }
+            free(n_c.cookie);
+            return ret;
+        }
+    }
+
+    int ret = c->new_connection_callback(c->new_connection_callback_object, &n_c);
+    free(n_c.cookie);
+    return ret;
+}
+
+/* Create the TCP connection of crypt_connection_id. Packets on it go to c even if the TCP
+ * connections are shared with the other accounts of a host.
+ *
+ * return connections_number on success.
+ * return -1 on failure.
+ */
+static int new_crypto_tcp_connection(Net_Crypto *c, const uint8_t *dht_public_key, int crypt_connection_id)
+{
+    pthread_mutex_lock(c->tcp_mutex);
+    int connection_number_tcp = new_tcp_connection_to(c->tcp_c, dht_public_key, crypt_connection_id);
+
+    if (connection_number_tcp != -1 && c->host)
+        set_tcp_connection_to_object(c->tcp_c, connection_number_tcp, c);
 
-    int ret = c->new_connection_callback(c->new_connection_callback_object, &n_c);
-    free(n_c.cookie);
-    return ret;
+    pthread_mutex_unlock(c->tcp_mutex);
+    return connection_number_tcp;
 }
 
 /* Accept a crypto connection.
@@ -1582,9 +2752,7 @@ int accept_crypto_connection(Net_Crypto *c, New_Connection *n_c)
     if (n_c->cookie_length != COOKIE_LENGTH)
         return -1;
 
-    pthread_mutex_lock(&c->tcp_mutex);
-    int connection_number_tcp = new_tcp_connection_to(c->tcp_c, n_c->dht_public_key, crypt_connection_id);
-    pthread_mutex_unlock(&c->tcp_mutex);
+    int connection_number_tcp = new_crypto_tcp_connection(c, n_c->dht_public_key, crypt_connection_id);
 
     if (connection_number_tcp == -1)
         return -1;
@@ -1597,17 +2765,19 @@ int accept_crypto_connection(Net_Crypto *c, New_Connection *n_c)
     crypto_box_keypair(conn->sessionpublic_key, conn->sessionsecret_key);
     encrypt_precompute(conn->peersessionpublic_key, conn->sessionsecret_key, conn->shared_key);
     conn->status = CRYPTO_CONN_NOT_CONFIRMED;
+    conn->created_time = current_time_monotonic(c->mono_time);
 
     if (create_send_handshake(c, crypt_connection_id, n_c->cookie, n_c->dht_public_key) != 0) {
-        pthread_mutex_lock(&c->tcp_mutex);
+        pthread_mutex_lock(c->tcp_mutex);
         kill_tcp_connection_to(c->tcp_c, conn->connection_number_tcp);
-        pthread_mutex_unlock(&c->tcp_mutex);
+        pthread_mutex_unlock(c->tcp_mutex);
         conn->status = CRYPTO_CONN_NO_CONNECTION;
         return -1;
     }
 
     memcpy(conn->dht_public_key, n_c->dht_public_key, crypto_box_PUBLICKEYBYTES);
-    conn->packet_send_rate = CRYPTO_PACKET_MIN_RATE;
+    congestion_control_init(&conn->congestion_control, c->congestion_control_type,
+                            current_time_monotonic(c->mono_time));
     conn->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
     conn->rtt_time = DEFAULT_PING_CONNECTION;
     crypto_connection_add_source(c, crypt_connection_id, n_c->source);
@@ -1637,9 +2807,7 @@ int new_crypto_connection(Net_Crypto *c, const uint8_t *real_public_key, const u
     if (conn == 0)
         return -1;
 
-    pthread_mutex_lock(&c->tcp_mutex);
-    int connection_number_tcp = new_tcp_connection_to(c->tcp_c, dht_public_key, crypt_connection_id);
-    pthread_mutex_unlock(&c->tcp_mutex);
+    int connection_number_tcp = new_crypto_tcp_connection(c, dht_public_key, crypt_connection_id);
 
     if (connection_number_tcp == -1)
         return -1;
@@ -1649,7 +2817,9 @@ int new_crypto_connection(Net_Crypto *c, const uint8_t *real_public_key, const u
     random_nonce(conn->sent_nonce);
     crypto_box_keypair(conn->sessionpublic_key, conn->sessionsecret_key);
     conn->status = CRYPTO_CONN_COOKIE_REQUESTING;
-    conn->packet_send_rate = CRYPTO_PACKET_MIN_RATE;
+    conn->created_time = current_time_monotonic(c->mono_time);
+    congestion_control_init(&conn->congestion_control, c->congestion_control_type,
+                            current_time_monotonic(c->mono_time));
     conn->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
     conn->rtt_time = DEFAULT_PING_CONNECTION;
     memcpy(conn->dht_public_key, dht_public_key, crypto_box_PUBLICKEYBYTES);
@@ -1660,9 +2830,9 @@ int new_crypto_connection(Net_Crypto *c, const uint8_t *real_public_key, const u
     if (create_cookie_request(c, cookie_request, conn->dht_public_key, conn->cookie_request_number,
                               conn->shared_key) != sizeof(cookie_request)
             || new_temp_packet(c, crypt_connection_id, cookie_request, sizeof(cookie_request)) != 0) {
-        pthread_mutex_lock(&c->tcp_mutex);
+        pthread_mutex_lock(c->tcp_mutex);
         kill_tcp_connection_to(c->tcp_c, conn->connection_number_tcp);
-        pthread_mutex_unlock(&c->tcp_mutex);
+        pthread_mutex_unlock(c->tcp_mutex);
         conn->status = CRYPTO_CONN_NO_CONNECTION;
         return -1;
     }
@@ -1688,7 +2858,7 @@ int set_direct_ip_port(Net_Crypto *c, int crypt_connection_id, IP_Port ip_port,
         return -1;
 
     if (!ipport_equal(&ip_port, &conn->ip_port)) {
-        if ((UDP_DIRECT_TIMEOUT + conn->direct_lastrecv_time) > unix_time()) {
+        if ((UDP_DIRECT_TIMEOUT + conn->direct_lastrecv_time) > unix_time(c->mono_time)) {
             /* We already know a LAN ip, no need to switch. */
             if (LAN_ip(conn->ip_port.ip) == 0)
                 return -1;
@@ -1703,7 +2873,7 @@ int set_direct_ip_port(Net_Crypto *c, int crypt_connection_id, IP_Port ip_port,
             conn->ip_port = ip_port;
 
             if (connected) {
-                conn->direct_lastrecv_time = unix_time();
+                conn->direct_lastrecv_time = unix_time(c->mono_time);
             } else {
                 conn->direct_lastrecv_time = 0;
             }
@@ -1725,16 +2895,20 @@ static int tcp_data_callback(void *object, int id, const uint8_t *data, uint16_t
 
     Crypto_Connection *conn = get_crypto_connection(c, id);
 
-    if (conn == 0)
+    if (conn == 0) {
+        ++c->packets_no_connection;
         return -1;
+    }
+
+    count_packet_received(c, id, length, 1);
 
     if (data[0] == NET_PACKET_COOKIE_REQUEST) {
         return tcp_handle_cookie_request(c, conn->connection_number_tcp, data, length);
     }
 
-    pthread_mutex_unlock(&c->tcp_mutex);
+    pthread_mutex_unlock(c->tcp_mutex);
     int ret = handle_packet_connection(c, id, data, length);
-    pthread_mutex_lock(&c->tcp_mutex);
+    pthread_mutex_lock(c->tcp_mutex);
 
     if (ret != 0)
         return -1;
@@ -1780,9 +2954,9 @@ int add_tcp_relay_peer(Net_Crypto *c, int crypt_connection_id, IP_Port ip_port,
     if (conn == 0)
         return -1;
 
-    pthread_mutex_lock(&c->tcp_mutex);
+    pthread_mutex_lock(c->tcp_mutex);
     int ret = add_tcp_relay_connection(c->tcp_c, conn->connection_number_tcp, ip_port, public_key);
-    pthread_mutex_unlock(&c->tcp_mutex);
+    pthread_mutex_unlock(c->tcp_mutex);
     return ret;
 }
 
@@ -1793,9 +2967,9 @@ int add_tcp_relay_peer(Net_Crypto *c, int crypt_connection_id, IP_Port ip_port,
  */
 int add_tcp_relay(Net_Crypto *c, IP_Port ip_port, const uint8_t *public_key)
 {
-    pthread_mutex_lock(&c->tcp_mutex);
+    pthread_mutex_lock(c->tcp_mutex);
     int ret = add_tcp_relay_global(c->tcp_c, ip_port, public_key);
-    pthread_mutex_unlock(&c->tcp_mutex);
+    pthread_mutex_unlock(c->tcp_mutex);
     return ret;
 }
 
@@ -1809,9 +2983,9 @@ int add_tcp_relay(Net_Crypto *c, IP_Port ip_port, const uint8_t *public_key)
  */
 int get_random_tcp_con_number(Net_Crypto *c)
 {
-    pthread_mutex_lock(&c->tcp_mutex);
+    pthread_mutex_lock(c->tcp_mutex);
     int ret = get_random_tcp_onion_conn_number(c->tcp_c);
-    pthread_mutex_unlock(&c->tcp_mutex);
+    pthread_mutex_unlock(c->tcp_mutex);
 
     return ret;
 }
@@ -1823,9 +2997,9 @@ int get_random_tcp_con_number(Net_Crypto *c)
  */
 int send_tcp_onion_request(Net_Crypto *c, unsigned int tcp_connections_number, const uint8_t *data, uint16_t length)
 {
-    pthread_mutex_lock(&c->tcp_mutex);
+    pthread_mutex_lock(c->tcp_mutex);
     int ret = tcp_send_onion_request(c->tcp_c, tcp_connections_number, data, length);
-    pthread_mutex_unlock(&c->tcp_mutex);
+    pthread_mutex_unlock(c->tcp_mutex);
 
     return ret;
 }
@@ -1841,18 +3015,35 @@ unsigned int copy_connected_tcp_relays(Net_Crypto *c, Node_format *tcp_relays, u
     if (num == 0)
         return 0;
 
-    pthread_mutex_lock(&c->tcp_mutex);
+    pthread_mutex_lock(c->tcp_mutex);
     unsigned int ret = tcp_copy_connected_relays(c->tcp_c, tcp_relays, num);
-    pthread_mutex_unlock(&c->tcp_mutex);
+    pthread_mutex_unlock(c->tcp_mutex);
+
+    return ret;
+}
+
+/* Copy a snapshot of a maximum of num of our TCP relay connections to stats.
+ * If stats is NULL, only count them.
+ *
+ * return number of relays copied to stats.
+ */
+unsigned int copy_tcp_relay_stats(Net_Crypto *c, TCP_Relay_Stats *stats, unsigned int num)
+{
+    pthread_mutex_lock(c->tcp_mutex);
+    unsigned int ret = tcp_copy_relay_stats(c->tcp_c, stats, num);
+    pthread_mutex_unlock(c->tcp_mutex);
 
     return ret;
 }
 
 static void do_tcp(Net_Crypto *c)
 {
-    pthread_mutex_lock(&c->tcp_mutex);
-    do_tcp_connections(c->tcp_c);
-    pthread_mutex_unlock(&c->tcp_mutex);
+    /* The host runs the connections it shares */
+    if (!c->host) {
+        pthread_mutex_lock(c->tcp_mutex);
+        do_tcp_connections(c->tcp_c);
+        pthread_mutex_unlock(c->tcp_mutex);
+    }
 
     uint32_t i;
 
@@ -1867,13 +3058,13 @@ static void do_tcp(Net_Crypto *c)
             crypto_connection_status(c, i, &direct_connected, NULL);
 
             if (direct_connected) {
-                pthread_mutex_lock(&c->tcp_mutex);
+                pthread_mutex_lock(c->tcp_mutex);
                 set_tcp_connection_to_status(c->tcp_c, conn->connection_number_tcp, 0);
-                pthread_mutex_unlock(&c->tcp_mutex);
+                pthread_mutex_unlock(c->tcp_mutex);
             } else {
-                pthread_mutex_lock(&c->tcp_mutex);
+                pthread_mutex_lock(c->tcp_mutex);
                 set_tcp_connection_to_status(c->tcp_c, conn->connection_number_tcp, 1);
-                pthread_mutex_unlock(&c->tcp_mutex);
+                pthread_mutex_unlock(c->tcp_mutex);
             }
         }
     }
@@ -2001,10 +3192,19 @@ static int udp_handle_packet(void *object, IP_Port source, const uint8_t *packet
     int crypt_connection_id = crypto_id_ip_port(c, source);
 
     if (crypt_connection_id == -1) {
-        if (packet[0] != NET_PACKET_CRYPTO_HS)
+        if (packet[0] != NET_PACKET_CRYPTO_HS || handle_new_connection_handshake(c, source, packet, length) != 0) {
+            ++c->packets_no_connection;
             return 1;
+        }
+
+        return 0;
+    }
 
-        if (handle_new_connection_handshake(c, source, packet, length) != 0)
+    count_packet_received(c, crypt_connection_id, length, 0);
+
+    if (c->pipeline && packet[0] == NET_PACKET_CRYPTO_DATA) {
+        /* Decrypted and handled later in a batch by handle_pipeline_packets(). */
+        if (queue_pipeline_packet(c, crypt_connection_id, packet, length) != 0)
             return 1;
 
         return 0;
@@ -2019,30 +3219,33 @@ static int udp_handle_packet(void *object, IP_Port source, const uint8_t *packet
         return -1;
 
     pthread_mutex_lock(&conn->mutex);
-    conn->direct_lastrecv_time = unix_time();
+    conn->direct_lastrecv_time = unix_time(c->mono_time);
     pthread_mutex_unlock(&conn->mutex);
     return 0;
 }
 
 /* The dT for the average packet receiving rate calculations.
    Also used as the */
-#define PACKET_COUNTER_AVERAGE_INTERVAL 50
+#define PACKET_COUNTER_AVERAGE_INTERVAL CONGESTION_CONTROL_INTERVAL
 
 /* Ratio of recv queue size / recv packet rate (in seconds) times
  * the number of ms between request packets to send at that ratio
  */
 #define REQUEST_PACKETS_COMPARE_CONSTANT (0.125 * 100.0)
 
+/* Maximum interval in ms between request packets while receiving data, so that
+ * the congestion control of the other side gets timely acks and RTT samples.
+ * Not applied to connections using the default algorithm, which keep the old interval.
+ */
+#define MAX_REQUEST_PACKET_INTERVAL (CONGESTION_CONTROL_INTERVAL / 2)
+
 /* Multiplier for maximum allowed resends. */
 #define PACKET_RESEND_MULTIPLIER 3
 
-/* Timeout for increasing speed after congestion event (in ms). */
-#define CONGESTION_EVENT_TIMEOUT 2000
-
 static void send_crypto_packets(Net_Crypto *c)
 {
     uint32_t i;
-    uint64_t temp_time = current_time_monotonic();
+    uint64_t temp_time = current_time_monotonic(c->mono_time);
     double total_send_rate = 0;
     uint32_t peak_request_packet_interval = ~0;
 
@@ -2064,11 +3267,25 @@ static void send_crypto_packets(Net_Crypto *c)
 
         }
 
+        if (conn->status == CRYPTO_CONN_ESTABLISHED && !conn->capabilities_received
+                && conn->capabilities_sent < MAX_CAPABILITIES_SENT
+                && (CAPABILITIES_SEND_INTERVAL + conn->last_capabilities_sent) < temp_time) {
+            send_capabilities_packet(c, i);
+        }
+
+        if (conn->status == CRYPTO_CONN_ESTABLISHED)
+            send_timed_out_fec_packets(c, i, temp_time);
+
         if (conn->status == CRYPTO_CONN_ESTABLISHED) {
             if (conn->packet_recv_rate > CRYPTO_PACKET_MIN_RATE) {
                 double request_packet_interval = (REQUEST_PACKETS_COMPARE_CONSTANT / (((double)num_packets_array(
                                                       &conn->recv_array) + 1.0) / (conn->packet_recv_rate + 1.0)));
 
+                if (conn->congestion_control.type != CONGESTION_CONTROL_DEFAULT
+                        && request_packet_interval > MAX_REQUEST_PACKET_INTERVAL) {
+                    request_packet_interval = MAX_REQUEST_PACKET_INTERVAL;
+                }
+
                 if (temp_time - conn->last_request_packet_sent > (uint64_t)request_packet_interval) {
                     if (send_request_packet(c, i) == 0) {
                         conn->last_request_packet_sent = temp_time;
@@ -2088,74 +3305,36 @@ static void send_crypto_packets(Net_Crypto *c)
                 conn->packet_counter = 0;
                 conn->packet_counter_set = temp_time;
 
-                uint32_t packets_sent = conn->packets_sent;
-                conn->packets_sent = 0;
-
-                /* conjestion control
-                    calculate a new value of conn->packet_send_rate based on some data
-                 */
-
-                unsigned int pos = conn->last_sendqueue_counter % CONGESTION_QUEUE_ARRAY_SIZE;
-                conn->last_sendqueue_size[pos] = num_packets_array(&conn->send_array);
-                ++conn->last_sendqueue_counter;
-
-                unsigned int j;
-                long signed int sum = 0;
-                sum = (long signed int)conn->last_sendqueue_size[(pos) % CONGESTION_QUEUE_ARRAY_SIZE] -
-                      (long signed int)conn->last_sendqueue_size[(pos - (CONGESTION_QUEUE_ARRAY_SIZE - 1)) % CONGESTION_QUEUE_ARRAY_SIZE];
-
-                conn->last_num_packets_sent[pos] = packets_sent;
-                long signed int total_sent = 0;
-
-                for (j = 0; j < CONGESTION_QUEUE_ARRAY_SIZE; ++j) {
-                    total_sent += conn->last_num_packets_sent[j];
-                }
-
-                total_sent -= sum;
-
-                double min_speed = 1000.0 * (((double)(total_sent)) / ((double)(CONGESTION_QUEUE_ARRAY_SIZE) *
-                                             PACKET_COUNTER_AVERAGE_INTERVAL));
-
-                if (conn->last_congestion_event + CONGESTION_EVENT_TIMEOUT < temp_time) {
-                    conn->packet_send_rate = min_speed * 1.25;
-                } else {
-                    conn->packet_send_rate = min_speed;
-                }
-
-                if (conn->packet_send_rate < CRYPTO_PACKET_MIN_RATE) {
-                    conn->packet_send_rate = CRYPTO_PACKET_MIN_RATE;
-                }
-
+                congestion_control_update(&conn->congestion_control, temp_time, num_packets_array(&conn->send_array));
             }
 
-            if (conn->last_packets_left_set == 0) {
-                conn->last_packets_left_set = temp_time;
-                conn->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
-            } else if (((uint64_t)((1000.0 / conn->packet_send_rate) + 0.5) + conn->last_packets_left_set) < temp_time) {
-                uint32_t num_packets = conn->packet_send_rate * ((double)(temp_time - conn->last_packets_left_set) / 1000.0) + 0.5;
+            congestion_control_pace(&conn->congestion_control, temp_time, &conn->packets_left);
 
-                if (conn->packets_left > num_packets * 4 + CRYPTO_MIN_QUEUE_LENGTH) {
-                    conn->packets_left = num_packets * 4 + CRYPTO_MIN_QUEUE_LENGTH;
-                } else {
-                    conn->packets_left += num_packets;
-                }
+            /* Lossless packets written since the last call are only coalesced until now. */
+            send_coalesced_packet(c, i);
 
-                conn->last_packets_left_set = temp_time;
-            }
+            int ret;
 
-            int ret = send_requested_packets(c, i, conn->packets_left * PACKET_RESEND_MULTIPLIER);
+            if (c->pipeline) {
+                ret = send_requested_packets_pipelined(c, i, conn->packets_left * PACKET_RESEND_MULTIPLIER);
+            } else {
+                ret = send_requested_packets(c, i, conn->packets_left * PACKET_RESEND_MULTIPLIER);
+            }
 
             if (ret != -1) {
                 if ((unsigned int)ret < conn->packets_left) {
                     conn->packets_left -= ret;
                 } else {
-                    conn->last_congestion_event = temp_time;
+                    congestion_control_on_congestion_event(&conn->congestion_control, temp_time);
+                    pthread_mutex_lock(&conn->mutex);
+                    ++conn->counters.congestion_events;
+                    pthread_mutex_unlock(&conn->mutex);
                     conn->packets_left = 0;
                 }
             }
 
-            if (conn->packet_send_rate > CRYPTO_PACKET_MIN_RATE * 1.5) {
-                total_send_rate += conn->packet_send_rate;
+            if (conn->congestion_control.send_rate > CRYPTO_PACKET_MIN_RATE * 1.5) {
+                total_send_rate += conn->congestion_control.send_rate;
             }
         }
     }
@@ -2236,17 +3415,27 @@ int64_t write_cryptpacket(Net_Crypto *c, int crypt_connection_id, const uint8_t
     if (conn->status != CRYPTO_CONN_ESTABLISHED)
         return -1;
 
+    _Bool coalesce = c->coalesce_packets && (conn->peer_capabilities & CRYPTO_CAPABILITY_COALESCED)
+                     && length <= CRYPTO_COALESCE_MAX_LENGTH;
+
+    if (coalesce) {
+        int64_t ret = coalesce_lossless_packet(c, crypt_connection_id, data, length);
+
+        if (ret != -1)
+            return ret;
+    }
+
     if (congestion_control && conn->packets_left == 0)
         return -1;
 
-    int64_t ret = send_lossless_packet(c, crypt_connection_id, data, length, congestion_control);
+    int64_t ret = send_lossless_packet(c, crypt_connection_id, data, length, congestion_control, coalesce);
 
     if (ret == -1)
         return -1;
 
     if (congestion_control) {
         --conn->packets_left;
-        conn->packets_sent++;
+        congestion_control_on_sent(&conn->congestion_control, 1);
     }
 
     return ret;
@@ -2301,11 +3490,284 @@ int send_lossy_cryptpacket(Net_Crypto *c, int crypt_connection_id, const uint8_t
     int ret = -1;
 
     if (conn) {
+        FEC_Buffers *buffers = NULL;
+        uint32_t num_parity = 0;
+
+        pthread_mutex_lock(&conn->fec_mutex);
+        pthread_mutex_lock(&conn->mutex);
+        uint32_t buffer_start = conn->recv_array.buffer_start;
+        uint32_t buffer_end = conn->send_array.buffer_end;
+
+        if (conn->fec && (conn->peer_capabilities & CRYPTO_CAPABILITY_FEC)
+                && fec_packet_protected(conn->fec, data, length)) {
+            int fec_length = fec_wrap_packet(conn->fec, data, length, conn->fec_buffers->packet,
+                                             current_time_monotonic(c->mono_time));
+
+            if (fec_length != -1) {
+                buffers = conn->fec_buffers;
+                data = buffers->packet;
+                length = fec_length;
+                num_parity = fec_parity_packets(conn->fec, buffers->packet[1], 0, buffers->parity_packets,
+                                                buffers->parity_lengths);
+            }
+        }
+
+        pthread_mutex_unlock(&conn->mutex);
+
+        /* The buffers are only needed until the packets in them are sent. */
+        if (buffers == NULL)
+            pthread_mutex_unlock(&conn->fec_mutex);
+
+        ret = send_data_packet_helper(c, crypt_connection_id, buffer_start, buffer_end, data, length);
+
+        if (buffers) {
+            if (num_parity != 0)
+                send_fec_packets(c, crypt_connection_id, buffers->parity_packets, buffers->parity_lengths, num_parity);
+
+            pthread_mutex_unlock(&conn->fec_mutex);
+        }
+    }
+
+    pthread_mutex_lock(&c->connections_mutex);
+    --c->connection_use_counter;
+    pthread_mutex_unlock(&c->connections_mutex);
+
+    return ret;
+}
+
+/* Drop the data packets of crypt_connection_id waiting to be decrypted by the crypto pipeline.
+ */
+static void clear_pipeline_packets(Net_Crypto *c, int crypt_connection_id)
+{
+    if (c->pipeline == NULL)
+        return;
+
+    uint32_t i;
+
+    for (i = 0; i < c->pipeline->recv_queue_length; ++i) {
+        if (c->pipeline->recv_queue[i].crypt_connection_id == crypt_connection_id)
+            c->pipeline->recv_queue[i].crypt_connection_id = -1;
+    }
+}
+
+/* Kill a crypto connection.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int crypto_kill(Net_Crypto *c, int crypt_connection_id)
+{
+    while (1) { /* TODO: is this really the best way to do this? */
+        pthread_mutex_lock(&c->connections_mutex);
+
+        if (!c->connection_use_counter) {
+            break;
+        }
+
+        pthread_mutex_unlock(&c->connections_mutex);
+    }
+
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    int ret = -1;
+
+    if (conn) {
+        if (conn->status == CRYPTO_CONN_ESTABLISHED)
+            send_kill_packet(c, crypt_connection_id);
+
+        pthread_mutex_lock(c->tcp_mutex);
+        kill_tcp_connection_to(c->tcp_c, conn->connection_number_tcp);
+        pthread_mutex_unlock(c->tcp_mutex);
+
+        bs_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_port, crypt_connection_id);
+        clear_pipeline_packets(c, crypt_connection_id);
+        clear_temp_packet(c, crypt_connection_id);
+        clear_buffer(&conn->send_array);
+        clear_buffer(&conn->recv_array);
+        ret = wipe_crypto_connection(c, crypt_connection_id);
+    }
+
+    pthread_mutex_unlock(&c->connections_mutex);
+
+    return ret;
+}
+
+/* return one of CRYPTO_CONN_* values indicating the state of the connection.
+ *
+ * sets direct_connected to 1 if connection connects directly to other, 0 if it isn't.
+ * sets online_tcp_relays to the number of connected tcp relays this connection has.
+ */
+unsigned int crypto_connection_status(const Net_Crypto *c, int crypt_connection_id, _Bool *direct_connected,
+                                      unsigned int *online_tcp_relays)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return CRYPTO_CONN_NO_CONNECTION;
+
+    if (direct_connected) {
+        *direct_connected = 0;
+
+        if ((UDP_DIRECT_TIMEOUT + conn->direct_lastrecv_time) > unix_time(c->mono_time))
+            *direct_connected = 1;
+    }
+
+    if (online_tcp_relays) {
+        *online_tcp_relays = tcp_connection_to_online_tcp_relays(c->tcp_c, conn->connection_number_tcp);
+    }
+
+    return conn->status;
+}
+
+/* Copy the address the connection is directly connected to into ip_port.
+ *
+ * return -1 if the connection isn't directly connected.
+ * return 0 on success.
+ */
+int crypto_connection_direct_ip_port(const Net_Crypto *c, int crypt_connection_id, IP_Port *ip_port)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    if ((UDP_DIRECT_TIMEOUT + conn->direct_lastrecv_time) <= unix_time(c->mono_time))
+        return -1;
+
+    *ip_port = conn->ip_port;
+    return 0;
+}
+
+void new_keys(Net_Crypto *c)
+{
+    crypto_box_keypair(c->self_public_key, c->self_secret_key);
+}
+
+/* Save the public and private keys to the keys array.
+ * Length must be crypto_box_PUBLICKEYBYTES + crypto_box_SECRETKEYBYTES.
+ *
+ * TODO: Save only secret key.
+ */
+void save_keys(const Net_Crypto *c, uint8_t *keys)
+{
+    memcpy(keys, c->self_public_key, crypto_box_PUBLICKEYBYTES);
+    memcpy(keys + crypto_box_PUBLICKEYBYTES, c->self_secret_key, crypto_box_SECRETKEYBYTES);
+}
+
+/* Load the secret key.
+ * Length must be crypto_box_SECRETKEYBYTES.
+ */
+void load_secret_key(Net_Crypto *c, const uint8_t *sk)
+{
+    memcpy(c->self_secret_key, sk, crypto_box_SECRETKEYBYTES);
+    crypto_scalarmult_curve25519_base(c->self_public_key, c->self_secret_key);
+}
+
+/* Set the congestion control algorithm used by new connections.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int set_congestion_control(Net_Crypto *c, CONGESTION_CONTROL_TYPE type)
+{
+    if (congestion_control_name(type) == NULL)
+        return -1;
+
+    c->congestion_control_type = type;
+    return 0;
+}
+
+/* Change the congestion control algorithm of an existing connection.
+ * The connection starts again from the initial send rate of the algorithm.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int crypto_connection_set_congestion_control(Net_Crypto *c, int crypt_connection_id, CONGESTION_CONTROL_TYPE type)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == 0)
+        return -1;
+
+    return congestion_control_init(&conn->congestion_control, type, current_time_monotonic(c->mono_time));
+}
+
+/* Protect the lossy packets starting with packet_id sent on the connection with num_parity
+ * parity packets for every num_data packets.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int crypto_connection_set_fec(Net_Crypto *c, int crypt_connection_id, uint8_t packet_id, uint8_t num_data,
+                              uint8_t num_parity)
+{
+    if (packet_id < PACKET_ID_LOSSY_RANGE_START || packet_id >= (PACKET_ID_LOSSY_RANGE_START + PACKET_ID_LOSSY_RANGE_SIZE))
+        return -1;
+
+    pthread_mutex_lock(&c->connections_mutex);
+    ++c->connection_use_counter;
+    pthread_mutex_unlock(&c->connections_mutex);
+
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    int ret = -1;
+
+    if (conn) {
+        pthread_mutex_lock(&conn->mutex);
+
+        if (num_data != 0)
+            create_fec_session(conn);
+
+        if (conn->fec)
+            ret = fec_set_stream(conn->fec, packet_id, num_data, num_parity);
+        else if (num_data == 0)
+            ret = 0;
+
+        pthread_mutex_unlock(&conn->mutex);
+    }
+
+    pthread_mutex_lock(&c->connections_mutex);
+    --c->connection_use_counter;
+    pthread_mutex_unlock(&c->connections_mutex);
+
+    return ret;
+}
+
+/* Send the parity packets for the lossy packets starting with packet_id sent so far.
+ *
+ * return -1 on failure.
+ * return number of parity packets sent on success.
+ */
+int crypto_connection_fec_flush(Net_Crypto *c, int crypt_connection_id, uint8_t packet_id)
+{
+    pthread_mutex_lock(&c->connections_mutex);
+    ++c->connection_use_counter;
+    pthread_mutex_unlock(&c->connections_mutex);
+
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    int ret = -1;
+
+    if (conn) {
+        uint32_t num = 0;
+
+        pthread_mutex_lock(&conn->fec_mutex);
         pthread_mutex_lock(&conn->mutex);
-        uint32_t buffer_start = conn->recv_array.buffer_start;
-        uint32_t buffer_end = conn->send_array.buffer_end;
+        FEC_Buffers *buffers = conn->fec_buffers;
+
+        if (conn->fec)
+            num = fec_parity_packets(conn->fec, packet_id, 1, buffers->parity_packets, buffers->parity_lengths);
+
         pthread_mutex_unlock(&conn->mutex);
-        ret = send_data_packet_helper(c, crypt_connection_id, buffer_start, buffer_end, data, length);
+
+        ret = num;
+
+        if (num != 0 && send_fec_packets(c, crypt_connection_id, buffers->parity_packets, buffers->parity_lengths,
+                                         num) != 0)
+            ret = -1;
+
+        pthread_mutex_unlock(&conn->fec_mutex);
     }
 
     pthread_mutex_lock(&c->connections_mutex);
@@ -2315,97 +3777,136 @@ int send_lossy_cryptpacket(Net_Crypto *c, int crypt_connection_id, const uint8_t
     return ret;
 }
 
-/* Kill a crypto connection.
- *
- * return -1 on failure.
- * return 0 on success.
+/* Enable or disable coalescing of small lossless packets.
  */
-int crypto_kill(Net_Crypto *c, int crypt_connection_id)
+void set_packet_coalescing(Net_Crypto *c, _Bool enabled)
 {
-    while (1) { /* TODO: is this really the best way to do this? */
-        pthread_mutex_lock(&c->connections_mutex);
-
-        if (!c->connection_use_counter) {
-            break;
-        }
-
-        pthread_mutex_unlock(&c->connections_mutex);
-    }
-
-    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+    c->coalesce_packets = enabled;
+}
 
-    int ret = -1;
+/* Get the number of data packets and bytes of packet overhead that coalescing
+ * lossless packets saved.
+ */
+void packet_coalescing_stats(const Net_Crypto *c, uint64_t *packets_saved, uint64_t *bytes_saved)
+{
+    if (packets_saved)
+        *packets_saved = c->coalesced_packets_saved;
 
-    if (conn) {
-        if (conn->status == CRYPTO_CONN_ESTABLISHED)
-            send_kill_packet(c, crypt_connection_id);
+    if (bytes_saved)
+        *bytes_saved = c->coalesced_bytes_saved;
+}
 
-        pthread_mutex_lock(&c->tcp_mutex);
-        kill_tcp_connection_to(c->tcp_c, conn->connection_number_tcp);
-        pthread_mutex_unlock(&c->tcp_mutex);
+/* Add value, a time in ms, to the histogram of CRYPTO_HISTOGRAM_BUCKETS buckets. */
+void crypto_histogram_add(uint64_t *histogram, uint64_t value)
+{
+    unsigned int bucket = 0;
 
-        bs_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_port, crypt_connection_id);
-        clear_temp_packet(c, crypt_connection_id);
-        clear_buffer(&conn->send_array);
-        clear_buffer(&conn->recv_array);
-        ret = wipe_crypto_connection(c, crypt_connection_id);
+    while (value != 0 && bucket < CRYPTO_HISTOGRAM_BUCKETS - 1) {
+        value >>= 1;
+        ++bucket;
     }
 
-    pthread_mutex_unlock(&c->connections_mutex);
-
-    return ret;
+    ++histogram[bucket];
 }
 
-/* return one of CRYPTO_CONN_* values indicating the state of the connection.
+/* Copy a snapshot of the connection into stats.
  *
- * sets direct_connected to 1 if connection connects directly to other, 0 if it isn't.
- * sets online_tcp_relays to the number of connected tcp relays this connection has.
+ * return -1 on failure.
+ * return 0 on success.
  */
-unsigned int crypto_connection_status(const Net_Crypto *c, int crypt_connection_id, _Bool *direct_connected,
-                                      unsigned int *online_tcp_relays)
+int crypto_connection_stats(const Net_Crypto *c, int crypt_connection_id, Crypto_Connection_Stats *stats)
 {
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
     if (conn == 0)
-        return CRYPTO_CONN_NO_CONNECTION;
+        return -1;
 
-    if (direct_connected) {
-        *direct_connected = 0;
+    memset(stats, 0, sizeof(Crypto_Connection_Stats));
+    stats->status = crypto_connection_status(c, crypt_connection_id, &stats->direct_connected,
+                    &stats->online_tcp_relays);
 
-        if ((UDP_DIRECT_TIMEOUT + conn->direct_lastrecv_time) > unix_time())
-            *direct_connected = 1;
-    }
+    pthread_mutex_lock(&conn->mutex);
+    stats->counters = conn->counters;
 
-    if (online_tcp_relays) {
-        *online_tcp_relays = tcp_connection_to_online_tcp_relays(c->tcp_c, conn->connection_number_tcp);
-    }
+    if (conn->status == CRYPTO_CONN_ESTABLISHED)
+        stats->handshake_time = conn->handshake_time;
 
-    return conn->status;
+    pthread_mutex_unlock(&conn->mutex);
+
+    stats->send_rate = conn->congestion_control.send_rate;
+    stats->recv_rate = conn->packet_recv_rate;
+    stats->rtt = conn->rtt_time;
+    stats->smoothed_rtt = conn->congestion_control.smoothed_rtt;
+    stats->send_queue = num_packets_array(&conn->send_array);
+    stats->recv_queue = num_packets_array(&conn->recv_array);
+    stats->last_congestion_event = conn->congestion_control.last_congestion_event;
+
+    return 0;
 }
 
-void new_keys(Net_Crypto *c)
+/* Copy a snapshot of all the connections into stats. */
+void net_crypto_stats(const Net_Crypto *c, Net_Crypto_Stats *stats)
 {
-    crypto_box_keypair(c->self_public_key, c->self_secret_key);
+    uint32_t i;
+
+    memset(stats, 0, sizeof(Net_Crypto_Stats));
+    stats->totals = c->killed_counters;
+
+    for (i = 0; i < c->crypto_connections_length; ++i) {
+        Crypto_Connection_Stats conn_stats;
+
+        if (crypto_connection_stats(c, i, &conn_stats) != 0)
+            continue;
+
+        add_counters(&stats->totals, &conn_stats.counters);
+        ++stats->connections;
+
+        if (conn_stats.status == CRYPTO_CONN_ESTABLISHED)
+            ++stats->connections_established;
+
+        if (conn_stats.direct_connected)
+            ++stats->connections_direct;
+    }
+
+    stats->packets_no_connection = c->packets_no_connection;
+    memcpy(stats->handshake_histogram, c->handshake_histogram, sizeof(stats->handshake_histogram));
 }
 
-/* Save the public and private keys to the keys array.
- * Length must be crypto_box_PUBLICKEYBYTES + crypto_box_SECRETKEYBYTES.
+/* Set the number of worker threads used to encrypt and decrypt data packets.
+ * If num_threads is 0, packets are encrypted and decrypted on the thread running do_net_crypto().
  *
- * TODO: Save only secret key.
+ * return -1 on failure.
+ * return 0 on success.
  */
-void save_keys(const Net_Crypto *c, uint8_t *keys)
+int set_crypto_pipeline_threads(Net_Crypto *c, uint32_t num_threads)
 {
-    memcpy(keys, c->self_public_key, crypto_box_PUBLICKEYBYTES);
-    memcpy(keys + crypto_box_PUBLICKEYBYTES, c->self_secret_key, crypto_box_SECRETKEYBYTES);
-}
+    if (num_threads > CRYPTO_PIPELINE_MAX_WORKERS)
+        return -1;
 
-/* Load the secret key.
- * Length must be crypto_box_SECRETKEYBYTES.
- */
-void load_secret_key(Net_Crypto *c, const uint8_t *sk)
-{
-    memcpy(c->self_secret_key, sk, crypto_box_SECRETKEYBYTES);
-    crypto_scalarmult_curve25519_base(c->self_public_key, c->self_secret_key);
+    if (c->pipeline) {
+        handle_pipeline_packets(c);
+        kill_crypto_pipeline(c->pipeline->pipeline);
+        free(c->pipeline);
+        c->pipeline = NULL;
+    }
+
+    if (num_threads == 0)
+        return 0;
+
+    Net_Crypto_Pipeline *p = calloc(1, sizeof(Net_Crypto_Pipeline));
+
+    if (p == NULL)
+        return -1;
+
+    p->pipeline = new_crypto_pipeline(num_threads);
+
+    if (p->pipeline == NULL) {
+        free(p);
+        return -1;
+    }
+
+    c->pipeline = p;
+    return 0;
 }
 
 /* Run this to (re)initialize net_crypto.
@@ -2413,17 +3914,17 @@ void load_secret_key(Net_Crypto *c, const uint8_t *sk)
  */
 Net_Crypto *new_net_crypto(DHT *dht, TCP_Proxy_Info *proxy_info)
 {
-    unix_time_update();
-
     if (dht == NULL)
         return NULL;
 
+    unix_time_update(dht->mono_time);
+
     Net_Crypto *temp = calloc(1, sizeof(Net_Crypto));
 
     if (temp == NULL)
         return NULL;
 
-    temp->tcp_c = new_tcp_connections(dht->self_secret_key, proxy_info);
+    temp->tcp_c = new_tcp_connections(dht->mono_time, dht->self_secret_key, proxy_info);
 
     if (temp->tcp_c == NULL) {
         free(temp);
@@ -2433,14 +3934,23 @@ Net_Crypto *new_net_crypto(DHT *dht, TCP_Proxy_Info *proxy_info)
     set_packet_tcp_connection_callback(temp->tcp_c, &tcp_data_callback, temp);
     set_oob_packet_tcp_connection_callback(temp->tcp_c, &tcp_oob_callback, temp);
 
-    if (create_recursive_mutex(&temp->tcp_mutex) != 0 ||
-            pthread_mutex_init(&temp->connections_mutex, NULL) != 0) {
+    if (create_recursive_mutex(&temp->own_tcp_mutex) != 0) {
+        kill_tcp_connections(temp->tcp_c);
+        free(temp);
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&temp->connections_mutex, NULL) != 0) {
+        pthread_mutex_destroy(&temp->own_tcp_mutex);
         kill_tcp_connections(temp->tcp_c);
         free(temp);
         return NULL;
     }
 
+    temp->tcp_mutex = &temp->own_tcp_mutex;
+
     temp->dht = dht;
+    temp->mono_time = dht->mono_time;
 
     new_keys(temp);
     new_symmetric_key(temp->secret_symmetric_key);
@@ -2457,6 +3967,245 @@ Net_Crypto *new_net_crypto(DHT *dht, TCP_Proxy_Info *proxy_info)
     return temp;
 }
 
+/* return the account of host with a connection to source.
+ * return NULL if there is none.
+ */
+static Net_Crypto *host_account_ip_port(Net_Crypto_Host *host, IP_Port source)
+{
+    if (host->last_account < host->num_accounts
+            && crypto_id_ip_port(host->accounts[host->last_account], source) != -1)
+        return host->accounts[host->last_account];
+
+    uint32_t i;
+
+    for (i = 0; i < host->num_accounts; ++i) {
+        if (crypto_id_ip_port(host->accounts[i], source) != -1) {
+            host->last_account = i;
+            return host->accounts[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* return the account of host a handshake packet from a new address is for.
+ * return NULL if there is none.
+ */
+static Net_Crypto *host_account_handshake(Net_Crypto_Host *host, const uint8_t *packet, uint16_t length)
+{
+    if (length != HANDSHAKE_PACKET_LENGTH)
+        return NULL;
+
+    /* The cookie was made by one of the accounts and holds the real public key of the sender */
+    uint8_t cookie_plain[COOKIE_DATA_LENGTH];
+
+    if (open_cookie(host->dht->mono_time, cookie_plain, packet + 1, host->secret_symmetric_key) != 0)
+        return NULL;
+
+    uint32_t i;
+
+    for (i = 0; i < host->num_accounts; ++i) {
+        if (getcryptconnection_id(host->accounts[i], cookie_plain) != -1)
+            return host->accounts[i];
+    }
+
+    if (host->find_account)
+        return host->find_account(host->find_account_object, cookie_plain);
+
+    return NULL;
+}
+
+/* Cookie requests can be answered by any account as they share the cookie key. */
+static int host_handle_cookie_request(void *object, IP_Port source, const uint8_t *packet, uint16_t length)
+{
+    Net_Crypto_Host *host = object;
+
+    if (host->num_accounts == 0)
+        return 1;
+
+    return udp_handle_cookie_request(host->accounts[0], source, packet, length);
+}
+
+static int host_handle_packet(void *object, IP_Port source, const uint8_t *packet, uint16_t length)
+{
+    Net_Crypto_Host *host = object;
+
+    if (length <= CRYPTO_MIN_PACKET_SIZE || length > MAX_CRYPTO_PACKET_SIZE)
+        return 1;
+
+    Net_Crypto *c = host_account_ip_port(host, source);
+
+    if (c)
+        return udp_handle_packet(c, source, packet, length);
+
+    if (packet[0] != NET_PACKET_CRYPTO_HS)
+        return 1;
+
+    c = host_account_handshake(host, packet, length);
+
+    if (c == NULL || handle_new_connection_handshake(c, source, packet, length) != 0)
+        return 1;
+
+    return 0;
+}
+
+/* Data packets on the TCP connections of the accounts go to them directly, see new_crypto_tcp_connection(). */
+static int host_tcp_oob_callback(void *object, const uint8_t *public_key, unsigned int tcp_connections_number,
+                                 const uint8_t *data, uint16_t length)
+{
+    Net_Crypto_Host *host = object;
+
+    if (length == 0 || length > MAX_CRYPTO_PACKET_SIZE)
+        return -1;
+
+    Net_Crypto *c = NULL;
+
+    if (data[0] == NET_PACKET_COOKIE_REQUEST) {
+        if (host->num_accounts != 0)
+            c = host->accounts[0];
+    } else if (data[0] == NET_PACKET_CRYPTO_HS) {
+        c = host_account_handshake(host, data, length);
+    }
+
+    if (c == NULL)
+        return -1;
+
+    return tcp_oob_callback(c, public_key, tcp_connections_number, data, length);
+}
+
+Net_Crypto_Host *new_net_crypto_host(DHT *dht, TCP_Proxy_Info *proxy_info)
+{
+    if (dht == NULL)
+        return NULL;
+
+    unix_time_update(dht->mono_time);
+
+    Net_Crypto_Host *host = calloc(1, sizeof(Net_Crypto_Host));
+
+    if (host == NULL)
+        return NULL;
+
+    host->tcp_c = new_tcp_connections(dht->mono_time, dht->self_secret_key, proxy_info);
+
+    if (host->tcp_c == NULL) {
+        free(host);
+        return NULL;
+    }
+
+    if (create_recursive_mutex(&host->tcp_mutex) != 0) {
+        kill_tcp_connections(host->tcp_c);
+        free(host);
+        return NULL;
+    }
+
+    host->dht = dht;
+    new_symmetric_key(host->secret_symmetric_key);
+
+    set_oob_packet_tcp_connection_callback(host->tcp_c, &host_tcp_oob_callback, host);
+    set_packet_tcp_connection_callback(host->tcp_c, &tcp_data_callback, NULL);
+
+    networking_registerhandler(dht->net, NET_PACKET_COOKIE_REQUEST, &host_handle_cookie_request, host);
+    networking_registerhandler(dht->net, NET_PACKET_COOKIE_RESPONSE, &host_handle_packet, host);
+    networking_registerhandler(dht->net, NET_PACKET_CRYPTO_HS, &host_handle_packet, host);
+    networking_registerhandler(dht->net, NET_PACKET_CRYPTO_DATA, &host_handle_packet, host);
+
+    return host;
+}
+
+void net_crypto_host_account_handler(Net_Crypto_Host *host, Net_Crypto *(*function)(void *object,
+                                     const uint8_t *real_public_key), void *object)
+{
+    host->find_account = function;
+    host->find_account_object = object;
+}
+
+Net_Crypto *new_net_crypto_hosted(Net_Crypto_Host *host)
+{
+    if (host == NULL)
+        return NULL;
+
+    unix_time_update(host->dht->mono_time);
+
+    Net_Crypto **accounts = realloc(host->accounts, (host->num_accounts + 1) * sizeof(Net_Crypto *));
+
+    if (accounts == NULL)
+        return NULL;
+
+    host->accounts = accounts;
+
+    Net_Crypto *temp = calloc(1, sizeof(Net_Crypto));
+
+    if (temp == NULL)
+        return NULL;
+
+    if (pthread_mutex_init(&temp->connections_mutex, NULL) != 0) {
+        free(temp);
+        return NULL;
+    }
+
+    temp->host = host;
+    temp->dht = host->dht;
+    temp->mono_time = host->dht->mono_time;
+    temp->tcp_c = host->tcp_c;
+    temp->tcp_mutex = &host->tcp_mutex;
+
+    new_keys(temp);
+    memcpy(temp->secret_symmetric_key, host->secret_symmetric_key, crypto_box_KEYBYTES);
+
+    temp->current_sleep_time = CRYPTO_SEND_PACKET_INTERVAL;
+
+    bs_list_init(&temp->ip_port_list, sizeof(IP_Port), 8);
+
+    host->accounts[host->num_accounts] = temp;
+    ++host->num_accounts;
+    return temp;
+}
+
+static void host_remove_account(Net_Crypto_Host *host, const Net_Crypto *c)
+{
+    uint32_t i;
+
+    for (i = 0; i < host->num_accounts; ++i) {
+        if (host->accounts[i] == c) {
+            --host->num_accounts;
+            host->accounts[i] = host->accounts[host->num_accounts];
+            host->last_account = 0;
+            return;
+        }
+    }
+}
+
+int add_tcp_relay_host(Net_Crypto_Host *host, IP_Port ip_port, const uint8_t *public_key)
+{
+    pthread_mutex_lock(&host->tcp_mutex);
+    int ret = add_tcp_relay_global(host->tcp_c, ip_port, public_key);
+    pthread_mutex_unlock(&host->tcp_mutex);
+    return ret;
+}
+
+void do_net_crypto_host(Net_Crypto_Host *host)
+{
+    pthread_mutex_lock(&host->tcp_mutex);
+    do_tcp_connections(host->tcp_c);
+    pthread_mutex_unlock(&host->tcp_mutex);
+}
+
+void kill_net_crypto_host(Net_Crypto_Host *host)
+{
+    if (host == NULL)
+        return;
+
+    networking_registerhandler(host->dht->net, NET_PACKET_COOKIE_REQUEST, NULL, NULL);
+    networking_registerhandler(host->dht->net, NET_PACKET_COOKIE_RESPONSE, NULL, NULL);
+    networking_registerhandler(host->dht->net, NET_PACKET_CRYPTO_HS, NULL, NULL);
+    networking_registerhandler(host->dht->net, NET_PACKET_CRYPTO_DATA, NULL, NULL);
+
+    kill_tcp_connections(host->tcp_c);
+    pthread_mutex_destroy(&host->tcp_mutex);
+    free(host->accounts);
+    free(host);
+}
+
 static void kill_timedout(Net_Crypto *c)
 {
     uint32_t i;
@@ -2496,7 +4245,8 @@ uint32_t crypto_run_interval(const Net_Crypto *c)
 /* Main loop. */
 void do_net_crypto(Net_Crypto *c)
 {
-    unix_time_update();
+    unix_time_update(c->mono_time);
+    handle_pipeline_packets(c);
     kill_timedout(c);
     do_tcp(c);
     send_crypto_packets(c);
@@ -2510,15 +4260,21 @@ void kill_net_crypto(Net_Crypto *c)
         crypto_kill(c, i);
     }
 
-    pthread_mutex_destroy(&c->tcp_mutex);
+    set_crypto_pipeline_threads(c, 0);
     pthread_mutex_destroy(&c->connections_mutex);
-
-    kill_tcp_connections(c->tcp_c);
     bs_list_free(&c->ip_port_list);
-    networking_registerhandler(c->dht->net, NET_PACKET_COOKIE_REQUEST, NULL, NULL);
-    networking_registerhandler(c->dht->net, NET_PACKET_COOKIE_RESPONSE, NULL, NULL);
-    networking_registerhandler(c->dht->net, NET_PACKET_CRYPTO_HS, NULL, NULL);
-    networking_registerhandler(c->dht->net, NET_PACKET_CRYPTO_DATA, NULL, NULL);
+
+    if (c->host) {
+        host_remove_account(c->host, c);
+    } else {
+        pthread_mutex_destroy(c->tcp_mutex);
+        kill_tcp_connections(c->tcp_c);
+        networking_registerhandler(c->dht->net, NET_PACKET_COOKIE_REQUEST, NULL, NULL);
+        networking_registerhandler(c->dht->net, NET_PACKET_COOKIE_RESPONSE, NULL, NULL);
+        networking_registerhandler(c->dht->net, NET_PACKET_CRYPTO_HS, NULL, NULL);
+        networking_registerhandler(c->dht->net, NET_PACKET_CRYPTO_DATA, NULL, NULL);
+    }
+
     memset(c, 0, sizeof(Net_Crypto));
     free(c);
 }
@@ -27,6 +27,9 @@
 #include "DHT.h"
 #include "LAN_discovery.h"
 #include "TCP_connection.h"
+#include "crypto_pipeline.h"
+#include "congestion_control.h"
+#include "fec.h"
 #include <pthread.h>
 
 #define CRYPTO_CONN_NO_CONNECTION 0
@@ -39,10 +42,10 @@
 #define CRYPTO_PACKET_BUFFER_SIZE 16384 /* Must be a power of 2 */
 
 /* Minimum packet rate per second. */
-#define CRYPTO_PACKET_MIN_RATE 8.0
+#define CRYPTO_PACKET_MIN_RATE CONGESTION_MIN_SEND_RATE
 
 /* Minimum packet queue max length. */
-#define CRYPTO_MIN_QUEUE_LENGTH 64
+#define CRYPTO_MIN_QUEUE_LENGTH CONGESTION_MIN_QUEUE_LENGTH
 
 /* Maximum total size of packets that net_crypto sends. */
 #define MAX_CRYPTO_PACKET_SIZE 1400
@@ -65,6 +68,16 @@
 #define PACKET_ID_PADDING 3 /* Denotes padding */
 #define PACKET_ID_REQUEST 4 /* Used to request unreceived packets */
 #define PACKET_ID_KILL    5 /* Used to kill connection */
+#define PACKET_ID_SACK    6 /* Used to request unreceived packets with ranges and bitmaps */
+#define PACKET_ID_CAPABILITIES 7 /* Used to tell the other side which optional packets we handle */
+#define PACKET_ID_COALESCED 8 /* Contains multiple lossless packets */
+#define PACKET_ID_FEC 9 /* Contains a lossy packet or parity data to recover lost ones */
+
+/* Capability flags sent in PACKET_ID_CAPABILITIES packets. */
+#define CRYPTO_CAPABILITY_SACK      (1 << 0) /* PACKET_ID_SACK packets are handled. */
+#define CRYPTO_CAPABILITY_COALESCED (1 << 1) /* PACKET_ID_COALESCED packets are handled. */
+#define CRYPTO_CAPABILITY_FEC       (1 << 2) /* PACKET_ID_FEC packets are handled. */
+#define CRYPTO_CAPABILITIES (CRYPTO_CAPABILITY_SACK | CRYPTO_CAPABILITY_COALESCED | CRYPTO_CAPABILITY_FEC)
 
 /* Packet ids 0 to CRYPTO_RESERVED_PACKETS - 1 are reserved for use by net_crypto. */
 #define CRYPTO_RESERVED_PACKETS 16
@@ -78,16 +91,41 @@
 
 #define CRYPTO_MAX_PADDING 8 /* All packets will be padded a number of bytes based on this number. */
 
-/* Base current transfer speed on last CONGESTION_QUEUE_ARRAY_SIZE number of points taken
-   at the dT defined in net_crypto.c */
-#define CONGESTION_QUEUE_ARRAY_SIZE 24
-
 /* Default connection ping in ms. */
 #define DEFAULT_PING_CONNECTION 200
 
+/* Reasons received packets of a connection are dropped for, counted in Crypto_Connection_Counters. */
+enum {
+    CRYPTO_DROP_DECRYPT, /* could not be decrypted */
+    CRYPTO_DROP_WINDOW, /* outside of the receive window or already received */
+    CRYPTO_DROP_STATE, /* not expected in the state the connection is in */
+    CRYPTO_DROP_INVALID /* decrypted but malformed */
+};
+
+#define CRYPTO_DROP_REASONS 4
+
+/* Buckets of the histograms of times in ms: bucket 0 counts times below 1 ms, bucket i times
+ * from 2^(i - 1) to 2^i ms and the last bucket all the longer ones.
+ */
+#define CRYPTO_HISTOGRAM_BUCKETS 16
+
+typedef struct {
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    uint64_t packets_sent_tcp; /* Of packets_sent, the ones that only went through TCP relays. */
+    uint64_t packets_received;
+    uint64_t bytes_received;
+    uint64_t packets_received_tcp;
+    uint64_t retransmits; /* Data packets sent again because the other side requested them. */
+    uint64_t congestion_events; /* Times the connection used up all the packets it was allowed to send. */
+    uint64_t drops[CRYPTO_DROP_REASONS];
+    uint64_t rtt_histogram[CRYPTO_HISTOGRAM_BUCKETS];
+} Crypto_Connection_Counters;
+
 typedef struct {
     uint64_t sent_time;
     uint16_t length;
+    _Bool requested; /* The other side requested this packet again, RTT samples from it are ambiguous. */
     uint8_t data[MAX_CRYPTO_DATA_SIZE];
 } Packet_Data;
 
@@ -97,6 +135,17 @@ typedef struct {
     uint32_t  buffer_end; /* packet numbers in array: {buffer_start, buffer_end) */
 } Packets_Array;
 
+/* Work buffers of the FEC session of a connection, allocated with it so the packets it creates don't have
+ * to be put on the stack.
+ */
+typedef struct {
+    uint8_t packet[FEC_MAX_PACKET_SIZE]; /* A lossy packet wrapped by fec_wrap_packet(). */
+    uint8_t parity_packets[FEC_MAX_PARITY_PACKETS][FEC_MAX_PACKET_SIZE];
+    uint16_t parity_lengths[FEC_MAX_PARITY_PACKETS];
+    uint8_t recv_packets[FEC_MAX_PARITY_PACKETS + 1][FEC_MAX_PACKET_SIZE];
+    uint16_t recv_lengths[FEC_MAX_PARITY_PACKETS + 1];
+} FEC_Buffers;
+
 typedef struct {
     uint8_t public_key[crypto_box_PUBLICKEYBYTES]; /* The real public key of the peer. */
     uint8_t recv_nonce[crypto_box_NONCEBYTES]; /* Nonce of received packets. */
@@ -138,18 +187,25 @@ typedef struct {
 
     uint64_t last_request_packet_sent;
 
+    uint32_t peer_capabilities; /* CRYPTO_CAPABILITY_* flags of the other side. */
+    _Bool capabilities_received; /* peer_capabilities was set from a PACKET_ID_CAPABILITIES packet. */
+    uint8_t capabilities_sent; /* Number of PACKET_ID_CAPABILITIES packets sent. */
+    uint64_t last_capabilities_sent;
+
+    _Bool coalesce_open; /* The last packet in send_array wasn't sent yet and more lossless packets can be added to it. */
+
+    FEC_Session *fec; /* Created when FEC is first enabled or a PACKET_ID_FEC packet is received, protected by mutex. */
+    /* Created with fec. packet and the parity packets are only used with fec_mutex held, the received
+     * packets only by the thread handling the packets received by the connection.
+     */
+    FEC_Buffers *fec_buffers;
+
     uint32_t packet_counter;
     double packet_recv_rate;
     uint64_t packet_counter_set;
 
-    double packet_send_rate;
+    Congestion_Control congestion_control;
     uint32_t packets_left;
-    uint64_t last_packets_left_set;
-
-    uint32_t last_sendqueue_size[CONGESTION_QUEUE_ARRAY_SIZE], last_sendqueue_counter;
-    long signed int last_num_packets_sent[CONGESTION_QUEUE_ARRAY_SIZE];
-    uint32_t packets_sent;
-    uint64_t last_congestion_event;
     uint64_t rtt_time;
 
     /* TCP_connection connection_number */
@@ -157,7 +213,15 @@ typedef struct {
 
     uint8_t maximum_speed_reached;
 
+    /* Only written and read with mutex held, as send_packet_to() can be called from any thread
+     * and the stats can be read from any thread too.
+     */
+    Crypto_Connection_Counters counters;
+    uint64_t created_time; /* ms */
+    uint64_t handshake_time; /* ms from creating the connection until it was established. */
+
     pthread_mutex_t mutex;
+    pthread_mutex_t fec_mutex; /* Always locked before mutex, never while holding it. */
 
     void (*dht_pk_callback)(void *data, int32_t number, const uint8_t *dht_public_key);
     void *dht_pk_callback_object;
@@ -174,12 +238,40 @@ typedef struct {
     uint8_t cookie_length;
 } New_Connection;
 
+/* Maximum number of data packets encrypted or decrypted in one crypto pipeline batch. */
+#define CRYPTO_PIPELINE_BATCH_SIZE 256
+
+typedef struct {
+    int crypt_connection_id;
+    uint16_t length;
+    uint8_t data[MAX_CRYPTO_PACKET_SIZE];
+} Pipeline_Packet;
+
+typedef struct {
+    Crypto_Pipeline *pipeline;
+
+    Crypto_Job jobs[CRYPTO_PIPELINE_BATCH_SIZE];
+    uint8_t plain[CRYPTO_PIPELINE_BATCH_SIZE][MAX_CRYPTO_PACKET_SIZE];
+    uint8_t packets[CRYPTO_PIPELINE_BATCH_SIZE][MAX_CRYPTO_PACKET_SIZE];
+
+    /* Received data packets waiting to be decrypted. */
+    Pipeline_Packet recv_queue[CRYPTO_PIPELINE_BATCH_SIZE];
+    uint32_t recv_queue_length;
+} Net_Crypto_Pipeline;
+
+typedef struct Net_Crypto_Host Net_Crypto_Host;
+
 typedef struct {
     DHT *dht;
+    Mono_Time *mono_time; /* the one of dht */
     TCP_Connections *tcp_c;
 
+    /* Set if the instance is one of the accounts of a host, which owns tcp_c and its mutex. */
+    Net_Crypto_Host *host;
+
     Crypto_Connection *crypto_connections;
-    pthread_mutex_t tcp_mutex;
+    pthread_mutex_t *tcp_mutex;
+    pthread_mutex_t own_tcp_mutex;
 
     pthread_mutex_t connections_mutex;
     unsigned int connection_use_counter;
@@ -200,8 +292,74 @@ typedef struct {
     uint32_t current_sleep_time;
 
     BS_LIST ip_port_list;
+
+    /* NULL if data packets are encrypted and decrypted on the thread running do_net_crypto(). */
+    Net_Crypto_Pipeline *pipeline;
+
+    /* Congestion control algorithm used by new connections. */
+    CONGESTION_CONTROL_TYPE congestion_control_type;
+
+    /* Coalesce small lossless packets written in the same do_net_crypto() interval. */
+    _Bool coalesce_packets;
+    uint64_t coalesced_packets_saved;
+    uint64_t coalesced_bytes_saved;
+
+    /* Counters of the connections that were killed, so that the totals don't go backwards. */
+    Crypto_Connection_Counters killed_counters;
+    uint64_t handshake_histogram[CRYPTO_HISTOGRAM_BUCKETS];
+    uint64_t packets_no_connection; /* Packets that weren't for any connection or handshake. */
 } Net_Crypto;
 
+/* A snapshot of a connection for monitoring it. */
+typedef struct {
+    Crypto_Connection_Counters counters;
+    uint8_t status; /* One of CRYPTO_CONN_* */
+    _Bool direct_connected;
+    unsigned int online_tcp_relays;
+    double send_rate; /* Packets per second we are allowed to send. */
+    double recv_rate; /* Packets per second we receive. */
+    uint64_t rtt; /* ms, lowest seen, see rtt_time. */
+    uint64_t smoothed_rtt; /* ms */
+    uint32_t send_queue; /* Packets sent but not yet acknowledged. */
+    uint32_t recv_queue; /* Packets received out of order, waiting for the ones before them. */
+    uint64_t last_congestion_event; /* current_time_monotonic() of the last one, 0 if there wasn't any. */
+    uint64_t handshake_time; /* Only set if the connection is established. */
+} Crypto_Connection_Stats;
+
+/* A snapshot of all the connections of a Net_Crypto. */
+typedef struct {
+    Crypto_Connection_Counters totals; /* Of all connections, including the ones that were killed. */
+    uint32_t connections;
+    uint32_t connections_established;
+    uint32_t connections_direct;
+    uint64_t packets_no_connection;
+    uint64_t handshake_histogram[CRYPTO_HISTOGRAM_BUCKETS];
+} Net_Crypto_Stats;
+
+/* The parts of net_crypto shared by the accounts of a host: the socket handlers, the TCP relay
+ * connections and the key cookies are made with.
+ *
+ * Packets from an address one of the accounts has a connection with go to that account. A
+ * handshake from elsewhere goes to the account that already has a connection to its sender, or
+ * else to the one the account callback finds. The accounts can't have connections to the same
+ * peer: the peer would see one DHT key for all of them.
+ */
+struct Net_Crypto_Host {
+    DHT *dht;
+    TCP_Connections *tcp_c;
+    pthread_mutex_t tcp_mutex;
+
+    /* The secret key used for cookies, the same for all accounts. */
+    uint8_t secret_symmetric_key[crypto_box_KEYBYTES];
+
+    Net_Crypto **accounts;
+    uint32_t num_accounts;
+    uint32_t last_account; /* the account the last packet went to, tried first. */
+
+    Net_Crypto *(*find_account)(void *object, const uint8_t *real_public_key);
+    void *find_account_object;
+};
+
 
 /* Set function to be called when someone requests a new connection to us.
  *
@@ -360,6 +518,13 @@ int send_tcp_onion_request(Net_Crypto *c, unsigned int TCP_conn_number, const ui
  */
 unsigned int copy_connected_tcp_relays(Net_Crypto *c, Node_format *tcp_relays, uint16_t num);
 
+/* Copy a snapshot of a maximum of num of our TCP relay connections to stats.
+ * If stats is NULL, only count them.
+ *
+ * return number of relays copied to stats.
+ */
+unsigned int copy_tcp_relay_stats(Net_Crypto *c, TCP_Relay_Stats *stats, unsigned int num);
+
 /* Kill a crypto connection.
  *
  * return -1 on failure.
@@ -375,6 +540,13 @@ int crypto_kill(Net_Crypto *c, int crypt_connection_id);
 unsigned int crypto_connection_status(const Net_Crypto *c, int crypt_connection_id, _Bool *direct_connected,
                                       unsigned int *online_tcp_relays);
 
+/* Copy the address the connection is directly connected to into ip_port.
+ *
+ * return -1 if the connection isn't directly connected.
+ * return 0 on success.
+ */
+int crypto_connection_direct_ip_port(const Net_Crypto *c, int crypt_connection_id, IP_Port *ip_port);
+
 /* Generate our public and private keys.
  *  Only call this function the first time the program starts.
  */
@@ -390,11 +562,114 @@ void save_keys(const Net_Crypto *c, uint8_t *keys);
  */
 void load_secret_key(Net_Crypto *c, const uint8_t *sk);
 
+/* Set the number of worker threads used to encrypt and decrypt data packets.
+ * If num_threads is 0, packets are encrypted and decrypted on the thread running do_net_crypto().
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int set_crypto_pipeline_threads(Net_Crypto *c, uint32_t num_threads);
+
+/* Set the congestion control algorithm used by new connections.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int set_congestion_control(Net_Crypto *c, CONGESTION_CONTROL_TYPE type);
+
+/* Change the congestion control algorithm of an existing connection.
+ * The connection starts again from the initial send rate of the algorithm.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int crypto_connection_set_congestion_control(Net_Crypto *c, int crypt_connection_id, CONGESTION_CONTROL_TYPE type);
+
+/* Enable or disable coalescing of small lossless packets.
+ *
+ * When enabled, lossless packets written to connections to peers that support it are
+ * held until the end of the current do_net_crypto() interval and packed together
+ * into as few data packets as possible.
+ */
+void set_packet_coalescing(Net_Crypto *c, _Bool enabled);
+
+/* Get the number of data packets and bytes of packet overhead that coalescing
+ * lossless packets saved.
+ */
+void packet_coalescing_stats(const Net_Crypto *c, uint64_t *packets_saved, uint64_t *bytes_saved);
+
+/* Add value, a time in ms, to the histogram of CRYPTO_HISTOGRAM_BUCKETS buckets. */
+void crypto_histogram_add(uint64_t *histogram, uint64_t value);
+
+/* Copy a snapshot of the connection into stats.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int crypto_connection_stats(const Net_Crypto *c, int crypt_connection_id, Crypto_Connection_Stats *stats);
+
+/* Copy a snapshot of all the connections into stats. */
+void net_crypto_stats(const Net_Crypto *c, Net_Crypto_Stats *stats);
+
+/* Protect the lossy packets starting with packet_id sent on the connection with num_parity
+ * parity packets for every num_data packets (FEC_MAX_DATA_PACKETS and FEC_MAX_PARITY_PACKETS
+ * at most), so that up to num_parity of them can be lost without the other side missing any.
+ * num_parity 1 uses XOR parity, more use a Reed-Solomon code.
+ *
+ * num_data 0 stops protecting them. Packets are only protected if the other side supports it.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int crypto_connection_set_fec(Net_Crypto *c, int crypt_connection_id, uint8_t packet_id, uint8_t num_data,
+                              uint8_t num_parity);
+
+/* Send the parity packets for the lossy packets starting with packet_id sent so far instead of
+ * waiting for num_data of them, for example at the end of a video frame.
+ *
+ * Incomplete groups are also flushed automatically after a short timeout.
+ *
+ * return -1 on failure.
+ * return number of parity packets sent on success.
+ */
+int crypto_connection_fec_flush(Net_Crypto *c, int crypt_connection_id, uint8_t packet_id);
+
 /* Create new instance of Net_Crypto.
  *  Sets all the global connection variables to their default values.
  */
 Net_Crypto *new_net_crypto(DHT *dht, TCP_Proxy_Info *proxy_info);
 
+/* Create the shared part of net_crypto for accounts that share dht and its socket.
+ *
+ * return NULL on failure.
+ */
+Net_Crypto_Host *new_net_crypto_host(DHT *dht, TCP_Proxy_Info *proxy_info);
+
+/* Set the function that returns the account that takes new connections from real_public_key,
+ * NULL if none does.
+ */
+void net_crypto_host_account_handler(Net_Crypto_Host *host, Net_Crypto *(*function)(void *object,
+                                     const uint8_t *real_public_key), void *object);
+
+/* Create a new account of host with keys of its own.
+ * It is killed with kill_net_crypto(), which must be done before killing the host.
+ *
+ * return NULL on failure.
+ */
+Net_Crypto *new_net_crypto_hosted(Net_Crypto_Host *host);
+
+/* Add a tcp relay to the relays the accounts of host share.
+ *
+ * return 0 if it was added.
+ * return -1 if it wasn't.
+ */
+int add_tcp_relay_host(Net_Crypto_Host *host, IP_Port ip_port, const uint8_t *public_key);
+
+/* Main loop of the shared part, do_net_crypto() must still be run for every account. */
+void do_net_crypto_host(Net_Crypto_Host *host);
+
+void kill_net_crypto_host(Net_Crypto_Host *host);
+
 /* return the optimal interval in ms for running do_net_crypto.
  */
 uint32_t crypto_run_interval(const Net_Crypto *c);
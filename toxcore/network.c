@@ -224,25 +224,63 @@ static uint64_t current_time_actual(void)
 }
 
 
+Mono_Time *new_mono_time(const Net_Clock *clock)
+{
+    Mono_Time *mono_time = calloc(1, sizeof(Mono_Time));
+
+    if (mono_time == NULL)
+        return NULL;
+
+#if defined(_WIN32) || defined(__WIN32__) || defined (WIN32)
+
+    if (pthread_mutex_init(&mono_time->lock, NULL) != 0) {
+        free(mono_time);
+        return NULL;
+    }
+
+#endif
+
+    /* A clock of our own already gives the unix time */
+    if (clock && clock->function)
+        mono_time->clock = *clock;
+    else
+        mono_time->unix_base_time_value = (uint64_t)time(NULL) - (current_time_monotonic(mono_time) / 1000ULL);
+
+    unix_time_update(mono_time);
+    return mono_time;
+}
+
+void kill_mono_time(Mono_Time *mono_time)
+{
+    if (mono_time == NULL)
+        return;
+
 #if defined(_WIN32) || defined(__WIN32__) || defined (WIN32)
-static uint64_t last_monotime;
-static uint64_t add_monotime;
+    pthread_mutex_destroy(&mono_time->lock);
 #endif
+    free(mono_time);
+}
 
 /* return current monotonic time in milliseconds (ms). */
-uint64_t current_time_monotonic(void)
+uint64_t current_time_monotonic(Mono_Time *mono_time)
 {
+    if (mono_time->clock.function)
+        return mono_time->clock.function(mono_time->clock.object);
+
     uint64_t time;
 #if defined(_WIN32) || defined(__WIN32__) || defined (WIN32)
-    time = (uint64_t)GetTickCount() + add_monotime;
+    /* The threads of the instance read the clock too */
+    pthread_mutex_lock(&mono_time->lock);
+    time = (uint64_t)GetTickCount() + mono_time->add_monotime;
 
-    if (time < last_monotime) { /* Prevent time from ever decreasing because of 32 bit wrap. */
+    if (time < mono_time->last_monotime) { /* Prevent time from ever decreasing because of 32 bit wrap. */
         uint32_t add = ~0;
-        add_monotime += add;
+        mono_time->add_monotime += add;
         time += add;
     }
 
-    last_monotime = time;
+    mono_time->last_monotime = time;
+    pthread_mutex_unlock(&mono_time->lock);
 #else
     struct timespec monotime;
 #if defined(__linux__) && defined(CLOCK_MONOTONIC_RAW)
@@ -289,6 +327,20 @@ uint64_t current_time_monotonic(void)
 
 #endif /* LOGGING */
 
+/* sendpacket() is called from several threads, so the counters are updated atomically. Relaxed
+ * ordering is enough as they are only ever read as statistics.
+ */
+static void count_sent(Networking_Core *net, int res)
+{
+    if (res < 0) {
+        __atomic_fetch_add(&net->stats.send_failures, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_fetch_add(&net->stats.packets_sent, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&net->stats.bytes_sent, res, __ATOMIC_RELAXED);
+}
+
 /* Basic network functions:
  * Function to send packet(data) of length length to ip_port.
  */
@@ -301,6 +353,13 @@ int sendpacket(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint1
     if ((net->family == AF_INET) && (ip_port.ip.family != AF_INET))
         return -1;
 
+    if (net->transport.send) {
+        int res = net->transport.send(net->transport.object, ip_port, data, length);
+        loglogdata("O=>", data, length, ip_port, res);
+        count_sent(net, res);
+        return res;
+    }
+
     struct sockaddr_storage addr;
     size_t addrsize = 0;
 
@@ -351,6 +410,7 @@ int sendpacket(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint1
     int res = sendto(net->sock, (char *) data, length, 0, (struct sockaddr *)&addr, addrsize);
 
     loglogdata("O=>", data, length, ip_port, res);
+    count_sent(net, res);
 
     return res;
 }
@@ -412,27 +472,51 @@ void networking_registerhandler(Networking_Core *net, uint8_t byte, packet_handl
     net->packethandlers[byte].object = object;
 }
 
+void networking_handle_packet(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint16_t length)
+{
+    if (length < 1)
+        return;
+
+    ++net->stats.packets_received;
+    net->stats.bytes_received += length;
+
+    if (!(net->packethandlers[data[0]].function)) {
+        LOGGER_WARNING("[%02u] -- Packet has no handler", data[0]);
+        ++net->stats.packets_unhandled;
+        return;
+    }
+
+    net->packethandlers[data[0]].function(net->packethandlers[data[0]].object, ip_port, data, length);
+}
+
+/* Copy the counters of net into stats. */
+void networking_get_stats(const Networking_Core *net, Networking_Stats *stats)
+{
+    stats->packets_sent = __atomic_load_n(&net->stats.packets_sent, __ATOMIC_RELAXED);
+    stats->bytes_sent = __atomic_load_n(&net->stats.bytes_sent, __ATOMIC_RELAXED);
+    stats->send_failures = __atomic_load_n(&net->stats.send_failures, __ATOMIC_RELAXED);
+    stats->packets_received = net->stats.packets_received;
+    stats->bytes_received = net->stats.bytes_received;
+    stats->packets_unhandled = net->stats.packets_unhandled;
+}
+
 void networking_poll(Networking_Core *net)
 {
     if (net->family == 0) /* Socket not initialized */
         return;
 
-    unix_time_update();
+    unix_time_update(net->mono_time);
+
+    /* The transport hands us our packets itself */
+    if (net->transport.send)
+        return;
 
     IP_Port ip_port;
     uint8_t data[MAX_UDP_PACKET_SIZE];
     uint32_t length;
 
-    while (receivepacket(net->sock, &ip_port, data, &length) != -1) {
-        if (length < 1) continue;
-
-        if (!(net->packethandlers[data[0]].function)) {
-            LOGGER_WARNING("[%02u] -- Packet has no handler", data[0]);
-            continue;
-        }
-
-        net->packethandlers[data[0]].function(net->packethandlers[data[0]].object, ip_port, data, length);
-    }
+    while (receivepacket(net->sock, &ip_port, data, &length) != -1)
+        networking_handle_packet(net, ip_port, data, length);
 }
 
 #ifndef VANILLA_NACL
@@ -440,12 +524,24 @@ void networking_poll(Networking_Core *net)
 #include <sodium.h>
 #endif
 
+/* Instances may be started on several threads at once. Running this twice does no harm, so it
+ * is only made sure that the flag itself is read and written atomically.
+ */
 uint8_t at_startup_ran = 0;
 int networking_at_startup(void)
 {
+#if defined(__ATOMIC_ACQUIRE)
+
+    if (__atomic_load_n(&at_startup_ran, __ATOMIC_ACQUIRE) != 0)
+        return 0;
+
+#else
+
     if (at_startup_ran != 0)
         return 0;
 
+#endif
+
 #ifndef VANILLA_NACL
 
 #ifdef USE_RANDOMBYTES_STIR
@@ -464,7 +560,11 @@ int networking_at_startup(void)
 
 #endif
     srand((uint32_t)current_time_actual());
+#if defined(__ATOMIC_RELEASE)
+    __atomic_store_n(&at_startup_ran, 1, __ATOMIC_RELEASE);
+#else
     at_startup_ran = 1;
+#endif
     return 0;
 }
 
@@ -482,7 +582,7 @@ static void at_shutdown(void)
  */
 Networking_Core *new_networking(IP ip, uint16_t port)
 {
-    return new_networking_ex(ip, port, port + (TOX_PORTRANGE_TO - TOX_PORTRANGE_FROM), 0);
+    return new_networking_ex(ip, port, port + (TOX_PORTRANGE_TO - TOX_PORTRANGE_FROM), NULL, 0);
 }
 
 /* Initialize networking.
@@ -495,7 +595,8 @@ Networking_Core *new_networking(IP ip, uint16_t port)
  *
  * If error is non NULL it is set to 0 if no issues, 1 if socket related error, 2 if other.
  */
-Networking_Core *new_networking_ex(IP ip, uint16_t port_from, uint16_t port_to, unsigned int *error)
+Networking_Core *new_networking_ex(IP ip, uint16_t port_from, uint16_t port_to, const Net_Clock *clock,
+                                   unsigned int *error)
 {
     /* If both from and to are 0, use default port range
      * If one is 0 and the other is non-0, use the non-0 value as only port
@@ -533,6 +634,13 @@ Networking_Core *new_networking_ex(IP ip, uint16_t port_from, uint16_t port_to,
     if (temp == NULL)
         return NULL;
 
+    temp->mono_time = new_mono_time(clock);
+
+    if (temp->mono_time == NULL) {
+        free(temp);
+        return NULL;
+    }
+
     temp->family = ip.family;
     temp->port = 0;
 
@@ -545,6 +653,7 @@ Networking_Core *new_networking_ex(IP ip, uint16_t port_from, uint16_t port_to,
 #ifdef DEBUG
         fprintf(stderr, "Failed to get a socket?! %u, %s\n", errno, strerror(errno));
 #endif
+        kill_mono_time(temp->mono_time);
         free(temp);
 
         if (error)
@@ -696,12 +805,57 @@ Networking_Core *new_networking_ex(IP ip, uint16_t port_from, uint16_t port_to,
     return NULL;
 }
 
+Networking_Core *new_networking_transport(const Net_Transport *transport, const Net_Clock *clock)
+{
+    if (transport->send == NULL)
+        return NULL;
+
+    if (transport->ip_port.ip.family != AF_INET && transport->ip_port.ip.family != AF_INET6)
+        return NULL;
+
+    Networking_Core *net = calloc(1, sizeof(Networking_Core));
+
+    if (net == NULL)
+        return NULL;
+
+    net->mono_time = new_mono_time(clock);
+
+    if (net->mono_time == NULL) {
+        free(net);
+        return NULL;
+    }
+
+    net->family = transport->ip_port.ip.family;
+    net->port = transport->ip_port.port;
+    net->sock = ~(sock_t)0;   /* not a valid socket */
+    net->transport = *transport;
+    return net;
+}
+
+Networking_Core *new_networking_no_udp(const Net_Clock *clock)
+{
+    Networking_Core *net = calloc(1, sizeof(Networking_Core));
+
+    if (net == NULL)
+        return NULL;
+
+    net->mono_time = new_mono_time(clock);
+
+    if (net->mono_time == NULL) {
+        free(net);
+        return NULL;
+    }
+
+    return net;
+}
+
 /* Function to cleanup networking stuff. */
 void kill_networking(Networking_Core *net)
 {
-    if (net->family != 0) /* Socket not initialized */
+    if (net->family != 0 && !net->transport.send) /* Socket not initialized */
         kill_sock(net->sock);
 
+    kill_mono_time(net->mono_time);
     free(net);
     return;
 }
@@ -43,6 +43,7 @@
 #include <winsock2.h>
 #include <windows.h>
 #include <ws2tcpip.h>
+#include <pthread.h>
 
 #ifndef IPV6_V6ONLY
 #define IPV6_V6ONLY 27
@@ -305,6 +306,56 @@ typedef struct {
     void *object;
 } Packet_Handles;
 
+/* Sends a packet in place of the socket, returns the number of bytes sent or -1 like sendto(). */
+typedef int (*net_send_callback)(void *object, IP_Port ip_port, const uint8_t *data, uint16_t length);
+
+/* A transport that carries the packets of a Networking_Core instead of a UDP socket, used to
+ * run nodes on a simulated network. The packets for the node are handed to it with
+ * networking_handle_packet().
+ */
+typedef struct {
+    net_send_callback send;
+    void *object;
+    IP_Port ip_port;   /* our address on the transport */
+} Net_Transport;
+
+/* A clock that an instance reads in place of the system clock, used to run nodes on a simulated
+ * network. function returns the time in milliseconds since the unix epoch and must never go back.
+ */
+typedef struct {
+    uint64_t (*function)(void *object);
+    void *object;
+} Net_Clock;
+
+/* The clock of an instance, kept by its Networking_Core. Every module of the instance reads the
+ * time from it, so that instances in one process can run on clocks of their own.
+ *
+ * The unix time is only updated by unix_time_update(). It is read by the threads of the instance,
+ * so it is only touched atomically.
+ */
+typedef struct {
+    Net_Clock clock;
+
+    uint64_t unix_time_value;
+    uint64_t unix_base_time_value;   /* unix time at which the monotonic time was 0 */
+
+#if defined(_WIN32) || defined(__WIN32__) || defined (WIN32)
+    /* GetTickCount() wraps around every 49 days */
+    pthread_mutex_t lock;
+    uint64_t last_monotime;
+    uint64_t add_monotime;
+#endif
+} Mono_Time;
+
+typedef struct {
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    uint64_t send_failures;
+    uint64_t packets_received;
+    uint64_t bytes_received;
+    uint64_t packets_unhandled; /* Received packets no handler was registered for. */
+} Networking_Stats;
+
 typedef struct {
     Packet_Handles packethandlers[256];
 
@@ -312,6 +363,14 @@ typedef struct {
     uint16_t port;
     /* Our UDP socket. */
     sock_t sock;
+
+    /* Used in place of the socket if send is set */
+    Net_Transport transport;
+
+    Mono_Time *mono_time;
+
+    /* The sent ones are updated atomically, use networking_get_stats() to read them. */
+    Networking_Stats stats;
 } Networking_Core;
 
 /* Run this before creating sockets.
@@ -360,8 +419,17 @@ int set_socket_reuseaddr(sock_t sock);
  */
 int set_socket_dualstack(sock_t sock);
 
+/* Creates a clock that reads clock, or the system clock if clock is NULL or its function isn't
+ * set. unix_time() of the new clock is already up to date.
+ *
+ * return NULL on failure.
+ */
+Mono_Time *new_mono_time(const Net_Clock *clock);
+
+void kill_mono_time(Mono_Time *mono_time);
+
 /* return current monotonic time in milliseconds (ms). */
-uint64_t current_time_monotonic(void);
+uint64_t current_time_monotonic(Mono_Time *mono_time);
 
 /* Basic network functions: */
 
@@ -374,6 +442,14 @@ void networking_registerhandler(Networking_Core *net, uint8_t byte, packet_handl
 /* Call this several times a second. */
 void networking_poll(Networking_Core *net);
 
+/* Hands a packet from ip_port to the handler registered for its first byte, as if it had been
+ * received on the socket. Used by transports.
+ */
+void networking_handle_packet(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint16_t length);
+
+/* Copy the counters of net into stats. */
+void networking_get_stats(const Networking_Core *net, Networking_Stats *stats);
+
 /* Initialize networking.
  * bind to ip and port.
  * ip must be in network order EX: 127.0.0.1 = (7F000001).
@@ -385,7 +461,27 @@ void networking_poll(Networking_Core *net);
  * If error is non NULL it is set to 0 if no issues, 1 if socket related error, 2 if other.
  */
 Networking_Core *new_networking(IP ip, uint16_t port);
-Networking_Core *new_networking_ex(IP ip, uint16_t port_from, uint16_t port_to, unsigned int *error);
+
+/* Same as new_networking() with a range of ports to try, reading the time from clock, or from the
+ * system clock if clock is NULL.
+ */
+Networking_Core *new_networking_ex(IP ip, uint16_t port_from, uint16_t port_to, const Net_Clock *clock,
+                                   unsigned int *error);
+
+/* Initialize networking on transport instead of a socket, reading the time from clock, or from
+ * the system clock if clock is NULL.
+ * Our address is transport->ip_port.
+ *
+ * return Networking_Core object if no problems
+ * return NULL if there are problems.
+ */
+Networking_Core *new_networking_transport(const Net_Transport *transport, const Net_Clock *clock);
+
+/* A Networking_Core without a socket, for instances that don't use UDP. It only keeps the clock.
+ *
+ * return NULL on failure.
+ */
+Networking_Core *new_networking_no_udp(const Net_Clock *clock);
 
 /* Function to cleanup networking stuff (doesn't do much right now). */
 void kill_networking(Networking_Core *net);
@@ -39,9 +39,9 @@
 #define KEY_REFRESH_INTERVAL (2 * 60 * 60)
 static void change_symmetric_key(Onion *onion)
 {
-    if (is_timeout(onion->timestamp, KEY_REFRESH_INTERVAL)) {
+    if (is_timeout(onion->dht->mono_time, onion->timestamp, KEY_REFRESH_INTERVAL)) {
         new_symmetric_key(onion->secret_symmetric_key);
-        onion->timestamp = unix_time();
+        onion->timestamp = unix_time(onion->dht->mono_time);
     }
 }
 
@@ -320,7 +320,8 @@ static int handle_send_initial(void *object, IP_Port source, const uint8_t *pack
 
     uint8_t plain[ONION_MAX_PACKET_SIZE];
     uint8_t shared_key[crypto_box_BEFORENMBYTES];
-    get_shared_key(&onion->shared_keys_1, shared_key, onion->dht->self_secret_key, packet + 1 + crypto_box_NONCEBYTES);
+    get_shared_key(onion->dht->mono_time, &onion->shared_keys_1, shared_key, onion->dht->self_secret_key,
+                   packet + 1 + crypto_box_NONCEBYTES);
     int len = decrypt_data_symmetric(shared_key, packet + 1, packet + 1 + crypto_box_NONCEBYTES + crypto_box_PUBLICKEYBYTES,
                                      length - (1 + crypto_box_NONCEBYTES + crypto_box_PUBLICKEYBYTES), plain);
 
@@ -381,7 +382,8 @@ static int handle_send_1(void *object, IP_Port source, const uint8_t *packet, ui
 
     uint8_t plain[ONION_MAX_PACKET_SIZE];
     uint8_t shared_key[crypto_box_BEFORENMBYTES];
-    get_shared_key(&onion->shared_keys_2, shared_key, onion->dht->self_secret_key, packet + 1 + crypto_box_NONCEBYTES);
+    get_shared_key(onion->dht->mono_time, &onion->shared_keys_2, shared_key, onion->dht->self_secret_key,
+                   packet + 1 + crypto_box_NONCEBYTES);
     int len = decrypt_data_symmetric(shared_key, packet + 1, packet + 1 + crypto_box_NONCEBYTES + crypto_box_PUBLICKEYBYTES,
                                      length - (1 + crypto_box_NONCEBYTES + crypto_box_PUBLICKEYBYTES + RETURN_1), plain);
 
@@ -431,7 +433,8 @@ static int handle_send_2(void *object, IP_Port source, const uint8_t *packet, ui
 
     uint8_t plain[ONION_MAX_PACKET_SIZE];
     uint8_t shared_key[crypto_box_BEFORENMBYTES];
-    get_shared_key(&onion->shared_keys_3, shared_key, onion->dht->self_secret_key, packet + 1 + crypto_box_NONCEBYTES);
+    get_shared_key(onion->dht->mono_time, &onion->shared_keys_3, shared_key, onion->dht->self_secret_key,
+                   packet + 1 + crypto_box_NONCEBYTES);
     int len = decrypt_data_symmetric(shared_key, packet + 1, packet + 1 + crypto_box_NONCEBYTES + crypto_box_PUBLICKEYBYTES,
                                      length - (1 + crypto_box_NONCEBYTES + crypto_box_PUBLICKEYBYTES + RETURN_2), plain);
 
@@ -573,6 +576,11 @@ static int handle_recv_1(void *object, IP_Port source, const uint8_t *packet, ui
     return 0;
 }
 
+void onion_refresh_symmetric_key(Onion *onion)
+{
+    change_symmetric_key(onion);
+}
+
 void set_callback_handle_recv_1(Onion *onion, int (*function)(void *, IP_Port, const uint8_t *, uint16_t), void *object)
 {
     onion->recv_1_function = function;
@@ -592,7 +600,7 @@ Onion *new_onion(DHT *dht)
     onion->dht = dht;
     onion->net = dht->net;
     new_symmetric_key(onion->secret_symmetric_key);
-    onion->timestamp = unix_time();
+    onion->timestamp = unix_time(dht->mono_time);
 
     networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_INITIAL, &handle_send_initial, onion);
     networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_1, &handle_send_1, onion);
@@ -149,6 +149,11 @@ int send_onion_response(Networking_Core *net, IP_Port dest, const uint8_t *data,
  */
 int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, IP_Port source, const uint8_t *nonce);
 
+/* Replace the key the return parts of packets are encrypted with if it's due, which happens
+ * when packets are handled. Used when the packets are handled somewhere else.
+ */
+void onion_refresh_symmetric_key(Onion *onion);
+
 /* Set the callback to be called when the dest ip_port doesn't have AF_INET6 or AF_INET as the family.
  *
  * Format: function(void *object, IP_Port dest, uint8_t *data, uint16_t length)
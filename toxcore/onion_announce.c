@@ -210,7 +210,7 @@ static int in_entries(const Onion_Announce *onion_a, const uint8_t *public_key)
     unsigned int i;
 
     for (i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
-        if (!is_timeout(onion_a->entries[i].time, ONION_ANNOUNCE_TIMEOUT)
+        if (!is_timeout(onion_a->dht->mono_time, onion_a->entries[i].time, ONION_ANNOUNCE_TIMEOUT)
                 && memcmp(onion_a->entries[i].public_key, public_key, crypto_box_PUBLICKEYBYTES) == 0)
             return i;
     }
@@ -218,14 +218,19 @@ static int in_entries(const Onion_Announce *onion_a, const uint8_t *public_key)
     return -1;
 }
 
-static uint8_t cmp_public_key[crypto_box_PUBLICKEYBYTES];
+/* An entry and the key it is sorted by, as qsort() takes no context. */
+typedef struct {
+    const Mono_Time *mono_time;
+    const uint8_t *base_public_key;
+    Onion_Announce_Entry entry;
+} Cmp_data;
+
 static int cmp_entry(const void *a, const void *b)
 {
-    Onion_Announce_Entry entry1, entry2;
-    memcpy(&entry1, a, sizeof(Onion_Announce_Entry));
-    memcpy(&entry2, b, sizeof(Onion_Announce_Entry));
-    int t1 = is_timeout(entry1.time, ONION_ANNOUNCE_TIMEOUT);
-    int t2 = is_timeout(entry2.time, ONION_ANNOUNCE_TIMEOUT);
+    const Cmp_data *cmp1 = a, *cmp2 = b;
+    const Onion_Announce_Entry *entry1 = &cmp1->entry, *entry2 = &cmp2->entry;
+    int t1 = is_timeout(cmp1->mono_time, entry1->time, ONION_ANNOUNCE_TIMEOUT);
+    int t2 = is_timeout(cmp2->mono_time, entry2->time, ONION_ANNOUNCE_TIMEOUT);
 
     if (t1 && t2)
         return 0;
@@ -236,7 +241,7 @@ static int cmp_entry(const void *a, const void *b)
     if (t2)
         return 1;
 
-    int close = id_closest(cmp_public_key, entry1.public_key, entry2.public_key);
+    int close = id_closest(cmp1->base_public_key, entry1->public_key, entry2->public_key);
 
     if (close == 1)
         return 1;
@@ -247,6 +252,27 @@ static int cmp_entry(const void *a, const void *b)
     return 0;
 }
 
+/* Sorts list with the timed out entries first and then from the furthest from comp_public_key
+ * to the closest.
+ */
+static void sort_onion_announce_list(const Mono_Time *mono_time, Onion_Announce_Entry *list, unsigned int length,
+                                     const uint8_t *comp_public_key)
+{
+    Cmp_data cmp_list[length];
+    unsigned int i;
+
+    for (i = 0; i < length; ++i) {
+        cmp_list[i].mono_time = mono_time;
+        cmp_list[i].base_public_key = comp_public_key;
+        cmp_list[i].entry = list[i];
+    }
+
+    qsort(cmp_list, length, sizeof(Cmp_data), cmp_entry);
+
+    for (i = 0; i < length; ++i)
+        list[i] = cmp_list[i].entry;
+}
+
 /* add entry to entries list
  *
  * return -1 if failure
@@ -262,7 +288,7 @@ static int add_to_entries(Onion_Announce *onion_a, IP_Port ret_ip_port, const ui
 
     if (pos == -1) {
         for (i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
-            if (is_timeout(onion_a->entries[i].time, ONION_ANNOUNCE_TIMEOUT))
+            if (is_timeout(onion_a->dht->mono_time, onion_a->entries[i].time, ONION_ANNOUNCE_TIMEOUT))
                 pos = i;
         }
     }
@@ -279,10 +305,10 @@ static int add_to_entries(Onion_Announce *onion_a, IP_Port ret_ip_port, const ui
     onion_a->entries[pos].ret_ip_port = ret_ip_port;
     memcpy(onion_a->entries[pos].ret, ret, ONION_RETURN_3);
     memcpy(onion_a->entries[pos].data_public_key, data_public_key, crypto_box_PUBLICKEYBYTES);
-    onion_a->entries[pos].time = unix_time();
+    onion_a->entries[pos].time = unix_time(onion_a->dht->mono_time);
 
-    memcpy(cmp_public_key, onion_a->dht->self_public_key, crypto_box_PUBLICKEYBYTES);
-    qsort(onion_a->entries, ONION_ANNOUNCE_MAX_ENTRIES, sizeof(Onion_Announce_Entry), cmp_entry);
+    sort_onion_announce_list(onion_a->dht->mono_time, onion_a->entries, ONION_ANNOUNCE_MAX_ENTRIES,
+                             onion_a->dht->self_public_key);
     return in_entries(onion_a, public_key);
 }
 
@@ -295,7 +321,8 @@ static int handle_announce_request(void *object, IP_Port source, const uint8_t *
 
     const uint8_t *packet_public_key = packet + 1 + crypto_box_NONCEBYTES;
     uint8_t shared_key[crypto_box_BEFORENMBYTES];
-    get_shared_key(&onion_a->shared_keys_recv, shared_key, onion_a->dht->self_secret_key, packet_public_key);
+    get_shared_key(onion_a->dht->mono_time, &onion_a->shared_keys_recv, shared_key, onion_a->dht->self_secret_key,
+                   packet_public_key);
 
     uint8_t plain[ONION_PING_ID_SIZE + crypto_box_PUBLICKEYBYTES + crypto_box_PUBLICKEYBYTES +
                   ONION_ANNOUNCE_SENDBACK_DATA_LENGTH];
@@ -307,10 +334,11 @@ static int handle_announce_request(void *object, IP_Port source, const uint8_t *
         return 1;
 
     uint8_t ping_id1[ONION_PING_ID_SIZE];
-    generate_ping_id(onion_a, unix_time(), packet_public_key, source, ping_id1);
+    generate_ping_id(onion_a, unix_time(onion_a->dht->mono_time), packet_public_key, source, ping_id1);
 
     uint8_t ping_id2[ONION_PING_ID_SIZE];
-    generate_ping_id(onion_a, unix_time() + PING_ID_TIMEOUT, packet_public_key, source, ping_id2);
+    generate_ping_id(onion_a, unix_time(onion_a->dht->mono_time) + PING_ID_TIMEOUT, packet_public_key, source,
+                     ping_id2);
 
     int index = -1;
 
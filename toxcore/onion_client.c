@@ -33,6 +33,9 @@
 #define ANNOUNCE_ARRAY_SIZE 256
 #define ANNOUNCE_TIMEOUT 10
 
+/* num, public key, ip_port and path_num, see new_sendback(). */
+#define SENDBACK_DATA_SIZE (sizeof(uint32_t) + crypto_box_PUBLICKEYBYTES + sizeof(IP_Port) + sizeof(uint32_t))
+
 /* Add a node to the path_nodes bootstrap array.
  *
  * return -1 on failure
@@ -177,16 +180,16 @@ static uint16_t random_nodes_path_onion(const Onion_Client *onion_c, Node_format
  * return -1 if nodes are suitable for creating a new path.
  * return path number of already existing similar path if one already exists.
  */
-static int is_path_used(const Onion_Client_Paths *onion_paths, const Node_format *nodes)
+static int is_path_used(const Mono_Time *mono_time, const Onion_Client_Paths *onion_paths, const Node_format *nodes)
 {
     unsigned int i;
 
     for (i = 0; i < NUMBER_ONION_PATHS; ++i) {
-        if (is_timeout(onion_paths->last_path_success[i], ONION_PATH_TIMEOUT)) {
+        if (is_timeout(mono_time, onion_paths->last_path_success[i], ONION_PATH_TIMEOUT)) {
             continue;
         }
 
-        if (is_timeout(onion_paths->path_creation_time[i], ONION_PATH_MAX_LIFETIME)) {
+        if (is_timeout(mono_time, onion_paths->path_creation_time[i], ONION_PATH_MAX_LIFETIME)) {
             continue;
         }
 
@@ -199,13 +202,13 @@ static int is_path_used(const Onion_Client_Paths *onion_paths, const Node_format
 }
 
 /* is path timed out */
-static _Bool path_timed_out(Onion_Client_Paths *onion_paths, uint32_t pathnum)
+static _Bool path_timed_out(const Mono_Time *mono_time, Onion_Client_Paths *onion_paths, uint32_t pathnum)
 {
     pathnum = pathnum % NUMBER_ONION_PATHS;
 
     return ((onion_paths->last_path_success[pathnum] + ONION_PATH_TIMEOUT < onion_paths->last_path_used[pathnum]
              && onion_paths->last_path_used_times[pathnum] >= ONION_PATH_MAX_NO_RESPONSE_USES)
-            || is_timeout(onion_paths->path_creation_time[pathnum], ONION_PATH_MAX_LIFETIME));
+            || is_timeout(mono_time, onion_paths->path_creation_time[pathnum], ONION_PATH_MAX_LIFETIME));
 }
 
 /* Create a new path or use an old suitable one (if pathnum is valid)
@@ -225,20 +228,21 @@ static int random_path(const Onion_Client *onion_c, Onion_Client_Paths *onion_pa
         pathnum = pathnum % NUMBER_ONION_PATHS;
     }
 
-    if (path_timed_out(onion_paths, pathnum)) {
+    if (path_timed_out(onion_c->mono_time, onion_paths, pathnum)) {
         Node_format nodes[ONION_PATH_LENGTH];
 
         if (random_nodes_path_onion(onion_c, nodes, ONION_PATH_LENGTH) != ONION_PATH_LENGTH)
             return -1;
 
-        int n = is_path_used(onion_paths, nodes);
+        int n = is_path_used(onion_c->mono_time, onion_paths, nodes);
 
         if (n == -1) {
             if (create_onion_path(onion_c->dht, &onion_paths->paths[pathnum], nodes) == -1)
                 return -1;
 
-            onion_paths->last_path_success[pathnum] = unix_time() + ONION_PATH_FIRST_TIMEOUT - ONION_PATH_TIMEOUT;
-            onion_paths->path_creation_time[pathnum] = unix_time();
+            onion_paths->last_path_success[pathnum] = unix_time(onion_c->mono_time) + ONION_PATH_FIRST_TIMEOUT
+                    - ONION_PATH_TIMEOUT;
+            onion_paths->path_creation_time[pathnum] = unix_time(onion_c->mono_time);
             onion_paths->last_path_used_times[pathnum] = ONION_PATH_MAX_NO_RESPONSE_USES / 2;
 
             uint32_t path_num = rand();
@@ -253,15 +257,15 @@ static int random_path(const Onion_Client *onion_c, Onion_Client_Paths *onion_pa
     }
 
     ++onion_paths->last_path_used_times[pathnum];
-    onion_paths->last_path_used[pathnum] = unix_time();
+    onion_paths->last_path_used[pathnum] = unix_time(onion_c->mono_time);
     memcpy(path, &onion_paths->paths[pathnum], sizeof(Onion_Path));
     return 0;
 }
 
 /* Does path with path_num exist. */
-static _Bool path_exists(Onion_Client_Paths *onion_paths, uint32_t path_num)
+static _Bool path_exists(const Mono_Time *mono_time, Onion_Client_Paths *onion_paths, uint32_t path_num)
 {
-    if (path_timed_out(onion_paths, path_num))
+    if (path_timed_out(mono_time, onion_paths, path_num))
         return 0;
 
     return onion_paths->paths[path_num % NUMBER_ONION_PATHS].path_num == path_num;
@@ -284,7 +288,7 @@ static uint32_t set_path_timeouts(Onion_Client *onion_c, uint32_t num, uint32_t
     }
 
     if (onion_paths->paths[path_num % NUMBER_ONION_PATHS].path_num == path_num) {
-        onion_paths->last_path_success[path_num % NUMBER_ONION_PATHS] = unix_time();
+        onion_paths->last_path_success[path_num % NUMBER_ONION_PATHS] = unix_time(onion_c->mono_time);
         onion_paths->last_path_used_times[path_num % NUMBER_ONION_PATHS] = 0;
 
         Node_format nodes[ONION_PATH_LENGTH];
@@ -353,7 +357,7 @@ static int send_onion_packet_tcp_udp(const Onion_Client *onion_c, const Onion_Pa
 static int new_sendback(Onion_Client *onion_c, uint32_t num, const uint8_t *public_key, IP_Port ip_port,
                         uint32_t path_num, uint64_t *sendback)
 {
-    uint8_t data[sizeof(uint32_t) + crypto_box_PUBLICKEYBYTES + sizeof(IP_Port) + sizeof(uint32_t)];
+    uint8_t data[SENDBACK_DATA_SIZE];
     memcpy(data, &num, sizeof(uint32_t));
     memcpy(data + sizeof(uint32_t), public_key, crypto_box_PUBLICKEYBYTES);
     memcpy(data + sizeof(uint32_t) + crypto_box_PUBLICKEYBYTES, &ip_port, sizeof(IP_Port));
@@ -381,7 +385,7 @@ static uint32_t check_sendback(Onion_Client *onion_c, const uint8_t *sendback, u
 {
     uint64_t sback;
     memcpy(&sback, sendback, sizeof(uint64_t));
-    uint8_t data[sizeof(uint32_t) + crypto_box_PUBLICKEYBYTES + sizeof(IP_Port) + sizeof(uint32_t)];
+    uint8_t data[SENDBACK_DATA_SIZE];
 
     if (ping_array_check(data, sizeof(data), &onion_c->announce_ping_array, sback) != sizeof(data))
         return ~0;
@@ -440,14 +444,19 @@ static int client_send_announce_request(Onion_Client *onion_c, uint32_t num, IP_
     return send_onion_packet_tcp_udp(onion_c, &path, dest, request, len);
 }
 
-static uint8_t cmp_public_key[crypto_box_PUBLICKEYBYTES];
+/* Sort key for the lists of onion nodes, kept with each entry instead of in a global. */
+typedef struct {
+    const Mono_Time *mono_time;
+    const uint8_t *base_public_key;
+    Onion_Node entry;
+} Cmp_data;
+
 static int cmp_entry(const void *a, const void *b)
 {
-    Onion_Node entry1, entry2;
-    memcpy(&entry1, a, sizeof(Onion_Node));
-    memcpy(&entry2, b, sizeof(Onion_Node));
-    int t1 = is_timeout(entry1.timestamp, ONION_NODE_TIMEOUT);
-    int t2 = is_timeout(entry2.timestamp, ONION_NODE_TIMEOUT);
+    const Cmp_data *cmp1 = a, *cmp2 = b;
+    const Onion_Node *entry1 = &cmp1->entry, *entry2 = &cmp2->entry;
+    int t1 = is_timeout(cmp1->mono_time, entry1->timestamp, ONION_NODE_TIMEOUT);
+    int t2 = is_timeout(cmp2->mono_time, entry2->timestamp, ONION_NODE_TIMEOUT);
 
     if (t1 && t2)
         return 0;
@@ -458,7 +467,7 @@ static int cmp_entry(const void *a, const void *b)
     if (t2)
         return 1;
 
-    int close = id_closest(cmp_public_key, entry1.public_key, entry2.public_key);
+    int close = id_closest(cmp1->base_public_key, entry1->public_key, entry2->public_key);
 
     if (close == 1)
         return 1;
@@ -469,6 +478,24 @@ static int cmp_entry(const void *a, const void *b)
     return 0;
 }
 
+static void sort_onion_node_list(const Mono_Time *mono_time, Onion_Node *list, unsigned int length,
+                                 const uint8_t *comp_public_key)
+{
+    Cmp_data cmp_list[length];
+    unsigned int i;
+
+    for (i = 0; i < length; ++i) {
+        cmp_list[i].mono_time = mono_time;
+        cmp_list[i].base_public_key = comp_public_key;
+        cmp_list[i].entry = list[i];
+    }
+
+    qsort(cmp_list, length, sizeof(Cmp_data), cmp_entry);
+
+    for (i = 0; i < length; ++i)
+        list[i] = cmp_list[i].entry;
+}
+
 static int client_add_to_list(Onion_Client *onion_c, uint32_t num, const uint8_t *public_key, IP_Port ip_port,
                               uint8_t is_stored, const uint8_t *pingid_or_key, uint32_t path_num)
 {
@@ -494,13 +521,12 @@ static int client_add_to_list(Onion_Client *onion_c, uint32_t num, const uint8_t
         reference_id = onion_c->friends_list[num - 1].real_public_key;
     }
 
-    memcpy(cmp_public_key, reference_id, crypto_box_PUBLICKEYBYTES);
-    qsort(list_nodes, MAX_ONION_CLIENTS, sizeof(Onion_Node), cmp_entry);
+    sort_onion_node_list(onion_c->mono_time, list_nodes, MAX_ONION_CLIENTS, reference_id);
 
     int index = -1, stored = 0;
     unsigned int i;
 
-    if (is_timeout(list_nodes[0].timestamp, ONION_NODE_TIMEOUT)
+    if (is_timeout(onion_c->mono_time, list_nodes[0].timestamp, ONION_NODE_TIMEOUT)
             || id_closest(reference_id, list_nodes[0].public_key, public_key) == 2) {
         index = 0;
     }
@@ -529,7 +555,7 @@ static int client_add_to_list(Onion_Client *onion_c, uint32_t num, const uint8_t
     }
 
     list_nodes[index].is_stored = is_stored;
-    list_nodes[index].timestamp = unix_time();
+    list_nodes[index].timestamp = unix_time(onion_c->mono_time);
 
     if (!stored)
         list_nodes[index].last_pinged = 0;
@@ -538,18 +564,19 @@ static int client_add_to_list(Onion_Client *onion_c, uint32_t num, const uint8_t
     return 0;
 }
 
-static int good_to_ping(Last_Pinged *last_pinged, uint8_t *last_pinged_index, const uint8_t *public_key)
+static int good_to_ping(const Mono_Time *mono_time, Last_Pinged *last_pinged, uint8_t *last_pinged_index,
+                        const uint8_t *public_key)
 {
     unsigned int i;
 
     for (i = 0; i < MAX_STORED_PINGED_NODES; ++i) {
-        if (!is_timeout(last_pinged[i].timestamp, MIN_NODE_PING_TIME))
+        if (!is_timeout(mono_time, last_pinged[i].timestamp, MIN_NODE_PING_TIME))
             if (memcmp(last_pinged[i].public_key, public_key, crypto_box_PUBLICKEYBYTES) == 0)
                 return 0;
     }
 
     memcpy(last_pinged[*last_pinged_index % MAX_STORED_PINGED_NODES].public_key, public_key, crypto_box_PUBLICKEYBYTES);
-    last_pinged[*last_pinged_index % MAX_STORED_PINGED_NODES].timestamp = unix_time();
+    last_pinged[*last_pinged_index % MAX_STORED_PINGED_NODES].timestamp = unix_time(mono_time);
     ++*last_pinged_index;
     return 1;
 }
@@ -590,7 +617,7 @@ static int client_ping_nodes(Onion_Client *onion_c, uint32_t num, const Node_for
             if (LAN_ip(nodes[i].ip_port.ip) == 0)
                 continue;
 
-        if (is_timeout(list_nodes[0].timestamp, ONION_NODE_TIMEOUT)
+        if (is_timeout(onion_c->mono_time, list_nodes[0].timestamp, ONION_NODE_TIMEOUT)
                 || id_closest(reference_id, list_nodes[0].public_key, nodes[i].public_key) == 2) {
             /* check if node is already in list. */
             for (j = 0; j < MAX_ONION_CLIENTS; ++j) {
@@ -599,7 +626,8 @@ static int client_ping_nodes(Onion_Client *onion_c, uint32_t num, const Node_for
                 }
             }
 
-            if (j == MAX_ONION_CLIENTS && good_to_ping(last_pinged, last_pinged_index, nodes[i].public_key)) {
+            if (j == MAX_ONION_CLIENTS
+                    && good_to_ping(onion_c->mono_time, last_pinged, last_pinged_index, nodes[i].public_key)) {
                 client_send_announce_request(onion_c, num, nodes[i].ip_port, nodes[i].public_key, NULL, ~0);
             }
         }
@@ -660,12 +688,30 @@ static int handle_announce_response(void *object, IP_Port source, const uint8_t
     }
 
     //TODO: LAN vs non LAN ips?, if we are connected only to LAN, are we offline?
-    onion_c->last_packet_recv = unix_time();
+    onion_c->last_packet_recv = unix_time(onion_c->mono_time);
     return 0;
 }
 
 #define DATA_IN_RESPONSE_MIN_SIZE ONION_DATA_IN_RESPONSE_MIN_SIZE
 
+/* Handle the inner layer of a data response packet, temp_plain being its decrypted outer layer. */
+static int handle_data_response_plain(Onion_Client *onion_c, const uint8_t *packet, const uint8_t *temp_plain,
+                                      uint16_t temp_length)
+{
+    uint8_t plain[temp_length - DATA_IN_RESPONSE_MIN_SIZE];
+    int len = decrypt_data(temp_plain, onion_c->c->self_secret_key, packet + 1, temp_plain + crypto_box_PUBLICKEYBYTES,
+                           temp_length - crypto_box_PUBLICKEYBYTES, plain);
+
+    if ((uint32_t)len != sizeof(plain))
+        return 1;
+
+    if (!onion_c->Onion_Data_Handlers[plain[0]].function)
+        return 1;
+
+    return onion_c->Onion_Data_Handlers[plain[0]].function(onion_c->Onion_Data_Handlers[plain[0]].object, temp_plain, plain,
+            sizeof(plain));
+}
+
 static int handle_data_response(void *object, IP_Port source, const uint8_t *packet, uint16_t length)
 {
     Onion_Client *onion_c = object;
@@ -684,18 +730,7 @@ static int handle_data_response(void *object, IP_Port source, const uint8_t *pac
     if ((uint32_t)len != sizeof(temp_plain))
         return 1;
 
-    uint8_t plain[sizeof(temp_plain) - DATA_IN_RESPONSE_MIN_SIZE];
-    len = decrypt_data(temp_plain, onion_c->c->self_secret_key, packet + 1, temp_plain + crypto_box_PUBLICKEYBYTES,
-                       sizeof(temp_plain) - crypto_box_PUBLICKEYBYTES, plain);
-
-    if ((uint32_t)len != sizeof(plain))
-        return 1;
-
-    if (!onion_c->Onion_Data_Handlers[plain[0]].function)
-        return 1;
-
-    return onion_c->Onion_Data_Handlers[plain[0]].function(onion_c->Onion_Data_Handlers[plain[0]].object, temp_plain, plain,
-            sizeof(plain));
+    return handle_data_response_plain(onion_c, packet, temp_plain, sizeof(temp_plain));
 }
 
 #define DHTPK_DATA_MIN_LENGTH (1 + sizeof(uint64_t) + crypto_box_PUBLICKEYBYTES)
@@ -729,7 +764,7 @@ static int handle_dhtpk_announce(void *object, const uint8_t *source_pubkey, con
                 onion_c->friends_list[friend_num].dht_pk_callback_number, data + 1 + sizeof(uint64_t));
 
     onion_set_friend_DHT_pubkey(onion_c, friend_num, data + 1 + sizeof(uint64_t));
-    onion_c->friends_list[friend_num].last_seen = unix_time();
+    onion_c->friends_list[friend_num].last_seen = unix_time(onion_c->mono_time);
 
     uint16_t len_nodes = length - DHTPK_DATA_MIN_LENGTH;
 
@@ -801,7 +836,7 @@ int send_onion_data(Onion_Client *onion_c, int friend_num, const uint8_t *data,
     Onion_Node *list_nodes = onion_c->friends_list[friend_num].clients_list;
 
     for (i = 0; i < MAX_ONION_CLIENTS; ++i) {
-        if (is_timeout(list_nodes[i].timestamp, ONION_NODE_TIMEOUT))
+        if (is_timeout(onion_c->mono_time, list_nodes[i].timestamp, ONION_NODE_TIMEOUT))
             continue;
 
         ++num_nodes;
@@ -925,7 +960,7 @@ static int send_dhtpk_announce(Onion_Client *onion_c, uint16_t friend_num, uint8
 
     uint8_t data[DHTPK_DATA_MAX_LENGTH];
     data[0] = ONION_DATA_DHTPK;
-    uint64_t no_replay = unix_time();
+    uint64_t no_replay = unix_time(onion_c->mono_time);
     host_to_net((uint8_t *)&no_replay, sizeof(no_replay));
     memcpy(data + 1, &no_replay, sizeof(no_replay));
     memcpy(data + 1 + sizeof(uint64_t), onion_c->dht->self_public_key, crypto_box_PUBLICKEYBYTES);
@@ -1128,7 +1163,7 @@ int onion_set_friend_DHT_pubkey(Onion_Client *onion_c, int friend_num, const uin
         onion_c->friends_list[friend_num].know_dht_public_key = 0;
     }
 
-    onion_c->friends_list[friend_num].last_seen = unix_time();
+    onion_c->friends_list[friend_num].last_seen = unix_time(onion_c->mono_time);
     onion_c->friends_list[friend_num].know_dht_public_key = 1;
     memcpy(onion_c->friends_list[friend_num].dht_public_key, dht_key, crypto_box_PUBLICKEYBYTES);
 
@@ -1188,7 +1223,7 @@ int onion_set_friend_online(Onion_Client *onion_c, int friend_num, uint8_t is_on
         return -1;
 
     if (is_online == 0 && onion_c->friends_list[friend_num].is_online == 1)
-        onion_c->friends_list[friend_num].last_seen = unix_time();
+        onion_c->friends_list[friend_num].last_seen = unix_time(onion_c->mono_time);
 
     onion_c->friends_list[friend_num].is_online = is_online;
 
@@ -1252,20 +1287,20 @@ static void do_friend(Onion_Client *onion_c, uint16_t friendnum)
 
     if (!onion_c->friends_list[friendnum].is_online) {
         for (i = 0; i < MAX_ONION_CLIENTS; ++i) {
-            if (is_timeout(list_nodes[i].timestamp, FRIEND_ONION_NODE_TIMEOUT))
+            if (is_timeout(onion_c->mono_time, list_nodes[i].timestamp, FRIEND_ONION_NODE_TIMEOUT))
                 continue;
 
             ++count;
 
 
             if (list_nodes[i].last_pinged == 0) {
-                list_nodes[i].last_pinged = unix_time();
+                list_nodes[i].last_pinged = unix_time(onion_c->mono_time);
                 continue;
             }
 
-            if (is_timeout(list_nodes[i].last_pinged, interval)) {
+            if (is_timeout(onion_c->mono_time, list_nodes[i].last_pinged, interval)) {
                 if (client_send_announce_request(onion_c, friendnum + 1, list_nodes[i].ip_port, list_nodes[i].public_key, 0, ~0) == 0) {
-                    list_nodes[i].last_pinged = unix_time();
+                    list_nodes[i].last_pinged = unix_time(onion_c->mono_time);
                 }
             }
         }
@@ -1294,13 +1329,15 @@ static void do_friend(Onion_Client *onion_c, uint16_t friendnum)
         }
 
         /* send packets to friend telling them our DHT public key. */
-        if (is_timeout(onion_c->friends_list[friendnum].last_dht_pk_onion_sent, ONION_DHTPK_SEND_INTERVAL))
+        if (is_timeout(onion_c->mono_time, onion_c->friends_list[friendnum].last_dht_pk_onion_sent,
+                       ONION_DHTPK_SEND_INTERVAL))
             if (send_dhtpk_announce(onion_c, friendnum, 0) >= 1)
-                onion_c->friends_list[friendnum].last_dht_pk_onion_sent = unix_time();
+                onion_c->friends_list[friendnum].last_dht_pk_onion_sent = unix_time(onion_c->mono_time);
 
-        if (is_timeout(onion_c->friends_list[friendnum].last_dht_pk_dht_sent, DHT_DHTPK_SEND_INTERVAL))
+        if (is_timeout(onion_c->mono_time, onion_c->friends_list[friendnum].last_dht_pk_dht_sent,
+                       DHT_DHTPK_SEND_INTERVAL))
             if (send_dhtpk_announce(onion_c, friendnum, 1) >= 1)
-                onion_c->friends_list[friendnum].last_dht_pk_dht_sent = unix_time();
+                onion_c->friends_list[friendnum].last_dht_pk_dht_sent = unix_time(onion_c->mono_time);
 
     }
 }
@@ -1322,7 +1359,7 @@ static void do_announce(Onion_Client *onion_c)
     Onion_Node *list_nodes = onion_c->clients_announce_list;
 
     for (i = 0; i < MAX_ONION_CLIENTS; ++i) {
-        if (is_timeout(list_nodes[i].timestamp, ONION_NODE_TIMEOUT))
+        if (is_timeout(onion_c->mono_time, list_nodes[i].timestamp, ONION_NODE_TIMEOUT))
             continue;
 
         ++count;
@@ -1335,14 +1372,15 @@ static void do_announce(Onion_Client *onion_c)
 
         unsigned int interval = ANNOUNCE_INTERVAL_NOT_ANNOUNCED;
 
-        if (list_nodes[i].is_stored && path_exists(&onion_c->onion_paths_self, list_nodes[i].path_used)) {
+        if (list_nodes[i].is_stored
+                && path_exists(onion_c->mono_time, &onion_c->onion_paths_self, list_nodes[i].path_used)) {
             interval = ANNOUNCE_INTERVAL_ANNOUNCED;
         }
 
-        if (is_timeout(list_nodes[i].last_pinged, interval)) {
+        if (is_timeout(onion_c->mono_time, list_nodes[i].last_pinged, interval)) {
             if (client_send_announce_request(onion_c, 0, list_nodes[i].ip_port, list_nodes[i].public_key,
                                              list_nodes[i].ping_id, list_nodes[i].path_used) == 0) {
-                list_nodes[i].last_pinged = unix_time();
+                list_nodes[i].last_pinged = unix_time(onion_c->mono_time);
             }
         }
     }
@@ -1377,14 +1415,14 @@ static int onion_isconnected(const Onion_Client *onion_c)
 {
     unsigned int i, num = 0, announced = 0;
 
-    if (is_timeout(onion_c->last_packet_recv, ONION_OFFLINE_TIMEOUT))
+    if (is_timeout(onion_c->mono_time, onion_c->last_packet_recv, ONION_OFFLINE_TIMEOUT))
         return 0;
 
     if (onion_c->path_nodes_index == 0)
         return 0;
 
     for (i = 0; i < MAX_ONION_CLIENTS; ++i) {
-        if (!is_timeout(onion_c->clients_announce_list[i].timestamp, ONION_NODE_TIMEOUT)) {
+        if (!is_timeout(onion_c->mono_time, onion_c->clients_announce_list[i].timestamp, ONION_NODE_TIMEOUT)) {
             ++num;
 
             if (onion_c->clients_announce_list[i].is_stored) {
@@ -1432,7 +1470,7 @@ void do_onion_client(Onion_Client *onion_c)
 {
     unsigned int i;
 
-    if (onion_c->last_run == unix_time())
+    if (onion_c->last_run == unix_time(onion_c->mono_time))
         return;
 
     populate_path_nodes(onion_c);
@@ -1454,7 +1492,7 @@ void do_onion_client(Onion_Client *onion_c)
 
     _Bool UDP_connected = DHT_non_lan_connected(onion_c->dht);
 
-    if (is_timeout(onion_c->first_run, ONION_CONNECTION_SECONDS)) {
+    if (is_timeout(onion_c->mono_time, onion_c->first_run, ONION_CONNECTION_SECONDS)) {
         set_tcp_onion_status(onion_c->c->tcp_c, !UDP_connected);
     }
 
@@ -1468,10 +1506,183 @@ void do_onion_client(Onion_Client *onion_c)
     }
 
     if (onion_c->last_run == 0) {
-        onion_c->first_run = unix_time();
+        onion_c->first_run = unix_time(onion_c->mono_time);
+    }
+
+    onion_c->last_run = unix_time(onion_c->mono_time);
+}
+
+static int host_handle_announce_response(void *object, IP_Port source, const uint8_t *packet, uint16_t length)
+{
+    Onion_Client_Host *host = object;
+    uint32_t i;
+
+    /* Only the account that sent the request finds its sendback in its ping array */
+    for (i = 0; i < host->num_accounts; ++i) {
+        if (handle_announce_response(host->accounts[i], source, packet, length) == 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+static int host_handle_data_response(void *object, IP_Port source, const uint8_t *packet, uint16_t length)
+{
+    Onion_Client_Host *host = object;
+
+    if (length <= (ONION_DATA_RESPONSE_MIN_SIZE + DATA_IN_RESPONSE_MIN_SIZE))
+        return 1;
+
+    if (length > MAX_DATA_REQUEST_SIZE)
+        return 1;
+
+    uint8_t temp_plain[length - ONION_DATA_RESPONSE_MIN_SIZE];
+    int len = decrypt_data(packet + 1 + crypto_box_NONCEBYTES, host->temp_secret_key, packet + 1,
+                           packet + 1 + crypto_box_NONCEBYTES + crypto_box_PUBLICKEYBYTES,
+                           length - (1 + crypto_box_NONCEBYTES + crypto_box_PUBLICKEYBYTES), temp_plain);
+
+    if ((uint32_t)len != sizeof(temp_plain))
+        return 1;
+
+    /* temp_plain starts with the real public key of the sender */
+    uint32_t i;
+
+    for (i = 0; i < host->num_accounts; ++i) {
+        if (onion_friend_num(host->accounts[i], temp_plain) != -1
+                && handle_data_response_plain(host->accounts[i], packet, temp_plain, sizeof(temp_plain)) == 0)
+            return 0;
+    }
+
+    for (i = 0; i < host->num_accounts; ++i) {
+        if (onion_friend_num(host->accounts[i], temp_plain) == -1
+                && handle_data_response_plain(host->accounts[i], packet, temp_plain, sizeof(temp_plain)) == 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+static int host_handle_dht_dhtpk(void *object, IP_Port source, const uint8_t *source_pubkey, const uint8_t *packet,
+                                 uint16_t length)
+{
+    Onion_Client_Host *host = object;
+
+    if (length < crypto_box_PUBLICKEYBYTES)
+        return 1;
+
+    /* packet starts with the real public key of the sender */
+    uint32_t i;
+
+    for (i = 0; i < host->num_accounts; ++i) {
+        if (onion_friend_num(host->accounts[i], packet) != -1
+                && handle_dht_dhtpk(host->accounts[i], source, source_pubkey, packet, length) == 0)
+            return 0;
     }
 
-    onion_c->last_run = unix_time();
+    return 1;
+}
+
+static int host_handle_tcp_onion(void *object, const uint8_t *data, uint16_t length)
+{
+    if (length == 0)
+        return 1;
+
+    IP_Port ip_port = {0};
+    ip_port.ip.family = TCP_FAMILY;
+
+    if (data[0] == NET_PACKET_ANNOUNCE_RESPONSE) {
+        return host_handle_announce_response(object, ip_port, data, length);
+    } else if (data[0] == NET_PACKET_ONION_DATA_RESPONSE) {
+        return host_handle_data_response(object, ip_port, data, length);
+    }
+
+    return 1;
+}
+
+Onion_Client_Host *new_onion_client_host(Net_Crypto_Host *c_host)
+{
+    if (c_host == NULL)
+        return NULL;
+
+    Onion_Client_Host *host = calloc(1, sizeof(Onion_Client_Host));
+
+    if (host == NULL)
+        return NULL;
+
+    host->dht = c_host->dht;
+    host->net = c_host->dht->net;
+    host->tcp_c = c_host->tcp_c;
+    crypto_box_keypair(host->temp_public_key, host->temp_secret_key);
+    networking_registerhandler(host->net, NET_PACKET_ANNOUNCE_RESPONSE, &host_handle_announce_response, host);
+    networking_registerhandler(host->net, NET_PACKET_ONION_DATA_RESPONSE, &host_handle_data_response, host);
+    cryptopacket_registerhandler(host->dht, CRYPTO_PACKET_DHTPK, &host_handle_dht_dhtpk, host);
+    set_onion_packet_tcp_connection_callback(host->tcp_c, &host_handle_tcp_onion, host);
+
+    return host;
+}
+
+Onion_Client *new_onion_client_hosted(Onion_Client_Host *host, Net_Crypto *c)
+{
+    if (host == NULL || c == NULL)
+        return NULL;
+
+    Onion_Client **accounts = realloc(host->accounts, (host->num_accounts + 1) * sizeof(Onion_Client *));
+
+    if (accounts == NULL)
+        return NULL;
+
+    host->accounts = accounts;
+
+    Onion_Client *onion_c = calloc(1, sizeof(Onion_Client));
+
+    if (onion_c == NULL)
+        return NULL;
+
+    if (ping_array_init(&onion_c->announce_ping_array, c->dht->mono_time, ANNOUNCE_ARRAY_SIZE, ANNOUNCE_TIMEOUT,
+                        SENDBACK_DATA_SIZE) != 0) {
+        free(onion_c);
+        return NULL;
+    }
+
+    onion_c->dht = c->dht;
+    onion_c->net = c->dht->net;
+    onion_c->mono_time = c->dht->mono_time;
+    onion_c->c = c;
+    onion_c->host = host;
+    new_symmetric_key(onion_c->secret_symmetric_key);
+    memcpy(onion_c->temp_public_key, host->temp_public_key, crypto_box_PUBLICKEYBYTES);
+    memcpy(onion_c->temp_secret_key, host->temp_secret_key, crypto_box_SECRETKEYBYTES);
+    oniondata_registerhandler(onion_c, ONION_DATA_DHTPK, &handle_dhtpk_announce, onion_c);
+
+    host->accounts[host->num_accounts] = onion_c;
+    ++host->num_accounts;
+    return onion_c;
+}
+
+static void host_remove_account(Onion_Client_Host *host, const Onion_Client *onion_c)
+{
+    uint32_t i;
+
+    for (i = 0; i < host->num_accounts; ++i) {
+        if (host->accounts[i] == onion_c) {
+            --host->num_accounts;
+            host->accounts[i] = host->accounts[host->num_accounts];
+            return;
+        }
+    }
+}
+
+void kill_onion_client_host(Onion_Client_Host *host)
+{
+    if (host == NULL)
+        return;
+
+    networking_registerhandler(host->net, NET_PACKET_ANNOUNCE_RESPONSE, NULL, NULL);
+    networking_registerhandler(host->net, NET_PACKET_ONION_DATA_RESPONSE, NULL, NULL);
+    cryptopacket_registerhandler(host->dht, CRYPTO_PACKET_DHTPK, NULL, NULL);
+    set_onion_packet_tcp_connection_callback(host->tcp_c, NULL, NULL);
+    free(host->accounts);
+    free(host);
 }
 
 Onion_Client *new_onion_client(Net_Crypto *c)
@@ -1484,13 +1695,15 @@ Onion_Client *new_onion_client(Net_Crypto *c)
     if (onion_c == NULL)
         return NULL;
 
-    if (ping_array_init(&onion_c->announce_ping_array, ANNOUNCE_ARRAY_SIZE, ANNOUNCE_TIMEOUT) != 0) {
+    if (ping_array_init(&onion_c->announce_ping_array, c->dht->mono_time, ANNOUNCE_ARRAY_SIZE, ANNOUNCE_TIMEOUT,
+                        SENDBACK_DATA_SIZE) != 0) {
         free(onion_c);
         return NULL;
     }
 
     onion_c->dht = c->dht;
     onion_c->net = c->dht->net;
+    onion_c->mono_time = c->dht->mono_time;
     onion_c->c = c;
     new_symmetric_key(onion_c->secret_symmetric_key);
     crypto_box_keypair(onion_c->temp_public_key, onion_c->temp_secret_key);
@@ -1510,11 +1723,17 @@ void kill_onion_client(Onion_Client *onion_c)
 
     ping_array_free_all(&onion_c->announce_ping_array);
     realloc_onion_friends(onion_c, 0);
-    networking_registerhandler(onion_c->net, NET_PACKET_ANNOUNCE_RESPONSE, NULL, NULL);
-    networking_registerhandler(onion_c->net, NET_PACKET_ONION_DATA_RESPONSE, NULL, NULL);
     oniondata_registerhandler(onion_c, ONION_DATA_DHTPK, NULL, NULL);
-    cryptopacket_registerhandler(onion_c->dht, CRYPTO_PACKET_DHTPK, NULL, NULL);
-    set_onion_packet_tcp_connection_callback(onion_c->c->tcp_c, NULL, NULL);
+
+    if (onion_c->host) {
+        host_remove_account(onion_c->host, onion_c);
+    } else {
+        networking_registerhandler(onion_c->net, NET_PACKET_ANNOUNCE_RESPONSE, NULL, NULL);
+        networking_registerhandler(onion_c->net, NET_PACKET_ONION_DATA_RESPONSE, NULL, NULL);
+        cryptopacket_registerhandler(onion_c->dht, CRYPTO_PACKET_DHTPK, NULL, NULL);
+        set_onion_packet_tcp_connection_callback(onion_c->c->tcp_c, NULL, NULL);
+    }
+
     memset(onion_c, 0, sizeof(Onion_Client));
     free(onion_c);
 }
@@ -123,10 +123,14 @@ typedef struct {
 typedef int (*oniondata_handler_callback)(void *object, const uint8_t *source_pubkey, const uint8_t *data,
         uint16_t len);
 
+typedef struct Onion_Client_Host Onion_Client_Host;
+
 typedef struct {
     DHT     *dht;
     Net_Crypto *c;
     Networking_Core *net;
+    Mono_Time *mono_time; /* the one of net */
+    Onion_Client_Host *host; /* Set if the instance is one of the accounts of a host. */
     Onion_Friend    *friends_list;
     uint16_t       num_friends;
 
@@ -162,6 +166,26 @@ typedef struct {
     _Bool UDP_connected;
 } Onion_Client;
 
+/* The parts of the onion client shared by the accounts of a host: the socket handlers and the
+ * temporary key data packets are sent to.
+ *
+ * Announce responses go to the account whose ping array has their sendback. Data packets have
+ * their outer layer decrypted once and are then tried on the accounts that are friends with the
+ * sender. Only friend requests are tried on the other accounts, so one costs a decryption for
+ * every account that isn't a friend of its sender.
+ */
+struct Onion_Client_Host {
+    DHT *dht;
+    Networking_Core *net;
+    TCP_Connections *tcp_c;
+
+    uint8_t temp_public_key[crypto_box_PUBLICKEYBYTES];
+    uint8_t temp_secret_key[crypto_box_SECRETKEYBYTES];
+
+    Onion_Client **accounts;
+    uint32_t num_accounts;
+};
+
 
 /* Add a node to the path_nodes bootstrap array.
  *
@@ -277,6 +301,21 @@ void do_onion_client(Onion_Client *onion_c);
 
 Onion_Client *new_onion_client(Net_Crypto *c);
 
+/* Create the shared part of the onion client for the accounts of c_host.
+ *
+ * return NULL on failure.
+ */
+Onion_Client_Host *new_onion_client_host(Net_Crypto_Host *c_host);
+
+/* Create the onion client of an account of host, c being the net_crypto of the account.
+ * It is killed with kill_onion_client(), which must be done before killing the host.
+ *
+ * return NULL on failure.
+ */
+Onion_Client *new_onion_client_hosted(Onion_Client_Host *host, Net_Crypto *c);
+
+void kill_onion_client_host(Onion_Client_Host *host);
+
 void kill_onion_client(Onion_Client *onion_c);
 
 
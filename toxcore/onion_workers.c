@@ -0,0 +1,391 @@
+/*
+* onion_workers.c -- Forwarding of onion packets on worker threads.
+*
+*  Copyright (C) 2016 Tox project All Rights Reserved.
+*
+*  This file is part of Tox.
+*
+*  Tox is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  Tox is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "onion_workers.h"
+#include "util.h"
+
+#include <stdbool.h>
+
+/* Responses for TCP clients waiting to be handed to the node by do_onion_workers() */
+#define ONION_WORKER_TCP_QUEUE_SIZE 256
+
+static const uint8_t onion_packet_ids[] = {
+    NET_PACKET_ONION_SEND_INITIAL,
+    NET_PACKET_ONION_SEND_1,
+    NET_PACKET_ONION_SEND_2,
+    NET_PACKET_ONION_RECV_3,
+    NET_PACKET_ONION_RECV_2,
+    NET_PACKET_ONION_RECV_1
+};
+
+#define NUM_ONION_PACKET_IDS (sizeof(onion_packet_ids) / sizeof(onion_packet_ids[0]))
+
+typedef struct {
+    IP_Port     ip_port;
+    uint16_t    length;
+    uint8_t     data[ONION_MAX_PACKET_SIZE];
+} Onion_Worker_Packet;
+
+typedef struct {
+    Onion_Worker_Packet *packets;
+    uint32_t    capacity;
+    uint32_t    start;
+    uint32_t    size;
+} Onion_Worker_Queue;
+
+typedef struct {
+    Onion_Workers *workers;
+    pthread_t   thread;
+    pthread_mutex_t lock;   /* guards everything below but onion */
+    pthread_cond_t cond;
+    bool        stop;
+
+    Onion       onion;   /* copy of the node's onion with shared keys of its own, only used by the worker */
+    uint8_t     new_key[crypto_box_KEYBYTES];
+    bool        has_new_key;
+
+    Onion_Worker_Queue in;    /* packets to forward */
+    Onion_Worker_Queue tcp;   /* responses for TCP clients of the node */
+
+    uint64_t    handled;
+    uint64_t    dropped;
+} Onion_Worker;
+
+struct Onion_Workers {
+    Onion       *onion;
+    Packet_Handles handlers[NUM_ONION_PACKET_IDS];   /* the onion's own handlers, run by the workers */
+    uint8_t     key[crypto_box_KEYBYTES];   /* the key the workers were last given */
+
+    Onion_Worker *workers;
+    uint32_t    num_workers;   /* the ones that were started */
+};
+
+static int queue_init(Onion_Worker_Queue *queue, uint32_t capacity)
+{
+    queue->packets = malloc(capacity * sizeof(Onion_Worker_Packet));
+
+    if (queue->packets == NULL)
+        return -1;
+
+    queue->capacity = capacity;
+    queue->start = 0;
+    queue->size = 0;
+    return 0;
+}
+
+static bool queue_push(Onion_Worker_Queue *queue, IP_Port ip_port, const uint8_t *data, uint16_t length)
+{
+    if (queue->size == queue->capacity || length > ONION_MAX_PACKET_SIZE)
+        return false;
+
+    Onion_Worker_Packet *packet = &queue->packets[(queue->start + queue->size) % queue->capacity];
+    packet->ip_port = ip_port;
+    packet->length = length;
+    memcpy(packet->data, data, length);
+    ++queue->size;
+    return true;
+}
+
+static void queue_pop(Onion_Worker_Queue *queue, Onion_Worker_Packet *dest)
+{
+    const Onion_Worker_Packet *packet = &queue->packets[queue->start];
+    dest->ip_port = packet->ip_port;
+    dest->length = packet->length;
+    memcpy(dest->data, packet->data, packet->length);
+    queue->start = (queue->start + 1) % queue->capacity;
+    --queue->size;
+}
+
+/* Picks the worker for the packets from ip_port. */
+static uint32_t source_hash(const IP_Port *ip_port)
+{
+    uint32_t hash = ip_port->port;
+
+    if (ip_port->ip.family == AF_INET) {
+        hash ^= ip_port->ip.ip4.uint32;
+    } else {
+        uint32_t i;
+
+        for (i = 0; i < 4; ++i)
+            hash = hash * 31 + ip_port->ip.ip6.uint32[i];
+    }
+
+    return hash * 2654435761u;
+}
+
+/* Called by the worker's copy of the onion in place of the node's callback. */
+static int queue_tcp_response(void *object, IP_Port dest, const uint8_t *data, uint16_t length)
+{
+    Onion_Worker *worker = object;
+
+    pthread_mutex_lock(&worker->lock);
+    bool queued = queue_push(&worker->tcp, dest, data, length);
+    pthread_mutex_unlock(&worker->lock);
+
+    return queued ? 0 : 1;
+}
+
+static int handle_worker_packet(Onion_Worker *worker, const Onion_Worker_Packet *packet)
+{
+    const Onion_Workers *workers = worker->workers;
+    uint32_t i;
+
+    for (i = 0; i < NUM_ONION_PACKET_IDS; ++i) {
+        if (onion_packet_ids[i] == packet->data[0] && workers->handlers[i].function)
+            return workers->handlers[i].function(&worker->onion, packet->ip_port, packet->data, packet->length);
+    }
+
+    return 1;
+}
+
+static void *onion_worker_thread(void *arg)
+{
+    Onion_Worker *worker = arg;
+    Onion_Worker_Packet packet;
+
+    pthread_mutex_lock(&worker->lock);
+
+    while (1) {
+        while (worker->in.size == 0 && !worker->stop)
+            pthread_cond_wait(&worker->cond, &worker->lock);
+
+        if (worker->stop)
+            break;
+
+        if (worker->has_new_key) {
+            memcpy(worker->onion.secret_symmetric_key, worker->new_key, crypto_box_KEYBYTES);
+            worker->has_new_key = false;
+        }
+
+        queue_pop(&worker->in, &packet);
+        pthread_mutex_unlock(&worker->lock);
+
+        int ret = handle_worker_packet(worker, &packet);
+
+        pthread_mutex_lock(&worker->lock);
+
+        if (ret == 0)
+            ++worker->handled;
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+    return NULL;
+}
+
+/* Takes the place of the onion's handlers on the thread that polls the network. */
+static int queue_onion_packet(void *object, IP_Port source, const uint8_t *packet, uint16_t length)
+{
+    Onion_Workers *workers = object;
+    Onion_Worker *worker = &workers->workers[source_hash(&source) % workers->num_workers];
+
+    pthread_mutex_lock(&worker->lock);
+    bool queued = queue_push(&worker->in, source, packet, length);
+
+    if (queued)
+        pthread_cond_signal(&worker->cond);
+    else
+        ++worker->dropped;
+
+    pthread_mutex_unlock(&worker->lock);
+
+    return queued ? 0 : 1;
+}
+
+static int start_worker(Onion_Workers *workers, Onion_Worker *worker)
+{
+    worker->workers = workers;
+
+    if (queue_init(&worker->in, ONION_WORKER_QUEUE_SIZE) == -1)
+        return -1;
+
+    if (queue_init(&worker->tcp, ONION_WORKER_TCP_QUEUE_SIZE) == -1) {
+        free(worker->in.packets);
+        return -1;
+    }
+
+    memcpy(&worker->onion, workers->onion, sizeof(Onion));
+    memset(&worker->onion.shared_keys_1, 0, sizeof(Shared_Keys));
+    memset(&worker->onion.shared_keys_2, 0, sizeof(Shared_Keys));
+    memset(&worker->onion.shared_keys_3, 0, sizeof(Shared_Keys));
+
+    /* The copy never replaces its key itself, do_onion_workers() hands it the node's */
+    worker->onion.timestamp = UINT64_MAX / 2;
+    worker->onion.recv_1_function = &queue_tcp_response;
+    worker->onion.callback_object = worker;
+
+    if (pthread_mutex_init(&worker->lock, NULL) != 0)
+        goto fail_queues;
+
+    if (pthread_cond_init(&worker->cond, NULL) != 0)
+        goto fail_lock;
+
+    if (pthread_create(&worker->thread, NULL, &onion_worker_thread, worker) != 0)
+        goto fail_cond;
+
+    return 0;
+
+fail_cond:
+    pthread_cond_destroy(&worker->cond);
+fail_lock:
+    pthread_mutex_destroy(&worker->lock);
+fail_queues:
+    free(worker->in.packets);
+    free(worker->tcp.packets);
+    return -1;
+}
+
+Onion_Workers *new_onion_workers(Onion *onion, uint32_t num_workers)
+{
+    if (onion == NULL || num_workers == 0 || num_workers > MAX_ONION_WORKERS)
+        return NULL;
+
+    Onion_Workers *workers = calloc(1, sizeof(Onion_Workers));
+
+    if (workers == NULL)
+        return NULL;
+
+    workers->onion = onion;
+    memcpy(workers->key, onion->secret_symmetric_key, crypto_box_KEYBYTES);
+
+    uint32_t i;
+
+    for (i = 0; i < NUM_ONION_PACKET_IDS; ++i) {
+        workers->handlers[i] = onion->net->packethandlers[onion_packet_ids[i]];
+
+        /* The workers call the handlers with their own copy of the onion */
+        if (workers->handlers[i].object != onion) {
+            free(workers);
+            return NULL;
+        }
+    }
+
+    workers->workers = calloc(num_workers, sizeof(Onion_Worker));
+
+    if (workers->workers == NULL) {
+        free(workers);
+        return NULL;
+    }
+
+    for (i = 0; i < num_workers; ++i) {
+        if (start_worker(workers, &workers->workers[i]) == -1) {
+            kill_onion_workers(workers);
+            return NULL;
+        }
+
+        ++workers->num_workers;
+    }
+
+    for (i = 0; i < NUM_ONION_PACKET_IDS; ++i)
+        networking_registerhandler(onion->net, onion_packet_ids[i], &queue_onion_packet, workers);
+
+    return workers;
+}
+
+void do_onion_workers(Onion_Workers *workers)
+{
+    Onion *onion = workers->onion;
+
+    onion_refresh_symmetric_key(onion);
+
+    bool new_key = memcmp(workers->key, onion->secret_symmetric_key, crypto_box_KEYBYTES) != 0;
+
+    if (new_key)
+        memcpy(workers->key, onion->secret_symmetric_key, crypto_box_KEYBYTES);
+
+    Onion_Worker_Packet packet;
+    uint32_t i;
+
+    for (i = 0; i < workers->num_workers; ++i) {
+        Onion_Worker *worker = &workers->workers[i];
+
+        pthread_mutex_lock(&worker->lock);
+
+        if (new_key) {
+            memcpy(worker->new_key, workers->key, crypto_box_KEYBYTES);
+            worker->has_new_key = true;
+        }
+
+        while (worker->tcp.size > 0) {
+            queue_pop(&worker->tcp, &packet);
+            pthread_mutex_unlock(&worker->lock);
+
+            if (onion->recv_1_function)
+                onion->recv_1_function(onion->callback_object, packet.ip_port, packet.data, packet.length);
+
+            pthread_mutex_lock(&worker->lock);
+        }
+
+        pthread_mutex_unlock(&worker->lock);
+    }
+}
+
+void onion_workers_stats(Onion_Workers *workers, uint64_t *handled, uint64_t *dropped)
+{
+    *handled = 0;
+    *dropped = 0;
+
+    uint32_t i;
+
+    for (i = 0; i < workers->num_workers; ++i) {
+        Onion_Worker *worker = &workers->workers[i];
+
+        pthread_mutex_lock(&worker->lock);
+        *handled += worker->handled;
+        *dropped += worker->dropped;
+        pthread_mutex_unlock(&worker->lock);
+    }
+}
+
+void kill_onion_workers(Onion_Workers *workers)
+{
+    if (workers == NULL)
+        return;
+
+    uint32_t i;
+
+    for (i = 0; i < NUM_ONION_PACKET_IDS; ++i) {
+        if (workers->onion->net->packethandlers[onion_packet_ids[i]].object == workers)
+            networking_registerhandler(workers->onion->net, onion_packet_ids[i], workers->handlers[i].function,
+                                       workers->handlers[i].object);
+    }
+
+    for (i = 0; i < workers->num_workers; ++i) {
+        Onion_Worker *worker = &workers->workers[i];
+
+        pthread_mutex_lock(&worker->lock);
+        worker->stop = true;
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->lock);
+
+        pthread_join(worker->thread, NULL);
+        pthread_cond_destroy(&worker->cond);
+        pthread_mutex_destroy(&worker->lock);
+        free(worker->in.packets);
+        free(worker->tcp.packets);
+    }
+
+    free(workers->workers);
+    free(workers);
+}
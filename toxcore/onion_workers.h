@@ -0,0 +1,62 @@
+/*
+* onion_workers.h -- Forwarding of onion packets on worker threads.
+*
+*  Copyright (C) 2016 Tox project All Rights Reserved.
+*
+*  This file is part of Tox.
+*
+*  Tox is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  Tox is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with Tox.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#ifndef ONION_WORKERS_H
+#define ONION_WORKERS_H
+
+#include "onion.h"
+
+/* Packets waiting for each worker, packets that don't fit are dropped like a full socket would. */
+#define ONION_WORKER_QUEUE_SIZE 1024
+
+#define MAX_ONION_WORKERS 64
+
+typedef struct Onion_Workers Onion_Workers;
+
+/* Hands the onion packets that reach the socket of onion over to num_workers threads which
+ * decrypt and forward them, so that a node relaying many onion paths isn't limited to one core.
+ *
+ * The thread that calls networking_poll() only queues them. All the packets from one address go
+ * to the same worker so that they are forwarded in the order they came in. Each worker keeps
+ * shared keys of its own so they don't need a lock.
+ *
+ * Must be called once the DHT keys are set and onion's callbacks are set, and from the process
+ * that runs the node.
+ *
+ * return NULL on failure.
+ */
+Onion_Workers *new_onion_workers(Onion *onion, uint32_t num_workers);
+
+/* To be called on the thread that calls networking_poll(), hands the workers new keys and the
+ * responses for the TCP clients of onion's callback to it.
+ */
+void do_onion_workers(Onion_Workers *workers);
+
+/* Sets handled to the number of packets the workers have forwarded and dropped to those that
+ * were dropped because their worker was too busy.
+ */
+void onion_workers_stats(Onion_Workers *workers, uint64_t *handled, uint64_t *dropped);
+
+/* Stops the workers and lets onion handle its packets itself again. */
+void kill_onion_workers(Onion_Workers *workers);
+
+#endif
@@ -225,7 +225,8 @@ static int handle_ping_response(void *_dht, IP_Port source, const uint8_t *packe
  * return 1 if it is.
  * return 0 if it isn't.
  */
-static int in_list(const Client_data *list, uint16_t length, const uint8_t *client_id, IP_Port ip_port)
+static int in_list(const Mono_Time *mono_time, const Client_data *list, uint16_t length, const uint8_t *client_id,
+                   IP_Port ip_port)
 {
     uint32_t i;
 
@@ -239,7 +240,7 @@ static int in_list(const Client_data *list, uint16_t length, const uint8_t *clie
                 ipptp = &list[i].assoc6;
             }
 
-            if (!is_timeout(ipptp->timestamp, BAD_NODE_TIMEOUT) && ipport_equal(&ipptp->ip_port, &ip_port))
+            if (!is_timeout(mono_time, ipptp->timestamp, BAD_NODE_TIMEOUT) && ipport_equal(&ipptp->ip_port, &ip_port))
                 return 1;
         }
     }
@@ -262,7 +263,7 @@ int add_to_ping(PING *ping, const uint8_t *client_id, IP_Port ip_port)
     if (!ip_isset(&ip_port.ip))
         return -1;
 
-    if (in_list(ping->dht->close_clientlist, LCLIENT_LIST, client_id, ip_port))
+    if (in_list(ping->dht->mono_time, ping->dht->close_clientlist, LCLIENT_LIST, client_id, ip_port))
         return -1;
 
     uint32_t i;
@@ -298,7 +299,7 @@ int add_to_ping(PING *ping, const uint8_t *client_id, IP_Port ip_port)
  */
 void do_to_ping(PING *ping)
 {
-    if (!is_timeout(ping->last_to_ping, TIME_TO_PING))
+    if (!is_timeout(ping->dht->mono_time, ping->last_to_ping, TIME_TO_PING))
         return;
 
     if (!ip_isset(&ping->to_ping[0].ip_port.ip))
@@ -315,7 +316,7 @@ void do_to_ping(PING *ping)
     }
 
     if (i != 0)
-        ping->last_to_ping = unix_time();
+        ping->last_to_ping = unix_time(ping->dht->mono_time);
 }
 
 
@@ -326,7 +327,7 @@ PING *new_ping(DHT *dht)
     if (ping == NULL)
         return NULL;
 
-    if (ping_array_init(&ping->ping_array, PING_NUM_MAX, PING_TIMEOUT) != 0) {
+    if (ping_array_init(&ping->ping_array, dht->mono_time, PING_NUM_MAX, PING_TIMEOUT, PING_DATA_SIZE) != 0) {
         free(ping);
         return NULL;
     }
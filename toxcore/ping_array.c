@@ -32,13 +32,16 @@
 
 static void clear_entry(Ping_Array *array, uint32_t index)
 {
-    free(array->entries[index].data);
-    array->entries[index].data = NULL;
     array->entries[index].length =
         array->entries[index].time =
             array->entries[index].ping_id = 0;
 }
 
+static uint8_t *entry_data(const Ping_Array *array, uint32_t index)
+{
+    return array->data + (size_t)index * array->max_data_length;
+}
+
 /* Clear timed out entries.
  */
 static void ping_array_clear_timedout(Ping_Array *array)
@@ -46,7 +49,7 @@ static void ping_array_clear_timedout(Ping_Array *array)
     while (array->last_deleted != array->last_added) {
         uint32_t index = array->last_deleted % array->total_size;
 
-        if (!is_timeout(array->entries[index].time, array->timeout))
+        if (!is_timeout(array->mono_time, array->entries[index].time, array->timeout))
             break;
 
         clear_entry(array, index);
@@ -61,22 +64,20 @@ static void ping_array_clear_timedout(Ping_Array *array)
  */
 uint64_t ping_array_add(Ping_Array *array, const uint8_t *data, uint32_t length)
 {
+    if (length > array->max_data_length)
+        return 0;
+
     ping_array_clear_timedout(array);
     uint32_t index = array->last_added % array->total_size;
 
-    if (array->entries[index].data != NULL) {
+    if (array->entries[index].ping_id != 0) {
         array->last_deleted = array->last_added - array->total_size;
         clear_entry(array, index);
     }
 
-    array->entries[index].data = malloc(length);
-
-    if (array->entries[index].data == NULL)
-        return 0;
-
-    memcpy(array->entries[index].data, data, length);
+    memcpy(entry_data(array, index), data, length);
     array->entries[index].length = length;
-    array->entries[index].time = unix_time();
+    array->entries[index].time = unix_time(array->mono_time);
     ++array->last_added;
     uint64_t ping_id = random_64b();
     ping_id /= array->total_size;
@@ -108,41 +109,48 @@ int ping_array_check(uint8_t *data, uint32_t length, Ping_Array *array, uint64_t
     if (array->entries[index].ping_id != ping_id)
         return -1;
 
-    if (is_timeout(array->entries[index].time, array->timeout))
+    if (is_timeout(array->mono_time, array->entries[index].time, array->timeout))
         return -1;
 
     if (array->entries[index].length > length)
         return -1;
 
-    if (array->entries[index].data == NULL)
-        return -1;
-
-    memcpy(data, array->entries[index].data, array->entries[index].length);
+    memcpy(data, entry_data(array, index), array->entries[index].length);
     uint32_t len = array->entries[index].length;
     clear_entry(array, index);
     return len;
 }
 
-/* Initialize a Ping_Array.
+/* Initialize a Ping_Array whose entries time out on mono_time.
  * size represents the total size of the array and should be a power of 2.
  * timeout represents the maximum timeout in seconds for the entry.
+ * max_data_length is the largest data that will be added, room for it is allocated for every entry.
  *
  * return 0 on success.
  * return -1 on failure.
  */
-int ping_array_init(Ping_Array *empty_array, uint32_t size, uint32_t timeout)
+int ping_array_init(Ping_Array *empty_array, const Mono_Time *mono_time, uint32_t size, uint32_t timeout,
+                    uint32_t max_data_length)
 {
-    if (size == 0 || timeout == 0 || empty_array == NULL)
+    if (size == 0 || timeout == 0 || max_data_length == 0 || empty_array == NULL)
         return -1;
 
     empty_array->entries = calloc(size, sizeof(Ping_Array_Entry));
+    empty_array->data = malloc((size_t)size * max_data_length);
 
-    if (empty_array->entries == NULL)
+    if (empty_array->entries == NULL || empty_array->data == NULL) {
+        free(empty_array->entries);
+        free(empty_array->data);
+        empty_array->entries = NULL;
+        empty_array->data = NULL;
         return -1;
+    }
 
+    empty_array->max_data_length = max_data_length;
     empty_array->last_deleted = empty_array->last_added = 0;
     empty_array->total_size = size;
     empty_array->timeout = timeout;
+    empty_array->mono_time = mono_time;
     return 0;
 }
 
@@ -157,6 +165,8 @@ void ping_array_free_all(Ping_Array *array)
     }
 
     free(array->entries);
+    free(array->data);
     array->entries = NULL;
+    array->data = NULL;
 }
 
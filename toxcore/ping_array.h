@@ -26,24 +26,30 @@
 #include "network.h"
 
 typedef struct {
-    void *data;
     uint32_t length;
     uint64_t time;
-    uint64_t ping_id;
+    uint64_t ping_id; /* 0 if the entry is empty. */
 } Ping_Array_Entry;
 
 
 typedef struct {
     Ping_Array_Entry *entries;
 
+    /* The data of entry i is at data + i * max_data_length, so that adding never allocates. */
+    uint8_t *data;
+    uint32_t max_data_length;
+
     uint32_t last_deleted; /* number representing the next entry to be deleted. */
     uint32_t last_added; /* number representing the last entry to be added. */
     uint32_t total_size; /* The length of entries */
     uint32_t timeout; /* The timeout after which entries are cleared. */
+
+    const Mono_Time *mono_time;
 } Ping_Array;
 
 
 /* Add a data with length to the Ping_Array list and return a ping_id.
+ * length must not be larger than the max_data_length the array was initialized with.
  *
  * return ping_id on success.
  * return 0 on failure.
@@ -59,14 +65,16 @@ uint64_t ping_array_add(Ping_Array *array, const uint8_t *data, uint32_t length)
  */
 int ping_array_check(uint8_t *data, uint32_t length, Ping_Array *array, uint64_t ping_id);
 
-/* Initialize a Ping_Array.
+/* Initialize a Ping_Array whose entries time out on mono_time.
  * size represents the total size of the array and should be a power of 2.
  * timeout represents the maximum timeout in seconds for the entry.
+ * max_data_length is the largest data that will be added, room for it is allocated for every entry.
  *
  * return 0 on success.
  * return -1 on failure.
  */
-int ping_array_init(Ping_Array *empty_array, uint32_t size, uint32_t timeout);
+int ping_array_init(Ping_Array *empty_array, const Mono_Time *mono_time, uint32_t size, uint32_t timeout,
+                    uint32_t max_data_length);
 
 /* Free all the allocated memory in a Ping_Array.
  */
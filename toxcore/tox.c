@@ -29,16 +29,28 @@
 #include "group_chats.h"
 #include "group_moderation.h"
 #include "logger.h"
+#include "util.h"
 
 #include "../toxencryptsave/defines.h"
 
 #define TOX_DEFINED
 typedef struct Messenger Tox;
 
+#define TOX_HOST_DEFINED
+typedef struct Messenger_Host Tox_Host;
+
 #include "tox.h"
 
 #define SET_ERROR_PARAMETER(param, x) {if(param) {*param = x;}}
 
+#if TOX_STATS_HISTOGRAM_BUCKETS != CRYPTO_HISTOGRAM_BUCKETS
+#error TOX_STATS_HISTOGRAM_BUCKETS is assumed to be equal to CRYPTO_HISTOGRAM_BUCKETS
+#endif
+
+#if TOX_STATS_DROP_REASONS != CRYPTO_DROP_REASONS
+#error TOX_STATS_DROP_REASONS is assumed to be equal to CRYPTO_DROP_REASONS
+#endif
+
 #if TOX_HASH_LENGTH != crypto_hash_sha256_BYTES
 #error TOX_HASH_LENGTH is assumed to be equal to crypto_hash_sha256_BYTES
 #endif
@@ -122,7 +134,87 @@ void tox_options_free(struct Tox_Options *options)
     free(options);
 }
 
-Tox *tox_new(const struct Tox_Options *options, TOX_ERR_NEW *error)
+/* Translates the options other than the savedata to m_options.
+ *
+ * return 0 on failure.
+ */
+static _Bool messenger_options_from(const struct Tox_Options *options, Messenger_Options *m_options, TOX_ERR_NEW *error)
+{
+    m_options->ipv6enabled = options->ipv6_enabled;
+    m_options->udp_disabled = !options->udp_enabled;
+    m_options->port_range[0] = options->start_port;
+    m_options->port_range[1] = options->end_port;
+    m_options->tcp_server_port = options->tcp_port;
+    m_options->crypto_threads = options->crypto_threads;
+
+    switch (options->congestion_control) {
+        case TOX_CONGESTION_CONTROL_DEFAULT:
+            m_options->congestion_control = CONGESTION_CONTROL_DEFAULT;
+            break;
+
+        case TOX_CONGESTION_CONTROL_LEDBAT:
+            m_options->congestion_control = CONGESTION_CONTROL_LEDBAT;
+            break;
+
+        case TOX_CONGESTION_CONTROL_BBR:
+            m_options->congestion_control = CONGESTION_CONTROL_BBR;
+            break;
+
+        default:
+            SET_ERROR_PARAMETER(error, TOX_ERR_NEW_BAD_CONGESTION_CONTROL);
+            return 0;
+    }
+
+    m_options->coalesce_packets = options->coalesce_lossless_packets;
+    m_options->group_history_dir = options->group_history_dir;
+    m_options->group_history_size = options->group_history_size;
+    m_options->shared_group_key = options->shared_group_key;
+    m_options->concurrent_send = options->concurrent_send;
+    m_options->clock.function = options->time_callback;
+    m_options->clock.object = options->time_user_data;
+
+    switch (options->proxy_type) {
+        case TOX_PROXY_TYPE_HTTP:
+            m_options->proxy_info.proxy_type = TCP_PROXY_HTTP;
+            break;
+
+        case TOX_PROXY_TYPE_SOCKS5:
+            m_options->proxy_info.proxy_type = TCP_PROXY_SOCKS5;
+            break;
+
+        case TOX_PROXY_TYPE_NONE:
+            m_options->proxy_info.proxy_type = TCP_PROXY_NONE;
+            break;
+
+        default:
+            SET_ERROR_PARAMETER(error, TOX_ERR_NEW_PROXY_BAD_TYPE);
+            return 0;
+    }
+
+    if (m_options->proxy_info.proxy_type != TCP_PROXY_NONE) {
+        if (options->proxy_port == 0) {
+            SET_ERROR_PARAMETER(error, TOX_ERR_NEW_PROXY_BAD_PORT);
+            return 0;
+        }
+
+        ip_init(&m_options->proxy_info.ip_port.ip, m_options->ipv6enabled);
+
+        if (m_options->ipv6enabled)
+            m_options->proxy_info.ip_port.ip.family = AF_UNSPEC;
+
+        if (!addr_resolve_or_parse_ip(options->proxy_host, &m_options->proxy_info.ip_port.ip, NULL)) {
+            SET_ERROR_PARAMETER(error, TOX_ERR_NEW_PROXY_BAD_HOST);
+            //TODO: TOX_ERR_NEW_PROXY_NOT_FOUND if domain.
+            return 0;
+        }
+
+        m_options->proxy_info.ip_port.port = htons(options->proxy_port);
+    }
+
+    return 1;
+}
+
+static Tox *new_tox(const struct Tox_Options *options, Messenger_Host *host, TOX_ERR_NEW *error)
 {
     if (!logger_get_global())
         logger_set_global(logger_new(LOGGER_OUTPUT_FILE, LOGGER_LEVEL, "toxcore"));
@@ -162,54 +254,20 @@ Tox *tox_new(const struct Tox_Options *options, TOX_ERR_NEW *error)
             load_savedata_tox = 1;
         }
 
-        m_options.ipv6enabled = options->ipv6_enabled;
-        m_options.udp_disabled = !options->udp_enabled;
-        m_options.port_range[0] = options->start_port;
-        m_options.port_range[1] = options->end_port;
-        m_options.tcp_server_port = options->tcp_port;
-
-        switch (options->proxy_type) {
-            case TOX_PROXY_TYPE_HTTP:
-                m_options.proxy_info.proxy_type = TCP_PROXY_HTTP;
-                break;
-
-            case TOX_PROXY_TYPE_SOCKS5:
-                m_options.proxy_info.proxy_type = TCP_PROXY_SOCKS5;
-                break;
-
-            case TOX_PROXY_TYPE_NONE:
-                m_options.proxy_info.proxy_type = TCP_PROXY_NONE;
-                break;
-
-            default:
-                SET_ERROR_PARAMETER(error, TOX_ERR_NEW_PROXY_BAD_TYPE);
-                return NULL;
-        }
-
-        if (m_options.proxy_info.proxy_type != TCP_PROXY_NONE) {
-            if (options->proxy_port == 0) {
-                SET_ERROR_PARAMETER(error, TOX_ERR_NEW_PROXY_BAD_PORT);
-                return NULL;
-            }
-
-            ip_init(&m_options.proxy_info.ip_port.ip, m_options.ipv6enabled);
-
-            if (m_options.ipv6enabled)
-                m_options.proxy_info.ip_port.ip.family = AF_UNSPEC;
-
-            if (!addr_resolve_or_parse_ip(options->proxy_host, &m_options.proxy_info.ip_port.ip, NULL)) {
-                SET_ERROR_PARAMETER(error, TOX_ERR_NEW_PROXY_BAD_HOST);
-                //TODO: TOX_ERR_NEW_PROXY_NOT_FOUND if domain.
-                return NULL;
-            }
-
-            m_options.proxy_info.ip_port.port = htons(options->proxy_port);
-        }
+        if (!messenger_options_from(options, &m_options, error))
+            return NULL;
     }
 
+    m_options.host = host;
+
     unsigned int m_error;
     Messenger *m = new_messenger(&m_options, &m_error);
 
+    if (m == NULL) {
+        SET_ERROR_PARAMETER(error, m_error == MESSENGER_ERROR_OTHER ? TOX_ERR_NEW_MALLOC : TOX_ERR_NEW_PORT_ALLOC);
+        return NULL;
+    }
+
     if (load_savedata_tox && messenger_load(m, options->savedata_data, options->savedata_length) == -1) {
         SET_ERROR_PARAMETER(error, TOX_ERR_NEW_LOAD_BAD_FORMAT);
     } else if (load_savedata_sk) {
@@ -222,6 +280,11 @@ Tox *tox_new(const struct Tox_Options *options, TOX_ERR_NEW *error)
     return m;
 }
 
+Tox *tox_new(const struct Tox_Options *options, TOX_ERR_NEW *error)
+{
+    return new_tox(options, NULL, error);
+}
+
 void tox_kill(Tox *tox)
 {
     Messenger *m = tox;
@@ -244,7 +307,9 @@ void tox_get_savedata(const Tox *tox, uint8_t *data)
     }
 }
 
-bool tox_bootstrap(Tox *tox, const char *address, uint16_t port, const uint8_t *public_key, TOX_ERR_BOOTSTRAP *error)
+/* Bootstraps dht and, if it isn't NULL, adds the node to the onion paths of onion_c. */
+static bool bootstrap(DHT *dht, Onion_Client *onion_c, const char *address, uint16_t port, const uint8_t *public_key,
+                      TOX_ERR_BOOTSTRAP *error)
 {
     if (!address || !public_key) {
         SET_ERROR_PARAMETER(error, TOX_ERR_BOOTSTRAP_NULL);
@@ -284,9 +349,10 @@ bool tox_bootstrap(Tox *tox, const char *address, uint16_t port, const uint8_t *
             continue;
         }
 
-        Messenger *m = tox;
-        onion_add_bs_path_node(m->onion_c, ip_port, public_key);
-        DHT_bootstrap(m->dht, ip_port, public_key);
+        if (onion_c)
+            onion_add_bs_path_node(onion_c, ip_port, public_key);
+
+        DHT_bootstrap(dht, ip_port, public_key);
         ++count;
     } while ((info = info->ai_next));
 
@@ -301,6 +367,12 @@ bool tox_bootstrap(Tox *tox, const char *address, uint16_t port, const uint8_t *
     }
 }
 
+bool tox_bootstrap(Tox *tox, const char *address, uint16_t port, const uint8_t *public_key, TOX_ERR_BOOTSTRAP *error)
+{
+    Messenger *m = tox;
+    return bootstrap(m->dht, m->onion_c, address, port, public_key, error);
+}
+
 bool tox_add_tcp_relay(Tox *tox, const char *address, uint16_t port, const uint8_t *public_key,
                        TOX_ERR_BOOTSTRAP *error)
 {
@@ -392,6 +464,62 @@ void tox_iterate(Tox *tox)
     do_messenger(m);
 }
 
+Tox_Host *tox_host_new(const struct Tox_Options *options, TOX_ERR_NEW *error)
+{
+    if (!logger_get_global())
+        logger_set_global(logger_new(LOGGER_OUTPUT_FILE, LOGGER_LEVEL, "toxcore"));
+
+    Messenger_Options m_options = {0};
+
+    if (options == NULL) {
+        m_options.ipv6enabled = TOX_ENABLE_IPV6_DEFAULT;
+    } else if (!messenger_options_from(options, &m_options, error)) {
+        return NULL;
+    }
+
+    unsigned int m_error;
+    Messenger_Host *host = new_messenger_host(&m_options, &m_error);
+
+    if (host == NULL) {
+        SET_ERROR_PARAMETER(error, m_error == MESSENGER_ERROR_OTHER ? TOX_ERR_NEW_MALLOC : TOX_ERR_NEW_PORT_ALLOC);
+        return NULL;
+    }
+
+    SET_ERROR_PARAMETER(error, TOX_ERR_NEW_OK);
+    return host;
+}
+
+void tox_host_kill(Tox_Host *host)
+{
+    kill_messenger_host(host);
+}
+
+bool tox_host_bootstrap(Tox_Host *host, const char *address, uint16_t port, const uint8_t *public_key,
+                        TOX_ERR_BOOTSTRAP *error)
+{
+    return bootstrap(host->dht, NULL, address, port, public_key, error);
+}
+
+uint32_t tox_host_iteration_interval(const Tox_Host *host)
+{
+    return messenger_host_run_interval(host);
+}
+
+void tox_host_iterate(Tox_Host *host)
+{
+    do_messenger_host(host);
+}
+
+Tox *tox_new_hosted(Tox_Host *host, const struct Tox_Options *options, TOX_ERR_NEW *error)
+{
+    if (host == NULL) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_NEW_NULL);
+        return NULL;
+    }
+
+    return new_tox(options, host, error);
+}
+
 void tox_self_get_address(const Tox *tox, uint8_t *address)
 {
     if (address) {
@@ -1186,6 +1314,49 @@ bool tox_friend_send_lossy_packet(Tox *tox, uint32_t friend_number, const uint8_
     }
 }
 
+bool tox_friend_lossy_packet_set_fec(Tox *tox, uint32_t friend_number, uint8_t packet_id, uint8_t num_data,
+                                     uint8_t num_parity, TOX_ERR_FRIEND_CUSTOM_PACKET *error)
+{
+    Messenger *m = tox;
+
+    if (packet_id < (PACKET_ID_LOSSY_RANGE_START + PACKET_LOSSY_AV_RESERVED)) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_CUSTOM_PACKET_INVALID);
+        return 0;
+    }
+
+    int ret = m_set_lossy_fec(m, friend_number, packet_id, num_data, num_parity);
+
+    /* Parameters out of range are reported like an invalid first byte. */
+    set_custom_packet_error(ret == -2 ? -3 : ret, error);
+
+    if (ret == 0) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+bool tox_friend_lossy_packet_flush_fec(Tox *tox, uint32_t friend_number, uint8_t packet_id,
+                                       TOX_ERR_FRIEND_CUSTOM_PACKET *error)
+{
+    Messenger *m = tox;
+
+    if (packet_id < (PACKET_ID_LOSSY_RANGE_START + PACKET_LOSSY_AV_RESERVED)) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_CUSTOM_PACKET_INVALID);
+        return 0;
+    }
+
+    int ret = m_flush_lossy_fec(m, friend_number, packet_id);
+
+    set_custom_packet_error(ret, error);
+
+    if (ret == 0) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
 void tox_callback_friend_lossy_packet(Tox *tox, tox_friend_lossy_packet_cb *function, void *user_data)
 {
     Messenger *m = tox;
@@ -1259,6 +1430,151 @@ uint16_t tox_self_get_tcp_port(const Tox *tox, TOX_ERR_GET_PORT *error)
     }
 }
 
+static void copy_connection_counters(struct Tox_Connection_Counters *counters,
+                                     const Crypto_Connection_Counters *crypto_counters)
+{
+    unsigned int i;
+
+    counters->packets_sent = crypto_counters->packets_sent;
+    counters->bytes_sent = crypto_counters->bytes_sent;
+    counters->packets_sent_tcp = crypto_counters->packets_sent_tcp;
+    counters->packets_received = crypto_counters->packets_received;
+    counters->bytes_received = crypto_counters->bytes_received;
+    counters->packets_received_tcp = crypto_counters->packets_received_tcp;
+    counters->retransmits = crypto_counters->retransmits;
+    counters->congestion_events = crypto_counters->congestion_events;
+
+    for (i = 0; i < TOX_STATS_DROP_REASONS; ++i)
+        counters->drops[i] = crypto_counters->drops[i];
+
+    for (i = 0; i < TOX_STATS_HISTOGRAM_BUCKETS; ++i)
+        counters->rtt_histogram[i] = crypto_counters->rtt_histogram[i];
+}
+
+void tox_self_get_stats(const Tox *tox, struct Tox_Stats *stats)
+{
+    const Messenger *m = tox;
+    Networking_Stats net_stats;
+    Net_Crypto_Stats crypto_stats;
+    unsigned int i;
+
+    networking_get_stats(m->net, &net_stats);
+    net_crypto_stats(m->net_crypto, &crypto_stats);
+
+    memset(stats, 0, sizeof(struct Tox_Stats));
+    stats->udp_packets_sent = net_stats.packets_sent;
+    stats->udp_bytes_sent = net_stats.bytes_sent;
+    stats->udp_send_failures = net_stats.send_failures;
+    stats->udp_packets_received = net_stats.packets_received;
+    stats->udp_bytes_received = net_stats.bytes_received;
+    stats->udp_packets_unhandled = net_stats.packets_unhandled;
+
+    copy_connection_counters(&stats->friends, &crypto_stats.totals);
+    stats->connections = crypto_stats.connections;
+    stats->connections_established = crypto_stats.connections_established;
+    stats->connections_direct = crypto_stats.connections_direct;
+    stats->packets_no_connection = crypto_stats.packets_no_connection;
+
+    for (i = 0; i < TOX_STATS_HISTOGRAM_BUCKETS; ++i)
+        stats->handshake_histogram[i] = crypto_stats.handshake_histogram[i];
+
+    stats->tcp_relays = copy_tcp_relay_stats(m->net_crypto, NULL, 0);
+}
+
+bool tox_friend_get_stats(const Tox *tox, uint32_t friend_number, struct Tox_Friend_Stats *stats,
+                          TOX_ERR_FRIEND_QUERY *error)
+{
+    if (!stats) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_NULL);
+        return 0;
+    }
+
+    const Messenger *m = tox;
+    Crypto_Connection_Stats crypto_stats;
+    int ret = m_get_friend_connection_stats(m, friend_number, &crypto_stats);
+
+    if (ret == -1) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_FRIEND_NOT_FOUND);
+        return 0;
+    }
+
+    memset(stats, 0, sizeof(struct Tox_Friend_Stats));
+    SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_OK);
+
+    if (ret != 0)
+        return 1;
+
+    copy_connection_counters(&stats->counters, &crypto_stats.counters);
+    stats->connected = 1;
+    stats->established = crypto_stats.status == CRYPTO_CONN_ESTABLISHED;
+    stats->direct = crypto_stats.direct_connected;
+    stats->online_tcp_relays = crypto_stats.online_tcp_relays;
+    stats->send_rate = crypto_stats.send_rate;
+    stats->recv_rate = crypto_stats.recv_rate;
+    stats->rtt = crypto_stats.rtt;
+    stats->smoothed_rtt = crypto_stats.smoothed_rtt;
+    stats->send_queue = crypto_stats.send_queue;
+    stats->recv_queue = crypto_stats.recv_queue;
+    stats->handshake_time = crypto_stats.handshake_time;
+
+    if (crypto_stats.last_congestion_event) {
+        stats->since_congestion_event = current_time_monotonic(m->net->mono_time) - crypto_stats.last_congestion_event;
+    } else {
+        stats->since_congestion_event = UINT64_MAX;
+    }
+
+    return 1;
+}
+
+size_t tox_self_get_relay_stats(const Tox *tox, struct Tox_Relay_Stats *stats, size_t max)
+{
+    const Messenger *m = tox;
+
+    if (!stats)
+        return copy_tcp_relay_stats(m->net_crypto, NULL, 0);
+
+    if (max == 0)
+        return 0;
+
+    if (max > UINT16_MAX)
+        max = UINT16_MAX;
+
+    TCP_Relay_Stats *relays = calloc(max, sizeof(TCP_Relay_Stats));
+
+    if (!relays)
+        return 0;
+
+    unsigned int num = copy_tcp_relay_stats(m->net_crypto, relays, max);
+    uint64_t now = unix_time(m->net->mono_time);
+    unsigned int i;
+
+    for (i = 0; i < num; ++i) {
+        const TCP_Relay_Stats *relay = &relays[i];
+        struct Tox_Relay_Stats *out = &stats[i];
+
+        memset(out, 0, sizeof(struct Tox_Relay_Stats));
+        memcpy(out->public_key, relay->public_key, TOX_PUBLIC_KEY_SIZE);
+        ip_parse_addr(&relay->ip_port.ip, out->address, sizeof(out->address));
+        out->port = ntohs(relay->ip_port.port);
+        out->connected = relay->status == TCP_CONN_CONNECTED;
+        out->sleeping = relay->status == TCP_CONN_SLEEPING;
+        out->onion = relay->onion;
+        out->users = relay->lock_count;
+        out->reconnects = relay->reconnects;
+
+        if (relay->connected_time && relay->connected_time <= now)
+            out->connected_for = now - relay->connected_time;
+
+        out->packets_sent = relay->counters.packets_sent;
+        out->bytes_sent = relay->counters.bytes_sent;
+        out->packets_received = relay->counters.packets_received;
+        out->bytes_received = relay->counters.bytes_received;
+    }
+
+    free(relays);
+    return num;
+}
+
 /**************** GROUPCHAT FUNCTIONS *****************/
 
 void tox_callback_group_invite(Tox *tox, tox_group_invite_cb *function, void *userdata)
@@ -1279,6 +1595,12 @@ void tox_callback_group_private_message(Tox *tox, tox_group_private_message_cb *
     gc_callback_private_message(m, function, userdata);
 }
 
+void tox_callback_group_history_message(Tox *tox, tox_group_history_message_cb *function, void *userdata)
+{
+    Messenger *m = tox;
+    gc_callback_history_message(m, function, userdata);
+}
+
 void tox_callback_group_moderation(Tox *tox, tox_group_moderation_cb *function, void *userdata)
 {
     Messenger *m = tox;
@@ -1799,6 +2121,20 @@ TOX_GROUP_PRIVACY_STATE tox_group_get_privacy_state(const Tox *tox, uint32_t gro
     return gc_get_privacy_state(chat);
 }
 
+TOX_GROUP_TOPOLOGY tox_group_get_topology(const Tox *tox, uint32_t groupnumber, TOX_ERR_GROUP_STATE_QUERIES *error)
+{
+    const Messenger *m = tox;
+    const GC_Chat *chat = gc_get_group(m->group_handler, groupnumber);
+
+    if (chat == NULL) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_STATE_QUERIES_GROUP_NOT_FOUND);
+        return -1;
+    }
+
+    SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_STATE_QUERIES_OK);
+    return gc_get_topology(chat);
+}
+
 uint32_t tox_group_get_peer_limit(const Tox *tox, uint32_t groupnumber, TOX_ERR_GROUP_STATE_QUERIES *error)
 {
     const Messenger *m = tox;
@@ -2039,6 +2375,37 @@ bool tox_group_founder_set_privacy_state(Tox *tox, uint32_t groupnumber, TOX_GRO
     return 0;
 }
 
+bool tox_group_founder_set_topology(Tox *tox, uint32_t groupnumber, TOX_GROUP_TOPOLOGY topology,
+                                    TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY *error)
+{
+    Messenger *m = tox;
+    int ret = gc_founder_set_topology(m, groupnumber, topology);
+
+    switch (ret) {
+        case 0:
+            SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY_OK);
+            return 1;
+        case -1:
+            SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY_GROUP_NOT_FOUND);
+            return 0;
+        case -2:
+            SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY_INVALID);
+            return 0;
+        case -3:
+            SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY_PERMISSIONS);
+            return 0;
+        case -4:
+            SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY_FAIL_SET);
+            return 0;
+        case -5:
+            SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY_FAIL_SEND);
+            return 0;
+    }
+
+    /* can't happen */
+    return 0;
+}
+
 bool tox_group_founder_set_peer_limit(Tox *tox, uint32_t groupnumber, uint32_t maxpeers, TOX_ERR_GROUP_FOUNDER_SET_PEER_LIMIT *error)
 {
     Messenger *m = tox;
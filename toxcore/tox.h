@@ -101,6 +101,16 @@ extern "C" {
  * access multiple different Tox instances, no more than one API function can
  * operate on a single instance at any given time.
  *
+ * The exception are instances created with concurrent_send set in their
+ * options. On those, tox_friend_send_message, tox_file_send_chunk,
+ * tox_friend_send_lossy_packet and tox_friend_send_lossless_packet may be
+ * called from any number of threads at once, also while another thread runs
+ * tox_iterate or any other function. They only check their arguments and queue
+ * what they send for the friend; the next tox_iterate sends it. Everything
+ * else, adding and deleting friends included, must still be synchronised with
+ * tox_iterate, and a friend must not be deleted while other threads may send
+ * to it.
+ *
  * Functions that write to variable length byte arrays will always have a size
  * function associated with them. The result of this size function is only valid
  * until another mutating function (one that takes a pointer to non-const Tox)
@@ -133,6 +143,15 @@ extern "C" {
 typedef struct Tox Tox;
 #endif /* TOX_DEFINED */
 
+/**
+ * A host shares one UDP socket, DHT, onion and set of TCP relay connections
+ * between the Tox instances created on it, see tox_host_new.
+ */
+#ifndef TOX_HOST_DEFINED
+#define TOX_HOST_DEFINED
+typedef struct Tox_Host Tox_Host;
+#endif /* TOX_HOST_DEFINED */
+
 
 /*******************************************************************************
  *
@@ -386,6 +405,43 @@ typedef enum TOX_SAVEDATA_TYPE {
 } TOX_SAVEDATA_TYPE;
 
 
+/**
+ * Congestion control algorithm used for the connections to friends.
+ */
+typedef enum TOX_CONGESTION_CONTROL {
+
+    /**
+     * Estimate the available bandwidth from how fast the send queue drains.
+     */
+    TOX_CONGESTION_CONTROL_DEFAULT,
+
+    /**
+     * Delay based (LEDBAT-like). Backs off as soon as queues build up on the
+     * path, which makes it yield to other traffic. Good for background
+     * transfers.
+     */
+    TOX_CONGESTION_CONTROL_LEDBAT,
+
+    /**
+     * Model based (BBR-like). Sends at the measured bottleneck bandwidth and
+     * does not back off on random loss, which helps on lossy long distance
+     * paths.
+     */
+    TOX_CONGESTION_CONTROL_BBR,
+
+} TOX_CONGESTION_CONTROL;
+
+
+/**
+ * A clock for a Tox instance to read instead of the system clock, see the
+ * time_callback option.
+ *
+ * @return The time in milliseconds since the unix epoch. It must never go
+ *   back.
+ */
+typedef uint64_t tox_time_cb(void *user_data);
+
+
 /**
  * This struct contains all the startup options for Tox. You can either allocate
  * this object yourself, and pass it to tox_options_default, or call
@@ -476,6 +532,108 @@ struct Tox_Options {
     uint16_t tcp_port;
 
 
+    /**
+     * The number of worker threads used to encrypt and decrypt data packets
+     * sent to and received from friends.
+     *
+     * If this is 0, all encryption and decryption is done on the thread that
+     * calls tox_iterate. Setting it to a value greater than 0 only helps with
+     * many high bandwidth connections (file transfers, video) and costs that
+     * many extra threads. The maximum value is 64.
+     */
+    uint32_t crypto_threads;
+
+
+    /**
+     * The congestion control algorithm used for the connections to friends.
+     *
+     * Only affects the sending side of a connection, so it is compatible with
+     * friends using any other algorithm.
+     */
+    TOX_CONGESTION_CONTROL congestion_control;
+
+
+    /**
+     * Enable coalescing of small lossless packets (messages, typing
+     * notifications, receipts, custom lossless packets).
+     *
+     * When enabled, small lossless packets sent to the same friend between
+     * two tox_iterate calls are packed together into as few network packets
+     * as possible. This saves bandwidth for chatty traffic at the cost of
+     * delaying those packets until the next tox_iterate call. It is only used
+     * with friends whose client supports it.
+     */
+    bool coalesce_lossless_packets;
+
+
+    /**
+     * Directory to keep a log of the messages of each group chat in, one file
+     * per group named after its chat id. The directory must exist.
+     *
+     * If this is NULL no logs are kept. Peers who join a group or come back
+     * online ask a peer for the messages they missed, which are then passed
+     * to the group_history_message callback. Only peers that keep a log can
+     * answer them, and each of them answers a limited number of requests at a
+     * time, so catching up on a large log takes a while.
+     */
+    const char *group_history_dir;
+
+
+    /**
+     * The number of bytes of messages the log of each group holds. When a log
+     * is full the oldest messages are dropped. If this is 0, 4 MiB is used.
+     * It must be at least 64 KiB.
+     */
+    uint32_t group_history_size;
+
+
+    /**
+     * Let the group chats created or joined from now on share one connection
+     * to each TCP relay, instead of each group keeping connections of its own.
+     *
+     * Relays take one public key per connection, so these groups all use one
+     * encryption key, derived from the long term secret key. It stays the same
+     * across restarts and doesn't reveal the Tox ID, but peers and relays can
+     * tell that the groups using it are joined by the same user. Groups saved
+     * with it keep sharing connections when loaded with this option unset.
+     *
+     * Off by default. Friend connections are not affected.
+     */
+    bool shared_group_key;
+
+
+    /**
+     * Let the functions that send to friends be called from any thread, see
+     * the threading section.
+     *
+     * What they send is queued for each friend and sent by the next
+     * tox_iterate, in the order it was queued, as fast as the connection to
+     * the friend takes it. A friend can have up to 1024 sends queued; past
+     * that they fail with their SENDQ error. Anything queued for a friend who
+     * goes offline is dropped, without a read receipt for messages. The file
+     * number, position and state of a file chunk are only checked when it is
+     * sent; a chunk that fails them then is dropped.
+     */
+    bool concurrent_send;
+
+
+    /**
+     * The clock the instance reads the time from, to run instances on a
+     * simulated network. If this is NULL the system clock is used.
+     *
+     * Each instance, or host, keeps its own clock, so instances in one process
+     * can run on different clocks. It is called from the threads the instance
+     * uses as well as from the one that iterates it.
+     */
+    tox_time_cb *time_callback;
+
+
+    /**
+     * The pointer passed to time_callback.
+     */
+    void *time_user_data;
+
+
     /**
      * The type of savedata to load from.
      */
@@ -613,6 +771,11 @@ typedef enum TOX_ERR_NEW {
      */
     TOX_ERR_NEW_LOAD_BAD_FORMAT,
 
+    /**
+     * congestion_control was not a known congestion control algorithm.
+     */
+    TOX_ERR_NEW_BAD_CONGESTION_CONTROL,
+
 } TOX_ERR_NEW;
 
 
@@ -794,6 +957,71 @@ uint32_t tox_iteration_interval(const Tox *tox);
 void tox_iterate(Tox *tox);
 
 
+/*******************************************************************************
+ *
+ * :: Hosts of many accounts
+ *
+ ******************************************************************************/
+
+
+
+/**
+ * @brief Creates a host for running many Tox instances over one socket.
+ *
+ * Instances created on a host with tox_new_hosted share its UDP port, DHT,
+ * onion and TCP relay connections, so that every instance costs its own keys,
+ * friends and connections to them but not a socket or the background traffic
+ * of keeping a DHT and relays up.
+ *
+ * The DHT key is shared too and peers see it. A peer can't be friends with
+ * two instances of the same host, two instances of a host can't be friends
+ * with each other and they can't be in the same group chat.
+ *
+ * All the instances of a host must be used from the thread that iterates it.
+ *
+ * @param options The network options of the host: ipv6_enabled, udp_enabled,
+ *   the proxy, start_port, end_port and tcp_port. The others are ignored. If
+ *   this parameter is NULL, the default options are used.
+ *
+ * @return A new host on success or NULL on failure.
+ */
+Tox_Host *tox_host_new(const struct Tox_Options *options, TOX_ERR_NEW *error);
+
+/**
+ * Releases the host. All the instances created on it must have been killed
+ * with tox_kill before.
+ */
+void tox_host_kill(Tox_Host *host);
+
+/**
+ * Sends a "get nodes" request to the given bootstrap node, like tox_bootstrap.
+ * Bootstrapping the host is enough for all its instances.
+ */
+bool tox_host_bootstrap(Tox_Host *host, const char *address, uint16_t port, const uint8_t *public_key,
+                        TOX_ERR_BOOTSTRAP *error);
+
+/**
+ * Return the time in milliseconds before tox_host_iterate() should be called
+ * again for optimal performance.
+ */
+uint32_t tox_host_iteration_interval(const Tox_Host *host);
+
+/**
+ * The main loop of the host and of all its instances, which don't need
+ * tox_iterate to be called on them. It needs to be run in intervals of
+ * tox_host_iteration_interval() milliseconds.
+ */
+void tox_host_iterate(Tox_Host *host);
+
+/**
+ * @brief Creates a new Tox instance on host.
+ *
+ * Works like tox_new, except that the network options are the ones of the
+ * host.
+ */
+Tox *tox_new_hosted(Tox_Host *host, const struct Tox_Options *options, TOX_ERR_NEW *error);
+
+
 /*******************************************************************************
  *
  * :: Internal client information (Tox address/id)
@@ -2207,6 +2435,41 @@ bool tox_friend_send_lossy_packet(Tox *tox, uint32_t friend_number, const uint8_
 bool tox_friend_send_lossless_packet(Tox *tox, uint32_t friend_number, const uint8_t *data, size_t length,
                                      TOX_ERR_FRIEND_CUSTOM_PACKET *error);
 
+/**
+ * Protect the custom lossy packets starting with packet_id sent to a friend
+ * with forward error correction.
+ *
+ * For every num_data packets, num_parity parity packets are sent. As long as
+ * no more than num_parity of the num_data + num_parity packets are lost, the
+ * friend receives all the lossy packets without them being sent again. One
+ * parity packet is a plain XOR of the packets, more use a Reed-Solomon code.
+ *
+ * Groups of fewer than num_data packets are completed after a short timeout,
+ * or when tox_friend_lossy_packet_flush_fec is called. Packets are only protected
+ * if the friend supports it, and packets close to TOX_MAX_CUSTOM_PACKET_SIZE in
+ * length are never protected.
+ *
+ * @param friend_number The friend number of the friend the packets are sent to.
+ * @param packet_id The first byte of the packets, in the range 200-254.
+ * @param num_data The number of packets in a group, at most 32. 0 stops
+ *   protecting the packets.
+ * @param num_parity The number of parity packets per group, 1 to 8.
+ *
+ * @return true on success.
+ */
+bool tox_friend_lossy_packet_set_fec(Tox *tox, uint32_t friend_number, uint8_t packet_id, uint8_t num_data,
+                                     uint8_t num_parity, TOX_ERR_FRIEND_CUSTOM_PACKET *error);
+
+/**
+ * Send the parity packets of the custom lossy packets starting with packet_id
+ * sent so far instead of waiting for the group to fill up, for example at the
+ * end of a video frame.
+ *
+ * @return true on success.
+ */
+bool tox_friend_lossy_packet_flush_fec(Tox *tox, uint32_t friend_number, uint8_t packet_id,
+                                       TOX_ERR_FRIEND_CUSTOM_PACKET *error);
+
 /**
  * @param friend_number The friend number of the friend who sent a lossy packet.
  * @param data A byte array containing the received packet data.
@@ -2287,6 +2550,318 @@ uint16_t tox_self_get_udp_port(const Tox *tox, TOX_ERR_GET_PORT *error);
 uint16_t tox_self_get_tcp_port(const Tox *tox, TOX_ERR_GET_PORT *error);
 
 
+/*******************************************************************************
+ *
+ * :: Connection statistics
+ *
+ ******************************************************************************/
+
+
+
+/**
+ * The number of buckets of the time histograms. Bucket 0 counts times below
+ * 1 ms, bucket i counts times from 2^(i-1) up to 2^i ms and the last bucket
+ * counts all the longer ones.
+ */
+#define TOX_STATS_HISTOGRAM_BUCKETS    16
+
+/**
+ * The reasons received packets of a connection are dropped for.
+ */
+typedef enum TOX_STATS_DROP {
+
+    /**
+     * The packet could not be decrypted.
+     */
+    TOX_STATS_DROP_DECRYPT,
+
+    /**
+     * The packet was outside of the receive window or already received.
+     */
+    TOX_STATS_DROP_WINDOW,
+
+    /**
+     * The packet wasn't expected in the state the connection was in.
+     */
+    TOX_STATS_DROP_STATE,
+
+    /**
+     * The packet was decrypted but malformed.
+     */
+    TOX_STATS_DROP_INVALID,
+
+} TOX_STATS_DROP;
+
+/**
+ * The number of TOX_STATS_DROP values.
+ */
+#define TOX_STATS_DROP_REASONS         4
+
+/**
+ * The length of the address strings in Tox_Relay_Stats, including the NUL
+ * terminator.
+ */
+#define TOX_STATS_ADDRESS_LENGTH       64
+
+/**
+ * Counters of the packets of one or more friend connections. They only ever
+ * go up for as long as the Tox instance lives.
+ */
+struct Tox_Connection_Counters {
+
+    uint64_t packets_sent;
+
+    /**
+     * Bytes of the encrypted packets, excluding the UDP or TCP headers.
+     */
+    uint64_t bytes_sent;
+
+    /**
+     * The packets of packets_sent that were only sent through TCP relays.
+     */
+    uint64_t packets_sent_tcp;
+
+    uint64_t packets_received;
+
+    uint64_t bytes_received;
+
+    uint64_t packets_received_tcp;
+
+    /**
+     * Lossless data packets sent again because the friend requested them.
+     */
+    uint64_t retransmits;
+
+    /**
+     * The times the connection used up all the packets congestion control
+     * allowed it to send.
+     */
+    uint64_t congestion_events;
+
+    /**
+     * Received packets that were dropped, indexed by TOX_STATS_DROP.
+     */
+    uint64_t drops[TOX_STATS_DROP_REASONS];
+
+    /**
+     * Round trip times of acknowledged lossless packets.
+     */
+    uint64_t rtt_histogram[TOX_STATS_HISTOGRAM_BUCKETS];
+
+};
+
+/**
+ * A snapshot of the connection to a friend.
+ */
+struct Tox_Friend_Stats {
+
+    struct Tox_Connection_Counters counters;
+
+    /**
+     * Whether there is a connection to the friend at all, online or not. If
+     * it is false, only counters holds anything.
+     */
+    bool connected;
+
+    /**
+     * Whether the friend is online, after the handshake.
+     */
+    bool established;
+
+    /**
+     * Whether packets to the friend go over UDP.
+     */
+    bool direct;
+
+    /**
+     * The number of TCP relays the friend is reachable through.
+     */
+    uint32_t online_tcp_relays;
+
+    /**
+     * Lossless packets per second congestion control allows to send.
+     */
+    double send_rate;
+
+    /**
+     * Packets per second received.
+     */
+    double recv_rate;
+
+    /**
+     * The lowest round trip time seen recently, in ms.
+     */
+    uint64_t rtt;
+
+    /**
+     * The smoothed round trip time, in ms.
+     */
+    uint64_t smoothed_rtt;
+
+    /**
+     * Lossless packets sent but not yet acknowledged.
+     */
+    uint32_t send_queue;
+
+    /**
+     * Lossless packets received out of order, waiting for the ones before
+     * them.
+     */
+    uint32_t recv_queue;
+
+    /**
+     * Milliseconds since the last congestion event, UINT64_MAX if there was
+     * none.
+     */
+    uint64_t since_congestion_event;
+
+    /**
+     * Milliseconds from starting the connection until the handshake finished,
+     * 0 if it hasn't.
+     */
+    uint64_t handshake_time;
+
+};
+
+/**
+ * A snapshot of a connection to a TCP relay.
+ */
+struct Tox_Relay_Stats {
+
+    uint8_t public_key[TOX_PUBLIC_KEY_SIZE];
+
+    /**
+     * The IP address of the relay as a NUL terminated string.
+     */
+    char address[TOX_STATS_ADDRESS_LENGTH];
+
+    uint16_t port;
+
+    bool connected;
+
+    /**
+     * Whether the connection was closed because no friend needed it, to be
+     * opened again when one does.
+     */
+    bool sleeping;
+
+    /**
+     * Whether onion packets are sent through the relay.
+     */
+    bool onion;
+
+    /**
+     * The number of friends using the relay.
+     */
+    uint32_t users;
+
+    /**
+     * The times the connection to the relay was lost and opened again.
+     */
+    uint32_t reconnects;
+
+    /**
+     * Seconds the relay has been connected for, 0 if it isn't.
+     */
+    uint64_t connected_for;
+
+    /**
+     * Counters of the TCP packets, of all the connections to the relay so far.
+     * The bytes include the length and MAC of every packet.
+     */
+    uint64_t packets_sent;
+
+    uint64_t bytes_sent;
+
+    uint64_t packets_received;
+
+    uint64_t bytes_received;
+
+};
+
+/**
+ * Statistics of a Tox instance as a whole.
+ */
+struct Tox_Stats {
+
+    /**
+     * Counters of the UDP socket. The socket of a host is shared by all the
+     * instances created on it, so they count the packets of all of them.
+     */
+    uint64_t udp_packets_sent;
+
+    uint64_t udp_bytes_sent;
+
+    uint64_t udp_send_failures;
+
+    uint64_t udp_packets_received;
+
+    uint64_t udp_bytes_received;
+
+    /**
+     * Received UDP packets of a type that isn't handled.
+     */
+    uint64_t udp_packets_unhandled;
+
+    /**
+     * The counters of all friend connections, including the ones that were
+     * closed since.
+     */
+    struct Tox_Connection_Counters friends;
+
+    /**
+     * Friend connections open, open and online, and online over UDP.
+     */
+    uint32_t connections;
+
+    uint32_t connections_established;
+
+    uint32_t connections_direct;
+
+    /**
+     * Received packets that didn't belong to any friend connection.
+     */
+    uint64_t packets_no_connection;
+
+    /**
+     * Times from starting a friend connection until its handshake finished.
+     */
+    uint64_t handshake_histogram[TOX_STATS_HISTOGRAM_BUCKETS];
+
+    /**
+     * The number of TCP relay connections, including the sleeping ones.
+     */
+    uint32_t tcp_relays;
+
+};
+
+/**
+ * Copies the statistics of the Tox instance into stats.
+ *
+ * Everything counted is counted all the time, so this is cheap and can be
+ * called as often as needed, for example once a second for monitoring.
+ */
+void tox_self_get_stats(const Tox *tox, struct Tox_Stats *stats);
+
+/**
+ * Copies a snapshot of the connection to a friend into stats.
+ *
+ * @return true on success.
+ */
+bool tox_friend_get_stats(const Tox *tox, uint32_t friend_number, struct Tox_Friend_Stats *stats,
+                          TOX_ERR_FRIEND_QUERY *error);
+
+/**
+ * Copies snapshots of up to max TCP relay connections into stats.
+ *
+ * @param stats If this parameter is NULL, the relays are only counted and max
+ *   is ignored.
+ *
+ * @return the number of relays copied.
+ */
+size_t tox_self_get_relay_stats(const Tox *tox, struct Tox_Relay_Stats *stats, size_t max);
+
+
 /*******************************************************************************
  *
  * :: Group chats
@@ -2372,6 +2947,27 @@ typedef enum TOX_GROUP_PRIVACY_STATE {
 } TOX_GROUP_PRIVACY_STATE;
 
 
+/**
+ * Represents the way group broadcasts reach the peers of a group.
+ */
+typedef enum TOX_GROUP_TOPOLOGY {
+
+    /**
+     * Every peer is connected to every other peer and sends its broadcasts to all of them.
+     */
+    TOX_GROUP_TOPOLOGY_FULL_MESH,
+
+    /**
+     * Every peer is connected to a few neighbours, broadcasts are signed by their sender and
+     * relayed between neighbours until they reach the whole group. Suited for large groups.
+     *
+     * Private messages can only be sent to peers that we are connected to.
+     */
+    TOX_GROUP_TOPOLOGY_OVERLAY,
+
+} TOX_GROUP_TOPOLOGY;
+
+
 /**
  * Represents group roles.
  *
@@ -3019,6 +3615,14 @@ uint32_t tox_group_get_number_groups(const Tox *tox);
 TOX_GROUP_PRIVACY_STATE tox_group_get_privacy_state(const Tox *tox, uint32_t groupnumber,
         TOX_ERR_GROUP_STATE_QUERIES *error);
 
+/**
+ * Return the topology of the group designated by the given group number. If group number
+ * is invalid, the return value is unspecified.
+ *
+ * @see the `Group chat founder controls` section for the respective set function.
+ */
+TOX_GROUP_TOPOLOGY tox_group_get_topology(const Tox *tox, uint32_t groupnumber, TOX_ERR_GROUP_STATE_QUERIES *error);
+
 /**
  * @param groupnumber The group number of the group the topic change is intended for.
  * @param privacy_state The new privacy state.
@@ -3290,6 +3894,32 @@ typedef void tox_group_private_message_cb(Tox *tox, uint32_t groupnumber, uint32
  */
 void tox_callback_group_private_message(Tox *tox, tox_group_private_message_cb *callback, void *user_data);
 
+/**
+ * @param groupnumber The group number of the group the message was sent to.
+ * @param public_key The public key of the sender, which need not be in the group anymore.
+ * @param nick The nickname the sender had.
+ * @param nick_length The length of the nickname.
+ * @param type The type of the message.
+ * @param time The unix time the sender sent the message at, by the sender's clock.
+ * @param message The message data.
+ * @param length The length of the message.
+ */
+typedef void tox_group_history_message_cb(Tox *tox, uint32_t groupnumber, const uint8_t *public_key,
+        const uint8_t *nick, size_t nick_length, TOX_MESSAGE_TYPE type, uint64_t time, const uint8_t *message,
+        size_t length, void *user_data);
+
+
+/**
+ * Set the callback for the `group_history_message` event. Pass NULL to unset.
+ *
+ * This event is triggered for each message we missed while catching up on a group,
+ * when group_history_dir is set in the options. Each message is signed by its sender
+ * together with its time and type, messages whose signature doesn't check out are
+ * dropped. The nickname isn't signed, it's the one the peer we got the message from
+ * knew the sender by.
+ */
+void tox_callback_group_history_message(Tox *tox, tox_group_history_message_cb *callback, void *user_data);
+
 
 /*******************************************************************************
  *
@@ -3596,6 +4226,59 @@ typedef enum TOX_ERR_GROUP_FOUNDER_SET_PRIVACY_STATE {
 bool tox_group_founder_set_privacy_state(Tox *tox, uint32_t groupnumber, TOX_GROUP_PRIVACY_STATE privacy_state,
         TOX_ERR_GROUP_FOUNDER_SET_PRIVACY_STATE *error);
 
+typedef enum TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY {
+
+    /**
+     * The function returned successfully.
+     */
+    TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY_OK,
+
+    /**
+     * The group number passed did not designate a valid group.
+     */
+    TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY_GROUP_NOT_FOUND,
+
+    /**
+     * TOX_GROUP_TOPOLOGY is an invalid type.
+     */
+    TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY_INVALID,
+
+    /**
+     * The caller does not have the required permissions to set the topology.
+     */
+    TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY_PERMISSIONS,
+
+    /**
+     * The topology could not be set. This may occur due to an error related to
+     * cryptographic signing of the new shared state.
+     */
+    TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY_FAIL_SET,
+
+    /**
+     * The packet failed to send.
+     */
+    TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY_FAIL_SEND,
+
+} TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY;
+
+
+/**
+ * Set the group topology.
+ *
+ * This function sets the group's topology, creates a new group shared state
+ * including the change, and distributes it to the rest of the group.
+ *
+ * If an attempt is made to set the topology to the one the group already uses, the function
+ * call will be successful and no action will be taken.
+ *
+ * @param groupnumber The group number of the group for which we wish to change the topology.
+ * @param topology The topology we wish to set the group to.
+ *
+ * @return true on success.
+ */
+bool tox_group_founder_set_topology(Tox *tox, uint32_t groupnumber, TOX_GROUP_TOPOLOGY topology,
+                                    TOX_ERR_GROUP_FOUNDER_SET_TOPOLOGY *error);
+
 typedef enum TOX_ERR_GROUP_FOUNDER_SET_PEER_LIMIT {
 
     /**
@@ -34,26 +34,38 @@
 #include "util.h"
 
 
-/* don't call into system billions of times for no reason */
-static uint64_t unix_time_value;
-static uint64_t unix_base_time_value;
-
-void unix_time_update()
+/* don't call into system billions of times for no reason
+ *
+ * The time of an instance is read by its threads, so it is only touched atomically. It is never
+ * moved back if a thread that read the clock earlier stores it after another thread.
+ */
+void unix_time_update(Mono_Time *mono_time)
 {
-    if (unix_base_time_value == 0)
-        unix_base_time_value = ((uint64_t)time(NULL) - (current_time_monotonic() / 1000ULL));
+    uint64_t value = (current_time_monotonic(mono_time) / 1000ULL) + mono_time->unix_base_time_value;
+#if defined(__ATOMIC_RELAXED)
+    uint64_t old = __atomic_load_n(&mono_time->unix_time_value, __ATOMIC_RELAXED);
+
+    while (old < value
+            && !__atomic_compare_exchange_n(&mono_time->unix_time_value, &old, value, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED));
 
-    unix_time_value = (current_time_monotonic() / 1000ULL) + unix_base_time_value;
+#else
+    mono_time->unix_time_value = value;
+#endif
 }
 
-uint64_t unix_time()
+uint64_t unix_time(const Mono_Time *mono_time)
 {
-    return unix_time_value;
+#if defined(__ATOMIC_RELAXED)
+    return __atomic_load_n(&mono_time->unix_time_value, __ATOMIC_RELAXED);
+#else
+    return mono_time->unix_time_value;
+#endif
 }
 
-int is_timeout(uint64_t timestamp, uint64_t timeout)
+int is_timeout(const Mono_Time *mono_time, uint64_t timestamp, uint64_t timeout)
 {
-    return timestamp + timeout <= unix_time();
+    return timestamp + timeout <= unix_time(mono_time);
 }
 
 
@@ -29,6 +29,8 @@
 #include <stdint.h>
 #include <pthread.h>
 
+#include "network.h"
+
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define POWER_OF_2(x) (((x) != 0) && (((x) & ((~(x)) + 1)) == (x)))
 
@@ -47,9 +49,10 @@
 #define CHAT_ID(key) (key + ENC_PUBLIC_KEY)
 
 
-void unix_time_update();
-uint64_t unix_time();
-int is_timeout(uint64_t timestamp, uint64_t timeout);
+/* The unix time of mono_time, in seconds, as of the last unix_time_update(). */
+void unix_time_update(Mono_Time *mono_time);
+uint64_t unix_time(const Mono_Time *mono_time);
+int is_timeout(const Mono_Time *mono_time, uint64_t timestamp, uint64_t timeout);
 
 
 /* id functions */
@@ -70,6 +73,7 @@ uint16_t lendian_to_host16(uint16_t lendian);
 #define host_tolendian16(x) lendian_to_host16(x)
 
 void host_to_lendian32(uint8_t *dest,  uint32_t num);
+void lendian_to_host32(uint32_t *dest, const uint8_t *lendian);
 
 /* state load/save */
 typedef int (*load_state_callback_func)(void *outer, const uint8_t *data, uint32_t len, uint16_t type);